@@ -107,17 +107,59 @@ cleanup() {
 }
 
 
+# Run a probe command, bounded by PROBE_TIMEOUT when timeout(1) exists.
+probe() {
+	if [ -n "$TIMEOUT" ]; then
+		"$TIMEOUT" -k 2 "$PROBE_TIMEOUT" "$@"
+	else
+		"$@"
+	fi
+}
+
+# The independent sections are collected by background jobs, each into
+# its own file. wait_jobs waits on them for at most PROBE_TIMEOUT seconds
+# in total, so a stuck device cannot hang the script; what a job has
+# written until then is kept and the section is marked as timed out.
+JOB_PIDS=()
+JOB_NAMES=()
+
+start_job() {
+	local name=$1
+	shift
+	( "$@" ) < /dev/null &
+	JOB_PIDS+=($!)
+	JOB_NAMES+=("$name")
+}
+
+wait_jobs() {
+	local i pid deadline=$((SECONDS + PROBE_TIMEOUT))
+	for i in "${!JOB_PIDS[@]}"; do
+		pid=${JOB_PIDS[$i]}
+		while kill -0 $pid 2>/dev/null && [ $SECONDS -lt $deadline ]; do
+			sleep 0.1
+		done
+		if kill -0 $pid 2>/dev/null; then
+			pkill -KILL -P $pid 2>/dev/null
+			kill -KILL $pid 2>/dev/null
+			echo "${JOB_NAMES[$i]}: timed out after $PROBE_TIMEOUT seconds" >> $TEMPDIR/timeouts.tmp
+		fi
+		wait $pid 2>/dev/null
+	done
+	JOB_PIDS=()
+	JOB_NAMES=()
+}
+
 withaplay() {
         echo "!!Aplay/Arecord output" >> $FILE
         echo "!!--------------------" >> $FILE
         echo "" >> $FILE
        	echo "APLAY" >> $FILE
 	echo "" >> $FILE 
-	aplay -l >> $FILE 2>&1
+	probe aplay -l >> $FILE 2>&1
         echo "" >> $FILE
        	echo "ARECORD" >> $FILE
 	echo "" >> $FILE
-	arecord -l >> $FILE 2>&1
+	probe arecord -l >> $FILE 2>&1
 	echo "" >> $FILE
 }
 
@@ -138,8 +180,8 @@ withamixer() {
 		[ -f "$f" ] && read -r CARD_NAME < "$f" || continue
 		echo "!!-------Mixer controls for card $CARD_NAME" >> $FILE
 		echo "" >>$FILE
-		amixer -c "$CARD_NAME" info >> $FILE 2>&1
-		amixer -c "$CARD_NAME" >> $FILE 2>&1
+		probe amixer -c "$CARD_NAME" info >> $FILE 2>&1
+		probe amixer -c "$CARD_NAME" >> $FILE 2>&1
 		echo "" >> $FILE
 	done
 	echo "" >> $FILE
@@ -149,7 +191,7 @@ withalsactl() {
 	echo "!!Alsactl output" >> $FILE
         echo "!!--------------" >> $FILE
         echo "" >> $FILE
-	alsactl -f $TEMPDIR/alsactl.tmp store
+	probe alsactl -f $TEMPDIR/alsactl.tmp store
 	echo "--startcollapse--" >> $FILE
 	cat $TEMPDIR/alsactl.tmp >> $FILE
 	echo "--endcollapse--" >> $FILE
@@ -233,7 +275,7 @@ withdmesg() {
 	echo "!!ALSA/HDA dmesg" >> $FILE
 	echo "!!--------------" >> $FILE
 	echo "" >> $FILE
-	dmesg | grep -C1 -E 'ALSA|HDA|HDMI|snd[_-]|sound|audio|hda.codec|hda.intel' >> $FILE
+	probe dmesg | grep -C1 -E 'ALSA|HDA|HDMI|snd[_-]|sound|audio|hda.codec|hda.intel' >> $FILE
 	echo "" >> $FILE
 	echo "" >> $FILE
 }
@@ -244,6 +286,7 @@ withpackages() {
 	RPM="$(command -v rpmquery)"
 	DPKG="$(command -v dpkg)"
 	[ -n "$RPM$DPKG" ] || return
+	[ -z "$FAST" ] || return
 	local PATTERN='(alsa-(lib|oss|plugins|tools|(topology|ucm)-conf|utils|sof-firmware)|libalsa|tinycompress|sof-firmware)'
 	{
         echo "!!Packages installed"
@@ -257,19 +300,37 @@ withpackages() {
 	} >> "$FILE"
 }
 
+with_section() {
+	FILE="$TEMPDIR/with-$1.tmp"
+	with$1
+}
+
 withall() {
-	withdevices
-	withconfigs
-	withaplay
-	withamixer
-	withalsactl
-	withmodules
-	withsysfs
-	withdmesg
-	withpackages
+	local s
+	local SECTIONS="devices configs aplay amixer alsactl modules sysfs dmesg packages"
+	for s in $SECTIONS; do
+		start_job "$s" with_section $s
+	done
+	wait_jobs
+	for s in $SECTIONS; do
+		cat "$TEMPDIR/with-$s.tmp" >> $FILE 2>/dev/null
+	done
+	withtimeouts
 	WITHALL="no"
 }
 
+withtimeouts() {
+	if [ -s "$TEMPDIR/timeouts.tmp" ]; then
+		echo "!!Timed out sections" >> $FILE
+		echo "!!-------------------" >> $FILE
+		echo "" >> $FILE
+		cat $TEMPDIR/timeouts.tmp >> $FILE
+		echo "" >> $FILE
+		echo "" >> $FILE
+		rm -f $TEMPDIR/timeouts.tmp
+	fi
+}
+
 get_alsa_library_version() {
 	ALSA_LIB_VERSION=$(grep VERSION_STR /usr/include/alsa/version.h 2>/dev/null | awk '{ print $3 }' | sed 's/"//g')
 
@@ -317,12 +378,38 @@ done
 LSPCI="$(command -v lspci)"
 TPUT="$(command -v tput)"
 DIALOG="$(command -v dialog)"
+TIMEOUT="$(command -v timeout)"
 
 # Check to see if sysfs is enabled in the kernel. We'll need this later on
 SYSFS=$(mount | grep sysfs | awk '{ print $3 }');
 
+# Options which change the collection itself are needed before it starts
+PROBE_TIMEOUT=30
+FAST=""
+ARGS=("$@")
+for i in "${!ARGS[@]}"; do
+	case "${ARGS[$i]}" in
+	--fast)
+		FAST="yes"
+		;;
+	--timeout)
+		PROBE_TIMEOUT="${ARGS[$((i + 1))]}"
+		;;
+	esac
+done
+case "$PROBE_TIMEOUT" in
+	''|*[!0-9]*|0)
+		echo "Invalid --timeout value: $PROBE_TIMEOUT"
+		exit 1
+		;;
+esac
+
 # Check modprobe config files for sound related options
-SNDOPTIONS=$(modprobe -c | sed -n 's/^options \(snd[-_][^ ]*\)/\1:/p')
+if [ -z "$FAST" ]; then
+	SNDOPTIONS=$(probe modprobe -c | sed -n 's/^options \(snd[-_][^ ]*\)/\1:/p')
+else
+	SNDOPTIONS=""
+fi
 
 KEEP_OUTPUT=
 NFILE=""
@@ -465,33 +552,47 @@ fi
 
 awk '{ print $2 " (card " $1 ")" }' < /proc/asound/modules > $TEMPDIR/alsamodules.tmp 2> /dev/null
 cat /proc/asound/cards > $TEMPDIR/alsacards.tmp
-if [[ ! -z "$LSPCI" ]]; then
+
+# The probes below are independent of each other, run them in parallel
+probe_lspci() {
+	local class
 	for class in 0401 0402 0403; do
-		lspci -vvnn -d "::$class" | sed -n '/^[^\t]/,+1p'
+		probe lspci -vvnn -d "::$class" | sed -n '/^[^\t]/,+1p'
 	done > $TEMPDIR/lspci.tmp
+}
+
+probe_lsusb() {
+	local f id
+	for f in /proc/asound/card[0-9]*/usbbus; do
+		test -f "$f" || continue
+		id=$(sed 's@/@:@' $f)
+		probe lsusb -v -s $id >> $TEMPDIR/lsusb.tmp 2> /dev/null
+	done
+}
+
+if [[ ! -z "$LSPCI" ]]; then
+	start_job lspci probe_lspci
 fi
 
 #Check for HDA-Intel cards codec#*
-cat /proc/asound/card*/codec\#* > $TEMPDIR/alsa-hda-intel.tmp 2> /dev/null
+start_job "HDA codecs" probe cat /proc/asound/card*/codec\#* > $TEMPDIR/alsa-hda-intel.tmp 2> /dev/null
 
 #Check for AC97 cards codec
-cat /proc/asound/card*/codec97\#0/ac97\#0-0 > $TEMPDIR/alsa-ac97.tmp 2> /dev/null
-cat /proc/asound/card*/codec97\#0/ac97\#0-0+regs > $TEMPDIR/alsa-ac97-regs.tmp 2> /dev/null
-
-#Check for USB descriptors
-if [ -x /usr/bin/lsusb ]; then
-    for f in /proc/asound/card[0-9]*/usbbus; do
-	test -f "$f" || continue
-	id=$(sed 's@/@:@' $f)
-	lsusb -v -s $id >> $TEMPDIR/lsusb.tmp 2> /dev/null
-    done
+start_job "AC97 codecs" probe cat /proc/asound/card*/codec97\#0/ac97\#0-0 > $TEMPDIR/alsa-ac97.tmp 2> /dev/null
+start_job "AC97 registers" probe cat /proc/asound/card*/codec97\#0/ac97\#0-0+regs > $TEMPDIR/alsa-ac97-regs.tmp 2> /dev/null
+
+#Check for USB descriptors, expensive with many devices
+if [ -x /usr/bin/lsusb -a -z "$FAST" ]; then
+	start_job lsusb probe_lsusb
 fi
 
 #Check for USB stream setup
-cat /proc/asound/card*/stream[0-9]* > $TEMPDIR/alsa-usbstream.tmp 2> /dev/null
+start_job "USB streams" probe cat /proc/asound/card*/stream[0-9]* > $TEMPDIR/alsa-usbstream.tmp 2> /dev/null
 
 #Check for USB mixer setup
-cat /proc/asound/card*/usbmixer > $TEMPDIR/alsa-usbmixer.tmp 2> /dev/null
+start_job "USB mixers" probe cat /proc/asound/card*/usbmixer > $TEMPDIR/alsa-usbmixer.tmp 2> /dev/null
+
+wait_jobs
 
 #Fetch the info, and put it in $FILE in a nice readable format.
 if [[ -z $PASTEBIN ]]; then
@@ -631,7 +732,7 @@ if [ "$SNDOPTIONS" ]; then
 echo "!!Modprobe options (Sound related)" >> $FILE
 echo "!!--------------------------------" >> $FILE
 echo "" >> $FILE
-modprobe -c|sed -n 's/^options \(snd[-_][^ ]*\)/\1:/p' >> $FILE
+echo "$SNDOPTIONS" >> $FILE
 echo "" >> $FILE
 echo "" >> $FILE
 fi
@@ -658,7 +759,7 @@ if [ -d "$SYSFS" ]; then
 		driver=$(readlink -f "$cdir/device/driver")
 		echo "Driver: $driver" >> $FILE
 		echo "Tree:" >> $FILE
-		tree --noreport $cdir -L 2 | sed -e 's/^/\t/g' >> $FILE
+		[ -n "$FAST" ] || tree --noreport $cdir -L 2 | sed -e 's/^/\t/g' >> $FILE
 		echo "" >> $FILE
 	done
 	echo "" >> $FILE
@@ -720,6 +821,8 @@ if [ -s "$TEMPDIR/alsa-usbmixer.tmp" ]; then
 	echo "" >> $FILE
 fi
 
+withtimeouts
+
 #If no command line options are specified, then run as though --with-all was specified
 if [ -z "$1" ]; then
 	update
@@ -758,6 +861,11 @@ if [ -n "$1" ]; then
 		--with-all)
 			withall
 			;;
+		--fast)
+			;;
+		--timeout)
+			shift
+			;;
 		--with-aplay)
 			withaplay
 			WITHALL="no"
@@ -819,6 +927,11 @@ if [ -n "$1" ]; then
 			echo "	--with-dmesg (shows the ALSA/HDA kernel messages)"
 			echo "	--with-packages (includes known packages installed)"
 			echo ""
+			echo "	--fast (skip the expensive probes: lsusb descriptors,"
+			echo "	    packages, modprobe options and sysfs trees)"
+			echo "	--timeout SECONDS (bound the time spent on the probes,"
+			echo "	    default 30)"
+			echo ""
 			echo "	--output FILE (specify the file to output for no-upload mode)"
 			echo "	--update (check server for script updates)"
 			echo "	--upload (upload contents to remote server)"
@@ -52,6 +52,8 @@ int use_syslog = 0;
 char *command;
 char *statefile = NULL;
 char *lockfile = SYS_LOCKFILE;
+char *cachefile = NULL;
+char *profilefile = NULL;
 
 #define TITLE	0x0100
 #define HEADER	0x0200
@@ -80,6 +82,7 @@ static struct arg args[] = {
 { 'l', "lock", "use file locking to serialize concurrent access" },
 { 'L', "no-lock", "do not use file locking to serialize concurrent access" },
 { FILEARG | 'O', "lock-state-file", "state lock file path (default " SYS_LOCKFILE ")" },
+{ FILEARG | 'C', "cache", "compiled state cache used by restore (default none)" },
 { 'F', "force", "try to restore the matching controls as much as possible" },
 { 0, NULL, "  (default mode)" },
 { 'g', "ignore", "ignore 'No soundcards found' error" },
@@ -89,8 +92,13 @@ static struct arg args[] = {
 { FILEARG | 'r', "runstate", "save restore and init state to this file (only errors)" },
 { 0, NULL, "  default settings is 'no file set'" },
 { 'R', "remove", "remove runstate file at first, otherwise append errors" },
+{ FILEARG | 'Z', "profile", "write store/restore/init timings to this file" },
+{ 0, NULL, "  (JSON, '-' for stdout or 'syslog')" },
 { INTARG | 'p', "period", "store period in seconds for the daemon command" },
+{ INTARG | 'W', "save-delay", "store delay in ms after the last change (daemon)" },
 { FILEARG | 'e', "pid-file", "pathname for the process id (daemon mode)" },
+{ FILEARG | 'M', "monitor-format", "monitor output format: text, json or binary" },
+{ INTARG | 'T', "monitor-stats", "report the event rates every # seconds (monitor)" },
 { HEADER, NULL, "Available init options:" },
 { ENVARG | 'E', "env", "set environment variable for init phase (NAME=VALUE)" },
 { FILEARG | 'i', "initfile", "main configuation file for init phase" },
@@ -242,6 +250,9 @@ int main(int argc, char *argv[])
 	int removestate = 0;
 	int init_fallback = 1; /* new default behavior */
 	int period = 5*60;
+	int save_delay = 30000;
+	int monitor_format = MONITOR_TEXT;
+	int monitor_stats = 0;
 	int background = 0;
 	int daemoncmd = 0;
 	int use_nice = NO_NICE;
@@ -303,6 +314,9 @@ int main(int argc, char *argv[])
 		case 'O':
 			lockfile = optarg;
 			break;
+		case 'C':
+			cachefile = optarg;
+			break;
 		case 'F':
 			force_restore = 1;
 			break;
@@ -334,6 +348,9 @@ int main(int argc, char *argv[])
 		case 'R':
 			removestate = 1;
 			break;
+		case 'Z':
+			profilefile = optarg;
+			break;
 		case 'P':
 			force_restore = 0;
 			break;
@@ -344,9 +361,32 @@ int main(int argc, char *argv[])
 			else if (period > 24*60*60)
 				period = 24*60*60;
 			break;
+		case 'W':
+			save_delay = atoi(optarg);
+			if (save_delay < 0)
+				save_delay = 30000;
+			break;
 		case 'e':
 			pidfile = optarg;
 			break;
+		case 'M':
+			if (!strcmp(optarg, "text")) {
+				monitor_format = MONITOR_TEXT;
+			} else if (!strcmp(optarg, "json")) {
+				monitor_format = MONITOR_JSON;
+			} else if (!strcmp(optarg, "binary")) {
+				monitor_format = MONITOR_BINARY;
+			} else {
+				fprintf(stderr, "unknown monitor format '%s'\n", optarg);
+				res = EXIT_FAILURE;
+				goto out;
+			}
+			break;
+		case 'T':
+			monitor_stats = atoi(optarg);
+			if (monitor_stats < 0)
+				monitor_stats = 0;
+			break;
 		case 'b':
 			background = 1;
 			break;
@@ -427,30 +467,36 @@ int main(int argc, char *argv[])
 
 	snd_lib_error_set_handler(error_handler);
 
+	/* the start of the profiled time */
+	profile_now();
+
 	if (!strcmp(cmd, "init")) {
 		res = init(cfgdir, initfile, initflags | FLAG_UCM_FBOOT | FLAG_UCM_BOOT, cardname);
 		snd_config_update_free_global();
+		profile_report(cmd);
 	} else if (!strcmp(cmd, "store")) {
 		res = save_state(cfgfile, cardname);
+		profile_report(cmd);
 	} else if (!strcmp(cmd, "restore") ||
                    !strcmp(cmd, "rdaemon") ||
 		   !strcmp(cmd, "nrestore")) {
 		if (removestate)
 			remove(statefile);
 		res = load_state(cfgdir, cfgfile, initfile, initflags, cardname, init_fallback);
+		profile_report(cmd);
 		if (!strcmp(cmd, "rdaemon")) {
 			do_nice(use_nice, sched_idle);
-			res = state_daemon(cfgfile, cardname, period, pidfile);
+			res = state_daemon(cfgfile, cardname, period, save_delay, pidfile);
 		}
 		if (!strcmp(cmd, "nrestore"))
 			res = state_daemon_kill(pidfile, "rescan");
 	} else if (!strcmp(cmd, "daemon")) {
 		do_nice(use_nice, sched_idle);
-		res = state_daemon(cfgfile, cardname, period, pidfile);
+		res = state_daemon(cfgfile, cardname, period, save_delay, pidfile);
 	} else if (!strcmp(cmd, "kill")) {
 		res = state_daemon_kill(pidfile, cardname);
 	} else if (!strcmp(cmd, "monitor")) {
-		res = monitor(cardname);
+		res = monitor(cardname, monitor_format, monitor_stats);
 	} else if (!strcmp(cmd, "clean")) {
 		res = clean(cardname, extra_args);
 	} else if (!strcmp(cmd, "dump-state")) {
@@ -463,6 +509,7 @@ int main(int argc, char *argv[])
 	}
 
 	snd_config_update_free_global();
+	init_cleanup();
 	if (use_syslog) {
 		if (daemoncmd)
 			syslog(LOG_INFO, "alsactl daemon stopped");
@@ -1,4 +1,5 @@
 #include <stdbool.h>
+#include <stdint.h>
 #include <alsa/asoundlib.h>
 
 extern int debugflag;
@@ -9,6 +10,8 @@ extern int use_syslog;
 extern char *command;
 extern char *statefile;
 extern char *lockfile;
+extern char *cachefile;
+extern char *profilefile;
 
 struct snd_card_iterator {
 	int card;
@@ -40,6 +43,10 @@ void error_handler(const char *file, int line, const char *function, int err, co
 #define FLAG_UCM_BOOT		(1<<2)
 #define FLAG_UCM_DEFAULTS	(1<<3)
 
+#define MONITOR_TEXT		0
+#define MONITOR_JSON		1
+#define MONITOR_BINARY		2
+
 void snd_card_iterator_init(struct snd_card_iterator *iter, int cardno);
 int snd_card_iterator_sinit(struct snd_card_iterator *iter, const char *cardname);
 const char *snd_card_iterator_next(struct snd_card_iterator *iter);
@@ -47,26 +54,55 @@ int snd_card_iterator_error(struct snd_card_iterator *iter);
 
 int load_configuration(const char *file, snd_config_t **top, int *open_failed);
 int init(const char *cfgdir, const char *file, int flags, const char *cardname);
+void init_cleanup(void);
 int init_ucm(int flags, int cardno);
 int state_lock(const char *file, int timeout);
 int state_unlock(int fd, const char *file);
 int save_state(const char *file, const char *cardname);
+int ctl_value_equal(snd_ctl_elem_type_t type, unsigned int count,
+		    snd_ctl_elem_value_t *ctl1, snd_ctl_elem_value_t *ctl2);
+int cache_save(const char *cachefile, const char *file, const char *cardname);
+int cache_restore(const char *cachefile, const char *file,
+		  const char *cardname, int initflags);
+struct state_cache;
+void state_cache_free(struct state_cache *cache);
+int state_cache_card(struct state_cache *cache, int cardno);
+int state_cache_control(struct state_cache *cache, snd_ctl_t *handle,
+			snd_ctl_elem_id_t *id);
+int save_state_cached(struct state_cache **cache, const char *file,
+		      const char *cardname);
+void state_meta_forget(snd_ctl_t *handle, snd_ctl_elem_id_t *id);
+void state_meta_free(void);
 int load_state(const char *cfgdir, const char *file,
 	       const char *initfile, int initflags,
 	       const char *cardname, int do_init);
 int power(const char *argv[], int argc);
-int monitor(const char *name);
+int monitor(const char *name, int format, int stats);
 int state_daemon(const char *file, const char *cardname, int period,
-		 const char *pidfile);
+		 int delay, const char *pidfile);
 int state_daemon_kill(const char *pidfile, const char *cmd);
 int clean(const char *cardname, char *const *extra_args);
 int snd_card_clean_cfgdir(const char *cfgdir, int cardno);
 
+/* profile */
+
+long long profile_now(void);
+void profile_phase(int card, const char *phase, long long start);
+void profile_control(int card, const char *id, long long start);
+int profile_report(const char *command);
+
 /* utils */
 
 int file_map(const char *filename, char **buf, size_t *bufsize);
 void file_unmap(void *buf, size_t bufsize);
 size_t line_width(const char *buf, size_t bufsize, size_t pos);
+
+/* FNV-1a, start with FNV_OFFSET (FNV64_OFFSET) and chain the calls */
+#define FNV_OFFSET	2166136261U
+#define FNV64_OFFSET	0xcbf29ce484222325ULL
+unsigned int fnv_hash(unsigned int hash, const void *data, size_t size);
+unsigned int fnv_hash_str(unsigned int hash, const char *str);
+uint64_t fnv64_hash(uint64_t hash, const void *data, size_t size);
 void initfailed(int cardnumber, const char *reason, int exitcode);
 
 static inline int hextodigit(int c)
@@ -0,0 +1,245 @@
+/*
+ *  Advanced Linux Sound Architecture Control Program - state benchmark
+ *  Copyright (c) 2026 by agent <agent@local>
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#include "aconfig.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "alsactl.h"
+#include "bench.h"
+
+/*
+ * The text state of a synthetic card with many controls is loaded the
+ * same way as 'alsactl restore' does (load_configuration(), with the
+ * lock), and the tree is stored the same way as 'alsactl store' does
+ * (snd_config_save() to the new file, renamed over the old one). The
+ * controls themselves need a card, so their reading and writing is not
+ * a part of it.
+ */
+
+#define DEFAULT_CONTROLS	5000
+#define DEFAULT_REPEATS		20
+
+int debugflag = 0;
+int force_restore = 1;
+int ignore_nocards = 0;
+int do_lock = 1;
+int use_syslog = 0;
+char *command = "benchmark";
+char *statefile = NULL;
+char *lockfile = NULL;
+char *cachefile = NULL;
+char *profilefile = NULL;
+
+static bool json;
+
+/* the mix of a HDA codec: stereo volumes, stereo switches and enums */
+static int write_state(FILE *fp, unsigned int controls)
+{
+	unsigned int i;
+
+	fprintf(fp, "state.Bench {\n");
+	for (i = 1; i <= controls; i++) {
+		fprintf(fp, "\tcontrol.%u {\n\t\tiface MIXER\n", i);
+		switch (i % 3) {
+		case 0:
+			fprintf(fp,
+				"\t\tname 'Control %u Playback Volume'\n"
+				"\t\tvalue.0 57\n"
+				"\t\tvalue.1 57\n"
+				"\t\tcomment {\n"
+				"\t\t\taccess 'read write'\n"
+				"\t\t\ttype INTEGER\n"
+				"\t\t\tcount 2\n"
+				"\t\t\trange '0 - 87'\n"
+				"\t\t\tdbmin -6525\n"
+				"\t\t\tdbmax 0\n"
+				"\t\t\tdbvalue.0 -2250\n"
+				"\t\t\tdbvalue.1 -2250\n"
+				"\t\t}\n", i);
+			break;
+		case 1:
+			fprintf(fp,
+				"\t\tname 'Control %u Playback Switch'\n"
+				"\t\tvalue.0 true\n"
+				"\t\tvalue.1 true\n"
+				"\t\tcomment {\n"
+				"\t\t\taccess 'read write'\n"
+				"\t\t\ttype BOOLEAN\n"
+				"\t\t\tcount 2\n"
+				"\t\t}\n", i);
+			break;
+		default:
+			fprintf(fp,
+				"\t\tname 'Control %u Mode'\n"
+				"\t\tvalue Enabled\n"
+				"\t\tcomment {\n"
+				"\t\t\taccess 'read write'\n"
+				"\t\t\ttype ENUMERATED\n"
+				"\t\t\tcount 1\n"
+				"\t\t\titem.0 Disabled\n"
+				"\t\t\titem.1 Enabled\n"
+				"\t\t}\n", i);
+			break;
+		}
+		fprintf(fp, "\t}\n");
+	}
+	fprintf(fp, "}\n");
+	return ferror(fp) ? -EIO : 0;
+}
+
+static int bench_load(const char *file, struct bench_cost *cost)
+{
+	snd_config_t *config;
+	int err;
+
+	bench_cost_begin(cost);
+	err = load_configuration(file, &config, NULL);
+	bench_cost_end(cost, 0, 0);
+	if (err < 0)
+		return err;
+	snd_config_delete(config);
+	return 0;
+}
+
+static int bench_save(const char *file, const char *nfile,
+		      snd_config_t *config, struct bench_cost *cost)
+{
+	snd_output_t *out;
+	int err;
+
+	bench_cost_begin(cost);
+	err = snd_output_stdio_open(&out, nfile, "w");
+	if (err < 0)
+		return err;
+	err = snd_config_save(config, out);
+	snd_output_close(out);
+	if (err == 0 && rename(nfile, file) < 0)
+		err = -errno;
+	bench_cost_end(cost, 0, 0);
+	return err;
+}
+
+int main(int argc, char *argv[])
+{
+	struct bench_cost load_cost = {0}, save_cost = {0};
+	unsigned int controls = DEFAULT_CONTROLS;
+	unsigned int i, repeats = DEFAULT_REPEATS;
+	char file[] = "/tmp/alsactl-bench.XXXXXX";
+	char *nfile = NULL, *lfile = NULL;
+	snd_config_t *config = NULL;
+	struct stat st;
+	FILE *fp;
+	int fd, err;
+
+	if (argc > 1 && strcmp(argv[1], "--json") == 0) {
+		json = true;
+		--argc;
+		++argv;
+	}
+
+	if (argc > 1) {
+		char *term;
+
+		errno = 0;
+		controls = strtoul(argv[1], &term, 10);
+		if (errno || *term != '\0' || controls == 0) {
+			printf("Usage: %s [--json] [controls]\n", argv[0]);
+			return EXIT_FAILURE;
+		}
+	}
+
+	fd = mkstemp(file);
+	if (fd < 0) {
+		fprintf(stderr, "%s: %s\n", file, strerror(errno));
+		return EXIT_FAILURE;
+	}
+	if (asprintf(&nfile, "%s.new", file) < 0 ||
+	    asprintf(&lfile, "%s.lock", file) < 0) {
+		close(fd);
+		err = -ENOMEM;
+		goto out;
+	}
+	lockfile = lfile;
+
+	fp = fdopen(fd, "w");
+	if (fp == NULL) {
+		close(fd);
+		err = -errno;
+		goto out;
+	}
+	err = write_state(fp, controls);
+	if (fclose(fp) != 0 && err == 0)
+		err = -errno;
+	if (err < 0)
+		goto out;
+	if (stat(file, &st) < 0) {
+		err = -errno;
+		goto out;
+	}
+
+	/* the tree to store, as read from the cards */
+	err = load_configuration(file, &config, NULL);
+	if (err < 0)
+		goto out;
+
+	for (i = 0; i < repeats; i++) {
+		err = bench_load(file, &load_cost);
+		if (err < 0)
+			goto out;
+		err = bench_save(file, nfile, config, &save_cost);
+		if (err < 0)
+			goto out;
+	}
+
+	if (json) {
+		printf("{ \"suite\": \"alsactl\", \"name\": \"state\", "
+		       "\"controls\": %u, \"bytes\": %lld",
+		       controls, (long long)st.st_size);
+	} else {
+		printf("%-10s %8s %10s %10s %10s\n",
+		       "state", "controls", "bytes", "load usec", "save usec");
+		printf("%-10s %8u %10lld", "state", controls,
+		       (long long)st.st_size);
+	}
+	bench_print_time("load", &load_cost, repeats, json);
+	bench_print_time("save", &save_cost, repeats, json);
+	printf(json ? " }\n" : "\n");
+
+out:
+	if (config)
+		snd_config_delete(config);
+	snd_config_update_free_global();
+	unlink(file);
+	if (nfile)
+		unlink(nfile);
+	if (lfile)
+		unlink(lfile);
+	free(nfile);
+	free(lfile);
+	if (err < 0) {
+		fprintf(stderr, "%s\n", snd_strerror(err));
+		return EXIT_FAILURE;
+	}
+	return EXIT_SUCCESS;
+}
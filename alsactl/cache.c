@@ -0,0 +1,521 @@
+/*
+ *  Advanced Linux Sound Architecture Control Program - compiled state cache
+ *  Copyright (c) 2026 by agent <agent@local>
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#include "aconfig.h"
+#include <stdio.h>
+#include <stdint.h>
+#include <errno.h>
+#include <sys/stat.h>
+#include "alsactl.h"
+
+/*
+ * The cache holds the values of the writable controls in a binary form,
+ * so the restore does not need to parse the text state and look up each
+ * control by its name. It is valid only for the state file it was
+ * created with (modification time and size) and only when the hash of
+ * the control ids of each card matches, otherwise the text state is
+ * restored and the cache is created again.
+ *
+ * The file is mapped and used in place: a header, then for each card
+ * a card record followed by the control records with their values.
+ * The fields are in the host byte order, the records are 8 byte aligned.
+ */
+
+#define CACHE_MAGIC	"ALSACST"
+#define CACHE_VERSION	1
+
+#define CACHE_ALIGN(x)	(((x) + 7) & ~(size_t)7)
+
+struct cache_header {
+	char magic[8];
+	uint32_t version;
+	uint32_t cards;
+	int64_t state_mtime;		/* of the text state file */
+	int64_t state_size;
+};
+
+struct cache_card {
+	char id[32];
+	uint64_t layout;		/* hash of the control ids */
+	uint32_t controls;
+	uint32_t size;			/* bytes of the control records */
+};
+
+struct cache_control {
+	uint32_t numid;
+	uint32_t type;
+	uint32_t count;
+	uint32_t size;			/* bytes of the values */
+};
+
+struct cache_buffer {
+	char *data;
+	size_t size;
+	size_t alloc;
+};
+
+static int card_layout(snd_ctl_t *handle, const char *id, uint64_t *layout)
+{
+	snd_ctl_elem_list_t *list;
+	snd_ctl_elem_id_t *elem_id;
+	unsigned int idx, count;
+	uint32_t val[5];
+	const char *name;
+	uint64_t hash = FNV64_OFFSET;
+	int err;
+	snd_ctl_elem_list_alloca(&list);
+	snd_ctl_elem_id_alloca(&elem_id);
+
+	err = snd_ctl_elem_list(handle, list);
+	if (err < 0)
+		return err;
+	count = snd_ctl_elem_list_get_count(list);
+	hash = fnv64_hash(hash, id, strlen(id) + 1);
+	if (count == 0)
+		goto _out;
+	if (snd_ctl_elem_list_alloc_space(list, count) < 0)
+		return -ENOMEM;
+	err = snd_ctl_elem_list(handle, list);
+	if (err < 0)
+		goto _free;
+	for (idx = 0; idx < count; idx++) {
+		snd_ctl_elem_list_get_id(list, idx, elem_id);
+		val[0] = snd_ctl_elem_id_get_numid(elem_id);
+		val[1] = snd_ctl_elem_id_get_interface(elem_id);
+		val[2] = snd_ctl_elem_id_get_device(elem_id);
+		val[3] = snd_ctl_elem_id_get_subdevice(elem_id);
+		val[4] = snd_ctl_elem_id_get_index(elem_id);
+		name = snd_ctl_elem_id_get_name(elem_id);
+		hash = fnv64_hash(hash, val, sizeof(val));
+		hash = fnv64_hash(hash, name, strlen(name) + 1);
+	}
+ _free:
+	snd_ctl_elem_list_free_space(list);
+	if (err < 0)
+		return err;
+ _out:
+	*layout = hash;
+	return 0;
+}
+
+static size_t value_size(unsigned int type, unsigned int count)
+{
+	switch (type) {
+	case SND_CTL_ELEM_TYPE_BOOLEAN:
+	case SND_CTL_ELEM_TYPE_INTEGER:
+	case SND_CTL_ELEM_TYPE_ENUMERATED:
+		return count <= 128 ? count * sizeof(int64_t) : 0;
+	case SND_CTL_ELEM_TYPE_INTEGER64:
+		return count <= 64 ? count * sizeof(int64_t) : 0;
+	case SND_CTL_ELEM_TYPE_BYTES:
+		return count <= 512 ? count : 0;
+	case SND_CTL_ELEM_TYPE_IEC958:
+		return sizeof(snd_aes_iec958_t);
+	default:
+		return 0;
+	}
+}
+
+static void *buffer_add(struct cache_buffer *buf, size_t size, size_t *offset)
+{
+	size_t nsize = CACHE_ALIGN(size);
+	char *n;
+
+	if (buf->size + nsize > buf->alloc) {
+		n = realloc(buf->data, buf->alloc + nsize + 64 * 1024);
+		if (n == NULL)
+			return NULL;
+		buf->data = n;
+		buf->alloc += nsize + 64 * 1024;
+	}
+	n = buf->data + buf->size;
+	memset(n, 0, nsize);
+	if (offset)
+		*offset = buf->size;
+	buf->size += nsize;
+	return n;
+}
+
+static int save_control(struct cache_buffer *buf, snd_ctl_t *handle,
+			snd_ctl_elem_id_t *id)
+{
+	snd_ctl_elem_info_t *info;
+	snd_ctl_elem_value_t *ctl;
+	struct cache_control *rec;
+	unsigned int idx, type, count;
+	int64_t *val;
+	size_t size;
+	int err;
+	snd_ctl_elem_info_alloca(&info);
+	snd_ctl_elem_value_alloca(&ctl);
+
+	snd_ctl_elem_info_set_id(info, id);
+	err = snd_ctl_elem_info(handle, info);
+	if (err < 0)
+		return err;
+	if (!snd_ctl_elem_info_is_readable(info) ||
+	    !snd_ctl_elem_info_is_writable(info) ||
+	    snd_ctl_elem_info_is_inactive(info))
+		return 0;
+	type = snd_ctl_elem_info_get_type(info);
+	count = snd_ctl_elem_info_get_count(info);
+	size = value_size(type, count);
+	if (size == 0)
+		return 0;
+	snd_ctl_elem_value_set_id(ctl, id);
+	err = snd_ctl_elem_read(handle, ctl);
+	if (err < 0)
+		return err;
+	rec = buffer_add(buf, sizeof(*rec) + CACHE_ALIGN(size), NULL);
+	if (rec == NULL)
+		return -ENOMEM;
+	rec->numid = snd_ctl_elem_info_get_numid(info);
+	rec->type = type;
+	rec->count = count;
+	rec->size = CACHE_ALIGN(size);
+	val = (int64_t *)(rec + 1);
+	switch (type) {
+	case SND_CTL_ELEM_TYPE_BOOLEAN:
+	case SND_CTL_ELEM_TYPE_INTEGER:
+		for (idx = 0; idx < count; idx++)
+			val[idx] = snd_ctl_elem_value_get_integer(ctl, idx);
+		break;
+	case SND_CTL_ELEM_TYPE_INTEGER64:
+		for (idx = 0; idx < count; idx++)
+			val[idx] = snd_ctl_elem_value_get_integer64(ctl, idx);
+		break;
+	case SND_CTL_ELEM_TYPE_ENUMERATED:
+		for (idx = 0; idx < count; idx++)
+			val[idx] = snd_ctl_elem_value_get_enumerated(ctl, idx);
+		break;
+	case SND_CTL_ELEM_TYPE_BYTES:
+		memcpy(val, snd_ctl_elem_value_get_bytes(ctl), count);
+		break;
+	case SND_CTL_ELEM_TYPE_IEC958:
+		snd_ctl_elem_value_get_iec958(ctl, (snd_aes_iec958_t *)val);
+		break;
+	}
+	return 1;
+}
+
+static int save_card(struct cache_buffer *buf, int cardno)
+{
+	snd_ctl_t *handle;
+	snd_ctl_card_info_t *info;
+	snd_ctl_elem_list_t *list;
+	snd_ctl_elem_id_t *elem_id;
+	struct cache_card *card;
+	unsigned int idx, count, controls = 0;
+	size_t offset;
+	uint64_t layout;
+	char name[32];
+	const char *id;
+	int err;
+	snd_ctl_card_info_alloca(&info);
+	snd_ctl_elem_list_alloca(&list);
+	snd_ctl_elem_id_alloca(&elem_id);
+
+	sprintf(name, "hw:%d", cardno);
+	err = snd_ctl_open(&handle, name, SND_CTL_READONLY);
+	if (err < 0)
+		return err;
+	err = snd_ctl_card_info(handle, info);
+	if (err < 0)
+		goto _close;
+	id = snd_ctl_card_info_get_id(info);
+	err = card_layout(handle, id, &layout);
+	if (err < 0)
+		goto _close;
+	card = buffer_add(buf, sizeof(*card), &offset);
+	if (card == NULL) {
+		err = -ENOMEM;
+		goto _close;
+	}
+	snprintf(card->id, sizeof(card->id), "%s", id);
+	card->layout = layout;
+	err = snd_ctl_elem_list(handle, list);
+	if (err < 0)
+		goto _close;
+	count = snd_ctl_elem_list_get_count(list);
+	if (count > 0) {
+		if (snd_ctl_elem_list_alloc_space(list, count) < 0) {
+			err = -ENOMEM;
+			goto _close;
+		}
+		err = snd_ctl_elem_list(handle, list);
+		for (idx = 0; idx < count && err >= 0; idx++) {
+			snd_ctl_elem_list_get_id(list, idx, elem_id);
+			err = save_control(buf, handle, elem_id);
+			if (err > 0)
+				controls++;
+		}
+		snd_ctl_elem_list_free_space(list);
+		if (err < 0)
+			goto _close;
+	}
+	/* the buffer might be moved meanwhile */
+	card = (struct cache_card *)(buf->data + offset);
+	card->controls = controls;
+	card->size = buf->size - offset - sizeof(*card);
+	err = 0;
+ _close:
+	snd_ctl_close(handle);
+	return err;
+}
+
+/* create the cache from the current values, the state file is locked by the caller */
+int cache_save(const char *cachefile, const char *file, const char *cardname)
+{
+	struct cache_buffer buf = { NULL, 0, 0 };
+	struct cache_header *header;
+	struct snd_card_iterator iter;
+	struct stat st;
+	unsigned int cards = 0;
+	char *nfile = NULL;
+	FILE *fp;
+	int err;
+
+	if (stat(file, &st) < 0)
+		return -errno;
+	if (buffer_add(&buf, sizeof(*header), NULL) == NULL)
+		return -ENOMEM;
+	err = snd_card_iterator_sinit(&iter, cardname);
+	if (err < 0)
+		goto out;
+	while (snd_card_iterator_next(&iter)) {
+		err = save_card(&buf, iter.card);
+		if (err < 0)
+			goto out;
+		cards++;
+	}
+	header = (struct cache_header *)buf.data;
+	memcpy(header->magic, CACHE_MAGIC, sizeof(header->magic));
+	header->version = CACHE_VERSION;
+	header->cards = cards;
+	header->state_mtime = st.st_mtime;
+	header->state_size = st.st_size;
+
+	nfile = malloc(strlen(cachefile) + 5);
+	if (nfile == NULL) {
+		err = -ENOMEM;
+		goto out;
+	}
+	strcpy(nfile, cachefile);
+	strcat(nfile, ".new");
+	fp = fopen(nfile, "w");
+	if (fp == NULL) {
+		err = -errno;
+		goto out;
+	}
+	if (fwrite(buf.data, 1, buf.size, fp) != buf.size)
+		err = -errno;
+	if (fclose(fp) && err == 0)
+		err = -errno;
+	if (err == 0 && rename(nfile, cachefile) < 0)
+		err = -errno;
+	if (err < 0)
+		unlink(nfile);
+out:
+	if (err < 0)
+		error("Cannot create the state cache %s: %s", cachefile,
+		      snd_strerror(err));
+	free(nfile);
+	free(buf.data);
+	return err;
+}
+
+struct cache_restore {
+	int card;
+	snd_ctl_t *handle;
+	const struct cache_card *rec;
+};
+
+static const struct cache_card *find_card(const char *buf, size_t size,
+					  const char *id, uint64_t layout)
+{
+	const struct cache_header *header = (const struct cache_header *)buf;
+	const struct cache_card *card;
+	size_t pos = sizeof(*header);
+	unsigned int i;
+
+	for (i = 0; i < header->cards; i++) {
+		if (pos + sizeof(*card) > size)
+			return NULL;
+		card = (const struct cache_card *)(buf + pos);
+		pos += sizeof(*card);
+		if (card->size > size - pos)
+			return NULL;
+		pos += card->size;
+		if (card->layout == layout &&
+		    strncmp(card->id, id, sizeof(card->id)) == 0)
+			return card;
+	}
+	return NULL;
+}
+
+static int restore_card_cache(snd_ctl_t *handle, const struct cache_card *card)
+{
+	const char *pos = (const char *)(card + 1);
+	const char *end = pos + card->size;
+	const struct cache_control *rec;
+	snd_ctl_elem_value_t *ctl, *old;
+	const int64_t *val;
+	unsigned int i, idx, written = 0;
+	int err, res = 0;
+	snd_ctl_elem_value_alloca(&ctl);
+	snd_ctl_elem_value_alloca(&old);
+
+	for (i = 0; i < card->controls; i++) {
+		rec = (const struct cache_control *)pos;
+		if ((size_t)(end - pos) < sizeof(*rec) ||
+		    rec->size > (size_t)(end - pos) - sizeof(*rec) ||
+		    CACHE_ALIGN(value_size(rec->type, rec->count)) != rec->size ||
+		    rec->size == 0) {
+			error("Invalid state cache record for card %s", card->id);
+			return -EINVAL;
+		}
+		pos += sizeof(*rec) + rec->size;
+		val = (const int64_t *)(rec + 1);
+		snd_ctl_elem_value_clear(ctl);
+		snd_ctl_elem_value_set_numid(ctl, rec->numid);
+		switch (rec->type) {
+		case SND_CTL_ELEM_TYPE_BOOLEAN:
+		case SND_CTL_ELEM_TYPE_INTEGER:
+			for (idx = 0; idx < rec->count; idx++)
+				snd_ctl_elem_value_set_integer(ctl, idx, val[idx]);
+			break;
+		case SND_CTL_ELEM_TYPE_INTEGER64:
+			for (idx = 0; idx < rec->count; idx++)
+				snd_ctl_elem_value_set_integer64(ctl, idx, val[idx]);
+			break;
+		case SND_CTL_ELEM_TYPE_ENUMERATED:
+			for (idx = 0; idx < rec->count; idx++)
+				snd_ctl_elem_value_set_enumerated(ctl, idx, val[idx]);
+			break;
+		case SND_CTL_ELEM_TYPE_BYTES:
+			for (idx = 0; idx < rec->count; idx++)
+				snd_ctl_elem_value_set_byte(ctl, idx,
+						((const unsigned char *)val)[idx]);
+			break;
+		case SND_CTL_ELEM_TYPE_IEC958:
+			snd_ctl_elem_value_set_iec958(ctl,
+					(const snd_aes_iec958_t *)val);
+			break;
+		}
+		snd_ctl_elem_value_set_numid(old, rec->numid);
+		if (snd_ctl_elem_read(handle, old) >= 0 &&
+		    ctl_value_equal(rec->type, rec->count, ctl, old))
+			continue;
+		err = snd_ctl_elem_write(handle, ctl);
+		if (err < 0) {
+			error("Cannot write control #%u: %s", rec->numid,
+			      snd_strerror(err));
+			if (!force_restore)
+				res = err;
+			continue;
+		}
+		written++;
+	}
+	dbg("card %s: %u controls written from the cache, %u unchanged",
+	    card->id, written, card->controls - written);
+	return res;
+}
+
+/*
+ * Restore all cards from the cache. Nothing is written and -ESTALE is
+ * returned when the cache does not match the state file or a card.
+ * On any error, the caller does the restore from the text state.
+ */
+int cache_restore(const char *cachefile, const char *file,
+		  const char *cardname, int initflags)
+{
+	const struct cache_header *header;
+	struct cache_restore *cards = NULL, *n;
+	struct snd_card_iterator iter;
+	snd_ctl_card_info_t *info;
+	struct stat st;
+	uint64_t layout;
+	char *buf, name[32];
+	size_t size;
+	int i, count = 0, err, finalerr = 0;
+	snd_ctl_card_info_alloca(&info);
+
+	if (file_map(cachefile, &buf, &size) < 0)
+		return -ENOENT;
+	header = (const struct cache_header *)buf;
+	if (size < sizeof(*header) ||
+	    memcmp(header->magic, CACHE_MAGIC, sizeof(header->magic)) ||
+	    header->version != CACHE_VERSION ||
+	    stat(file, &st) < 0 ||
+	    header->state_mtime != (int64_t)st.st_mtime ||
+	    header->state_size != (int64_t)st.st_size) {
+		err = -ESTALE;
+		goto out;
+	}
+	err = snd_card_iterator_sinit(&iter, cardname);
+	if (err < 0)
+		goto out;
+	while (snd_card_iterator_next(&iter)) {
+		n = realloc(cards, sizeof(*cards) * (count + 1));
+		if (n == NULL) {
+			err = -ENOMEM;
+			goto out;
+		}
+		cards = n;
+		n = &cards[count];
+		n->card = iter.card;
+		sprintf(name, "hw:%d", iter.card);
+		err = snd_ctl_open(&n->handle, name, 0);
+		if (err < 0)
+			goto out;
+		count++;
+		err = snd_ctl_card_info(n->handle, info);
+		if (err < 0)
+			goto out;
+		err = card_layout(n->handle, snd_ctl_card_info_get_id(info),
+				  &layout);
+		if (err < 0)
+			goto out;
+		n->rec = find_card(buf, size, snd_ctl_card_info_get_id(info),
+				   layout);
+		if (n->rec == NULL) {
+			dbg("card %d does not match the state cache", iter.card);
+			err = -ESTALE;
+			goto out;
+		}
+	}
+	err = snd_card_iterator_error(&iter);
+	if (err < 0)
+		goto out;
+	for (i = 0; i < count; i++) {
+		/* error is ignored */
+		init_ucm(initflags | FLAG_UCM_FBOOT, cards[i].card);
+		err = restore_card_cache(cards[i].handle, cards[i].rec);
+		if (err < 0)
+			finalerr = err;
+	}
+	err = finalerr;
+out:
+	for (i = 0; i < count; i++)
+		snd_ctl_close(cards[i].handle);
+	free(cards);
+	file_unmap(buf, size);
+	return err;
+}
@@ -24,20 +24,66 @@
 #include <getopt.h>
 #include <stdarg.h>
 #include <stdio.h>
+#include <string.h>
 #include <assert.h>
 #include <errno.h>
 #include "alsactl.h"
 
+/*
+ * The ids given on the command line are kept in a hash table keyed like
+ * snd_ctl_elem_id_compare_set() compares (interface, device, subdevice,
+ * name and index), so that each element of the card is matched against
+ * the filter with one lookup, before its info is read.
+ */
+struct control_filter {
+	snd_ctl_elem_id_t **ids;	/* NULL terminated */
+	unsigned int count;
+	unsigned int *table;		/* index + 1 into ids, 0 for empty */
+	unsigned int mask;
+};
+
+static unsigned int filter_hash(const snd_ctl_elem_id_t *id)
+{
+	unsigned int val[4];
+
+	val[0] = snd_ctl_elem_id_get_interface(id);
+	val[1] = snd_ctl_elem_id_get_device(id);
+	val[2] = snd_ctl_elem_id_get_subdevice(id);
+	val[3] = snd_ctl_elem_id_get_index(id);
+	return fnv_hash_str(fnv_hash(FNV_OFFSET, val, sizeof(val)),
+			    snd_ctl_elem_id_get_name(id));
+}
+
+static int filter_match(const struct control_filter *filter,
+			const snd_ctl_elem_id_t *elem_id)
+{
+	unsigned int slot, idx;
+
+	for (slot = filter_hash(elem_id) & filter->mask;
+	     (idx = filter->table[slot]) != 0;
+	     slot = (slot + 1) & filter->mask) {
+		if (snd_ctl_elem_id_compare_set(elem_id, filter->ids[idx - 1]) == 0)
+			return 1;
+	}
+	return 0;
+}
+
 static int clean_one_control(snd_ctl_t *handle, snd_ctl_elem_id_t *elem_id,
-			     snd_ctl_elem_id_t **filter)
+			     const struct control_filter *filter, int *removed)
 {
 	snd_ctl_elem_info_t *info;
 	char *s;
 	int err;
 
+	if (filter->ids && !filter_match(filter, elem_id))
+		return 0;
+
 	snd_ctl_elem_info_alloca(&info);
 	snd_ctl_elem_info_set_id(info, elem_id);
 	err = snd_ctl_elem_info(handle, info);
+	/* the other elements of a removed set are gone, too */
+	if (err == -ENOENT && *removed)
+		return 0;
 	if (err < 0) {
 		s = snd_ctl_ascii_elem_id_get(elem_id);
 		error("Cannot read control info '%s': %s", s, snd_strerror(err));
@@ -50,16 +96,6 @@ static int clean_one_control(snd_ctl_t *handle, snd_ctl_elem_id_t *elem_id,
 
 	s = snd_ctl_ascii_elem_id_get(elem_id);
 	dbg("Application control \"%s\" found.", s);
-	if (filter) {
-		for (; *filter; filter++) {
-			if (snd_ctl_elem_id_compare_set(elem_id, *filter) == 0)
-				break;
-		}
-		if (*filter == NULL) {
-			free(s);
-			return 0;
-		}
-	}
 
 	err = snd_ctl_elem_remove(handle, elem_id);
 	if (err < 0) {
@@ -67,58 +103,69 @@ static int clean_one_control(snd_ctl_t *handle, snd_ctl_elem_id_t *elem_id,
 		free(s);
 		return err;
 	}
+	(*removed)++;
 	dbg("Application control \"%s\" removed.", s);
 	free(s);
 	return 0;
 }
 
-static void filter_controls_free(snd_ctl_elem_id_t **_filter)
+static void filter_controls_free(struct control_filter *filter)
 {
-	snd_ctl_elem_id_t **filter;
+	snd_ctl_elem_id_t **id;
 
-	for (filter = _filter; filter; filter++)
-		free(*filter);
-	free(_filter);
+	if (filter->ids) {
+		for (id = filter->ids; *id; id++)
+			snd_ctl_elem_id_free(*id);
+		free(filter->ids);
+	}
+	free(filter->table);
+	filter->ids = NULL;
+	filter->table = NULL;
 }
 
-static int filter_controls_parse(char *const *controls, snd_ctl_elem_id_t ***_filter)
+static int filter_controls_parse(char *const *controls, struct control_filter *filter)
 {
-	snd_ctl_elem_id_t **filter = NULL;
 	char *const *c;
 	char *s;
-	unsigned int count, idx;
+	unsigned int count, idx, size, slot;
 	int err;
 
+	memset(filter, 0, sizeof(*filter));
 	if (!controls)
-		goto fin;
+		return 0;
 	for (count = 0, c = controls; *c; c++, count++);
 	if (count == 0)
-		goto fin;
-	filter = calloc(count + 1, sizeof(snd_ctl_elem_id_t *));
-	if (filter == NULL) {
+		return 0;
+	/* keep the table at most half full */
+	for (size = 16; size < count * 2; size <<= 1);
+	filter->ids = calloc(count + 1, sizeof(snd_ctl_elem_id_t *));
+	filter->table = calloc(size, sizeof(unsigned int));
+	if (filter->ids == NULL || filter->table == NULL) {
 nomem:
 		error("No enough memory...");
+		filter_controls_free(filter);
 		return -ENOMEM;
 	}
-	filter[count] = NULL;
+	filter->mask = size - 1;
 	for (idx = 0; idx < count; idx++) {
-		err = snd_ctl_elem_id_malloc(&filter[idx]);
-		if (err < 0) {
-			filter_controls_free(filter);
+		err = snd_ctl_elem_id_malloc(&filter->ids[idx]);
+		if (err < 0)
 			goto nomem;
-		}
-		err = snd_ctl_ascii_elem_id_parse(filter[idx], controls[idx]);
+		err = snd_ctl_ascii_elem_id_parse(filter->ids[idx], controls[idx]);
 		if (err < 0) {
 			error("Cannot parse id '%s': %s", controls[idx], snd_strerror(err));
 			filter_controls_free(filter);
 			return err;
 		}
-		s = snd_ctl_ascii_elem_id_get(filter[idx]);
+		s = snd_ctl_ascii_elem_id_get(filter->ids[idx]);
 		dbg("Add to filter: \"%s\"", s);
 		free(s);
+		for (slot = filter_hash(filter->ids[idx]) & filter->mask;
+		     filter->table[slot] != 0;
+		     slot = (slot + 1) & filter->mask);
+		filter->table[slot] = idx + 1;
 	}
-fin:
-	*_filter = filter;
+	filter->count = count;
 	return 0;
 }
 
@@ -127,10 +174,10 @@ static int clean_controls(int cardno, char *const *controls)
 	snd_ctl_t *handle;
 	snd_ctl_elem_list_t *list;
 	snd_ctl_elem_id_t *elem_id;
-	snd_ctl_elem_id_t **filter;
+	struct control_filter filter;
 	char name[32];
 	unsigned int idx, count;
-	int err;
+	int err, removed = 0;
 
 	snd_ctl_elem_id_alloca(&elem_id);
 	snd_ctl_elem_list_alloca(&list);
@@ -143,7 +190,7 @@ static int clean_controls(int cardno, char *const *controls)
 	err = snd_ctl_open(&handle, name, 0);
 	if (err < 0) {
 		error("snd_ctl_open error: %s", snd_strerror(err));
-		filter_controls_free(filter);
+		filter_controls_free(&filter);
 		return err;
 	}
 	dbg("Control device '%s' opened.", name);
@@ -164,18 +211,22 @@ static int clean_controls(int cardno, char *const *controls)
 		error("Cannot determine controls (2): %s", snd_strerror(err));
 		goto fin_err;
 	}
+	/* all ids are listed once, the removals follow in the same pass */
 	for (idx = 0; idx < count; idx++) {
 		snd_ctl_elem_list_get_id(list, idx, elem_id);
-		err = clean_one_control(handle, elem_id, filter);
+		err = clean_one_control(handle, elem_id, &filter, &removed);
 		if (err < 0)
 			goto fin_err;
 	}
+	dbg("%d application controls removed.", removed);
 fin_ok:
-	filter_controls_free(filter);
+	snd_ctl_elem_list_free_space(list);
+	filter_controls_free(&filter);
 	snd_ctl_close(handle);
 	return 0;
 fin_err:
-	filter_controls_free(filter);
+	snd_ctl_elem_list_free_space(list);
+	filter_controls_free(&filter);
 	snd_ctl_close(handle);
 	return err;
 }
@@ -30,18 +30,29 @@
 #include <time.h>
 #include <poll.h>
 #include "alsactl.h"
+#include "probes.h"
 
-struct id_list {
-	snd_ctl_elem_id_t **list;
-	int size;
+/* the ids are hashed by the fields compared in compare_ids() */
+struct id_entry {
+	struct id_entry *next;
+	unsigned int hash;
+	snd_ctl_elem_id_t *id;
+};
+
+struct id_set {
+	struct id_entry **table;
+	unsigned int mask;
+	unsigned int count;
 };
 
 struct card {
 	int index;
 	int pfds;
 	snd_ctl_t *handle;
-	struct id_list whitelist;
-	struct id_list blacklist;
+	struct id_set whitelist;
+	struct id_set blacklist;
+	struct id_set changed;		/* controls to store */
+	int rebuild;			/* controls were added or removed */
 };
 
 static int quit = 0;
@@ -66,21 +77,31 @@ static void signal_handler_rescan(int sig)
 	signal(sig, signal_handler_rescan);
 }
 
-static void free_list(struct id_list *list)
+static void free_set(struct id_set *set)
 {
-	int i;
-
-	for (i = 0; i < list->size; i++)
-		free(list->list[i]);
-	free(list->list);
+	struct id_entry *e, *n;
+	unsigned int i;
+
+	for (i = 0; set->table && i <= set->mask; i++) {
+		for (e = set->table[i]; e; e = n) {
+			n = e->next;
+			free(e->id);
+			free(e);
+		}
+	}
+	free(set->table);
+	set->table = NULL;
+	set->mask = 0;
+	set->count = 0;
 }
 
 static void card_free(struct card **card)
 {
 	struct card *c = *card;
 
-	free_list(&c->blacklist);
-	free_list(&c->whitelist);
+	free_set(&c->blacklist);
+	free_set(&c->whitelist);
+	free_set(&c->changed);
 	if (c->handle)
 		snd_ctl_close(c->handle);
 	free(c);
@@ -164,54 +185,97 @@ static int compare_ids(snd_ctl_elem_id_t *id1, snd_ctl_elem_id_t *id2)
 	       snd_ctl_elem_id_get_subdevice(id1) == snd_ctl_elem_id_get_subdevice(id2);
 }
 
-static int in_list(struct id_list *list, snd_ctl_elem_id_t *id)
+static unsigned int hash_id(snd_ctl_elem_id_t *id)
 {
-	int i;
-	snd_ctl_elem_id_t *id1;
+	unsigned int val[4];
+
+	val[0] = snd_ctl_elem_id_get_interface(id);
+	val[1] = snd_ctl_elem_id_get_device(id);
+	val[2] = snd_ctl_elem_id_get_subdevice(id);
+	val[3] = snd_ctl_elem_id_get_index(id);
+	return fnv_hash(fnv_hash_str(FNV_OFFSET, snd_ctl_elem_id_get_name(id)),
+			val, sizeof(val));
+}
 
-	for (i = 0; i < list->size; i++) {
-		id1 = list->list[i];
-		if (id1 == NULL)
-			continue;
-		if (compare_ids(id, id1))
+static int in_set(struct id_set *set, snd_ctl_elem_id_t *id)
+{
+	struct id_entry *e;
+	unsigned int hash;
+
+	if (set->count == 0)
+		return 0;
+	hash = hash_id(id);
+	for (e = set->table[hash & set->mask]; e; e = e->next) {
+		if (e->hash == hash && compare_ids(id, e->id))
 			return 1;
 	}
 	return 0;
 }
 
-static void remove_from_list(struct id_list *list, snd_ctl_elem_id_t *id)
+static void remove_from_set(struct id_set *set, snd_ctl_elem_id_t *id)
 {
-	int i;
+	struct id_entry *e, **pe;
+	unsigned int hash;
 
-	for (i = 0; i < list->size; i++) {
-		if (compare_ids(id, list->list[i])) {
-			free(list->list[i]);
-			list->list[i] = NULL;
+	if (set->count == 0)
+		return;
+	hash = hash_id(id);
+	for (pe = &set->table[hash & set->mask]; (e = *pe) != NULL; ) {
+		if (e->hash == hash && compare_ids(id, e->id)) {
+			*pe = e->next;
+			free(e->id);
+			free(e);
+			set->count--;
+		} else {
+			pe = &e->next;
 		}
 	}
 }
 
-static void add_to_list(struct id_list *list, snd_ctl_elem_id_t *id)
+static void grow_set(struct id_set *set)
 {
-	snd_ctl_elem_id_t *id1;
-	snd_ctl_elem_id_t **n;
-	int i;
+	struct id_entry **table, *e, *n;
+	unsigned int i, size;
 
-	if (snd_ctl_elem_id_malloc(&id1))
+	size = set->table ? (set->mask + 1) * 2 : 64;
+	table = calloc(size, sizeof(*table));
+	if (table == NULL)
 		return;
-	snd_ctl_elem_id_copy(id1, id);
-	for (i = 0; i < list->size; i++) {
-		if (list->list[i] == NULL) {
-			list->list[i] = id1;
-			return;
+	for (i = 0; set->table && i <= set->mask; i++) {
+		for (e = set->table[i]; e; e = n) {
+			n = e->next;
+			e->next = table[e->hash & (size - 1)];
+			table[e->hash & (size - 1)] = e;
 		}
 	}
-	n = realloc(list->list, sizeof(void *) * (list->size + 1));
-	if (n == NULL)
+	free(set->table);
+	set->table = table;
+	set->mask = size - 1;
+}
+
+/* the id is added only once */
+static void add_to_set(struct id_set *set, snd_ctl_elem_id_t *id)
+{
+	struct id_entry *e;
+
+	if (in_set(set, id))
+		return;
+	if (set->table == NULL || set->count > set->mask)
+		grow_set(set);
+	if (set->table == NULL)
 		return;
-	n[list->size] = id1;
-	list->size++;
-	list->list = n;
+	e = malloc(sizeof(*e));
+	if (e == NULL)
+		return;
+	if (snd_ctl_elem_id_malloc(&e->id)) {
+		free(e);
+		return;
+	}
+	snd_ctl_elem_id_copy(e->id, id);
+	e->hash = hash_id(id);
+	e->next = set->table[e->hash & set->mask];
+	set->table[e->hash & set->mask] = e;
+	set->count++;
 }
 
 static int check_lists(struct card *card, snd_ctl_elem_id_t *id)
@@ -219,19 +283,19 @@ static int check_lists(struct card *card, snd_ctl_elem_id_t *id)
 	snd_ctl_elem_info_t *info;
 	snd_ctl_elem_info_alloca(&info);
 
-	if (in_list(&card->blacklist, id))
+	if (in_set(&card->blacklist, id))
 		return 0;
-	if (in_list(&card->whitelist, id))
+	if (in_set(&card->whitelist, id))
 		return 1;
 	snd_ctl_elem_info_set_id(info, id);
 	if (snd_ctl_elem_info(card->handle, info) < 0)
 		return 0;
 	if (snd_ctl_elem_info_is_writable(info) ||
 	    snd_ctl_elem_info_is_tlv_writable(info)) {
-		add_to_list(&card->whitelist, id);
+		add_to_set(&card->whitelist, id);
 		return 1;
 	} else {
-		add_to_list(&card->blacklist, id);
+		add_to_set(&card->blacklist, id);
 		return 0;
 	}
 }
@@ -253,24 +317,72 @@ static int card_events(struct card *card)
 		mask = snd_ctl_event_elem_get_mask(ev);
 		snd_ctl_event_elem_get_id(ev, id);
 		if (mask == SND_CTL_EVENT_MASK_REMOVE) {
-			remove_from_list(&card->whitelist, id);
-			remove_from_list(&card->blacklist, id);
+			remove_from_set(&card->whitelist, id);
+			remove_from_set(&card->blacklist, id);
+			remove_from_set(&card->changed, id);
+			state_meta_forget(card->handle, id);
+			card->rebuild = 1;
 			continue;
 		}
 		if (mask & SND_CTL_EVENT_MASK_INFO) {
-			remove_from_list(&card->whitelist, id);
-			remove_from_list(&card->blacklist, id);
+			remove_from_set(&card->whitelist, id);
+			remove_from_set(&card->blacklist, id);
 		}
+		if (mask & (SND_CTL_EVENT_MASK_INFO|SND_CTL_EVENT_MASK_TLV))
+			state_meta_forget(card->handle, id);
+		if (mask & SND_CTL_EVENT_MASK_ADD)
+			card->rebuild = 1;
 		if (mask & (SND_CTL_EVENT_MASK_VALUE|
 			    SND_CTL_EVENT_MASK_ADD|
 			    SND_CTL_EVENT_MASK_TLV)) {
-			if (check_lists(card, id))
+			if (check_lists(card, id)) {
+				add_to_set(&card->changed, id);
 				res = 1;
+			}
 		}
 	}
 	return res;
 }
 
+static void save_changes(struct state_cache **cache, const char *file,
+			 const char *cardname, struct card **cards, int count)
+{
+	struct card *card;
+	struct id_entry *e;
+	unsigned int j;
+	int i, err;
+
+	for (i = 0; i < count; i++) {
+		card = cards[i];
+		if (card == NULL)
+			continue;
+		err = 0;
+		if (*cache == NULL) {
+			/* the whole state is read */
+		} else if (card->rebuild) {
+			err = state_cache_card(*cache, card->index);
+		} else {
+			for (j = 0; card->changed.count && j <= card->changed.mask &&
+				    err >= 0; j++) {
+				for (e = card->changed.table[j]; e && err >= 0; e = e->next)
+					err = state_cache_control(*cache, card->handle,
+								  e->id);
+			}
+		}
+		if (err < 0) {
+			dbg("cached state of card %i dropped: %s",
+			    card->index, snd_strerror(err));
+			state_cache_free(*cache);
+			*cache = NULL;
+		}
+		free_set(&card->changed);
+		card->rebuild = 0;
+	}
+	PROBE1(alsactl, save, count);
+	save_state_cached(cache, file, cardname);
+	PROBE1(alsactl, save_done, count);
+}
+
 static long read_pid_file(const char *pidfile)
 {
 	int fd, err;
@@ -356,14 +468,23 @@ static int check_another_instance(const char *pidfile)
 	return 0;
 }
 
+static long long now_ms(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (long long)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
 int state_daemon(const char *file, const char *cardname, int period,
-		 const char *pidfile)
+		 int delay, const char *pidfile)
 {
-	int count = 0, pcount, psize = 0, i, j, k, changed = 0;
-	time_t last_write, now;
+	int count = 0, pcount, psize = 0, i, j, k, changed = 0, timeout;
+	long long first_change = 0, last_change = 0, deadline, now;
 	unsigned short revents;
 	struct card **cards = NULL;
 	struct pollfd *pfd = NULL, *pfdn;
+	struct state_cache *cache = NULL;
 
 	if (check_another_instance(pidfile))
 		return 0;
@@ -374,7 +495,6 @@ int state_daemon(const char *file, const char *cardname, int period,
 	signal(SIGUSR1, signal_handler_rescan);
 	signal(SIGUSR2, signal_handler_save_and_quit);
 	write_pid_file(pidfile);
-	time(&last_write);
 	while (!quit || save_now) {
 		if (save_now)
 			goto save;
@@ -385,6 +505,9 @@ int state_daemon(const char *file, const char *cardname, int period,
 				add_cards(&cards, &count);
 			}
 			snd_config_update_free_global();
+			/* new cards are not in the cached state */
+			state_cache_free(cache);
+			cache = NULL;
 			rescan = 0;
 		}
 		for (i = pcount = 0; i < count; i++) {
@@ -412,14 +535,27 @@ int state_daemon(const char *file, const char *cardname, int period,
 			}
 			j += k;
 		}
-		i = poll(pfd, j, (period / 2) * 1000);
+		/*
+		 * A burst of changes is stored once when no change came for
+		 * the delay, but at latest the period after the first change.
+		 */
+		if (changed) {
+			deadline = last_change + delay;
+			if (deadline > first_change + period * 1000LL)
+				deadline = first_change + period * 1000LL;
+			now = now_ms();
+			timeout = deadline > now ? deadline - now : 0;
+		} else {
+			timeout = (period / 2) * 1000;
+		}
+		i = poll(pfd, j, timeout);
 		if (i < 0 && errno == EINTR)
 			continue;
 		if (i < 0) {
 			error("poll failed: %s", strerror(errno));
 			break;
 		}
-		time(&now);
+		now = now_ms();
 		for (i = j = 0; i < count; i++) {
 			if (cards[i] == NULL)
 				continue;
@@ -436,20 +572,25 @@ int state_daemon(const char *file, const char *cardname, int period,
 				if (card_events(cards[i])) {
 					/* delay the write */
 					if (!changed)
-						last_write = now;
+						first_change = now;
+					last_change = now;
 					changed = 1;
 				}
 			}
 		}
-		if ((now - last_write >= period && changed) || save_now) {
+		if ((changed && (now - last_change >= delay ||
+				 now - first_change >= period * 1000LL)) ||
+		    save_now) {
 save:
 			changed = save_now = 0;
-			save_state(file, cardname);
+			save_changes(&cache, file, cardname, cards, count);
 		}
 	}
 out:
 	free(pfd);
 	remove(pidfile);
+	state_cache_free(cache);
+	state_meta_free();
 	if (cards) {
 		for (i = 0; i < count; i++)
 			card_free(&cards[i]);
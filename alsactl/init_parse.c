@@ -60,11 +60,19 @@ struct pair {
 	struct pair *next;
 };
 
+struct program_cache {
+	struct program_cache *next;
+	char *command;
+	char *result;
+	int retval;
+};
+
 struct space {
 	struct pair *pairs;
 	char *rootdir;
 	char *go_to;
 	char *program_result;
+	struct program_cache *program_cache;
 	const char *filename;
 	int linenum;
 	int log_run;
@@ -132,6 +140,13 @@ static void free_space(struct space *space)
 		free(space->program_result);
 	if (space->go_to)
 		free(space->go_to);
+	while (space->program_cache) {
+		struct program_cache *pc = space->program_cache;
+		space->program_cache = pc->next;
+		free(pc->command);
+		free(pc->result);
+		free(pc);
+	}
 	free(space);
 }
 
@@ -1244,6 +1259,37 @@ int run_program1(struct space *space,
 		 const char *command0, char *result,
 		 size_t ressize, size_t *reslen, int log)
 {
+	if (strncmp(command0, "__sysfs ", 8) == 0) {
+		char arg[PATH_SIZE], *devpath, *attr;
+		const char *res;
+		struct pair *pair;
+
+		strlcpy(arg, command0 + 8, sizeof(arg));
+		devpath = arg;
+		attr = strchr(arg, ' ');
+		if (attr) {
+			*attr++ = '\0';
+		} else {
+			/* the attribute of the card device */
+			pair = value_find(space, "sysfs_device");
+			if (pair == NULL)
+				return EXIT_FAILURE;
+			attr = arg;
+			devpath = pair->value;
+		}
+		res = sysfs_attr_get_value(devpath, attr);
+		if (res == NULL)
+			return EXIT_FAILURE;
+		strlcpy(result, res, ressize);
+		return EXIT_SUCCESS;
+	}
+	if (strncmp(command0, "__cardinfo ", 11) == 0) {
+		const char *res = cardinfo_get(space, command0 + 11);
+		if (res == NULL)
+			return EXIT_FAILURE;
+		strlcpy(result, res, ressize);
+		return EXIT_SUCCESS;
+	}
 	if (strncmp(command0, "__ctl_search", 12) == 0) {
 		const char *res = elemid_get(space, "do_search");
 		if (res == NULL || strcmp(res, "1") != 0)
@@ -1284,23 +1330,66 @@ static int conf_name_filter(const struct dirent *d)
 	return ext && !strcmp(ext, ".conf");
 }
 
-static int parse_line(struct space *space, char *line, size_t linesize)
+/*
+ * The rule files are compiled once per process: each rule holds its keys
+ * already split by get_key(), and a flag telling if the value needs the
+ * format substitution. A file is compiled again when its modification
+ * time or size changed.
+ */
+struct rule_key {
+	char *key;
+	char *value;
+	enum key_op op;
+	int format;		/* the value contains '$' or '%' */
+};
+
+struct rule {
+	unsigned int linenum;
+	unsigned int count;	/* keys */
+	int invalid;		/* a key after the parsed keys is invalid */
+	char *text;		/* for the debug output */
+	struct rule_key *keys;
+};
+
+struct rule_file {
+	struct rule_file *next;
+	char *filename;
+	time_t mtime;
+	off_t size;
+	unsigned int count;
+	struct rule *rules;
+	unsigned int err_linenum;	/* the compilation stopped here */
+	int err;
+	int users;			/* parse() calls using the rules */
+};
+
+static struct rule_file *rule_files;
+
+/* copy the value, the format is applied only when there is something to substitute */
+static void format_value(struct space *space, const struct rule_key *rk,
+			 char *string, size_t maxsize)
 {
-	char *linepos;
+	strlcpy(string, rk->value, maxsize);
+	if (rk->format)
+		apply_format(space, string, maxsize);
+}
+
+static int parse_line(struct space *space, const struct rule *rule)
+{
+	const struct rule_key *rk;
 	char *key, *value, *attr, *temp;
 	struct pair *pair;
 	enum key_op op;
 	int err = 0, count;
+	unsigned int k;
 	char string[PATH_SIZE];
 	char result[PATH_SIZE];
 
-	linepos = line;
-	while (*linepos != '\0') {
-		op = KEY_OP_UNSET;
-		
-		err = get_key(&linepos, &key, &op, &value);
-		if (err < 0)
-			goto invalid;
+	for (k = 0; k < rule->count; k++) {
+		rk = &rule->keys[k];
+		key = rk->key;
+		op = rk->op;
+		value = rk->value;
 
 		if (strncasecmp(key, "LABEL", 5) == 0) {
 			if (op != KEY_OP_ASSIGN) {
@@ -1326,8 +1415,7 @@ static int parse_line(struct space *space, char *line, size_t linesize)
 				goto invalid;
 			}
 			if (op == KEY_OP_ASSIGN) {
-				strlcpy(result, value, sizeof(result));
-				apply_format(space, result, sizeof(result));
+				format_value(space, rk, result, sizeof(result));
 				dbg("ctl assign: '%s' '%s'", value, attr);
 				err = elemid_set(space, attr, result);
 				if (space->program_result) {
@@ -1341,8 +1429,7 @@ static int parse_line(struct space *space, char *line, size_t linesize)
 					break;
 			} else if (op == KEY_OP_MATCH || op == KEY_OP_NOMATCH) {
 				if (strncmp(attr, "write", 5) == 0) {
-					strlcpy(result, value, sizeof(result));
-					apply_format(space, result, sizeof(result));
+					format_value(space, rk, result, sizeof(result));
 					dbg("ctl write: '%s' '%s'", value, attr);
 					err = elemid_set(space, "values", result);
 					if (err == 0 && op == KEY_OP_NOMATCH)
@@ -1370,8 +1457,7 @@ static int parse_line(struct space *space, char *line, size_t linesize)
 					free(space->program_result);
 					space->program_result = NULL;
 				}
-				strlcpy(string, value, sizeof(string));
-				apply_format(space, string, sizeof(string));
+				format_value(space, rk, string, sizeof(string));
 				space->program_result = strdup(string);
 				if (space->program_result == NULL)
 					break;
@@ -1384,8 +1470,7 @@ static int parse_line(struct space *space, char *line, size_t linesize)
 		if (strcasecmp(key, "PROGRAM") == 0) {
 			if (op == KEY_OP_UNSET)
 				continue;
-			strlcpy(string, value, sizeof(string));
-			apply_format(space, string, sizeof(string));
+			format_value(space, rk, string, sizeof(string));
 			if (space->program_result) {
 				free(space->program_result);
 				space->program_result = NULL;
@@ -1460,8 +1545,7 @@ static int parse_line(struct space *space, char *line, size_t linesize)
 					break;
 			} else if (op == KEY_OP_ASSIGN ||
 				   op == KEY_OP_ASSIGN_FINAL) {
-				strlcpy(result, value, sizeof(result));
-				apply_format(space, result, sizeof(result));
+				format_value(space, rk, result, sizeof(result));
 				dbg("env set: '%s' '%s'", attr, result);
 				if (setenv(attr, result, op == KEY_OP_ASSIGN_FINAL))
 					break;
@@ -1563,8 +1647,7 @@ static int parse_line(struct space *space, char *line, size_t linesize)
 		if (strncasecmp(key, "ACCESS", 6) == 0) {
 			if (op == KEY_OP_MATCH || op == KEY_OP_NOMATCH) {
 				if (value[0] == '$') {
-					strlcpy(string, value, sizeof(string));
-					apply_format(space, string, sizeof(string));
+					format_value(space, rk, string, sizeof(string));
 					if (string[0] == '/')
 						goto __access1;
 				}
@@ -1594,8 +1677,7 @@ static int parse_line(struct space *space, char *line, size_t linesize)
 				Perror(space, "invalid PRINT operation");
 				goto invalid;
 			}
-			strlcpy(string, value, sizeof(string));
-			apply_format(space, string, sizeof(string));
+			format_value(space, rk, string, sizeof(string));
 			fwrite(string, strlen(string), 1, stdout);
 			continue;
 		}
@@ -1604,8 +1686,7 @@ static int parse_line(struct space *space, char *line, size_t linesize)
 				Perror(space, "invalid ERROR operation");
 				goto invalid;
 			}
-			strlcpy(string, value, sizeof(string));
-			apply_format(space, string, sizeof(string));
+			format_value(space, rk, string, sizeof(string));
 			fwrite(string, strlen(string), 1, stderr);
 			continue;
 		}
@@ -1614,8 +1695,7 @@ static int parse_line(struct space *space, char *line, size_t linesize)
 				Perror(space, "invalid EXIT operation");
 				goto invalid;
 			}
-			strlcpy(string, value, sizeof(string));
-			apply_format(space, string, sizeof(string));
+			format_value(space, rk, string, sizeof(string));
 			if (strcmp(string, "return") == 0)
 				return -EJUSTRETURN;
 			space->exit_code = strtol(string, NULL, 0);
@@ -1628,8 +1708,7 @@ static int parse_line(struct space *space, char *line, size_t linesize)
 				Perror(space, "error parsing CONFIG attribute");
 				goto invalid;
 			}
-			strlcpy(result, value, sizeof(result));
-			apply_format(space, result, sizeof(result));
+			format_value(space, rk, result, sizeof(result));
 			if (op == KEY_OP_ASSIGN) {
 				err = value_set(space, attr, result);
 				dbg("CONFIG{%s}='%s'", attr, result);
@@ -1648,6 +1727,8 @@ static int parse_line(struct space *space, char *line, size_t linesize)
 
 		Perror(space, "unknown key '%s'", key);
 	}
+	if (k == rule->count && rule->invalid)
+		goto invalid;
 	return err;
 
 invalid:
@@ -1655,22 +1736,81 @@ invalid:
 	return -EINVAL;
 }
 
-static int parse(struct space *space, const char *filename)
+static void free_rule_file(struct rule_file *file)
+{
+	unsigned int i;
+
+	for (i = 0; i < file->count; i++) {
+		free(file->rules[i].text);
+		free(file->rules[i].keys);
+	}
+	free(file->rules);
+	free(file->filename);
+	free(file);
+}
+
+void init_cleanup(void)
+{
+	struct rule_file *file;
+
+	while (rule_files) {
+		file = rule_files;
+		rule_files = file->next;
+		free_rule_file(file);
+	}
+}
+
+static int compile_rule(struct rule *rule, const char *line, size_t len,
+			unsigned int linenum)
+{
+	struct rule_key *rk, *n;
+	char *linepos;
+	unsigned int alloc = 0;
+
+	memset(rule, 0, sizeof(*rule));
+	rule->linenum = linenum;
+	/* the original text and a copy split by get_key() */
+	rule->text = malloc(2 * (len + 1));
+	if (rule->text == NULL)
+		return -ENOMEM;
+	memcpy(rule->text, line, len + 1);
+	linepos = rule->text + len + 1;
+	memcpy(linepos, line, len + 1);
+	while (*linepos != '\0') {
+		if (rule->count == alloc) {
+			alloc += 8;
+			n = realloc(rule->keys, alloc * sizeof(*n));
+			if (n == NULL)
+				return -ENOMEM;
+			rule->keys = n;
+		}
+		rk = &rule->keys[rule->count];
+		rk->op = KEY_OP_UNSET;
+		if (get_key(&linepos, &rk->key, &rk->op, &rk->value) < 0) {
+			rule->invalid = 1;
+			break;
+		}
+		rk->format = strpbrk(rk->value, "$%") != NULL;
+		rule->count++;
+	}
+	return 0;
+}
+
+static int compile(struct rule_file *file)
 {
 	char *buf, *bufline, *line;
 	size_t bufsize, pos, count, linesize;
-	unsigned int linenum, i, j, linenum_adj;
+	unsigned int linenum, i, j, linenum_adj, alloc = 0;
+	struct rule *n;
 	int err;
 
-	dbg("start of file '%s'", filename);
-
-	if (file_map(filename, &buf, &bufsize) != 0) {
+	if (file_map(file->filename, &buf, &bufsize) != 0) {
 		err = errno;
-		error("Unable to open file '%s': %s", filename, strerror(err));
+		error("Unable to open file '%s': %s", file->filename, strerror(err));
 		return -err;
 	}
 
-	err = 0;	
+	err = 0;
 	pos = 0;
 	linenum = 0;
 	linesize = 128;
@@ -1679,8 +1819,7 @@ static int parse(struct space *space, const char *filename)
 		file_unmap(buf, bufsize);
 		return -ENOMEM;
 	}
-	space->filename = filename;
-	while (!err && pos < bufsize && !space->quit) {
+	while (pos < bufsize) {
 		count = line_width(buf, bufsize, pos);
 		bufline = buf + pos;
 		pos += count + 1;
@@ -1703,8 +1842,9 @@ static int parse(struct space *space, const char *filename)
 			line = NULL;
 			linesize = (count + 127 + 1) & ~127;
 			if (linesize > 2048) {
-				error("file %s, line %i too long", filename, linenum);
-				err = -EINVAL;
+				/* reported when the rules before were applied */
+				file->err = -EINVAL;
+				file->err_linenum = linenum;
 				break;
 			}
 			line = malloc(linesize);
@@ -1725,20 +1865,102 @@ static int parse(struct space *space, const char *filename)
 		}
 		line[j] = '\0';
 
-		dbg("read (%i) '%s'", linenum, line);
-		space->linenum = linenum;
-		err = parse_line(space, line, linesize);
+		if (file->count == alloc) {
+			alloc = alloc ? alloc * 2 : 64;
+			n = realloc(file->rules, alloc * sizeof(*n));
+			if (n == NULL) {
+				err = -ENOMEM;
+				break;
+			}
+			file->rules = n;
+		}
+		err = compile_rule(&file->rules[file->count++], line, j, linenum);
+		if (err < 0)
+			break;
+		linenum += linenum_adj;
+	}
+
+	free(line);
+	file_unmap(buf, bufsize);
+	return err;
+}
+
+static int get_rule_file(const char *filename, struct rule_file **result)
+{
+	struct rule_file *file, **pfile;
+	struct stat st;
+	int err;
+
+	if (stat(filename, &st) < 0) {
+		err = errno;
+		error("Unable to open file '%s': %s", filename, strerror(err));
+		return -err;
+	}
+	for (pfile = &rule_files; (file = *pfile) != NULL; pfile = &file->next) {
+		if (strcmp(file->filename, filename))
+			continue;
+		/* a file including itself keeps the rules it started with */
+		if (file->users > 0 ||
+		    (file->mtime == st.st_mtime && file->size == st.st_size)) {
+			*result = file;
+			return 0;
+		}
+		*pfile = file->next;
+		free_rule_file(file);
+		break;
+	}
+	file = calloc(1, sizeof(*file));
+	if (file == NULL)
+		return -ENOMEM;
+	file->filename = strdup(filename);
+	if (file->filename == NULL) {
+		free(file);
+		return -ENOMEM;
+	}
+	file->mtime = st.st_mtime;
+	file->size = st.st_size;
+	err = compile(file);
+	if (err < 0) {
+		free_rule_file(file);
+		return err;
+	}
+	file->next = rule_files;
+	rule_files = file;
+	*result = file;
+	return 0;
+}
+
+static int parse(struct space *space, const char *filename)
+{
+	struct rule_file *file;
+	unsigned int i;
+	int err;
+
+	dbg("start of file '%s'", filename);
+
+	err = get_rule_file(filename, &file);
+	if (err < 0)
+		return err;
+
+	space->filename = filename;
+	file->users++;
+	for (i = 0; !err && i < file->count && !space->quit; i++) {
+		dbg("read (%i) '%s'", file->rules[i].linenum, file->rules[i].text);
+		space->linenum = file->rules[i].linenum;
+		err = parse_line(space, &file->rules[i]);
 		if (err == -EJUSTRETURN) {
 			err = 0;
 			break;
 		}
-		linenum += linenum_adj;
 	}
+	if (!err && i == file->count && !space->quit && file->err) {
+		error("file %s, line %i too long", filename, file->err_linenum);
+		err = file->err;
+	}
+	file->users--;
 
-	free(line);
 	space->filename = NULL;
 	space->linenum = -1;
-	file_unmap(buf, bufsize);
 	dbg("end of file '%s'", filename);
 	return err ? err : -abs(space->exit_code);
 }
@@ -1748,6 +1970,7 @@ int init(const char *cfgdir, const char *filename, int flags, const char *cardna
 	struct space *space;
 	struct snd_card_iterator iter;
 	int err = 0, lasterr = 0;
+	long long start;
 	
 	sysfs_init();
 	err = snd_card_iterator_sinit(&iter, cardname);
@@ -1760,12 +1983,15 @@ int init(const char *cfgdir, const char *filename, int flags, const char *cardna
 				lasterr = err;
 			continue;
 		}
+		start = profile_now();
 		err = init_ucm(flags, iter.card);
+		profile_phase(iter.card, "ucm", start);
 		if (err == 0)
 			continue;
 		err = init_space(&space, iter.card);
 		if (err != 0)
 			continue;
+		start = profile_now();
 		space->rootdir = new_root_dir(filename);
 		if (space->rootdir != NULL) {
 			err = parse(space, filename);
@@ -1776,6 +2002,7 @@ int init(const char *cfgdir, const char *filename, int flags, const char *cardna
 			}
 		}
 		free_space(space);
+		profile_phase(iter.card, "rules", start);
 		if (err < 0)
 			goto out;
 	}
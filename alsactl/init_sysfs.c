@@ -21,20 +21,127 @@
 static char sysfs_path[PATH_SIZE];
 
 /* attribute value cache */
+#define ATTR_HASH_SIZE	256
+
 static LIST_HEAD(attr_list);
+static struct sysfs_attr *attr_hash[ATTR_HASH_SIZE];
 struct sysfs_attr {
 	struct list_head node;
+	struct sysfs_attr *hnext;	/* hash chain */
+	unsigned int hash;
+	int loaded;			/* value was read (or is known missing) */
 	char path[PATH_SIZE];
 	char *value;			/* points to value_local if value is cached */
 	char value_local[NAME_SIZE];
 };
 
+/* device directories already listed to the cache */
+static LIST_HEAD(dir_list);
+struct sysfs_dir {
+	struct list_head node;
+	char path[PATH_SIZE];
+};
+
+static unsigned int sysfs_hash(const char *path)
+{
+	return fnv_hash_str(FNV_OFFSET, path);
+}
+
+static struct sysfs_attr *sysfs_attr_find(const char *path, unsigned int hash)
+{
+	struct sysfs_attr *attr;
+
+	for (attr = attr_hash[hash % ATTR_HASH_SIZE]; attr; attr = attr->hnext) {
+		if (attr->hash == hash && strcmp(attr->path, path) == 0)
+			return attr;
+	}
+	return NULL;
+}
+
+static struct sysfs_attr *sysfs_attr_add(const char *path, unsigned int hash)
+{
+	struct sysfs_attr *attr;
+
+	attr = malloc(sizeof(struct sysfs_attr));
+	if (attr == NULL)
+		return NULL;
+	memset(attr, 0x00, sizeof(struct sysfs_attr));
+	strlcpy(attr->path, path, sizeof(attr->path));
+	attr->hash = hash;
+	attr->hnext = attr_hash[hash % ATTR_HASH_SIZE];
+	attr_hash[hash % ATTR_HASH_SIZE] = attr;
+	list_add(&attr->node, &attr_list);
+	return attr;
+}
+
+/*
+ * List the device directory once and add an entry for each attribute.
+ * The values are read on the first lookup, but a name which is not in
+ * the directory is known missing without another syscall.
+ * Returns 1 when the directory is listed in the cache.
+ */
+static int sysfs_dir_scan(const char *devpath)
+{
+	char path_full[PATH_SIZE];
+	char path[PATH_SIZE];
+	struct sysfs_dir *dir;
+	struct dirent *dent;
+	DIR *d;
+	size_t len;
+
+	list_for_each_entry(dir, &dir_list, node) {
+		if (strcmp(dir->path, devpath) == 0)
+			return 1;
+	}
+
+	strlcpy(path_full, sysfs_path, sizeof(path_full));
+	if (strlcat(path_full, devpath, sizeof(path_full)) >= sizeof(path_full))
+		return 0;
+	d = opendir(path_full);
+	if (d == NULL) {
+		dbg("cannot list '%s': %s", path_full, strerror(errno));
+		return 0;
+	}
+	dir = malloc(sizeof(struct sysfs_dir));
+	if (dir == NULL) {
+		closedir(d);
+		return 0;
+	}
+	strlcpy(dir->path, devpath, sizeof(dir->path));
+
+	strlcpy(path, devpath, sizeof(path));
+	len = strlcat(path, "/", sizeof(path));
+	if (len >= sizeof(path))
+		len = sizeof(path) - 1;
+	while ((dent = readdir(d)) != NULL) {
+		unsigned int hash;
+
+		if (dent->d_name[0] == '.')
+			continue;
+		if (dent->d_type == DT_DIR)
+			continue;
+		path[len] = '\0';
+		if (strlcat(path, dent->d_name, sizeof(path)) >= sizeof(path))
+			continue;
+		hash = sysfs_hash(path);
+		if (sysfs_attr_find(path, hash) == NULL)
+			sysfs_attr_add(path, hash);
+	}
+	closedir(d);
+
+	list_add(&dir->node, &dir_list);
+	dbg("listed '%s'", path_full);
+	return 1;
+}
+
 static int sysfs_init(void)
 {
 	const char *env;
 	char sysfs_test[PATH_SIZE];
 
 	INIT_LIST_HEAD(&attr_list);
+	INIT_LIST_HEAD(&dir_list);
+	memset(attr_hash, 0, sizeof(attr_hash));
 
 	env = getenv("SYSFS_PATH");
 	if (env) {
@@ -62,11 +169,18 @@ static void sysfs_cleanup(void)
 {
 	struct sysfs_attr *attr_loop;
 	struct sysfs_attr *attr_temp;
+	struct sysfs_dir *dir_loop;
+	struct sysfs_dir *dir_temp;
 
 	list_for_each_entry_safe(attr_loop, attr_temp, &attr_list, node) {
 		list_del(&attr_loop->node);
 		free(attr_loop);
 	}
+	list_for_each_entry_safe(dir_loop, dir_temp, &dir_list, node) {
+		list_del(&dir_loop->node);
+		free(dir_loop);
+	}
+	memset(attr_hash, 0, sizeof(attr_hash));
 }
 
 static char *sysfs_attr_get_value(const char *devpath, const char *attr_name)
@@ -74,9 +188,10 @@ static char *sysfs_attr_get_value(const char *devpath, const char *attr_name)
 	char path_full[PATH_SIZE];
 	const char *path;
 	char value[NAME_SIZE];
-	struct sysfs_attr *attr_loop;
 	struct sysfs_attr *attr;
 	struct stat statbuf;
+	unsigned int hash;
+	int listed;
 	int fd;
 	ssize_t size;
 	size_t sysfs_len;
@@ -88,23 +203,31 @@ static char *sysfs_attr_get_value(const char *devpath, const char *attr_name)
 	strlcat(path_full, "/", sizeof(path_full));
 	strlcat(path_full, attr_name, sizeof(path_full));
 
+	/* attributes in subdirectories are not listed by the scan */
+	listed = strchr(attr_name, '/') == NULL && sysfs_dir_scan(devpath);
+
 	/* look for attribute in cache */
-	list_for_each_entry(attr_loop, &attr_list, node) {
-		if (strcmp(attr_loop->path, path) == 0) {
-			dbg("found in cache '%s'", attr_loop->path);
-			return attr_loop->value;
-		}
+	hash = sysfs_hash(path);
+	attr = sysfs_attr_find(path, hash);
+	if (attr && attr->loaded) {
+		dbg("found in cache '%s'", attr->path);
+		return attr->value;
 	}
 
 	/* store attribute in cache (also negatives are kept in cache) */
-	dbg("new uncached attribute '%s'", path_full);
-	attr = malloc(sizeof(struct sysfs_attr));
-	if (attr == NULL)
-		return NULL;
-	memset(attr, 0x00, sizeof(struct sysfs_attr));
-	strlcpy(attr->path, path, sizeof(attr->path));
-	dbg("add to cache '%s'", path_full);
-	list_add(&attr->node, &attr_list);
+	if (attr == NULL) {
+		dbg("new uncached attribute '%s'", path_full);
+		attr = sysfs_attr_add(path, hash);
+		if (attr == NULL)
+			return NULL;
+		dbg("add to cache '%s'", path_full);
+		if (listed) {
+			/* not in the directory listing */
+			attr->loaded = 1;
+			goto out;
+		}
+	}
+	attr->loaded = 1;
 
 	if (lstat(path_full, &statbuf) != 0) {
 		dbg("stat '%s' failed: %s", path_full, strerror(errno));
@@ -237,11 +237,57 @@ int run_program0(struct space *space,
 	return retval;
 }
 
+/*
+ * The external programs are probes, their result is kept for the card,
+ * so a program runs only once. The buildin commands depend on the
+ * current control and are not cached.
+ */
 static
 int run_program(struct space *space, const char *command0, char *result,
 		size_t ressize, size_t *reslen, int log)
 {
+	struct program_cache *pc;
+	char buf[PATH_SIZE];
+	size_t len = 0;
+	int retval;
+
 	if (command0[0] == '_' && command0[1] == '_')
 		return run_program1(space, command0, result, ressize, reslen, log);
-	return run_program0(space, command0, result, ressize, reslen, log);
+	for (pc = space->program_cache; pc; pc = pc->next) {
+		if (strcmp(pc->command, command0) == 0) {
+			dbg("'%s' cached result '%s'", command0, pc->result);
+			if (result) {
+				len = strlcpy(result, pc->result, ressize);
+				if (reslen)
+					*reslen = len < ressize ? len : ressize - 1;
+			}
+			return pc->retval;
+		}
+	}
+	buf[0] = '\0';
+	retval = run_program0(space, command0, buf, sizeof(buf), &len, log);
+	if (result) {
+		if (len >= ressize) {
+			Perror(space, "ressize %ld too short", (long)ressize);
+			retval = -1;
+		}
+		strlcpy(result, buf, ressize);
+		if (reslen)
+			*reslen = len < ressize ? len : ressize - 1;
+	}
+	pc = calloc(1, sizeof(*pc));
+	if (pc == NULL)
+		return retval;
+	pc->command = strdup(command0);
+	pc->result = strdup(buf);
+	if (pc->command == NULL || pc->result == NULL) {
+		free(pc->command);
+		free(pc->result);
+		free(pc);
+		return retval;
+	}
+	pc->retval = retval;
+	pc->next = space->program_cache;
+	space->program_cache = pc;
+	return retval;
 }
@@ -27,9 +27,60 @@
 #include <fcntl.h>
 #include <errno.h>
 #include <string.h>
+#include <signal.h>
 #include <sys/stat.h>
 #include "alsactl.h"
 
+/*
+ * The open file description locks are released with the last descriptor
+ * only, and they conflict with the POSIX record locks of older versions.
+ */
+#ifdef F_OFD_SETLKW
+#define LOCK_SETLK	F_OFD_SETLK
+#define LOCK_SETLKW	F_OFD_SETLKW
+#else
+#define LOCK_SETLK	F_SETLK
+#define LOCK_SETLKW	F_SETLKW
+#endif
+
+static void lock_alarm(int sig)
+{
+}
+
+/*
+ * Wait for the lock in the kernel, so that the waiters take it one after
+ * another as soon as it is released. The wait is interrupted by an alarm
+ * after timeout seconds. The restore threads block SIGALRM (see
+ * restore_cards()), so the signal reaches the thread blocked in fcntl().
+ */
+static int lock_wait(int fd, struct flock *lck, int timeout)
+{
+	struct sigaction sa, osa;
+	unsigned int oalarm;
+	int err = 0;
+
+	if (fcntl(fd, LOCK_SETLK, lck) == 0)
+		return 0;
+	if (errno != EAGAIN && errno != EACCES)
+		return -errno;
+
+	memset(&sa, 0, sizeof(sa));
+	sa.sa_handler = lock_alarm;
+	sigemptyset(&sa.sa_mask);
+	/* no SA_RESTART, the alarm has to interrupt fcntl() */
+	sa.sa_flags = 0;
+	if (sigaction(SIGALRM, &sa, &osa) < 0)
+		return -errno;
+	oalarm = alarm(timeout);
+	if (fcntl(fd, LOCK_SETLKW, lck) < 0)
+		err = errno == EINTR ? -EBUSY : -errno;
+	alarm(0);
+	sigaction(SIGALRM, &osa, NULL);
+	if (oalarm > 0)
+		alarm(oalarm > (unsigned int)timeout ? oalarm - timeout : 1);
+	return err;
+}
+
 static int state_lock_(const char *file, int lock, int timeout, int _fd)
 {
 	int fd = -1, err = 0;
@@ -93,16 +144,12 @@ static int state_lock_(const char *file, int lock, int timeout, int _fd)
 			goto out;
 		}
 	}
-	while (timeout > 0) {
-		if (fcntl(fd, F_SETLK, &lck) < 0) {
-			sleep(1);
-			timeout--;
-		} else {
-			break;
-		}
-	}
-	if (timeout <= 0) {
-		err = -EBUSY;
+	if (lock) {
+		err = lock_wait(fd, &lck, timeout > 0 ? timeout : 1);
+		if (err < 0)
+			goto out;
+	} else if (fcntl(fd, LOCK_SETLK, &lck) < 0) {
+		err = -errno;
 		goto out;
 	}
 	if (lock) {
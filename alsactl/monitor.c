@@ -22,6 +22,8 @@
 #include <stdio.h>
 #include <stdbool.h>
 #include <string.h>
+#include <stdarg.h>
+#include <stdint.h>
 #include <sys/epoll.h>
 #include <sys/inotify.h>
 #include <limits.h>
@@ -38,9 +40,138 @@ struct src_entry {
 	snd_ctl_t *handle;
 	char *name;
 	unsigned int pfd_count;
+	unsigned long long events;	/* since the last stats report */
+	unsigned long long total;
 	struct list_head list;
 };
 
+struct monitor_ctx {
+	int format;			/* MONITOR_TEXT, _JSON or _BINARY */
+	unsigned int stats;		/* stats period in seconds, 0 = off */
+	uint64_t stats_last;		/* CLOCK_MONOTONIC, nanoseconds */
+	uint64_t stats_next;
+};
+
+/*
+ * The binary format is a stream of records in host byte order. Each record
+ * starts with its total size and type, the card name and (for events) the
+ * element name follow the fixed part without the terminating zero.
+ */
+#define MONITOR_RECORD_EVENT	1
+#define MONITOR_RECORD_STATS	2
+
+struct monitor_event_record {
+	uint32_t size;
+	uint16_t type;
+	uint16_t card_len;
+	uint64_t tstamp;
+	uint32_t numid;
+	uint32_t iface;
+	uint32_t device;
+	uint32_t subdevice;
+	uint32_t index;
+	uint32_t mask;
+	uint32_t name_len;
+	uint32_t reserved;
+};
+
+struct monitor_stats_record {
+	uint32_t size;
+	uint16_t type;
+	uint16_t card_len;
+	uint64_t tstamp;
+	uint64_t events;
+	uint64_t total;
+	uint32_t interval;		/* milliseconds */
+	uint32_t reserved;
+};
+
+/*
+ * The compact formats are collected here and written once per dispatch
+ * round (or when the buffer fills up) instead of once per event.
+ */
+static struct {
+	size_t len;
+	char buf[64 * 1024];
+} out;
+
+static void out_flush(void)
+{
+	if (out.len > 0) {
+		fwrite(out.buf, 1, out.len, stdout);
+		out.len = 0;
+	}
+	fflush(stdout);
+}
+
+static void out_write(const void *data, size_t size)
+{
+	if (out.len + size > sizeof(out.buf))
+		out_flush();
+	if (size > sizeof(out.buf)) {
+		fwrite(data, 1, size, stdout);
+		return;
+	}
+	memcpy(out.buf + out.len, data, size);
+	out.len += size;
+}
+
+static void out_printf(const char *fmt, ...)
+{
+	va_list ap;
+	size_t room;
+	int len;
+
+	room = sizeof(out.buf) - out.len;
+	va_start(ap, fmt);
+	len = vsnprintf(out.buf + out.len, room, fmt, ap);
+	va_end(ap);
+	if (len < 0)
+		return;
+	if ((size_t)len < room) {
+		out.len += len;
+		return;
+	}
+	/* does not fit, flush and format again into the empty buffer */
+	out_flush();
+	va_start(ap, fmt);
+	len = vsnprintf(out.buf, sizeof(out.buf), fmt, ap);
+	va_end(ap);
+	if (len < 0)
+		return;
+	out.len = (size_t)len < sizeof(out.buf) ? (size_t)len : sizeof(out.buf) - 1;
+}
+
+static void out_json_string(const char *str)
+{
+	char tmp[8];
+
+	out_write("\"", 1);
+	for (; *str; str++) {
+		unsigned char c = *str;
+
+		if (c == '"' || c == '\\') {
+			tmp[0] = '\\';
+			tmp[1] = c;
+			out_write(tmp, 2);
+		} else if (c < 0x20) {
+			snprintf(tmp, sizeof(tmp), "\\u%04x", c);
+			out_write(tmp, 6);
+		} else {
+			out_write(str, 1);
+		}
+	}
+	out_write("\"", 1);
+}
+
+static uint64_t monotonic_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
 static void remove_source_entry(struct src_entry *entry)
 {
 	list_del(&entry->list);
@@ -238,6 +369,146 @@ static int print_event(snd_ctl_t *ctl, const char *name)
 	return 0;
 }
 
+static void json_event(const char *card, uint64_t tstamp,
+		       snd_ctl_event_t *event)
+{
+	static const struct {
+		unsigned int mask;
+		const char *name;
+	} masks[] = {
+		{ SND_CTL_EVENT_MASK_VALUE, "VALUE" },
+		{ SND_CTL_EVENT_MASK_INFO, "INFO" },
+		{ SND_CTL_EVENT_MASK_ADD, "ADD" },
+		{ SND_CTL_EVENT_MASK_TLV, "TLV" },
+	};
+	unsigned int mask, i;
+	bool first = true;
+
+	out_printf("{\"ts\":%llu.%09llu,\"card\":",
+		   (unsigned long long)(tstamp / 1000000000ULL),
+		   (unsigned long long)(tstamp % 1000000000ULL));
+	out_json_string(card);
+	out_printf(",\"numid\":%u,\"iface\":%i,\"device\":%u,\"subdevice\":%u,\"name\":",
+		   snd_ctl_event_elem_get_numid(event),
+		   snd_ctl_event_elem_get_interface(event),
+		   snd_ctl_event_elem_get_device(event),
+		   snd_ctl_event_elem_get_subdevice(event));
+	out_json_string(snd_ctl_event_elem_get_name(event));
+	out_printf(",\"index\":%u,\"mask\":[",
+		   snd_ctl_event_elem_get_index(event));
+	mask = snd_ctl_event_elem_get_mask(event);
+	if (mask == SND_CTL_EVENT_MASK_REMOVE) {
+		out_printf("\"REMOVE\"]}\n");
+		return;
+	}
+	for (i = 0; i < ARRAY_SIZE(masks); i++) {
+		if (!(mask & masks[i].mask))
+			continue;
+		out_printf("%s\"%s\"", first ? "" : ",", masks[i].name);
+		first = false;
+	}
+	out_printf("]}\n");
+}
+
+static void binary_event(const char *card, uint64_t tstamp,
+			 snd_ctl_event_t *event)
+{
+	struct monitor_event_record rec;
+	const char *name = snd_ctl_event_elem_get_name(event);
+	size_t card_len = strlen(card);
+	size_t name_len = strlen(name);
+
+	memset(&rec, 0, sizeof(rec));
+	rec.size = sizeof(rec) + card_len + name_len;
+	rec.type = MONITOR_RECORD_EVENT;
+	rec.card_len = card_len;
+	rec.tstamp = tstamp;
+	rec.numid = snd_ctl_event_elem_get_numid(event);
+	rec.iface = snd_ctl_event_elem_get_interface(event);
+	rec.device = snd_ctl_event_elem_get_device(event);
+	rec.subdevice = snd_ctl_event_elem_get_subdevice(event);
+	rec.index = snd_ctl_event_elem_get_index(event);
+	rec.mask = snd_ctl_event_elem_get_mask(event);
+	rec.name_len = name_len;
+	out_write(&rec, sizeof(rec));
+	out_write(card, card_len);
+	out_write(name, name_len);
+}
+
+static int handle_event(struct monitor_ctx *ctx, struct src_entry *entry)
+{
+	snd_ctl_event_t *event;
+	uint64_t tstamp;
+	int err;
+
+	if (ctx->format == MONITOR_TEXT) {
+		err = print_event(entry->handle, entry->name);
+		if (err >= 0)
+			entry->events++;
+		return err;
+	}
+
+	snd_ctl_event_alloca(&event);
+	err = snd_ctl_read(entry->handle, event);
+	if (err < 0)
+		return err;
+	if (snd_ctl_event_get_type(event) != SND_CTL_EVENT_ELEM)
+		return 0;
+
+	tstamp = monotonic_ns();
+	entry->events++;
+	if (ctx->format == MONITOR_JSON)
+		json_event(entry->name, tstamp, event);
+	else
+		binary_event(entry->name, tstamp, event);
+	return 0;
+}
+
+static void report_stats(struct monitor_ctx *ctx, struct list_head *srcs,
+			 uint64_t now)
+{
+	struct monitor_stats_record rec;
+	struct src_entry *entry;
+	uint64_t interval = now - ctx->stats_last;
+	double rate;
+
+	if (interval == 0)
+		interval = 1;
+	list_for_each_entry(entry, srcs, list) {
+		entry->total += entry->events;
+		rate = (double)entry->events * 1000000000.0 / interval;
+		switch (ctx->format) {
+		case MONITOR_TEXT:
+			printf("stats %s, %llu events, %.2f/s, %llu total\n",
+			       entry->name, entry->events, rate, entry->total);
+			break;
+		case MONITOR_JSON:
+			out_printf("{\"ts\":%llu.%09llu,\"card\":",
+				   (unsigned long long)(now / 1000000000ULL),
+				   (unsigned long long)(now % 1000000000ULL));
+			out_json_string(entry->name);
+			out_printf(",\"stats\":{\"events\":%llu,\"rate\":%.2f,\"total\":%llu}}\n",
+				   entry->events, rate, entry->total);
+			break;
+		default:
+			memset(&rec, 0, sizeof(rec));
+			rec.size = sizeof(rec) + strlen(entry->name);
+			rec.type = MONITOR_RECORD_STATS;
+			rec.card_len = strlen(entry->name);
+			rec.tstamp = now;
+			rec.events = entry->events;
+			rec.total = entry->total;
+			rec.interval = interval / 1000000;
+			out_write(&rec, sizeof(rec));
+			out_write(entry->name, rec.card_len);
+			break;
+		}
+		entry->events = 0;
+	}
+	ctx->stats_last = now;
+	ctx->stats_next = now + ctx->stats * 1000000000ULL;
+}
+
 static int operate_dispatcher(int epfd, uint32_t op, struct epoll_event *epev,
 			      struct src_entry *entry)
 {
@@ -299,7 +570,7 @@ static int prepare_dispatcher(int epfd, int sigfd, int infd,
 }
 
 static int run_dispatcher(int epfd, int sigfd, int infd, struct list_head *srcs,
-			  bool *retry)
+			  struct monitor_ctx *ctx, bool *retry)
 {
 	struct src_entry *entry;
 	unsigned int max_ev_count;
@@ -315,10 +586,21 @@ static int run_dispatcher(int epfd, int sigfd, int infd, struct list_head *srcs,
 		return -ENOMEM;
 
 	while (true) {
+		int timeout = -1;
+		uint64_t now;
 		int count;
 		int i;
 
-		count = epoll_wait(epfd, epev, max_ev_count, -1);
+		if (ctx->stats) {
+			now = monotonic_ns();
+			if (now >= ctx->stats_next)
+				report_stats(ctx, srcs, now);
+			timeout = (ctx->stats_next - now + 999999) / 1000000;
+		}
+		if (ctx->format != MONITOR_TEXT || ctx->stats)
+			out_flush();
+
+		count = epoll_wait(epfd, epev, max_ev_count, timeout);
 		if (count < 0) {
 			if (errno == EINTR)
 				continue;
@@ -343,7 +625,7 @@ static int run_dispatcher(int epfd, int sigfd, int infd, struct list_head *srcs,
 
 			entry = ev->data.ptr;
 			if (ev->events & EPOLLIN)
-				print_event(entry->handle, entry->name);
+				handle_event(ctx, entry);
 			if (ev->events & EPOLLERR) {
 				operate_dispatcher(epfd, EPOLL_CTL_DEL, NULL, entry);
 				remove_source_entry(entry);
@@ -351,6 +633,7 @@ static int run_dispatcher(int epfd, int sigfd, int infd, struct list_head *srcs,
 		}
 	}
 end:
+	out_flush();
 	free(epev);
 	return err;
 }
@@ -388,9 +671,13 @@ static int prepare_signalfd(int *sigfd)
 	return 0;
 }
 
-int monitor(const char *name)
+int monitor(const char *name, int format, int stats)
 {
 	LIST_HEAD(srcs);
+	struct monitor_ctx ctx = {
+		.format = format,
+		.stats = stats > 0 ? stats : 0,
+	};
 	int sigfd = 0;
 	int epfd;
 	int infd;
@@ -418,6 +705,10 @@ int monitor(const char *name)
 		err = -errno;
 		goto error;
 	}
+	if (ctx.stats) {
+		ctx.stats_last = monotonic_ns();
+		ctx.stats_next = ctx.stats_last + ctx.stats * 1000000000ULL;
+	}
 retry:
 	retry = false;
 	err = prepare_source_entry(&srcs, name);
@@ -426,7 +717,7 @@ retry:
 
 	err = prepare_dispatcher(epfd, sigfd, infd, &srcs);
 	if (err >= 0)
-		err = run_dispatcher(epfd, sigfd, infd, &srcs, &retry);
+		err = run_dispatcher(epfd, sigfd, infd, &srcs, &ctx, &retry);
 	clear_dispatcher(epfd, sigfd, infd, &srcs);
 
 	if (retry) {
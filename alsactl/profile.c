@@ -0,0 +1,234 @@
+/*
+ *  Advanced Linux Sound Architecture Control Program - profiling
+ *  Copyright (c) 2026 by agent <agent@local>
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#include "aconfig.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <syslog.h>
+#include <pthread.h>
+#include "alsactl.h"
+
+/*
+ * The time of each phase is summed per card (card -1 is the global part
+ * like the state file parsing) and the slowest control writes are kept
+ * for each card. The restore runs the cards in threads, so the data is
+ * guarded by a mutex. Nothing is recorded unless profilefile is set.
+ */
+#define PROFILE_SLOWEST		10
+
+struct profile_phase {
+	struct profile_phase *next;
+	int card;
+	char phase[16];
+	long long usec;
+	unsigned int count;
+};
+
+struct profile_control {
+	int card;
+	long long usec;
+	char id[96];
+};
+
+static pthread_mutex_t profile_mutex = PTHREAD_MUTEX_INITIALIZER;
+static struct profile_phase *phases, **phases_tail = &phases;
+static struct profile_control slowest[PROFILE_SLOWEST * 32];
+static unsigned int slowest_count;
+static long long profile_start;
+
+long long profile_now(void)
+{
+	struct timespec ts;
+
+	if (profilefile == NULL)
+		return 0;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	if (profile_start == 0)
+		profile_start = ts.tv_sec * 1000000LL + ts.tv_nsec / 1000;
+	return ts.tv_sec * 1000000LL + ts.tv_nsec / 1000;
+}
+
+void profile_phase(int card, const char *phase, long long start)
+{
+	struct profile_phase *p;
+	long long usec;
+
+	if (profilefile == NULL)
+		return;
+	usec = profile_now() - start;
+	pthread_mutex_lock(&profile_mutex);
+	for (p = phases; p; p = p->next) {
+		if (p->card == card && strcmp(p->phase, phase) == 0)
+			break;
+	}
+	if (p == NULL) {
+		p = calloc(1, sizeof(*p));
+		if (p == NULL)
+			goto out;
+		p->card = card;
+		snprintf(p->phase, sizeof(p->phase), "%s", phase);
+		/* keep the order of the first occurrence */
+		*phases_tail = p;
+		phases_tail = &p->next;
+	}
+	p->usec += usec;
+	p->count++;
+out:
+	pthread_mutex_unlock(&profile_mutex);
+}
+
+void profile_control(int card, const char *id, long long start)
+{
+	struct profile_control *c, *min = NULL;
+	unsigned int i, n = 0;
+	long long usec;
+
+	if (profilefile == NULL)
+		return;
+	usec = profile_now() - start;
+	pthread_mutex_lock(&profile_mutex);
+	/* the PROFILE_SLOWEST entries of each card, the fastest is replaced */
+	for (i = 0; i < slowest_count; i++) {
+		c = &slowest[i];
+		if (c->card != card)
+			continue;
+		n++;
+		if (min == NULL || c->usec < min->usec)
+			min = c;
+	}
+	if (n < PROFILE_SLOWEST) {
+		if (slowest_count >= ARRAY_SIZE(slowest))
+			goto out;
+		c = &slowest[slowest_count++];
+	} else if (usec > min->usec) {
+		c = min;
+	} else {
+		goto out;
+	}
+	c->card = card;
+	c->usec = usec;
+	snprintf(c->id, sizeof(c->id), "%s", id);
+out:
+	pthread_mutex_unlock(&profile_mutex);
+}
+
+static int slowest_cmp(const void *a, const void *b)
+{
+	const struct profile_control *c1 = a, *c2 = b;
+
+	if (c1->card != c2->card)
+		return c1->card - c2->card;
+	return c1->usec < c2->usec ? 1 : (c1->usec > c2->usec ? -1 : 0);
+}
+
+static void json_string(FILE *fp, const char *s)
+{
+	fputc('"', fp);
+	for (; *s; s++) {
+		if (*s == '"' || *s == '\\')
+			fprintf(fp, "\\%c", *s);
+		else if ((unsigned char)*s < 0x20)
+			fprintf(fp, "\\u%04x", (unsigned char)*s);
+		else
+			fputc(*s, fp);
+	}
+	fputc('"', fp);
+}
+
+static void report_syslog(const char *command, long long total)
+{
+	struct profile_phase *p;
+	unsigned int i;
+
+	syslog(LOG_INFO, "profile %s: %lld us", command, total);
+	for (p = phases; p; p = p->next)
+		syslog(LOG_INFO, "profile card %d %s: %lld us (%u)",
+		       p->card, p->phase, p->usec, p->count);
+	for (i = 0; i < slowest_count; i++)
+		syslog(LOG_INFO, "profile card %d write %s: %lld us",
+		       slowest[i].card, slowest[i].id, slowest[i].usec);
+}
+
+static int report_json(const char *command, long long total)
+{
+	struct profile_phase *p;
+	unsigned int i;
+	FILE *fp;
+
+	if (strcmp(profilefile, "-") == 0)
+		fp = stdout;
+	else
+		fp = fopen(profilefile, "w");
+	if (fp == NULL) {
+		error("Cannot open %s for writing: %s", profilefile, strerror(errno));
+		return -errno;
+	}
+	fprintf(fp, "{\n  \"command\": ");
+	json_string(fp, command);
+	fprintf(fp, ",\n  \"total_us\": %lld,\n  \"phases\": [", total);
+	for (p = phases; p; p = p->next)
+		fprintf(fp, "%s\n    { \"card\": %d, \"phase\": \"%s\", \"us\": %lld, \"count\": %u }",
+			p == phases ? "" : ",", p->card, p->phase, p->usec, p->count);
+	fprintf(fp, "\n  ],\n  \"slowest\": [");
+	for (i = 0; i < slowest_count; i++) {
+		fprintf(fp, "%s\n    { \"card\": %d, \"control\": ",
+			i == 0 ? "" : ",", slowest[i].card);
+		json_string(fp, slowest[i].id);
+		fprintf(fp, ", \"us\": %lld }", slowest[i].usec);
+	}
+	fprintf(fp, "\n  ]\n}\n");
+	if (fp == stdout)
+		return fflush(fp) ? -errno : 0;
+	return fclose(fp) ? -errno : 0;
+}
+
+/*
+ * Write the collected data to profilefile, or to syslog when it is
+ * "syslog", and free it.
+ */
+int profile_report(const char *command)
+{
+	struct profile_phase *p, *next;
+	long long total;
+	int err;
+
+	if (profilefile == NULL)
+		return 0;
+	total = profile_now() - profile_start;
+	qsort(slowest, slowest_count, sizeof(slowest[0]), slowest_cmp);
+	if (strcmp(profilefile, "syslog") == 0) {
+		report_syslog(command, total);
+		err = 0;
+	} else {
+		err = report_json(command, total);
+	}
+	for (p = phases; p; p = next) {
+		next = p->next;
+		free(p);
+	}
+	phases = NULL;
+	phases_tail = &phases;
+	slowest_count = 0;
+	profile_start = 0;
+	return err;
+}
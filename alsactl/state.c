@@ -27,12 +27,14 @@
 #include <stdio.h>
 #include <assert.h>
 #include <errno.h>
+#include <pthread.h>
+#include <signal.h>
 #include "alsactl.h"
 
 
 static char *id_str(snd_ctl_elem_id_t *id)
 {
-	static char str[128];
+	static __thread char str[128];
 	assert(id);
 	sprintf(str, "%i,%i,%i,%s,%i", 
 		snd_ctl_elem_id_get_interface(id),
@@ -45,7 +47,7 @@ static char *id_str(snd_ctl_elem_id_t *id)
 
 static char *num_str(long n)
 {
-	static char str[32];
+	static __thread char str[32];
 	sprintf(str, "%ld", n);
 	return str;
 }
@@ -159,14 +161,161 @@ static unsigned int *str_to_tlv(const char *s)
 	return tlv;
 }
 
+/*
+ * The static part of the control description (TLV and enum item names)
+ * kept across the saves of one process, so only the values are read
+ * again. The entries are matched by the ctl name, numid and the info
+ * fields; a TLV or info change event drops the entry (state_meta_forget).
+ */
+#define CTL_META_HASH_SIZE	256
+
+struct ctl_meta_key {
+	snd_ctl_elem_type_t type;
+	unsigned int count;
+	unsigned int access;
+	unsigned int items;
+	long long min, max, step;
+	char name[64];
+};
+
+struct ctl_meta {
+	struct ctl_meta *next;
+	unsigned int numid;
+	struct ctl_meta_key key;
+	int tlv_valid;			/* the TLV was read */
+	unsigned int *tlv;		/* NULL when the read failed */
+	unsigned int tlv_size;
+	char **items;
+	char ctl[];
+};
+
+static struct ctl_meta *ctl_meta_table[CTL_META_HASH_SIZE];
+
+static unsigned int ctl_meta_hash(const char *ctl, unsigned int numid)
+{
+	unsigned int hash = fnv_hash_str(FNV_OFFSET, ctl);
+
+	return fnv_hash(hash, &numid, sizeof(numid)) % CTL_META_HASH_SIZE;
+}
+
+static void ctl_meta_key_init(struct ctl_meta_key *key, snd_ctl_elem_info_t *info)
+{
+	memset(key, 0, sizeof(*key));
+	key->type = snd_ctl_elem_info_get_type(info);
+	key->count = snd_ctl_elem_info_get_count(info);
+	key->access = (snd_ctl_elem_info_is_readable(info) << 0) |
+		      (snd_ctl_elem_info_is_writable(info) << 1) |
+		      (snd_ctl_elem_info_is_volatile(info) << 2) |
+		      (snd_ctl_elem_info_is_user(info) << 3) |
+		      (snd_ctl_elem_info_is_tlv_readable(info) << 4) |
+		      (snd_ctl_elem_info_is_tlv_writable(info) << 5);
+	switch (key->type) {
+	case SND_CTL_ELEM_TYPE_INTEGER:
+		key->min = snd_ctl_elem_info_get_min(info);
+		key->max = snd_ctl_elem_info_get_max(info);
+		key->step = snd_ctl_elem_info_get_step(info);
+		break;
+	case SND_CTL_ELEM_TYPE_INTEGER64:
+		key->min = snd_ctl_elem_info_get_min64(info);
+		key->max = snd_ctl_elem_info_get_max64(info);
+		key->step = snd_ctl_elem_info_get_step64(info);
+		break;
+	case SND_CTL_ELEM_TYPE_ENUMERATED:
+		key->items = snd_ctl_elem_info_get_items(info);
+		break;
+	default:
+		break;
+	}
+	strncpy(key->name, snd_ctl_elem_info_get_name(info), sizeof(key->name) - 1);
+}
+
+static void ctl_meta_free(struct ctl_meta *meta)
+{
+	unsigned int i;
+
+	if (meta->items) {
+		for (i = 0; i < meta->key.items; i++)
+			free(meta->items[i]);
+		free(meta->items);
+	}
+	free(meta->tlv);
+	free(meta);
+}
+
+static void ctl_meta_remove(const char *ctl, unsigned int numid)
+{
+	struct ctl_meta **pm, *meta;
+
+	pm = &ctl_meta_table[ctl_meta_hash(ctl, numid)];
+	while ((meta = *pm) != NULL) {
+		if (meta->numid == numid && strcmp(meta->ctl, ctl) == 0) {
+			*pm = meta->next;
+			ctl_meta_free(meta);
+			return;
+		}
+		pm = &meta->next;
+	}
+}
+
+/* find the entry for the control or make a new empty one, NULL on ENOMEM */
+static struct ctl_meta *ctl_meta_get(snd_ctl_t *handle, snd_ctl_elem_info_t *info)
+{
+	const char *ctl = snd_ctl_name(handle);
+	unsigned int numid = snd_ctl_elem_info_get_numid(info);
+	struct ctl_meta_key key;
+	struct ctl_meta *meta;
+	unsigned int hash;
+
+	ctl_meta_key_init(&key, info);
+	hash = ctl_meta_hash(ctl, numid);
+	for (meta = ctl_meta_table[hash]; meta; meta = meta->next) {
+		if (meta->numid == numid && strcmp(meta->ctl, ctl) == 0)
+			break;
+	}
+	if (meta && memcmp(&meta->key, &key, sizeof(key)) == 0)
+		return meta;
+	if (meta)
+		ctl_meta_remove(ctl, numid);
+	meta = calloc(1, sizeof(*meta) + strlen(ctl) + 1);
+	if (meta == NULL)
+		return NULL;
+	meta->numid = numid;
+	meta->key = key;
+	strcpy(meta->ctl, ctl);
+	meta->next = ctl_meta_table[hash];
+	ctl_meta_table[hash] = meta;
+	return meta;
+}
+
+void state_meta_forget(snd_ctl_t *handle, snd_ctl_elem_id_t *id)
+{
+	ctl_meta_remove(snd_ctl_name(handle), snd_ctl_elem_id_get_numid(id));
+}
+
+void state_meta_free(void)
+{
+	struct ctl_meta *meta, *next;
+	unsigned int i;
+
+	for (i = 0; i < CTL_META_HASH_SIZE; i++) {
+		for (meta = ctl_meta_table[i]; meta; meta = next) {
+			next = meta->next;
+			ctl_meta_free(meta);
+		}
+		ctl_meta_table[i] = NULL;
+	}
+}
+
 /*
  * add the TLV string, dB ranges, and dB values to comment fields
  */
 static int add_tlv_comments(snd_ctl_t *handle, snd_ctl_elem_id_t *id,
 			    snd_ctl_elem_info_t *info, snd_ctl_elem_value_t *ctl,
-			    snd_config_t *comment)
+			    snd_config_t *comment, struct ctl_meta *meta)
 {
-	unsigned int tlv[MAX_USER_TLV_SIZE];
+	unsigned int tlvbuf[MAX_USER_TLV_SIZE];
+	unsigned int *tlv = tlvbuf;
+	unsigned int tlv_size = sizeof(tlvbuf);
 	unsigned int *db;
 	long rangemin, rangemax;
 	long dbmin, dbmax, dbgain;
@@ -174,8 +323,28 @@ static int add_tlv_comments(snd_ctl_t *handle, snd_ctl_elem_id_t *id,
 	unsigned int i, count;
 	int err;
 
-	if (snd_ctl_elem_tlv_read(handle, id, tlv, sizeof(tlv)) < 0)
+	/* a writable TLV may change without an info change, read it always */
+	if (meta && snd_ctl_elem_info_is_tlv_writable(info))
+		meta = NULL;
+	if (meta && meta->tlv_valid) {
+		if (meta->tlv == NULL)
+			return 0;
+		tlv = meta->tlv;
+		tlv_size = meta->tlv_size;
+	} else if (snd_ctl_elem_tlv_read(handle, id, tlv, tlv_size) < 0) {
+		if (meta)
+			meta->tlv_valid = 1;
 		return 0; /* ignore error */
+	} else if (meta) {
+		if (tlv[1] <= tlv_size - 2 * sizeof(unsigned int))
+			tlv_size = tlv[1] + 2 * sizeof(unsigned int);
+		meta->tlv = malloc(tlv_size);
+		if (meta->tlv) {
+			memcpy(meta->tlv, tlv, tlv_size);
+			meta->tlv_size = tlv_size;
+			meta->tlv_valid = 1;
+		}
+	}
 
 	if (snd_ctl_elem_info_is_tlv_writable(info)) {
 		char *s = tlv_to_str(tlv);
@@ -189,7 +358,7 @@ static int add_tlv_comments(snd_ctl_t *handle, snd_ctl_elem_id_t *id,
 		}
 	}
 
-	err = snd_tlv_parse_dB_info(tlv, sizeof(tlv), &db);
+	err = snd_tlv_parse_dB_info(tlv, tlv_size, &db);
 	if (err <= 0)
 		return 0;
 
@@ -238,6 +407,7 @@ static int get_control(snd_ctl_t *handle, snd_ctl_elem_id_t *id, snd_config_t *t
 	const char *name;
 	snd_ctl_elem_type_t type;
 	unsigned int count;
+	struct ctl_meta *meta;
 	snd_ctl_elem_value_alloca(&ctl);
 	snd_ctl_elem_info_alloca(&info);
 	snd_ctl_elem_info_set_id(info, id);
@@ -256,6 +426,8 @@ static int get_control(snd_ctl_t *handle, snd_ctl_elem_id_t *id, snd_config_t *t
 		return err;
 	}
 
+	meta = ctl_meta_get(handle, info);
+
 	err = snd_config_compound_add(top, num_str(snd_ctl_elem_info_get_numid(info)), 0, &control);
 	if (err < 0) {
 		error("snd_config_compound_add: %s", snd_strerror(err));
@@ -323,7 +495,7 @@ static int get_control(snd_ctl_t *handle, snd_ctl_elem_id_t *id, snd_config_t *t
 			return err;
 		}
 		if (snd_ctl_elem_info_is_tlv_readable(info)) {
-			err = add_tlv_comments(handle, id, info, ctl, comment);
+			err = add_tlv_comments(handle, id, info, ctl, comment, meta);
 			if (err < 0)
 				return err;
 		}
@@ -354,14 +526,25 @@ static int get_control(snd_ctl_t *handle, snd_ctl_elem_id_t *id, snd_config_t *t
 			return err;
 		}
 		items = snd_ctl_elem_info_get_items(info);
+		if (meta && meta->items == NULL && items > 0)
+			meta->items = calloc(items, sizeof(char *));
 		for (idx = 0; idx < items; idx++) {
-			snd_ctl_elem_info_set_item(info, idx);
-			err = snd_ctl_elem_info(handle, info);
-			if (err < 0) {
-				error("snd_ctl_card_info: %s", snd_strerror(err));
-				return err;
+			const char *iname;
+
+			if (meta && meta->items && meta->items[idx]) {
+				iname = meta->items[idx];
+			} else {
+				snd_ctl_elem_info_set_item(info, idx);
+				err = snd_ctl_elem_info(handle, info);
+				if (err < 0) {
+					error("snd_ctl_card_info: %s", snd_strerror(err));
+					return err;
+				}
+				iname = snd_ctl_elem_info_get_item_name(info);
+				if (meta && meta->items)
+					meta->items[idx] = strdup(iname);
 			}
-			err = snd_config_string_add(item, num_str(idx), snd_ctl_elem_info_get_item_name(info));
+			err = snd_config_string_add(item, num_str(idx), iname);
 			if (err < 0) {
 				error("snd_config_string_add: %s", snd_strerror(err));
 				return err;
@@ -1201,8 +1384,187 @@ static int restore_config_value2(snd_ctl_t *handle, snd_ctl_elem_info_t *info,
 	return 0;
 }
 
+struct restore_stats {
+	int card;
+	unsigned int written;
+	unsigned int skipped;
+};
+
+/*
+ * The controls of the card indexed by their ids, so the configuration
+ * nodes are matched without a lookup ioctl for each of them. It is
+ * built once per card from a single element list.
+ */
+struct ctl_map_entry {
+	struct ctl_map_entry *next;
+	unsigned int numid;
+	unsigned int iface;
+	unsigned int device;
+	unsigned int subdevice;
+	unsigned int index;
+	char name[];
+};
+
+struct ctl_map {
+	struct ctl_map_entry **table;
+	unsigned int mask;
+};
+
+static unsigned int ctl_map_hash(unsigned int iface, unsigned int device,
+				 unsigned int subdevice, const char *name,
+				 unsigned int index)
+{
+	unsigned int val[4] = { iface, device, subdevice, index };
+
+	return fnv_hash(fnv_hash_str(FNV_OFFSET, name), val, sizeof(val));
+}
+
+static int ctl_map_add(struct ctl_map *map, unsigned int numid,
+		       unsigned int iface, unsigned int device,
+		       unsigned int subdevice, const char *name,
+		       unsigned int index)
+{
+	struct ctl_map_entry *e;
+	unsigned int hash;
+
+	e = malloc(sizeof(*e) + strlen(name) + 1);
+	if (e == NULL)
+		return -ENOMEM;
+	e->numid = numid;
+	e->iface = iface;
+	e->device = device;
+	e->subdevice = subdevice;
+	e->index = index;
+	strcpy(e->name, name);
+	hash = ctl_map_hash(iface, device, subdevice, name, index) & map->mask;
+	e->next = map->table[hash];
+	map->table[hash] = e;
+	return 0;
+}
+
+static unsigned int ctl_map_find(struct ctl_map *map, unsigned int iface,
+				 unsigned int device, unsigned int subdevice,
+				 const char *name, unsigned int index)
+{
+	struct ctl_map_entry *e;
+	unsigned int hash;
+
+	hash = ctl_map_hash(iface, device, subdevice, name, index) & map->mask;
+	for (e = map->table[hash]; e; e = e->next) {
+		if (e->iface == iface && e->device == device &&
+		    e->subdevice == subdevice && e->index == index &&
+		    strcmp(e->name, name) == 0)
+			return e->numid;
+	}
+	return 0;
+}
+
+static void ctl_map_free(struct ctl_map *map)
+{
+	struct ctl_map_entry *e, *n;
+	unsigned int i;
+
+	if (map->table == NULL)
+		return;
+	for (i = 0; i <= map->mask; i++) {
+		for (e = map->table[i]; e; e = n) {
+			n = e->next;
+			free(e);
+		}
+	}
+	free(map->table);
+	map->table = NULL;
+}
+
+static int ctl_map_init(struct ctl_map *map, snd_ctl_t *handle)
+{
+	snd_ctl_elem_list_t *list;
+	snd_ctl_elem_id_t *id;
+	unsigned int idx, count, size;
+	int err;
+	snd_ctl_elem_list_alloca(&list);
+	snd_ctl_elem_id_alloca(&id);
+
+	map->table = NULL;
+	err = snd_ctl_elem_list(handle, list);
+	if (err < 0)
+		return err;
+	count = snd_ctl_elem_list_get_count(list);
+	for (size = 16; size < count; size <<= 1)
+		;
+	map->table = calloc(size, sizeof(*map->table));
+	if (map->table == NULL)
+		return -ENOMEM;
+	map->mask = size - 1;
+	if (count == 0)
+		return 0;
+	if (snd_ctl_elem_list_alloc_space(list, count) < 0) {
+		err = -ENOMEM;
+		goto _err;
+	}
+	err = snd_ctl_elem_list(handle, list);
+	for (idx = 0; idx < count && err >= 0; idx++) {
+		snd_ctl_elem_list_get_id(list, idx, id);
+		err = ctl_map_add(map, snd_ctl_elem_id_get_numid(id),
+				  snd_ctl_elem_id_get_interface(id),
+				  snd_ctl_elem_id_get_device(id),
+				  snd_ctl_elem_id_get_subdevice(id),
+				  snd_ctl_elem_id_get_name(id),
+				  snd_ctl_elem_id_get_index(id));
+	}
+	snd_ctl_elem_list_free_space(list);
+	if (err >= 0)
+		return 0;
+ _err:
+	ctl_map_free(map);
+	return err;
+}
+
+/* compare the parts of the values used by the element */
+int ctl_value_equal(snd_ctl_elem_type_t type, unsigned int count,
+		    snd_ctl_elem_value_t *ctl1, snd_ctl_elem_value_t *ctl2)
+{
+	unsigned int idx;
+	snd_aes_iec958_t iec1, iec2;
+
+	switch (type) {
+	case SND_CTL_ELEM_TYPE_BOOLEAN:
+	case SND_CTL_ELEM_TYPE_INTEGER:
+		for (idx = 0; idx < count; idx++)
+			if (snd_ctl_elem_value_get_integer(ctl1, idx) !=
+			    snd_ctl_elem_value_get_integer(ctl2, idx))
+				return 0;
+		return 1;
+	case SND_CTL_ELEM_TYPE_INTEGER64:
+		for (idx = 0; idx < count; idx++)
+			if (snd_ctl_elem_value_get_integer64(ctl1, idx) !=
+			    snd_ctl_elem_value_get_integer64(ctl2, idx))
+				return 0;
+		return 1;
+	case SND_CTL_ELEM_TYPE_ENUMERATED:
+		for (idx = 0; idx < count; idx++)
+			if (snd_ctl_elem_value_get_enumerated(ctl1, idx) !=
+			    snd_ctl_elem_value_get_enumerated(ctl2, idx))
+				return 0;
+		return 1;
+	case SND_CTL_ELEM_TYPE_BYTES:
+		for (idx = 0; idx < count; idx++)
+			if (snd_ctl_elem_value_get_byte(ctl1, idx) !=
+			    snd_ctl_elem_value_get_byte(ctl2, idx))
+				return 0;
+		return 1;
+	case SND_CTL_ELEM_TYPE_IEC958:
+		snd_ctl_elem_value_get_iec958(ctl1, &iec1);
+		snd_ctl_elem_value_get_iec958(ctl2, &iec2);
+		return memcmp(&iec1, &iec2, sizeof(iec1)) == 0;
+	default:
+		return 0;
+	}
+}
+
 static int set_control(snd_ctl_t *handle, snd_config_t *control,
-		       int *maxnumid, int doit)
+		       int *maxnumid, int doit, struct restore_stats *stats,
+		       struct ctl_map *map)
 {
 	snd_ctl_elem_value_t *ctl;
 	snd_ctl_elem_info_t *info;
@@ -1224,6 +1586,7 @@ static int set_control(snd_ctl_t *handle, snd_config_t *control,
 	snd_config_t *value = NULL;
 	snd_config_t *comment = NULL;
 	unsigned int idx;
+	long long start;
 	int err;
 	char *set;
 	const char *id;
@@ -1325,7 +1688,19 @@ static int set_control(snd_ctl_t *handle, snd_config_t *control,
 		snd_ctl_elem_info_set_subdevice(info, subdevice);
 		snd_ctl_elem_info_set_name(info, name);
 		snd_ctl_elem_info_set_index(info, index);
-		err = snd_ctl_elem_info(handle, info);
+		if (map->table) {
+			numid1 = ctl_map_find(map, iface, device, subdevice,
+					      name, index);
+			err = -ENOENT;
+			if (numid1 > 0) {
+				snd_ctl_elem_info_set_numid(info, numid1);
+				err = snd_ctl_elem_info(handle, info);
+				if (err < 0)
+					snd_ctl_elem_info_set_numid(info, 0);
+			}
+		} else {
+			err = snd_ctl_elem_info(handle, info);
+		}
 		if (err < 0 && comment && check_comment_access(comment, "user")) {
 			err = add_user_control(handle, info, comment);
 			if (err < 0) {
@@ -1333,6 +1708,10 @@ static int set_control(snd_ctl_t *handle, snd_config_t *control,
 				       numid, snd_strerror(err));
 				return err;
 			}
+			if (map->table &&
+			    ctl_map_add(map, snd_ctl_elem_info_get_numid(info),
+					iface, device, subdevice, name, index) < 0)
+				ctl_map_free(map);
 		}
 	}
 	if (err < 0) {
@@ -1470,11 +1849,32 @@ static int set_control(snd_ctl_t *handle, snd_config_t *control,
 	}
 
  _ok:
-	err = doit ? snd_ctl_elem_write(handle, ctl) : 0;
+	if (!doit)
+		return 0;
+	/* a write may reach the codec registers, skip it when nothing changes */
+	if (snd_ctl_elem_info_is_readable(info)) {
+		snd_ctl_elem_value_t *old;
+		snd_ctl_elem_value_alloca(&old);
+		snd_ctl_elem_value_set_numid(old, numid1);
+		if (snd_ctl_elem_read(handle, old) >= 0 &&
+		    ctl_value_equal(type, count, ctl, old)) {
+			stats->skipped++;
+			return 0;
+		}
+	}
+	start = profile_now();
+	err = snd_ctl_elem_write(handle, ctl);
 	if (err < 0) {
 		error("Cannot write control '%d:%ld:%ld:%s:%ld' : %s", (int)iface, device, subdevice, name, index, snd_strerror(err));
 		return err;
 	}
+	if (profilefile) {
+		char cid[96];
+
+		snprintf(cid, sizeof(cid), "#%u %s", numid1, name1);
+		profile_control(stats->card, cid, start);
+	}
+	stats->written++;
 	return 0;
 }
 
@@ -1487,6 +1887,9 @@ static int set_controls(int card, snd_config_t *top, int doit)
 	int err, maxnumid = -1;
 	char name[32], tmpid[16];
 	const char *id;
+	struct restore_stats stats = { card, 0, 0 };
+	struct ctl_map map = { NULL, 0 };
+	long long start;
 	snd_ctl_card_info_alloca(&info);
 
 	sprintf(name, "hw:%d", card);
@@ -1521,14 +1924,22 @@ static int set_controls(int card, snd_config_t *top, int doit)
 		cerror(doit, "state.%s.control is not a compound\n", id);
 		return -EINVAL;
 	}
+	/* without the map, the controls are looked up one by one */
+	start = profile_now();
+	if (ctl_map_init(&map, handle) < 0)
+		dbg("cannot index the controls of card %d", card);
+	profile_phase(card, "index", start);
 	snd_config_for_each(i, next, control) {
 		snd_config_t *n = snd_config_iterator_entry(i);
-		err = set_control(handle, n, &maxnumid, doit);
+		err = set_control(handle, n, &maxnumid, doit, &stats, &map);
 		if (err < 0 && (!force_restore || !doit))
 			goto _close;
 	}
 
 	dbg("maxnumid=%i", maxnumid);
+	if (doit)
+		dbg("card %d: %u controls written, %u unchanged",
+		    card, stats.written, stats.skipped);
 	/* check if we have additional controls in driver */
 	/* in this case we should go through init procedure */
 	if (!doit && maxnumid >= 0) {
@@ -1545,21 +1956,54 @@ static int set_controls(int card, snd_config_t *top, int doit)
 	}
 
  _close:
+	ctl_map_free(&map);
 	snd_ctl_close(handle);
 	dbg("result code: %i", err);
 	return err;
 }
 
+static int state_get(snd_config_t *config, const char *file,
+		     const char *cardname)
+{
+	snd_input_t *in;
+	struct snd_card_iterator iter;
+	int err;
+
+	if (file && (err = snd_input_stdio_open(&in, file, "r")) >= 0) {
+		err = snd_config_load(config, in);
+		snd_input_close(in);
+#if 0
+		if (err < 0) {
+			error("snd_config_load error: %s", snd_strerror(err));
+			return err;
+		}
+#endif
+	}
+
+	err = snd_card_iterator_sinit(&iter, cardname);
+	if (err < 0)
+		return err;
+	while (snd_card_iterator_next(&iter)) {
+		long long start = profile_now();
+
+		if ((err = get_controls(iter.card, config)))
+			return err;
+		profile_phase(iter.card, "read", start);
+	}
+	if (iter.first)
+		return snd_card_iterator_error(&iter);
+	return 0;
+}
+
 int save_state(const char *file, const char *cardname)
 {
 	int err;
 	snd_config_t *config;
-	snd_input_t *in;
 	snd_output_t *out;
 	int stdio;
 	char *nfile = NULL;
 	int lock_fd = -EINVAL;
-	struct snd_card_iterator iter;
+	long long start;
 
 	err = snd_config_top(&config);
 	if (err < 0) {
@@ -1582,28 +2026,9 @@ int save_state(const char *file, const char *cardname)
 			goto out;
 		}
 	}
-	if (!stdio && (err = snd_input_stdio_open(&in, file, "r")) >= 0) {
-		err = snd_config_load(config, in);
-		snd_input_close(in);
-#if 0
-		if (err < 0) {
-			error("snd_config_load error: %s", snd_strerror(err));
-			goto out;
-		}
-#endif
-	}
-
-	err = snd_card_iterator_sinit(&iter, cardname);
+	err = state_get(config, stdio ? NULL : file, cardname);
 	if (err < 0)
 		goto out;
-	while (snd_card_iterator_next(&iter)) {
-		if ((err = get_controls(iter.card, config)))
-			goto out;
-	}
-	if (iter.first) {
-		err = snd_card_iterator_error(&iter);
-		goto out;
-	}
 
 	if (stdio) {
 		err = snd_output_stdio_attach(&out, stdout, 0);
@@ -1615,14 +2040,18 @@ int save_state(const char *file, const char *cardname)
 		err = -errno;
 		goto out;
 	}
+	start = profile_now();
 	err = snd_config_save(config, out);
 	snd_output_close(out);
+	profile_phase(-1, "write", start);
 	if (err < 0) {
 		error("snd_config_save: %s", snd_strerror(err));
 	} else if (nfile) {
 		err = rename(nfile, file);
 		if (err < 0)
 			error("rename failed: %s (%s)", strerror(-err), file);
+		else if (cachefile)
+			cache_save(cachefile, file, cardname);
 	}
 out:
 	if (!stdio && lock_fd >= 0)
@@ -1633,17 +2062,351 @@ out:
 	return err;
 }
 
+/*
+ * The daemon keeps the last stored tree and its text in memory. Only the
+ * controls reported as changed are read again from the driver and the
+ * file is not touched at all when the new text equals the stored one.
+ */
+struct state_cache {
+	snd_config_t *config;
+	char *text;
+	size_t size;
+};
+
+void state_cache_free(struct state_cache *cache)
+{
+	if (cache == NULL)
+		return;
+	if (cache->config)
+		snd_config_delete(cache->config);
+	free(cache->text);
+	free(cache);
+}
+
+static int state_cache_text(struct state_cache *cache, const char *text,
+			    size_t size)
+{
+	char *n;
+
+	n = malloc(size ? size : 1);
+	if (n == NULL)
+		return -ENOMEM;
+	memcpy(n, text, size);
+	free(cache->text);
+	cache->text = n;
+	cache->size = size;
+	return 0;
+}
+
+static int state_cache_new(struct state_cache **cache, const char *file,
+			   const char *cardname)
+{
+	struct state_cache *c;
+	char *buf;
+	size_t size;
+	int err;
+
+	c = calloc(1, sizeof(*c));
+	if (c == NULL)
+		return -ENOMEM;
+	err = snd_config_top(&c->config);
+	if (err < 0) {
+		error("snd_config_top error: %s", snd_strerror(err));
+		goto _err;
+	}
+	err = state_get(c->config, file, cardname);
+	if (err < 0)
+		goto _err;
+	/* the current file content, so an unchanged state is not stored again */
+	if (file_map(file, &buf, &size) == 0) {
+		err = state_cache_text(c, buf, size);
+		file_unmap(buf, size);
+		if (err < 0)
+			goto _err;
+	}
+	*cache = c;
+	return 0;
+ _err:
+	state_cache_free(c);
+	return err;
+}
+
+/* re-read all controls of the card, used when the controls were added or removed */
+int state_cache_card(struct state_cache *cache, int cardno)
+{
+	return get_controls(cardno, cache->config);
+}
+
+/* replace the value and comments of one control in the cached tree */
+int state_cache_control(struct state_cache *cache, snd_ctl_t *handle,
+			snd_ctl_elem_id_t *id)
+{
+	snd_ctl_card_info_t *info;
+	snd_config_t *control, *top, *n, *old, *item;
+	snd_config_iterator_t i, next, j, jnext;
+	const char *key;
+	int err;
+	snd_ctl_card_info_alloca(&info);
+
+	err = snd_ctl_card_info(handle, info);
+	if (err < 0)
+		return err;
+	err = snd_config_searchv(cache->config, &control, "state",
+				 snd_ctl_card_info_get_id(info), "control", NULL);
+	if (err < 0)
+		return err;
+	err = snd_config_top(&top);
+	if (err < 0)
+		return err;
+	err = get_control(handle, id, top);
+	if (err < 0)
+		goto _free;
+	snd_config_for_each(i, next, top) {
+		n = snd_config_iterator_entry(i);
+		if (snd_config_get_id(n, &key) < 0 ||
+		    snd_config_search(control, key, &old) < 0) {
+			/* not stored yet, the caller re-reads the whole card */
+			err = -ENOENT;
+			goto _free;
+		}
+		/* keep the node in place, so the order in the file is stable */
+		snd_config_for_each(j, jnext, old)
+			snd_config_delete(snd_config_iterator_entry(j));
+		snd_config_for_each(j, jnext, n) {
+			item = snd_config_iterator_entry(j);
+			snd_config_remove(item);
+			err = snd_config_add(old, item);
+			if (err < 0) {
+				snd_config_delete(item);
+				goto _free;
+			}
+		}
+		break;
+	}
+ _free:
+	snd_config_delete(top);
+	return err;
+}
+
+int save_state_cached(struct state_cache **cache, const char *file,
+		      const char *cardname)
+{
+	snd_output_t *out = NULL;
+	char *nfile, *text;
+	size_t size;
+	FILE *fp;
+	int lock_fd, err;
+
+	if (!strcmp(file, "-"))
+		return save_state(file, cardname);
+	nfile = malloc(strlen(file) + 5);
+	if (nfile == NULL) {
+		error("No enough memory...");
+		return -ENOMEM;
+	}
+	strcpy(nfile, file);
+	strcat(nfile, ".new");
+	lock_fd = state_lock(file, 10);
+	if (lock_fd < 0) {
+		free(nfile);
+		return lock_fd;
+	}
+	if (*cache == NULL) {
+		err = state_cache_new(cache, file, cardname);
+		if (err < 0)
+			goto out;
+	}
+	err = snd_output_buffer_open(&out);
+	if (err < 0) {
+		error("snd_output_buffer_open: %s", snd_strerror(err));
+		goto out;
+	}
+	err = snd_config_save((*cache)->config, out);
+	if (err < 0) {
+		error("snd_config_save: %s", snd_strerror(err));
+		goto out;
+	}
+	size = snd_output_buffer_string(out, &text);
+	if ((*cache)->text && size == (*cache)->size &&
+	    memcmp(text, (*cache)->text, size) == 0 &&
+	    access(file, F_OK) == 0) {
+		dbg("state unchanged, not stored");
+		goto out;
+	}
+	fp = fopen(nfile, "w");
+	if (fp == NULL) {
+		err = -errno;
+		error("Cannot open %s for writing: %s", nfile, strerror(errno));
+		goto out;
+	}
+	if (fwrite(text, 1, size, fp) != size)
+		err = -errno;
+	if (fclose(fp) && err == 0)
+		err = -errno;
+	if (err < 0) {
+		error("Cannot write %s: %s", nfile, strerror(-err));
+		unlink(nfile);
+		goto out;
+	}
+	err = rename(nfile, file);
+	if (err < 0) {
+		err = -errno;
+		error("rename failed: %s (%s)", strerror(-err), file);
+		goto out;
+	}
+	err = state_cache_text(*cache, text, size);
+out:
+	if (out)
+		snd_output_close(out);
+	state_unlock(lock_fd, file);
+	free(nfile);
+	snd_config_update_free_global();
+	return err;
+}
+
+/*
+ * Each card is restored in its own thread, so the time is given by the
+ * slowest card. The init parser uses static buffers, hence init() and
+ * the UCM calls are serialized. The results are reported in the card
+ * order once all threads finished.
+ */
+struct restore_card {
+	pthread_t thread;
+	bool started;
+	int card;
+	char name[16];
+	const char *cfgdir;
+	const char *initfile;
+	int initflags;
+	int do_init;
+	snd_config_t *config;
+	int init_err;
+	int err;
+};
+
+static pthread_mutex_t init_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+static void *restore_card_thread(void *arg)
+{
+	struct restore_card *rc = arg;
+	long long start;
+	int err;
+
+	/* error is ignored */
+	pthread_mutex_lock(&init_mutex);
+	start = profile_now();
+	init_ucm(rc->initflags | FLAG_UCM_FBOOT, rc->card);
+	profile_phase(rc->card, "ucm", start);
+	pthread_mutex_unlock(&init_mutex);
+	/* do a check if controls matches state file */
+	start = profile_now();
+	err = rc->do_init ? set_controls(rc->card, rc->config, 0) : 0;
+	if (rc->do_init)
+		profile_phase(rc->card, "check", start);
+	if (err) {
+		pthread_mutex_lock(&init_mutex);
+		start = profile_now();
+		rc->init_err = init(rc->cfgdir, rc->initfile,
+				    rc->initflags | FLAG_UCM_BOOT, rc->name);
+		profile_phase(rc->card, "init", start);
+		pthread_mutex_unlock(&init_mutex);
+	}
+	start = profile_now();
+	rc->err = set_controls(rc->card, rc->config, 1);
+	profile_phase(rc->card, "restore", start);
+	return NULL;
+}
+
+static int restore_cards(struct snd_card_iterator *iter, const char *cfgdir,
+			 const char *initfile, int initflags, int do_init,
+			 snd_config_t *config)
+{
+	struct restore_card *cards = NULL, *n, *rc;
+	const char *cardname1;
+	sigset_t set, oset;
+	int i, count = 0, finalerr = 0;
+
+	while ((cardname1 = snd_card_iterator_next(iter)) != NULL) {
+		n = realloc(cards, sizeof(*cards) * (count + 1));
+		if (n == NULL) {
+			error("No enough memory...");
+			finalerr = -ENOMEM;
+			break;
+		}
+		cards = n;
+		rc = &cards[count++];
+		memset(rc, 0, sizeof(*rc));
+		rc->card = iter->card;
+		snprintf(rc->name, sizeof(rc->name), "%s", cardname1);
+		rc->cfgdir = cfgdir;
+		rc->initfile = initfile;
+		rc->initflags = initflags;
+		rc->do_init = do_init;
+		rc->config = config;
+	}
+	/*
+	 * The threads inherit the mask, so the SIGALRM of lock_wait() is
+	 * always delivered to the main thread which waits for the lock.
+	 */
+	sigemptyset(&set);
+	sigaddset(&set, SIGALRM);
+	pthread_sigmask(SIG_BLOCK, &set, &oset);
+	for (i = 0; i < count && count > 1; i++) {
+		rc = &cards[i];
+		rc->started = pthread_create(&rc->thread, NULL,
+					     restore_card_thread, rc) == 0;
+	}
+	pthread_sigmask(SIG_SETMASK, &oset, NULL);
+	for (i = 0; i < count; i++) {
+		rc = &cards[i];
+		if (rc->started)
+			pthread_join(rc->thread, NULL);
+		else
+			restore_card_thread(rc);
+	}
+	for (i = 0; i < count; i++) {
+		rc = &cards[i];
+		if (rc->init_err < 0) {
+			initfailed(rc->card, "init", rc->init_err);
+			finalerr = rc->init_err;
+		}
+		if (rc->err) {
+			if (!force_restore)
+				finalerr = rc->err;
+			initfailed(rc->card, "restore", rc->err);
+		}
+	}
+	free(cards);
+	return finalerr;
+}
+
 int load_state(const char *cfgdir, const char *file,
 	       const char *initfile, int initflags,
 	       const char *cardname, int do_init)
 {
-	int err, finalerr = 0, open_failed;
+	int err, finalerr = 0, open_failed, lock_fd;
 	struct snd_card_iterator iter;
 	snd_config_t *config;
 	const char *cardname1;
+	long long start;
+
+	if (cachefile && strcmp(file, "-")) {
+		start = profile_now();
+		lock_fd = state_lock(file, 10);
+		err = lock_fd >= 0 ?
+			cache_restore(cachefile, file, cardname, initflags) : lock_fd;
+		if (lock_fd >= 0)
+			state_unlock(lock_fd, file);
+		profile_phase(-1, "cache", start);
+		if (err == 0)
+			return 0;
+		dbg("state cache not used: %s", snd_strerror(err));
+	}
 
 	config = NULL;
+	start = profile_now();
 	err = load_configuration(file, &config, &open_failed);
+	profile_phase(-1, "parse", start);
 	if (err < 0 && !open_failed)
 		return err;
 
@@ -1673,24 +2436,17 @@ int load_state(const char *cfgdir, const char *file,
 	err = snd_card_iterator_sinit(&iter, cardname);
 	if (err < 0)
 		goto out;
-	while ((cardname1 = snd_card_iterator_next(&iter)) != NULL) {
-		/* error is ignored */
-		init_ucm(initflags | FLAG_UCM_FBOOT, iter.card);
-		/* do a check if controls matches state file */
-		if (do_init && set_controls(iter.card, config, 0)) {
-			err = init(cfgdir, initfile, initflags | FLAG_UCM_BOOT, cardname1);
-			if (err < 0) {
-				initfailed(iter.card, "init", err);
-				finalerr = err;
-			}
-		}
-		if ((err = set_controls(iter.card, config, 1))) {
-			if (!force_restore)
-				finalerr = err;
-			initfailed(iter.card, "restore", err);
+	finalerr = restore_cards(&iter, cfgdir, initfile, initflags, do_init,
+				 config);
+	err = finalerr ? finalerr : snd_card_iterator_error(&iter);
+	/* the next restore can use the values just restored */
+	if (err == 0 && cachefile && strcmp(file, "-")) {
+		lock_fd = state_lock(file, 10);
+		if (lock_fd >= 0) {
+			cache_save(cachefile, file, cardname);
+			state_unlock(lock_fd, file);
 		}
 	}
-	err = finalerr ? finalerr : snd_card_iterator_error(&iter);
 out:
 	if (config)
 		snd_config_delete(config);
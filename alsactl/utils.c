@@ -65,6 +65,31 @@ void file_unmap(void *buf, size_t bufsize)
 	munmap(buf, bufsize);
 }
 
+unsigned int fnv_hash(unsigned int hash, const void *data, size_t size)
+{
+	const unsigned char *p = data;
+
+	while (size--)
+		hash = (hash ^ *p++) * 16777619U;
+	return hash;
+}
+
+unsigned int fnv_hash_str(unsigned int hash, const char *str)
+{
+	while (*str)
+		hash = (hash ^ (unsigned char)*str++) * 16777619U;
+	return hash;
+}
+
+uint64_t fnv64_hash(uint64_t hash, const void *data, size_t size)
+{
+	const unsigned char *p = data;
+
+	while (size--)
+		hash = (hash ^ *p++) * 0x100000001b3ULL;
+	return hash;
+}
+
 size_t line_width(const char *buf, size_t bufsize, size_t pos)
 {
 	int esc = 0;
@@ -121,9 +146,11 @@ void info_(const char *fcn, long line, const char *fmt, ...)
 	if (use_syslog) {
 		syslog_(LOG_INFO, fcn, line, fmt, ap);
 	} else {
+		flockfile(stdout);
 		fprintf(stdout, "%s: %s:%ld: ", command, fcn, line);
 		vfprintf(stdout, fmt, ap);
 		putc('\n', stdout);
+		funlockfile(stdout);
 	}
 	va_end(ap);
 }
@@ -136,9 +163,11 @@ void error_(const char *fcn, long line, const char *fmt, ...)
 	if (use_syslog) {
 		syslog_(LOG_ERR, fcn, line, fmt, ap);
 	} else {
+		flockfile(stderr);
 		fprintf(stderr, "%s: %s:%ld: ", command, fcn, line);
 		vfprintf(stderr, fmt, ap);
 		putc('\n', stderr);
+		funlockfile(stderr);
 	}
 	va_end(ap);
 }
@@ -153,9 +182,11 @@ void cerror_(const char *fcn, long line, int cond, const char *fmt, ...)
 	if (use_syslog) {
 		syslog_(LOG_ERR, fcn, line, fmt, ap);
 	} else {
+		flockfile(stderr);
 		fprintf(stderr, "%s: %s:%ld: ", command, fcn, line);
 		vfprintf(stderr, fmt, ap);
 		putc('\n', stderr);
+		funlockfile(stderr);
 	}
 	va_end(ap);
 }
@@ -170,9 +201,11 @@ void dbg_(const char *fcn, long line, const char *fmt, ...)
 	if (use_syslog) {
 		syslog_(LOG_DEBUG, fcn, line, fmt, ap);
 	} else {
+		flockfile(stderr);
 		fprintf(stderr, "%s: %s:%ld: ", command, fcn, line);
 		vfprintf(stderr, fmt, ap);
 		putc('\n', stderr);
+		funlockfile(stderr);
 	}
 	va_end(ap);
 }
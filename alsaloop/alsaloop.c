@@ -24,6 +24,7 @@
 #include <stdlib.h>
 #include <string.h>
 #include <sched.h>
+#include <unistd.h>
 #include <errno.h>
 #include <getopt.h>
 #include <alsa/asoundlib.h>
@@ -32,6 +33,10 @@
 #include <pthread.h>
 #include <syslog.h>
 #include <signal.h>
+#include <sys/epoll.h>
+#include <sys/mman.h>
+#include <sys/eventfd.h>
+#include <malloc.h>
 #include "alsaloop.h"
 
 struct loopback_thread {
@@ -41,13 +46,39 @@ struct loopback_thread {
 	struct loopback **loopbacks;
 	int loopbacks_count;
 	snd_output_t *output;
+	/* epoll mode */
+	int epfd;
+	struct pollfd *regs;		/* descriptors registered to epoll */
+	int *regs_count;
+	int *offsets;			/* offset of loopback in pfds */
+	int *ready;			/* loopbacks with received events */
+	/* automatic scheduling (worker pool) */
+	int pool;
+	pthread_mutex_t lock;
+	int exiting;
+	unsigned long long load;	/* usec in the last interval */
+	struct loopback_thread *steal;	/* a worker asking for loopback */
+	struct loopback **inbox;	/* loopbacks handed over to us */
+	int inbox_count;
+	int wake_fd;			/* eventfd, new jobs in the inbox */
 };
 
+/* the interval to measure load of workers and rebalance them */
+#define SCHED_INTERVAL	1000	/* in ms */
+
 int quit = 0;
 int verbose = 0;
 int workarounds = 0;
 int daemonize = 0;
 int use_syslog = 0;
+int use_epoll = 0;
+int arg_workers = -1;
+int *arg_rtprio = NULL;		/* per thread, used cyclically */
+int arg_rtprio_count = 0;
+int *arg_cpus = NULL;		/* per thread, used cyclically */
+int arg_cpus_count = 0;
+int arg_mlock = 0;
+char *arg_stats = NULL;
 struct loopback **loopbacks = NULL;
 int loopbacks_count = 0;
 char **my_argv = NULL;
@@ -57,11 +88,56 @@ int threads_count = 0;
 pthread_t main_job;
 int arg_default_xrun = 0;
 int arg_default_wake = 0;
+char *arg_discover = NULL;
+
+/*
+ * With --discover, the jobs are created on demand. The main thread watches
+ * the "PCM Slave Active" controls of the capture side of a snd-aloop card
+ * and creates a job from the command line when an application starts to
+ * play into the substream, "%i" in the arguments is replaced by the number
+ * of the substream. The job runs in the pool of workers and it is closed
+ * when the application stops, so unused substreams cost nothing.
+ */
+enum {
+	DYN_NONE = 0,			/* a static job */
+	DYN_NEW,			/* in an inbox, not started yet */
+	DYN_RUNNING,
+	DYN_DONE,			/* closed by the worker */
+	DYN_FAILED,			/* the start failed */
+};
+
+#define DYN_DEVICE	1		/* the capture side of the cable */
+
+struct dyn_slot {
+	int subdevice;
+	snd_ctl_elem_value_t *value;
+	struct loopback *loop;
+	unsigned int active:1;
+	unsigned int failed:1;		/* do not retry until a change */
+};
+
+static pthread_mutex_t dyn_lock = PTHREAD_MUTEX_INITIALIZER;
+static snd_ctl_t *dyn_ctl;
+static struct dyn_slot *dyn_slots;
+static int dyn_slots_count;
+static int dyn_next;			/* the worker for the next job */
+static int dyn_argc;			/* the job template */
+static char **dyn_argv;
+static int instancing;			/* parsing the template */
 
 static void my_exit(struct loopback_thread *thread, int exitcode)
 {
 	int i;
 
+	if (thread->pool) {
+		/* loopbacks already handed over are finished here */
+		pthread_mutex_lock(&thread->lock);
+		thread->exiting = 1;
+		for (i = 0; i < thread->inbox_count; i++)
+			thread->loopbacks[thread->loopbacks_count++] = thread->inbox[i];
+		thread->inbox_count = 0;
+		pthread_mutex_unlock(&thread->lock);
+	}
 	for (i = 0; i < thread->loopbacks_count; i++)
 		pcmjob_done(thread->loopbacks[i]);
 	if (thread->threaded) {
@@ -131,9 +207,11 @@ static int create_loopback(struct loopback **_handle,
 	handle->loop_limit = ~0ULL;
 	handle->output = output;
 	handle->state = output;
-#ifdef USE_SAMPLERATE
 	handle->src_enable = 1;
+#ifdef USE_SAMPLERATE
 	handle->src_converter_type = SRC_SINC_BEST_QUALITY;
+#else
+	handle->src_converter_type = RESAMPLE_POLY_BEST;
 #endif
 	*_handle = handle;
 	return 0;
@@ -145,10 +223,20 @@ static void set_loop_time(struct loopback *loop, unsigned long loop_time)
 	loop->loop_limit = loop->capt->rate * loop_time;
 }
 
-static void setscheduler(void)
+static void setscheduler(struct loopback_thread *thread)
 {
 	struct sched_param sched_param;
+	int idx = thread - threads, err;
 
+	if (arg_rtprio_count > 0) {
+		sched_param.sched_priority = arg_rtprio[idx % arg_rtprio_count];
+		err = pthread_setschedparam(pthread_self(), SCHED_FIFO, &sched_param);
+		if (err)
+			logit(LOG_WARNING, "Thread %i: SCHED_FIFO priority %i not applied: %s\n", idx, sched_param.sched_priority, strerror(err));
+		else
+			logit(LOG_INFO, "Thread %i: SCHED_FIFO priority %i applied\n", idx, sched_param.sched_priority);
+		return;
+	}
 	if (sched_getparam(0, &sched_param) < 0) {
 		logit(LOG_WARNING, "Scheduler getparam failed.\n");
 		return;
@@ -163,6 +251,66 @@ static void setscheduler(void)
 		logit(LOG_INFO, "!!!Scheduler set to Round Robin with priority %i FAILED!\n", sched_param.sched_priority);
 }
 
+static void setaffinity(struct loopback_thread *thread)
+{
+	int idx = thread - threads, cpu, err;
+	cpu_set_t set;
+
+	if (arg_cpus_count <= 0)
+		return;
+	cpu = arg_cpus[idx % arg_cpus_count];
+	CPU_ZERO(&set);
+	CPU_SET(cpu, &set);
+	err = pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+	if (err)
+		logit(LOG_WARNING, "Thread %i: CPU %i affinity not applied: %s\n", idx, cpu, strerror(err));
+	else
+		logit(LOG_INFO, "Thread %i: CPU %i affinity applied\n", idx, cpu);
+}
+
+/*
+ * Lock all memory and keep the freed heap in the process, so the buffers
+ * reallocated by a loopback restart do not fault in the pages again.
+ */
+static void setmlock(void)
+{
+	if (!arg_mlock)
+		return;
+	mallopt(M_TRIM_THRESHOLD, -1);
+	mallopt(M_MMAP_MAX, 0);
+	if (mlockall(MCL_CURRENT | MCL_FUTURE) < 0)
+		logit(LOG_WARNING, "Memory lock not applied: %s\n", strerror(errno));
+	else
+		logit(LOG_INFO, "Memory lock applied\n");
+}
+
+static int parse_list(const char *str, int **_list, int *_count)
+{
+	int *list = NULL, *nlist, count = 0;
+	char *end;
+	long val;
+
+	while (*str) {
+		val = strtol(str, &end, 0);
+		if (end == str || val < 0 || (*end && *end != ',')) {
+			free(list);
+			return -EINVAL;
+		}
+		nlist = realloc(list, (count + 1) * sizeof(*list));
+		if (nlist == NULL) {
+			free(list);
+			return -ENOMEM;
+		}
+		list = nlist;
+		list[count++] = val;
+		str = *end ? end + 1 : end;
+	}
+	free(*_list);
+	*_list = list;
+	*_count = count;
+	return 0;
+}
+
 void help(void)
 {
 	int k;
@@ -181,8 +329,10 @@ void help(void)
 "-c,--channels  channels\n"
 "-r,--rate      rate\n"
 "-n,--resample  resample in alsa-lib\n"
+"-i,--mmap      use mmap access (direct copy when possible)\n"
 "-A,--samplerate use converter (0=sincbest,1=sincmedium,2=sincfastest,\n"
-"                               3=zerohold,4=linear)\n"
+"                               3=zerohold,4=linear,5=polyfast,\n"
+"                               6=polymedium,7=polybest)\n"
 "-B,--buffer    buffer size in frames\n"
 "-E,--period    period size in frames\n"
 "-s,--seconds   duration of loop in seconds\n"
@@ -190,17 +340,35 @@ void help(void)
 "-S,--sync      sync mode(0=none,1=simple,2=captshift,3=playshift,4=samplerate,\n"
 "                         5=auto)\n"
 "-a,--slave     stream parameters slave mode (0=auto, 1=on, 2=off)\n"
+"-o,--controller drift controller (0=step, 1=pi)\n"
+"-x,--fanout    share the capture device with other jobs using -x\n"
+"-M,--mix       mix into the playback device with other jobs using -M\n"
+"-G,--mixgain   gain of this job in the playback mix in dB (default 0)\n"
 "-T,--thread    thread number (-1 = create unique)\n"
 "-m,--mixer	redirect mixer, argument is:\n"
 "		    SRC_SLAVE_ID(PLAYBACK)[@DST_SLAVE_ID(CAPTURE)]\n"
 "-O,--ossmixer	rescan and redirect oss mixer, argument is:\n"
 "		    ALSA_ID@OSS_ID  (for example: \"Master@VOLUME\")\n"
 "-e,--effect    apply an effect (bandpass filter sweep)\n"
+"-D,--dsp       add a block to the effect chain, argument is one of:\n"
+"		    gain:DB, eq:TYPE:FREQ[:Q[:DB]], limiter:DB[:RELEASE_MS],\n"
+"		    delay:MS (TYPE is lowpass, highpass, bandpass, notch,\n"
+"		    peak, lowshelf or highshelf)\n"
 "-v,--verbose   verbose mode (more -v means more verbose)\n"
 "-w,--workaround use workaround (serialopen)\n"
 "-U,--xrun      xrun profiling\n"
 "-W,--wake      process wake timeout in ms\n"
 "-z,--syslog    use syslog for errors\n"
+"-p,--epoll     wait for events using epoll (many loopbacks per thread)\n"
+"-k,--workers   schedule loopbacks automatically to a pool of threads\n"
+"               (0 or auto = number of cores, -T is ignored)\n"
+"-R,--rtprio    SCHED_FIFO priority of the threads (comma separated list,\n"
+"               one value per thread, used cyclically)\n"
+"-J,--affinity  CPU of the threads (comma separated list, one per thread)\n"
+"-L,--mlock     lock the memory to avoid page faults\n"
+"-y,--stats     export statistics of the loopbacks to a shared file\n"
+"-K,--discover  create the job on demand for each active substream of\n"
+"               the given snd-aloop ctl device (%%i = substream number)\n"
 );
 	printf("\nRecognized sample formats are:");
 	for (k = 0; k < SND_PCM_FORMAT_LAST; ++k) {
@@ -372,8 +540,10 @@ static int parse_config(int argc, char *argv[], snd_output_t *output,
 		{"seconds", 1, NULL, 's'},
 		{"nblock", 0, NULL, 'b'},
 		{"effect", 0, NULL, 'e'},
+		{"dsp", 1, NULL, 'D'},
 		{"verbose", 0, NULL, 'v'},
 		{"resample", 0, NULL, 'n'},
+		{"mmap", 0, NULL, 'i'},
 		{"samplerate", 1, NULL, 'A'},
 		{"sync", 1, NULL, 'S'},
 		{"slave", 1, NULL, 'a'},
@@ -383,6 +553,17 @@ static int parse_config(int argc, char *argv[], snd_output_t *output,
 		{"workaround", 1, NULL, 'w'},
 		{"xrun", 0, NULL, 'U'},
 		{"syslog", 0, NULL, 'z'},
+		{"epoll", 0, NULL, 'p'},
+		{"workers", 1, NULL, 'k'},
+		{"rtprio", 1, NULL, 'R'},
+		{"affinity", 1, NULL, 'J'},
+		{"mlock", 0, NULL, 'L'},
+		{"stats", 1, NULL, 'y'},
+		{"controller", 1, NULL, 'o'},
+		{"fanout", 0, NULL, 'x'},
+		{"mix", 0, NULL, 'M'},
+		{"mixgain", 1, NULL, 'G'},
+		{"discover", 1, NULL, 'K'},
 		{NULL, 0, NULL, 0},
 	};
 	int err, morehelp;
@@ -402,17 +583,27 @@ static int parse_config(int argc, char *argv[], snd_output_t *output,
 	int arg_nblock = 0;
 	int arg_effect = 0;
 	int arg_resample = 0;
+	int arg_mmap = 0;
 #ifdef USE_SAMPLERATE
 	int arg_samplerate = SRC_SINC_FASTEST + 1;
+#else
+	int arg_samplerate = RESAMPLE_POLY_MEDIUM + 1;
 #endif
 	int arg_sync = SYNC_TYPE_AUTO;
 	int arg_slave = SLAVE_TYPE_AUTO;
+	int arg_controller = CONTROLLER_TYPE_STEP;
+	int arg_fanout = 0;
+	int arg_mix = 0;
+	double arg_mixgain = 0;
 	int arg_thread = 0;
 	struct loopback *loop = NULL;
 	char *arg_mixers[MAX_MIXERS];
 	int arg_mixers_count = 0;
 	char *arg_ossmixers[MAX_MIXERS];
 	int arg_ossmixers_count = 0;
+	char *arg_effects[MAX_EFFECTS];
+	int arg_effects_count = 0;
+	int i;
 	int arg_xrun = arg_default_xrun;
 	int arg_wake = arg_default_wake;
 
@@ -420,9 +611,12 @@ static int parse_config(int argc, char *argv[], snd_output_t *output,
 	while (1) {
 		int c;
 		if ((c = getopt_long(argc, argv,
-				"hdg:P:C:X:Y:l:t:F:f:c:r:s:benvA:S:a:m:T:O:w:UW:z",
+				"hdg:P:C:X:Y:l:t:F:f:c:r:s:benvA:S:a:m:T:O:w:UW:zpk:o:xMG:iD:R:J:Ly:K:",
 				long_option, NULL)) < 0)
 			break;
+		/* the global options were applied by the template already */
+		if (instancing && c > 0 && strchr("dgvzpkRJLyK", c))
+			continue;
 		switch (c) {
 		case 'h':
 			morehelp++;
@@ -490,7 +684,9 @@ static int parse_config(int argc, char *argv[], snd_output_t *output,
 		case 'n':
 			arg_resample = 1;
 			break;
-#ifdef USE_SAMPLERATE
+		case 'i':
+			arg_mmap = 1;
+			break;
 		case 'A':
 			if (strcasecmp(optarg, "sincbest") == 0)
 				arg_samplerate = SRC_SINC_BEST_QUALITY;
@@ -502,13 +698,24 @@ static int parse_config(int argc, char *argv[], snd_output_t *output,
 				arg_samplerate = SRC_ZERO_ORDER_HOLD;
 			else if (strcasecmp(optarg, "linear") == 0)
 				arg_samplerate = SRC_LINEAR;
+			else if (strcasecmp(optarg, "polyfast") == 0)
+				arg_samplerate = RESAMPLE_POLY_FAST;
+			else if (strcasecmp(optarg, "polymedium") == 0)
+				arg_samplerate = RESAMPLE_POLY_MEDIUM;
+			else if (strcasecmp(optarg, "polybest") == 0)
+				arg_samplerate = RESAMPLE_POLY_BEST;
 			else
 				arg_samplerate = atoi(optarg);
-			if (arg_samplerate < 0 || arg_samplerate > SRC_LINEAR)
-				arg_sync = SRC_SINC_FASTEST;
+			if (arg_samplerate < 0 || arg_samplerate > RESAMPLE_LAST)
+				arg_samplerate = RESAMPLE_POLY_MEDIUM;
+#ifndef USE_SAMPLERATE
+			if (arg_samplerate < RESAMPLE_POLY_FAST) {
+				logit(LOG_WARNING, "Compiled without libsamplerate, using the polyphase resampler\n");
+				arg_samplerate = RESAMPLE_POLY_MEDIUM;
+			}
+#endif
 			arg_samplerate += 1;
 			break;
-#endif
 		case 'S':
 			if (strcasecmp(optarg, "samplerate") == 0)
 				arg_sync = SYNC_TYPE_SAMPLERATE;
@@ -558,6 +765,13 @@ static int parse_config(int argc, char *argv[], snd_output_t *output,
 			}
 			arg_ossmixers[arg_ossmixers_count++] = optarg;
 			break;
+		case 'D':
+			if (arg_effects_count >= MAX_EFFECTS) {
+				logit(LOG_CRIT, "Maximum effects reached (max %i)\n", (int)MAX_EFFECTS);
+				exit(EXIT_FAILURE);
+			}
+			arg_effects[arg_effects_count++] = optarg;
+			break;
 		case 'v':
 			verbose++;
 			break;
@@ -578,6 +792,58 @@ static int parse_config(int argc, char *argv[], snd_output_t *output,
 		case 'z':
 			enable_syslog();
 			break;
+		case 'p':
+			use_epoll = 1;
+			break;
+		case 'o':
+			if (strcasecmp(optarg, "pi") == 0)
+				arg_controller = CONTROLLER_TYPE_PI;
+			else if (strcasecmp(optarg, "step") == 0)
+				arg_controller = CONTROLLER_TYPE_STEP;
+			else
+				arg_controller = atoi(optarg);
+			if (arg_controller < 0 || arg_controller > CONTROLLER_TYPE_LAST)
+				arg_controller = CONTROLLER_TYPE_STEP;
+			break;
+		case 'x':
+			arg_fanout = 1;
+			break;
+		case 'M':
+			arg_mix = 1;
+			break;
+		case 'G':
+			arg_mixgain = atof(optarg);
+			if (arg_mixgain > 24)
+				arg_mixgain = 24;
+			break;
+		case 'k':
+			arg_workers = atoi(optarg);
+			if (arg_workers < 0)
+				arg_workers = 0;
+			break;
+		case 'R':
+			if (parse_list(optarg, &arg_rtprio, &arg_rtprio_count) < 0) {
+				logit(LOG_CRIT, "Wrong priority list '%s'\n", optarg);
+				exit(EXIT_FAILURE);
+			}
+			break;
+		case 'J':
+			if (parse_list(optarg, &arg_cpus, &arg_cpus_count) < 0) {
+				logit(LOG_CRIT, "Wrong CPU list '%s'\n", optarg);
+				exit(EXIT_FAILURE);
+			}
+			break;
+		case 'L':
+			arg_mlock = 1;
+			break;
+		case 'y':
+			free(arg_stats);
+			arg_stats = strdup(optarg);
+			break;
+		case 'K':
+			free(arg_discover);
+			arg_discover = strdup(optarg);
+			break;
 		}
 	}
 
@@ -609,11 +875,19 @@ static int parse_config(int argc, char *argv[], snd_output_t *output,
 		play->buffer_size_req = capt->buffer_size_req = arg_buffer_size;
 		play->period_size_req = capt->period_size_req = arg_period_size;
 		play->resample = capt->resample = arg_resample;
+		if (arg_mmap)
+			play->access = capt->access =
+					SND_PCM_ACCESS_MMAP_INTERLEAVED;
 		play->nblock = capt->nblock = arg_nblock ? 1 : 0;
 		loop->latency_req = arg_latency_req;
 		loop->latency_reqtime = arg_latency_reqtime;
 		loop->sync = arg_sync;
 		loop->slave = arg_slave;
+		loop->controller = arg_controller;
+		loop->fanout = arg_fanout;
+		loop->mix = arg_mix;
+		play->mix_gain = arg_mixgain <= -144 ? 0 :
+				 lrint(pow(10, arg_mixgain / 20) * 65536);
 		loop->thread = arg_thread;
 		loop->xrun = arg_xrun;
 		loop->wake = arg_wake;
@@ -627,11 +901,16 @@ static int parse_config(int argc, char *argv[], snd_output_t *output,
 			logit(LOG_CRIT, "Unable to add ossmixer controls.\n");
 			exit(EXIT_FAILURE);
 		}
-#ifdef USE_SAMPLERATE
+		for (i = 0; i < arg_effects_count; i++) {
+			err = effect_chain_add(&loop->effects, arg_effects[i]);
+			if (err < 0) {
+				logit(LOG_CRIT, "Unable to add effects.\n");
+				exit(EXIT_FAILURE);
+			}
+		}
 		loop->src_enable = arg_samplerate > 0;
 		if (loop->src_enable)
 			loop->src_converter_type = arg_samplerate - 1;
-#endif
 		set_loop_time(loop, arg_loop_time);
 		add_loop(loop);
 		return 0;
@@ -710,15 +989,351 @@ static int parse_config_file(const char *file, snd_output_t *output)
 	return err;
 }
 
+/*
+ * Update descriptors of one loopback registered to epoll. The registration
+ * is touched only when the set returned by pcmjob_pollfds_init() differs
+ * from the previous one.
+ */
+static int epoll_update(struct loopback_thread *thread, int idx,
+			struct pollfd *pfds)
+{
+	struct loopback *loop = thread->loopbacks[idx];
+	struct pollfd *fds = pfds + thread->offsets[idx];
+	struct pollfd *regs = thread->regs + thread->offsets[idx];
+	struct epoll_event ev;
+	int i, count;
+
+	count = pcmjob_pollfds_init(loop, fds);
+	if (count < 0)
+		return count;
+	for (i = 0; i < count; i++)
+		fds[i].revents = 0;
+	if (count == thread->regs_count[idx]) {
+		for (i = 0; i < count; i++) {
+			if (fds[i].fd != regs[i].fd ||
+			    fds[i].events != regs[i].events)
+				break;
+		}
+		if (i >= count)
+			return 0;
+	}
+	/* the descriptor might be already closed, ignore errors */
+	for (i = 0; i < thread->regs_count[idx]; i++)
+		epoll_ctl(thread->epfd, EPOLL_CTL_DEL, regs[i].fd, NULL);
+	thread->regs_count[idx] = 0;
+	for (i = 0; i < count; i++) {
+		memset(&ev, 0, sizeof(ev));
+		/* POLL* and EPOLL* flags have the same values */
+		ev.events = fds[i].events;
+		ev.data.u64 = ((uint64_t)idx << 32) | i;
+		if (epoll_ctl(thread->epfd, EPOLL_CTL_ADD, fds[i].fd, &ev) < 0)
+			return -errno;
+		regs[i] = fds[i];
+		thread->regs_count[idx]++;
+	}
+	if (verbose > 10)
+		snd_output_printf(thread->output, "%s: epoll registered %i descriptors\n", loop->id, count);
+	return 0;
+}
+
+static int epoll_handle(struct loopback_thread *thread, int idx,
+			struct pollfd *pfds)
+{
+	struct loopback *loop = thread->loopbacks[idx];
+	int err;
+
+	if (loop->active_pollfd_count > 0) {
+		err = pcmjob_pollfds_handle(loop, pfds + thread->offsets[idx]);
+		if (err < 0)
+			return err;
+	}
+	return epoll_update(thread, idx, pfds);
+}
+
+static void thread_epoll(struct loopback_thread *thread,
+			 struct pollfd *pfds, int pfds_count, int wake)
+{
+	snd_output_t *output = thread->output;
+	struct epoll_event *events;
+	int i, j, err, count, ready_count;
+	uint32_t idx, slot;
+
+	thread->epfd = epoll_create1(EPOLL_CLOEXEC);
+	thread->regs = calloc(pfds_count, sizeof(struct pollfd));
+	thread->regs_count = calloc(thread->loopbacks_count, sizeof(int));
+	thread->offsets = calloc(thread->loopbacks_count, sizeof(int));
+	thread->ready = calloc(thread->loopbacks_count, sizeof(int));
+	events = calloc(pfds_count, sizeof(struct epoll_event));
+	if (thread->epfd < 0 || thread->regs == NULL ||
+	    thread->regs_count == NULL || thread->offsets == NULL ||
+	    thread->ready == NULL || events == NULL) {
+		logit(LOG_CRIT, "Epoll initialization failed.\n");
+		my_exit(thread, EXIT_FAILURE);
+	}
+	/* each loopback owns a fixed area of pfds */
+	for (i = j = 0; i < thread->loopbacks_count; i++) {
+		thread->offsets[i] = j;
+		j += thread->loopbacks[i]->pollfd_count;
+	}
+	for (i = 0; i < thread->loopbacks_count; i++) {
+		err = epoll_update(thread, i, pfds);
+		if (err < 0) {
+			logit(LOG_CRIT, "Poll FD initialization failed: %s\n", strerror(-err));
+			my_exit(thread, EXIT_FAILURE);
+		}
+	}
+	while (!quit) {
+		struct timeval tv1, tv2;
+		if (verbose > 10)
+			gettimeofday(&tv1, NULL);
+		count = epoll_wait(thread->epfd, events, pfds_count, wake);
+		if (count < 0)
+			count = -errno;
+		if (verbose > 10) {
+			gettimeofday(&tv2, NULL);
+			snd_output_printf(output, "epoll took %lius\n", timediff(tv2, tv1));
+		}
+		if (count < 0) {
+			if (count == -EINTR || count == -ERESTART)
+				continue;
+			logit(LOG_CRIT, "Poll failed: %s\n", strerror(-count));
+			my_exit(thread, EXIT_FAILURE);
+		}
+		if (count == 0) {
+			/* wake timeout, all loopbacks are processed like poll() does */
+			for (i = 0; i < thread->loopbacks_count; i++) {
+				if (epoll_handle(thread, i, pfds) < 0) {
+					logit(LOG_CRIT, "pcmjob failed.\n");
+					exit(EXIT_FAILURE);
+				}
+			}
+			continue;
+		}
+		for (i = ready_count = 0; i < count; i++) {
+			idx = events[i].data.u64 >> 32;
+			slot = events[i].data.u64 & 0xffffffff;
+			if (slot >= (uint32_t)thread->regs_count[idx])
+				continue;
+			pfds[thread->offsets[idx] + slot].revents = events[i].events;
+			for (j = 0; j < ready_count; j++)
+				if (thread->ready[j] == (int)idx)
+					break;
+			if (j >= ready_count)
+				thread->ready[ready_count++] = idx;
+		}
+		for (i = 0; i < ready_count; i++) {
+			if (epoll_handle(thread, thread->ready[i], pfds) < 0) {
+				logit(LOG_CRIT, "pcmjob failed.\n");
+				exit(EXIT_FAILURE);
+			}
+		}
+	}
+
+	free(events);
+	my_exit(thread, EXIT_SUCCESS);
+}
+
+static int thread_wake(struct loopback_thread *thread)
+{
+	int i, j, wake = 1000000;
+
+	for (i = 0; i < thread->loopbacks_count; i++) {
+		j = thread->loopbacks[i]->wake;
+		if (j > 0 && j < wake)
+			wake = j;
+	}
+	if (wake >= 1000000)
+		wake = -1;
+	return wake;
+}
+
+/*
+ * Take loopbacks handed over by other workers.
+ */
+/*
+ * Size the poll descriptors for the loopbacks the thread owns now.
+ */
+static int sched_resize(struct loopback_thread *thread,
+			struct pollfd **pfds, int *pfds_count)
+{
+	struct pollfd *nfds;
+	int i, count = 0;
+
+	for (i = 0; i < thread->loopbacks_count; i++)
+		count += thread->loopbacks[i]->pollfd_count;
+	if (count == *pfds_count)
+		return 0;
+	/* one more for the wake up descriptor */
+	nfds = realloc(*pfds, (count + 1) * sizeof(struct pollfd));
+	if (nfds == NULL)
+		return -ENOMEM;
+	*pfds = nfds;
+	*pfds_count = count;
+	return 1;
+}
+
+static int sched_receive(struct loopback_thread *thread,
+			 struct pollfd **pfds, int *pfds_count)
+{
+	int i, received;
+
+	pthread_mutex_lock(&thread->lock);
+	received = thread->inbox_count;
+	for (i = 0; i < thread->inbox_count; i++)
+		thread->loopbacks[thread->loopbacks_count++] = thread->inbox[i];
+	thread->inbox_count = 0;
+	pthread_mutex_unlock(&thread->lock);
+	if (received == 0)
+		return 0;
+	i = sched_resize(thread, pfds, pfds_count);
+	return i < 0 ? i : 1;
+}
+
+/*
+ * Start the jobs created on demand and close the released ones. The
+ * closed jobs are left to the main thread.
+ */
+static int dyn_update(struct loopback_thread *thread,
+		      struct pollfd **pfds, int *pfds_count)
+{
+	struct loopback *loop;
+	int i, err, state, release, changed = 0;
+
+	for (i = 0; i < thread->loopbacks_count; ) {
+		loop = thread->loopbacks[i];
+		pthread_mutex_lock(&dyn_lock);
+		state = loop->dyn_state;
+		release = loop->dyn_release;
+		pthread_mutex_unlock(&dyn_lock);
+		if (state == DYN_NEW) {
+			err = pcmjob_init(loop);
+			if (err >= 0) {
+				err = pcmjob_start(loop);
+				if (err < 0)
+					pcmjob_done(loop);
+			}
+			if (err < 0)
+				logit(LOG_ERR, "Loopback start failure: %s\n", snd_strerror(err));
+			state = err < 0 ? DYN_FAILED : DYN_RUNNING;
+			changed = 1;
+		} else if (state == DYN_RUNNING && release) {
+			pcmjob_done(loop);
+			state = DYN_DONE;
+			changed = 1;
+		}
+		if (state == DYN_DONE || state == DYN_FAILED) {
+			memmove(thread->loopbacks + i, thread->loopbacks + i + 1,
+				(thread->loopbacks_count - i - 1) * sizeof(*thread->loopbacks));
+			thread->loopbacks_count--;
+		} else {
+			i++;
+		}
+		pthread_mutex_lock(&dyn_lock);
+		loop->dyn_state = state;
+		pthread_mutex_unlock(&dyn_lock);
+	}
+	if (!changed)
+		return 0;
+	err = sched_resize(thread, pfds, pfds_count);
+	return err < 0 ? err : 1;
+}
+
+/*
+ * Hand over one loopback to the worker which asked for it. The loopback
+ * is chosen so that the load of both workers gets closer.
+ */
+static int sched_give(struct loopback_thread *thread)
+{
+	struct loopback_thread *thief;
+	unsigned long long gap, best = 0;
+	int i, idx = -1;
+
+	pthread_mutex_lock(&thread->lock);
+	thief = thread->steal;
+	thread->steal = NULL;
+	pthread_mutex_unlock(&thread->lock);
+	if (thief == NULL || thread->loopbacks_count < 2)
+		return 0;
+
+	pthread_mutex_lock(&thief->lock);
+	gap = thread->load > thief->load ? (thread->load - thief->load) / 2 : 0;
+	for (i = 0; i < thread->loopbacks_count; i++) {
+		struct loopback *loop = thread->loopbacks[i];
+		unsigned long long load = loop->sched_load;
+		/* jobs sharing a PCM stay in one thread */
+		if (loop->capt->fanout_master || loop->capt->fanout_count ||
+		    loop->play->mix_master || loop->play->mix_count)
+			continue;
+		if (load <= gap && load >= best) {
+			best = load;
+			idx = i;
+		}
+	}
+	if (idx >= 0 && !thief->exiting) {
+		struct loopback *loop = thread->loopbacks[idx];
+		if (verbose > 1)
+			snd_output_printf(thread->output, "%s: moved to another worker (load %llu/%llu)\n", loop->id, thread->load, thief->load);
+		thief->inbox[thief->inbox_count++] = loop;
+		memmove(thread->loopbacks + idx, thread->loopbacks + idx + 1,
+			(thread->loopbacks_count - idx - 1) * sizeof(*thread->loopbacks));
+		thread->loopbacks_count--;
+		pthread_mutex_unlock(&thief->lock);
+		return 1;
+	}
+	pthread_mutex_unlock(&thief->lock);
+	return 0;
+}
+
+/*
+ * Publish the load of the last interval and ask the busiest worker for
+ * a loopback when this one is much less loaded.
+ */
+static void sched_balance(struct loopback_thread *thread)
+{
+	struct loopback_thread *busiest = NULL;
+	unsigned long long load = 0, max = 0;
+	int i;
+
+	for (i = 0; i < thread->loopbacks_count; i++) {
+		struct loopback *loop = thread->loopbacks[i];
+		loop->sched_load = loop->sched_proctime;
+		loop->sched_proctime = 0;
+		load += loop->sched_load;
+	}
+	pthread_mutex_lock(&thread->lock);
+	thread->load = load;
+	pthread_mutex_unlock(&thread->lock);
+
+	for (i = 0; i < threads_count; i++) {
+		struct loopback_thread *t = &threads[i];
+		if (t == thread)
+			continue;
+		pthread_mutex_lock(&t->lock);
+		if (t->load > max) {
+			max = t->load;
+			busiest = t;
+		}
+		pthread_mutex_unlock(&t->lock);
+	}
+	if (busiest == NULL || load * 2 >= max)
+		return;
+	pthread_mutex_lock(&busiest->lock);
+	if (busiest->steal == NULL)
+		busiest->steal = thread;
+	pthread_mutex_unlock(&busiest->lock);
+}
+
 static void thread_job1(void *_data)
 {
 	struct loopback_thread *thread = _data;
 	snd_output_t *output = thread->output;
 	struct pollfd *pfds = NULL;
 	int pfds_count = 0;
-	int i, j, err, wake = 1000000;
+	int i, j, err, wake, timeout, nfds;
+	struct timeval tv_balance, tv_now;
 
-	setscheduler();
+	setscheduler(thread);
+	setaffinity(thread);
 
 	for (i = 0; i < thread->loopbacks_count; i++) {
 		err = pcmjob_init(thread->loopbacks[i]);
@@ -734,19 +1349,50 @@ static void thread_job1(void *_data)
 			my_exit(thread, EXIT_FAILURE);
 		}
 		pfds_count += thread->loopbacks[i]->pollfd_count;
-		j = thread->loopbacks[i]->wake;
-		if (j > 0 && j < wake)
-			wake = j;
 	}
-	if (wake >= 1000000)
-		wake = -1;
-	pfds = calloc(pfds_count, sizeof(struct pollfd));
-	if (pfds == NULL || pfds_count <= 0) {
+	wake = thread_wake(thread);
+	pfds = calloc(pfds_count + 1, sizeof(struct pollfd));
+	if (pfds == NULL || (pfds_count <= 0 && thread->wake_fd < 0)) {
 		logit(LOG_CRIT, "Poll FDs allocation failed.\n");
 		my_exit(thread, EXIT_FAILURE);
 	}
+	if (use_epoll && !thread->pool)
+		thread_epoll(thread, pfds, pfds_count, wake);
+	gettimeofday(&tv_balance, NULL);
 	while (!quit) {
 		struct timeval tv1, tv2;
+		if (thread->pool) {
+			err = sched_receive(thread, &pfds, &pfds_count);
+			if (err < 0) {
+				logit(LOG_CRIT, "Poll FDs allocation failed.\n");
+				my_exit(thread, EXIT_FAILURE);
+			}
+			if (err > 0)
+				wake = thread_wake(thread);
+			if (arg_discover) {
+				err = dyn_update(thread, &pfds, &pfds_count);
+				if (err < 0) {
+					logit(LOG_CRIT, "Poll FDs allocation failed.\n");
+					my_exit(thread, EXIT_FAILURE);
+				}
+				if (err > 0)
+					wake = thread_wake(thread);
+			}
+			if (sched_give(thread)) {
+				/* the descriptors of the loopback went with it */
+				err = sched_resize(thread, &pfds, &pfds_count);
+				if (err < 0) {
+					logit(LOG_CRIT, "Poll FDs allocation failed.\n");
+					my_exit(thread, EXIT_FAILURE);
+				}
+				wake = thread_wake(thread);
+			}
+			gettimeofday(&tv_now, NULL);
+			if (timediff(tv_now, tv_balance) >= SCHED_INTERVAL * 1000) {
+				sched_balance(thread);
+				tv_balance = tv_now;
+			}
+		}
 		for (i = j = 0; i < thread->loopbacks_count; i++) {
 			err = pcmjob_pollfds_init(thread->loopbacks[i], &pfds[j]);
 			if (err < 0) {
@@ -755,9 +1401,19 @@ static void thread_job1(void *_data)
 			}
 			j += err;
 		}
+		nfds = j;
+		if (thread->wake_fd >= 0) {
+			pfds[nfds].fd = thread->wake_fd;
+			pfds[nfds].events = POLLIN;
+			pfds[nfds++].revents = 0;
+		}
+		/* the pool needs to wake up for balancing */
+		timeout = wake;
+		if (thread->pool && (timeout < 0 || timeout > SCHED_INTERVAL))
+			timeout = SCHED_INTERVAL;
 		if (verbose > 10)
 			gettimeofday(&tv1, NULL);
-		err = poll(pfds, j, wake);
+		err = poll(pfds, nfds, timeout);
 		if (err < 0)
 			err = -errno;
 		if (verbose > 10) {
@@ -770,14 +1426,28 @@ static void thread_job1(void *_data)
 			logit(LOG_CRIT, "Poll failed: %s\n", strerror(-err));
 			my_exit(thread, EXIT_FAILURE);
 		}
+		if (err > 0 && nfds > j && (pfds[j].revents & POLLIN)) {
+			eventfd_t value;
+			eventfd_read(thread->wake_fd, &value);
+			if (err == 1)
+				continue;
+		}
+		if (err == 0 && timeout != wake)
+			continue;
 		for (i = j = 0; i < thread->loopbacks_count; i++) {
 			struct loopback *loop = thread->loopbacks[i];
 			if (j < loop->active_pollfd_count) {
+				if (thread->pool)
+					gettimeofday(&tv1, NULL);
 				err = pcmjob_pollfds_handle(loop, &pfds[j]);
 				if (err < 0) {
 					logit(LOG_CRIT, "pcmjob failed.\n");
 					exit(EXIT_FAILURE);
 				}
+				if (thread->pool) {
+					gettimeofday(&tv2, NULL);
+					loop->sched_proctime += timediff(tv2, tv1);
+				}
 			}
 			j += loop->active_pollfd_count;
 		}
@@ -837,6 +1507,447 @@ static void signal_handler_ignore(int sig)
 	signal(sig, signal_handler_ignore);
 }
 
+/*
+ * Distribute loopbacks round-robin to a pool of workers. The assignment
+ * is changed later according to the measured processing time.
+ */
+static void setup_pool(snd_output_t *output, int capacity)
+{
+	int i, k, workers = arg_workers;
+
+	if (workers == 0)
+		workers = sysconf(_SC_NPROCESSORS_ONLN);
+	if (workers <= 0)
+		workers = 1;
+	if (workers > capacity)
+		workers = capacity;
+	threads = calloc(workers, sizeof(struct loopback_thread));
+	if (threads == NULL) {
+		logit(LOG_CRIT, "No enough memory\n");
+		exit(EXIT_FAILURE);
+	}
+	for (k = 0; k < workers; k++) {
+		/* any worker may own all loopbacks at some point */
+		threads[k].loopbacks = malloc(capacity * sizeof(struct loopback *));
+		threads[k].inbox = malloc(capacity * sizeof(struct loopback *));
+		if (threads[k].loopbacks == NULL || threads[k].inbox == NULL) {
+			logit(LOG_CRIT, "No enough memory\n");
+			exit(EXIT_FAILURE);
+		}
+		threads[k].output = output;
+		/* the main thread watches the substreams with --discover */
+		threads[k].threaded = workers > 1 || arg_discover;
+		threads[k].pool = workers > 1 || arg_discover;
+		threads[k].wake_fd = -1;
+		if (arg_discover) {
+			threads[k].wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+			if (threads[k].wake_fd < 0) {
+				logit(LOG_CRIT, "eventfd() failed: %s\n", strerror(errno));
+				exit(EXIT_FAILURE);
+			}
+		}
+		pthread_mutex_init(&threads[k].lock, NULL);
+	}
+	for (i = k = 0; i < loopbacks_count; i++) {
+		struct loopback_thread *thread;
+		struct loopback_handle *master = loopbacks[i]->capt->fanout_master;
+		if (master == NULL)
+			master = loopbacks[i]->play->mix_master;
+		if (master)
+			loopbacks[i]->thread = master->loopback->thread;
+		else
+			loopbacks[i]->thread = k++ % workers;
+		thread = &threads[loopbacks[i]->thread];
+		thread->loopbacks[thread->loopbacks_count++] = loopbacks[i];
+	}
+	threads_count = workers;
+	if (verbose)
+		logit(LOG_INFO, "Scheduling %i loopbacks to %i workers\n", capacity, workers);
+}
+
+/*
+ * Jobs using -x with the same capture device share the capture PCM of
+ * the first one, which feeds their rings. They run in its thread.
+ */
+static void setup_fanout(void)
+{
+	struct loopback *loop, *master;
+	struct loopback_handle **nfanout;
+	int i, j;
+
+	for (i = 0; i < loopbacks_count; i++) {
+		loop = loopbacks[i];
+		if (!loop->fanout)
+			continue;
+		for (j = 0; j < i; j++) {
+			master = loopbacks[j];
+			if (master->fanout && !master->capt->fanout_master &&
+			    strcmp(master->capt->device, loop->capt->device) == 0)
+				break;
+		}
+		if (j >= i)
+			continue;
+		nfanout = realloc(master->capt->fanout,
+				  (master->capt->fanout_count + 1) *
+						sizeof(*nfanout));
+		if (nfanout == NULL) {
+			logit(LOG_CRIT, "No enough memory\n");
+			exit(EXIT_FAILURE);
+		}
+		master->capt->fanout = nfanout;
+		master->capt->fanout[master->capt->fanout_count++] = loop->capt;
+		loop->capt->fanout_master = master->capt;
+		loop->thread = master->thread;
+		if (verbose)
+			logit(LOG_INFO, "Capture %s is shared by job %i\n", loop->capt->device, i);
+	}
+}
+
+/*
+ * Jobs using -M with the same playback device are summed into the
+ * playback PCM of the first one. They run in its thread.
+ */
+static void setup_mix(void)
+{
+	struct loopback *loop, *master;
+	struct loopback_handle **nmix;
+	int i, j;
+
+	for (i = 0; i < loopbacks_count; i++) {
+		loop = loopbacks[i];
+		if (!loop->mix)
+			continue;
+		for (j = 0; j < i; j++) {
+			master = loopbacks[j];
+			if (master->mix && !master->play->mix_master &&
+			    strcmp(master->play->device, loop->play->device) == 0)
+				break;
+		}
+		if (j >= i)
+			continue;
+		if (loop->capt->fanout_master) {
+			logit(LOG_CRIT, "Job %i cannot share both the capture and the playback device\n", i);
+			exit(EXIT_FAILURE);
+		}
+		nmix = realloc(master->play->mix,
+			       (master->play->mix_count + 1) * sizeof(*nmix));
+		if (nmix == NULL) {
+			logit(LOG_CRIT, "No enough memory\n");
+			exit(EXIT_FAILURE);
+		}
+		master->play->mix = nmix;
+		master->play->mix[master->play->mix_count++] = loop->play;
+		loop->play->mix_master = master->play;
+		loop->thread = master->thread;
+		if (verbose)
+			logit(LOG_INFO, "Playback %s is mixed from job %i\n", loop->play->device, i);
+	}
+}
+
+static void free_control(struct loopback_control *control)
+{
+	if (control->id)
+		snd_ctl_elem_id_free(control->id);
+	if (control->info)
+		snd_ctl_elem_info_free(control->info);
+	if (control->value)
+		snd_ctl_elem_value_free(control->value);
+}
+
+static void free_loopback_handle(struct loopback_handle *handle)
+{
+	free(handle->device);
+	free(handle->ctldev);
+	free(handle->id);
+	free(handle);
+}
+
+/*
+ * Free a job which is not running, the PCMs are closed by pcmjob_done().
+ */
+static void free_loopback(struct loopback *loop)
+{
+	struct loopback_mixer *mixer;
+	struct loopback_ossmixer *ossmixer;
+
+	while ((mixer = loop->controls) != NULL) {
+		loop->controls = mixer->next;
+		free_control(&mixer->src);
+		free_control(&mixer->dst);
+		free(mixer);
+	}
+	while ((ossmixer = loop->oss_controls) != NULL) {
+		loop->oss_controls = ossmixer->next;
+		free((char *)ossmixer->alsa_id);
+		free((char *)ossmixer->oss_id);
+		free(ossmixer);
+	}
+	effect_chain_free(loop->effects);
+	free_loopback_handle(loop->play);
+	free_loopback_handle(loop->capt);
+	free(loop);
+}
+
+/* replace each "%i" in str with num */
+static char *dyn_subst(const char *str, const char *num)
+{
+	const char *p;
+	char *res, *dst;
+	size_t count = 0;
+
+	for (p = strstr(str, "%i"); p; p = strstr(p + 2, "%i"))
+		count++;
+	res = malloc(strlen(str) + count * strlen(num) + 1);
+	if (res == NULL)
+		return NULL;
+	for (dst = res; *str; ) {
+		if (str[0] == '%' && str[1] == 'i') {
+			dst = stpcpy(dst, num);
+			str += 2;
+		} else {
+			*dst++ = *str++;
+		}
+	}
+	*dst = '\0';
+	return res;
+}
+
+/*
+ * Create the job of one substream from the template on the command line.
+ */
+static struct loopback *dyn_instance(snd_output_t *output, int subdevice)
+{
+	struct loopback *loop = NULL;
+	char **argv, num[16];
+	int i, err;
+
+	argv = calloc(dyn_argc + 1, sizeof(char *));
+	if (argv == NULL)
+		return NULL;
+	snprintf(num, sizeof(num), "%i", subdevice);
+	for (i = 0; i < dyn_argc; i++) {
+		argv[i] = dyn_subst(dyn_argv[i], num);
+		if (argv[i] == NULL)
+			goto __end;
+	}
+	/* erase runtime variables for getopt */
+	optarg = NULL;
+	optind = opterr = 1;
+	optopt = '?';
+	instancing = 1;
+	err = parse_config(dyn_argc, argv, output, 0);
+	instancing = 0;
+	if (err >= 0 && loopbacks_count > 0)
+		loop = loopbacks[--loopbacks_count];
+      __end:
+	for (i = 0; i < dyn_argc; i++)
+		free(argv[i]);
+	free(argv);
+	return loop;
+}
+
+static void dyn_wake(struct loopback_thread *thread)
+{
+	eventfd_write(thread->wake_fd, 1);
+}
+
+static void dyn_wake_all(void)
+{
+	int i;
+
+	for (i = 0; i < threads_count; i++)
+		dyn_wake(&threads[i]);
+}
+
+static void dyn_spawn(snd_output_t *output, struct dyn_slot *slot)
+{
+	struct loopback_thread *thread;
+	struct loopback *loop;
+
+	loop = dyn_instance(output, slot->subdevice);
+	if (loop == NULL) {
+		logit(LOG_ERR, "Substream %i: unable to create the job\n", slot->subdevice);
+		slot->failed = 1;
+		return;
+	}
+	loop->dyn_state = DYN_NEW;
+	loop->thread = dyn_next++ % threads_count;
+	thread = &threads[loop->thread];
+	pthread_mutex_lock(&thread->lock);
+	if (thread->exiting) {
+		pthread_mutex_unlock(&thread->lock);
+		free_loopback(loop);
+		return;
+	}
+	thread->inbox[thread->inbox_count++] = loop;
+	pthread_mutex_unlock(&thread->lock);
+	slot->loop = loop;
+	dyn_wake(thread);
+	if (verbose)
+		logit(LOG_INFO, "Substream %i: job created in worker %i\n", slot->subdevice, loop->thread);
+}
+
+/*
+ * Bring the job of a substream in line with its state: ask the worker to
+ * close it when the substream is not active, free it when it is closed
+ * and create it when the substream is active.
+ */
+static void dyn_check(snd_output_t *output, struct dyn_slot *slot)
+{
+	struct loopback *loop = slot->loop;
+	int state, wake = 0;
+
+	if (loop) {
+		pthread_mutex_lock(&dyn_lock);
+		state = loop->dyn_state;
+		if (state != DYN_DONE && state != DYN_FAILED &&
+		    loop->dyn_release != !slot->active) {
+			loop->dyn_release = !slot->active;
+			wake = 1;
+		}
+		pthread_mutex_unlock(&dyn_lock);
+		if (wake)
+			dyn_wake_all();
+		if (state != DYN_DONE && state != DYN_FAILED)
+			return;
+		if (verbose)
+			logit(LOG_INFO, "Substream %i: job finished\n", slot->subdevice);
+		free_loopback(loop);
+		slot->loop = NULL;
+		if (state == DYN_FAILED)
+			slot->failed = 1;
+	}
+	if (slot->active && !slot->failed)
+		dyn_spawn(output, slot);
+}
+
+static void dyn_read(snd_output_t *output, struct dyn_slot *slot)
+{
+	int err;
+
+	err = snd_ctl_elem_read(dyn_ctl, slot->value);
+	if (err < 0) {
+		logit(LOG_WARNING, "Substream %i: unable to read the state: %s\n", slot->subdevice, snd_strerror(err));
+		return;
+	}
+	slot->active = snd_ctl_elem_value_get_boolean(slot->value, 0) != 0;
+	slot->failed = 0;
+	dyn_check(output, slot);
+}
+
+/*
+ * Find the substreams of the loopback card, the count limits the jobs.
+ */
+static int dyn_open(void)
+{
+	snd_ctl_elem_list_t *list;
+	snd_ctl_elem_id_t *id;
+	struct dyn_slot *slot;
+	unsigned int i, count;
+	int err;
+
+	err = snd_ctl_open(&dyn_ctl, arg_discover, SND_CTL_NONBLOCK);
+	if (err < 0) {
+		logit(LOG_CRIT, "Unable to open ctl device %s: %s\n", arg_discover, snd_strerror(err));
+		exit(EXIT_FAILURE);
+	}
+	snd_ctl_elem_list_alloca(&list);
+	snd_ctl_elem_id_alloca(&id);
+	err = snd_ctl_elem_list(dyn_ctl, list);
+	if (err >= 0) {
+		count = snd_ctl_elem_list_get_count(list);
+		err = snd_ctl_elem_list_alloc_space(list, count);
+	}
+	if (err >= 0)
+		err = snd_ctl_elem_list(dyn_ctl, list);
+	if (err < 0) {
+		logit(LOG_CRIT, "Unable to list controls of %s: %s\n", arg_discover, snd_strerror(err));
+		exit(EXIT_FAILURE);
+	}
+	count = snd_ctl_elem_list_get_used(list);
+	dyn_slots = calloc(count, sizeof(*dyn_slots));
+	if (dyn_slots == NULL) {
+		logit(LOG_CRIT, "No enough memory\n");
+		exit(EXIT_FAILURE);
+	}
+	for (i = 0; i < count; i++) {
+		snd_ctl_elem_list_get_id(list, i, id);
+		if (snd_ctl_elem_id_get_interface(id) != SND_CTL_ELEM_IFACE_PCM ||
+		    snd_ctl_elem_id_get_device(id) != DYN_DEVICE ||
+		    strcmp(snd_ctl_elem_id_get_name(id), "PCM Slave Active"))
+			continue;
+		slot = &dyn_slots[dyn_slots_count++];
+		slot->subdevice = snd_ctl_elem_id_get_subdevice(id);
+		if (snd_ctl_elem_value_malloc(&slot->value) < 0) {
+			logit(LOG_CRIT, "No enough memory\n");
+			exit(EXIT_FAILURE);
+		}
+		snd_ctl_elem_value_set_id(slot->value, id);
+	}
+	snd_ctl_elem_list_free_space(list);
+	if (dyn_slots_count == 0) {
+		logit(LOG_CRIT, "No loopback substreams found on %s\n", arg_discover);
+		exit(EXIT_FAILURE);
+	}
+	err = snd_ctl_subscribe_events(dyn_ctl, 1);
+	if (err < 0) {
+		logit(LOG_CRIT, "Unable to subscribe events of %s: %s\n", arg_discover, snd_strerror(err));
+		exit(EXIT_FAILURE);
+	}
+	if (verbose)
+		logit(LOG_INFO, "Watching %i substreams of %s\n", dyn_slots_count, arg_discover);
+	return dyn_slots_count;
+}
+
+/*
+ * The main thread follows the state of the substreams until the end.
+ */
+static void dyn_run(snd_output_t *output)
+{
+	struct pollfd *pfds;
+	snd_ctl_event_t *ev;
+	unsigned int numid;
+	int i, count, err;
+
+	snd_ctl_event_alloca(&ev);
+	count = snd_ctl_poll_descriptors_count(dyn_ctl);
+	pfds = calloc(count > 0 ? count : 1, sizeof(struct pollfd));
+	if (pfds == NULL || count <= 0 ||
+	    snd_ctl_poll_descriptors(dyn_ctl, pfds, count) != count) {
+		logit(LOG_CRIT, "Poll FDs allocation failed.\n");
+		quit = 1;
+	}
+	for (i = 0; i < dyn_slots_count && !quit; i++)
+		dyn_read(output, &dyn_slots[i]);
+	while (!quit) {
+		err = poll(pfds, count, SCHED_INTERVAL);
+		if (err < 0 && errno != EINTR) {
+			logit(LOG_CRIT, "Poll failed: %s\n", strerror(errno));
+			break;
+		}
+		while (!quit && snd_ctl_read(dyn_ctl, ev) > 0) {
+			if (snd_ctl_event_get_type(ev) != SND_CTL_EVENT_ELEM)
+				continue;
+			if (snd_ctl_event_elem_get_mask(ev) == SND_CTL_EVENT_MASK_REMOVE ||
+			    !(snd_ctl_event_elem_get_mask(ev) & SND_CTL_EVENT_MASK_VALUE))
+				continue;
+			numid = snd_ctl_event_elem_get_numid(ev);
+			for (i = 0; i < dyn_slots_count; i++) {
+				if (snd_ctl_elem_value_get_numid(dyn_slots[i].value) == numid) {
+					dyn_read(output, &dyn_slots[i]);
+					break;
+				}
+			}
+		}
+		/* free the finished jobs and retry the released ones */
+		for (i = 0; i < dyn_slots_count && !quit; i++)
+			dyn_check(output, &dyn_slots[i]);
+	}
+	quit = 1;
+	dyn_wake_all();
+	free(pfds);
+}
+
 int main(int argc, char *argv[])
 {
 	snd_output_t *output;
@@ -852,11 +1963,25 @@ int main(int argc, char *argv[])
 		logit(LOG_CRIT, "Unable to parse arguments or configuration...\n");
 		exit(EXIT_FAILURE);
 	}
+	if (arg_discover) {
+		/* the only job is a template */
+		if (my_argv != NULL || loopbacks_count != 1) {
+			logit(LOG_CRIT, "One job on the command line is required with --discover\n");
+			exit(EXIT_FAILURE);
+		}
+		if (loopbacks[0]->fanout || loopbacks[0]->mix || arg_stats) {
+			logit(LOG_CRIT, "--fanout, --mix and --stats cannot be used with --discover\n");
+			exit(EXIT_FAILURE);
+		}
+		free_loopback(loopbacks[--loopbacks_count]);
+		dyn_argc = argc;
+		dyn_argv = argv;
+	}
 	while (my_argc > 0)
 		free(my_argv[--my_argc]);
 	free(my_argv);
 
-	if (loopbacks_count <= 0) {
+	if (loopbacks_count <= 0 && !arg_discover) {
 		logit(LOG_CRIT, "No loopback defined...\n");
 		exit(EXIT_FAILURE);
 	}
@@ -877,6 +2002,22 @@ int main(int argc, char *argv[])
 		}
 	}
 
+	setmlock();
+	setup_fanout();
+	setup_mix();
+	if (arg_stats && stats_open(arg_stats, loopbacks, loopbacks_count) < 0)
+		exit(EXIT_FAILURE);
+	if (arg_discover) {
+		if (arg_workers < 0)
+			arg_workers = 0;
+		setup_pool(output, dyn_open());
+		goto __run;
+	}
+	if (arg_workers >= 0) {
+		setup_pool(output, loopbacks_count);
+		goto __run;
+	}
+
 	/* we must sort thread IDs */
 	j = -1;
 	do {
@@ -912,11 +2053,13 @@ int main(int argc, char *argv[])
 		threads[k].loopbacks_count = l;
 		threads[k].output = output;
 		threads[k].threaded = j > 1;
+		threads[k].wake_fd = -1;
 		for (i = l = 0; i < loopbacks_count; i++)
 			if (loopbacks[i]->thread == k)
 				threads[k].loopbacks[l++] = loopbacks[i];
 	}
 	threads_count = j;
+      __run:
 	main_job = pthread_self();
  
 	signal(SIGINT, signal_handler);
@@ -928,11 +2071,14 @@ int main(int argc, char *argv[])
 	for (k = 0; k < threads_count; k++)
 		thread_job(&threads[k]);
 
-	if (j > 1) {
+	if (arg_discover)
+		dyn_run(output);
+	if (threads_count > 1 || arg_discover) {
 		for (k = 0; k < threads_count; k++)
 			pthread_join(threads[k].thread, NULL);
 	}
 
+	stats_close();
 	if (use_syslog)
 		closelog();
 	exit(EXIT_SUCCESS);
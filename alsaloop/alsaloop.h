@@ -19,6 +19,7 @@
  */
 
 #include "aconfig.h"
+#include <stdint.h>
 #ifdef HAVE_SAMPLERATE_H
 #define USE_SAMPLERATE
 #include <samplerate.h>
@@ -32,8 +33,17 @@ enum {
 };
 #endif
 
+/* in-tree polyphase resampler (resample.c), following libsamplerate types */
+enum {
+	RESAMPLE_POLY_FAST	= SRC_LINEAR + 1,
+	RESAMPLE_POLY_MEDIUM,
+	RESAMPLE_POLY_BEST,
+	RESAMPLE_LAST		= RESAMPLE_POLY_BEST
+};
+
 #define MAX_ARGS	128
 #define MAX_MIXERS	64
+#define MAX_EFFECTS	16
 
 #if 0
 #define FILE_PWRITE "/tmp/alsaloop.praw"
@@ -53,6 +63,12 @@ typedef enum _sync_type {
 	SYNC_TYPE_LAST = SYNC_TYPE_AUTO
 } sync_type_t;
 
+typedef enum _controller_type {
+	CONTROLLER_TYPE_STEP = 0,	/* fixed pitch steps every 15 seconds */
+	CONTROLLER_TYPE_PI = 1,		/* proportional-integral controller */
+	CONTROLLER_TYPE_LAST = CONTROLLER_TYPE_PI
+} controller_type_t;
+
 typedef enum _slave_type {
 	SLAVE_TYPE_AUTO = 0,
 	SLAVE_TYPE_ON = 1,
@@ -66,11 +82,20 @@ struct loopback_control {
 	snd_ctl_elem_value_t *value;
 };
 
+#define CONTROL_HASH_SIZE	64
+
 struct loopback_mixer {
 	unsigned int skip:1;
+	unsigned int pending:1;		/* to be copied in control_flush() */
+	unsigned int pending_capt:1;	/* the last change was on capture */
+	unsigned int src_numid;
+	unsigned int dst_numid;
 	struct loopback_control src;
 	struct loopback_control dst;
 	struct loopback_mixer *next;
+	struct loopback_mixer *src_hash_next;
+	struct loopback_mixer *dst_hash_next;
+	struct loopback_mixer *pending_next;
 };
 
 struct loopback_ossmixer {
@@ -103,13 +128,24 @@ struct loopback_handle {
 	unsigned int nblock:1;		/* do block (period size) transfers */
 	unsigned int xrun_pending:1;
 	unsigned int pollfd_count;
+	unsigned long xruns;
 	/* I/O job */
 	char *buf;			/* I/O buffer */
 	snd_pcm_uframes_t buf_pos;	/* I/O position */
 	snd_pcm_uframes_t buf_count;	/* filled samples */
 	snd_pcm_uframes_t buf_size;	/* buffer size in frames */
 	snd_pcm_uframes_t buf_over;	/* capture buffer overflow */
+	size_t buf_bytes;		/* allocated size of buf */
+	char *buf_cache;		/* the ring of the last run */
+	size_t buf_cache_bytes;
 	int stall;
+	/* parameters kept over a restart */
+	unsigned int setup:1;
+	snd_pcm_access_t setup_access;
+	snd_pcm_format_t setup_format;
+	unsigned int setup_rate_req;
+	unsigned int setup_channels;
+	snd_pcm_uframes_t setup_bufsize;
 	/* statistics */
 	snd_pcm_uframes_t max;
 	unsigned long long counter;
@@ -127,6 +163,19 @@ struct loopback_handle {
 	snd_ctl_elem_value_t *ctl_format;
 	snd_ctl_elem_value_t *ctl_rate;
 	snd_ctl_elem_value_t *ctl_channels;
+	/* capture fan-out */
+	struct loopback_handle *fanout_master;	/* the handle reading the PCM */
+	struct loopback_handle **fanout;	/* handles fed by this one */
+	int fanout_count;
+	snd_pcm_uframes_t fanout_pending;	/* frames fed since readit */
+	/* playback mixing */
+	struct loopback_handle *mix_master;	/* the handle writing the PCM */
+	struct loopback_handle **mix;		/* handles mixed into this one */
+	int mix_count;
+	snd_pcm_uframes_t mix_pending;	/* frames mixed since writeit */
+	int mix_gain;			/* linear gain, 1.0 = 65536 */
+	int64_t *mix_acc;		/* sums of one chunk (master only) */
+	char *mix_out;			/* saturated sums (master only) */
 };
 
 struct loopback {
@@ -146,17 +195,37 @@ struct loopback {
 	unsigned int reinit:1;
 	unsigned int running:1;
 	unsigned int stop_pending:1;
+	unsigned int fanout:1;		/* share the capture with other jobs */
+	unsigned int mix:1;		/* share the playback with other jobs */
+	unsigned int direct:1;		/* copy between the mmap areas */
 	snd_pcm_uframes_t stop_count;
 	sync_type_t sync;		/* type of sync */
 	slave_type_t slave;
 	int thread;			/* thread number */
 	unsigned int wake;
+	/* processing time in the current and the last balancing interval */
+	unsigned long long sched_proctime;	/* in us */
+	unsigned long long sched_load;		/* in us */
+	/* a job created on demand (--discover), guarded by dyn_lock */
+	int dyn_state;
+	int dyn_release;		/* the substream is not active */
 	/* statistics */
 	double pitch;
 	double pitch_delta;
 	snd_pcm_sframes_t pitch_diff;
 	snd_pcm_sframes_t pitch_diff_min;
 	snd_pcm_sframes_t pitch_diff_max;
+	snd_pcm_sframes_t play_queued;	/* last measured */
+	snd_pcm_sframes_t capt_queued;
+	/* statistics export */
+	struct stats_record *stats;
+	long stats_max_proctime;	/* in us */
+	/* drift controller */
+	controller_type_t controller;
+	double pi_error;		/* averaged latency error in frames */
+	double pi_integral;		/* integrated error in frames * s */
+	double pi_output;		/* rate correction in frames / s */
+	unsigned long pi_updates;
 	unsigned int total_queued_count;
 	snd_timestamp_t tstamp_start;
 	snd_timestamp_t tstamp_end;
@@ -176,15 +245,22 @@ struct loopback {
 	double xrun_max_missing;
 	/* control mixer */
 	struct loopback_mixer *controls;
+	struct loopback_mixer *controls_src_hash[CONTROL_HASH_SIZE];
+	struct loopback_mixer *controls_dst_hash[CONTROL_HASH_SIZE];
+	struct loopback_mixer *controls_pending;
 	struct loopback_ossmixer *oss_controls;
 	/* sample rate */
 	unsigned int use_samplerate:1;
-#ifdef USE_SAMPLERATE
 	unsigned int src_enable:1;
 	int src_converter_type;
+	double src_ratio;
+	unsigned int src_out_frames;
+	struct resampler *resampler;
+	/* effects */
+	struct effect_chain *effects;
+#ifdef USE_SAMPLERATE
 	SRC_STATE *src_state;
 	SRC_DATA src_data;
-	unsigned int src_out_frames;
 #endif
 #ifdef FILE_CWRITE
 	FILE *cfile;
@@ -213,8 +289,32 @@ int pcmjob_pollfds_init(struct loopback *loop, struct pollfd *fds);
 int pcmjob_pollfds_handle(struct loopback *loop, struct pollfd *fds);
 void pcmjob_state(struct loopback *loop);
 
+int resampler_open(struct resampler **r, int quality,
+		   snd_pcm_format_t format, unsigned int channels,
+		   unsigned int rate_in, unsigned int rate_out,
+		   snd_pcm_uframes_t max_frames);
+void resampler_close(struct resampler *r);
+snd_pcm_uframes_t resampler_write(struct resampler *r, const void *buf,
+				  snd_pcm_uframes_t frames);
+snd_pcm_uframes_t resampler_read(struct resampler *r, double ratio,
+				 void *buf, snd_pcm_uframes_t frames);
+snd_pcm_uframes_t resampler_pending(struct resampler *r);
+
+int stats_open(const char *path, struct loopback **loops, int count);
+void stats_close(void);
+void stats_update(struct loopback *loop, int force);
+
+int effect_chain_add(struct effect_chain **chain, const char *spec);
+int effect_chain_start(struct effect_chain *chain, snd_pcm_format_t format,
+		       unsigned int channels, unsigned int rate);
+void effect_chain_stop(struct effect_chain *chain);
+void effect_chain_free(struct effect_chain *chain);
+void effect_chain_apply(struct effect_chain *chain, void *buf,
+			snd_pcm_uframes_t frames);
+
 int control_parse_id(const char *str, snd_ctl_elem_id_t *id);
 int control_id_match(snd_ctl_elem_id_t *id1, snd_ctl_elem_id_t *id2);
 int control_init(struct loopback *loop);
 int control_done(struct loopback *loop);
 int control_event(struct loopback_handle *lhandle, snd_ctl_event_t *ev);
+int control_flush(struct loopback *loop);
@@ -0,0 +1,204 @@
+/*
+ *  A simple PCM loopback utility - benchmark of the polyphase resampler
+ *  Copyright (c) 2026 by agent <agent@local>
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <alsa/asoundlib.h>
+#include <math.h>
+#include "alsaloop.h"
+#include "bench.h"
+
+/* the amount of input pushed through each trial by default */
+#define DEFAULT_MEGABYTES	4
+/* the frames written at once, as a period of the capture ring */
+#define PERIOD_FRAMES		1024
+
+#define ARRAY_SIZE(a)		(sizeof(a) / sizeof((a)[0]))
+
+static bool json;
+
+static const char *const quality_names[] = {
+	[RESAMPLE_POLY_FAST - RESAMPLE_POLY_FAST]	= "fast",
+	[RESAMPLE_POLY_MEDIUM - RESAMPLE_POLY_FAST]	= "medium",
+	[RESAMPLE_POLY_BEST - RESAMPLE_POLY_FAST]	= "best",
+};
+
+/* a sine at 997 Hz in each channel, at about half of the full scale */
+static void *generate(snd_pcm_format_t format, unsigned int channels,
+		      unsigned int rate, unsigned int frames)
+{
+	unsigned int i, c;
+	double v;
+	void *buf;
+
+	buf = malloc(frames * channels *
+		     snd_pcm_format_physical_width(format) / 8);
+	if (buf == NULL)
+		return NULL;
+	for (i = 0; i < frames; i++) {
+		v = 0.5 * sin(2 * M_PI * 997.0 * i / rate);
+		for (c = 0; c < channels; c++) {
+			if (format == SND_PCM_FORMAT_S16)
+				((int16_t *)buf)[i * channels + c] = v * INT16_MAX;
+			else
+				((int32_t *)buf)[i * channels + c] = v * INT32_MAX;
+		}
+	}
+	return buf;
+}
+
+/*
+ * The input is written and read a period at a time, the same as
+ * buf_add_resampler() of pcmjob.c does with the rings of a loopback.
+ */
+static int bench_resample(int quality, snd_pcm_format_t format,
+			  unsigned int channels, unsigned int rate_in,
+			  unsigned int rate_out, uint64_t byte_count)
+{
+	struct bench_cost cost = {0};
+	struct resampler *r;
+	unsigned int bytes_per_frame;
+	double ratio = (double)rate_out / rate_in;
+	snd_pcm_uframes_t out_frames, done;
+	uint64_t frame_count, total_in = 0, total_out = 0;
+	void *in, *out;
+	int err;
+
+	bytes_per_frame = channels * snd_pcm_format_physical_width(format) / 8;
+	frame_count = (byte_count + bytes_per_frame - 1) / bytes_per_frame;
+	out_frames = PERIOD_FRAMES * ratio + 1;
+
+	err = resampler_open(&r, quality, format, channels, rate_in, rate_out,
+			     4 * PERIOD_FRAMES);
+	if (err < 0)
+		return err;
+	in = generate(format, channels, rate_in, PERIOD_FRAMES);
+	out = malloc(out_frames * bytes_per_frame);
+	if (in == NULL || out == NULL) {
+		err = -ENOMEM;
+		goto out;
+	}
+
+	while (total_in < frame_count) {
+		bench_cost_begin(&cost);
+		done = resampler_write(r, in, PERIOD_FRAMES);
+		total_out += resampler_read(r, ratio, out, out_frames);
+		bench_cost_end(&cost, done, bytes_per_frame);
+		if (done < PERIOD_FRAMES) {
+			err = -EIO;
+			goto out;
+		}
+		total_in += done;
+	}
+	/* all but the delay of the filter comes out */
+	if (total_out + PERIOD_FRAMES < total_in * ratio) {
+		err = -EIO;
+		goto out;
+	}
+
+	if (json) {
+		printf("{ \"suite\": \"alsaloop\", \"name\": \"resample\", "
+		       "\"quality\": \"%s\", \"format\": \"%s\", "
+		       "\"channels\": %u, \"rate_in\": %u, \"rate_out\": %u, "
+		       "\"frames\": %u",
+		       quality_names[quality - RESAMPLE_POLY_FAST],
+		       snd_pcm_format_name(format), channels, rate_in,
+		       rate_out, PERIOD_FRAMES);
+	} else {
+		printf("%-10s %-10s %3u %6u %6u",
+		       quality_names[quality - RESAMPLE_POLY_FAST],
+		       snd_pcm_format_name(format), channels, rate_in,
+		       rate_out);
+	}
+	bench_print_cost("resample", &cost, json);
+	printf(json ? " }\n" : "\n");
+out:
+	free(out);
+	free(in);
+	resampler_close(r);
+	return err;
+}
+
+int main(int argc, char *argv[])
+{
+	static const snd_pcm_format_t formats[] = {
+		SND_PCM_FORMAT_S16,
+		SND_PCM_FORMAT_S32,
+	};
+	static const unsigned int channels_entries[] = {2, 8};
+	static const unsigned int rates[][2] = {
+		{44100, 48000},
+		{48000, 44100},
+		{48000, 96000},
+	};
+	uint64_t byte_count;
+	unsigned int q, f, c, i;
+	int err = 0;
+
+	if (argc > 1 && strcmp(argv[1], "--json") == 0) {
+		json = true;
+		--argc;
+		++argv;
+	}
+
+	byte_count = DEFAULT_MEGABYTES;
+	if (argc > 1) {
+		char *term;
+
+		errno = 0;
+		byte_count = strtoul(argv[1], &term, 10);
+		if (errno || *term != '\0' || byte_count == 0) {
+			printf("Usage: %s [--json] [megabytes per trial]\n",
+			       argv[0]);
+			return EXIT_FAILURE;
+		}
+	}
+	byte_count *= 1024 * 1024;
+
+	if (!json)
+		printf("%-10s %-10s %3s %6s %6s %10s %10s\n",
+		       "quality", "format", "ch", "in", "out", "MB/s",
+		       "cyc/frame");
+	for (q = RESAMPLE_POLY_FAST; q <= RESAMPLE_POLY_BEST; q++) {
+		for (f = 0; f < ARRAY_SIZE(formats); f++) {
+			for (c = 0; c < ARRAY_SIZE(channels_entries); c++) {
+				for (i = 0; i < ARRAY_SIZE(rates); i++) {
+					err = bench_resample(q, formats[f],
+							channels_entries[c],
+							rates[i][0],
+							rates[i][1],
+							byte_count);
+					if (err < 0)
+						goto end;
+				}
+			}
+		}
+	}
+end:
+	if (err < 0) {
+		fprintf(stderr, "%s\n", strerror(-err));
+		return EXIT_FAILURE;
+	}
+	return EXIT_SUCCESS;
+}
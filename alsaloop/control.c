@@ -309,12 +309,44 @@ static int control_init2(struct loopback *loop,
 	return 0;
 }
 
+/*
+ * The mirrored controls are found by the numid of the event in one of two
+ * hash tables, for the playback (source) and the capture (destination)
+ * side.
+ */
+static void control_hash_clear(struct loopback *loop)
+{
+	struct loopback_mixer *mix;
+
+	memset(loop->controls_src_hash, 0, sizeof(loop->controls_src_hash));
+	memset(loop->controls_dst_hash, 0, sizeof(loop->controls_dst_hash));
+	for (mix = loop->controls; mix; mix = mix->next)
+		mix->pending = 0;
+	loop->controls_pending = NULL;
+}
+
+static void control_hash_add(struct loopback *loop, struct loopback_mixer *mix)
+{
+	struct loopback_mixer **head;
+
+	mix->src_numid = snd_ctl_elem_info_get_numid(mix->src.info);
+	mix->dst_numid = snd_ctl_elem_info_get_numid(mix->dst.info);
+	head = &loop->controls_src_hash[mix->src_numid % CONTROL_HASH_SIZE];
+	mix->src_hash_next = *head;
+	*head = mix;
+	head = &loop->controls_dst_hash[mix->dst_numid % CONTROL_HASH_SIZE];
+	mix->dst_hash_next = *head;
+	*head = mix;
+}
+
 int control_init(struct loopback *loop)
 {
 	struct loopback_mixer *mix;
 	struct loopback_ossmixer *ossmix;
 	int err;
 
+	control_hash_clear(loop);
+
 	for (ossmix = loop->oss_controls; ossmix; ossmix = ossmix->next)
 		oss_set(loop, ossmix, 0);
 	for (mix = loop->controls; mix; mix = mix->next) {
@@ -327,6 +359,7 @@ int control_init(struct loopback *loop)
 		err = control_init2(loop, mix);
 		if (err < 0)
 			return err;
+		control_hash_add(loop, mix);
 	}
 	for (ossmix = loop->oss_controls; ossmix; ossmix = ossmix->next) {
 		err = oss_set(loop, ossmix, 1);
@@ -344,6 +377,7 @@ int control_done(struct loopback *loop)
 	struct loopback_ossmixer *ossmix;
 	int err;
 
+	control_hash_clear(loop);
 	if (loop->capt->ctl == NULL)
 		return 0;
 	for (ossmix = loop->oss_controls; ossmix; ossmix = ossmix->next) {
@@ -361,18 +395,12 @@ int control_done(struct loopback *loop)
 	return 0;
 }
 
-static int control_event1(struct loopback *loop,
-			  struct loopback_mixer *mix,
-			  snd_ctl_event_t *ev,
-			  int capture)
+static int control_copy(struct loopback *loop,
+			struct loopback_mixer *mix,
+			int capture)
 {
-	unsigned int mask = snd_ctl_event_elem_get_mask(ev);
 	int err;
 
-	if (mask == SND_CTL_EVENT_MASK_REMOVE)
-		return 0;
-	if ((mask & SND_CTL_EVENT_MASK_VALUE) == 0)
-		return 0;
 	if (!capture) {
 		snd_ctl_elem_value_set_id(mix->src.value, mix->src.id);
 		err = snd_ctl_elem_read(loop->play->ctl, mix->src.value);
@@ -402,23 +430,50 @@ static int control_event1(struct loopback *loop,
 	return 0;
 }
 
+/*
+ * The events only mark the control; the value is read and written once
+ * per poll cycle by control_flush(), however many events came for it.
+ */
 int control_event(struct loopback_handle *lhandle, snd_ctl_event_t *ev)
 {
-	snd_ctl_elem_id_t *id2;
+	struct loopback *loop = lhandle->loopback;
 	struct loopback_mixer *mix;
-	int capt = lhandle == lhandle->loopback->capt;
-	int err;
+	unsigned int mask = snd_ctl_event_elem_get_mask(ev);
+	unsigned int numid = snd_ctl_event_elem_get_numid(ev);
+	int capt = lhandle == loop->capt;
 
-	snd_ctl_elem_id_alloca(&id2);
-	snd_ctl_event_elem_get_id(ev, id2);
-	for (mix = lhandle->loopback->controls; mix; mix = mix->next) {
-		if (mix->skip)
+	if (mask == SND_CTL_EVENT_MASK_REMOVE)
+		return 0;
+	if ((mask & SND_CTL_EVENT_MASK_VALUE) == 0)
+		return 0;
+	if (capt)
+		mix = loop->controls_dst_hash[numid % CONTROL_HASH_SIZE];
+	else
+		mix = loop->controls_src_hash[numid % CONTROL_HASH_SIZE];
+	for (; mix; mix = capt ? mix->dst_hash_next : mix->src_hash_next) {
+		if ((capt ? mix->dst_numid : mix->src_numid) != numid)
 			continue;
-		if (control_id_match(id2, capt ? mix->dst.id : mix->src.id)) {
-			err = control_event1(lhandle->loopback, mix, ev, capt);
-			if (err < 0)
-				return err;
+		mix->pending_capt = capt;
+		if (!mix->pending) {
+			mix->pending = 1;
+			mix->pending_next = loop->controls_pending;
+			loop->controls_pending = mix;
 		}
 	}
 	return 0;
 }
+
+int control_flush(struct loopback *loop)
+{
+	struct loopback_mixer *mix;
+	int err, res = 0;
+
+	while ((mix = loop->controls_pending) != NULL) {
+		loop->controls_pending = mix->pending_next;
+		mix->pending = 0;
+		err = control_copy(loop, mix, mix->pending_capt);
+		if (err < 0)
+			res = err;
+	}
+	return res;
+}
@@ -0,0 +1,476 @@
+/*
+ *  A simple PCM loopback utility - effect chain
+ *  Copyright (c) 2026 by agent <agent@local>
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <stdint.h>
+#include <alsa/asoundlib.h>
+#include <math.h>
+#include <syslog.h>
+#include "alsaloop.h"
+
+/*
+ * The chain processes the frames added to the playback ring in place.
+ * The samples are converted to float in chunks, passed through all
+ * blocks and stored back with saturation, so a block sees only one
+ * interleaved float buffer and the chain costs one conversion pass.
+ */
+
+#define EFFECT_CHUNK	256		/* frames */
+#define EFFECT_ARGS	4
+
+typedef enum {
+	EFFECT_GAIN = 0,
+	EFFECT_EQ,
+	EFFECT_LIMITER,
+	EFFECT_DELAY
+} effect_type_t;
+
+typedef enum {
+	EQ_LOWPASS = 0,
+	EQ_HIGHPASS,
+	EQ_BANDPASS,
+	EQ_NOTCH,
+	EQ_PEAK,
+	EQ_LOWSHELF,
+	EQ_HIGHSHELF
+} eq_type_t;
+
+struct effect {
+	struct effect *next;
+	effect_type_t type;
+	int subtype;
+	double arg[EFFECT_ARGS];
+	/* run time */
+	float gain;			/* gain or limiter threshold */
+	double b0, b1, b2, a1, a2;	/* biquad */
+	double *z;			/* biquad state, two per channel */
+	float *line;			/* delay line */
+	unsigned int length;		/* delay in frames */
+	unsigned int pos;
+	float env;			/* limiter envelope */
+	float release;
+};
+
+struct effect_chain {
+	struct effect *first;
+	snd_pcm_format_t format;
+	unsigned int channels;
+	float full_scale;
+	float *buf;			/* EFFECT_CHUNK frames */
+};
+
+static const char *eq_types[] = {
+	[EQ_LOWPASS]	= "lowpass",
+	[EQ_HIGHPASS]	= "highpass",
+	[EQ_BANDPASS]	= "bandpass",
+	[EQ_NOTCH]	= "notch",
+	[EQ_PEAK]	= "peak",
+	[EQ_LOWSHELF]	= "lowshelf",
+	[EQ_HIGHSHELF]	= "highshelf",
+};
+
+static int parse_args(const char *str, double *arg, int min, int max)
+{
+	char *end;
+	int i = 0;
+
+	while (str && *str) {
+		if (i >= max)
+			return -EINVAL;
+		arg[i++] = strtod(str, &end);
+		if (end == str || (*end && *end != ':'))
+			return -EINVAL;
+		str = *end ? end + 1 : end;
+	}
+	return i < min ? -EINVAL : i;
+}
+
+/*
+ * gain:DB
+ * eq:TYPE:FREQ[:Q[:DB]]
+ * limiter:DB[:RELEASE_MS]
+ * delay:MS
+ */
+int effect_chain_add(struct effect_chain **_chain, const char *spec)
+{
+	struct effect_chain *chain = *_chain;
+	struct effect *effect, **last;
+	const char *args;
+	size_t len;
+	int err;
+
+	effect = calloc(1, sizeof(*effect));
+	if (effect == NULL)
+		return -ENOMEM;
+	args = strchr(spec, ':');
+	len = args ? (size_t)(args - spec) : strlen(spec);
+	if (args)
+		args++;
+	if (len == 4 && strncmp(spec, "gain", 4) == 0) {
+		effect->type = EFFECT_GAIN;
+		err = parse_args(args, effect->arg, 1, 1);
+	} else if (len == 2 && strncmp(spec, "eq", 2) == 0) {
+		effect->type = EFFECT_EQ;
+		effect->arg[1] = M_SQRT1_2;
+		err = -EINVAL;
+		if (args == NULL)
+			goto __error;
+		for (effect->subtype = 0; effect->subtype <= EQ_HIGHSHELF; effect->subtype++) {
+			len = strlen(eq_types[effect->subtype]);
+			if (strncmp(args, eq_types[effect->subtype], len) == 0 &&
+			    args[len] == ':')
+				break;
+		}
+		if (effect->subtype > EQ_HIGHSHELF)
+			goto __error;
+		err = parse_args(args + len + 1, effect->arg, 1, 3);
+		if (err >= 0 && (effect->arg[0] <= 0 || effect->arg[1] <= 0))
+			err = -EINVAL;
+	} else if (len == 7 && strncmp(spec, "limiter", 7) == 0) {
+		effect->type = EFFECT_LIMITER;
+		effect->arg[1] = 50;
+		err = parse_args(args, effect->arg, 1, 2);
+		if (err >= 0 && effect->arg[1] <= 0)
+			err = -EINVAL;
+	} else if (len == 5 && strncmp(spec, "delay", 5) == 0) {
+		effect->type = EFFECT_DELAY;
+		err = parse_args(args, effect->arg, 1, 1);
+		if (err >= 0 && effect->arg[0] < 0)
+			err = -EINVAL;
+	} else {
+		err = -EINVAL;
+	}
+	if (err < 0)
+		goto __error;
+	if (chain == NULL) {
+		chain = calloc(1, sizeof(*chain));
+		if (chain == NULL) {
+			err = -ENOMEM;
+			goto __error;
+		}
+		*_chain = chain;
+	}
+	for (last = &chain->first; *last; last = &(*last)->next)
+		;
+	*last = effect;
+	return 0;
+      __error:
+	logit(LOG_CRIT, "Wrong effect '%s'\n", spec);
+	free(effect);
+	return err;
+}
+
+static void eq_setup(struct effect *effect, unsigned int rate)
+{
+	double w0 = 2 * M_PI * effect->arg[0] / rate;
+	double cs = cos(w0), alpha = sin(w0) / (2 * effect->arg[1]);
+	double A = pow(10, effect->arg[2] / 40), sq = 2 * sqrt(A) * alpha;
+	double b0, b1, b2, a0, a1, a2;
+
+	switch (effect->subtype) {
+	case EQ_LOWPASS:
+		b0 = b2 = (1 - cs) / 2;
+		b1 = 1 - cs;
+		a0 = 1 + alpha; a1 = -2 * cs; a2 = 1 - alpha;
+		break;
+	case EQ_HIGHPASS:
+		b0 = b2 = (1 + cs) / 2;
+		b1 = -(1 + cs);
+		a0 = 1 + alpha; a1 = -2 * cs; a2 = 1 - alpha;
+		break;
+	case EQ_BANDPASS:
+		b0 = alpha; b1 = 0; b2 = -alpha;
+		a0 = 1 + alpha; a1 = -2 * cs; a2 = 1 - alpha;
+		break;
+	case EQ_NOTCH:
+		b0 = b2 = 1;
+		b1 = -2 * cs;
+		a0 = 1 + alpha; a1 = -2 * cs; a2 = 1 - alpha;
+		break;
+	case EQ_PEAK:
+		b0 = 1 + alpha * A; b1 = -2 * cs; b2 = 1 - alpha * A;
+		a0 = 1 + alpha / A; a1 = -2 * cs; a2 = 1 - alpha / A;
+		break;
+	case EQ_LOWSHELF:
+		b0 = A * ((A + 1) - (A - 1) * cs + sq);
+		b1 = 2 * A * ((A - 1) - (A + 1) * cs);
+		b2 = A * ((A + 1) - (A - 1) * cs - sq);
+		a0 = (A + 1) + (A - 1) * cs + sq;
+		a1 = -2 * ((A - 1) + (A + 1) * cs);
+		a2 = (A + 1) + (A - 1) * cs - sq;
+		break;
+	default:	/* EQ_HIGHSHELF */
+		b0 = A * ((A + 1) + (A - 1) * cs + sq);
+		b1 = -2 * A * ((A - 1) + (A + 1) * cs);
+		b2 = A * ((A + 1) + (A - 1) * cs - sq);
+		a0 = (A + 1) - (A - 1) * cs + sq;
+		a1 = 2 * ((A - 1) - (A + 1) * cs);
+		a2 = (A + 1) - (A - 1) * cs - sq;
+		break;
+	}
+	effect->b0 = b0 / a0;
+	effect->b1 = b1 / a0;
+	effect->b2 = b2 / a0;
+	effect->a1 = a1 / a0;
+	effect->a2 = a2 / a0;
+}
+
+static void effect_free_state(struct effect *effect)
+{
+	free(effect->z);
+	effect->z = NULL;
+	free(effect->line);
+	effect->line = NULL;
+}
+
+int effect_chain_start(struct effect_chain *chain, snd_pcm_format_t format,
+		       unsigned int channels, unsigned int rate)
+{
+	struct effect *effect;
+
+	if (chain == NULL)
+		return 0;
+	if (format != SND_PCM_FORMAT_S16 && format != SND_PCM_FORMAT_S32)
+		return -EINVAL;
+	effect_chain_stop(chain);
+	chain->format = format;
+	chain->channels = channels;
+	chain->full_scale = format == SND_PCM_FORMAT_S16 ?
+					32768.0f : 2147483648.0f;
+	chain->buf = malloc(EFFECT_CHUNK * channels * sizeof(float));
+	if (chain->buf == NULL)
+		return -ENOMEM;
+	for (effect = chain->first; effect; effect = effect->next) {
+		switch (effect->type) {
+		case EFFECT_GAIN:
+			effect->gain = pow(10, effect->arg[0] / 20);
+			break;
+		case EFFECT_EQ:
+			eq_setup(effect, rate);
+			effect->z = calloc(2 * channels, sizeof(double));
+			if (effect->z == NULL)
+				goto __nomem;
+			break;
+		case EFFECT_LIMITER:
+			effect->gain = pow(10, effect->arg[0] / 20) *
+				       chain->full_scale;
+			effect->release = exp(-1000.0 / (rate * effect->arg[1]));
+			effect->env = 0;
+			break;
+		case EFFECT_DELAY:
+			effect->length = rate * effect->arg[0] / 1000;
+			effect->pos = 0;
+			if (effect->length == 0)
+				break;
+			effect->line = calloc(effect->length * channels,
+					      sizeof(float));
+			if (effect->line == NULL)
+				goto __nomem;
+			break;
+		}
+	}
+	return 0;
+      __nomem:
+	effect_chain_stop(chain);
+	return -ENOMEM;
+}
+
+void effect_chain_stop(struct effect_chain *chain)
+{
+	struct effect *effect;
+
+	if (chain == NULL)
+		return;
+	for (effect = chain->first; effect; effect = effect->next)
+		effect_free_state(effect);
+	free(chain->buf);
+	chain->buf = NULL;
+}
+
+void effect_chain_free(struct effect_chain *chain)
+{
+	struct effect *effect;
+
+	if (chain == NULL)
+		return;
+	effect_chain_stop(chain);
+	while ((effect = chain->first) != NULL) {
+		chain->first = effect->next;
+		free(effect);
+	}
+	free(chain);
+}
+
+static void apply_gain(struct effect *effect, float *buf, unsigned int samples)
+{
+	float gain = effect->gain;
+	unsigned int i;
+
+	/* a plain loop, the compiler vectorizes it */
+	for (i = 0; i < samples; i++)
+		buf[i] *= gain;
+}
+
+static void apply_eq(struct effect *effect, float *buf, unsigned int frames,
+		     unsigned int channels)
+{
+	unsigned int i, c;
+	double x, y, *z;
+
+	/* transposed direct form II, the state is kept in double */
+	for (c = 0; c < channels; c++) {
+		z = effect->z + 2 * c;
+		for (i = 0; i < frames; i++) {
+			x = buf[i * channels + c];
+			y = effect->b0 * x + z[0];
+			z[0] = effect->b1 * x - effect->a1 * y + z[1];
+			z[1] = effect->b2 * x - effect->a2 * y;
+			buf[i * channels + c] = y;
+		}
+	}
+}
+
+static void apply_limiter(struct effect *effect, float *buf,
+			  unsigned int frames, unsigned int channels)
+{
+	unsigned int i, c;
+	float peak, gain;
+
+	/* instant attack, all channels share one envelope */
+	for (i = 0; i < frames; i++, buf += channels) {
+		peak = 0;
+		for (c = 0; c < channels; c++)
+			if (fabsf(buf[c]) > peak)
+				peak = fabsf(buf[c]);
+		if (peak > effect->env)
+			effect->env = peak;
+		else
+			effect->env = effect->release * effect->env +
+				      (1 - effect->release) * peak;
+		if (effect->env <= effect->gain)
+			continue;
+		gain = effect->gain / effect->env;
+		for (c = 0; c < channels; c++)
+			buf[c] *= gain;
+	}
+}
+
+static void apply_delay(struct effect *effect, float *buf,
+			unsigned int frames, unsigned int channels)
+{
+	unsigned int i, c;
+	float *line, v;
+
+	if (effect->length == 0)
+		return;
+	for (i = 0; i < frames; i++, buf += channels) {
+		line = effect->line + effect->pos * channels;
+		for (c = 0; c < channels; c++) {
+			v = line[c];
+			line[c] = buf[c];
+			buf[c] = v;
+		}
+		if (++effect->pos >= effect->length)
+			effect->pos = 0;
+	}
+}
+
+static void chain_load(struct effect_chain *chain, const void *src,
+		       unsigned int samples)
+{
+	unsigned int i;
+
+	if (chain->format == SND_PCM_FORMAT_S16) {
+		const int16_t *s = src;
+		for (i = 0; i < samples; i++)
+			chain->buf[i] = s[i];
+	} else {
+		const int32_t *s = src;
+		for (i = 0; i < samples; i++)
+			chain->buf[i] = s[i];
+	}
+}
+
+static void chain_store(struct effect_chain *chain, void *dst,
+			unsigned int samples)
+{
+	unsigned int i;
+	float v;
+
+	if (chain->format == SND_PCM_FORMAT_S16) {
+		int16_t *d = dst;
+		for (i = 0; i < samples; i++) {
+			v = chain->buf[i];
+			if (v >= 32767.0f)
+				d[i] = 32767;
+			else if (v <= -32768.0f)
+				d[i] = -32768;
+			else
+				d[i] = lrintf(v);
+		}
+	} else {
+		int32_t *d = dst;
+		for (i = 0; i < samples; i++) {
+			v = chain->buf[i];
+			if (v >= 2147483648.0f)
+				d[i] = INT32_MAX;
+			else if (v <= -2147483648.0f)
+				d[i] = INT32_MIN;
+			else
+				d[i] = lrintf(v);
+		}
+	}
+}
+
+void effect_chain_apply(struct effect_chain *chain, void *buf,
+			snd_pcm_uframes_t frames)
+{
+	unsigned int channels = chain->channels;
+	unsigned int bytes = snd_pcm_format_physical_width(chain->format) / 8;
+	struct effect *effect;
+	snd_pcm_uframes_t n;
+
+	while (frames > 0) {
+		n = frames > EFFECT_CHUNK ? EFFECT_CHUNK : frames;
+		chain_load(chain, buf, n * channels);
+		for (effect = chain->first; effect; effect = effect->next) {
+			switch (effect->type) {
+			case EFFECT_GAIN:
+				apply_gain(effect, chain->buf, n * channels);
+				break;
+			case EFFECT_EQ:
+				apply_eq(effect, chain->buf, n, channels);
+				break;
+			case EFFECT_LIMITER:
+				apply_limiter(effect, chain->buf, n, channels);
+				break;
+			case EFFECT_DELAY:
+				apply_delay(effect, chain->buf, n, channels);
+				break;
+			}
+		}
+		chain_store(chain, buf, n * channels);
+		buf = (char *)buf + n * channels * bytes;
+		frames -= n;
+	}
+}
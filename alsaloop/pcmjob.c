@@ -33,9 +33,24 @@
 #include <syslog.h>
 #include <pthread.h>
 #include "alsaloop.h"
+#include "probes.h"
 
 #define XRUN_PROFILE_UNKNOWN (-10000000)
 
+/*
+ * The PI controller sees the latency as an integrator of the rate error:
+ * d(latency)/dt = -(pitch - 1) * rate. With the correction
+ * u = Kp * e + Ki * integral(e) the loop has the natural frequency
+ * sqrt(Ki) and the damping Kp / (2 * sqrt(Ki)). The bandwidth is kept
+ * low (0.02Hz), so the period granularity of the measured delays is
+ * filtered out, with the damping of 0.707.
+ */
+#define PI_INTERVAL	1		/* update period in seconds */
+#define PI_OMEGA	(2 * M_PI * 0.02)
+#define PI_KP		(2 * 0.707 * PI_OMEGA)
+#define PI_KI		(PI_OMEGA * PI_OMEGA)
+#define PI_PITCH_LIMIT	0.005		/* maximal correction (5000ppm) */
+
 static int set_rate_shift(struct loopback_handle *lhandle, double pitch);
 static int get_rate(struct loopback_handle *lhandle);
 
@@ -52,15 +67,18 @@ static const char *sync_types[] = {
 
 #define SRCTYPE(v) [SRC_##v] = "SRC_" #v
 
-#ifdef USE_SAMPLERATE
+#define RESAMPLETYPE(v) [RESAMPLE_##v] = #v
+
 static const char *src_types[] = {
 	SRCTYPE(SINC_BEST_QUALITY),
 	SRCTYPE(SINC_MEDIUM_QUALITY),
 	SRCTYPE(SINC_FASTEST),
 	SRCTYPE(ZERO_ORDER_HOLD),
-	SRCTYPE(LINEAR)
+	SRCTYPE(LINEAR),
+	RESAMPLETYPE(POLY_FAST),
+	RESAMPLETYPE(POLY_MEDIUM),
+	RESAMPLETYPE(POLY_BEST)
 };
-#endif
 
 static pthread_once_t pcm_open_mutex_once = PTHREAD_ONCE_INIT;
 static pthread_mutex_t pcm_open_mutex;
@@ -124,6 +142,12 @@ static int setparams_stream(struct loopback_handle *lhandle,
 		return err;
 	}
 	err = snd_pcm_hw_params_set_access(handle, params, lhandle->access);
+	if (err < 0 && lhandle->access == SND_PCM_ACCESS_MMAP_INTERLEAVED) {
+		if (verbose)
+			logit(LOG_WARNING, "No mmap access for %s, using read/write\n", lhandle->id);
+		lhandle->access = SND_PCM_ACCESS_RW_INTERLEAVED;
+		err = snd_pcm_hw_params_set_access(handle, params, lhandle->access);
+	}
 	if (err < 0) {
 		logit(LOG_CRIT, "Access type not available for %s: %s\n", lhandle->id, snd_strerror(err));
 		return err;
@@ -147,11 +171,7 @@ static int setparams_stream(struct loopback_handle *lhandle,
 	rrate = 0;
 	snd_pcm_hw_params_get_rate(params, &rrate, 0);
 	lhandle->rate = rrate;
-	if (
-#ifdef USE_SAMPLERATE
-	    !lhandle->loopback->src_enable &&
-#endif
-	    (int)rrate != lhandle->rate) {
+	if (!lhandle->loopback->src_enable && (int)rrate != lhandle->rate) {
 		logit(LOG_CRIT, "Rate does not match (requested %uHz, got %uHz, resample %u)\n", lhandle->rate, rrate, lhandle->resample);
 		return -EINVAL;
 	}
@@ -274,6 +294,11 @@ static int setparams_set(struct loopback_handle *lhandle,
 		return err;
 	}
 	snd_pcm_sw_params_get_avail_min(swparams, &lhandle->avail_min);
+	if (lhandle->loopback->controller == CONTROLLER_TYPE_PI) {
+		/* both delays are sampled with timestamps of the same clock */
+		snd_pcm_sw_params_set_tstamp_mode(handle, swparams, SND_PCM_TSTAMP_ENABLE);
+		snd_pcm_sw_params_set_tstamp_type(handle, swparams, SND_PCM_TSTAMP_TYPE_MONOTONIC);
+	}
 	err = snd_pcm_sw_params(handle, swparams);
 	if (err < 0) {
 		logit(LOG_CRIT, "Unable to set sw params for %s: %s\n", lhandle->id, snd_strerror(err));
@@ -318,8 +343,41 @@ static int increase_playback_avail_min(struct loopback_handle *lhandle)
 	return 0;
 }
 
+/*
+ * A restart keeps the hw and sw parameters of a handle, which were not
+ * freed by pcmjob_stop() and which are requested again.
+ */
+static int setparams_keep(struct loopback_handle *lhandle,
+			  snd_pcm_uframes_t bufsize)
+{
+	if (!lhandle->setup ||
+	    lhandle->setup_access != lhandle->access ||
+	    lhandle->setup_format != lhandle->format ||
+	    lhandle->setup_rate_req != lhandle->rate_req ||
+	    lhandle->setup_channels != lhandle->channels ||
+	    lhandle->setup_bufsize != bufsize ||
+	    snd_pcm_state(lhandle->handle) != SND_PCM_STATE_SETUP)
+		return 0;
+	lhandle->pitch = (double)lhandle->rate_req / (double)lhandle->rate;
+	if (verbose > 1)
+		snd_output_printf(lhandle->loopback->output, "%s: parameters kept\n", lhandle->id);
+	return 1;
+}
+
+static void setparams_save(struct loopback_handle *lhandle,
+			   snd_pcm_uframes_t bufsize)
+{
+	lhandle->setup = 1;
+	lhandle->setup_access = lhandle->access;
+	lhandle->setup_format = lhandle->format;
+	lhandle->setup_rate_req = lhandle->rate_req;
+	lhandle->setup_channels = lhandle->channels;
+	lhandle->setup_bufsize = bufsize;
+}
+
 static int setparams(struct loopback *loop, snd_pcm_uframes_t bufsize)
 {
+	int set_play, set_capt;
 	int err;
 	snd_pcm_hw_params_t *pt_params, *ct_params;	/* templates with rate, format and channels */
 	snd_pcm_hw_params_t *p_params, *c_params;
@@ -331,31 +389,67 @@ static int setparams(struct loopback *loop, snd_pcm_uframes_t bufsize)
 	snd_pcm_hw_params_alloca(&ct_params);
 	snd_pcm_sw_params_alloca(&p_swparams);
 	snd_pcm_sw_params_alloca(&c_swparams);
-	if ((err = setparams_stream(loop->play, pt_params)) < 0) {
+	set_play = !loop->play->mix_master &&
+		   !setparams_keep(loop->play, bufsize);
+	set_capt = !loop->capt->fanout_master &&
+		   !setparams_keep(loop->capt, bufsize);
+	if (set_play)
+		loop->play->setup = 0;
+	if (set_capt)
+		loop->capt->setup = 0;
+	if (loop->play->mix_master) {
+		/* the playback PCM is configured by the master job */
+		struct loopback_handle *master = loop->play->mix_master;
+		loop->play->access = master->access;
+		loop->play->rate = master->rate;
+		loop->play->pitch = master->pitch;
+		loop->play->buffer_size = master->buffer_size;
+		loop->play->period_size = master->period_size;
+		loop->play->avail_min = master->avail_min;
+	} else if (set_play &&
+		   (err = setparams_stream(loop->play, pt_params)) < 0) {
 		logit(LOG_CRIT, "Unable to set parameters for %s stream: %s\n", loop->play->id, snd_strerror(err));
 		return err;
 	}
-	if ((err = setparams_stream(loop->capt, ct_params)) < 0) {
+	if (loop->capt->fanout_master) {
+		/* the capture PCM is configured by the master job */
+		struct loopback_handle *master = loop->capt->fanout_master;
+		loop->capt->access = master->access;
+		loop->capt->rate = master->rate;
+		loop->capt->pitch = master->pitch;
+		loop->capt->buffer_size = master->buffer_size;
+		loop->capt->period_size = master->period_size;
+		loop->capt->avail_min = master->avail_min;
+	} else if (set_capt &&
+		   (err = setparams_stream(loop->capt, ct_params)) < 0) {
 		logit(LOG_CRIT, "Unable to set parameters for %s stream: %s\n", loop->capt->id, snd_strerror(err));
 		return err;
 	}
 
-	if ((err = setparams_bufsize(loop->play, p_params, pt_params, bufsize / loop->play->pitch)) < 0) {
+	if (set_play &&
+	    (err = setparams_bufsize(loop->play, p_params, pt_params, bufsize / loop->play->pitch)) < 0) {
 		logit(LOG_CRIT, "Unable to set buffer parameters for %s stream: %s\n", loop->play->id, snd_strerror(err));
 		return err;
 	}
-	if ((err = setparams_bufsize(loop->capt, c_params, ct_params, bufsize / loop->capt->pitch)) < 0) {
+	if (set_capt &&
+	    (err = setparams_bufsize(loop->capt, c_params, ct_params, bufsize / loop->capt->pitch)) < 0) {
 		logit(LOG_CRIT, "Unable to set buffer parameters for %s stream: %s\n", loop->capt->id, snd_strerror(err));
 		return err;
 	}
 
-	if ((err = setparams_set(loop->play, p_params, p_swparams, bufsize / loop->play->pitch)) < 0) {
-		logit(LOG_CRIT, "Unable to set sw parameters for %s stream: %s\n", loop->play->id, snd_strerror(err));
-		return err;
+	if (set_play) {
+		if ((err = setparams_set(loop->play, p_params, p_swparams, bufsize / loop->play->pitch)) < 0) {
+			logit(LOG_CRIT, "Unable to set sw parameters for %s stream: %s\n", loop->play->id, snd_strerror(err));
+			return err;
+		}
+		setparams_save(loop->play, bufsize);
 	}
-	if ((err = setparams_set(loop->capt, c_params, c_swparams, bufsize / loop->capt->pitch)) < 0) {
-		logit(LOG_CRIT, "Unable to set sw parameters for %s stream: %s\n", loop->capt->id, snd_strerror(err));
-		return err;
+	if (set_capt) {
+		if ((err = setparams_set(loop->capt, c_params, c_swparams, bufsize / loop->capt->pitch)) < 0) {
+			logit(LOG_CRIT, "Unable to set sw parameters for %s stream: %s\n", loop->capt->id, snd_strerror(err));
+			return err;
+		}
+		setparams_save(loop->capt, bufsize);
 	}
 
 #if 0
@@ -363,18 +457,22 @@ static int setparams(struct loopback *loop, snd_pcm_uframes_t bufsize)
 		if (snd_pcm_link(loop->capt->handle, loop->play->handle) >= 0)
 			loop->linked = 1;
 #endif
-	if ((err = snd_pcm_prepare(loop->play->handle)) < 0) {
+	if (!loop->play->mix_master &&
+	    (err = snd_pcm_prepare(loop->play->handle)) < 0) {
 		logit(LOG_CRIT, "Prepare %s error: %s\n", loop->play->id, snd_strerror(err));
 		return err;
 	}
-	if (!loop->linked && (err = snd_pcm_prepare(loop->capt->handle)) < 0) {
+	if (!loop->linked && !loop->capt->fanout_master &&
+	    (err = snd_pcm_prepare(loop->capt->handle)) < 0) {
 		logit(LOG_CRIT, "Prepare %s error: %s\n", loop->capt->id, snd_strerror(err));
 		return err;
 	}
 
 	if (verbose) {
-		snd_pcm_dump(loop->play->handle, loop->output);
-		snd_pcm_dump(loop->capt->handle, loop->output);
+		if (!loop->play->mix_master)
+			snd_pcm_dump(loop->play->handle, loop->output);
+		if (!loop->capt->fanout_master)
+			snd_pcm_dump(loop->capt->handle, loop->output);
 	}
 	return 0;
 }
@@ -421,9 +519,7 @@ static void xrun_profile0(struct loopback *loop)
 		loop->xrun_last_cdelay = cdelay;
 		loop->xrun_buf_pcount = loop->play->buf_count;
 		loop->xrun_buf_ccount = loop->capt->buf_count;
-#ifdef USE_SAMPLERATE
 		loop->xrun_out_frames = loop->src_out_frames;
-#endif
 	}
 }
 
@@ -488,6 +584,29 @@ static inline snd_pcm_uframes_t buf_avail(struct loopback_handle *lhandle)
 	return lhandle->buf_size - lhandle->buf_count;
 }
 
+/* the area of ring buffer from pos in up to two contiguous segments */
+struct buf_view {
+	char *ptr[2];
+	snd_pcm_uframes_t frames[2];
+};
+
+static inline void buf_view(struct loopback_handle *lhandle,
+			    snd_pcm_uframes_t pos, snd_pcm_uframes_t count,
+			    struct buf_view *view)
+{
+	snd_pcm_uframes_t head = lhandle->buf_size - pos;
+
+	view->ptr[0] = lhandle->buf + pos * lhandle->frame_size;
+	view->ptr[1] = lhandle->buf;
+	if (count <= head) {
+		view->frames[0] = count;
+		view->frames[1] = 0;
+	} else {
+		view->frames[0] = head;
+		view->frames[1] = count - head;
+	}
+}
+
 static void buf_remove(struct loopback *loop, snd_pcm_uframes_t count)
 {
 	/* remove samples from the capture buffer */
@@ -537,38 +656,63 @@ static void buf_add_copy(struct loopback *loop)
 }
 #endif
 
+static void buf_add_resampler(struct loopback *loop)
+{
+	struct loopback_handle *capt = loop->capt;
+	struct loopback_handle *play = loop->play;
+	struct buf_view view;
+	snd_pcm_uframes_t done;
+	int i;
+
+	buf_view(capt, (capt->buf_pos + capt->buf_size - capt->buf_count) %
+		       capt->buf_size, capt->buf_count, &view);
+	for (i = 0; i < 2; i++) {
+		done = resampler_write(loop->resampler, view.ptr[i],
+				       view.frames[i]);
+		capt->buf_count -= done;
+		if (done < view.frames[i])
+			break;
+	}
+	buf_view(play, (play->buf_pos + play->buf_count) % play->buf_size,
+		 buf_avail(play), &view);
+	for (i = 0; i < 2; i++) {
+		done = resampler_read(loop->resampler, loop->src_ratio,
+				      view.ptr[i], view.frames[i]);
+		play->buf_count += done;
+		if (done < view.frames[i])
+			break;
+	}
+	/* the input kept in the resampler counted in output frames */
+	loop->src_out_frames = resampler_pending(loop->resampler) *
+			       loop->src_ratio;
+}
+
 #ifdef USE_SAMPLERATE
-static void buf_add_src(struct loopback *loop)
+static void buf_add_libsamplerate(struct loopback *loop)
 {
 	struct loopback_handle *capt = loop->capt;
 	struct loopback_handle *play = loop->play;
 	float *old_data_out;
-	snd_pcm_uframes_t count, pos, count1, pos1;
-	count = capt->buf_count;
+	struct buf_view view;
+	snd_pcm_uframes_t count, pos;
+	int i;
+
+	/* the captured samples are converted straight from the ring */
+	buf_view(capt, (capt->buf_pos + capt->buf_size - capt->buf_count) %
+		       capt->buf_size, capt->buf_count, &view);
 	pos = 0;
-	pos1 = capt->buf_pos - count;
-	if (pos1 > capt->buf_size)
-		pos1 += capt->buf_size;
-	while (count > 0) {
-		count1 = count;
-		if (count1 + pos1 > capt->buf_size)
-			count1 = capt->buf_size - pos1;
+	for (i = 0; i < 2; i++) {
 		if (capt->format == SND_PCM_FORMAT_S32)
-			src_int_to_float_array((int *)(capt->buf +
-						pos1 * capt->frame_size),
+			src_int_to_float_array((int *)view.ptr[i],
 					 (float *)loop->src_data.data_in +
 					   pos * capt->channels,
-					 count1 * capt->channels);
+					 view.frames[i] * capt->channels);
 		else
-			src_short_to_float_array((short *)(capt->buf +
-						pos1 * capt->frame_size),
+			src_short_to_float_array((short *)view.ptr[i],
 					 (float *)loop->src_data.data_in +
 					   pos * capt->channels,
-					 count1 * capt->channels);
-		count -= count1;
-		pos += count1;
-		pos1 += count1;
-		pos1 %= capt->buf_size;
+					 view.frames[i] * capt->channels);
+		pos += view.frames[i];
 	}
 	loop->src_data.input_frames = pos;
 	loop->src_data.output_frames = play->buf_size -
@@ -576,39 +720,33 @@ static void buf_add_src(struct loopback *loop)
 	loop->src_data.end_of_input = 0;
 	old_data_out = loop->src_data.data_out;
 	loop->src_data.data_out = old_data_out + loop->src_out_frames;
+	loop->src_data.src_ratio = loop->src_ratio;
 	src_process(loop->src_state, &loop->src_data);
 	loop->src_data.data_out = old_data_out;
 	capt->buf_count -= loop->src_data.input_frames_used;
+
+	/* and converted back straight into the free area of the other ring */
 	count = loop->src_data.output_frames_gen +
 		loop->src_out_frames;
+	if (count > buf_avail(play))
+		count = buf_avail(play);
+	buf_view(play, (play->buf_pos + play->buf_count) % play->buf_size,
+		 count, &view);
 	pos = 0;
-	pos1 = (play->buf_pos + play->buf_count) % play->buf_size;
-	while (count > 0) {
-		count1 = count;
-		if (count1 + pos1 > play->buf_size)
-			count1 = play->buf_size - pos1;
-		if (count1 > buf_avail(play))
-			count1 = buf_avail(play);
-		if (count1 == 0)
-			break;
+	for (i = 0; i < 2; i++) {
 		if (capt->format == SND_PCM_FORMAT_S32)
 			src_float_to_int_array(loop->src_data.data_out +
 					   pos * play->channels,
-					 (int *)(play->buf +
-					   pos1 * play->frame_size),
-					 count1 * play->channels);
+					 (int *)view.ptr[i],
+					 view.frames[i] * play->channels);
 		else
 			src_float_to_short_array(loop->src_data.data_out +
 					   pos * play->channels,
-					 (short *)(play->buf +
-					   pos1 * play->frame_size),
-					 count1 * play->channels);
-		play->buf_count += count1;
-		count -= count1;
-		pos += count1;
-		pos1 += count1;
-		pos1 %= play->buf_size;
+					 (short *)view.ptr[i],
+					 view.frames[i] * play->channels);
+		pos += view.frames[i];
 	}
+	play->buf_count += pos;
 #if 0
 	printf("src: pos = %li, gen = %li, out = %li, count = %li\n",
 		(long)pos, (long)loop->src_data.output_frames_gen,
@@ -622,14 +760,25 @@ static void buf_add_src(struct loopback *loop)
 			loop->src_out_frames * play->channels * sizeof(float));
 	}
 }
-#else
+#endif
+
 static void buf_add_src(struct loopback *loop)
 {
-}
+	if (loop->resampler) {
+		buf_add_resampler(loop);
+		return;
+	}
+#ifdef USE_SAMPLERATE
+	buf_add_libsamplerate(loop);
 #endif
+}
 
 static void buf_add(struct loopback *loop, snd_pcm_uframes_t count)
 {
+	struct loopback_handle *play = loop->play;
+	snd_pcm_uframes_t old = play->buf_count;
+	struct buf_view view;
+
 	/* copy samples from capture to playback buffer */
 	if (count <= 0)
 		return;
@@ -638,12 +787,22 @@ static void buf_add(struct loopback *loop, snd_pcm_uframes_t count)
 	} else {
 		buf_add_src(loop);
 	}
+	/* the effects process the new frames in place */
+	if (loop->effects && play->buf_count > old) {
+		buf_view(play, (play->buf_pos + old) % play->buf_size,
+			 play->buf_count - old, &view);
+		effect_chain_apply(loop->effects, view.ptr[0], view.frames[0]);
+		if (view.frames[1] > 0)
+			effect_chain_apply(loop->effects, view.ptr[1],
+					   view.frames[1]);
+	}
 }
 
 static int xrun(struct loopback_handle *lhandle)
 {
 	int err;
 
+	lhandle->xruns++;
 	if (lhandle == lhandle->loopback->play) {
 		logit(LOG_DEBUG, "underrun for %s\n", lhandle->id);
 		xrun_stats(lhandle->loopback);
@@ -671,12 +830,68 @@ static int suspend(struct loopback_handle *lhandle)
 	return 0;
 }
 
+static inline snd_pcm_sframes_t pcm_read(struct loopback_handle *lhandle,
+					 void *buf, snd_pcm_uframes_t frames)
+{
+	if (lhandle->access == SND_PCM_ACCESS_MMAP_INTERLEAVED)
+		return snd_pcm_mmap_readi(lhandle->handle, buf, frames);
+	return snd_pcm_readi(lhandle->handle, buf, frames);
+}
+
+static inline snd_pcm_sframes_t pcm_write(struct loopback_handle *lhandle,
+					  const void *buf,
+					  snd_pcm_uframes_t frames)
+{
+	if (lhandle->access == SND_PCM_ACCESS_MMAP_INTERLEAVED)
+		return snd_pcm_mmap_writei(lhandle->handle, buf, frames);
+	return snd_pcm_writei(lhandle->handle, buf, frames);
+}
+
+/*
+ * Store captured frames to the ring of a job sharing the capture PCM,
+ * as if that job read them itself.
+ */
+static void fanout_feed(struct loopback_handle *lhandle, const char *buf,
+			snd_pcm_uframes_t count)
+{
+	snd_pcm_uframes_t r;
+
+	if (!lhandle->loopback->running)
+		return;
+	if (count > buf_avail(lhandle)) {
+		lhandle->buf_over += count - buf_avail(lhandle);
+		count = buf_avail(lhandle);
+	}
+	while (count > 0) {
+		r = count;
+		if (r + lhandle->buf_pos > lhandle->buf_size)
+			r = lhandle->buf_size - lhandle->buf_pos;
+		memcpy(lhandle->buf + lhandle->buf_pos * lhandle->frame_size,
+		       buf, r * lhandle->frame_size);
+		buf += r * lhandle->frame_size;
+		lhandle->fanout_pending += r;
+		if (lhandle->max < lhandle->fanout_pending)
+			lhandle->max = lhandle->fanout_pending;
+		lhandle->counter += r;
+		lhandle->buf_count += r;
+		lhandle->buf_pos += r;
+		lhandle->buf_pos %= lhandle->buf_size;
+		count -= r;
+	}
+}
+
 static int readit(struct loopback_handle *lhandle)
 {
 	snd_pcm_sframes_t r, res = 0;
 	snd_pcm_sframes_t avail;
-	int err;
+	int i, err;
 
+	if (lhandle->fanout_master) {
+		/* the frames were stored by the master handle */
+		res = lhandle->fanout_pending;
+		lhandle->fanout_pending = 0;
+		return res;
+	}
 	avail = snd_pcm_avail_update(lhandle->handle);
 	if (avail == -EPIPE) {
 		return xrun(lhandle);
@@ -699,10 +914,10 @@ static int readit(struct loopback_handle *lhandle)
 			r = lhandle->buf_size - lhandle->buf_pos;
 		if (r > avail)
 			r = avail;
-		r = snd_pcm_readi(lhandle->handle,
-				  lhandle->buf +
-				  lhandle->buf_pos *
-				  lhandle->frame_size, r);
+		r = pcm_read(lhandle,
+			     lhandle->buf +
+			     lhandle->buf_pos *
+			     lhandle->frame_size, r);
 		if (r == 0)
 			return res;
 		if (r < 0) {
@@ -722,6 +937,9 @@ static int readit(struct loopback_handle *lhandle)
 			fwrite(lhandle->buf + lhandle->buf_pos * lhandle->frame_size,
 			       r, lhandle->frame_size, lhandle->loopback->cfile);
 #endif
+		for (i = 0; i < lhandle->fanout_count; i++)
+			fanout_feed(lhandle->fanout[i], lhandle->buf +
+				    lhandle->buf_pos * lhandle->frame_size, r);
 		res += r;
 		if (lhandle->max < res)
 			lhandle->max = res;
@@ -734,12 +952,142 @@ static int readit(struct loopback_handle *lhandle)
 	return res;
 }
 
+/*
+ * Playback mixing: the master handle sums the next frames of its own
+ * ring and of the rings of the jobs sharing its playback PCM, with the
+ * gain of each. The master ring sets the pace, a source short of frames
+ * contributes silence. The sums are kept in 64 bits (Q16) and saturate
+ * only once, when stored in the playback format.
+ */
+static void mix_add(int64_t *acc, const char *src, snd_pcm_format_t format,
+		    int gain, snd_pcm_uframes_t samples)
+{
+	snd_pcm_uframes_t i;
+
+	/* plain loops, the compiler vectorizes them */
+	if (format == SND_PCM_FORMAT_S16) {
+		const int16_t *s = (const int16_t *)src;
+		for (i = 0; i < samples; i++)
+			acc[i] += (int64_t)s[i] * gain;
+	} else {
+		const int32_t *s = (const int32_t *)src;
+		for (i = 0; i < samples; i++)
+			acc[i] += (int64_t)s[i] * gain;
+	}
+}
+
+static void mix_store(char *dst, const int64_t *acc, snd_pcm_format_t format,
+		      snd_pcm_uframes_t samples)
+{
+	snd_pcm_uframes_t i;
+	int64_t v;
+
+	if (format == SND_PCM_FORMAT_S16) {
+		int16_t *d = (int16_t *)dst;
+		for (i = 0; i < samples; i++) {
+			v = acc[i] >> 16;
+			if (v > INT16_MAX)
+				v = INT16_MAX;
+			else if (v < INT16_MIN)
+				v = INT16_MIN;
+			d[i] = v;
+		}
+	} else {
+		int32_t *d = (int32_t *)dst;
+		for (i = 0; i < samples; i++) {
+			v = acc[i] >> 16;
+			if (v > INT32_MAX)
+				v = INT32_MAX;
+			else if (v < INT32_MIN)
+				v = INT32_MIN;
+			d[i] = v;
+		}
+	}
+}
+
+static char *mix_chunk(struct loopback_handle *lhandle, const char *buf,
+		       snd_pcm_uframes_t frames)
+{
+	struct loopback_handle *source;
+	struct buf_view view;
+	snd_pcm_uframes_t count;
+	int64_t *acc;
+	int i, j;
+
+	memset(lhandle->mix_acc, 0,
+	       frames * lhandle->channels * sizeof(*lhandle->mix_acc));
+	mix_add(lhandle->mix_acc, buf, lhandle->format, lhandle->mix_gain,
+		frames * lhandle->channels);
+	for (i = 0; i < lhandle->mix_count; i++) {
+		source = lhandle->mix[i];
+		if (!source->loopback->running)
+			continue;
+		count = source->buf_count < frames ? source->buf_count : frames;
+		buf_view(source, source->buf_pos, count, &view);
+		acc = lhandle->mix_acc;
+		for (j = 0; j < 2; j++) {
+			mix_add(acc, view.ptr[j], lhandle->format,
+				source->mix_gain,
+				view.frames[j] * lhandle->channels);
+			acc += view.frames[j] * lhandle->channels;
+		}
+	}
+	mix_store(lhandle->mix_out, lhandle->mix_acc, lhandle->format,
+		  frames * lhandle->channels);
+	return lhandle->mix_out;
+}
+
+/* remove the played frames from the mixed rings */
+static void mix_commit(struct loopback_handle *lhandle,
+		       snd_pcm_uframes_t frames)
+{
+	struct loopback_handle *source;
+	snd_pcm_uframes_t count;
+	int i;
+
+	for (i = 0; i < lhandle->mix_count; i++) {
+		source = lhandle->mix[i];
+		if (!source->loopback->running)
+			continue;
+		count = source->buf_count < frames ? source->buf_count : frames;
+		source->counter += count;
+		source->buf_count -= count;
+		source->buf_pos += count;
+		source->buf_pos %= source->buf_size;
+		source->mix_pending += count;
+	}
+}
+
+/* returns 1 when the playback after the stop request is finished */
+static int stop_check(struct loopback_handle *lhandle, snd_pcm_uframes_t count)
+{
+	struct loopback *loop = lhandle->loopback;
+
+	if (!loop->stop_pending)
+		return 0;
+	loop->stop_count += count;
+	if (loop->stop_count * lhandle->pitch > loop->latency * 3) {
+		loop->stop_pending = 0;
+		loop->reinit = 1;
+		return 1;
+	}
+	return 0;
+}
+
 static int writeit(struct loopback_handle *lhandle)
 {
 	snd_pcm_sframes_t avail;
 	snd_pcm_sframes_t r, res = 0;
+	char *ptr;
 	int err;
 
+	if (lhandle->mix_master) {
+		/* the frames were played by the master handle */
+		res = lhandle->mix_pending;
+		lhandle->mix_pending = 0;
+		stop_check(lhandle, res);
+		return res;
+	}
       __again:
 	avail = snd_pcm_avail_update(lhandle->handle);
 	if (avail == -EPIPE) {
@@ -757,10 +1105,13 @@ static int writeit(struct loopback_handle *lhandle)
 			r = lhandle->buf_size - lhandle->buf_pos;
 		if (r > avail)
 			r = avail;
-		r = snd_pcm_writei(lhandle->handle,
-				   lhandle->buf +
-				   lhandle->buf_pos *
-				   lhandle->frame_size, r);
+		ptr = lhandle->buf + lhandle->buf_pos * lhandle->frame_size;
+		if (lhandle->mix_acc) {
+			if (r > (snd_pcm_sframes_t)lhandle->buffer_size)
+				r = lhandle->buffer_size;
+			ptr = mix_chunk(lhandle, ptr, r);
+		}
+		r = pcm_write(lhandle, ptr, r);
 		if (r <= 0) {
 			if (r == -EPIPE) {
 				if ((err = xrun(lhandle)) < 0)
@@ -772,24 +1123,73 @@ static int writeit(struct loopback_handle *lhandle)
 		}
 #ifdef FILE_PWRITE
 		if (lhandle->loopback->pfile)
-			fwrite(lhandle->buf + lhandle->buf_pos * lhandle->frame_size,
-			       r, lhandle->frame_size, lhandle->loopback->pfile);
+			fwrite(ptr, r, lhandle->frame_size,
+			       lhandle->loopback->pfile);
 #endif
+		if (lhandle->mix_acc)
+			mix_commit(lhandle, r);
 		res += r;
 		lhandle->counter += r;
 		lhandle->buf_count -= r;
 		lhandle->buf_pos += r;
 		lhandle->buf_pos %= lhandle->buf_size;
 		xrun_profile(lhandle->loopback);
-		if (lhandle->loopback->stop_pending) {
-			lhandle->loopback->stop_count += r;
-			if (lhandle->loopback->stop_count * lhandle->pitch >
-			    lhandle->loopback->latency * 3) {
-				lhandle->loopback->stop_pending = 0;
-				lhandle->loopback->reinit = 1;
-				break;
-			}
+		if (stop_check(lhandle, r))
+			break;
+	}
+	return res;
+}
+
+static inline char *area_ptr(const snd_pcm_channel_area_t *areas,
+			     snd_pcm_uframes_t offset)
+{
+	return (char *)areas[0].addr + (areas[0].first + offset * areas[0].step) / 8;
+}
+
+/*
+ * Copy the captured frames straight from the capture mmap area to the
+ * playback one, when nothing waits in the ring. It is one pass through
+ * the memory instead of two. The errors and the frames which do not fit
+ * are left to readit() and writeit().
+ */
+static snd_pcm_sframes_t direct_copy(struct loopback *loop)
+{
+	struct loopback_handle *capt = loop->capt;
+	struct loopback_handle *play = loop->play;
+	const snd_pcm_channel_area_t *careas, *pareas;
+	snd_pcm_uframes_t coffset, poffset, cframes, pframes;
+	snd_pcm_sframes_t cavail, pavail, r, res = 0;
+
+	cavail = snd_pcm_avail_update(capt->handle);
+	pavail = snd_pcm_avail_update(play->handle);
+	while (cavail > 0 && pavail > 0) {
+		cframes = cavail;
+		pframes = pavail;
+		if (snd_pcm_mmap_begin(capt->handle, &careas, &coffset, &cframes) < 0)
+			break;
+		if (snd_pcm_mmap_begin(play->handle, &pareas, &poffset, &pframes) < 0) {
+			snd_pcm_mmap_commit(capt->handle, coffset, 0);
+			break;
 		}
+		if (cframes > pframes)
+			cframes = pframes;
+		memcpy(area_ptr(pareas, poffset), area_ptr(careas, coffset),
+		       cframes * play->frame_size);
+		r = snd_pcm_mmap_commit(play->handle, poffset, cframes);
+		/* the frames not played stay in the capture area */
+		snd_pcm_mmap_commit(capt->handle, coffset, r > 0 ? r : 0);
+		if (r <= 0)
+			break;
+		res += r;
+		if (capt->max < res)
+			capt->max = res;
+		capt->counter += r;
+		play->counter += r;
+		cavail -= r;
+		pavail -= r;
+		xrun_profile(loop);
+		if (stop_check(play, r))
+			break;
 	}
 	return res;
 }
@@ -870,7 +1270,9 @@ static int xrun_sync(struct loopback *loop)
 	if ((err = snd_pcm_delay(play->handle, &pdelay)) < 0) {
 		if (err == -EPIPE) {
 			pdelay = 0;
-			play->xrun_pending = 1;
+			/* the shared playback is recovered by the master */
+			if (!play->mix_master)
+				play->xrun_pending = 1;
 		} else if (err == -ESTRPIPE) {
 			err = suspend(play);
 			if (err < 0)
@@ -886,9 +1288,7 @@ static int xrun_sync(struct loopback *loop)
 	if (play->buf != capt->buf)
 		cdelay += capt->buf_count;
 	pdelay += play->buf_count;
-#ifdef USE_SAMPLERATE
 	pdelay += loop->src_out_frames;
-#endif
 	cdelay1 = cdelay * capt->pitch;
 	pdelay1 = pdelay * play->pitch;
 	delay1 = cdelay1 + pdelay1;
@@ -899,27 +1299,22 @@ static int xrun_sync(struct loopback *loop)
 	if (verbose > 6) {
 		snd_output_printf(loop->output,
 			"sync: cdelay=%li(%li), pdelay=%li(%li), fill=%li (delay=%li)"
-#ifdef USE_SAMPLERATE
-			", src_out=%li"
-#endif
-			"\n",
+			", src_out=%li\n",
 			(long)cdelay, (long)cdelay1, (long)pdelay, (long)pdelay1,
-			(long)fill, (long)delay1
-#ifdef USE_SAMPLERATE
-			, (long)loop->src_out_frames
-#endif
-			);
+			(long)fill, (long)delay1, (long)loop->src_out_frames);
 		snd_output_printf(loop->output,
 			"sync: cbufcount=%li, pbufcount=%li\n",
 			(long)capt->buf_count, (long)play->buf_count);
 	}
 	if (delay1 > fill && capt->counter > 0) {
-		if ((err = snd_pcm_drop(capt->handle)) < 0)
-			return err;
-		if ((err = snd_pcm_prepare(capt->handle)) < 0)
-			return err;
-		if ((err = snd_pcm_start(capt->handle)) < 0)
-			return err;
+		if (!capt->fanout_master) {
+			if ((err = snd_pcm_drop(capt->handle)) < 0)
+				return err;
+			if ((err = snd_pcm_prepare(capt->handle)) < 0)
+				return err;
+			if ((err = snd_pcm_start(capt->handle)) < 0)
+				return err;
+		}
 		diff = remove_samples(loop, 1, (delay1 - fill) / capt->pitch);
 		if (verbose > 6)
 			snd_output_printf(loop->output,
@@ -1023,9 +1418,7 @@ static int xrun_sync(struct loopback *loop)
 			if (play->buf != capt->buf)
 				cdelay += capt->buf_count;
 			pdelay += play->buf_count;
-#ifdef USE_SAMPLERATE
 			pdelay += loop->src_out_frames;
-#endif
 			cdelay1 = cdelay * capt->pitch;
 			pdelay1 = pdelay * play->pitch;
 			delay1 = cdelay1 + pdelay1;
@@ -1080,37 +1473,30 @@ void update_pitch(struct loopback *loop)
 {
 	double pitch = loop->pitch;
 
-#ifdef USE_SAMPLERATE
 	if (loop->sync == SYNC_TYPE_SAMPLERATE) {
-		loop->src_data.src_ratio = (double)1.0 / (pitch *
+		loop->src_ratio = (double)1.0 / (pitch *
 				loop->play->pitch * loop->capt->pitch);
 		if (verbose > 2)
-			snd_output_printf(loop->output, "%s: Samplerate src_ratio update1: %.8f\n", loop->id, loop->src_data.src_ratio);
-	} else
-#endif
-	if (loop->sync == SYNC_TYPE_CAPTRATESHIFT) {
+			snd_output_printf(loop->output, "%s: Samplerate src_ratio update1: %.8f\n", loop->id, loop->src_ratio);
+	} else if (loop->sync == SYNC_TYPE_CAPTRATESHIFT) {
 		set_rate_shift(loop->capt, pitch);
-#ifdef USE_SAMPLERATE
 		if (loop->use_samplerate) {
-			loop->src_data.src_ratio = 
+			loop->src_ratio =
 				(double)1.0 /
 					(loop->play->pitch * loop->capt->pitch);
 			if (verbose > 2)
-				snd_output_printf(loop->output, "%s: Samplerate src_ratio update2: %.8f\n", loop->id, loop->src_data.src_ratio);
+				snd_output_printf(loop->output, "%s: Samplerate src_ratio update2: %.8f\n", loop->id, loop->src_ratio);
 		}
-#endif
 	}
 	else if (loop->sync == SYNC_TYPE_PLAYRATESHIFT) {
 		set_rate_shift(loop->play, pitch);
-#ifdef USE_SAMPLERATE
 		if (loop->use_samplerate) {
-			loop->src_data.src_ratio = 
+			loop->src_ratio =
 				(double)1.0 /
 					(loop->play->pitch * loop->capt->pitch);
 			if (verbose > 2)
-				snd_output_printf(loop->output, "%s: Samplerate src_ratio update3: %.8f\n", loop->id, loop->src_data.src_ratio);
+				snd_output_printf(loop->output, "%s: Samplerate src_ratio update3: %.8f\n", loop->id, loop->src_ratio);
 		}
-#endif
 	}
 	if (verbose)
 		snd_output_printf(loop->output, "New pitch for %s: %.8f (min/max samples = %li/%li)\n", loop->id, pitch, loop->pitch_diff_min, loop->pitch_diff_max);
@@ -1242,7 +1628,17 @@ static int openit(struct loopback_handle *lhandle)
 	int stream = lhandle == lhandle->loopback->play ?
 				SND_PCM_STREAM_PLAYBACK :
 				SND_PCM_STREAM_CAPTURE;
+	struct loopback_handle *master = lhandle->fanout_master ?
+					 lhandle->fanout_master :
+					 lhandle->mix_master;
 	int err, card, device, subdevice;
+
+	if (master) {
+		lhandle->handle = master->handle;
+		lhandle->card_number = master->card_number;
+		lhandle->ctl = NULL;
+		return 0;
+	}
 	pcm_open_lock();
 	err = snd_pcm_open(&lhandle->handle, lhandle->device, stream, SND_PCM_NONBLOCK);
 	pcm_open_unlock();
@@ -1283,8 +1679,17 @@ static int openit(struct loopback_handle *lhandle)
 
 static int freeit(struct loopback_handle *lhandle)
 {
-	free(lhandle->buf);
+	/* the ring is reused by the next start, if it is large enough */
+	if (lhandle->buf) {
+		free(lhandle->buf_cache);
+		lhandle->buf_cache = lhandle->buf;
+		lhandle->buf_cache_bytes = lhandle->buf_bytes;
+	}
 	lhandle->buf = NULL;
+	free(lhandle->mix_acc);
+	lhandle->mix_acc = NULL;
+	free(lhandle->mix_out);
+	lhandle->mix_out = NULL;
 	return 0;
 }
 
@@ -1292,6 +1697,11 @@ static int closeit(struct loopback_handle *lhandle)
 {
 	int err = 0;
 
+	lhandle->setup = 0;
+	if (lhandle->fanout_master || lhandle->mix_master) {
+		lhandle->handle = NULL;
+		return 0;
+	}
 	set_rate_shift(lhandle, 1);
 	if (lhandle->ctl_rate_shift)
 		snd_ctl_elem_value_free(lhandle->ctl_rate_shift);
@@ -1308,18 +1718,52 @@ static int closeit(struct loopback_handle *lhandle)
 	return err;
 }
 
+/* each ring buffer starts at the boundary of cache line */
+#define BUF_ALIGN	64
+
+static char *buf_alloc(snd_pcm_uframes_t frames, unsigned int frame_size)
+{
+	size_t size = frames * frame_size;
+	void *buf;
+
+	size = (size + BUF_ALIGN - 1) & ~(size_t)(BUF_ALIGN - 1);
+	if (posix_memalign(&buf, BUF_ALIGN, size))
+		return NULL;
+	memset(buf, 0, size);
+	return buf;
+}
+
+static char *ring_alloc(struct loopback_handle *lhandle)
+{
+	size_t size = lhandle->buf_size * lhandle->frame_size;
+	char *buf = lhandle->buf_cache;
+
+	lhandle->buf_cache = NULL;
+	if (buf == NULL || lhandle->buf_cache_bytes < size) {
+		free(buf);
+		buf = buf_alloc(lhandle->buf_size, lhandle->frame_size);
+		lhandle->buf_bytes = size;
+	} else {
+		lhandle->buf_bytes = lhandle->buf_cache_bytes;
+	}
+	return buf;
+}
+
 static int init_handle(struct loopback_handle *lhandle, int alloc)
 {
 	snd_pcm_uframes_t lat;
 	lhandle->frame_size = (snd_pcm_format_physical_width(lhandle->format) 
 						/ 8) * lhandle->channels;
-	lhandle->sync_point = lhandle->rate * 15;	/* every 15 seconds */
+	if (lhandle->loopback->controller == CONTROLLER_TYPE_PI)
+		lhandle->sync_point = lhandle->rate * PI_INTERVAL;
+	else
+		lhandle->sync_point = lhandle->rate * 15;	/* every 15 seconds */
 	lat = lhandle->loopback->latency;
 	if (lhandle->buffer_size > lat)
 		lat = lhandle->buffer_size;
 	lhandle->buf_size = lat * 2;
 	if (alloc) {
-		lhandle->buf = calloc(1, lhandle->buf_size * lhandle->frame_size);
+		lhandle->buf = ring_alloc(lhandle);
 		if (lhandle->buf == NULL)
 			return -ENOMEM;
 	}
@@ -1348,12 +1792,12 @@ int pcmjob_init(struct loopback *loop)
 		loop->sync = SYNC_TYPE_CAPTRATESHIFT;
 	if (loop->sync == SYNC_TYPE_AUTO && loop->play->ctl_rate_shift)
 		loop->sync = SYNC_TYPE_PLAYRATESHIFT;
-#ifdef USE_SAMPLERATE
 	if (loop->sync == SYNC_TYPE_AUTO && loop->src_enable)
 		loop->sync = SYNC_TYPE_SAMPLERATE;
-#endif
 	if (loop->sync == SYNC_TYPE_AUTO)
 		loop->sync = SYNC_TYPE_SIMPLE;
+	if (loop->capt->fanout_master || loop->play->mix_master)
+		loop->slave = SLAVE_TYPE_OFF;
 	if (loop->slave == SLAVE_TYPE_AUTO &&
 	    loop->capt->ctl_notify &&
 	    loop->capt->ctl_active &&
@@ -1383,6 +1827,9 @@ int pcmjob_init(struct loopback *loop)
 
 static void freeloop(struct loopback *loop)
 {
+	effect_chain_stop(loop->effects);
+	resampler_close(loop->resampler);
+	loop->resampler = NULL;
 #ifdef USE_SAMPLERATE
 	if (loop->use_samplerate) {
 		if (loop->src_state)
@@ -1394,8 +1841,9 @@ static void freeloop(struct loopback *loop)
 		loop->src_data.data_out = NULL;
 	}
 #endif
+	/* the shared ring is cached by the playback handle */
 	if (loop->play->buf == loop->capt->buf)
-		loop->play->buf = NULL;
+		loop->capt->buf = NULL;
 	freeit(loop->play);
 	freeit(loop->capt);
 }
@@ -1406,6 +1854,12 @@ int pcmjob_done(struct loopback *loop)
 	closeit(loop->play);
 	closeit(loop->capt);
 	freeloop(loop);
+	free(loop->play->buf_cache);
+	loop->play->buf_cache = NULL;
+	free(loop->capt->buf_cache);
+	loop->capt->buf_cache = NULL;
+	effect_chain_free(loop->effects);
+	loop->effects = NULL;
 	free(loop->id);
 	loop->id = NULL;
 #ifdef FILE_PWRITE
@@ -1453,13 +1907,41 @@ int pcmjob_start(struct loopback *loop)
 	snd_pcm_uframes_t count;
 	int err;
 
+	if (loop->capt->fanout_master) {
+		/* the ring gets frames in the format of the master */
+		struct loopback_handle *master = loop->capt->fanout_master;
+		if (!master->loopback->running) {
+			logit(LOG_CRIT, "%s: shared capture %s is not running\n", loop->id, master->id);
+			err = -EIO;
+			goto __error;
+		}
+		loop->play->format = loop->capt->format = master->format;
+		loop->play->channels = loop->capt->channels = master->channels;
+		loop->capt->rate_req = master->rate_req;
+	}
+	if (loop->play->mix_master) {
+		/* the ring is summed in the format of the master */
+		struct loopback_handle *master = loop->play->mix_master;
+		if (!master->loopback->running) {
+			logit(LOG_CRIT, "%s: shared playback %s is not running\n", loop->id, master->id);
+			err = -EIO;
+			goto __error;
+		}
+		loop->play->format = loop->capt->format = master->format;
+		loop->play->channels = loop->capt->channels = master->channels;
+		loop->play->rate_req = master->rate_req;
+	}
 	loop->pollfd_count = loop->play->ctl_pollfd_count +
 			     loop->capt->ctl_pollfd_count;
-	if ((err = snd_pcm_poll_descriptors_count(loop->play->handle)) < 0)
+	if (loop->play->mix_master)
+		err = 0;	/* woken up by the capture only */
+	else if ((err = snd_pcm_poll_descriptors_count(loop->play->handle)) < 0)
 		goto __error;
 	loop->play->pollfd_count = err;
 	loop->pollfd_count += err;
-	if ((err = snd_pcm_poll_descriptors_count(loop->capt->handle)) < 0)
+	if (loop->capt->fanout_master)
+		err = 0;	/* woken up by the playback only */
+	else if ((err = snd_pcm_poll_descriptors_count(loop->capt->handle)) < 0)
 		goto __error;
 	loop->capt->pollfd_count = err;
 	loop->pollfd_count += err;
@@ -1503,30 +1985,19 @@ __again:
 	    loop->sync != SYNC_TYPE_SAMPLERATE) {
 		if (verbose > 1)
 			snd_output_printf(loop->output, "shared buffer!!!\n");
-		if ((err = init_handle(loop->play, 1)) < 0)
+		if ((err = init_handle(loop->play, 0)) < 0)
 			goto __error;
 		if ((err = init_handle(loop->capt, 0)) < 0)
 			goto __error;
-		if (loop->play->buf_size < loop->capt->buf_size) {
-			char *nbuf = realloc(loop->play->buf,
-					     loop->capt->buf_size *
-					       loop->capt->frame_size);
-			if (nbuf == NULL) {
-				err = -ENOMEM;
-				goto __error;
-			}
-			loop->play->buf = nbuf;
+		/* the larger one is shared */
+		if (loop->play->buf_size < loop->capt->buf_size)
 			loop->play->buf_size = loop->capt->buf_size;
-		} else if (loop->capt->buf_size < loop->play->buf_size) {
-			char *nbuf = realloc(loop->capt->buf,
-					     loop->play->buf_size *
-					       loop->play->frame_size);
-			if (nbuf == NULL) {
-				err = -ENOMEM;
-				goto __error;
-			}
-			loop->capt->buf = nbuf;
+		else
 			loop->capt->buf_size = loop->play->buf_size;
+		loop->play->buf = ring_alloc(loop->play);
+		if (loop->play->buf == NULL) {
+			err = -ENOMEM;
+			goto __error;
 		}
 		loop->capt->buf = loop->play->buf;
 	} else {
@@ -1548,7 +2019,30 @@ __again:
                         }
                 }
 	}
-#ifdef USE_SAMPLERATE
+	if (loop->play->mix_count > 0) {
+		struct loopback_handle *play = loop->play;
+		if (play->format != SND_PCM_FORMAT_S16 &&
+		    play->format != SND_PCM_FORMAT_S32) {
+			logit(LOG_CRIT, "playback mixing supports only %s or %s formats (play=%s)\n", snd_pcm_format_name(SND_PCM_FORMAT_S16), snd_pcm_format_name(SND_PCM_FORMAT_S32), snd_pcm_format_name(play->format));
+			err = -EIO;
+			goto __error;
+		}
+		play->mix_acc = malloc(play->buffer_size * play->channels *
+				       sizeof(*play->mix_acc));
+		play->mix_out = buf_alloc(play->buffer_size, play->frame_size);
+		if (play->mix_acc == NULL || play->mix_out == NULL) {
+			err = -ENOMEM;
+			goto __error;
+		}
+	}
+	err = effect_chain_start(loop->effects, loop->play->format,
+				 loop->play->channels, loop->play->rate);
+	if (err == -EINVAL) {
+		logit(LOG_CRIT, "effects support only %s or %s formats (play=%s)\n", snd_pcm_format_name(SND_PCM_FORMAT_S16), snd_pcm_format_name(SND_PCM_FORMAT_S32), snd_pcm_format_name(loop->play->format));
+		err = -EIO;
+	}
+	if (err < 0)
+		goto __error;
 	if (loop->sync == SYNC_TYPE_SAMPLERATE)
 		loop->use_samplerate = 1;
 	if (loop->use_samplerate && !loop->src_enable) {
@@ -1567,38 +2061,45 @@ __again:
 			err = -EIO;
 			goto __error;		
 		}
-		loop->src_state = src_new(loop->src_converter_type,
-					  loop->play->channels, &err);
-		loop->src_data.data_in = calloc(1, sizeof(float)*loop->capt->channels*loop->capt->buf_size);
-		if (loop->src_data.data_in == NULL) {
-			err = -ENOMEM;
-			goto __error;
-		}
-		loop->src_data.data_out =  calloc(1, sizeof(float)*loop->play->channels*loop->play->buf_size);
-		if (loop->src_data.data_out == NULL) {
-			err = -ENOMEM;
-			goto __error;
-		}
-		loop->src_data.src_ratio = (double)loop->play->rate /
-					   (double)loop->capt->rate;
-		loop->src_data.end_of_input = 0;
+		loop->src_ratio = (double)loop->play->rate /
+				  (double)loop->capt->rate;
 		loop->src_out_frames = 0;
-	} else {
-		loop->src_state = NULL;
-	}
+		if (loop->src_converter_type >= RESAMPLE_POLY_FAST) {
+			err = resampler_open(&loop->resampler,
+					     loop->src_converter_type,
+					     loop->capt->format,
+					     loop->capt->channels,
+					     loop->capt->rate,
+					     loop->play->rate,
+					     loop->capt->buf_size);
+			if (err < 0)
+				goto __error;
+		} else {
+#ifdef USE_SAMPLERATE
+			loop->src_state = src_new(loop->src_converter_type,
+						  loop->play->channels, &err);
+			loop->src_data.data_in = calloc(1, sizeof(float)*loop->capt->channels*loop->capt->buf_size);
+			if (loop->src_data.data_in == NULL) {
+				err = -ENOMEM;
+				goto __error;
+			}
+			loop->src_data.data_out =  calloc(1, sizeof(float)*loop->play->channels*loop->play->buf_size);
+			if (loop->src_data.data_out == NULL) {
+				err = -ENOMEM;
+				goto __error;
+			}
+			loop->src_data.end_of_input = 0;
 #else
-	if (loop->sync == SYNC_TYPE_SAMPLERATE || loop->use_samplerate) {
-		logit(LOG_CRIT, "alsaloop is compiled without libsamplerate support\n");
-		err = -EIO;
-		goto __error;
-	}
+			logit(LOG_CRIT, "alsaloop is compiled without libsamplerate support\n");
+			err = -EIO;
+			goto __error;
 #endif
+		}
+	}
 	if (verbose) {
 		snd_output_printf(loop->output, "%s sync type: %s", loop->id, sync_types[loop->sync]);
-#ifdef USE_SAMPLERATE
 		if (loop->sync == SYNC_TYPE_SAMPLERATE)
 			snd_output_printf(loop->output, " (%s)", src_types[loop->src_converter_type]);
-#endif
 		snd_output_printf(loop->output, "\n");
 	}
 	lhandle_start(loop->play);
@@ -1614,6 +2115,8 @@ __again:
 	loop->pitch = 1.0;
 	update_pitch(loop);
 	loop->pitch_delta = 1.0 / ((double)loop->capt->rate * 4);
+	loop->pi_error = loop->pi_integral = loop->pi_output = 0;
+	loop->pi_updates = 0;
 	loop->total_queued_count = 0;
 	loop->pitch_diff = 0;
 	count = get_whole_latency(loop) / loop->play->pitch;
@@ -1630,6 +2133,15 @@ __again:
 		err = -EIO;
 		goto __error;
 	}
+	/* the ring is bypassed only when it is shared by plain streams */
+	loop->direct = loop->play->access == SND_PCM_ACCESS_MMAP_INTERLEAVED &&
+		       loop->capt->access == SND_PCM_ACCESS_MMAP_INTERLEAVED &&
+		       loop->play->buf == loop->capt->buf &&
+		       !loop->capt->fanout_master && !loop->capt->fanout_count &&
+		       !loop->play->mix_master && !loop->play->mix_count &&
+		       !loop->effects;
+	if (verbose > 1 && loop->direct)
+		snd_output_printf(loop->output, "%s: direct mmap copy\n", loop->id);
 	loop->running = 1;
 	loop->stop_pending = 0;
 	if (loop->xrun) {
@@ -1638,16 +2150,19 @@ __again:
 		loop->xrun_last_cdelay = XRUN_PROFILE_UNKNOWN;
 		loop->xrun_max_proctime = 0;
 	}
-	if ((err = snd_pcm_start(loop->capt->handle)) < 0) {
+	if (!loop->capt->fanout_master &&
+	    (err = snd_pcm_start(loop->capt->handle)) < 0) {
 		logit(LOG_CRIT, "pcm start %s error: %s\n", loop->capt->id, snd_strerror(err));
 		goto __error;
 	}
-	if (!loop->linked) {
+	if (!loop->linked && !loop->play->mix_master) {
 		if ((err = snd_pcm_start(loop->play->handle)) < 0) {
 			logit(LOG_CRIT, "pcm start %s error: %s\n", loop->play->id, snd_strerror(err));
 			goto __error;
 		}
 	}
+	if (loop->stats)
+		stats_update(loop, 1);
 	return 0;
       __error:
 	pcmjob_stop(loop);
@@ -1659,16 +2174,32 @@ int pcmjob_stop(struct loopback *loop)
 	int err;
 
 	if (loop->running) {
-		if ((err = snd_pcm_drop(loop->capt->handle)) < 0)
+		/* the shared PCMs are stopped by the master jobs */
+		if (!loop->capt->fanout_master &&
+		    (err = snd_pcm_drop(loop->capt->handle)) < 0)
 			logit(LOG_WARNING, "pcm drop %s error: %s\n", loop->capt->id, snd_strerror(err));
-		if ((err = snd_pcm_drop(loop->play->handle)) < 0)
+		if (!loop->play->mix_master &&
+		    (err = snd_pcm_drop(loop->play->handle)) < 0)
 			logit(LOG_WARNING, "pcm drop %s error: %s\n", loop->play->id, snd_strerror(err));
-		if ((err = snd_pcm_hw_free(loop->capt->handle)) < 0)
-			logit(LOG_WARNING, "pcm hw_free %s error: %s\n", loop->capt->id, snd_strerror(err));
-		if ((err = snd_pcm_hw_free(loop->play->handle)) < 0)
-			logit(LOG_WARNING, "pcm hw_free %s error: %s\n", loop->play->id, snd_strerror(err));
+		/*
+		 * The parameters are kept for the next start, only the
+		 * loopback driver needs them freed, so the other side of
+		 * the cable can change them.
+		 */
+		if (!loop->capt->fanout_master && loop->capt->ctl_notify) {
+			loop->capt->setup = 0;
+			if ((err = snd_pcm_hw_free(loop->capt->handle)) < 0)
+				logit(LOG_WARNING, "pcm hw_free %s error: %s\n", loop->capt->id, snd_strerror(err));
+		}
+		if (!loop->play->mix_master && loop->play->ctl_notify) {
+			loop->play->setup = 0;
+			if ((err = snd_pcm_hw_free(loop->play->handle)) < 0)
+				logit(LOG_WARNING, "pcm hw_free %s error: %s\n", loop->play->id, snd_strerror(err));
+		}
 		loop->running = 0;
 	}
+	if (loop->stats)
+		stats_update(loop, 1);
 	freeloop(loop);
 	return 0;
 }
@@ -1678,14 +2209,18 @@ int pcmjob_pollfds_init(struct loopback *loop, struct pollfd *fds)
 	int err, idx = 0;
 
 	if (loop->running) {
-		err = snd_pcm_poll_descriptors(loop->play->handle, fds + idx, loop->play->pollfd_count);
-		if (err < 0)
-			return err;
-		idx += loop->play->pollfd_count;
-		err = snd_pcm_poll_descriptors(loop->capt->handle, fds + idx, loop->capt->pollfd_count);
-		if (err < 0)
-			return err;
-		idx += loop->capt->pollfd_count;
+		if (loop->play->pollfd_count > 0) {
+			err = snd_pcm_poll_descriptors(loop->play->handle, fds + idx, loop->play->pollfd_count);
+			if (err < 0)
+				return err;
+			idx += loop->play->pollfd_count;
+		}
+		if (loop->capt->pollfd_count > 0) {
+			err = snd_pcm_poll_descriptors(loop->capt->handle, fds + idx, loop->capt->pollfd_count);
+			if (err < 0)
+				return err;
+			idx += loop->capt->pollfd_count;
+		}
 	}
 	if (loop->play->ctl_pollfd_count > 0 &&
 	    (loop->slave == SLAVE_TYPE_ON || loop->controls)) {
@@ -1713,9 +2248,7 @@ static snd_pcm_sframes_t get_queued_playback_samples(struct loopback *loop)
 		return 0;
 	loop->play->last_delay = delay;
 	delay += loop->play->buf_count;
-#ifdef USE_SAMPLERATE
 	delay += loop->src_out_frames;
-#endif
 	return delay;
 }
 
@@ -1731,6 +2264,72 @@ static snd_pcm_sframes_t get_queued_capture_samples(struct loopback *loop)
 	return delay;
 }
 
+/*
+ * Queued frames on both sides at the same moment: the delay of each
+ * handle is moved from its own timestamp to the later one, so the order
+ * and the jitter of the two status calls do not add to the error.
+ */
+static int get_queued_aligned(struct loopback *loop,
+			      snd_pcm_sframes_t *pqueued,
+			      snd_pcm_sframes_t *cqueued)
+{
+	snd_pcm_status_t *pstatus, *cstatus;
+	snd_htimestamp_t pts, cts;
+	double pdelay, cdelay, diff;
+	int err;
+
+	snd_pcm_status_alloca(&pstatus);
+	snd_pcm_status_alloca(&cstatus);
+	if ((err = snd_pcm_status(loop->play->handle, pstatus)) < 0)
+		return err;
+	if ((err = snd_pcm_status(loop->capt->handle, cstatus)) < 0)
+		return err;
+	if (snd_pcm_status_get_state(pstatus) != SND_PCM_STATE_RUNNING ||
+	    snd_pcm_status_get_state(cstatus) != SND_PCM_STATE_RUNNING)
+		return -EAGAIN;
+	snd_pcm_status_get_htstamp(pstatus, &pts);
+	snd_pcm_status_get_htstamp(cstatus, &cts);
+	if ((pts.tv_sec == 0 && pts.tv_nsec == 0) ||
+	    (cts.tv_sec == 0 && cts.tv_nsec == 0))
+		return -EINVAL;
+	pdelay = snd_pcm_status_get_delay(pstatus);
+	cdelay = snd_pcm_status_get_delay(cstatus);
+	/* seconds from the capture to the playback timestamp */
+	diff = (double)(pts.tv_sec - cts.tv_sec) +
+	       (double)(pts.tv_nsec - cts.tv_nsec) / 1000000000.0;
+	if (diff > 0)
+		cdelay += diff * loop->capt->rate;
+	else
+		pdelay += diff * loop->play->rate;
+	loop->play->last_delay = pdelay;
+	loop->capt->last_delay = cdelay;
+	*pqueued = pdelay + loop->play->buf_count + loop->src_out_frames;
+	*cqueued = cdelay + loop->capt->buf_count;
+	return 0;
+}
+
+static void pi_update(struct loopback *loop, double error)
+{
+	double output, pitch, rate = loop->capt->rate;
+
+	loop->pi_error = error;
+	output = PI_KP * error + PI_KI * (loop->pi_integral + error * PI_INTERVAL);
+	pitch = 1.0 + output / rate;
+	/* no integration while saturated (anti-windup) */
+	if (pitch > 1.0 + PI_PITCH_LIMIT) {
+		pitch = 1.0 + PI_PITCH_LIMIT;
+	} else if (pitch < 1.0 - PI_PITCH_LIMIT) {
+		pitch = 1.0 - PI_PITCH_LIMIT;
+	} else {
+		loop->pi_integral += error * PI_INTERVAL;
+	}
+	loop->pi_output = output;
+	loop->pi_updates++;
+	loop->pitch = pitch;
+	if (verbose > 3)
+		snd_output_printf(loop->output, "%s: pi error %.3f integral %.3f pitch %.8f\n", loop->id, error, loop->pi_integral, pitch);
+}
+
 static int ctl_event_check(snd_ctl_elem_value_t *val, snd_ctl_event_t *ev)
 {
 	snd_ctl_elem_id_t *id1, *id2;
@@ -1783,6 +2382,7 @@ static int handle_ctl_events(struct loopback_handle *lhandle,
 	      __ctl_check:
 		control_event(lhandle, ev);
 	}
+	control_flush(loop);
 	err = get_active(lhandle);
 	if (verbose > 7)
 		snd_output_printf(loop->output, "%s: ctl event active %i\n", lhandle->id, err);
@@ -1810,12 +2410,12 @@ int pcmjob_pollfds_handle(struct loopback *loop, struct pollfd *fds)
 	struct loopback_handle *play = loop->play;
 	struct loopback_handle *capt = loop->capt;
 	unsigned short prevents, crevents, events;
-	snd_pcm_uframes_t ccount, pcount;
+	snd_pcm_uframes_t ccount, pcount, dcount;
 	int err, loopcount = 0, idx;
 
 	if (verbose > 11)
 		snd_output_printf(loop->output, "%s: pollfds handle\n", loop->id);
-	if (verbose > 13 || loop->xrun)
+	if (verbose > 13 || loop->xrun || loop->stats)
 		getcurtimestamp(&loop->tstamp_start);
 	if (verbose > 12) {
 		snd_pcm_sframes_t pdelay, cdelay;
@@ -1830,18 +2430,23 @@ int pcmjob_pollfds_handle(struct loopback *loop, struct pollfd *fds)
 	}
 	idx = 0;
 	if (loop->running) {
-		err = snd_pcm_poll_descriptors_revents(play->handle, fds,
-						       play->pollfd_count,
-						       &prevents);
-		if (err < 0)
-			return err;
-		idx += play->pollfd_count;
-		err = snd_pcm_poll_descriptors_revents(capt->handle, fds + idx,
-						       capt->pollfd_count,
-						       &crevents);
-		if (err < 0)
-			return err;
-		idx += capt->pollfd_count;
+		prevents = crevents = 0;
+		if (play->pollfd_count > 0) {
+			err = snd_pcm_poll_descriptors_revents(play->handle, fds,
+							       play->pollfd_count,
+							       &prevents);
+			if (err < 0)
+				return err;
+			idx += play->pollfd_count;
+		}
+		if (capt->pollfd_count > 0) {
+			err = snd_pcm_poll_descriptors_revents(capt->handle, fds + idx,
+							       capt->pollfd_count,
+							       &crevents);
+			if (err < 0)
+				return err;
+			idx += capt->pollfd_count;
+		}
 		if (loop->xrun) {
 			if (prevents || crevents) {
 				loop->xrun_last_wake = loop->xrun_last_wake0;
@@ -1890,9 +2495,15 @@ int pcmjob_pollfds_handle(struct loopback *loop, struct pollfd *fds)
 	if (!loop->running)
 		goto __pcm_end;
 	do {
+		dcount = 0;
+		if (loop->direct && play->buf_count == 0 && capt->buf_count == 0)
+			dcount = direct_copy(loop);
+		if (loop->reinit)
+			break;
 		ccount = readit(capt);
+		PROBE2(alsaloop, readit, ccount, capt->buf_pos);
 		if (prevents != 0 && crevents == 0 &&
-		    ccount == 0 && loopcount == 0) {
+		    ccount == 0 && dcount == 0 && loopcount == 0) {
 			if (play->stall > 20) {
 				play->stall = 0;
 				increase_playback_avail_min(play);
@@ -1901,7 +2512,7 @@ int pcmjob_pollfds_handle(struct loopback *loop, struct pollfd *fds)
 			play->stall++;
 			break;
 		}
-		if (ccount > 0)
+		if (ccount > 0 || dcount > 0)
 			play->stall = 0;
 		buf_add(loop, ccount);
 		if (capt->xrun_pending || loop->reinit)
@@ -1909,14 +2520,17 @@ int pcmjob_pollfds_handle(struct loopback *loop, struct pollfd *fds)
 		/* we read new samples, if we have a room in the playback
 		   buffer, feed them there */
 		pcount = writeit(play);
+		PROBE2(alsaloop, writeit, pcount, play->buf_pos);
 		buf_remove(loop, pcount);
 		if (pcount > 0)
 			play->stall = 0;
 		if (play->xrun_pending || loop->reinit)
 			break;
 		loopcount++;
-	} while ((ccount > 0 || pcount > 0) && loopcount > 10);
+	} while ((ccount > 0 || pcount > 0 || dcount > 0) && loopcount > 10);
 	if (play->xrun_pending || capt->xrun_pending) {
+		PROBE2(alsaloop, xrun_sync, play->xrun_pending,
+		       capt->xrun_pending);
 		if ((err = xrun_sync(loop)) < 0)
 			return err;
 	}
@@ -1938,7 +2552,11 @@ int pcmjob_pollfds_handle(struct loopback *loop, struct pollfd *fds)
 		/* FIXME: this algorithm may be slightly better */
 		if (verbose > 3)
 			snd_output_printf(loop->output, "%s: sync diff %li old diff %li\n", loop->id, diff, loop->pitch_diff);
-		if (diff > 0) {
+		if (loop->controller == CONTROLLER_TYPE_PI) {
+			pi_update(loop, ((double)play->total_queued * play->pitch +
+					 (double)capt->total_queued * capt->pitch) /
+					(double)loop->total_queued_count - lat);
+		} else if (diff > 0) {
 			if (diff == loop->pitch_diff)
 				loop->pitch += loop->pitch_delta;
 			else if (diff > loop->pitch_diff)
@@ -1965,7 +2583,10 @@ int pcmjob_pollfds_handle(struct loopback *loop, struct pollfd *fds)
 		snd_pcm_sframes_t pqueued, cqueued;
 
 		/* Reduce cumulative error by interleaving playback vs capture reading order */
-		if (loop->total_queued_count & 1) {
+		if (loop->controller == CONTROLLER_TYPE_PI &&
+		    get_queued_aligned(loop, &pqueued, &cqueued) >= 0) {
+			/* both sides sampled at the same time */
+		} else if (loop->total_queued_count & 1) {
 			pqueued = get_queued_playback_samples(loop);
 			cqueued = get_queued_capture_samples(loop);
 		} else {
@@ -1975,6 +2596,8 @@ int pcmjob_pollfds_handle(struct loopback *loop, struct pollfd *fds)
 
 		if (verbose > 4)
 			snd_output_printf(loop->output, "%s: queued %li/%li samples\n", loop->id, pqueued, cqueued);
+		loop->play_queued = pqueued;
+		loop->capt_queued = cqueued;
 		if (pqueued > 0)
 			play->total_queued += pqueued;
 		if (cqueued > 0)
@@ -1994,7 +2617,7 @@ int pcmjob_pollfds_handle(struct loopback *loop, struct pollfd *fds)
 			snd_output_printf(loop->output, "%s: end delay %li / %li / %li\n", capt->id, cdelay, capt->buf_size, capt->buf_count);
 	}
       __pcm_end:
-	if (verbose > 13 || loop->xrun) {
+	if (verbose > 13 || loop->xrun || loop->stats) {
 		long diff;
 		getcurtimestamp(&loop->tstamp_end);
 		diff = timediff(loop->tstamp_end, loop->tstamp_start);
@@ -2002,7 +2625,11 @@ int pcmjob_pollfds_handle(struct loopback *loop, struct pollfd *fds)
 			snd_output_printf(loop->output, "%s: processing time %lius\n", loop->id, diff);
 		if (loop->xrun && loop->xrun_max_proctime < diff)
 			loop->xrun_max_proctime = diff;
+		if (loop->stats_max_proctime < diff)
+			loop->stats_max_proctime = diff;
 	}
+	if (loop->stats)
+		stats_update(loop, 0);
 	return 0;
 }
 
@@ -2039,6 +2666,8 @@ void pcmjob_state(struct loopback *loop)
 		goto __skip;
 	OUT("  pollfd_count = %i\n", loop->pollfd_count);
 	OUT("  pitch = %.8f, delta = %.8f, diff = %li, min = %li, max = %li\n", loop->pitch, loop->pitch_delta, loop->pitch_diff, loop->pitch_diff_min, loop->pitch_diff_max);
+	if (loop->controller == CONTROLLER_TYPE_PI)
+		OUT("  controller = pi, error = %.3f, integral = %.3f, output = %.6f, updates = %lu\n", loop->pi_error, loop->pi_integral, loop->pi_output, loop->pi_updates);
 	OUT("  use_samplerate = %i\n", loop->use_samplerate);
       __skip:
 	show_handle(loop->play, "playback");
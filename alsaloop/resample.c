@@ -0,0 +1,306 @@
+/*
+ *  A simple PCM loopback utility - polyphase resampler
+ *  Copyright (c) 2026 by agent <agent@local>
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <stdint.h>
+#include <alsa/asoundlib.h>
+#include <math.h>
+#include <syslog.h>
+#include <pthread.h>
+#include "alsaloop.h"
+
+/*
+ * The filter is a windowed sinc split to phases. The coefficient table
+ * depends only on the quality and the nominal rates, so it is computed
+ * once and shared by all loopbacks with the same parameters. The ratio
+ * may drift around the nominal one (samplerate sync), the nearest phase
+ * is used for each output frame, so the cost per frame is constant.
+ */
+
+struct resample_table {
+	struct resample_table *next;
+	int refs;
+	int quality;
+	unsigned int rate_in;
+	unsigned int rate_out;
+	unsigned int taps;
+	unsigned int phases;
+	float *coef;			/* phases rows of taps */
+};
+
+struct resampler {
+	struct resample_table *table;
+	snd_pcm_format_t format;
+	unsigned int channels;
+	float *hist;			/* input frames, one plane per channel */
+	snd_pcm_uframes_t hist_frames;	/* filled frames in each plane */
+	snd_pcm_uframes_t hist_size;	/* size of each plane */
+	uint64_t pos;			/* next output position (32.32) */
+};
+
+static const struct {
+	unsigned int taps;
+	unsigned int phases;
+	double cutoff;			/* relative to the lower nyquist */
+} qualities[] = {
+	[RESAMPLE_POLY_FAST - RESAMPLE_POLY_FAST]	= {  8,  128, 0.85 },
+	[RESAMPLE_POLY_MEDIUM - RESAMPLE_POLY_FAST]	= { 16,  256, 0.90 },
+	[RESAMPLE_POLY_BEST - RESAMPLE_POLY_FAST]	= { 32, 1024, 0.95 },
+};
+
+static pthread_mutex_t tables_mutex = PTHREAD_MUTEX_INITIALIZER;
+static struct resample_table *tables;
+
+static void table_compute(struct resample_table *table, double cutoff)
+{
+	double fc, half = table->taps / 2;
+	unsigned int p, k;
+
+	fc = cutoff;
+	if (table->rate_out < table->rate_in)
+		fc *= (double)table->rate_out / table->rate_in;
+	for (p = 0; p < table->phases; p++) {
+		float *h = table->coef + p * table->taps;
+		double sum = 0, t, x, w;
+
+		for (k = 0; k < table->taps; k++) {
+			/* distance from the output position */
+			t = (double)k - (half - 1) - (double)p / table->phases;
+			x = M_PI * fc * t;
+			w = 0.42 + 0.5 * cos(M_PI * t / half) +
+			    0.08 * cos(2 * M_PI * t / half);
+			if (t <= -half || t >= half)
+				w = 0;
+			h[k] = fabs(x) < 1e-9 ? w : w * sin(x) / x;
+			sum += h[k];
+		}
+		/* unity gain for DC */
+		for (k = 0; k < table->taps; k++)
+			h[k] /= sum;
+	}
+}
+
+static struct resample_table *table_get(int quality, unsigned int rate_in,
+					unsigned int rate_out)
+{
+	struct resample_table *table;
+
+	pthread_mutex_lock(&tables_mutex);
+	for (table = tables; table; table = table->next) {
+		if (table->quality == quality &&
+		    table->rate_in == rate_in &&
+		    table->rate_out == rate_out) {
+			table->refs++;
+			goto __end;
+		}
+	}
+	table = calloc(1, sizeof(*table));
+	if (table == NULL)
+		goto __end;
+	table->quality = quality;
+	table->rate_in = rate_in;
+	table->rate_out = rate_out;
+	table->taps = qualities[quality - RESAMPLE_POLY_FAST].taps;
+	table->phases = qualities[quality - RESAMPLE_POLY_FAST].phases;
+	table->coef = malloc(table->phases * table->taps * sizeof(float));
+	if (table->coef == NULL) {
+		free(table);
+		table = NULL;
+		goto __end;
+	}
+	table_compute(table, qualities[quality - RESAMPLE_POLY_FAST].cutoff);
+	table->refs = 1;
+	table->next = tables;
+	tables = table;
+      __end:
+	pthread_mutex_unlock(&tables_mutex);
+	return table;
+}
+
+static void table_put(struct resample_table *table)
+{
+	struct resample_table **prev;
+
+	pthread_mutex_lock(&tables_mutex);
+	if (--table->refs == 0) {
+		for (prev = &tables; *prev; prev = &(*prev)->next) {
+			if (*prev == table) {
+				*prev = table->next;
+				break;
+			}
+		}
+		free(table->coef);
+		free(table);
+	}
+	pthread_mutex_unlock(&tables_mutex);
+}
+
+int resampler_open(struct resampler **_r, int quality,
+		   snd_pcm_format_t format, unsigned int channels,
+		   unsigned int rate_in, unsigned int rate_out,
+		   snd_pcm_uframes_t max_frames)
+{
+	struct resampler *r;
+
+	if (quality < RESAMPLE_POLY_FAST || quality > RESAMPLE_POLY_BEST)
+		return -EINVAL;
+	if (format != SND_PCM_FORMAT_S16 && format != SND_PCM_FORMAT_S32)
+		return -EINVAL;
+	r = calloc(1, sizeof(*r));
+	if (r == NULL)
+		return -ENOMEM;
+	r->table = table_get(quality, rate_in, rate_out);
+	if (r->table == NULL) {
+		free(r);
+		return -ENOMEM;
+	}
+	r->format = format;
+	r->channels = channels;
+	r->hist_size = max_frames + r->table->taps;
+	r->hist = calloc(r->hist_size * channels, sizeof(float));
+	if (r->hist == NULL) {
+		resampler_close(r);
+		return -ENOMEM;
+	}
+	/* silence before the first frame, the filter is centered on it */
+	r->hist_frames = r->table->taps / 2 - 1;
+	*_r = r;
+	return 0;
+}
+
+void resampler_close(struct resampler *r)
+{
+	if (r == NULL)
+		return;
+	if (r->table)
+		table_put(r->table);
+	free(r->hist);
+	free(r);
+}
+
+/* drop the input frames which are not needed anymore */
+static void resampler_compact(struct resampler *r)
+{
+	snd_pcm_uframes_t idx = r->pos >> 32;
+	unsigned int c;
+
+	if (idx == 0)
+		return;
+	if (idx > r->hist_frames)
+		idx = r->hist_frames;
+	for (c = 0; c < r->channels; c++) {
+		float *plane = r->hist + c * r->hist_size;
+		memmove(plane, plane + idx,
+			(r->hist_frames - idx) * sizeof(float));
+	}
+	r->hist_frames -= idx;
+	r->pos -= (uint64_t)idx << 32;
+}
+
+snd_pcm_uframes_t resampler_write(struct resampler *r, const void *buf,
+				  snd_pcm_uframes_t frames)
+{
+	snd_pcm_uframes_t i;
+	unsigned int c;
+
+	if (frames > r->hist_size - r->hist_frames)
+		resampler_compact(r);
+	if (frames > r->hist_size - r->hist_frames)
+		frames = r->hist_size - r->hist_frames;
+	for (c = 0; c < r->channels; c++) {
+		float *dst = r->hist + c * r->hist_size + r->hist_frames;
+		if (r->format == SND_PCM_FORMAT_S16) {
+			const int16_t *src = (const int16_t *)buf + c;
+			for (i = 0; i < frames; i++)
+				dst[i] = src[i * r->channels];
+		} else {
+			const int32_t *src = (const int32_t *)buf + c;
+			for (i = 0; i < frames; i++)
+				dst[i] = src[i * r->channels];
+		}
+	}
+	r->hist_frames += frames;
+	return frames;
+}
+
+static inline float fir(const float *h, const float *x, unsigned int taps)
+{
+	float acc = 0;
+	unsigned int k;
+
+	/* a plain loop, the compiler vectorizes it */
+	for (k = 0; k < taps; k++)
+		acc += h[k] * x[k];
+	return acc;
+}
+
+snd_pcm_uframes_t resampler_read(struct resampler *r, double ratio,
+				 void *buf, snd_pcm_uframes_t frames)
+{
+	struct resample_table *table = r->table;
+	uint64_t step = (uint64_t)(4294967296.0 / ratio);
+	snd_pcm_uframes_t n, idx;
+	unsigned int c, phase;
+	const float *h;
+	float v;
+
+	for (n = 0; n < frames; n++) {
+		idx = r->pos >> 32;
+		if (idx + table->taps > r->hist_frames)
+			break;
+		phase = ((r->pos & 0xffffffff) * table->phases) >> 32;
+		h = table->coef + phase * table->taps;
+		for (c = 0; c < r->channels; c++) {
+			v = fir(h, r->hist + c * r->hist_size + idx,
+				table->taps);
+			if (r->format == SND_PCM_FORMAT_S16) {
+				int16_t *dst = (int16_t *)buf +
+					       n * r->channels + c;
+				if (v >= 32767.0f)
+					*dst = 32767;
+				else if (v <= -32768.0f)
+					*dst = -32768;
+				else
+					*dst = lrintf(v);
+			} else {
+				int32_t *dst = (int32_t *)buf +
+					       n * r->channels + c;
+				if (v >= 2147483648.0f)
+					*dst = INT32_MAX;
+				else if (v <= -2147483648.0f)
+					*dst = INT32_MIN;
+				else
+					*dst = lrintf(v);
+			}
+		}
+		r->pos += step;
+	}
+	return n;
+}
+
+snd_pcm_uframes_t resampler_pending(struct resampler *r)
+{
+	snd_pcm_uframes_t idx = (r->pos >> 32) + r->table->taps / 2 - 1;
+
+	return idx < r->hist_frames ? r->hist_frames - idx : 0;
+}
@@ -0,0 +1,156 @@
+/*
+ *  A simple PCM loopback utility - statistics export
+ *  Copyright (c) 2026 by agent <agent@local>
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/time.h>
+#include <alsa/asoundlib.h>
+#include <syslog.h>
+#include "alsaloop.h"
+
+/*
+ * The statistics are published to a shared file mapping (for example
+ * in /dev/shm), one record per loopback. Each record is written only by
+ * the thread of its loopback using a sequence lock: the sequence is odd
+ * while the record is updated, a reader copies the record and retries
+ * when the sequence was odd or changed meanwhile. The loop threads never
+ * block or make a system call for the export.
+ */
+
+#define STATS_MAGIC	"ALOOPST"
+#define STATS_VERSION	1
+#define STATS_INTERVAL	1000000		/* in us */
+
+struct stats_header {
+	char magic[8];
+	uint32_t version;
+	uint32_t count;			/* records */
+	uint32_t record_size;
+	uint32_t reserved;
+};
+
+struct stats_record {
+	uint32_t seq;
+	uint32_t running;
+	char id[128];
+	uint64_t updated;		/* gettimeofday() in us */
+	uint32_t rate;
+	uint32_t reserved;
+	uint64_t latency;		/* requested latency in frames */
+	int64_t play_queued;		/* frames queued in the playback path */
+	int64_t capt_queued;		/* frames queued in the capture path */
+	double pitch;
+	int64_t pitch_diff;
+	int64_t pitch_diff_min;
+	int64_t pitch_diff_max;
+	uint64_t play_xruns;
+	uint64_t capt_xruns;
+	uint64_t max_proctime;		/* in us, during the last interval */
+};
+
+static void *stats_map;
+static size_t stats_size;
+
+int stats_open(const char *path, struct loopback **loops, int count)
+{
+	struct stats_header *header;
+	struct stats_record *records;
+	int fd, i;
+
+	stats_size = sizeof(*header) + count * sizeof(*records);
+	fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+	if (fd < 0) {
+		logit(LOG_CRIT, "Unable to open statistics file %s: %s\n", path, strerror(errno));
+		return -errno;
+	}
+	if (ftruncate(fd, stats_size) < 0) {
+		logit(LOG_CRIT, "Unable to resize statistics file %s: %s\n", path, strerror(errno));
+		close(fd);
+		return -errno;
+	}
+	stats_map = mmap(NULL, stats_size, PROT_READ | PROT_WRITE,
+			 MAP_SHARED, fd, 0);
+	close(fd);
+	if (stats_map == MAP_FAILED) {
+		stats_map = NULL;
+		logit(LOG_CRIT, "Unable to map statistics file %s: %s\n", path, strerror(errno));
+		return -ENOMEM;
+	}
+	memset(stats_map, 0, stats_size);
+	header = stats_map;
+	records = (struct stats_record *)(header + 1);
+	for (i = 0; i < count; i++)
+		loops[i]->stats = &records[i];
+	header->version = STATS_VERSION;
+	header->count = count;
+	header->record_size = sizeof(*records);
+	/* the magic tells the readers the page is complete */
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+	memcpy(header->magic, STATS_MAGIC, sizeof(header->magic));
+	return 0;
+}
+
+void stats_close(void)
+{
+	if (stats_map)
+		munmap(stats_map, stats_size);
+	stats_map = NULL;
+}
+
+void stats_update(struct loopback *loop, int force)
+{
+	struct stats_record *rec = loop->stats;
+	struct timeval tv;
+	uint64_t now;
+	uint32_t seq;
+
+	gettimeofday(&tv, NULL);
+	now = (uint64_t)tv.tv_sec * 1000000 + tv.tv_usec;
+	if (!force && now - rec->updated < STATS_INTERVAL)
+		return;
+	seq = rec->seq;
+	__atomic_store_n(&rec->seq, seq + 1, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+	rec->running = loop->running;
+	if (loop->id && rec->id[0] == '\0') {
+		strncpy(rec->id, loop->id, sizeof(rec->id) - 1);
+		rec->id[sizeof(rec->id) - 1] = '\0';
+	}
+	rec->updated = now;
+	rec->rate = loop->play->rate_req;
+	rec->latency = loop->latency;
+	rec->play_queued = loop->play_queued;
+	rec->capt_queued = loop->capt_queued;
+	rec->pitch = loop->pitch;
+	rec->pitch_diff = loop->pitch_diff;
+	rec->pitch_diff_min = loop->pitch_diff_min;
+	rec->pitch_diff_max = loop->pitch_diff_max;
+	rec->play_xruns = loop->play->xruns;
+	rec->capt_xruns = loop->capt->xruns;
+	rec->max_proctime = loop->stats_max_proctime;
+	__atomic_store_n(&rec->seq, seq + 2, __ATOMIC_RELEASE);
+	loop->stats_max_proctime = 0;
+}
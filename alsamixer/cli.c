@@ -28,10 +28,12 @@
 #include "mixer_widget.h"
 #include "mainloop.h"
 #include "configparser.h"
+#include "meter.h"
 
 static int use_color = 1;
 static int use_mouse = 1;
 static const char* config_file = CONFIG_DEFAULT;
+static const char *meter_device;
 static struct snd_mixer_selem_regopt selem_regopt = {
 	.ver = 1,
 	.abstract = SND_MIXER_SABSTRACT_NONE,
@@ -49,7 +51,8 @@ static void show_help(void)
 	       "  -M, --no-mouse          disable mouse\n"
 	       "  -f, --config=FILE       configuration file\n"
 	       "  -F, --no-config         do not load configuration file\n"
-	       "  -V, --view=MODE         starting view mode: playback/capture/all"));
+	       "  -V, --view=MODE         starting view mode: playback/capture/all\n"
+	       "  -L, --meter=NAME        show the signal level of a capture device"));
 	puts(_("Debugging options:\n"
 	       "  -g, --no-color          toggle using of colors\n"
 	       "  -a, --abstraction=NAME  mixer abstraction level: none/basic"));
@@ -57,7 +60,7 @@ static void show_help(void)
 
 static void parse_options(int argc, char *argv[])
 {
-	static const char short_options[] = "hc:D:f:FmMV:gsa:";
+	static const char short_options[] = "hc:D:f:FmMV:gsa:L:";
 	static const struct option long_options[] = {
 		{ .name = "help", .val = 'h' },
 		{ .name = "card", .has_arg = 1, .val = 'c' },
@@ -69,6 +72,7 @@ static void parse_options(int argc, char *argv[])
 		{ .name = "view", .has_arg = 1, .val = 'V' },
 		{ .name = "no-color", .val = 'g' },
 		{ .name = "abstraction", .has_arg = 1, .val = 'a' },
+		{ .name = "meter", .has_arg = 1, .val = 'L' },
 		{ 0 }
 	};
 	int option;
@@ -121,6 +125,9 @@ static void parse_options(int argc, char *argv[])
 		case 'g':
 			use_color = !use_color;
 			break;
+		case 'L':
+			meter_device = optarg;
+			break;
 		case 'a':
 			if (!strcmp(optarg, "none"))
 				selem_regopt.abstract = SND_MIXER_SABSTRACT_NONE;
@@ -153,6 +160,8 @@ int main(int argc, char *argv[])
 	parse_options(argc, argv);
 
 	create_mixer_object(&selem_regopt);
+	if (meter_device)
+		meter_open(meter_device);
 
 	initialize_curses(use_color, use_mouse);
 
@@ -20,6 +20,7 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <errno.h>
+#include <time.h>
 #include <poll.h>
 #include <panel.h>
 #include <alsa/asoundlib.h>
@@ -30,10 +31,22 @@
 #include "mixer_widget.h"
 #include "mixer_display.h"
 #include "mixer_controls.h"
+#include "meter.h"
 #include "mainloop.h"
 
+/* value changes are drawn at most once per frame */
+#define FRAME_INTERVAL_MS	20
+
 static WINDOW *curses_initialized;
 
+static long long now_ms(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000LL + ts.tv_nsec / 1000000;
+}
+
 static void black_hole_error_handler(const char *file, int line,
 				     const char *function, int err,
 				     const char *fmt, ...)
@@ -63,6 +76,7 @@ void app_shutdown(void)
 		curs_set(1);
 		endwin();
 	}
+	meter_close();
 	mixer_shutdown();
 }
 
@@ -71,9 +85,10 @@ void mainloop(void)
 	struct pollfd *pollfds = NULL;
 	int nfds = 0, n;
 	const struct widget *active_widget;
-	unsigned short revents;
 	int key;
 	int err;
+	int timeout, mixer_fds;
+	long long last_frame = 0, now;
 
 	for (;;) {
 		update_panels();
@@ -83,7 +98,7 @@ void mainloop(void)
 		if (!active_widget)
 			break;
 
-		n = 1 + snd_mixer_poll_descriptors_count(mixer);
+		n = 1 + mixer_poll_descriptors_count() + meter_poll_descriptors_count();
 		if (n != nfds) {
 			free(pollfds);
 			nfds = n;
@@ -91,10 +106,19 @@ void mainloop(void)
 			pollfds[0].fd = fileno(stdin);
 			pollfds[0].events = POLLIN;
 		}
-		err = snd_mixer_poll_descriptors(mixer, &pollfds[1], nfds - 1);
+		mixer_fds = mixer_poll_descriptors(&pollfds[1], nfds - 1);
+		if (mixer_fds < 0)
+			fatal_alsa_error("cannot get poll descriptors", mixer_fds);
+		err = meter_poll_descriptors(&pollfds[1 + mixer_fds], nfds - 1 - mixer_fds);
 		if (err < 0)
 			fatal_alsa_error("cannot get poll descriptors", err);
-		n = poll(pollfds, nfds, -1);
+		timeout = -1;
+		if (control_values_changed || meter_pending()) {
+			timeout = last_frame + FRAME_INTERVAL_MS - now_ms();
+			if (timeout < 0)
+				timeout = 0;
+		}
+		n = poll(pollfds, nfds, timeout);
 		if (n < 0) {
 			if (errno == EINTR) {
 				pollfds[0].revents = 0;
@@ -108,13 +132,8 @@ void mainloop(void)
 		if (pollfds[0].revents & POLLIN)
 			--n;
 		if (n > 0) {
-			err = snd_mixer_poll_descriptors_revents(mixer, &pollfds[1], nfds - 1, &revents);
-			if (err < 0)
-				fatal_alsa_error("cannot get poll events", err);
-			if (revents & (POLLERR | POLLNVAL))
-				close_mixer_device();
-			else if (revents & POLLIN)
-				snd_mixer_handle_events(mixer);
+			mixer_handle_poll_events(&pollfds[1]);
+			meter_handle_poll_events(&pollfds[1 + mixer_fds]);
 		}
 		key = wgetch(active_widget->window);
 		while (key != ERR) {
@@ -136,9 +155,16 @@ void mainloop(void)
 			create_controls();
 			control_values_changed = FALSE;
 			display_controls();
-		} else if (control_values_changed) {
-			control_values_changed = FALSE;
-			display_controls();
+		} else if (control_values_changed || meter_pending()) {
+			now = now_ms();
+			if (now - last_frame >= FRAME_INTERVAL_MS) {
+				last_frame = now;
+				if (control_values_changed) {
+					control_values_changed = FALSE;
+					display_dirty_controls();
+				}
+				display_meter();
+			}
 		}
 	}
 	free(pollfds);
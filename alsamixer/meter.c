@@ -0,0 +1,155 @@
+/*
+ * meter.c - level meters of a capture device
+ * Copyright (c) 2026 agent <agent@local>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "aconfig.h"
+#include <stdlib.h>
+#include <math.h>
+#include <alsa/asoundlib.h>
+#include "gettext_curses.h"
+#include "die.h"
+#include "meter.h"
+#include "sample-kernels.h"
+
+/*
+ * The capture runs at a low rate through the plug layer, so any device
+ * (like a dsnoop tap of the card) can be used. The samples are read
+ * from the main loop when the PCM descriptors are ready, and reduced to
+ * the peak and the sum of squares until the next screen frame takes
+ * them.
+ */
+#define METER_RATE		8000
+#define METER_LATENCY		100000	/* us */
+#define METER_READ_FRAMES	512
+
+static snd_pcm_t *meter_pcm;
+static unsigned int pollfds_count;
+static short buffer[METER_READ_FRAMES * METER_CHANNELS];
+
+static unsigned int peak[METER_CHANNELS];
+static unsigned long long sum_squares[METER_CHANNELS];
+static unsigned long frames_count;
+
+void meter_open(const char *device_name)
+{
+	int err;
+
+	err = snd_pcm_open(&meter_pcm, device_name, SND_PCM_STREAM_CAPTURE, SND_PCM_NONBLOCK);
+	if (err < 0)
+		fatal_alsa_error(_("cannot open meter device"), err);
+	err = snd_pcm_set_params(meter_pcm, SND_PCM_FORMAT_S16, SND_PCM_ACCESS_RW_INTERLEAVED,
+				 METER_CHANNELS, METER_RATE, 1, METER_LATENCY);
+	if (err < 0)
+		fatal_alsa_error(_("cannot set meter device parameters"), err);
+	err = snd_pcm_start(meter_pcm);
+	if (err < 0)
+		fatal_alsa_error(_("cannot start meter device"), err);
+}
+
+void meter_close(void)
+{
+	if (meter_pcm) {
+		snd_pcm_close(meter_pcm);
+		meter_pcm = NULL;
+	}
+}
+
+static void reduce(const short *buf, unsigned int frames)
+{
+	sample_peak_sumsq_s16(buf, frames, METER_CHANNELS, peak, sum_squares);
+	frames_count += frames;
+}
+
+static void read_frames(void)
+{
+	snd_pcm_sframes_t frames;
+	int err;
+
+	for (;;) {
+		frames = snd_pcm_readi(meter_pcm, buffer, METER_READ_FRAMES);
+		if (frames == -EAGAIN)
+			return;
+		if (frames < 0) {
+			/* overrun or suspend, just start again */
+			err = snd_pcm_recover(meter_pcm, frames, 1);
+			if (err >= 0)
+				err = snd_pcm_start(meter_pcm);
+			if (err < 0)
+				meter_close();
+			return;
+		}
+		reduce(buffer, frames);
+		if (frames < METER_READ_FRAMES)
+			return;
+	}
+}
+
+bool meter_pending(void)
+{
+	return frames_count > 0;
+}
+
+bool meter_take_levels(struct meter_levels *levels)
+{
+	unsigned int c;
+
+	if (frames_count == 0)
+		return FALSE;
+	for (c = 0; c < METER_CHANNELS; c++) {
+		levels->peak[c] = peak[c] / 32768.0;
+		levels->rms[c] = sqrt((double)sum_squares[c] / frames_count) / 32768.0;
+		peak[c] = 0;
+		sum_squares[c] = 0;
+	}
+	frames_count = 0;
+	return TRUE;
+}
+
+int meter_poll_descriptors_count(void)
+{
+	if (!meter_pcm)
+		return 0;
+	return snd_pcm_poll_descriptors_count(meter_pcm);
+}
+
+int meter_poll_descriptors(struct pollfd *pfds, unsigned int space)
+{
+	int n;
+
+	pollfds_count = 0;
+	if (!meter_pcm)
+		return 0;
+	n = snd_pcm_poll_descriptors(meter_pcm, pfds, space);
+	if (n < 0)
+		return n;
+	pollfds_count = n;
+	return n;
+}
+
+void meter_handle_poll_events(struct pollfd *pfds)
+{
+	unsigned short revents;
+	int err;
+
+	if (!meter_pcm || pollfds_count == 0)
+		return;
+	err = snd_pcm_poll_descriptors_revents(meter_pcm, pfds, pollfds_count, &revents);
+	if (err < 0)
+		fatal_alsa_error("cannot get poll events", err);
+	if (revents & (POLLIN | POLLERR))
+		read_frames();
+}
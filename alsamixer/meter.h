@@ -0,0 +1,40 @@
+/*
+ * meter.h - level meters of a capture device
+ * Copyright (c) 2026 agent <agent@local>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef METER_H_INCLUDED
+#define METER_H_INCLUDED
+
+#include CURSESINC
+#include <poll.h>
+
+#define METER_CHANNELS	2
+
+struct meter_levels {
+	double peak[METER_CHANNELS];	/* 0..1 of the full scale */
+	double rms[METER_CHANNELS];
+};
+
+void meter_open(const char *device_name);
+void meter_close(void);
+bool meter_pending(void);
+bool meter_take_levels(struct meter_levels *levels);
+int meter_poll_descriptors_count(void);
+int meter_poll_descriptors(struct pollfd *pfds, unsigned int space);
+void meter_handle_poll_events(struct pollfd *pfds);
+
+#endif
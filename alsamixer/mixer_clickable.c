@@ -5,63 +5,175 @@
 extern int screen_cols;
 extern int screen_lines;
 
-static struct clickable_rect *clickable_rects = NULL;
-static unsigned int clickable_rects_count = 0;
-static unsigned int last_rect = 0;
-
-/* Using 0 instead of -1 for marking free rectangles allows us to use
- * memset for `freeing` all rectangles at once.
- * Zero is actually a valid coordinate in ncurses, but since we don't have
- * any clickables in the top line this is fine. */
-#define FREE_MARKER 0
-#define RECT_IS_FREE(RECT) ((RECT).y1 == FREE_MARKER)
-#define RECT_FREE(RECT) ((RECT).y1 = FREE_MARKER)
+/* The rectangles are also registered to the cells of a grid they overlap,
+ * so a mouse event looks only at the few rectangles of one cell.
+ *
+ * Redrawing clears and sets the same rectangles again, so a cleared
+ * rectangle is only marked as free and it is taken again by a rectangle
+ * with the same coordinates, which keeps the grid unchanged. The grid is
+ * rebuilt, and the free rectangles are dropped, when the layout changes. */
+#define CELL_LINES 4
+#define CELL_COLS 16
 
-void clickable_set(int y1, int x1, int y2, int x2, command_enum command, int arg1) {
-	struct clickable_rect* tmp;
-	unsigned int i;
+struct clickable_entry {
+	struct clickable_rect rect;
+	bool free;
+};
+
+struct clickable_cell {
+	unsigned int *entries;		/* indexes in clickable_entries */
+	unsigned int count;
+	unsigned int size;
+};
+
+static struct clickable_entry *clickable_entries = NULL;
+static unsigned int clickable_entries_count = 0;
+static unsigned int clickable_entries_size = 0;
+static unsigned int clickable_free_count = 0;
+
+static struct clickable_cell *grid = NULL;
+static int grid_lines = 0;
+static int grid_cols = 0;
+/* Not valid until the first layout or after an allocation failure, the
+ * rectangles are searched one by one then */
+static bool grid_valid = FALSE;
 
-	for (i = last_rect; i < clickable_rects_count; ++i) {
-		if (RECT_IS_FREE(clickable_rects[i])) {
-			last_rect = i;
-			goto SET_CLICKABLE_DATA;
+static void get_cell(int y, int x, int *line, int *col) {
+	*line = y < 0 ? 0 : y / CELL_LINES;
+	if (*line >= grid_lines)
+		*line = grid_lines - 1;
+	*col = x < 0 ? 0 : x / CELL_COLS;
+	if (*col >= grid_cols)
+		*col = grid_cols - 1;
+}
+
+static void grid_insert(unsigned int index) {
+	const struct clickable_rect *rect = &clickable_entries[index].rect;
+	struct clickable_cell *cell;
+	unsigned int *tmp;
+	int line1, col1, line2, col2, line, col;
+
+	get_cell(rect->y1, rect->x1, &line1, &col1);
+	get_cell(rect->y2, rect->x2, &line2, &col2);
+	for (line = line1; line <= line2; ++line) {
+		for (col = col1; col <= col2; ++col) {
+			cell = &grid[line * grid_cols + col];
+			if (cell->count == cell->size) {
+				tmp = realloc(cell->entries, (cell->size + 8) * sizeof(*cell->entries));
+				if (!tmp) {
+					grid_valid = FALSE;
+					return;
+				}
+				cell->entries = tmp;
+				cell->size += 8;
+			}
+			cell->entries[cell->count++] = index;
 		}
 	}
+}
 
-	for (i = 0; i < last_rect; ++i) {
-		if (RECT_IS_FREE(clickable_rects[i])) {
-			last_rect = i;
-			goto SET_CLICKABLE_DATA;
-		}
+static void grid_free(void) {
+	int i;
+
+	for (i = 0; i < grid_lines * grid_cols; ++i)
+		free(grid[i].entries);
+	free(grid);
+	grid = NULL;
+	grid_lines = 0;
+	grid_cols = 0;
+	grid_valid = FALSE;
+}
+
+void clickable_rebuild(void) {
+	unsigned int i, count;
+	int lines, cols;
+
+	for (i = count = 0; i < clickable_entries_count; ++i) {
+		if (!clickable_entries[i].free)
+			clickable_entries[count++] = clickable_entries[i];
 	}
+	clickable_entries_count = count;
+	clickable_free_count = 0;
 
-	last_rect = clickable_rects_count;
-	tmp = realloc(clickable_rects, (clickable_rects_count + 8) * sizeof(*clickable_rects));
-	if (!tmp) {
-		free(clickable_rects);
-		clickable_rects = NULL;
-		clickable_rects_count = 0;
-		last_rect = 0;
-		return;
+	lines = (screen_lines + CELL_LINES - 1) / CELL_LINES;
+	cols = (screen_cols + CELL_COLS - 1) / CELL_COLS;
+	if (lines < 1)
+		lines = 1;
+	if (cols < 1)
+		cols = 1;
+	if (lines != grid_lines || cols != grid_cols) {
+		grid_free();
+		grid = calloc(lines * cols, sizeof(*grid));
+		if (!grid)
+			return;
+		grid_lines = lines;
+		grid_cols = cols;
+	} else {
+		for (i = 0; i < (unsigned int)(lines * cols); ++i)
+			grid[i].count = 0;
 	}
-	clickable_rects = tmp;
-#if FREE_MARKER == 0
-	memset(clickable_rects + clickable_rects_count, 0, 8 * sizeof(*clickable_rects));
-#else
-	for (i = clickable_rects_count; i < clickable_rects_count + 8; ++i)
-		RECT_FREE(clickable_rects[i]);
-#endif
-	clickable_rects_count += 8;
+	grid_valid = TRUE;
+	for (i = 0; i < clickable_entries_count && grid_valid; ++i)
+		grid_insert(i);
+}
+
+/* a free rectangle with the given coordinates */
+static struct clickable_entry *find_free(int y1, int x1, int y2, int x2) {
+	struct clickable_entry *entry;
+	const struct clickable_cell *cell;
+	unsigned int i, count;
+	int line, col;
+
+	if (grid_valid) {
+		get_cell(y1, x1, &line, &col);
+		cell = &grid[line * grid_cols + col];
+		count = cell->count;
+	} else {
+		cell = NULL;
+		count = clickable_entries_count;
+	}
+	for (i = 0; i < count; ++i) {
+		entry = &clickable_entries[cell ? cell->entries[i] : i];
+		if (entry->free &&
+				entry->rect.y1 == y1 && entry->rect.x1 == x1 &&
+				entry->rect.y2 == y2 && entry->rect.x2 == x2)
+			return entry;
+	}
+	return NULL;
+}
+
+void clickable_set(int y1, int x1, int y2, int x2, command_enum command, int arg1) {
+	struct clickable_entry *entry, *tmp;
+
+	entry = find_free(y1, x1, y2, x2);
+	if (entry) {
+		clickable_free_count--;
+		goto SET_CLICKABLE_DATA;
+	}
+
+	/* the free rectangles left by different layouts of the columns */
+	if (clickable_free_count > 64 && clickable_free_count > clickable_entries_count / 2)
+		clickable_rebuild();
+
+	if (clickable_entries_count == clickable_entries_size) {
+		tmp = realloc(clickable_entries, (clickable_entries_size + 8) * sizeof(*clickable_entries));
+		if (!tmp)
+			return;
+		clickable_entries = tmp;
+		clickable_entries_size += 8;
+	}
+	entry = &clickable_entries[clickable_entries_count++];
+	entry->rect.y1 = y1;
+	entry->rect.x1 = x1;
+	entry->rect.y2 = y2;
+	entry->rect.x2 = x2;
+	if (grid_valid)
+		grid_insert(entry - clickable_entries);
 
 SET_CLICKABLE_DATA:
-	clickable_rects[last_rect] = (struct clickable_rect) {
-		.y1 = y1,
-		.x1 = x1,
-		.x2 = x2,
-		.y2 = y2,
-		.command = command,
-		.arg1 = arg1
-	};
+	entry->rect.command = command;
+	entry->rect.arg1 = arg1;
+	entry->free = FALSE;
 }
 
 void clickable_set_relative(WINDOW *win, int y1, int x1, int y2, int x2, command_enum command, int arg1) {
@@ -74,6 +186,13 @@ void clickable_set_relative(WINDOW *win, int y1, int x1, int y2, int x2, command
 	clickable_set(y1, x1, y2, x2, command, arg1);
 }
 
+static void entry_free(struct clickable_entry *entry) {
+	if (!entry->free) {
+		entry->free = TRUE;
+		clickable_free_count++;
+	}
+}
+
 void clickable_clear(int y1, int x1, int y2, int x2) {
 #define IS_IN_RECT(Y, X) (Y >= y1 && Y <= y2 && X >= x1 && X <= x2)
 	unsigned int i;
@@ -81,20 +200,14 @@ void clickable_clear(int y1, int x1, int y2, int x2) {
 	if (x1 == 0 && x2 == -1 && y2 == -1) {
 		if (y1 == 0) {
 			// Optimize case: clear all
-#if FREE_MARKER == 0
-			if (clickable_rects)
-				memset(clickable_rects, 0,
-						clickable_rects_count * sizeof(*clickable_rects));
-#else
-			for (i = 0; i < clickable_rects_count; ++i)
-				RECT_FREE(clickable_rects[i]);
-#endif
+			for (i = 0; i < clickable_entries_count; ++i)
+				entry_free(&clickable_entries[i]);
 		}
 		else {
 			// Optimize case: clear all lines beyond y1
-			for (i = 0; i < clickable_rects_count; ++i) {
-				if (clickable_rects[i].y2 >= y1)
-					RECT_FREE(clickable_rects[i]);
+			for (i = 0; i < clickable_entries_count; ++i) {
+				if (clickable_entries[i].rect.y2 >= y1)
+					entry_free(&clickable_entries[i]);
 			}
 		}
 		return;
@@ -105,30 +218,42 @@ void clickable_clear(int y1, int x1, int y2, int x2) {
 	if (x2 < 0)
 		x2 = screen_cols + x2 + 1;
 
-	for (i = 0; i < clickable_rects_count; ++i) {
-		if (!RECT_IS_FREE(clickable_rects[i]) && (
-				IS_IN_RECT(clickable_rects[i].y1, clickable_rects[i].x1) ||
-				IS_IN_RECT(clickable_rects[i].y2, clickable_rects[i].x2)
+	for (i = 0; i < clickable_entries_count; ++i) {
+		if (!clickable_entries[i].free && (
+				IS_IN_RECT(clickable_entries[i].rect.y1, clickable_entries[i].rect.x1) ||
+				IS_IN_RECT(clickable_entries[i].rect.y2, clickable_entries[i].rect.x2)
 			))
 		{
-			RECT_FREE(clickable_rects[i]);
+			entry_free(&clickable_entries[i]);
 		}
 	}
 }
 
 struct clickable_rect* clickable_find(int y, int x) {
-	unsigned int i;
+	struct clickable_entry *entry;
+	const struct clickable_cell *cell;
+	unsigned int i, count;
+	int line, col;
 
-	for (i = 0; i < clickable_rects_count; ++i) {
+	if (grid_valid) {
+		get_cell(y, x, &line, &col);
+		cell = &grid[line * grid_cols + col];
+		count = cell->count;
+	} else {
+		cell = NULL;
+		count = clickable_entries_count;
+	}
+	for (i = 0; i < count; ++i) {
+		entry = &clickable_entries[cell ? cell->entries[i] : i];
 		if (
-				!RECT_IS_FREE(clickable_rects[i]) &&
-				y >= clickable_rects[i].y1 &&
-				x >= clickable_rects[i].x1 &&
-				y <= clickable_rects[i].y2 &&
-				x <= clickable_rects[i].x2
+				!entry->free &&
+				y >= entry->rect.y1 &&
+				x >= entry->rect.x1 &&
+				y <= entry->rect.y2 &&
+				x <= entry->rect.x2
 			)
 		{
-			return &clickable_rects[i];
+			return &entry->rect;
 		}
 	}
 
@@ -21,7 +21,7 @@
 #include "aconfig.h"
 #include <stdlib.h>
 #include <string.h>
-#include <assert.h>
+#include <stdint.h>
 #include CURSESINC
 #include <alsa/asoundlib.h>
 #include "utils.h"
@@ -33,6 +33,8 @@
 struct control *controls;
 unsigned int controls_count;
 
+#define MAX_CONTROLS_PER_ELEM	(2 * ARRAY_SIZE(control_channels))
+
 static const snd_mixer_selem_channel_id_t supported_channels[] = {
 	SND_MIXER_SCHN_FRONT_LEFT,
 	SND_MIXER_SCHN_FRONT_RIGHT,
@@ -122,86 +124,29 @@ static bool has_merged_cswitch(snd_mixer_elem_t *elem)
 	return FALSE;
 }
 
-static unsigned int get_playback_controls_count(snd_mixer_elem_t *elem)
-{
-	unsigned int count = 0;
-	unsigned int i;
-	int has_vol, has_sw;
-
-	has_vol = snd_mixer_selem_has_playback_volume(elem);
-	has_sw = snd_mixer_selem_has_playback_switch(elem);
-	if (!has_vol && !has_sw)
-		return 0;
-	if ((!has_vol || snd_mixer_selem_has_playback_volume_joined(elem)) &&
-	    (!has_sw || snd_mixer_selem_has_playback_switch_joined(elem)))
-		return 1;
-	for (i = 0; i < ARRAY_SIZE(control_channels); ++i) {
-		if (snd_mixer_selem_has_playback_channel(elem, control_channels[i][0]) ||
-		    (control_channels[i][1] != SND_MIXER_SCHN_UNKNOWN &&
-		     snd_mixer_selem_has_playback_channel(elem, control_channels[i][1])))
-			++count;
-	}
-	return count;
-}
-
-static unsigned int get_capture_controls_count(snd_mixer_elem_t *elem)
-{
-	unsigned int count = 0;
-	unsigned int i;
-	int has_vol, has_sw;
-
-	has_vol = snd_mixer_selem_has_capture_volume(elem);
-	has_sw = snd_mixer_selem_has_capture_switch(elem);
-	if ((!has_vol && !has_sw) ||
-	    (view_mode == VIEW_MODE_ALL && has_merged_cswitch(elem)))
-		return 0;
-	if ((!has_vol || snd_mixer_selem_has_capture_volume_joined(elem)) &&
-	    (!has_sw || snd_mixer_selem_has_capture_switch_joined(elem)))
-		return 1;
-	for (i = 0; i < ARRAY_SIZE(control_channels); ++i) {
-		if (snd_mixer_selem_has_capture_channel(elem, control_channels[i][0]) ||
-		    (control_channels[i][1] != SND_MIXER_SCHN_UNKNOWN &&
-		     snd_mixer_selem_has_capture_channel(elem, control_channels[i][1])))
-			++count;
-	}
-	return count;
-}
-
-static unsigned int get_controls_count_for_elem(snd_mixer_elem_t *elem)
+/*
+ * Only the length of the name is needed for the layout, the string is
+ * built when the control is displayed. "S/PDIF" replaces "IEC958" with
+ * the same length.
+ */
+static void create_name(struct control *control)
 {
-	unsigned int p, c;
+	unsigned int index;
 
-	if (snd_mixer_elem_get_type(elem) != SND_MIXER_ELEM_SIMPLE)
-		return 0;
-	if (snd_mixer_selem_is_enumerated(elem)) {
-		switch (view_mode) {
-		case VIEW_MODE_PLAYBACK:
-			return snd_mixer_selem_is_enum_capture(elem) ? 0 : 1;
-		case VIEW_MODE_CAPTURE:
-			return snd_mixer_selem_is_enum_capture(elem) ? 1 : 0;
-		case VIEW_MODE_ALL:
-		default:
-			return 1;
-		}
-	}
-	switch (view_mode) {
-	case VIEW_MODE_PLAYBACK:
-		return get_playback_controls_count(elem);
-	case VIEW_MODE_CAPTURE:
-		return get_capture_controls_count(elem);
-	case VIEW_MODE_ALL:
-	default:
-		p = get_playback_controls_count(elem);
-		c = get_capture_controls_count(elem);
-		return has_merged_cswitch(elem) ? p : p + c;
-	}
+	index = snd_mixer_selem_get_index(control->elem);
+	control->name_len = strlen(snd_mixer_selem_get_name(control->elem));
+	if (index > 0)
+		for (control->name_len += 1; index > 0; index /= 10)
+			control->name_len++;
 }
 
-static void create_name(struct control *control)
+const char *get_control_name(struct control *control)
 {
 	unsigned int index;
 	char *s;
 
+	if (control->name)
+		return control->name;
 	index = snd_mixer_selem_get_index(control->elem);
 	if (index > 0)
 		control->name = casprintf("%s %u", snd_mixer_selem_get_name(control->elem), index);
@@ -210,6 +155,7 @@ static void create_name(struct control *control)
 
 	while ((s = strstr(control->name, "IEC958")) != NULL)
 		memcpy(s, "S/PDIF", 6);
+	return control->name;
 }
 
 static unsigned int create_controls_for_elem(snd_mixer_elem_t *elem, struct control *control)
@@ -489,26 +435,56 @@ void free_controls(void)
 	controls_count = 0;
 }
 
+/*
+ * The controls of an element are adjacent, the callback private data of
+ * the element holds the index of the first one plus one (or NULL).
+ */
+static void set_elem_first_control(snd_mixer_elem_t *elem, unsigned int count)
+{
+	snd_mixer_elem_set_callback_private(elem, count ?
+		(void *)(uintptr_t)(controls_count - count + 1) : NULL);
+}
+
+/* the columns of elem are redrawn by display_dirty_controls() */
+void mark_controls_dirty(snd_mixer_elem_t *elem)
+{
+	uintptr_t first = (uintptr_t)snd_mixer_elem_get_callback_private(elem);
+	unsigned int i;
+
+	if (first == 0)
+		return;
+	for (i = first - 1; i < controls_count && controls[i].elem == elem; ++i)
+		controls[i].dirty = TRUE;
+}
+
 void create_controls(void)
 {
 	snd_mixer_elem_t *elem;
-	struct control *control;
+	unsigned int allocated = 0, count;
 
 	free_controls();
 
+	/*
+	 * One pass over the elements; an element gets at most one playback
+	 * and one capture control per channel pair, so the array is grown
+	 * ahead of create_controls_for_elem().
+	 */
 	for (elem = snd_mixer_first_elem(mixer);
 	     elem;
-	     elem = snd_mixer_elem_next(elem))
-		controls_count += get_controls_count_for_elem(elem);
-
-	if (controls_count > 0) {
-		controls = ccalloc(controls_count, sizeof *controls);
-		control = controls;
-		for (elem = snd_mixer_first_elem(mixer);
-		     elem;
-		     elem = snd_mixer_elem_next(elem))
-			control += create_controls_for_elem(elem, control);
-		assert(control == controls + controls_count);
+	     elem = snd_mixer_elem_next(elem)) {
+		if (controls_count + MAX_CONTROLS_PER_ELEM > allocated) {
+			allocated = allocated ? allocated * 2 : 64;
+			controls = crealloc(controls, allocated * sizeof *controls);
+			memset(controls + controls_count, 0,
+			       (allocated - controls_count) * sizeof *controls);
+		}
+		count = create_controls_for_elem(elem, controls + controls_count);
+		controls_count += count;
+		set_elem_first_control(elem, count);
+	}
+	if (controls_count == 0) {
+		free(controls);
+		controls = NULL;
 	}
 
 	compute_controls_layout();
@@ -1,11 +1,13 @@
 #ifndef MIXER_CONTROLS_H_INCLUDED
 #define MIXER_CONTROLS_H_INCLUDED
 
+#include <stdbool.h>
 #include <alsa/asoundlib.h>
 
 struct control {
 	snd_mixer_elem_t *elem;
-	char *name;
+	char *name;		/* created on the first get_control_name() */
+	unsigned int name_len;
 	unsigned int flags;
 #define TYPE_PVOLUME	(1u << 4)
 #define TYPE_CVOLUME	(1u << 5)
@@ -25,6 +27,7 @@ struct control {
 	snd_mixer_selem_channel_id_t pswitch_channels[2];
 	snd_mixer_selem_channel_id_t cswitch_channels[2];
 	unsigned int enum_channel_bits;
+	bool dirty;	/* values changed since the last redraw */
 };
 
 extern struct control *controls;
@@ -33,5 +36,7 @@ extern unsigned int controls_count;
 bool are_there_any_controls(void);
 void create_controls(void);
 void free_controls(void);
+void mark_controls_dirty(snd_mixer_elem_t *elem);
+const char *get_control_name(struct control *control);
 
 #endif
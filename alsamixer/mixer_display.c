@@ -35,6 +35,7 @@
 #include "mixer_controls.h"
 #include "mixer_display.h"
 #include "mixer_clickable.h"
+#include "meter.h"
 
 enum align {
 	ALIGN_LEFT,
@@ -318,7 +319,7 @@ static void display_focus_item_info(void)
 				value_info = casprintf(" [%s, %s]", sw ? _("On") : _("Off"), sw2 ? _("On") : _("Off"));
 		}
 	}
-	item_info = casprintf("%s%s", control->name, value_info ? value_info : "");
+	item_info = casprintf("%s%s", get_control_name(control), value_info ? value_info : "");
 	free(value_info);
 	display_string_in_field(4, info_items_left, item_info, info_items_width, ALIGN_LEFT);
 	free(item_info);
@@ -600,7 +601,7 @@ static void display_control(unsigned int control_index)
 		else
 			wattrset(mixer_widget.window, attrs.ctl_label_inactive);
 	}
-	display_string_centered_in_control(name_y, col, control->name, control_name_width);
+	display_string_centered_in_control(name_y, col, get_control_name(control), control_name_width);
 	clickable_set_relative(mixer_widget.window, -1, -control_name_width, 0, -2,
 			CMD_WITH_ARG(CMD_MIXER_FOCUS_CONTROL, control_index), -1);
 	if (channel_name_y > name_y) {
@@ -668,6 +669,8 @@ void display_controls(void)
 
 	display_focus_item_info();
 
+	for (i = 0; i < controls_count; ++i)
+		controls[i].dirty = FALSE;
 	if (controls_count > 0) {
 		if (!screen_too_small)
 			for (i = 0; i < visible_controls; ++i)
@@ -680,6 +683,95 @@ void display_controls(void)
 	display_scroll_indicators();
 }
 
+/*
+ * Redraw only the visible columns whose values changed, the layout and
+ * the scroll position stay as set by the last display_controls().
+ */
+void display_dirty_controls(void)
+{
+	unsigned int i, index;
+	int left, width, y;
+
+	if (controls_count == 0 || screen_too_small) {
+		display_controls();
+		return;
+	}
+	for (i = 0; i < visible_controls; ++i) {
+		index = first_visible_control_index + i;
+		if (index >= controls_count || !controls[index].dirty)
+			continue;
+		/* with the gap on the right, the capture labels can reach it */
+		left = first_control_x + i * (control_width + 1);
+		width = control_width + 1;
+		if (width > screen_cols - 1 - left)
+			width = screen_cols - 1 - left;
+		clickable_clear(5, left, -1, left + width - 1);
+		wattrset(mixer_widget.window, attrs.mixer_frame);
+		for (y = 5; y < screen_lines - 1; ++y)
+			mvwprintw(mixer_widget.window, y, left, "%*s", width, "");
+		display_control(index);
+		if (index == focus_control_index)
+			display_focus_item_info();
+	}
+	for (i = 0; i < controls_count; ++i)
+		controls[i].dirty = FALSE;
+}
+
+#define METER_MIN_DB	-60
+
+static int meter_bar_length(double level, int width)
+{
+	double db;
+
+	if (level <= 0)
+		return 0;
+	db = 20 * log10(level);
+	if (db <= METER_MIN_DB)
+		return 0;
+	if (db >= 0)
+		return width;
+	return lrint((db - METER_MIN_DB) / -METER_MIN_DB * width);
+}
+
+/* the levels go into the bottom line of the frame: " L [bar] -12.3 " */
+void display_meter(void)
+{
+	struct meter_levels levels;
+	int width, x, y, i, c, rms, peak;
+	double db;
+	chtype ch;
+	char buf[16];
+
+	if (!meter_take_levels(&levels) || screen_cols < 40)
+		return;
+	y = screen_lines - 1;
+	width = (screen_cols - 4) / METER_CHANNELS - 10;
+	for (c = 0; c < METER_CHANNELS; c++) {
+		x = 2 + c * (width + 10);
+		wattrset(mixer_widget.window, attrs.mixer_active);
+		/* TRANSLATORS: the meter channels; one character */
+		mvwprintw(mixer_widget.window, y, x, " %c ", c ? _("R")[0] : _("L")[0]);
+		rms = meter_bar_length(levels.rms[c], width);
+		peak = meter_bar_length(levels.peak[c], width);
+		for (i = 0; i < width; i++) {
+			if (i < rms)
+				ch = ACS_CKBOARD | attrs.ctl_bar_lo;
+			else if (i == peak - 1)
+				ch = '|' | attrs.mixer_active;
+			else
+				ch = ACS_HLINE | attrs.mixer_frame;
+			waddch(mixer_widget.window, ch);
+		}
+		db = levels.peak[c] > 0 ? 20 * log10(levels.peak[c]) : -100;
+		if (db > -100)
+			snprintf(buf, sizeof buf, "%6.1f ", db);
+		else
+			snprintf(buf, sizeof buf, "%6s ", "-inf");
+		wattrset(mixer_widget.window, attrs.mixer_active);
+		waddstr(mixer_widget.window, buf);
+	}
+}
+
 void compute_controls_layout(void)
 {
 	bool any_volume, any_pswitch, any_cswitch, any_multich;
@@ -687,6 +779,8 @@ void compute_controls_layout(void)
 	int height, space;
 	unsigned int i;
 
+	clickable_rebuild();
+
 	if (controls_count == 0 || screen_too_small) {
 		visible_controls = 0;
 		return;
@@ -709,7 +803,7 @@ void compute_controls_layout(void)
 
 	max_width = 8;
 	for (i = 0; i < controls_count; ++i) {
-		name_len = strlen(controls[i].name);
+		name_len = controls[i].name_len;
 		if (name_len > max_width)
 			max_width = name_len;
 	}
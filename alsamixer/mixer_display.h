@@ -5,6 +5,8 @@ void init_mixer_layout(void);
 void display_card_info(void);
 void display_view_mode(void);
 void display_controls(void);
+void display_dirty_controls(void);
+void display_meter(void);
 void compute_controls_layout(void);
 
 #endif
@@ -22,6 +22,7 @@
 #include <stdlib.h>
 #include <string.h>
 #include <errno.h>
+#include <poll.h>
 #include <alsa/asoundlib.h>
 #include "gettext_curses.h"
 #include "version.h"
@@ -58,54 +59,219 @@ bool controls_changed;
 unsigned int mouse_wheel_step = 1;
 bool mouse_wheel_focuses_control = 1;
 
+/*
+ * Every selected card stays open in its own mixer object, so switching
+ * back to it needs no reload; the main loop polls all of them. "mixer"
+ * is the object of the selected card, or an empty one without a card.
+ * The elements of the other cards get background_elem_callback(), which
+ * only keeps the volume mapping cache valid.
+ */
+struct mixer_card {
+	struct mixer_card *next;
+	snd_mixer_t *mixer;
+	char *device_name;
+	unsigned int pollfds_count;
+};
+
+static struct mixer_card *mixer_cards;
+static struct mixer_card *current_card;
+static snd_mixer_t *no_card_mixer;
+static struct snd_mixer_selem_regopt mixer_regopt;
+
 static int elem_callback(snd_mixer_elem_t *elem, unsigned int mask)
 {
 	if (mask == SND_CTL_EVENT_MASK_REMOVE) {
+		volume_mapping_invalidate(elem);
 		controls_changed = TRUE;
 	} else {
-		if (mask & SND_CTL_EVENT_MASK_VALUE)
+		if (mask & SND_CTL_EVENT_MASK_VALUE) {
+			mark_controls_dirty(elem);
 			control_values_changed = TRUE;
+		}
 
-		if (mask & SND_CTL_EVENT_MASK_INFO)
+		if (mask & SND_CTL_EVENT_MASK_INFO) {
+			volume_mapping_invalidate(elem);
 			controls_changed = TRUE;
+		}
 	}
 
 	return 0;
 }
 
-static int mixer_callback(snd_mixer_t *mixer, unsigned int mask, snd_mixer_elem_t *elem)
+static int background_elem_callback(snd_mixer_elem_t *elem, unsigned int mask)
+{
+	if (mask == SND_CTL_EVENT_MASK_REMOVE || (mask & SND_CTL_EVENT_MASK_INFO))
+		volume_mapping_invalidate(elem);
+	return 0;
+}
+
+static int mixer_callback(snd_mixer_t *m, unsigned int mask, snd_mixer_elem_t *elem)
 {
 	if (mask & SND_CTL_EVENT_MASK_ADD) {
-		snd_mixer_elem_set_callback(elem, elem_callback);
-		controls_changed = TRUE;
+		if (m == mixer) {
+			snd_mixer_elem_set_callback(elem, elem_callback);
+			controls_changed = TRUE;
+		} else {
+			snd_mixer_elem_set_callback(elem, background_elem_callback);
+		}
 	}
 	return 0;
 }
 
-void create_mixer_object(struct snd_mixer_selem_regopt *selem_regopt)
+static void set_elem_callbacks(snd_mixer_t *m, snd_mixer_elem_callback_t callback)
+{
+	snd_mixer_elem_t *elem;
+
+	for (elem = snd_mixer_first_elem(m); elem; elem = snd_mixer_elem_next(elem))
+		snd_mixer_elem_set_callback(elem, callback);
+}
+
+static struct mixer_card *find_mixer_card(const char *device_name)
+{
+	struct mixer_card *card;
+
+	for (card = mixer_cards; card; card = card->next)
+		if (!strcmp(card->device_name, device_name))
+			return card;
+	return NULL;
+}
+
+static int open_mixer_card(const char *device_name, struct mixer_card **cardp)
 {
+	struct snd_mixer_selem_regopt regopt = mixer_regopt;
+	struct mixer_card *card;
+	snd_mixer_t *m;
 	int err;
 
-	err = snd_mixer_open(&mixer, 0);
+	err = snd_mixer_open(&m, 0);
 	if (err < 0)
-		fatal_alsa_error(_("cannot open mixer"), err);
+		return err;
+	regopt.device = device_name;
+	err = snd_mixer_selem_register(m, &regopt, NULL);
+	if (err < 0) {
+		snd_mixer_close(m);
+		return err;
+	}
+	snd_mixer_set_callback(m, mixer_callback);
+	err = snd_mixer_load(m);
+	if (err < 0)
+		fatal_alsa_error(_("cannot load mixer controls"), err);
+
+	card = ccalloc(1, sizeof *card);
+	card->mixer = m;
+	card->device_name = cstrdup(device_name);
+	card->next = mixer_cards;
+	mixer_cards = card;
+	*cardp = card;
+	return 0;
+}
+
+static void select_mixer_card(struct mixer_card *card)
+{
+	if (current_card)
+		set_elem_callbacks(current_card->mixer, background_elem_callback);
+	current_card = card;
+	if (card) {
+		mixer = card->mixer;
+		mixer_device_name = card->device_name;
+		set_elem_callbacks(mixer, elem_callback);
+	} else {
+		mixer = no_card_mixer;
+		mixer_device_name = NULL;
+	}
+}
 
-	mixer_device_name = cstrdup(selem_regopt->device);
-	err = snd_mixer_selem_register(mixer, selem_regopt, NULL);
+static void free_mixer_card(struct mixer_card *card)
+{
+	struct mixer_card **p;
+
+	if (card == current_card)
+		select_mixer_card(NULL);
+	for (p = &mixer_cards; *p != card; p = &(*p)->next)
+		;
+	*p = card->next;
+	volume_mapping_clear();
+	snd_mixer_close(card->mixer);
+	free(card->device_name);
+	free(card);
+}
+
+void create_mixer_object(struct snd_mixer_selem_regopt *selem_regopt)
+{
+	struct mixer_card *card;
+	int err;
+
+	err = snd_mixer_open(&no_card_mixer, 0);
 	if (err < 0)
 		fatal_alsa_error(_("cannot open mixer"), err);
 
-	snd_mixer_set_callback(mixer, mixer_callback);
-
-	err = snd_mixer_load(mixer);
+	mixer_regopt = *selem_regopt;
+	err = open_mixer_card(selem_regopt->device, &card);
 	if (err < 0)
-		fatal_alsa_error(_("cannot load mixer controls"), err);
+		fatal_alsa_error(_("cannot open mixer"), err);
+	select_mixer_card(card);
 
 	err = snd_mixer_selem_id_malloc(&current_selem_id);
 	if (err < 0)
 		fatal_error("out of memory");
 }
 
+int mixer_poll_descriptors_count(void)
+{
+	struct mixer_card *card;
+	int count = 0, n;
+
+	for (card = mixer_cards; card; card = card->next) {
+		n = snd_mixer_poll_descriptors_count(card->mixer);
+		if (n < 0)
+			return n;
+		count += n;
+	}
+	return count;
+}
+
+int mixer_poll_descriptors(struct pollfd *pfds, unsigned int space)
+{
+	struct mixer_card *card;
+	int n, count = 0;
+
+	for (card = mixer_cards; card; card = card->next) {
+		n = snd_mixer_poll_descriptors(card->mixer, pfds, space);
+		if (n < 0)
+			return n;
+		card->pollfds_count = n;
+		pfds += n;
+		space -= n;
+		count += n;
+	}
+	return count;
+}
+
+/* the descriptors as filled by mixer_poll_descriptors() */
+void mixer_handle_poll_events(struct pollfd *pfds)
+{
+	struct mixer_card *card, *next;
+	unsigned short revents;
+	int err;
+
+	for (card = mixer_cards; card; card = next) {
+		next = card->next;
+		err = snd_mixer_poll_descriptors_revents(card->mixer, pfds,
+							 card->pollfds_count, &revents);
+		pfds += card->pollfds_count;
+		if (err < 0)
+			fatal_alsa_error("cannot get poll events", err);
+		if (revents & (POLLERR | POLLNVAL)) {
+			if (card == current_card)
+				close_mixer_device();
+			else
+				free_mixer_card(card);
+		} else if (revents & POLLIN) {
+			snd_mixer_handle_events(card->mixer);
+		}
+	}
+}
+
 static void set_view_mode(enum view_mode m)
 {
 	view_mode = m;
@@ -115,11 +281,8 @@ static void set_view_mode(enum view_mode m)
 static void close_hctl(void)
 {
 	free_controls();
-	if (mixer_device_name) {
-		snd_mixer_detach(mixer, mixer_device_name);
-		free(mixer_device_name);
-		mixer_device_name = NULL;
-	}
+	if (current_card)
+		free_mixer_card(current_card);
 }
 
 static void check_unplugged(void)
@@ -153,16 +316,18 @@ void close_mixer_device(void)
 
 bool select_card_by_name(const char *device_name)
 {
+	struct mixer_card *card = NULL;
 	int err;
 	bool opened;
 	char *msg;
 
-	close_hctl();
-	unplugged = FALSE;
-
 	opened = FALSE;
 	if (device_name) {
-		err = snd_mixer_attach(mixer, device_name);
+		card = find_mixer_card(device_name);
+		if (card)
+			err = 0;
+		else
+			err = open_mixer_card(device_name, &card);
 		if (err >= 0)
 			opened = TRUE;
 		else {
@@ -171,13 +336,10 @@ bool select_card_by_name(const char *device_name)
 			free(msg);
 		}
 	}
-	if (opened) {
-		mixer_device_name = cstrdup(device_name);
 
-		err = snd_mixer_load(mixer);
-		if (err < 0)
-			fatal_alsa_error(_("cannot load mixer controls"), err);
-	}
+	free_controls();
+	unplugged = FALSE;
+	select_mixer_card(opened ? card : NULL);
 
 	display_card_info();
 	set_view_mode(view_mode);
@@ -650,8 +812,10 @@ static void on_close(void)
 void mixer_shutdown(void)
 {
 	free_controls();
-	if (mixer)
-		snd_mixer_close(mixer);
+	while (mixer_cards)
+		free_mixer_card(mixer_cards);
+	if (no_card_mixer)
+		snd_mixer_close(no_card_mixer);
 	if (current_selem_id)
 		snd_mixer_selem_id_free(current_selem_id);
 }
@@ -2,6 +2,7 @@
 #define MIXER_WIDGET_H_INCLUDED
 
 #include CURSESINC
+#include <poll.h>
 #include <alsa/asoundlib.h>
 #include "widget.h"
 
@@ -36,6 +37,9 @@ extern unsigned int mouse_wheel_step;
 extern bool mouse_wheel_focuses_control;
 
 void create_mixer_object(struct snd_mixer_selem_regopt *selem_regopt);
+int mixer_poll_descriptors_count(void);
+int mixer_poll_descriptors(struct pollfd *pfds, unsigned int space);
+void mixer_handle_poll_events(struct pollfd *pfds);
 void create_mixer_widget(void);
 void mixer_shutdown(void);
 void close_mixer_device(void);
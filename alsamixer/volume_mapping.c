@@ -34,6 +34,8 @@
 #include "aconfig.h"
 #include <math.h>
 #include <stdbool.h>
+#include <stdlib.h>
+#include <errno.h>
 #include "volume_mapping.h"
 
 #define MAX_LINEAR_DB_SCALE	24
@@ -79,42 +81,177 @@ static int (* const set_raw[2])(snd_mixer_elem_t *, snd_mixer_selem_channel_id_t
 	snd_mixer_selem_set_playback_volume,
 	snd_mixer_selem_set_capture_volume,
 };
+static int (* const set_dB_all[2])(snd_mixer_elem_t *, long, int) = {
+	snd_mixer_selem_set_playback_dB_all,
+	snd_mixer_selem_set_capture_dB_all,
+};
+static int (* const set_raw_all[2])(snd_mixer_elem_t *, long) = {
+	snd_mixer_selem_set_playback_volume_all,
+	snd_mixer_selem_set_capture_volume_all,
+};
+
+/*
+ * The dB range of each element is kept with a table of the normalized
+ * value for each raw value, so reading a volume costs no dB range query
+ * and no pow(). The entry is checked against the raw range on each use;
+ * the callers drop it on INFO and REMOVE events with
+ * volume_mapping_invalidate().
+ */
+#define MAX_TABLE_SIZE		4096
+#define VOL_MAP_HASH_SIZE	64
+
+struct vol_map {
+	struct vol_map *next;
+	snd_mixer_elem_t *elem;
+	enum ctl_dir ctl_dir;
+	long raw_min, raw_max;
+	bool has_dB;			/* false: the raw values are mapped */
+	long dB_min, dB_max;
+	double min_norm;		/* 0 for a muted minimum */
+	double *table;			/* NULL when the range is too large */
+};
+
+static struct vol_map *vol_maps[VOL_MAP_HASH_SIZE];
+
+static unsigned int vol_map_hash(snd_mixer_elem_t *elem)
+{
+	return ((unsigned long)elem >> 4) % VOL_MAP_HASH_SIZE;
+}
+
+void volume_mapping_invalidate(snd_mixer_elem_t *elem)
+{
+	struct vol_map **pm, *map;
+
+	pm = &vol_maps[vol_map_hash(elem)];
+	while ((map = *pm) != NULL) {
+		if (map->elem == elem) {
+			*pm = map->next;
+			free(map->table);
+			free(map);
+		} else {
+			pm = &map->next;
+		}
+	}
+}
+
+/* drop all entries, before the mixer handle is closed */
+void volume_mapping_clear(void)
+{
+	struct vol_map *map;
+	unsigned int i;
+
+	for (i = 0; i < VOL_MAP_HASH_SIZE; i++) {
+		while ((map = vol_maps[i]) != NULL) {
+			vol_maps[i] = map->next;
+			free(map->table);
+			free(map);
+		}
+	}
+}
+
+static double normalize_dB(const struct vol_map *map, long value)
+{
+	double normalized;
+
+	if (use_linear_dB_scale(map->dB_min, map->dB_max))
+		return (value - map->dB_min) / (double)(map->dB_max - map->dB_min);
+
+	normalized = pow(10, (value - map->dB_max) / 6000.0);
+	if (map->dB_min != SND_CTL_TLV_DB_GAIN_MUTE)
+		normalized = (normalized - map->min_norm) / (1 - map->min_norm);
+	return normalized;
+}
+
+static void vol_map_fill(struct vol_map *map)
+{
+	static int (* const ask_dB[2])(snd_mixer_elem_t *, long, long *) = {
+		snd_mixer_selem_ask_playback_vol_dB,
+		snd_mixer_selem_ask_capture_vol_dB,
+	};
+	long raw, value, size = map->raw_max - map->raw_min + 1;
+
+	if (size <= 0 || size > MAX_TABLE_SIZE)
+		return;
+	map->table = malloc(size * sizeof(double));
+	if (map->table == NULL)
+		return;
+	for (raw = map->raw_min; raw <= map->raw_max; raw++) {
+		if (ask_dB[map->ctl_dir](map->elem, raw, &value) < 0) {
+			free(map->table);
+			map->table = NULL;
+			return;
+		}
+		map->table[raw - map->raw_min] = normalize_dB(map, value);
+	}
+}
+
+static struct vol_map *get_vol_map(snd_mixer_elem_t *elem, enum ctl_dir ctl_dir)
+{
+	unsigned int hash = vol_map_hash(elem);
+	struct vol_map *map;
+	long min, max;
+
+	if (get_raw_range[ctl_dir](elem, &min, &max) < 0)
+		return NULL;
+	for (map = vol_maps[hash]; map; map = map->next) {
+		if (map->elem == elem && map->ctl_dir == ctl_dir)
+			break;
+	}
+	if (map && (map->raw_min != min || map->raw_max != max)) {
+		volume_mapping_invalidate(elem);
+		map = NULL;
+	}
+	if (map)
+		return map;
+
+	map = calloc(1, sizeof(*map));
+	if (map == NULL)
+		return NULL;
+	map->elem = elem;
+	map->ctl_dir = ctl_dir;
+	map->raw_min = min;
+	map->raw_max = max;
+	if (get_dB_range[ctl_dir](elem, &map->dB_min, &map->dB_max) >= 0 &&
+	    map->dB_min < map->dB_max) {
+		map->has_dB = true;
+		if (map->dB_min != SND_CTL_TLV_DB_GAIN_MUTE)
+			map->min_norm = pow(10, (map->dB_min - map->dB_max) / 6000.0);
+		vol_map_fill(map);
+	}
+	map->next = vol_maps[hash];
+	vol_maps[hash] = map;
+	return map;
+}
 
 static double get_normalized_volume(snd_mixer_elem_t *elem,
 				    snd_mixer_selem_channel_id_t channel,
 				    enum ctl_dir ctl_dir)
 {
-	long min, max, value;
-	double normalized, min_norm;
+	struct vol_map *map;
+	long value;
 	int err;
 
-	err = get_dB_range[ctl_dir](elem, &min, &max);
-	if (err < 0 || min >= max) {
-		err = get_raw_range[ctl_dir](elem, &min, &max);
-		if (err < 0 || min == max)
+	map = get_vol_map(elem, ctl_dir);
+	if (map == NULL)
+		return 0;
+	if (!map->has_dB || map->table) {
+		if (map->raw_min == map->raw_max)
 			return 0;
 
 		err = get_raw[ctl_dir](elem, channel, &value);
 		if (err < 0)
 			return 0;
 
-		return (value - min) / (double)(max - min);
+		if (map->table && value >= map->raw_min && value <= map->raw_max)
+			return map->table[value - map->raw_min];
+		return (value - map->raw_min) / (double)(map->raw_max - map->raw_min);
 	}
 
 	err = get_dB[ctl_dir](elem, channel, &value);
 	if (err < 0)
 		return 0;
 
-	if (use_linear_dB_scale(min, max))
-		return (value - min) / (double)(max - min);
-
-	normalized = pow(10, (value - max) / 6000.0);
-	if (min != SND_CTL_TLV_DB_GAIN_MUTE) {
-		min_norm = pow(10, (min - max) / 6000.0);
-		normalized = (normalized - min_norm) / (1 - min_norm);
-	}
-
-	return normalized;
+	return normalize_dB(map, value);
 }
 
 static int set_normalized_volume(snd_mixer_elem_t *elem,
@@ -123,30 +260,30 @@ static int set_normalized_volume(snd_mixer_elem_t *elem,
 				 int dir,
 				 enum ctl_dir ctl_dir)
 {
-	long min, max, value;
-	double min_norm;
-	int err;
+	struct vol_map *map;
+	long value;
 
-	err = get_dB_range[ctl_dir](elem, &min, &max);
-	if (err < 0 || min >= max) {
-		err = get_raw_range[ctl_dir](elem, &min, &max);
-		if (err < 0)
-			return err;
-
-		value = lrint_dir(volume * (max - min), dir) + min;
+	map = get_vol_map(elem, ctl_dir);
+	if (map == NULL)
+		return -ENOMEM;
+	if (!map->has_dB) {
+		value = lrint_dir(volume * (map->raw_max - map->raw_min), dir) + map->raw_min;
+		if (channel == SND_MIXER_SCHN_UNKNOWN)
+			return set_raw_all[ctl_dir](elem, value);
 		return set_raw[ctl_dir](elem, channel, value);
 	}
 
-	if (use_linear_dB_scale(min, max)) {
-		value = lrint_dir(volume * (max - min), dir) + min;
-		return set_dB[ctl_dir](elem, channel, value, dir);
+	if (use_linear_dB_scale(map->dB_min, map->dB_max)) {
+		value = lrint_dir(volume * (map->dB_max - map->dB_min), dir) + map->dB_min;
+		goto set;
 	}
 
-	if (min != SND_CTL_TLV_DB_GAIN_MUTE) {
-		min_norm = pow(10, (min - max) / 6000.0);
-		volume = volume * (1 - min_norm) + min_norm;
-	}
-	value = lrint_dir(6000.0 * log10(volume), dir) + max;
+	if (map->dB_min != SND_CTL_TLV_DB_GAIN_MUTE)
+		volume = volume * (1 - map->min_norm) + map->min_norm;
+	value = lrint_dir(6000.0 * log10(volume), dir) + map->dB_max;
+ set:
+	if (channel == SND_MIXER_SCHN_UNKNOWN)
+		return set_dB_all[ctl_dir](elem, value, dir);
 	return set_dB[ctl_dir](elem, channel, value, dir);
 }
 
@@ -177,3 +314,18 @@ int set_normalized_capture_volume(snd_mixer_elem_t *elem,
 {
 	return set_normalized_volume(elem, channel, volume, dir, CAPTURE);
 }
+
+/* set all channels of the element with a single write */
+int set_normalized_playback_volume_all(snd_mixer_elem_t *elem,
+				       double volume,
+				       int dir)
+{
+	return set_normalized_volume(elem, SND_MIXER_SCHN_UNKNOWN, volume, dir, PLAYBACK);
+}
+
+int set_normalized_capture_volume_all(snd_mixer_elem_t *elem,
+				      double volume,
+				      int dir)
+{
+	return set_normalized_volume(elem, SND_MIXER_SCHN_UNKNOWN, volume, dir, CAPTURE);
+}
@@ -15,5 +15,13 @@ int set_normalized_capture_volume(snd_mixer_elem_t *elem,
 				  snd_mixer_selem_channel_id_t channel,
 				  double volume,
 				  int dir);
+int set_normalized_playback_volume_all(snd_mixer_elem_t *elem,
+				       double volume,
+				       int dir);
+int set_normalized_capture_volume_all(snd_mixer_elem_t *elem,
+				      double volume,
+				      int dir);
+void volume_mapping_invalidate(snd_mixer_elem_t *elem);
+void volume_mapping_clear(void);
 
 #endif
@@ -18,7 +18,10 @@
  */
 
 #include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
 #include <string.h>
+#include <errno.h>
 #include <alsa/asoundlib.h>
 #include <alsa/use-case.h>
 #include "usecase.h"
@@ -53,6 +56,7 @@ struct renderer {
 	int (*value_begin)(struct renderer *r);
 	int (*value_end)(struct renderer *r);
 	int (*value)(struct renderer *r, const char *ident, const char *value);
+	FILE *out;
 	void *opaque;
 };
 
@@ -96,15 +100,15 @@ static char *tesc(const char *s, char *buf, size_t buf_len)
 static int text_verb_start(struct renderer *r, const char *verb, const char *comment)
 {
 	char buf1[128], buf2[128];
-	printf("Verb.%s {\n", ESC(verb, buf1));
+	fprintf(r->out, "Verb.%s {\n", ESC(verb, buf1));
 	if (comment && comment[0])
-		printf("\tComment %s\n", ESC(comment, buf2));
+		fprintf(r->out, "\tComment %s\n", ESC(comment, buf2));
 	return 0;
 }
 
 static int text_verb_end(struct renderer *r)
 {
-	printf("}\n");
+	fprintf(r->out, "}\n");
 	return 0;
 }
 
@@ -114,27 +118,27 @@ static int text_2nd_level_begin(struct renderer *r,
 				const char *comment)
 {
 	char buf1[128], buf2[128];
-	printf("\t%s.%s {\n", key, ESC(val, buf1));
+	fprintf(r->out, "\t%s.%s {\n", key, ESC(val, buf1));
 	if (comment && comment[0])
-		printf("\t\tComment %s\n", ESC(comment, buf2));
+		fprintf(r->out, "\t\tComment %s\n", ESC(comment, buf2));
 	return 0;
 }
 
 static int text_2nd_level_end(struct renderer *r)
 {
-	printf("\t}\n");
+	fprintf(r->out, "\t}\n");
 	return 0;
 }
 
 static int text_2nd_level(struct renderer *r, const char *txt)
 {
-	printf("\t\t%s", txt);
+	fprintf(r->out, "\t\t%s", txt);
 	return 0;
 }
 
 static int text_3rd_level(struct renderer *r, const char *txt)
 {
-	printf("\t\t\t%s", txt);
+	fprintf(r->out, "\t\t\t%s", txt);
 	return 0;
 }
 
@@ -152,7 +156,7 @@ static int text_supcon_start(struct renderer *r, const char *key)
 {
 	if (text_2nd_level(r, key))
 		return 1;
-	printf(" [\n");
+	fprintf(r->out, " [\n");
 	return 0;
 }
 
@@ -164,7 +168,7 @@ static int text_supcon_value(struct renderer *r, const char *value, int last)
 		strcat(buf, ",");
 	if (text_3rd_level(r, buf))
 		return 1;
-	printf("\n");
+	fprintf(r->out, "\n");
 	return 0;
 }
 
@@ -203,7 +207,7 @@ static int text_value(struct renderer *r, const char *ident, const char *value)
 	if (err < 0)
 		return err;
 	ESC(value, buf2);
-	printf(" %s\n", buf2);
+	fprintf(r->out, " %s\n", buf2);
 	return 0;
 }
 
@@ -262,30 +266,30 @@ static char *jesc(const char *s, char *buf, size_t buf_len)
 static void json_block(struct renderer *r, int level, int last)
 {
 	struct json *j = r->opaque;
-	printf((j->block[level] && !last) ? ",\n" : "\n");
+	fprintf(r->out, (j->block[level] && !last) ? ",\n" : "\n");
 	j->block[level] = last ? 0 : 1;
 }
 
 static int json_init(struct renderer *r)
 {
-	printf("{\n  \"Verbs\": {");
+	fprintf(r->out, "{\n  \"Verbs\": {");
 	return 0;
 }
 
 static void json_done(struct renderer *r)
 {
 	json_block(r, 0, 1);
-	printf("  }\n}\n");
+	fprintf(r->out, "  }\n}\n");
 }
 
 static int json_verb_start(struct renderer *r, const char *verb, const char *comment)
 {
 	char buf[256];
 	json_block(r, 0, 0);
-	printf("    %s: {", JESC(verb, buf));
+	fprintf(r->out, "    %s: {", JESC(verb, buf));
 	if (comment && comment[0]) {
 		json_block(r, 1, 0);
-		printf("      \"Comment\": %s", JESC(comment, buf));
+		fprintf(r->out, "      \"Comment\": %s", JESC(comment, buf));
 	}
 	return 0;
 }
@@ -293,14 +297,14 @@ static int json_verb_start(struct renderer *r, const char *verb, const char *com
 static int json_verb_end(struct renderer *r)
 {
 	json_block(r, 1, 1);
-	printf("    }");
+	fprintf(r->out, "    }");
 	return 0;
 }
 
 static int json_2nd_level_block_end(struct renderer *r)
 {
 	json_block(r, 2, 1);
-	printf("      }");
+	fprintf(r->out, "      }");
 	return 0;
 }
 
@@ -310,10 +314,10 @@ static int json_2nd_level_begin(struct renderer *r,
 {
 	char buf[256];
 	json_block(r, 2, 0);
-	printf("        %s: {", JESC(val, buf));
+	fprintf(r->out, "        %s: {", JESC(val, buf));
 	if (comment && comment[0]) {
 		json_block(r, 3, 0);
-		printf("          \"Comment\": %s", JESC(comment, buf));
+		fprintf(r->out, "          \"Comment\": %s", JESC(comment, buf));
 	}
 	return 0;
 }
@@ -321,33 +325,33 @@ static int json_2nd_level_begin(struct renderer *r,
 static int json_2nd_level_end(struct renderer *r)
 {
 	json_block(r, 3, 1);
-	printf("        }");
+	fprintf(r->out, "        }");
 	return 0;
 }
 
 static int json_2nd_level(struct renderer *r, const char *txt)
 {
-	printf("          %s", txt);
+	fprintf(r->out, "          %s", txt);
 	return 0;
 }
 
 static int json_3rd_level(struct renderer *r, const char *txt)
 {
-	printf("            %s", txt);
+	fprintf(r->out, "            %s", txt);
 	return 0;
 }
 
 static int json_dev_block_start(struct renderer *r)
 {
 	json_block(r, 1, 0);
-	printf("      \"Devices\": {");
+	fprintf(r->out, "      \"Devices\": {");
 	return 0;
 }
 
 static int json_mod_block_start(struct renderer *r)
 {
 	json_block(r, 1, 0);
-	printf("      \"Modifiers\": {");
+	fprintf(r->out, "      \"Modifiers\": {");
 	return 0;
 }
 
@@ -356,7 +360,7 @@ static int json_supcon_start(struct renderer *r, const char *key)
 	json_block(r, 3, 0);
 	if (json_2nd_level(r, key))
 		return 1;
-	printf(": [");
+	fprintf(r->out, ": [");
 	return 0;
 }
 
@@ -407,7 +411,7 @@ static int json_value(struct renderer *r, const char *ident, const char *value)
 	if (err < 0)
 		return err;
 	JESC(value, buf);
-	printf(": %s", buf);
+	fprintf(r->out, ": %s", buf);
 	return 0;
 }
 
@@ -437,189 +441,277 @@ static struct renderer json_renderer = {
 
 /*
  * universal dump functions
+ *
+ * All lists and values are gathered into the model first, so the
+ * renderers only walk memory, and the output is written to a memory
+ * stream and sent to stdout at once.
  */
 
-static int render_devlist(struct context *context,
-			  struct renderer *render,
-			  const char *verb,
-			  const char *device,
-			  const char *list,
-			  int (*begin)(struct renderer *),
-			  int (*value)(struct renderer *, const char *value, int last),
-			  int (*end)(struct renderer *))
+struct dump_list {
+	const char **list;
+	int num;
+};
+
+struct dump_device {
+	struct dump_list supported;
+	struct dump_list conflicting;
+	struct dump_list idents;
+	const char **values;
+};
+
+struct dump_verb {
+	const char *verb;
+	const char *comment;
+	struct dump_list devices;	/* device + comment pairs */
+	struct dump_list modifiers;	/* modifier + comment pairs */
+	struct dump_device *dev;
+};
+
+struct dump_model {
+	struct dump_list verbs;
+	struct dump_verb *verb;
+};
+
+static void free_list(struct dump_list *l)
+{
+	if (l->list)
+		snd_use_case_free_list(l->list, l->num);
+	l->list = NULL;
+	l->num = 0;
+}
+
+static int get_list(struct context *context, struct dump_list *l,
+		    const char *fmt, ...)
 {
-	snd_use_case_mgr_t *uc_mgr = context->uc_mgr;
-	const char **dev_list;
 	char buf[256];
-	int err = 0, j, dev_num;
-
-	snprintf(buf, sizeof(buf), "%s/%s/%s", list, device, verb);
-	dev_num = snd_use_case_get_list(uc_mgr, buf, &dev_list);
-	if (dev_num < 0) {
-		fprintf(stderr, "%s: unable to get %s for verb '%s' for device '%s'\n",
-			context->command, list, verb, device);
-		return dev_num;
+	va_list ap;
+
+	va_start(ap, fmt);
+	vsnprintf(buf, sizeof(buf), fmt, ap);
+	va_end(ap);
+	l->num = snd_use_case_get_list(context->uc_mgr, buf, &l->list);
+	if (l->num < 0) {
+		l->list = NULL;
+		return l->num;
 	}
-	if (dev_num > 0) {
-		err = begin(render);
-		if (err < 0)
-			goto __err;
-		for (j = 0; j < dev_num; j++) {
-			err = value(render, dev_list[j], j + 1 == dev_num);
+	return 0;
+}
+
+static void free_device(struct dump_device *d)
+{
+	int j;
+
+	if (d->values) {
+		for (j = 0; j < d->idents.num; j++)
+			free((char *)d->values[j]);
+		free(d->values);
+	}
+	free_list(&d->supported);
+	free_list(&d->conflicting);
+	free_list(&d->idents);
+}
+
+static void free_model(struct dump_model *m)
+{
+	struct dump_verb *v;
+	int i, j;
+
+	for (i = 0; m->verb && i < m->verbs.num / 2; i++) {
+		v = &m->verb[i];
+		for (j = 0; v->dev && j < v->devices.num / 2; j++)
+			free_device(&v->dev[j]);
+		free(v->dev);
+		free_list(&v->devices);
+		free_list(&v->modifiers);
+	}
+	free(m->verb);
+	free_list(&m->verbs);
+}
+
+static int gather_device(struct context *context, struct dump_device *d,
+			 const char *verb, const char *device)
+{
+	int err, j;
+
+	err = get_list(context, &d->supported, "_supporteddevs/%s/%s", device, verb);
+	if (err < 0) {
+		fprintf(stderr, "%s: unable to get _supporteddevs for verb '%s' for device '%s'\n",
+			context->command, verb, device);
+		return err;
+	}
+	err = get_list(context, &d->conflicting, "_conflictingdevs/%s/%s", device, verb);
+	if (err < 0) {
+		fprintf(stderr, "%s: unable to get _conflictingdevs for verb '%s' for device '%s'\n",
+			context->command, verb, device);
+		return err;
+	}
+	err = get_list(context, &d->idents, "_identifiers/%s/%s", device, verb);
+	if (err < 0) {
+		fprintf(stderr, "%s: unable to get _identifiers for verb '%s' for device '%s': %s\n",
+			context->command, verb, device, snd_strerror(err));
+		return err;
+	}
+	if (d->idents.num == 0)
+		return 0;
+	d->values = calloc(d->idents.num, sizeof(*d->values));
+	if (d->values == NULL)
+		return -ENOMEM;
+	for (j = 0; j < d->idents.num; j++) {
+		char buf[256];
+
+		snprintf(buf, sizeof(buf), "%s/%s/%s", d->idents.list[j], device, verb);
+		err = snd_use_case_get(context->uc_mgr, buf, &d->values[j]);
+		if (err < 0) {
+			fprintf(stderr, "%s: unable to get value '%s' for verb '%s' for device '%s': %s\n",
+				context->command, d->idents.list[j], verb, device, snd_strerror(err));
+			d->values[j] = NULL;
+			return err;
+		}
+	}
+	return 0;
+}
+
+static int gather(struct context *context, struct dump_model *m)
+{
+	struct dump_verb *v;
+	int i, j, err;
+
+	m->verbs.num = snd_use_case_verb_list(context->uc_mgr, &m->verbs.list);
+	if (m->verbs.num < 0) {
+		fprintf(stderr, "%s: no verbs found\n", context->command);
+		return m->verbs.num;
+	}
+	m->verb = calloc(m->verbs.num / 2 + 1, sizeof(*m->verb));
+	if (m->verb == NULL)
+		return -ENOMEM;
+	for (i = 0; i < m->verbs.num / 2; i++) {
+		v = &m->verb[i];
+		v->verb = m->verbs.list[i * 2 + 0];
+		v->comment = m->verbs.list[i * 2 + 1];
+		/* a verb without devices or modifiers lists is dumped empty */
+		if (get_list(context, &v->devices, "_devices/%s", v->verb) < 0)
+			fprintf(stderr, "%s: unable to get devices for verb '%s'\n",
+				context->command, v->verb);
+		if (get_list(context, &v->modifiers, "_modifiers/%s", v->verb) < 0)
+			fprintf(stderr, "%s: unable to get modifiers for verb '%s'\n",
+				context->command, v->verb);
+		v->dev = calloc(v->devices.num / 2 + 1, sizeof(*v->dev));
+		if (v->dev == NULL)
+			return -ENOMEM;
+		for (j = 0; j < v->devices.num / 2; j++) {
+			err = gather_device(context, &v->dev[j], v->verb,
+					    v->devices.list[j * 2]);
 			if (err < 0)
-				goto __err;
+				return err;
 		}
-		err = end(render);
 	}
-__err:
-	snd_use_case_free_list(dev_list, dev_num);
-	return err;
+	return 0;
 }
 
-static int render_values(struct context *context,
-			 struct renderer *render,
-			 const char *verb,
-			 const char *device)
+static int render_devlist(struct renderer *render,
+			  const struct dump_list *l,
+			  int (*begin)(struct renderer *),
+			  int (*value)(struct renderer *, const char *value, int last),
+			  int (*end)(struct renderer *))
 {
-	snd_use_case_mgr_t *uc_mgr = context->uc_mgr;
-	const char **list, *value;
-	char buf[256];
-	int err = 0, j, num;
+	int err, j;
 
-	snprintf(buf, sizeof(buf), "_identifiers/%s/%s", device, verb);
-	num = snd_use_case_get_list(uc_mgr, buf, &list);
-	if (num < 0) {
-		fprintf(stderr, "%s: unable to get _identifiers for verb '%s' for device '%s': %s\n",
-			context->command, verb, device, snd_strerror(num));
-		return num;
+	if (l->num <= 0)
+		return 0;
+	err = begin(render);
+	if (err < 0)
+		return err;
+	for (j = 0; j < l->num; j++) {
+		err = value(render, l->list[j], j + 1 == l->num);
+		if (err < 0)
+			return err;
 	}
-	if (num == 0)
-		goto __err;
+	return end(render);
+}
+
+static int render_values(struct renderer *render, const struct dump_device *d)
+{
+	int err, j;
+
+	if (d->idents.num <= 0)
+		return 0;
 	if (render->value_begin) {
 		err = render->value_begin(render);
 		if (err < 0)
-			goto __err;
+			return err;
 	}
-	for (j = 0; j < num; j++) {
-		snprintf(buf, sizeof(buf), "%s/%s/%s", list[j], device, verb);
-		err = snd_use_case_get(uc_mgr, buf, &value);
-		if (err < 0) {
-			fprintf(stderr, "%s: unable to get value '%s' for verb '%s' for device '%s': %s\n",
-				context->command, list[j], verb, device, snd_strerror(err));
-			goto __err;
-		}
-		err = render->value(render, list[j], value);
-		free((char *)value);
+	for (j = 0; j < d->idents.num; j++) {
+		err = render->value(render, d->idents.list[j], d->values[j]);
 		if (err < 0)
-			goto __err;
+			return err;
 	}
 	if (render->value_end)
-		err = render->value_end(render);
-__err:
-	snd_use_case_free_list(list, num);
-	return err;
+		return render->value_end(render);
+	return 0;
 }
 
-static int render_device(struct context *context,
-			 struct renderer *render,
-			 const char *verb,
-			 const char *device)
+static int render_device(struct renderer *render, const struct dump_device *d)
 {
 	int err;
 
-	err = render_devlist(context, render, verb, device,
-			     "_supporteddevs",
+	err = render_devlist(render, &d->supported,
 			     render->supported_begin,
 			     render->supported_value,
 			     render->supported_end);
 	if (err < 0)
 		return err;
-	err = render_devlist(context, render, verb, device,
-			     "_conflictingdevs",
+	err = render_devlist(render, &d->conflicting,
 			     render->conflict_begin,
 			     render->conflict_value,
 			     render->conflict_end);
 	if (err < 0)
 		return err;
-	return render_values(context, render, verb, device);
+	return render_values(render, d);
 }
 
-static void render(struct context *context, struct renderer *render)
+static void render(struct dump_model *m, struct renderer *render)
 {
-	snd_use_case_mgr_t *uc_mgr = context->uc_mgr;
-	int i, j, num, dev_num;
-	const char **list, **dev_list, *verb, *comment;
-	char buf[256];
+	struct dump_verb *v;
+	int i, j;
 
-	num = snd_use_case_verb_list(uc_mgr, &list);
-	if (num < 0) {
-		fprintf(stderr, "%s: no verbs found\n", context->command);
-		return;
-	}
 	if (render->init && render->init(render))
-		goto __end;
-	for (i = 0; i < num; i += 2) {
-		/* verb */
-		verb = list[i + 0];
-		comment = list[i + 1];
-		if (render->verb_begin(render, verb, comment))
+		return;
+	for (i = 0; i < m->verbs.num / 2; i++) {
+		v = &m->verb[i];
+		if (render->verb_begin(render, v->verb, v->comment))
 			break;
 		/* devices */
-		snprintf(buf, sizeof(buf), "_devices/%s", verb);
-		dev_num = snd_use_case_get_list(uc_mgr, buf, &dev_list);
-		if (dev_num < 0) {
-			fprintf(stderr, "%s: unable to get devices for verb '%s'\n",
-							context->command, verb);
-			continue;
-		}
-		if (dev_num == 0)
-			goto __mods;
-		if (render->device_block_begin && render->device_block_begin(render)) {
-			snd_use_case_free_list(dev_list, dev_num);
-			goto __end;
-		}
-		for (j = 0; j < dev_num; j += 2) {
-			render->device_begin(render, dev_list[j + 0], dev_list[j + 1]);
-			if (render_device(context, render, verb, dev_list[j + 0])) {
-				snd_use_case_free_list(dev_list, dev_num);
-				goto __end;
+		if (v->devices.num > 0) {
+			if (render->device_block_begin && render->device_block_begin(render))
+				return;
+			for (j = 0; j < v->devices.num; j += 2) {
+				render->device_begin(render, v->devices.list[j + 0],
+						     v->devices.list[j + 1]);
+				if (render_device(render, &v->dev[j / 2]))
+					return;
+				render->device_end(render);
 			}
-			render->device_end(render);
+			if (render->device_block_end && render->device_block_end(render))
+				return;
 		}
-		snd_use_case_free_list(dev_list, dev_num);
-		if (render->device_block_end && render->device_block_end(render))
-			goto __end;
-__mods:
 		/* modifiers */
-		snprintf(buf, sizeof(buf), "_modifiers/%s", verb);
-		dev_num = snd_use_case_get_list(uc_mgr, buf, &dev_list);
-		if (dev_num < 0) {
-			fprintf(stderr, "%s: unable to get modifiers for verb '%s'\n",
-							context->command, verb);
-			continue;
-		}
-		if (dev_num == 0)
-			goto __verb_end;
-		if (render->modifier_block_begin && render->modifier_block_begin(render)) {
-			snd_use_case_free_list(dev_list, dev_num);
-			goto __end;
-		}
-		for (j = 0; j < dev_num; j += 2) {
-			render->modifier_begin(render, dev_list[j + 0], dev_list[j + 1]);
-			render->modifier_end(render);
+		if (v->modifiers.num > 0) {
+			if (render->modifier_block_begin && render->modifier_block_begin(render))
+				return;
+			for (j = 0; j < v->modifiers.num; j += 2) {
+				render->modifier_begin(render, v->modifiers.list[j + 0],
+						       v->modifiers.list[j + 1]);
+				render->modifier_end(render);
+			}
+			if (render->modifier_block_end && render->modifier_block_end(render))
+				return;
 		}
-		snd_use_case_free_list(dev_list, dev_num);
-		if (render->modifier_block_end && render->modifier_block_end(render))
-			goto __end;
-__verb_end:
 		/* end */
 		if (render->verb_end(render))
 			break;
 	}
 	if (render->done)
 		render->done(render);
-__end:
-	snd_use_case_free_list(list, num);
 }
 
 void dump(struct context *context, const char *format)
@@ -640,7 +732,24 @@ void dump(struct context *context, const char *format)
 		r.opaque = &j;
 	}
 	if (r.opaque != NULL) {
-		render(context, &r);
+		struct dump_model m;
+		char *text = NULL;
+		size_t size = 0;
+
+		memset(&m, 0, sizeof(m));
+		if (gather(context, &m) < 0)
+			goto __free;
+		r.out = open_memstream(&text, &size);
+		if (r.out == NULL) {
+			fprintf(stderr, "%s: %s\n", context->command, strerror(errno));
+			goto __free;
+		}
+		render(&m, &r);
+		if (fclose(r.out) == 0)
+			fwrite(text, 1, size, stdout);
+		free(text);
+__free:
+		free_model(&m);
 		return;
 	}
 	fprintf(stderr, "%s: unknown dump format '%s'\n",
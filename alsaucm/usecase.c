@@ -36,6 +36,10 @@
 #include <unistd.h>
 #include <signal.h>
 #include <getopt.h>
+#include <errno.h>
+#include <time.h>
+#include <sys/socket.h>
+#include <sys/un.h>
 #include <alsa/asoundlib.h>
 #include <alsa/use-case.h>
 #include "usecase.h"
@@ -61,6 +65,7 @@ enum uc_cmd {
 	OM_GET_VAL,
 	OM_GETI,
 	OM_GETI_VAL,
+	OM_TOGGLE,
 
 	/* misc */
 	OM_HELP,
@@ -87,6 +92,7 @@ static struct cmd cmds[] = {
 	{ OM_GET_VAL, 1, 1, "getval" },
 	{ OM_GETI, 1, 1, "geti" },
 	{ OM_GETI_VAL, 1, 1, "getival" },
+	{ OM_TOGGLE, 5, 1, "toggle" },
 	{ OM_DUMP, 1, 1, "dump" },
 	{ OM_HELP, 0, 0, "help" },
 	{ OM_QUIT, 0, 0, "quit" },
@@ -107,6 +113,8 @@ static void dump_help(struct context *context)
 "  -i,--interactive           interactive mode\n"
 "  -b,--batch FILE            batch mode (use '-' for the stdin input)\n"
 "  -n,--no-open               do not open first card found\n"
+"  -s,--socket PATH           serve commands on the unix socket PATH\n"
+"  -t,--timing                print the time taken by each set command\n"
 "\nAvailable commands:\n"
 "  open NAME                  open card NAME\n"
 "  reset                      reset sound card to default state\n"
@@ -118,6 +126,9 @@ static void dump_help(struct context *context)
 "  get IDENTIFIER             get string value\n"
 "  geti IDENTIFIER            get integer value\n"
 "  set IDENTIFIER VALUE       set string value\n"
+"  toggle COUNT ID1 VAL1 ID2 VAL2\n"
+"                             set ID1=VAL1 and ID2=VAL2 COUNT times,\n"
+"                             report the latencies\n"
 "  h,help                     help\n"
 "  q,quit                     quit\n"
 );
@@ -179,6 +190,10 @@ static void my_exit(struct context *context, int exitcode)
 		free(context->card);
 	if (context->batch)
 		free(context->batch);
+	if (context->socket) {
+		unlink(context->socket);
+		free(context->socket);
+	}
 	free(context);
 	snd_config_update_free_global();
 	exit(exitcode);
@@ -213,10 +228,113 @@ static void do_initial_open(struct context *context)
 	}
 }
 
+static long long now_usec(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000LL + ts.tv_nsec / 1000;
+}
+
+/* snd_use_case_set() measured end to end, sequences included */
+static int timed_set(struct context *context, const char *identifier,
+		     const char *value, long long *usec)
+{
+	long long start;
+	int err;
+
+	start = now_usec();
+	err = snd_use_case_set(context->uc_mgr, identifier, value);
+	*usec = now_usec() - start;
+	if (err < 0)
+		fprintf(stderr, "%s: error failed to set %s=%s: %s\n",
+			context->command, identifier, value, snd_strerror(err));
+	return err;
+}
+
+static int cmp_usec(const void *a, const void *b)
+{
+	long long x = *(const long long *)a, y = *(const long long *)b;
+
+	return x < y ? -1 : (x > y ? 1 : 0);
+}
+
+#define HIST_BUCKETS	12	/* <1ms, <2ms, <4ms ... >=1024ms */
+
+static void report_latency(const char *identifier, const char *value,
+			   long long *usec, int count)
+{
+	int hist[HIST_BUCKETS] = { 0 };
+	long long sum = 0;
+	int i, b, peak = 0;
+
+	qsort(usec, count, sizeof(*usec), cmp_usec);
+	for (i = 0; i < count; i++) {
+		sum += usec[i];
+		for (b = 0; b < HIST_BUCKETS - 1; b++)
+			if (usec[i] < 1000LL << b)
+				break;
+		hist[b]++;
+	}
+	printf("%s=%s: %d runs, min %.3f ms, median %.3f ms, "
+	       "p95 %.3f ms, max %.3f ms, mean %.3f ms\n",
+	       identifier, value, count, usec[0] / 1000.0,
+	       usec[count / 2] / 1000.0, usec[(count * 95) / 100] / 1000.0,
+	       usec[count - 1] / 1000.0, sum / 1000.0 / count);
+	for (b = 0; b < HIST_BUCKETS; b++)
+		if (hist[b] > peak)
+			peak = hist[b];
+	for (b = 0; b < HIST_BUCKETS; b++) {
+		if (hist[b] == 0)
+			continue;
+		if (b < HIST_BUCKETS - 1)
+			printf("  < %5d ms %6d ", 1 << b, hist[b]);
+		else
+			printf("  >=%5d ms %6d ", 1 << (b - 1), hist[b]);
+		for (i = 0; i < (hist[b] * 40 + peak - 1) / peak; i++)
+			putchar('#');
+		putchar('\n');
+	}
+}
+
+/*
+ * Switch between two settings, e.g. two verbs or enabling and disabling
+ * a device, and report the latency of each direction.
+ */
+static int do_toggle(struct context *context, char **argv)
+{
+	long long *usec;
+	int i, count, err = 0;
+
+	count = atoi(argv[0]);
+	if (count <= 0) {
+		fprintf(stderr, "%s: invalid toggle count '%s'\n",
+			context->command, argv[0]);
+		return -EINVAL;
+	}
+	usec = malloc(2 * count * sizeof(*usec));
+	if (usec == NULL)
+		return -ENOMEM;
+	for (i = 0; i < count; i++) {
+		err = timed_set(context, argv[1], argv[2], &usec[i]);
+		if (err < 0)
+			goto __end;
+		err = timed_set(context, argv[3], argv[4], &usec[count + i]);
+		if (err < 0)
+			goto __end;
+	}
+	report_latency(argv[1], argv[2], usec, count);
+	report_latency(argv[3], argv[4], usec + count, count);
+__end:
+	free(usec);
+	return err;
+}
+
 static int do_one(struct context *context, struct cmd *cmd, char **argv)
 {
 	const char **list, *str;
 	long lval;
+	long long usec;
 	int err, i, j, entries;
 
 	if (cmd->opencard && context->uc_mgr == NULL) {
@@ -322,15 +440,15 @@ static int do_one(struct context *context, struct cmd *cmd, char **argv)
 		snd_use_case_free_list(list, err);
 		break;
 	case OM_SET:
-		err = snd_use_case_set(context->uc_mgr, argv[0], argv[1]);
-		if (err < 0) {
-			fprintf(stderr,
-				"%s: error failed to set %s=%s: %s\n",
-				context->command, argv[0], argv[1],
-				snd_strerror(err));
+		err = timed_set(context, argv[0], argv[1], &usec);
+		if (err < 0)
 			return err;
-		}
+		if (context->timing)
+			printf("set %s=%s: %.3f ms\n", argv[0], argv[1],
+			       usec / 1000.0);
 		break;
+	case OM_TOGGLE:
+		return do_toggle(context, argv);
 	case OM_GET:
 	case OM_GET_VAL:
 		err = snd_use_case_get(context->uc_mgr, argv[0], &str);
@@ -408,13 +526,103 @@ static int do_commands(struct context *context)
 	return 0;
 }
 
+/*
+ * Serve one client of the socket: the lines are the same commands as in
+ * the batch mode, their output goes to the client and each line is
+ * answered by "ok" or "error <code>". The use case manager stays open
+ * between the clients, so only the first command pays for the parsing
+ * of the configuration.
+ */
+static void serve_client(struct context *context, int fd)
+{
+	char line[MAX_BUF];
+	int out, errout, err;
+	FILE *in;
+
+	in = fdopen(fd, "r");
+	if (in == NULL) {
+		close(fd);
+		return;
+	}
+	fflush(stdout);
+	fflush(stderr);
+	out = dup(1);
+	errout = dup(2);
+	dup2(fd, 1);
+	dup2(fd, 2);
+
+	context->do_exit = 0;
+	while (!context->do_exit && fgets(line, sizeof(line), in) != NULL) {
+		err = parse_line(context, line);
+		if (err >= 0)
+			err = do_commands(context);
+		fflush(stderr);
+		if (err < 0)
+			printf("error %d\n", err);
+		else
+			printf("ok\n");
+		fflush(stdout);
+	}
+	context->do_exit = 0;
+
+	dup2(out, 1);
+	dup2(errout, 2);
+	close(out);
+	close(errout);
+	fclose(in);
+}
+
+static int serve_socket(struct context *context)
+{
+	struct sockaddr_un addr;
+	int fd, client;
+
+	if (strlen(context->socket) >= sizeof(addr.sun_path)) {
+		fprintf(stderr, "%s: socket path '%s' is too long\n",
+			context->command, context->socket);
+		return -EINVAL;
+	}
+	fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if (fd < 0) {
+		fprintf(stderr, "%s: unable to create socket: %s\n",
+			context->command, strerror(errno));
+		return -errno;
+	}
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	strcpy(addr.sun_path, context->socket);
+	unlink(context->socket);
+	if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0 ||
+	    listen(fd, 4) < 0) {
+		fprintf(stderr, "%s: unable to listen on '%s': %s\n",
+			context->command, context->socket, strerror(errno));
+		close(fd);
+		return -errno;
+	}
+	/* a client closing early must not kill the server */
+	signal(SIGPIPE, SIG_IGN);
+
+	for (;;) {
+		client = accept(fd, NULL, NULL);
+		if (client < 0) {
+			if (errno == EINTR)
+				continue;
+			fprintf(stderr, "%s: accept failed: %s\n",
+				context->command, strerror(errno));
+			close(fd);
+			return -errno;
+		}
+		serve_client(context, client);
+	}
+}
+
 enum {
 	OPT_VERSION = 1,
 };
 
 int main(int argc, char *argv[])
 {
-	static const char short_options[] = "hb:c:in";
+	static const char short_options[] = "hb:c:ins:t";
 	static const struct option long_options[] = {
 		{"help", 0, 0, 'h'},
 		{"version", 0, 0, OPT_VERSION},
@@ -422,6 +630,8 @@ int main(int argc, char *argv[])
 		{"interactive", 0, 0, 'i'},
 		{"batch", 1, 0, 'b'},
 		{"no-open", 0, 0, 'n'},
+		{"socket", 1, 0, 's'},
+		{"timing", 0, 0, 't'},
 		{0, 0, 0, 0}
 	};
 	struct context *context;
@@ -459,6 +669,13 @@ int main(int argc, char *argv[])
 		case 'n':
 			context->no_open = 1;
 			break;
+		case 's':
+			free(context->socket);
+			context->socket = strdup(optarg);
+			break;
+		case 't':
+			context->timing = 1;
+			break;
 		default:
 			fprintf(stderr, "Try '%s --help' for more information.\n", command);
 			my_exit(context, EXIT_FAILURE);
@@ -472,6 +689,14 @@ int main(int argc, char *argv[])
 		err = do_commands(context);
 		if (err < 0)
 			my_exit(context, EXIT_FAILURE);
+		/* the next parse_line() must not reallocate main's argv */
+		context->argv = NULL;
+		context->argc = 0;
+	}
+
+	if (context->socket) {
+		err = serve_socket(context);
+		my_exit(context, err < 0 ? EXIT_FAILURE : EXIT_SUCCESS);
 	}
 
 	if (!context->interactive && !context->batch)
@@ -25,9 +25,11 @@ struct context {
 	int argc;
 	int arga;
 	char *batch;
+	char *socket;
 	unsigned int interactive:1;
 	unsigned int no_open:1;
 	unsigned int do_exit:1;
+	unsigned int timing:1;
 };
 
 void dump(struct context *context, const char *format);
@@ -29,9 +29,11 @@
 #include <getopt.h>
 #include <errno.h>
 #include <signal.h>
+#include <time.h>
 #include <sys/timerfd.h>
 #include <sys/types.h>
 #include <poll.h>
+#include <stdint.h>
 #include <sys/stat.h>
 #include <unistd.h>
 #include <fcntl.h>
@@ -40,6 +42,11 @@
 #include "version.h"
 
 #define NSEC_PER_SEC 1000000000L
+#define SEND_CHUNK_SIZE (64 * 1024)
+
+#if defined(SND_LIB_VER) && SND_LIB_VER(1, 2, 6) <= SND_LIB_VERSION
+#define HAVE_RAWMIDI_TSTAMP 1
+#endif
 
 static int do_device_list, do_rawmidi_list;
 static char *port_name = "default";
@@ -48,11 +55,25 @@ static char *receive_file_name;
 static char *send_hex;
 static char *send_data;
 static int send_data_length;
+static int send_fd = -1;
 static int receive_file;
 static int dump;
 static float timeout;
 static int stop;
 static int sysex_interval;
+static size_t buffer_size;
+#ifdef HAVE_RAWMIDI_TSTAMP
+static int tstamp_clock = -1;		/* SND_RAWMIDI_CLOCK_*, -1 = off */
+static const char *tstamp_log_name;
+static FILE *tstamp_log;
+
+/* statistics of the packet inter-arrival times, in nanoseconds */
+static struct {
+	unsigned long count;
+	long long last;
+	double sum, sum_sq, min, max;
+} arrival;
+#endif
 static snd_rawmidi_t *input, **inputp;
 static snd_rawmidi_t *output, **outputp;
 
@@ -84,7 +105,14 @@ static void usage(void)
 		"                                for the specified duration\n"
 		"-a, --active-sensing            include active sensing bytes\n"
 		"-c, --clock                     include clock bytes\n"
-		"-i, --sysex-interval=mseconds   delay in between each SysEx message\n");
+		"-i, --sysex-interval=mseconds   delay in between each SysEx message\n"
+		"-B, --buffer-size=bytes         size of the RawMIDI buffers\n");
+#ifdef HAVE_RAWMIDI_TSTAMP
+	printf(
+		"-T, --timestamp=clock           timestamp the received packets,\n"
+		"                                clock is realtime, monotonic or raw\n"
+		"-g, --timestamp-log=file        write the timestamped packets into a file\n");
+#endif
 }
 
 static void version(void)
@@ -232,79 +260,171 @@ static void rawmidi_list(void)
 	snd_output_close(output);
 }
 
-static int send_midi_interleaved(void)
+/*
+ * wait until the output buffer is empty; avail_min is set to the buffer
+ * size, so POLLOUT means exactly that
+ */
+static int wait_output_empty(struct pollfd *pfds, int npfds, size_t buffer_size,
+			     snd_rawmidi_status_t *st)
 {
+	unsigned short revents;
 	int err;
-	char *data = send_data;
-	size_t buffer_size;
+
+	for (;;) {
+		err = snd_rawmidi_status(output, st);
+		if (err < 0)
+			return err;
+		if (snd_rawmidi_status_get_avail(st) >= buffer_size)
+			return 0;
+		err = poll(pfds, npfds, -1);
+		if (err < 0) {
+			if (errno == EINTR && !stop)
+				continue;
+			return -errno;
+		}
+		err = snd_rawmidi_poll_descriptors_revents(output, pfds, npfds, &revents);
+		if (err < 0)
+			return err;
+		if (revents & (POLLERR | POLLHUP))
+			return -EIO;
+	}
+}
+
+/* sleep until an absolute time of CLOCK_MONOTONIC */
+static void sleep_until(const struct timespec *target)
+{
+	while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, target, NULL) == EINTR && !stop)
+		;
+}
+
+/*
+ * send the data given with --send-hex, or the file given with --send; the
+ * file is read and sent in chunks, so a large dump needs no memory for
+ * the whole file and the first bytes go out at once
+ */
+static int send_midi(void)
+{
+	int err = 0, npfds = 0, first = 1, in_message = 0, done = 0;
+	char *buf = NULL, *data, *temp;
+	size_t buffer_size = 0, avail_min = 0;
+	ssize_t len, n;
 	snd_rawmidi_params_t *param;
 	snd_rawmidi_status_t *st;
+	struct pollfd *pfds = NULL;
+	struct timespec target;
 
 	snd_rawmidi_status_alloca(&st);
 
-	snd_rawmidi_params_alloca(&param);
-	snd_rawmidi_params_current(output, param);
-	buffer_size = snd_rawmidi_params_get_buffer_size(param);
-
-	while (data < (send_data + send_data_length)) {
-		int len = send_data + send_data_length - data;
-		char *temp;
-
-		if (data > send_data) {
-			snd_rawmidi_status(output, st);
-			do {
-				/* 320 µs per byte as noted in Page 1 of MIDI spec */
-				usleep((buffer_size - snd_rawmidi_status_get_avail(st)) * 320);
-				snd_rawmidi_status(output, st);
-			} while(snd_rawmidi_status_get_avail(st) < buffer_size);
-			usleep(sysex_interval * 1000);
-		}
+	if (sysex_interval) {
+		snd_rawmidi_params_alloca(&param);
+		snd_rawmidi_params_current(output, param);
+		buffer_size = snd_rawmidi_params_get_buffer_size(param);
+		avail_min = snd_rawmidi_params_get_avail_min(param);
+		/* wake up only when the buffer has been drained completely */
+		err = snd_rawmidi_params_set_avail_min(output, param, buffer_size);
+		if (err < 0)
+			return err;
+		err = snd_rawmidi_params(output, param);
+		if (err < 0)
+			return err;
 
-		/* find end of SysEx */
-		if ((temp = memchr(data, 0xf7, len)) != NULL)
-			len = temp - data + 1;
+		npfds = snd_rawmidi_poll_descriptors_count(output);
+		pfds = alloca(npfds * sizeof(struct pollfd));
+		snd_rawmidi_poll_descriptors(output, pfds, npfds);
+	}
 
-		if ((err = snd_rawmidi_write(output, data, len)) < 0)
-			return err;
+	if (send_fd >= 0)
+		buf = my_malloc(SEND_CHUNK_SIZE);
+
+	while (!stop) {
+		if (send_fd >= 0) {
+			len = read(send_fd, buf, SEND_CHUNK_SIZE);
+			if (len < 0) {
+				if (errno == EINTR)
+					continue;
+				error("cannot read from %s: %s", send_file_name, strerror(errno));
+				err = -errno;
+				break;
+			}
+			if (len == 0)
+				break;
+			data = buf;
+		} else {
+			if (done)
+				break;
+			data = send_data;
+			len = send_data_length;
+			done = 1;
+		}
+
+		while (len > 0) {
+			n = len;
+			if (sysex_interval) {
+				/* wait before each SysEx but the first */
+				if (!first && !in_message) {
+					err = wait_output_empty(pfds, npfds, buffer_size, st);
+					if (err < 0)
+						goto _exit;
+					/* the interval counts from the time the buffer got empty */
+					clock_gettime(CLOCK_MONOTONIC, &target);
+					target.tv_sec += sysex_interval / 1000;
+					target.tv_nsec += (sysex_interval % 1000) * 1000000L;
+					if (target.tv_nsec >= NSEC_PER_SEC) {
+						target.tv_sec++;
+						target.tv_nsec -= NSEC_PER_SEC;
+					}
+					sleep_until(&target);
+					if (stop)
+						goto _exit;
+				}
+				first = 0;
+				/*
+				 * find end of SysEx; without it, the message
+				 * continues in the next chunk of the file
+				 */
+				if ((temp = memchr(data, 0xf7, len)) != NULL) {
+					n = temp - data + 1;
+					in_message = 0;
+				} else {
+					in_message = 1;
+				}
+			}
 
-		data += len;
+			if ((err = snd_rawmidi_write(output, data, n)) < 0)
+				goto _exit;
+			err = 0;
+			data += n;
+			len -= n;
+		}
 	}
 
-	return 0;
+_exit:
+	/* the parameters stay with the handle, so restore the original one */
+	if (sysex_interval &&
+	    snd_rawmidi_params_set_avail_min(output, param, avail_min) >= 0)
+		snd_rawmidi_params(output, param);
+	free(buf);
+	return err;
 }
 
 static void load_file(void)
 {
-	int fd;
-	off_t length;
+	char header[4];
 
-	fd = open(send_file_name, O_RDONLY);
-	if (fd == -1) {
+	send_fd = open(send_file_name, O_RDONLY);
+	if (send_fd == -1) {
 		error("cannot open %s - %s", send_file_name, strerror(errno));
 		return;
 	}
-	length = lseek(fd, 0, SEEK_END);
-	if (length == (off_t)-1) {
-		error("cannot determine length of %s: %s", send_file_name, strerror(errno));
-		goto _error;
-	}
-	send_data = my_malloc(length);
-	lseek(fd, 0, SEEK_SET);
-	if (read(fd, send_data, length) != length) {
-		error("cannot read from %s: %s", send_file_name, strerror(errno));
-		goto _error;
-	}
-	if (length >= 4 && !memcmp(send_data, "MThd", 4)) {
+	if (pread(send_fd, header, sizeof(header), 0) == sizeof(header) &&
+	    !memcmp(header, "MThd", 4)) {
 		error("%s is a Standard MIDI File; use aplaymidi to send it", send_file_name);
-		goto _error;
+		close(send_fd);
+		send_fd = -1;
+		return;
 	}
-	send_data_length = length;
-	goto _exit;
-_error:
-	free(send_data);
-	send_data = NULL;
-_exit:
-	close(fd);
+	/* let the kernel read ahead while the data is being sent */
+	posix_fadvise(send_fd, 0, 0, POSIX_FADV_SEQUENTIAL);
 }
 
 static int hex_value(char c)
@@ -354,10 +474,14 @@ static void parse_data(void)
 }
 
 /*
- * prints MIDI commands, formatting them nicely
+ * formats MIDI commands nicely into out, which must have room for
+ * PRINT_BYTE_MAX characters, and returns the end of the output
  */
-static void print_byte(unsigned char byte)
+#define PRINT_BYTE_MAX 6
+
+static char *print_byte(char *out, unsigned char byte)
 {
+	static const char hex_digits[16] = "0123456789ABCDEF";
 	static enum {
 		STATE_UNKNOWN,
 		STATE_1PARAM,
@@ -423,12 +547,97 @@ static void print_byte(unsigned char byte)
 		default:
 			break;
 		}
-		if (running_status)
-			fputs("\n  ", stdout);
+		if (running_status) {
+			*out++ = '\n';
+			*out++ = ' ';
+			*out++ = ' ';
+		}
 	}
-	printf("%c%02X", newline ? '\n' : ' ', byte);
+	*out++ = newline ? '\n' : ' ';
+	*out++ = hex_digits[byte >> 4];
+	*out++ = hex_digits[byte & 0xf];
+	return out;
 }
 
+static int set_buffer_size(snd_rawmidi_t *rmidi)
+{
+	snd_rawmidi_params_t *param;
+	int err;
+
+	snd_rawmidi_params_alloca(&param);
+	err = snd_rawmidi_params_current(rmidi, param);
+	if (err < 0)
+		return err;
+	err = snd_rawmidi_params_set_buffer_size(rmidi, param, buffer_size);
+	if (err < 0)
+		return err;
+	return snd_rawmidi_params(rmidi, param);
+}
+
+#ifdef HAVE_RAWMIDI_TSTAMP
+static int set_timestamp_mode(snd_rawmidi_t *rmidi)
+{
+	snd_rawmidi_params_t *param;
+	int err;
+
+	snd_rawmidi_params_alloca(&param);
+	err = snd_rawmidi_params_current(rmidi, param);
+	if (err < 0)
+		return err;
+	err = snd_rawmidi_params_set_read_mode(rmidi, param, SND_RAWMIDI_READ_TSTAMP);
+	if (err < 0)
+		return err;
+	err = snd_rawmidi_params_set_clock_type(rmidi, param, tstamp_clock);
+	if (err < 0)
+		return err;
+	return snd_rawmidi_params(rmidi, param);
+}
+
+/*
+ * A log record is the timestamp in nanoseconds (64 bits), the data
+ * length (32 bits), both in host byte order, and the data.
+ */
+static void log_packet(const struct timespec *ts, const unsigned char *buf, int length)
+{
+	int64_t ns = (int64_t)ts->tv_sec * NSEC_PER_SEC + ts->tv_nsec;
+	uint32_t len = length;
+	double interval;
+
+	if (tstamp_log) {
+		fwrite(&ns, sizeof(ns), 1, tstamp_log);
+		fwrite(&len, sizeof(len), 1, tstamp_log);
+		fwrite(buf, 1, length, tstamp_log);
+	}
+
+	if (arrival.count > 0) {
+		interval = ns - arrival.last;
+		arrival.sum += interval;
+		arrival.sum_sq += interval * interval;
+		if (arrival.count == 1 || interval < arrival.min)
+			arrival.min = interval;
+		if (arrival.count == 1 || interval > arrival.max)
+			arrival.max = interval;
+	}
+	arrival.last = ns;
+	arrival.count++;
+}
+
+static void print_arrival_summary(void)
+{
+	unsigned long n = arrival.count - 1;
+	double mean, var;
+
+	if (arrival.count < 2)
+		return;
+	mean = arrival.sum / n;
+	var = arrival.sum_sq / n - mean * mean;
+	fprintf(stderr, "%lu packets, inter-arrival time (us): "
+		"min %.1f, mean %.1f, max %.1f, jitter (std. dev.) %.1f\n",
+		arrival.count, arrival.min / 1000, mean / 1000,
+		arrival.max / 1000, var > 0 ? sqrt(var) / 1000 : 0);
+}
+#endif
+
 static void sig_handler(int dummy)
 {
 	stop = 1;
@@ -454,7 +663,7 @@ static void add_send_hex_data(const char *str)
 
 int main(int argc, char *argv[])
 {
-	static const char short_options[] = "hVlLp:s:r:S::dt:aci:";
+	static const char short_options[] = "hVlLp:s:r:S::dt:aci:B:T:g:";
 	static const struct option long_options[] = {
 		{"help", 0, NULL, 'h'},
 		{"version", 0, NULL, 'V'},
@@ -469,6 +678,11 @@ int main(int argc, char *argv[])
 		{"active-sensing", 0, NULL, 'a'},
 		{"clock", 0, NULL, 'c'},
 		{"sysex-interval", 1, NULL, 'i'},
+		{"buffer-size", 1, NULL, 'B'},
+#ifdef HAVE_RAWMIDI_TSTAMP
+		{"timestamp", 1, NULL, 'T'},
+		{"timestamp-log", 1, NULL, 'g'},
+#endif
 		{0}
 	};
 	int c, err, ok = 0;
@@ -522,6 +736,32 @@ int main(int argc, char *argv[])
 		case 'i':
 			sysex_interval = atoi(optarg);
 			break;
+		case 'B':
+			buffer_size = atol(optarg);
+			if (buffer_size < 32) {
+				error("Invalid buffer size %s", optarg);
+				return 1;
+			}
+			break;
+#ifdef HAVE_RAWMIDI_TSTAMP
+		case 'T':
+			if (!strcmp(optarg, "realtime"))
+				tstamp_clock = SND_RAWMIDI_CLOCK_REALTIME;
+			else if (!strcmp(optarg, "monotonic"))
+				tstamp_clock = SND_RAWMIDI_CLOCK_MONOTONIC;
+			else if (!strcmp(optarg, "raw"))
+				tstamp_clock = SND_RAWMIDI_CLOCK_MONOTONIC_RAW;
+			else {
+				error("Invalid clock %s", optarg);
+				return 1;
+			}
+			break;
+		case 'g':
+			tstamp_log_name = optarg;
+			if (tstamp_clock < 0)
+				tstamp_clock = SND_RAWMIDI_CLOCK_MONOTONIC;
+			break;
+#endif
 		default:
 			error("Try `amidi --help' for more information.");
 			return 1;
@@ -562,7 +802,7 @@ int main(int argc, char *argv[])
 		load_file();
 	else if (send_hex)
 		parse_data();
-	if ((send_file_name || send_hex) && !send_data)
+	if (send_file_name ? send_fd < 0 : send_hex && !send_data)
 		return 1;
 
 	if (receive_file_name) {
@@ -579,7 +819,7 @@ int main(int argc, char *argv[])
 		inputp = &input;
 	else
 		inputp = NULL;
-	if (send_data)
+	if (send_data || send_fd >= 0)
 		outputp = &output;
 	else
 		outputp = NULL;
@@ -589,24 +829,44 @@ int main(int argc, char *argv[])
 		goto _exit2;
 	}
 
+	if (buffer_size) {
+		if (inputp && (err = set_buffer_size(input)) < 0) {
+			error("cannot set input buffer size: %s", snd_strerror(err));
+			goto _exit;
+		}
+		if (outputp && (err = set_buffer_size(output)) < 0) {
+			error("cannot set output buffer size: %s", snd_strerror(err));
+			goto _exit;
+		}
+	}
+
+#ifdef HAVE_RAWMIDI_TSTAMP
+	if (inputp && tstamp_clock >= 0) {
+		if ((err = set_timestamp_mode(input)) < 0) {
+			error("cannot set timestamp mode: %s", snd_strerror(err));
+			goto _exit;
+		}
+		if (tstamp_log_name) {
+			tstamp_log = fopen(tstamp_log_name, "wb");
+			if (!tstamp_log) {
+				error("cannot open %s - %s", tstamp_log_name, strerror(errno));
+				goto _exit;
+			}
+		}
+	}
+#endif
+
 	if (inputp)
 		snd_rawmidi_read(input, NULL, 0); /* trigger reading */
 
-	if (send_data) {
+	if (outputp) {
 		if ((err = snd_rawmidi_nonblock(output, 0)) < 0) {
 			error("cannot set blocking mode: %s", snd_strerror(err));
 			goto _exit;
 		}
-		if (!sysex_interval) {
-			if ((err = snd_rawmidi_write(output, send_data, send_data_length)) < 0) {
-				error("cannot send data: %s", snd_strerror(err));
-				return err;
-			}
-		} else {
-			if ((err = send_midi_interleaved()) < 0) {
-				error("cannot send data: %s", snd_strerror(err));
-				return err;
-			}
+		if ((err = send_midi()) < 0) {
+			error("cannot send data: %s", snd_strerror(err));
+			return err;
 		}
 	}
 
@@ -614,6 +874,15 @@ int main(int argc, char *argv[])
 		int read = 0;
 		int npfds;
 		struct pollfd *pfds;
+		unsigned char *buf;
+		char *text = NULL;
+		size_t buf_size;
+
+		/* read as much as the driver may have buffered at once */
+		buf_size = buffer_size > 4096 ? buffer_size : 4096;
+		buf = my_malloc(buf_size);
+		if (dump)
+			text = my_malloc(buf_size * PRINT_BYTE_MAX + 32);
 
 		npfds = 1 + snd_rawmidi_poll_descriptors_count(input);
 		pfds = alloca(npfds * sizeof(struct pollfd));
@@ -645,9 +914,12 @@ int main(int argc, char *argv[])
 			}
 		}
 		for (;;) {
-			unsigned char buf[256];
 			int i, length;
 			unsigned short revents;
+			char *end;
+#ifdef HAVE_RAWMIDI_TSTAMP
+			struct timespec ts;
+#endif
 
 			err = poll(pfds, npfds, -1);
 			if (stop || (err < 0 && errno == EINTR))
@@ -670,7 +942,13 @@ int main(int argc, char *argv[])
 				continue;
 			}
 
-			err = snd_rawmidi_read(input, buf, sizeof(buf));
+#ifdef HAVE_RAWMIDI_TSTAMP
+			/* all bytes of a read have the timestamp of the first one */
+			if (tstamp_clock >= 0)
+				err = snd_rawmidi_tread(input, &ts, buf, buf_size);
+			else
+#endif
+				err = snd_rawmidi_read(input, buf, buf_size);
 			if (err == -EAGAIN)
 				continue;
 			if (err < 0) {
@@ -693,9 +971,20 @@ int main(int argc, char *argv[])
 				if (wlength != length)
 					error("write error: %s", wlength < 0 ? strerror(errno) : "short");
 			}
+#ifdef HAVE_RAWMIDI_TSTAMP
+			if (tstamp_clock >= 0)
+				log_packet(&ts, buf, length);
+#endif
 			if (dump) {
+				end = text;
+#ifdef HAVE_RAWMIDI_TSTAMP
+				if (tstamp_clock >= 0)
+					end += sprintf(end, "\n%lld.%09ld",
+						       (long long)ts.tv_sec, ts.tv_nsec);
+#endif
 				for (i = 0; i < length; ++i)
-					print_byte(buf[i]);
+					end = print_byte(end, buf[i]);
+				fwrite(text, 1, end - text, stdout);
 				fflush(stdout);
 			}
 
@@ -709,6 +998,14 @@ int main(int argc, char *argv[])
 		}
 		if (isatty(fileno(stdout)))
 			printf("\n%d bytes read\n", read);
+		free(text);
+		free(buf);
+#ifdef HAVE_RAWMIDI_TSTAMP
+		if (tstamp_clock >= 0)
+			print_arrival_summary();
+		if (tstamp_log)
+			fclose(tstamp_log);
+#endif
 	}
 
 	ok = 1;
@@ -720,5 +1017,7 @@ _exit:
 _exit2:
 	if (receive_file != -1)
 		close(receive_file);
+	if (send_fd != -1)
+		close(send_fd);
 	return !ok;
 }
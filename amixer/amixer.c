@@ -29,6 +29,7 @@
 #include <assert.h>
 #include <alsa/asoundlib.h>
 #include <poll.h>
+#include <time.h>
 #include <stdint.h>
 #include "amixer.h"
 #include "../alsamixer/volume_mapping.h"
@@ -42,6 +43,7 @@ static int debugflag = 0;
 static int no_check = 0;
 static int smixer_level = 0;
 static int ignore_error = 0;
+static int json_output = 0;
 static struct snd_mixer_selem_regopt smixer_options;
 static char card[64] = "default";
 
@@ -72,6 +74,7 @@ static int help(void)
 	printf("  -s,--stdin      Read and execute commands from stdin sequentially\n");
 	printf("  -R,--raw-volume Use the raw value (default)\n");
 	printf("  -M,--mapped-volume Use the mapped volume\n");
+	printf("  -j,--json       JSON output for controls, contents and events\n");
 	printf("\nAvailable commands:\n");
 	printf("  scontrols       show all mixer simple controls\n");
 	printf("  scontents	  show contents of all mixer simple controls (default command)\n");
@@ -81,6 +84,8 @@ static int help(void)
 	printf("  contents        show contents of all controls for given card\n");
 	printf("  cset cID P      set control contents for one control\n");
 	printf("  cget cID        get control contents for one control\n");
+	printf("  ramp sID P time=MS [curve=linear|cos|square] [rate=HZ]\n");
+	printf("                  move the mapped volume to P%% in MS milliseconds\n");
 	return 0;
 }
 
@@ -593,25 +598,27 @@ static void decode_tlv(unsigned int spaces, unsigned int *tlv, unsigned int tlv_
 		putc('\n', stdout);
 }
 
-static int show_control(const char *space, snd_hctl_elem_t *elem,
-			int level)
+/*
+ * Shows one element through the ctl handle, so that showing a single
+ * element does not need an hctl with all elements of the card loaded.
+ */
+static int show_control(const char *space, snd_ctl_t *handle,
+			snd_ctl_elem_id_t *id, int level)
 {
 	int err;
 	unsigned int item, idx, count, *tlv;
 	snd_ctl_elem_type_t type;
-	snd_ctl_elem_id_t *id;
 	snd_ctl_elem_info_t *info;
 	snd_ctl_elem_value_t *control;
 	snd_aes_iec958_t iec958;
-	snd_ctl_elem_id_alloca(&id);
 	snd_ctl_elem_info_alloca(&info);
 	snd_ctl_elem_value_alloca(&control);
-	if ((err = snd_hctl_elem_info(elem, info)) < 0) {
-		error("Control %s snd_hctl_elem_info error: %s\n", card, snd_strerror(err));
+	snd_ctl_elem_info_set_id(info, id);
+	if ((err = snd_ctl_elem_info(handle, info)) < 0) {
+		error("Control %s snd_ctl_elem_info error: %s\n", card, snd_strerror(err));
 		return err;
 	}
 	if (level & LEVEL_ID) {
-		snd_hctl_elem_get_id(elem, id);
 		show_control_id(id);
 		printf("\n");
 	}
@@ -637,7 +644,7 @@ static int show_control(const char *space, snd_hctl_elem_t *elem,
 		printf(",items=%u\n", items);
 		for (item = 0; item < items; item++) {
 			snd_ctl_elem_info_set_item(info, item);
-			if ((err = snd_hctl_elem_info(elem, info)) < 0) {
+			if ((err = snd_ctl_elem_info(handle, info)) < 0) {
 				error("Control %s element info error: %s\n", card, snd_strerror(err));
 				return err;
 			}
@@ -652,7 +659,8 @@ static int show_control(const char *space, snd_hctl_elem_t *elem,
 	if (level & LEVEL_BASIC) {
 		if (!snd_ctl_elem_info_is_readable(info))
 			goto __skip_read;
-		if ((err = snd_hctl_elem_read(elem, control)) < 0) {
+		snd_ctl_elem_value_set_id(control, id);
+		if ((err = snd_ctl_elem_read(handle, control)) < 0) {
 			error("Control %s element read error: %s\n", card, snd_strerror(err));
 			return err;
 		}
@@ -700,7 +708,7 @@ static int show_control(const char *space, snd_hctl_elem_t *elem,
 		}
 
 		tlv = malloc(4096);
-		if ((err = snd_hctl_elem_tlv_read(elem, tlv, 4096)) < 0) {
+		if ((err = snd_ctl_elem_tlv_read(handle, id, tlv, 4096)) < 0) {
 			error("Control %s element TLV read error: %s\n", card, snd_strerror(err));
 			free(tlv);
 			return err;
@@ -741,12 +749,306 @@ static int controls(int level)
 		show_control_id(id);
 		printf("\n");
 		if (level & LEVEL_BASIC)
-			show_control("  ", elem, 1);
+			show_control("  ", snd_hctl_ctl(handle), id, 1);
 	}
 	snd_hctl_close(handle);
 	return 0;
 }
 
+/*
+ * JSON dump of all controls (-j/--json with controls or contents). Each
+ * element is queried once for its info, value and TLV through the plain
+ * ctl handle and the text is collected in a buffer written in large
+ * blocks.
+ */
+struct json_out {
+	char *buf;
+	size_t len;
+	size_t size;
+};
+
+static void json_flush(struct json_out *out)
+{
+	if (out->len > 0)
+		fwrite(out->buf, 1, out->len, stdout);
+	out->len = 0;
+}
+
+static void json_printf(struct json_out *out, const char *fmt, ...)
+{
+	va_list ap;
+	int len;
+
+	if (out->size - out->len < 256 && out->len > 0)
+		json_flush(out);
+	va_start(ap, fmt);
+	len = vsnprintf(out->buf + out->len, out->size - out->len, fmt, ap);
+	va_end(ap);
+	if (len < 0)
+		return;
+	if ((size_t)len >= out->size - out->len) {
+		/* longer than the free space, write it directly */
+		json_flush(out);
+		va_start(ap, fmt);
+		vprintf(fmt, ap);
+		va_end(ap);
+		return;
+	}
+	out->len += len;
+}
+
+static void json_string(struct json_out *out, const char *str)
+{
+	json_printf(out, "\"");
+	for (; *str; str++) {
+		unsigned char c = *str;
+
+		if (c == '"' || c == '\\')
+			json_printf(out, "\\%c", c);
+		else if (c < 0x20)
+			json_printf(out, "\\u%04x", c);
+		else
+			json_printf(out, "%c", c);
+	}
+	json_printf(out, "\"");
+}
+
+static void json_bytes(struct json_out *out, const unsigned char *data,
+		       unsigned int size)
+{
+	unsigned int idx;
+
+	json_printf(out, "\"");
+	for (idx = 0; idx < size; idx++)
+		json_printf(out, "%02x", data[idx]);
+	json_printf(out, "\"");
+}
+
+/* an error closes the open objects, so the output stays valid JSON */
+static void json_error(struct json_out *out, int err)
+{
+	json_printf(out, ",\"error\":");
+	json_string(out, snd_strerror(err));
+}
+
+static int json_control(struct json_out *out, snd_ctl_t *handle,
+			snd_ctl_elem_info_t *info, snd_ctl_elem_value_t *control)
+{
+	unsigned int item, idx, count, items;
+	snd_ctl_elem_type_t type;
+	snd_aes_iec958_t iec958;
+	unsigned int tlv[1024];
+	snd_ctl_elem_id_t *id;
+	int err = 0;
+	snd_ctl_elem_id_alloca(&id);
+
+	snd_ctl_elem_info_get_id(info, id);
+	count = snd_ctl_elem_info_get_count(info);
+	type = snd_ctl_elem_info_get_type(info);
+	json_printf(out, "{\"numid\":%u,\"iface\":\"%s\",\"name\":",
+		    snd_ctl_elem_id_get_numid(id),
+		    snd_ctl_elem_iface_name(snd_ctl_elem_id_get_interface(id)));
+	json_string(out, snd_ctl_elem_id_get_name(id));
+	json_printf(out, ",\"index\":%u,\"device\":%u,\"subdevice\":%u",
+		    snd_ctl_elem_id_get_index(id),
+		    snd_ctl_elem_id_get_device(id),
+		    snd_ctl_elem_id_get_subdevice(id));
+	json_printf(out, ",\"type\":\"%s\",\"access\":\"%s\",\"count\":%u",
+		    control_type(info), control_access(info), count);
+	switch (type) {
+	case SND_CTL_ELEM_TYPE_INTEGER:
+		json_printf(out, ",\"min\":%li,\"max\":%li,\"step\":%li",
+			    snd_ctl_elem_info_get_min(info),
+			    snd_ctl_elem_info_get_max(info),
+			    snd_ctl_elem_info_get_step(info));
+		break;
+	case SND_CTL_ELEM_TYPE_INTEGER64:
+		json_printf(out, ",\"min\":%lli,\"max\":%lli,\"step\":%lli",
+			    snd_ctl_elem_info_get_min64(info),
+			    snd_ctl_elem_info_get_max64(info),
+			    snd_ctl_elem_info_get_step64(info));
+		break;
+	case SND_CTL_ELEM_TYPE_ENUMERATED:
+		items = snd_ctl_elem_info_get_items(info);
+		json_printf(out, ",\"items\":[");
+		for (item = 0; item < items; item++) {
+			snd_ctl_elem_info_set_item(info, item);
+			if ((err = snd_ctl_elem_info(handle, info)) < 0) {
+				error("Control %s element info error: %s\n", card, snd_strerror(err));
+				break;
+			}
+			if (item > 0)
+				json_printf(out, ",");
+			json_string(out, snd_ctl_elem_info_get_item_name(info));
+		}
+		json_printf(out, "]");
+		if (err < 0)
+			goto _end;
+		break;
+	default:
+		break;
+	}
+	if (snd_ctl_elem_info_is_readable(info)) {
+		snd_ctl_elem_value_set_id(control, id);
+		if ((err = snd_ctl_elem_read(handle, control)) < 0) {
+			error("Control %s element read error: %s\n", card, snd_strerror(err));
+			goto _end;
+		}
+		json_printf(out, ",\"values\":");
+		switch (type) {
+		case SND_CTL_ELEM_TYPE_BYTES:
+			json_bytes(out, snd_ctl_elem_value_get_bytes(control), count);
+			break;
+		case SND_CTL_ELEM_TYPE_IEC958:
+			snd_ctl_elem_value_get_iec958(control, &iec958);
+			json_bytes(out, iec958.status, sizeof(iec958.status));
+			break;
+		default:
+			json_printf(out, "[");
+			for (idx = 0; idx < count; idx++) {
+				if (idx > 0)
+					json_printf(out, ",");
+				switch (type) {
+				case SND_CTL_ELEM_TYPE_BOOLEAN:
+					json_printf(out, "%s", snd_ctl_elem_value_get_boolean(control, idx) ? "true" : "false");
+					break;
+				case SND_CTL_ELEM_TYPE_INTEGER:
+					json_printf(out, "%li", snd_ctl_elem_value_get_integer(control, idx));
+					break;
+				case SND_CTL_ELEM_TYPE_INTEGER64:
+					json_printf(out, "%lli", snd_ctl_elem_value_get_integer64(control, idx));
+					break;
+				case SND_CTL_ELEM_TYPE_ENUMERATED:
+					json_printf(out, "%u", snd_ctl_elem_value_get_enumerated(control, idx));
+					break;
+				default:
+					json_printf(out, "null");
+					break;
+				}
+			}
+			json_printf(out, "]");
+			break;
+		}
+	}
+	/* skip ASoC ext bytes controls that may have huge binary TLV data */
+	if (snd_ctl_elem_info_is_tlv_readable(info) &&
+	    !(type == SND_CTL_ELEM_TYPE_BYTES &&
+	      !snd_ctl_elem_info_is_readable(info) &&
+	      !snd_ctl_elem_info_is_writable(info)) &&
+	    snd_ctl_elem_tlv_read(handle, id, tlv, sizeof(tlv)) >= 0) {
+		unsigned int *db;
+		long dbmin, dbmax;
+		unsigned int words = 2 + tlv[1] / sizeof(unsigned int);
+
+		if (words > sizeof(tlv) / sizeof(tlv[0]))
+			words = sizeof(tlv) / sizeof(tlv[0]);
+		json_printf(out, ",\"tlv\":[");
+		for (idx = 0; idx < words; idx++)
+			json_printf(out, "%s%u", idx > 0 ? "," : "", tlv[idx]);
+		json_printf(out, "]");
+		if (type == SND_CTL_ELEM_TYPE_INTEGER &&
+		    snd_tlv_parse_dB_info(tlv, sizeof(tlv), &db) > 0 &&
+		    snd_tlv_get_dB_range(db, snd_ctl_elem_info_get_min(info),
+					 snd_ctl_elem_info_get_max(info),
+					 &dbmin, &dbmax) >= 0)
+			json_printf(out, ",\"dbmin\":%ld,\"dbmax\":%ld", dbmin, dbmax);
+	}
+ _end:
+	if (err < 0)
+		json_error(out, err);
+	json_printf(out, "}");
+	return err;
+}
+
+/* the filter arguments are iface=<iface> and name=<prefix> */
+static int json_controls(int level, int argc, char *argv[])
+{
+	const char *iface = NULL, *prefix = NULL;
+	struct json_out out;
+	snd_ctl_t *handle;
+	snd_ctl_elem_list_t *list;
+	snd_ctl_elem_info_t *info;
+	snd_ctl_elem_value_t *control;
+	unsigned int idx, count, shown = 0;
+	int i, err;
+	snd_ctl_elem_list_alloca(&list);
+	snd_ctl_elem_info_alloca(&info);
+	snd_ctl_elem_value_alloca(&control);
+
+	for (i = 0; i < argc; i++) {
+		if (!strncmp(argv[i], "iface=", 6))
+			iface = argv[i] + 6;
+		else if (!strncmp(argv[i], "name=", 5))
+			prefix = argv[i] + 5;
+		else {
+			fprintf(stderr, "Unknown filter '%s' (iface=<iface> or name=<prefix>)\n", argv[i]);
+			return -EINVAL;
+		}
+	}
+	if ((err = snd_ctl_open(&handle, card, 0)) < 0) {
+		error("Control %s open error: %s", card, snd_strerror(err));
+		return err;
+	}
+	if ((err = snd_ctl_elem_list(handle, list)) < 0 ||
+	    (err = snd_ctl_elem_list_alloc_space(list, snd_ctl_elem_list_get_count(list))) < 0 ||
+	    (err = snd_ctl_elem_list(handle, list)) < 0) {
+		error("Control %s list error: %s\n", card, snd_strerror(err));
+		goto _close;
+	}
+	out.size = 64 * 1024;
+	out.len = 0;
+	out.buf = malloc(out.size);
+	if (out.buf == NULL) {
+		err = -ENOMEM;
+		goto _free;
+	}
+	json_printf(&out, "{\"card\":");
+	json_string(&out, card);
+	json_printf(&out, ",\"controls\":[");
+	count = snd_ctl_elem_list_get_used(list);
+	for (idx = 0; idx < count; idx++) {
+		snd_ctl_elem_info_set_numid(info, snd_ctl_elem_list_get_numid(list, idx));
+		if (iface && strcasecmp(iface, snd_ctl_elem_iface_name(snd_ctl_elem_list_get_interface(list, idx))))
+			continue;
+		if (prefix && strncmp(prefix, snd_ctl_elem_list_get_name(list, idx), strlen(prefix)))
+			continue;
+		if ((err = snd_ctl_elem_info(handle, info)) < 0) {
+			error("Control %s snd_ctl_elem_info error: %s\n", card, snd_strerror(err));
+			goto _out;
+		}
+		if (!(level & LEVEL_INACTIVE) && snd_ctl_elem_info_is_inactive(info))
+			continue;
+		json_printf(&out, "%s\n", shown++ ? "," : "");
+		if (level & LEVEL_BASIC) {
+			err = json_control(&out, handle, info, control);
+			if (err < 0)
+				goto _out;
+		} else {
+			json_printf(&out, "{\"numid\":%u,\"iface\":\"%s\",\"name\":",
+				    snd_ctl_elem_list_get_numid(list, idx),
+				    snd_ctl_elem_iface_name(snd_ctl_elem_list_get_interface(list, idx)));
+			json_string(&out, snd_ctl_elem_list_get_name(list, idx));
+			json_printf(&out, ",\"index\":%u,\"device\":%u,\"subdevice\":%u}",
+				    snd_ctl_elem_list_get_index(list, idx),
+				    snd_ctl_elem_list_get_device(list, idx),
+				    snd_ctl_elem_list_get_subdevice(list, idx));
+		}
+	}
+	err = 0;
+ _out:
+	json_printf(&out, "\n]");
+	if (err < 0)
+		json_error(&out, err);
+	json_printf(&out, "}\n");
+	json_flush(&out);
+	free(out.buf);
+ _free:
+	snd_ctl_elem_list_free_space(list);
+ _close:
+	snd_ctl_close(handle);
+	return err;
+}
+
 static void show_selem_volume(snd_mixer_elem_t *elem, 
 			      snd_mixer_selem_channel_id_t chn, int dir,
 			      long min, long max)
@@ -767,20 +1069,13 @@ static void show_selem_volume(snd_mixer_elem_t *elem,
 	}
 }
 
-static int show_selem(snd_mixer_t *handle, snd_mixer_selem_id_t *id, const char *space, int level)
+static int show_selem_elem(snd_mixer_elem_t *elem, const char *space, int level)
 {
 	snd_mixer_selem_channel_id_t chn;
 	long pmin = 0, pmax = 0;
 	long cmin = 0, cmax = 0;
 	int psw, csw;
 	int pmono, cmono, mono_ok = 0;
-	snd_mixer_elem_t *elem;
-	
-	elem = snd_mixer_find_selem(handle, id);
-	if (!elem) {
-		error("Mixer %s simple element not found", card);
-		return -ENOENT;
-	}
 
 	if (level & LEVEL_BASIC) {
 		printf("%sCapabilities:", space);
@@ -1035,6 +1330,18 @@ static int show_selem(snd_mixer_t *handle, snd_mixer_selem_id_t *id, const char
 	return 0;
 }
 
+static int show_selem(snd_mixer_t *handle, snd_mixer_selem_id_t *id, const char *space, int level)
+{
+	snd_mixer_elem_t *elem;
+
+	elem = snd_mixer_find_selem(handle, id);
+	if (!elem) {
+		error("Mixer %s simple element not found", card);
+		return -ENOENT;
+	}
+	return show_selem_elem(elem, space, level);
+}
+
 static int selems(int level)
 {
 	int err;
@@ -1122,10 +1429,264 @@ static int parse_simple_id(const char *str, snd_mixer_selem_id_t *sid)
 	return 0;
 }
 
+/*
+ * In the batch mode (-s) the handles stay open, so the identifiers are
+ * resolved through a hash index built once per handle instead of the
+ * linear lookups in alsa-lib. The simple elements are keyed by name and
+ * index, the controls by the full id and map to the numid.
+ */
+struct id_index_entry {
+	struct id_index_entry *next;
+	unsigned int hash;
+	unsigned int iface, device, subdevice, index;
+	unsigned int numid;
+	snd_mixer_elem_t *elem;
+	char name[];
+};
+
+struct id_index {
+	struct id_index_entry **table;
+	unsigned int mask;
+};
+
+static unsigned int id_index_hash(const char *name, unsigned int iface,
+				  unsigned int device, unsigned int subdevice,
+				  unsigned int index)
+{
+	unsigned int hash = 2166136261U;
+
+	while (*name)
+		hash = (hash ^ (unsigned char)*name++) * 16777619U;
+	hash = (hash ^ iface) * 16777619U;
+	hash = (hash ^ device) * 16777619U;
+	hash = (hash ^ subdevice) * 16777619U;
+	hash = (hash ^ index) * 16777619U;
+	return hash;
+}
+
+static void id_index_free(struct id_index *idx)
+{
+	struct id_index_entry *e, *n;
+	unsigned int i;
+
+	if (idx->table == NULL)
+		return;
+	for (i = 0; i <= idx->mask; i++) {
+		for (e = idx->table[i]; e; e = n) {
+			n = e->next;
+			free(e);
+		}
+	}
+	free(idx->table);
+	idx->table = NULL;
+}
+
+static int id_index_init(struct id_index *idx, unsigned int count)
+{
+	unsigned int size;
+
+	for (size = 64; size < count; size <<= 1)
+		;
+	idx->table = calloc(size, sizeof(*idx->table));
+	if (idx->table == NULL)
+		return -ENOMEM;
+	idx->mask = size - 1;
+	return 0;
+}
+
+static struct id_index_entry *id_index_add(struct id_index *idx, const char *name,
+					   unsigned int iface, unsigned int device,
+					   unsigned int subdevice, unsigned int index)
+{
+	struct id_index_entry *e;
+
+	e = calloc(1, sizeof(*e) + strlen(name) + 1);
+	if (e == NULL)
+		return NULL;
+	e->hash = id_index_hash(name, iface, device, subdevice, index);
+	e->iface = iface;
+	e->device = device;
+	e->subdevice = subdevice;
+	e->index = index;
+	strcpy(e->name, name);
+	e->next = idx->table[e->hash & idx->mask];
+	idx->table[e->hash & idx->mask] = e;
+	return e;
+}
+
+static struct id_index_entry *id_index_find(struct id_index *idx, const char *name,
+					    unsigned int iface, unsigned int device,
+					    unsigned int subdevice, unsigned int index)
+{
+	struct id_index_entry *e;
+	unsigned int hash;
+
+	if (idx->table == NULL)
+		return NULL;
+	hash = id_index_hash(name, iface, device, subdevice, index);
+	for (e = idx->table[hash & idx->mask]; e; e = e->next) {
+		if (e->hash == hash && e->iface == iface && e->device == device &&
+		    e->subdevice == subdevice && e->index == index &&
+		    strcmp(e->name, name) == 0)
+			return e;
+	}
+	return NULL;
+}
+
+/* index the controls of the ctl handle by their ids */
+static int ctl_index_build(struct id_index *idx, snd_ctl_t *handle)
+{
+	snd_ctl_elem_list_t *list;
+	snd_ctl_elem_id_t *id;
+	struct id_index_entry *e;
+	unsigned int i, count;
+	int err;
+	snd_ctl_elem_list_alloca(&list);
+	snd_ctl_elem_id_alloca(&id);
+
+	if ((err = snd_ctl_elem_list(handle, list)) < 0)
+		return err;
+	count = snd_ctl_elem_list_get_count(list);
+	if ((err = id_index_init(idx, count)) < 0)
+		return err;
+	if (count == 0)
+		return 0;
+	if ((err = snd_ctl_elem_list_alloc_space(list, count)) < 0)
+		goto _err;
+	if ((err = snd_ctl_elem_list(handle, list)) < 0)
+		goto _free;
+	for (i = 0; i < count; i++) {
+		snd_ctl_elem_list_get_id(list, i, id);
+		e = id_index_add(idx, snd_ctl_elem_id_get_name(id),
+				 snd_ctl_elem_id_get_interface(id),
+				 snd_ctl_elem_id_get_device(id),
+				 snd_ctl_elem_id_get_subdevice(id),
+				 snd_ctl_elem_id_get_index(id));
+		if (e == NULL) {
+			err = -ENOMEM;
+			goto _free;
+		}
+		e->numid = snd_ctl_elem_id_get_numid(id);
+	}
+	snd_ctl_elem_list_free_space(list);
+	return 0;
+ _free:
+	snd_ctl_elem_list_free_space(list);
+ _err:
+	id_index_free(idx);
+	return err;
+}
+
+/* index the simple elements of the mixer handle by name and index */
+static int selem_index_build(struct id_index *idx, snd_mixer_t *handle)
+{
+	snd_mixer_elem_t *elem;
+	struct id_index_entry *e;
+	int err;
+
+	if ((err = id_index_init(idx, snd_mixer_get_count(handle))) < 0)
+		return err;
+	for (elem = snd_mixer_first_elem(handle); elem; elem = snd_mixer_elem_next(elem)) {
+		e = id_index_add(idx, snd_mixer_selem_get_name(elem), 0, 0, 0,
+				 snd_mixer_selem_get_index(elem));
+		if (e == NULL) {
+			id_index_free(idx);
+			return -ENOMEM;
+		}
+		e->elem = elem;
+	}
+	return 0;
+}
+
+/*
+ * The cset commands between "begin" and "commit" in the stdin mode are
+ * applied to one value per element in memory. The commit writes each
+ * changed element once, ordered by numid.
+ */
+struct cset_pending {
+	struct cset_pending *next;
+	unsigned int numid;
+	snd_ctl_elem_value_t *value;
+};
+
+static snd_ctl_t *cset_handle = NULL;
+static struct cset_pending *cset_batch;		/* sorted by numid */
+static int cset_batch_active;
+
+static void cset_batch_free(void)
+{
+	struct cset_pending *p;
+
+	while ((p = cset_batch) != NULL) {
+		cset_batch = p->next;
+		snd_ctl_elem_value_free(p->value);
+		free(p);
+	}
+}
+
+static int cset_batch_add(snd_ctl_elem_info_t *info, snd_ctl_elem_id_t *id,
+			  const char *str)
+{
+	unsigned int numid = snd_ctl_elem_info_get_numid(info);
+	struct cset_pending *p, **pp;
+	int err;
+
+	for (pp = &cset_batch; (p = *pp) != NULL && p->numid < numid; pp = &p->next)
+		;
+	if (p == NULL || p->numid != numid) {
+		/* the first change of the element starts from its current value */
+		p = calloc(1, sizeof(*p));
+		if (p == NULL)
+			return -ENOMEM;
+		if ((err = snd_ctl_elem_value_malloc(&p->value)) < 0) {
+			free(p);
+			return err;
+		}
+		p->numid = numid;
+		snd_ctl_elem_value_set_id(p->value, id);
+		if ((err = snd_ctl_elem_read(cset_handle, p->value)) < 0) {
+			snd_ctl_elem_value_free(p->value);
+			free(p);
+			if (ignore_error)
+				return 0;
+			error("Cannot read the given element from control %s\n", card);
+			return err;
+		}
+		p->next = *pp;
+		*pp = p;
+	}
+	err = snd_ctl_ascii_value_parse(cset_handle, p->value, info, str);
+	if (err < 0) {
+		if (!ignore_error)
+			error("Control %s parse error: %s\n", card, snd_strerror(err));
+		return ignore_error ? 0 : err;
+	}
+	return 0;
+}
+
+static int cset_batch_commit(void)
+{
+	struct cset_pending *p;
+	int err, res = 0;
+
+	for (p = cset_batch; p; p = p->next) {
+		if ((err = snd_ctl_elem_write(cset_handle, p->value)) < 0) {
+			error("Control %s element #%u write error: %s\n", card,
+			      p->numid, snd_strerror(err));
+			if (!ignore_error)
+				res = err;
+		}
+	}
+	cset_batch_free();
+	cset_batch_active = 0;
+	return res;
+}
+
 static int cset(int argc, char *argv[], int roflag, int keep_handle)
 {
 	int err;
-	static snd_ctl_t *handle = NULL;
+	static struct id_index index;
+	struct id_index_entry *e;
 	snd_ctl_elem_info_t *info;
 	snd_ctl_elem_id_t *id;
 	snd_ctl_elem_value_t *control;
@@ -1146,76 +1707,83 @@ static int cset(int argc, char *argv[], int roflag, int keep_handle)
 		show_control_id(id);
 		printf("\n");
 	}
-	if (handle == NULL &&
-	    (err = snd_ctl_open(&handle, card, 0)) < 0) {
+	if (cset_handle == NULL &&
+	    (err = snd_ctl_open(&cset_handle, card, 0)) < 0) {
 		error("Control %s open error: %s\n", card, snd_strerror(err));
 		return err;
 	}
-	snd_ctl_elem_info_set_id(info, id);
-	if ((err = snd_ctl_elem_info(handle, info)) < 0) {
+	if (keep_handle && index.table == NULL)
+		ctl_index_build(&index, cset_handle);
+	e = NULL;
+	if (snd_ctl_elem_id_get_numid(id) == 0)
+		e = id_index_find(&index, snd_ctl_elem_id_get_name(id),
+				  snd_ctl_elem_id_get_interface(id),
+				  snd_ctl_elem_id_get_device(id),
+				  snd_ctl_elem_id_get_subdevice(id),
+				  snd_ctl_elem_id_get_index(id));
+	if (e) {
+		/* the numid is verified, the control may be replaced since */
+		snd_ctl_elem_info_set_numid(info, e->numid);
+		if (snd_ctl_elem_info(cset_handle, info) < 0 ||
+		    strcmp(snd_ctl_elem_info_get_name(info), e->name) ||
+		    snd_ctl_elem_info_get_index(info) != e->index) {
+			id_index_free(&index);
+			e = NULL;
+		}
+	}
+	if (e == NULL)
+		snd_ctl_elem_info_set_id(info, id);
+	if (e == NULL && (err = snd_ctl_elem_info(cset_handle, info)) < 0) {
 		if (ignore_error)
 			return 0;
 		error("Cannot find the given element from control %s\n", card);
 		if (! keep_handle) {
-			snd_ctl_close(handle);
-			handle = NULL;
+			snd_ctl_close(cset_handle);
+			cset_handle = NULL;
 		}
 		return err;
 	}
 	snd_ctl_elem_info_get_id(info, id);     /* FIXME: Remove it when hctl find works ok !!! */
+	if (!roflag && cset_batch_active)
+		return cset_batch_add(info, id, argv[1]);
 	if (!roflag) {
 		snd_ctl_elem_value_set_id(control, id);
-		if ((err = snd_ctl_elem_read(handle, control)) < 0) {
+		if ((err = snd_ctl_elem_read(cset_handle, control)) < 0) {
 			if (ignore_error)
 				return 0;
 			error("Cannot read the given element from control %s\n", card);
 			if (! keep_handle) {
-				snd_ctl_close(handle);
-				handle = NULL;
+				snd_ctl_close(cset_handle);
+				cset_handle = NULL;
 			}
 			return err;
 		}
-		err = snd_ctl_ascii_value_parse(handle, control, info, argv[1]);
+		err = snd_ctl_ascii_value_parse(cset_handle, control, info, argv[1]);
 		if (err < 0) {
  			if (!ignore_error)
 				error("Control %s parse error: %s\n", card, snd_strerror(err));
 			if (!keep_handle) {
-				snd_ctl_close(handle);
-				handle = NULL;
+				snd_ctl_close(cset_handle);
+				cset_handle = NULL;
 			}
 			return ignore_error ? 0 : err;
 		}
-		if ((err = snd_ctl_elem_write(handle, control)) < 0) {
+		if ((err = snd_ctl_elem_write(cset_handle, control)) < 0) {
 			if (!ignore_error)
 				error("Control %s element write error: %s\n", card, snd_strerror(err));
 			if (!keep_handle) {
-				snd_ctl_close(handle);
-				handle = NULL;
+				snd_ctl_close(cset_handle);
+				cset_handle = NULL;
 			}
 			return ignore_error ? 0 : err;
 		}
 	}
+	/* the element is shown by its full id, no hctl needs to be loaded */
+	if (!quiet)
+		show_control("  ", cset_handle, id, LEVEL_BASIC | LEVEL_ID);
 	if (! keep_handle) {
-		snd_ctl_close(handle);
-		handle = NULL;
-	}
-	if (!quiet) {
-		snd_hctl_t *hctl;
-		snd_hctl_elem_t *elem;
-		if ((err = snd_hctl_open(&hctl, card, 0)) < 0) {
-			error("Control %s open error: %s\n", card, snd_strerror(err));
-			return err;
-		}
-		if ((err = snd_hctl_load(hctl)) < 0) {
-			error("Control %s load error: %s\n", card, snd_strerror(err));
-			return err;
-		}
-		elem = snd_hctl_find_elem(hctl, id);
-		if (elem)
-			show_control("  ", elem, LEVEL_BASIC | LEVEL_ID);
-		else
-			printf("Could not find the specified element\n");
-		snd_hctl_close(hctl);
+		snd_ctl_close(cset_handle);
+		cset_handle = NULL;
 	}
 	return 0;
 }
@@ -1440,6 +2008,8 @@ static int sset(unsigned int argc, char *argv[], int roflag, int keep_handle)
 {
 	int err = 0;
 	static snd_mixer_t *handle = NULL;
+	static struct id_index index;
+	struct id_index_entry *e;
 	snd_mixer_elem_t *elem;
 	snd_mixer_selem_id_t *sid;
 	snd_mixer_selem_id_alloca(&sid);
@@ -1481,11 +2051,21 @@ static int sset(unsigned int argc, char *argv[], int roflag, int keep_handle)
 			return err;
 		}
 	}
-	elem = snd_mixer_find_selem(handle, sid);
+	if (keep_handle && index.table == NULL)
+		selem_index_build(&index, handle);
+	if (index.table) {
+		e = id_index_find(&index, snd_mixer_selem_id_get_name(sid), 0, 0, 0,
+				  snd_mixer_selem_id_get_index(sid));
+		elem = e ? e->elem : NULL;
+	} else {
+		elem = snd_mixer_find_selem(handle, sid);
+	}
 	if (!elem) {
 		if (ignore_error)
 			return 0;
 		error("Unable to find simple control '%s',%i\n", snd_mixer_selem_id_get_name(sid), snd_mixer_selem_id_get_index(sid));
+		id_index_free(&index);
+		volume_mapping_clear();
 		snd_mixer_close(handle);
 		handle = NULL;
 		return -ENOENT;
@@ -1506,44 +2086,428 @@ static int sset(unsigned int argc, char *argv[], int roflag, int keep_handle)
 	}
 	if (!quiet) {
 		printf("Simple mixer control '%s',%i\n", snd_mixer_selem_id_get_name(sid), snd_mixer_selem_id_get_index(sid));
-		show_selem(handle, sid, "  ", 1);
+		show_selem_elem(elem, "  ", 1);
 	}
  done:
 	if (! keep_handle) {
+		id_index_free(&index);
+		volume_mapping_clear();
 		snd_mixer_close(handle);
 		handle = NULL;
 	}
 	return err < 0 ? 1 : 0;
 }
 
-static void events_info(snd_hctl_elem_t *helem)
+/*
+ * ramp sID P time=<ms> [curve=linear|cos|square] [rate=<Hz>] [playback|capture]
+ *
+ * Moves the volume to P (a percentage on the mapped scale) in the given
+ * time. The steps are taken on absolute CLOCK_MONOTONIC ticks computed
+ * from the start, so the delays do not accumulate and the last step
+ * lands on the target at the end tick. When all channels start at the
+ * same volume, each step is one element write for all channels.
+ */
+#define RAMP_DEFAULT_RATE	50
+#define RAMP_MAX_RATE		1000
+
+enum { RAMP_LINEAR, RAMP_COS, RAMP_SQUARE };
+
+static double ramp_curve(int curve, double x)
+{
+	switch (curve) {
+	case RAMP_COS:
+		return (1 - cos(x * M_PI)) / 2;
+	case RAMP_SQUARE:
+		return x * x;
+	default:
+		return x;
+	}
+}
+
+static void ramp_tick(struct timespec *ts, long long start, long long offset)
+{
+	long long t = start + offset;
+
+	ts->tv_sec = t / 1000000000LL;
+	ts->tv_nsec = t % 1000000000LL;
+}
+
+static int ramp_elem(snd_mixer_elem_t *elem, int capture, double target,
+		     long long duration, int curve, int rate)
+{
+	double (*get)(snd_mixer_elem_t *, snd_mixer_selem_channel_id_t);
+	int (*set)(snd_mixer_elem_t *, snd_mixer_selem_channel_id_t, double, int);
+	int (*set_all)(snd_mixer_elem_t *, double, int);
+	int (*has_channel)(snd_mixer_elem_t *, snd_mixer_selem_channel_id_t);
+	double from[SND_MIXER_SCHN_LAST + 1], x, vol;
+	snd_mixer_selem_channel_id_t chn;
+	long long start, steps, k;
+	struct timespec ts;
+	int err, same = 1, first = -1;
+
+	if (capture) {
+		get = get_normalized_capture_volume;
+		set = set_normalized_capture_volume;
+		set_all = set_normalized_capture_volume_all;
+		has_channel = snd_mixer_selem_has_capture_channel;
+	} else {
+		get = get_normalized_playback_volume;
+		set = set_normalized_playback_volume;
+		set_all = set_normalized_playback_volume_all;
+		has_channel = snd_mixer_selem_has_playback_channel;
+	}
+	for (chn = 0; chn <= SND_MIXER_SCHN_LAST; chn++) {
+		if (!has_channel(elem, chn))
+			continue;
+		from[chn] = get(elem, chn);
+		if (first < 0)
+			first = chn;
+		else if (fabs(from[chn] - from[first]) > 1e-9)
+			same = 0;
+	}
+	if (first < 0) {
+		error("No %s volume", capture ? "capture" : "playback");
+		return -EINVAL;
+	}
+
+	steps = duration * rate / 1000;
+	if (steps < 1)
+		steps = 1;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	start = ts.tv_sec * 1000000000LL + ts.tv_nsec;
+	for (k = 1; k <= steps; k++) {
+		ramp_tick(&ts, start, duration * 1000000LL * k / steps);
+		while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR)
+			;
+		x = ramp_curve(curve, (double)k / steps);
+		if (same) {
+			vol = from[first] + (target - from[first]) * x;
+			err = set_all(elem, k == steps ? target : vol, 0);
+			if (err < 0)
+				goto __err;
+			continue;
+		}
+		for (chn = 0; chn <= SND_MIXER_SCHN_LAST; chn++) {
+			if (!has_channel(elem, chn))
+				continue;
+			vol = from[chn] + (target - from[chn]) * x;
+			err = set(elem, chn, k == steps ? target : vol, 0);
+			if (err < 0)
+				goto __err;
+		}
+	}
+	return 0;
+
+ __err:
+	error("Volume set error: %s", snd_strerror(err));
+	return err;
+}
+
+static int ramp(int argc, char *argv[])
+{
+	snd_mixer_t *handle;
+	snd_mixer_elem_t *elem;
+	snd_mixer_selem_id_t *sid;
+	long long duration = -1;
+	int curve = RAMP_LINEAR, rate = RAMP_DEFAULT_RATE, capture = 0;
+	double target;
+	char *end;
+	int i, err;
+	snd_mixer_selem_id_alloca(&sid);
+
+	if (argc < 3) {
+		fprintf(stderr, "Specify a scontrol identifier, the target volume and time=<ms>\n");
+		return 1;
+	}
+	if (parse_simple_id(argv[0], sid)) {
+		fprintf(stderr, "Wrong scontrol identifier: %s\n", argv[0]);
+		return 1;
+	}
+	target = strtod(argv[1], &end);
+	if (end == argv[1] || (*end != '\0' && strcmp(end, "%")) ||
+	    target < 0 || target > 100) {
+		fprintf(stderr, "Wrong target volume '%s' (0%%-100%%)\n", argv[1]);
+		return 1;
+	}
+	target /= 100;
+	for (i = 2; i < argc; i++) {
+		if (!strncmp(argv[i], "time=", 5))
+			duration = atoll(argv[i] + 5);
+		else if (!strncmp(argv[i], "rate=", 5))
+			rate = atoi(argv[i] + 5);
+		else if (!strcmp(argv[i], "curve=linear"))
+			curve = RAMP_LINEAR;
+		else if (!strcmp(argv[i], "curve=cos"))
+			curve = RAMP_COS;
+		else if (!strcmp(argv[i], "curve=square"))
+			curve = RAMP_SQUARE;
+		else if (!strcmp(argv[i], "playback"))
+			capture = 0;
+		else if (!strcmp(argv[i], "capture"))
+			capture = 1;
+		else {
+			fprintf(stderr, "Unknown argument '%s' (time=<ms>, curve=linear|cos|square, rate=<Hz>, playback or capture)\n", argv[i]);
+			return 1;
+		}
+	}
+	if (duration < 0) {
+		fprintf(stderr, "Specify the ramp time with time=<ms>\n");
+		return 1;
+	}
+	if (rate < 1 || rate > RAMP_MAX_RATE) {
+		fprintf(stderr, "Wrong rate %d (1-%d Hz)\n", rate, RAMP_MAX_RATE);
+		return 1;
+	}
+
+	if ((err = snd_mixer_open(&handle, 0)) < 0) {
+		error("Mixer %s open error: %s", card, snd_strerror(err));
+		return 1;
+	}
+	if (smixer_level == 0 && (err = snd_mixer_attach(handle, card)) < 0) {
+		error("Mixer attach %s error: %s", card, snd_strerror(err));
+		goto __close;
+	}
+	if ((err = snd_mixer_selem_register(handle, smixer_level > 0 ? &smixer_options : NULL, NULL)) < 0) {
+		error("Mixer register error: %s", snd_strerror(err));
+		goto __close;
+	}
+	err = snd_mixer_load(handle);
+	if (err < 0) {
+		error("Mixer %s load error: %s", card, snd_strerror(err));
+		goto __close;
+	}
+	elem = snd_mixer_find_selem(handle, sid);
+	if (!elem) {
+		error("Unable to find simple control '%s',%i\n", snd_mixer_selem_id_get_name(sid), snd_mixer_selem_id_get_index(sid));
+		err = -ENOENT;
+		goto __close;
+	}
+	err = ramp_elem(elem, capture, target, duration, curve, rate);
+	if (err >= 0 && !quiet) {
+		printf("Simple mixer control '%s',%i\n", snd_mixer_selem_id_get_name(sid), snd_mixer_selem_id_get_index(sid));
+		show_selem_elem(elem, "  ", 1);
+	}
+ __close:
+	volume_mapping_clear();
+	snd_mixer_close(handle);
+	return err < 0 ? 1 : 0;
+}
+
+/*
+ * The events and sevents commands accept the arguments iface=<iface>,
+ * name=<prefix> and coalesce=<ms>. The filtered elements get no callback
+ * at all. With coalescing the value events only mark the element and the
+ * marked elements are printed once per period with their latest value.
+ */
+struct ev_elem {
+	struct ev_elem *next;		/* in the pending queue */
+	int queued;
+	snd_hctl_elem_t *helem;
+	snd_mixer_elem_t *melem;
+};
+
+static const char *ev_iface;
+static const char *ev_prefix;
+static long long ev_coalesce;		/* milliseconds */
+static long long ev_flush_time;
+static struct ev_elem *ev_queue, **ev_queue_tail = &ev_queue;
+
+static long long ev_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000LL + ts.tv_nsec / 1000000;
+}
+
+static int ev_parse_args(int argc, char *argv[])
+{
+	int i;
+
+	for (i = 0; i < argc; i++) {
+		if (!strncmp(argv[i], "iface=", 6))
+			ev_iface = argv[i] + 6;
+		else if (!strncmp(argv[i], "name=", 5))
+			ev_prefix = argv[i] + 5;
+		else if (!strncmp(argv[i], "coalesce=", 9))
+			ev_coalesce = atoi(argv[i] + 9);
+		else {
+			fprintf(stderr, "Unknown argument '%s' (iface=<iface>, name=<prefix> or coalesce=<ms>)\n", argv[i]);
+			return -EINVAL;
+		}
+	}
+	return 0;
+}
+
+static int ev_filter(snd_ctl_elem_iface_t iface, const char *name)
+{
+	if (ev_iface && strcasecmp(ev_iface, snd_ctl_elem_iface_name(iface)))
+		return 0;
+	if (ev_prefix && strncmp(ev_prefix, name, strlen(ev_prefix)))
+		return 0;
+	return 1;
+}
+
+static void ev_json_head(const char *event)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	printf("{\"ts\":%lld.%06ld,\"event\":\"%s\"", (long long)ts.tv_sec,
+	       ts.tv_nsec / 1000, event);
+}
+
+static void ev_json_name(const char *name)
+{
+	printf(",\"name\":\"");
+	for (; *name; name++) {
+		if (*name == '"' || *name == '\\')
+			printf("\\%c", *name);
+		else if ((unsigned char)*name < 0x20)
+			printf("\\u%04x", (unsigned char)*name);
+		else
+			putchar(*name);
+	}
+	printf("\"");
+}
+
+static void ev_dequeue(struct ev_elem *ev)
+{
+	struct ev_elem **pe;
+
+	if (!ev->queued)
+		return;
+	for (pe = &ev_queue; *pe && *pe != ev; pe = &(*pe)->next)
+		;
+	if (*pe)
+		*pe = ev->next;
+	for (ev_queue_tail = &ev_queue; *ev_queue_tail; ev_queue_tail = &(*ev_queue_tail)->next)
+		;
+	ev->queued = 0;
+	ev->next = NULL;
+}
+
+static void ev_enqueue(struct ev_elem *ev)
+{
+	long long now;
+
+	if (ev->queued)
+		return;
+	if (ev_queue == NULL) {
+		now = ev_now();
+		if (ev_flush_time < now)
+			ev_flush_time = now;
+	}
+	ev->queued = 1;
+	ev->next = NULL;
+	*ev_queue_tail = ev;
+	ev_queue_tail = &ev->next;
+}
+
+/* the time to wait for the next flush of the pending values */
+static int ev_timeout(void)
+{
+	long long left;
+
+	if (ev_queue == NULL)
+		return -1;
+	left = ev_flush_time - ev_now();
+	return left > 0 ? (int)left : 0;
+}
+
+static void events_json(const char *event, snd_hctl_elem_t *helem, int values)
 {
 	snd_ctl_elem_id_t *id;
+	snd_ctl_elem_info_t *info;
+	snd_ctl_elem_value_t *control;
+	unsigned int idx, count;
 	snd_ctl_elem_id_alloca(&id);
+	snd_ctl_elem_info_alloca(&info);
+	snd_ctl_elem_value_alloca(&control);
+
 	snd_hctl_elem_get_id(helem, id);
-	printf("event info: ");
-	show_control_id(id);
-	printf("\n");
+	ev_json_head(event);
+	printf(",\"numid\":%u,\"iface\":\"%s\"", snd_ctl_elem_id_get_numid(id),
+	       snd_ctl_elem_iface_name(snd_ctl_elem_id_get_interface(id)));
+	ev_json_name(snd_ctl_elem_id_get_name(id));
+	printf(",\"index\":%u,\"device\":%u,\"subdevice\":%u",
+	       snd_ctl_elem_id_get_index(id), snd_ctl_elem_id_get_device(id),
+	       snd_ctl_elem_id_get_subdevice(id));
+	if (values && snd_hctl_elem_info(helem, info) >= 0 &&
+	    snd_ctl_elem_info_is_readable(info) &&
+	    snd_hctl_elem_read(helem, control) >= 0) {
+		count = snd_ctl_elem_info_get_count(info);
+		printf(",\"values\":[");
+		for (idx = 0; idx < count; idx++) {
+			if (idx > 0)
+				printf(",");
+			switch (snd_ctl_elem_info_get_type(info)) {
+			case SND_CTL_ELEM_TYPE_BOOLEAN:
+				printf("%s", snd_ctl_elem_value_get_boolean(control, idx) ? "true" : "false");
+				break;
+			case SND_CTL_ELEM_TYPE_INTEGER:
+				printf("%li", snd_ctl_elem_value_get_integer(control, idx));
+				break;
+			case SND_CTL_ELEM_TYPE_INTEGER64:
+				printf("%lli", snd_ctl_elem_value_get_integer64(control, idx));
+				break;
+			case SND_CTL_ELEM_TYPE_ENUMERATED:
+				printf("%u", snd_ctl_elem_value_get_enumerated(control, idx));
+				break;
+			case SND_CTL_ELEM_TYPE_BYTES:
+				printf("%u", snd_ctl_elem_value_get_byte(control, idx));
+				break;
+			default:
+				printf("null");
+				break;
+			}
+		}
+		printf("]");
+	}
+	printf("}\n");
 }
 
-static void events_value(snd_hctl_elem_t *helem)
+static void events_print(const char *event, snd_hctl_elem_t *helem)
 {
 	snd_ctl_elem_id_t *id;
 	snd_ctl_elem_id_alloca(&id);
+
+	if (json_output) {
+		events_json(event, helem, !strcmp(event, "value"));
+		return;
+	}
 	snd_hctl_elem_get_id(helem, id);
-	printf("event value: ");
+	printf("event %s: ", event);
 	show_control_id(id);
 	printf("\n");
 }
 
+static void events_info(snd_hctl_elem_t *helem)
+{
+	events_print("info", helem);
+}
+
+static void events_value(snd_hctl_elem_t *helem)
+{
+	struct ev_elem *ev = snd_hctl_elem_get_callback_private(helem);
+
+	if (ev_coalesce > 0 && ev) {
+		ev_enqueue(ev);
+		return;
+	}
+	events_print("value", helem);
+}
+
 static void events_remove(snd_hctl_elem_t *helem)
 {
-	snd_ctl_elem_id_t *id;
-	snd_ctl_elem_id_alloca(&id);
-	snd_hctl_elem_get_id(helem, id);
-	printf("event remove: ");
-	show_control_id(id);
-	printf("\n");
+	struct ev_elem *ev = snd_hctl_elem_get_callback_private(helem);
+
+	events_print("remove", helem);
+	if (ev) {
+		ev_dequeue(ev);
+		free(ev);
+		snd_hctl_elem_set_callback_private(helem, NULL);
+	}
 }
 
 static int element_callback(snd_hctl_elem_t *elem, unsigned int mask)
@@ -1559,15 +2523,30 @@ static int element_callback(snd_hctl_elem_t *elem, unsigned int mask)
 	return 0;
 }
 
-static void events_add(snd_hctl_elem_t *helem)
+static int events_watch(snd_hctl_elem_t *helem)
 {
 	snd_ctl_elem_id_t *id;
+	struct ev_elem *ev;
 	snd_ctl_elem_id_alloca(&id);
+
+	/* the elements are reported by the load and by the loop in events() */
+	if (snd_hctl_elem_get_callback_private(helem))
+		return 1;
 	snd_hctl_elem_get_id(helem, id);
-	printf("event add: ");
-	show_control_id(id);
-	printf("\n");
+	if (!ev_filter(snd_ctl_elem_id_get_interface(id), snd_ctl_elem_id_get_name(id)))
+		return 0;
+	ev = calloc(1, sizeof(*ev));
+	if (ev)
+		ev->helem = helem;
+	snd_hctl_elem_set_callback_private(helem, ev);
 	snd_hctl_elem_set_callback(helem, element_callback);
+	return 1;
+}
+
+static void events_add(snd_hctl_elem_t *helem)
+{
+	if (events_watch(helem))
+		events_print("add", helem);
 }
 
 static int ctl_callback(snd_hctl_t *ctl, unsigned int mask,
@@ -1578,12 +2557,33 @@ static int ctl_callback(snd_hctl_t *ctl, unsigned int mask,
 	return 0;
 }
 
-static int events(int argc ATTRIBUTE_UNUSED, char *argv[] ATTRIBUTE_UNUSED)
+static void sevents_print(const char *event, snd_mixer_elem_t *elem);
+
+static void events_flush(void)
+{
+	struct ev_elem *ev;
+
+	while ((ev = ev_queue) != NULL) {
+		ev_queue = ev->next;
+		ev->queued = 0;
+		ev->next = NULL;
+		if (ev->helem)
+			events_print("value", ev->helem);
+		else
+			sevents_print("value", ev->melem);
+	}
+	ev_queue_tail = &ev_queue;
+	ev_flush_time = ev_now() + ev_coalesce;
+}
+
+static int events(int argc, char *argv[])
 {
 	snd_hctl_t *handle;
 	snd_hctl_elem_t *helem;
 	int err;
 
+	if ((err = ev_parse_args(argc, argv)) < 0)
+		return err;
 	if ((err = snd_hctl_open(&handle, card, 0)) < 0) {
 		error("Control %s open error: %s\n", card, snd_strerror(err));
 		return err;
@@ -1594,59 +2594,107 @@ static int events(int argc ATTRIBUTE_UNUSED, char *argv[] ATTRIBUTE_UNUSED)
 		return err;
 	}
 	for (helem = snd_hctl_first_elem(handle); helem; helem = snd_hctl_elem_next(helem)) {
-		snd_hctl_elem_set_callback(helem, element_callback);
+		events_watch(helem);
 	}
-	printf("Ready to listen...\n");
+	if (!json_output)
+		printf("Ready to listen...\n");
+	fflush(stdout);
 	while (1) {
-		int res = snd_hctl_wait(handle, -1);
-		if (res >= 0) {
-			printf("Poll ok: %i\n", res);
+		int res = snd_hctl_wait(handle, ev_timeout());
+		if (res > 0) {
+			if (!json_output)
+				printf("Poll ok: %i\n", res);
 			res = snd_hctl_handle_events(handle);
 			if (res < 0)
 				printf("ERR: %s (%d)\n", snd_strerror(res), res);
 		}
+		if (ev_queue && ev_timeout() == 0)
+			events_flush();
+		fflush(stdout);
 	}
 	snd_hctl_close(handle);
 	return 0;
 }
 
-static void sevents_value(snd_mixer_selem_id_t *sid)
-{
-	printf("event value: '%s',%i\n", snd_mixer_selem_id_get_name(sid), snd_mixer_selem_id_get_index(sid));
-}
-
-static void sevents_info(snd_mixer_selem_id_t *sid)
+static void sevents_print(const char *event, snd_mixer_elem_t *elem)
 {
-	printf("event info: '%s',%i\n", snd_mixer_selem_id_get_name(sid), snd_mixer_selem_id_get_index(sid));
-}
+	snd_mixer_selem_channel_id_t chn;
+	snd_mixer_selem_id_t *sid;
+	long val;
+	int first;
+	snd_mixer_selem_id_alloca(&sid);
 
-static void sevents_remove(snd_mixer_selem_id_t *sid)
-{
-	printf("event remove: '%s',%i\n", snd_mixer_selem_id_get_name(sid), snd_mixer_selem_id_get_index(sid));
+	snd_mixer_selem_get_id(elem, sid);
+	if (!json_output) {
+		printf("event %s: '%s',%i\n", event, snd_mixer_selem_id_get_name(sid), snd_mixer_selem_id_get_index(sid));
+		return;
+	}
+	ev_json_head(event);
+	ev_json_name(snd_mixer_selem_id_get_name(sid));
+	printf(",\"index\":%u", snd_mixer_selem_id_get_index(sid));
+	if (strcmp(event, "value") == 0) {
+		if (snd_mixer_selem_has_playback_volume(elem)) {
+			printf(",\"playback\":[");
+			for (first = 1, chn = 0; chn <= SND_MIXER_SCHN_LAST; chn++) {
+				if (!snd_mixer_selem_has_playback_channel(elem, chn))
+					continue;
+				snd_mixer_selem_get_playback_volume(elem, chn, &val);
+				printf("%s%li", first ? "" : ",", val);
+				first = 0;
+			}
+			printf("]");
+		}
+		if (snd_mixer_selem_has_capture_volume(elem)) {
+			printf(",\"capture\":[");
+			for (first = 1, chn = 0; chn <= SND_MIXER_SCHN_LAST; chn++) {
+				if (!snd_mixer_selem_has_capture_channel(elem, chn))
+					continue;
+				snd_mixer_selem_get_capture_volume(elem, chn, &val);
+				printf("%s%li", first ? "" : ",", val);
+				first = 0;
+			}
+			printf("]");
+		}
+	}
+	printf("}\n");
 }
 
 static int melem_event(snd_mixer_elem_t *elem, unsigned int mask)
 {
-	snd_mixer_selem_id_t *sid;
-	snd_mixer_selem_id_alloca(&sid);
-	snd_mixer_selem_get_id(elem, sid);
+	struct ev_elem *ev = snd_mixer_elem_get_callback_private(elem);
+
 	if (mask == SND_CTL_EVENT_MASK_REMOVE) {
-		sevents_remove(sid);
+		sevents_print("remove", elem);
+		if (ev) {
+			ev_dequeue(ev);
+			free(ev);
+			snd_mixer_elem_set_callback_private(elem, NULL);
+		}
 		return 0;
 	}
 	if (mask & SND_CTL_EVENT_MASK_INFO) 
-		sevents_info(sid);
-	if (mask & SND_CTL_EVENT_MASK_VALUE) 
-		sevents_value(sid);
+		sevents_print("info", elem);
+	if (mask & SND_CTL_EVENT_MASK_VALUE) {
+		if (ev_coalesce > 0 && ev)
+			ev_enqueue(ev);
+		else
+			sevents_print("value", elem);
+	}
 	return 0;
 }
 
 static void sevents_add(snd_mixer_elem_t *elem)
 {
-	snd_mixer_selem_id_t *sid;
-	snd_mixer_selem_id_alloca(&sid);
-	snd_mixer_selem_get_id(elem, sid);
-	printf("event add: '%s',%i\n", snd_mixer_selem_id_get_name(sid), snd_mixer_selem_id_get_index(sid));
+	struct ev_elem *ev;
+
+	/* the simple elements are all of the mixer interface */
+	if (!ev_filter(SND_CTL_ELEM_IFACE_MIXER, snd_mixer_selem_get_name(elem)))
+		return;
+	ev = calloc(1, sizeof(*ev));
+	if (ev)
+		ev->melem = elem;
+	snd_mixer_elem_set_callback_private(elem, ev);
+	sevents_print("add", elem);
 	snd_mixer_elem_set_callback(elem, melem_event);
 }
 
@@ -1658,11 +2706,13 @@ static int mixer_event(snd_mixer_t *mixer, unsigned int mask,
 	return 0;
 }
 
-static int sevents(int argc ATTRIBUTE_UNUSED, char *argv[] ATTRIBUTE_UNUSED)
+static int sevents(int argc, char *argv[])
 {
 	snd_mixer_t *handle;
 	int err;
 
+	if ((err = ev_parse_args(argc, argv)) < 0)
+		return err;
 	if ((err = snd_mixer_open(&handle, 0)) < 0) {
 		error("Mixer %s open error: %s", card, snd_strerror(err));
 		return err;
@@ -1685,15 +2735,21 @@ static int sevents(int argc ATTRIBUTE_UNUSED, char *argv[] ATTRIBUTE_UNUSED)
 		return err;
 	}
 
-	printf("Ready to listen...\n");
+	if (!json_output)
+		printf("Ready to listen...\n");
+	fflush(stdout);
 	while (1) {
 		int res;
-		res = snd_mixer_wait(handle, -1);
-		if (res >= 0) {
-			printf("Poll ok: %i\n", res);
+		res = snd_mixer_wait(handle, ev_timeout());
+		if (res > 0) {
+			if (!json_output)
+				printf("Poll ok: %i\n", res);
 			res = snd_mixer_handle_events(handle);
 			assert(res >= 0);
 		}
+		if (ev_queue && ev_timeout() == 0)
+			events_flush();
+		fflush(stdout);
 	}
 	snd_mixer_close(handle);
 	return 0;
@@ -1749,24 +2805,39 @@ static int split_line(char *buf, char **token, int max_token)
 static int exec_stdin(void)
 {
 	int narg;
-	char buf[256], *args[MAX_ARGS];
+	char *buf = NULL, *args[MAX_ARGS];
+	size_t size = 0;
 	int err = 0;
 
 	/* quiet = 1; */
 	ignore_error = 1;
 
-	while (fgets(buf, sizeof(buf), stdin)) {
+	/* the lines are not limited in length */
+	while (getline(&buf, &size, stdin) >= 0) {
 		narg = split_line(buf, args, MAX_ARGS);
 		if (narg > 0) {
 			if (!strcmp(args[0], "sset") || !strcmp(args[0], "set"))
 				err = sset(narg - 1, args + 1, 0, 1);
 			else if (!strcmp(args[0], "cset"))
 				err = cset(narg - 1, args + 1, 0, 1);
-			if (err < 0)
+			else if (!strcmp(args[0], "begin"))
+				cset_batch_active = 1;
+			else if (!strcmp(args[0], "commit"))
+				err = cset_batch_commit();
+			else if (!strcmp(args[0], "abort")) {
+				cset_batch_free();
+				cset_batch_active = 0;
+			}
+			if (err < 0) {
+				cset_batch_free();
+				free(buf);
 				return 1;
+			}
 		}
 	}
-	return 0;
+	free(buf);
+	/* an unterminated batch is written at the end of the input */
+	return cset_batch_commit() < 0 ? 1 : 0;
 }
 
 
@@ -1788,6 +2859,7 @@ int main(int argc, char *argv[])
 		{"stdin", 0, NULL, 's'},
 		{"raw-volume", 0, NULL, 'R'},
 		{"mapped-volume", 0, NULL, 'M'},
+		{"json", 0, NULL, 'j'},
 		{NULL, 0, NULL, 0},
 	};
 
@@ -1795,7 +2867,7 @@ int main(int argc, char *argv[])
 	while (1) {
 		int c;
 
-		if ((c = getopt_long(argc, argv, "hc:D:qidnva:sRM", long_option, NULL)) < 0)
+		if ((c = getopt_long(argc, argv, "hc:D:qidnva:sRMj", long_option, NULL)) < 0)
 			break;
 		switch (c) {
 		case 'h':
@@ -1858,6 +2930,9 @@ int main(int argc, char *argv[])
 		case 'M':
 			std_vol_type = VOL_MAP;
 			break;
+		case 'j':
+			json_output = 1;
+			break;
 		default:
 			fprintf(stderr, "Invalid switch or option -%c needs an argument.\n", c);
 			badopt++;
@@ -1881,6 +2956,10 @@ int main(int argc, char *argv[])
 		retval = help() ? 1 : 0;
 	} else if (!strcmp(argv[optind], "info")) {
 		retval = info() ? 1 : 0;
+	} else if (!strcmp(argv[optind], "controls") && json_output) {
+		retval = json_controls(level, argc - optind - 1, argv + optind + 1) ? 1 : 0;
+	} else if (!strcmp(argv[optind], "contents") && json_output) {
+		retval = json_controls(LEVEL_BASIC | level, argc - optind - 1, argv + optind + 1) ? 1 : 0;
 	} else if (!strcmp(argv[optind], "controls")) {
 		retval = controls(level) ? 1 : 0;
 	} else if (!strcmp(argv[optind], "contents")) {
@@ -1897,6 +2976,8 @@ int main(int argc, char *argv[])
 		retval = cset(argc - optind - 1, argc - optind > 1 ? argv + optind + 1 : NULL, 0, 0) ? 1 : 0;
 	} else if (!strcmp(argv[optind], "cget")) {
 		retval = cset(argc - optind - 1, argc - optind > 1 ? argv + optind + 1 : NULL, 1, 0) ? 1 : 0;
+	} else if (!strcmp(argv[optind], "ramp")) {
+		retval = ramp(argc - optind - 1, argc - optind > 1 ? argv + optind + 1 : NULL);
 	} else if (!strcmp(argv[optind], "events")) {
 		retval = events(argc - optind - 1, argc - optind > 1 ? argv + optind + 1 : NULL);
 	} else if (!strcmp(argv[optind], "sevents")) {
@@ -45,13 +45,18 @@
 #include <termios.h>
 #include <signal.h>
 #include <poll.h>
+#include <pthread.h>
+#include <semaphore.h>
 #include <sys/uio.h>
 #include <sys/time.h>
 #include <sys/stat.h>
 #include <sys/types.h>
+#include <sys/mman.h>
 #include <endian.h>
 #include "gettext.h"
 #include "formats.h"
+#include "sample-kernels.h"
+#include "probes.h"
 #include "version.h"
 
 #define ABS(a)  (a) < 0 ? -(a) : (a)
@@ -91,16 +96,27 @@ static snd_pcm_sframes_t (*writen_func)(snd_pcm_t *handle, void **bufs, snd_pcm_
 enum {
 	VUMETER_NONE,
 	VUMETER_MONO,
-	VUMETER_STEREO
+	VUMETER_STEREO,
+	VUMETER_MULTI
 };
 
+/* the number of channels in multi-channel VU meter */
+#define VUMETER_MAX_CHANNELS	32
+
+/* the number of additional devices for playback */
+#define FANOUT_MAX_DEVICES	8
+
 static char *command;
 static snd_pcm_t *handle;
+static snd_pcm_t *fanout_handles[FANOUT_MAX_DEVICES];
+static char *fanout_names[FANOUT_MAX_DEVICES];
+static int fanout_count = 0;
+static int fanout_linked = 0;
 static struct {
 	snd_pcm_format_t format;
 	unsigned int channels;
 	unsigned int rate;
-} hwparams, rhwparams;
+} hwparams, rhwparams, gapless_params;
 static int timelimit = 0;
 static int sampleslimit = 0;
 static int quiet_mode = 0;
@@ -124,13 +140,33 @@ static int monotonic = 0;
 static int interactive = 0;
 static int can_pause = 0;
 static int fatal_errors = 0;
+static int file_mmap = 0;
+static unsigned int write_buffers = 0;
+static int gapless = 0;
+static unsigned int prefetch_mbytes = 0;
+static unsigned int latency_budget = 0;
+static int trigger_level = 0;
+static unsigned int trigger_hangover = 2000;
+static unsigned int trigger_preroll = 500;
+static snd_pcm_uframes_t capture_chunk, capture_chunk_max;
+static unsigned int xrun_count = 0;
+static int gapless_more_files = 0;
+static int gapless_running = 0;
 static int verbose = 0;
 static int vumeter = VUMETER_NONE;
 static int buffer_pos = 0;
 static size_t significant_bits_per_sample, bits_per_sample, bits_per_frame;
+static int frame_shift = -1;	/* log2 of bytes per frame, or -1 */
+static int sample_shift = -1;	/* log2 of bytes per sample, or -1 */
 static size_t chunk_bytes;
 static int test_position = 0;
 static int test_coef = 8;
+static enum {
+	POSITION_STATS_NONE = 0,
+	POSITION_STATS_CSV,
+	POSITION_STATS_JSON,
+} position_stats_format = POSITION_STATS_NONE;
+static int position_stats_interval = 0;
 static int test_nowait = 0;
 static snd_output_t *log;
 static long long max_file_size = 0;
@@ -156,6 +192,8 @@ static unsigned int *hw_map = NULL; /* chmap to follow */
 /* needed prototypes */
 
 static void done_stdin(void);
+static void dump_position_stats(void);
+static void close_fanout(void);
 
 static void playback(char *filename);
 static void capture(char *filename);
@@ -163,17 +201,17 @@ static void playbackv(char **filenames, unsigned int count);
 static void capturev(char **filenames, unsigned int count);
 
 static void begin_voc(int fd, size_t count);
-static void end_voc(int fd);
+static void end_voc(int fd, off64_t count);
 static void begin_wave(int fd, size_t count);
-static void end_wave(int fd);
+static void end_wave(int fd, off64_t count);
 static void begin_au(int fd, size_t count);
-static void end_au(int fd);
+static void end_au(int fd, off64_t count);
 
 static void suspend(void);
 
 static const struct fmt_capture {
 	void (*start) (int fd, size_t count);
-	void (*end) (int fd);
+	void (*end) (int fd, off64_t count);
 	char *what;
 	long long max_filesize;
 } fmt_rec_table[] = {
@@ -208,7 +246,7 @@ _("Usage: %s [OPTION]... [FILE]...\n"
 "    --version           print current version\n"
 "-l, --list-devices      list all soundcards and digital audio devices\n"
 "-L, --list-pcms         list device names\n"
-"-D, --device=NAME       select PCM by name\n"
+"-D, --device=NAME       select PCM by name (repeat to play on several)\n"
 "-q, --quiet             quiet mode\n"
 "-t, --file-type TYPE    file type (voc, wav, raw or au)\n"
 "-c, --channels=#        channels\n"
@@ -227,7 +265,7 @@ _("Usage: %s [OPTION]... [FILE]...\n"
 "                        (relative to buffer size if <= 0)\n"
 "-T, --stop-delay=#      delay for automatic PCM stop is # microseconds from xrun\n"
 "-v, --verbose           show PCM structure and setup (accumulative)\n"
-"-V, --vumeter=TYPE      enable VU meter (TYPE: mono or stereo)\n"
+"-V, --vumeter=TYPE      enable VU meter (TYPE: mono, stereo or multi)\n"
 "-I, --separate-channels one file for each channel\n"
 "-i, --interactive       allow interactive operation from stdin\n"
 "-m, --chmap=ch1,ch2,..  Give the channel map to override or follow\n"
@@ -239,12 +277,26 @@ _("Usage: %s [OPTION]... [FILE]...\n"
 "    --test-coef=#       test coefficient for ring buffer position (default 8)\n"
 "                        expression for validation is: coef * (buffer_size / 2)\n"
 "    --test-nowait       do not wait for ring buffer - eats whole CPU\n"
+"    --test-position-stats=FORMAT\n"
+"                        collect statistics of ring buffer position instead of\n"
+"                        printing each suspicious one (FORMAT: csv or json)\n"
+"    --test-position-interval=#\n"
+"                        dump the statistics at each # seconds\n"
 "    --max-file-time=#   start another output file when the old file has recorded\n"
 "                        for this many seconds\n"
 "    --process-id-file   write the process ID here\n"
 "    --use-strftime      apply the strftime facility to the output file name\n"
 "    --dump-hw-params    dump hw_params of the device\n"
 "    --fatal-errors      treat all errors as fatal\n"
+"    --file-mmap         map regular files to memory for playback\n"
+"    --write-buffers=#   write files in a thread with # buffers of chunk\n"
+"    --gapless           keep playing across files in the same format\n"
+"    --prefetch=#        read regular files # MiB ahead by a thread for playback\n"
+"    --latency-budget=#  capture in small chunks growing up to # microseconds\n"
+"    --trigger-level=#   capture only while the peak is above # percent, each\n"
+"                        segment to its own file\n"
+"    --trigger-hangover=# keep a segment for # milliseconds below the level\n"
+"    --trigger-preroll=# write # milliseconds before the level is reached\n"
   )
 		, command);
 	printf(_("Recognized sample formats are:"));
@@ -260,74 +312,216 @@ _("Usage: %s [OPTION]... [FILE]...\n"
 	printf(_("-f dat (16 bit little endian, 48000, stereo)\n"));
 }
 
-static void device_list(void)
+/*
+ * The cards are probed in threads at once, so that a card which does not
+ * respond delays the list by DEVICE_LIST_TIMEOUT at most. The output of
+ * each card is kept in a buffer and printed in the order of cards; for the
+ * cards still busy at the deadline, what was found so far is printed with
+ * a marker, and their threads are left behind until the exit.
+ */
+#define DEVICE_LIST_TIMEOUT	5	/* seconds */
+
+struct card_probe {
+	int card;
+	pthread_mutex_t lock;	/* guards out and err */
+	FILE *out;
+	char *out_buf;
+	size_t out_size;
+	FILE *err;
+	char *err_buf;
+	size_t err_size;
+	int done;
+};
+
+static pthread_mutex_t probe_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t probe_cond = PTHREAD_COND_INITIALIZER;
+static int probe_pending;
+
+#define probe_error(p, ...) do {\
+	fprintf((p)->err, "%s: %s:%d: ", command, __func__, __LINE__); \
+	fprintf((p)->err, __VA_ARGS__); \
+	putc('\n', (p)->err); \
+} while (0)
+
+static void probe_card(struct card_probe *p)
 {
 	snd_ctl_t *handle;
-	int card, err, dev, idx;
+	int card = p->card, err, dev, idx;
 	snd_ctl_card_info_t *info;
 	snd_pcm_info_t *pcminfo;
+	char name[32];
 	snd_ctl_card_info_alloca(&info);
 	snd_pcm_info_alloca(&pcminfo);
 
+	sprintf(name, "hw:%d", card);
+	if ((err = snd_ctl_open(&handle, name, 0)) < 0) {
+		pthread_mutex_lock(&p->lock);
+		probe_error(p, "control open (%i): %s", card, snd_strerror(err));
+		pthread_mutex_unlock(&p->lock);
+		return;
+	}
+	if ((err = snd_ctl_card_info(handle, info)) < 0) {
+		pthread_mutex_lock(&p->lock);
+		probe_error(p, "control hardware info (%i): %s", card, snd_strerror(err));
+		pthread_mutex_unlock(&p->lock);
+		snd_ctl_close(handle);
+		return;
+	}
+	dev = -1;
+	while (1) {
+		unsigned int count;
+		if (snd_ctl_pcm_next_device(handle, &dev)<0) {
+			pthread_mutex_lock(&p->lock);
+			probe_error(p, "snd_ctl_pcm_next_device");
+			pthread_mutex_unlock(&p->lock);
+		}
+		if (dev < 0)
+			break;
+		snd_pcm_info_set_device(pcminfo, dev);
+		snd_pcm_info_set_subdevice(pcminfo, 0);
+		snd_pcm_info_set_stream(pcminfo, stream);
+		if ((err = snd_ctl_pcm_info(handle, pcminfo)) < 0) {
+			if (err != -ENOENT) {
+				pthread_mutex_lock(&p->lock);
+				probe_error(p, "control digital audio info (%i): %s", card, snd_strerror(err));
+				pthread_mutex_unlock(&p->lock);
+			}
+			continue;
+		}
+		pthread_mutex_lock(&p->lock);
+		fprintf(p->out, _("card %i: %s [%s], device %i: %s [%s]\n"),
+			card, snd_ctl_card_info_get_id(info), snd_ctl_card_info_get_name(info),
+			dev,
+			snd_pcm_info_get_id(pcminfo),
+			snd_pcm_info_get_name(pcminfo));
+		count = snd_pcm_info_get_subdevices_count(pcminfo);
+		fprintf(p->out, _("  Subdevices: %i/%i\n"),
+			snd_pcm_info_get_subdevices_avail(pcminfo), count);
+		pthread_mutex_unlock(&p->lock);
+		for (idx = 0; idx < (int)count; idx++) {
+			snd_pcm_info_set_subdevice(pcminfo, idx);
+			err = snd_ctl_pcm_info(handle, pcminfo);
+			pthread_mutex_lock(&p->lock);
+			if (err < 0) {
+				probe_error(p, "control digital audio playback info (%i): %s", card, snd_strerror(err));
+			} else {
+				fprintf(p->out, _("  Subdevice #%i: %s\n"),
+					idx, snd_pcm_info_get_subdevice_name(pcminfo));
+			}
+			pthread_mutex_unlock(&p->lock);
+		}
+	}
+	snd_ctl_close(handle);
+}
+
+static void *probe_card_thread(void *arg)
+{
+	struct card_probe *p = arg;
+
+	probe_card(p);
+
+	pthread_mutex_lock(&probe_lock);
+	p->done = 1;
+	probe_pending--;
+	pthread_cond_signal(&probe_cond);
+	pthread_mutex_unlock(&probe_lock);
+	return NULL;
+}
+
+static void device_list(void)
+{
+	struct card_probe *probes = NULL, *p;
+	int card, count = 0, busy = 0, done, i;
+	struct timespec deadline;
+	pthread_t thread;
+
 	card = -1;
 	if (snd_card_next(&card) < 0 || card < 0) {
 		error(_("no soundcards found..."));
 		return;
 	}
-	printf(_("**** List of %s Hardware Devices ****\n"),
-	       snd_pcm_stream_name(stream));
 	while (card >= 0) {
-		char name[32];
-		sprintf(name, "hw:%d", card);
-		if ((err = snd_ctl_open(&handle, name, 0)) < 0) {
-			error("control open (%i): %s", card, snd_strerror(err));
-			goto next_card;
-		}
-		if ((err = snd_ctl_card_info(handle, info)) < 0) {
-			error("control hardware info (%i): %s", card, snd_strerror(err));
-			snd_ctl_close(handle);
-			goto next_card;
-		}
-		dev = -1;
-		while (1) {
-			unsigned int count;
-			if (snd_ctl_pcm_next_device(handle, &dev)<0)
-				error("snd_ctl_pcm_next_device");
-			if (dev < 0)
-				break;
-			snd_pcm_info_set_device(pcminfo, dev);
-			snd_pcm_info_set_subdevice(pcminfo, 0);
-			snd_pcm_info_set_stream(pcminfo, stream);
-			if ((err = snd_ctl_pcm_info(handle, pcminfo)) < 0) {
-				if (err != -ENOENT)
-					error("control digital audio info (%i): %s", card, snd_strerror(err));
-				continue;
-			}
-			printf(_("card %i: %s [%s], device %i: %s [%s]\n"),
-				card, snd_ctl_card_info_get_id(info), snd_ctl_card_info_get_name(info),
-				dev,
-				snd_pcm_info_get_id(pcminfo),
-				snd_pcm_info_get_name(pcminfo));
-			count = snd_pcm_info_get_subdevices_count(pcminfo);
-			printf( _("  Subdevices: %i/%i\n"),
-				snd_pcm_info_get_subdevices_avail(pcminfo), count);
-			for (idx = 0; idx < (int)count; idx++) {
-				snd_pcm_info_set_subdevice(pcminfo, idx);
-				if ((err = snd_ctl_pcm_info(handle, pcminfo)) < 0) {
-					error("control digital audio playback info (%i): %s", card, snd_strerror(err));
-				} else {
-					printf(_("  Subdevice #%i: %s\n"),
-						idx, snd_pcm_info_get_subdevice_name(pcminfo));
-				}
-			}
+		p = realloc(probes, (count + 1) * sizeof(*probes));
+		if (p == NULL) {
+			error(_("not enough memory"));
+			break;
 		}
-		snd_ctl_close(handle);
-	next_card:
+		probes = p;
+		p = &probes[count++];
+		memset(p, 0, sizeof(*p));
+		p->card = card;
 		if (snd_card_next(&card) < 0) {
 			error("snd_card_next");
 			break;
 		}
 	}
+
+	clock_gettime(CLOCK_REALTIME, &deadline);
+	deadline.tv_sec += DEVICE_LIST_TIMEOUT;
+	for (i = 0; i < count; i++) {
+		p = &probes[i];
+		pthread_mutex_init(&p->lock, NULL);
+		p->out = open_memstream(&p->out_buf, &p->out_size);
+		p->err = open_memstream(&p->err_buf, &p->err_size);
+		if (p->out == NULL || p->err == NULL) {
+			error(_("not enough memory"));
+			if (p->out)
+				fclose(p->out);
+			free(p->out_buf);
+			count = i;
+			break;
+		}
+		pthread_mutex_lock(&probe_lock);
+		probe_pending++;
+		pthread_mutex_unlock(&probe_lock);
+		/* without a thread, the card is probed here */
+		if (pthread_create(&thread, NULL, probe_card_thread, p) != 0)
+			probe_card_thread(p);
+		else
+			pthread_detach(thread);
+	}
+
+	pthread_mutex_lock(&probe_lock);
+	while (probe_pending > 0) {
+		if (pthread_cond_timedwait(&probe_cond, &probe_lock,
+					   &deadline) == ETIMEDOUT)
+			break;
+	}
+	pthread_mutex_unlock(&probe_lock);
+
+	printf(_("**** List of %s Hardware Devices ****\n"),
+	       snd_pcm_stream_name(stream));
+	for (i = 0; i < count; i++) {
+		p = &probes[i];
+		/* done is only accessed under probe_lock */
+		pthread_mutex_lock(&probe_lock);
+		done = p->done;
+		pthread_mutex_unlock(&probe_lock);
+		if (!done)
+			busy++;
+		pthread_mutex_lock(&p->lock);
+		fflush(p->out);
+		fflush(p->err);
+		fwrite(p->out_buf, 1, p->out_size, stdout);
+		fwrite(p->err_buf, 1, p->err_size, stderr);
+		if (!done)
+			printf(_("card %i: (not responding after %i seconds, the list may be incomplete)\n"),
+			       p->card, DEVICE_LIST_TIMEOUT);
+		pthread_mutex_unlock(&p->lock);
+	}
+	fflush(stdout);
+
+	/* the buffers of busy cards are still in use by their threads */
+	if (busy > 0)
+		return;
+	for (i = 0; i < count; i++) {
+		fclose(probes[i].out);
+		fclose(probes[i].err);
+		free(probes[i].out_buf);
+		free(probes[i].err_buf);
+		pthread_mutex_destroy(&probes[i].lock);
+	}
+	free(probes);
 }
 
 static void pcm_list(void)
@@ -380,9 +574,12 @@ static void version(void)
  */
 static void prg_exit(int code) 
 {
+	if (position_stats_format)
+		dump_position_stats();
 	done_stdin();
 	if (handle)
 		snd_pcm_close(handle);
+	close_fanout();
 	if (pidfile_written)
 		remove (pidfile_name);
 	exit(code);
@@ -390,6 +587,8 @@ static void prg_exit(int code)
 
 static void signal_handler(int sig)
 {
+	int i;
+
 	if (in_aborting)
 		return;
 
@@ -400,6 +599,10 @@ static void signal_handler(int sig)
 		fprintf(stderr, _("Aborted by signal %s...\n"), strsignal(sig));
 	if (handle)
 		snd_pcm_abort(handle);
+	for (i = 0; i < fanout_count; i++) {
+		if (fanout_handles[i])
+			snd_pcm_abort(fanout_handles[i]);
+	}
 	if (sig == SIGABRT) {
 		/* do not call snd_pcm_close() and abort immediately */
 		handle = NULL;
@@ -426,11 +629,21 @@ enum {
 	OPT_TEST_POSITION,
 	OPT_TEST_COEF,
 	OPT_TEST_NOWAIT,
+	OPT_TEST_POSITION_STATS,
+	OPT_TEST_POSITION_INTERVAL,
 	OPT_MAX_FILE_TIME,
 	OPT_PROCESS_ID_FILE,
 	OPT_USE_STRFTIME,
 	OPT_DUMP_HWPARAMS,
 	OPT_FATAL_ERRORS,
+	OPT_FILE_MMAP,
+	OPT_WRITE_BUFFERS,
+	OPT_GAPLESS,
+	OPT_PREFETCH,
+	OPT_LATENCY_BUDGET,
+	OPT_TRIGGER_LEVEL,
+	OPT_TRIGGER_HANGOVER,
+	OPT_TRIGGER_PREROLL,
 };
 
 /*
@@ -512,19 +725,30 @@ int main(int argc, char *argv[])
 		{"test-position", 0, 0, OPT_TEST_POSITION},
 		{"test-coef", 1, 0, OPT_TEST_COEF},
 		{"test-nowait", 0, 0, OPT_TEST_NOWAIT},
+		{"test-position-stats", 1, 0, OPT_TEST_POSITION_STATS},
+		{"test-position-interval", 1, 0, OPT_TEST_POSITION_INTERVAL},
 		{"max-file-time", 1, 0, OPT_MAX_FILE_TIME},
 		{"process-id-file", 1, 0, OPT_PROCESS_ID_FILE},
 		{"use-strftime", 0, 0, OPT_USE_STRFTIME},
 		{"interactive", 0, 0, 'i'},
 		{"dump-hw-params", 0, 0, OPT_DUMP_HWPARAMS},
 		{"fatal-errors", 0, 0, OPT_FATAL_ERRORS},
+		{"file-mmap", 0, 0, OPT_FILE_MMAP},
+		{"write-buffers", 1, 0, OPT_WRITE_BUFFERS},
+		{"gapless", 0, 0, OPT_GAPLESS},
+		{"prefetch", 1, 0, OPT_PREFETCH},
+		{"latency-budget", 1, 0, OPT_LATENCY_BUDGET},
+		{"trigger-level", 1, 0, OPT_TRIGGER_LEVEL},
+		{"trigger-hangover", 1, 0, OPT_TRIGGER_HANGOVER},
+		{"trigger-preroll", 1, 0, OPT_TRIGGER_PREROLL},
 #ifdef CONFIG_SUPPORT_CHMAP
 		{"chmap", 1, 0, 'm'},
 #endif
 		{0, 0, 0, 0}
 	};
 	char *pcm_name = "default";
-	int tmp, err, c;
+	int pcm_name_given = 0;
+	int tmp, err, c, i;
 	int do_device_list = 0, do_pcm_list = 0, force_sample_format = 0;
 	snd_pcm_info_t *info;
 	FILE *direction;
@@ -581,7 +805,18 @@ int main(int argc, char *argv[])
 			do_pcm_list = 1;
 			break;
 		case 'D':
+			/* the additional devices play the same data */
+			if (pcm_name_given) {
+				if (fanout_count >= FANOUT_MAX_DEVICES) {
+					error(_("too many devices (up to %d)"),
+					      FANOUT_MAX_DEVICES + 1);
+					return 1;
+				}
+				fanout_names[fanout_count++] = optarg;
+				break;
+			}
 			pcm_name = optarg;
+			pcm_name_given = 1;
 			break;
 		case 'q':
 			quiet_mode = 1;
@@ -731,6 +966,8 @@ int main(int argc, char *argv[])
 		case 'V':
 			if (*optarg == 's')
 				vumeter = VUMETER_STEREO;
+			else if (!strncmp(optarg, "mu", 2))
+				vumeter = VUMETER_MULTI;
 			else if (*optarg == 'm')
 				vumeter = VUMETER_MONO;
 			else
@@ -783,6 +1020,24 @@ int main(int argc, char *argv[])
 		case OPT_TEST_NOWAIT:
 			test_nowait = 1;
 			break;
+		case OPT_TEST_POSITION_STATS:
+			if (strcasecmp(optarg, "csv") == 0) {
+				position_stats_format = POSITION_STATS_CSV;
+			} else if (strcasecmp(optarg, "json") == 0) {
+				position_stats_format = POSITION_STATS_JSON;
+			} else {
+				error(_("unknown format of statistics '%s'"), optarg);
+				return 1;
+			}
+			test_position = 1;
+			break;
+		case OPT_TEST_POSITION_INTERVAL:
+			position_stats_interval = parse_long(optarg, &err);
+			if (err < 0 || position_stats_interval < 0) {
+				error(_("invalid interval of statistics '%s'"), optarg);
+				return 1;
+			}
+			break;
 		case OPT_MAX_FILE_TIME:
 			max_file_time = parse_long(optarg, &err);
 			if (err < 0) {
@@ -802,6 +1057,57 @@ int main(int argc, char *argv[])
 		case OPT_FATAL_ERRORS:
 			fatal_errors = 1;
 			break;
+		case OPT_FILE_MMAP:
+			file_mmap = 1;
+			break;
+		case OPT_WRITE_BUFFERS:
+			write_buffers = parse_long(optarg, &err);
+			if (err < 0 || (int)write_buffers < 0 ||
+			    write_buffers > 1024) {
+				error(_("invalid number of write buffers '%s'"), optarg);
+				return 1;
+			}
+			break;
+		case OPT_GAPLESS:
+			gapless = 1;
+			break;
+		case OPT_PREFETCH:
+			prefetch_mbytes = parse_long(optarg, &err);
+			if (err < 0 || (int)prefetch_mbytes < 0 ||
+			    prefetch_mbytes > 1024) {
+				error(_("invalid size of prefetch '%s'"), optarg);
+				return 1;
+			}
+			break;
+		case OPT_LATENCY_BUDGET:
+			latency_budget = parse_long(optarg, &err);
+			if (err < 0 || (int)latency_budget < 0) {
+				error(_("invalid latency budget '%s'"), optarg);
+				return 1;
+			}
+			break;
+		case OPT_TRIGGER_LEVEL:
+			trigger_level = parse_long(optarg, &err);
+			if (err < 0 || trigger_level < 1 || trigger_level > 100) {
+				error(_("invalid trigger level '%s'"), optarg);
+				return 1;
+			}
+			break;
+		case OPT_TRIGGER_HANGOVER:
+			trigger_hangover = parse_long(optarg, &err);
+			if (err < 0 || (int)trigger_hangover < 0) {
+				error(_("invalid trigger hangover '%s'"), optarg);
+				return 1;
+			}
+			break;
+		case OPT_TRIGGER_PREROLL:
+			trigger_preroll = parse_long(optarg, &err);
+			if (err < 0 || (int)trigger_preroll < 0 ||
+			    trigger_preroll > 60000) {
+				error(_("invalid trigger preroll '%s'"), optarg);
+				return 1;
+			}
+			break;
 #ifdef CONFIG_SUPPORT_CHMAP
 		case 'm':
 			channel_map = snd_pcm_chmap_parse_string(optarg);
@@ -826,12 +1132,53 @@ int main(int argc, char *argv[])
 		goto __end;
 	}
 
+	if (fanout_count > 0) {
+		if (stream != SND_PCM_STREAM_PLAYBACK || !interleaved) {
+			error(_("several devices are available for interleaved playback only"));
+			return 1;
+		}
+#ifdef CONFIG_SUPPORT_CHMAP
+		if (channel_map) {
+			error(_("channel map is not available with several devices"));
+			return 1;
+		}
+#endif
+	}
+
+	if (trigger_level) {
+		if (stream != SND_PCM_STREAM_CAPTURE || !interleaved) {
+			error(_("trigger level is available for interleaved capture only"));
+			return 1;
+		}
+		if (max_file_time || write_buffers) {
+			error(_("trigger level is not available with --max-file-time and --write-buffers"));
+			return 1;
+		}
+	}
+
 	err = snd_pcm_open(&handle, pcm_name, stream, open_mode);
 	if (err < 0) {
 		error(_("audio open error: %s"), snd_strerror(err));
 		return 1;
 	}
 
+	for (i = 0; i < fanout_count; i++) {
+		err = snd_pcm_open(&fanout_handles[i], fanout_names[i], stream,
+				   open_mode);
+		if (err < 0) {
+			error(_("audio open error on %s: %s"), fanout_names[i],
+			      snd_strerror(err));
+			prg_exit(EXIT_FAILURE);
+		}
+		if (nonblock) {
+			err = snd_pcm_nonblock(fanout_handles[i], 1);
+			if (err < 0) {
+				error(_("nonblock setting error: %s"), snd_strerror(err));
+				prg_exit(EXIT_FAILURE);
+			}
+		}
+	}
+
 	if ((err = snd_pcm_info(handle, info)) < 0) {
 		error(_("info error: %s"), snd_strerror(err));
 		return 1;
@@ -900,6 +1247,7 @@ int main(int argc, char *argv[])
 				capture(NULL);
 		} else {
 			while (optind <= argc - 1) {
+				gapless_more_files = gapless && optind < argc - 1;
 				if (stream == SND_PCM_STREAM_PLAYBACK)
 					playback(argv[optind++]);
 				else
@@ -916,6 +1264,7 @@ int main(int argc, char *argv[])
 		putchar('\n');
 	snd_pcm_close(handle);
 	handle = NULL;
+	close_fanout();
 	free(audiobuf);
       __end:
 	snd_output_close(log);
@@ -1307,7 +1656,120 @@ static int setup_chmap(void)
 #define setup_chmap()	0
 #endif
 
+/*
+ * Conversions between frames and bytes in loops for chunks. The division is
+ * replaced with shift for the usual formats of which frames have the size
+ * of power of 2.
+ */
+static inline size_t frames_to_bytes(size_t frames)
+{
+	if (frame_shift >= 0)
+		return frames << frame_shift;
+	return frames * bits_per_frame / 8;
+}
+
+static inline size_t bytes_to_frames(size_t bytes)
+{
+	if (frame_shift >= 0)
+		return bytes >> frame_shift;
+	return bytes * 8 / bits_per_frame;
+}
+
+/* The same for the samples of one channel in non-interleaved buffers. */
+static inline size_t samples_to_bytes(size_t samples)
+{
+	if (sample_shift >= 0)
+		return samples << sample_shift;
+	return samples * bits_per_sample / 8;
+}
+
+static inline size_t bytes_to_samples(size_t bytes)
+{
+	if (sample_shift >= 0)
+		return bytes >> sample_shift;
+	return bytes * 8 / bits_per_sample;
+}
+
+static void close_fanout(void)
+{
+	int i;
+
+	for (i = 0; i < fanout_count; i++) {
+		if (fanout_handles[i])
+			snd_pcm_close(fanout_handles[i]);
+		fanout_handles[i] = NULL;
+	}
+}
+
+/* wait until all of queued frames are played back */
+static void drain_pcms(void)
+{
+	int i;
+
+	snd_pcm_nonblock(handle, 0);
+	snd_pcm_drain(handle);
+	snd_pcm_nonblock(handle, nonblock);
+
+	/* the linked ones are drained together */
+	if (fanout_linked)
+		return;
+	for (i = 0; i < fanout_count; i++) {
+		snd_pcm_nonblock(fanout_handles[i], 0);
+		snd_pcm_drain(fanout_handles[i]);
+		snd_pcm_nonblock(fanout_handles[i], nonblock);
+	}
+}
+
+static void set_params_pcm(void);
+
+/*
+ * The additional devices are configured at first, with the same parameters
+ * of transfer as the first device, so that the globals reflect the first
+ * one finally.
+ */
 static void set_params(void)
+{
+	snd_pcm_t *first = handle;
+	int i, err;
+
+	/* the frames of previous file are played before reconfiguration */
+	if (gapless_running) {
+		drain_pcms();
+		gapless_running = 0;
+	}
+
+	for (i = 0; i < fanout_count; i++) {
+		/* the rate is updated with the nearest one of the device */
+		unsigned int rate = hwparams.rate;
+
+		handle = fanout_handles[i];
+		set_params_pcm();
+		handle = first;
+		hwparams.rate = rate;
+	}
+	set_params_pcm();
+
+	/* start and stop them at the same time if possible */
+	if (fanout_count > 0 && !fanout_linked) {
+		fanout_linked = 1;
+		for (i = 0; i < fanout_count; i++) {
+			err = snd_pcm_link(handle, fanout_handles[i]);
+			if (err < 0) {
+				if (verbose)
+					fprintf(stderr, _("Warning: unable to link %s: %s\n"),
+						fanout_names[i], snd_strerror(err));
+				fanout_linked = 0;
+			}
+		}
+		/* partial linking is not worth it */
+		if (!fanout_linked) {
+			for (i = 0; i < fanout_count; i++)
+				snd_pcm_unlink(fanout_handles[i]);
+		}
+	}
+}
+
+static void set_params_pcm(void)
 {
 	snd_pcm_hw_params_t *params;
 	snd_pcm_sw_params_t *swparams;
@@ -1318,6 +1780,7 @@ static void set_params(void)
 	snd_pcm_uframes_t start_threshold, stop_threshold;
 	snd_pcm_hw_params_alloca(&params);
 	snd_pcm_sw_params_alloca(&swparams);
+
 	err = snd_pcm_hw_params_any(handle, params);
 	if (err < 0) {
 		error(_("Broken configuration for this PCM: no configurations available"));
@@ -1388,6 +1851,13 @@ static void set_params(void)
 		if (buffer_time > 500000)
 			buffer_time = 500000;
 	}
+	/* small periods to read small chunks at first */
+	if (latency_budget > 0 && stream == SND_PCM_STREAM_CAPTURE &&
+	    period_time == 0 && period_frames == 0) {
+		period_time = latency_budget / 4;
+		if (period_time < 1000)
+			period_time = 1000;
+	}
 	if (period_time == 0 && period_frames == 0) {
 		if (buffer_time > 0)
 			period_time = buffer_time / 4;
@@ -1469,7 +1939,25 @@ static void set_params(void)
 	bits_per_sample = snd_pcm_format_physical_width(hwparams.format);
 	significant_bits_per_sample = snd_pcm_format_width(hwparams.format);
 	bits_per_frame = bits_per_sample * hwparams.channels;
-	chunk_bytes = chunk_size * bits_per_frame / 8;
+	frame_shift = -1;
+	if (bits_per_frame % 8 == 0 && bits_per_frame > 0) {
+		size_t bytes = bits_per_frame / 8;
+		if ((bytes & (bytes - 1)) == 0) {
+			frame_shift = 0;
+			while ((1UL << frame_shift) < bytes)
+				frame_shift++;
+		}
+	}
+	sample_shift = -1;
+	if (bits_per_sample % 8 == 0 && bits_per_sample > 0) {
+		size_t bytes = bits_per_sample / 8;
+		if ((bytes & (bytes - 1)) == 0) {
+			sample_shift = 0;
+			while ((1UL << sample_shift) < bytes)
+				sample_shift++;
+		}
+	}
+	chunk_bytes = frames_to_bytes(chunk_size);
 	audiobuf = realloc(audiobuf, chunk_bytes);
 	if (audiobuf == NULL) {
 		error(_("not enough memory"));
@@ -1482,6 +1970,13 @@ static void set_params(void)
 		if (hwparams.channels != 2 || !interleaved || verbose > 2)
 			vumeter = VUMETER_MONO;
 	}
+	/* ...as well as multi-channel one */
+	if (vumeter == VUMETER_MULTI) {
+		if (hwparams.channels < 2 ||
+		    hwparams.channels > VUMETER_MAX_CHANNELS ||
+		    !interleaved || verbose > 2)
+			vumeter = VUMETER_MONO;
+	}
 
 	/* show mmap buffer arragment */
 	if (mmap_flag && verbose) {
@@ -1637,6 +2132,10 @@ static void xrun(void)
 		prg_exit(EXIT_FAILURE);
 	}
 	if (snd_pcm_status_get_state(status) == SND_PCM_STATE_XRUN) {
+		xrun_count++;
+		PROBE3(aplay, xrun, xrun_count,
+		       (long)snd_pcm_status_get_delay(status),
+		       (unsigned long)snd_pcm_status_get_avail(status));
 		if (fatal_errors) {
 			error(_("fatal %s: %s"),
 					stream == SND_PCM_STREAM_PLAYBACK ? _("underrun") : _("overrun"),
@@ -1779,140 +2278,164 @@ static void print_vu_meter_stereo(int *perc, int *maxperc)
 	fputs(line, stderr);
 }
 
-static void print_vu_meter(signed int *perc, signed int *maxperc)
+/* one bar for each channel, narrower for more channels */
+static void print_vu_meter_multi(int *perc, int *maxperc, int channels)
 {
-	if (vumeter == VUMETER_STEREO)
+	static const char levels[] = " .:-=+*#";
+	char line[VUMETER_MAX_CHANNELS * 2 + 80];
+	int bar_length = 72 / channels - 1;
+	int pos = 0;
+	int clip = 0;
+	int max = 0;
+	int c, val;
+
+	if (bar_length > 16)
+		bar_length = 16;
+	if (bar_length < 1)
+		bar_length = 1;
+
+	for (c = 0; c < channels; c++) {
+		if (bar_length == 1) {
+			val = perc[c] * (int)(sizeof(levels) - 2) / 100;
+			if (val > (int)sizeof(levels) - 2)
+				val = sizeof(levels) - 2;
+			line[pos++] = levels[val];
+		} else {
+			int p = perc[c] * bar_length / 100;
+			int m = maxperc[c] * bar_length / 100;
+
+			if (p > bar_length)
+				p = bar_length;
+			if (m >= bar_length)
+				m = bar_length - 1;
+			memset(line + pos, ' ', bar_length);
+			memset(line + pos, '#', p);
+			line[pos + m] = '+';
+			pos += bar_length;
+		}
+		line[pos++] = '|';
+
+		if (perc[c] > 100)
+			clip = 1;
+		if (maxperc[c] > max)
+			max = maxperc[c];
+	}
+	if (max > 99)
+		sprintf(line + pos, " MAX");
+	else
+		sprintf(line + pos, " %02i%%", max);
+	fputs(line, stderr);
+	if (clip)
+		fprintf(stderr, _(" !clip  "));
+}
+
+static void print_vu_meter(signed int *perc, signed int *maxperc, int channels)
+{
+	if (vumeter == VUMETER_MULTI)
+		print_vu_meter_multi(perc, maxperc, channels);
+	else if (vumeter == VUMETER_STEREO)
 		print_vu_meter_stereo(perc, maxperc);
 	else
 		print_vu_meter_mono(*perc, *maxperc);
 }
 
+/* the peak of each of ichans interleaved channels, -1 for unsupported size */
+static int compute_peaks(u_char *data, size_t samples, int ichans,
+			 unsigned int *max_peak)
+{
+	int format_little_endian = snd_pcm_format_little_endian(hwparams.format);
+	unsigned int mask;
+
+	memset(max_peak, 0, ichans * sizeof(*max_peak));
+	switch (bits_per_sample) {
+	case 8:
+		mask = (unsigned char)snd_pcm_format_silence(hwparams.format);
+		sample_peaks_8(data, samples / ichans, ichans, mask, max_peak);
+		break;
+	case 16:
+		mask = snd_pcm_format_silence_16(hwparams.format);
+		if (format_little_endian)
+			sample_peaks_16le(data, samples / ichans, ichans, mask,
+					   max_peak);
+		else
+			sample_peaks_16be(data, samples / ichans, ichans, mask,
+					   max_peak);
+		break;
+	case 24:
+		mask = snd_pcm_format_silence_32(hwparams.format) & 0xffffff;
+		sample_peaks_24(data, samples / ichans, ichans, mask, max_peak,
+				 format_little_endian);
+		break;
+	case 32:
+		mask = snd_pcm_format_silence_32(hwparams.format);
+		if (format_little_endian)
+			sample_peaks_32le(data, samples / ichans, ichans, mask,
+					   max_peak);
+		else
+			sample_peaks_32be(data, samples / ichans, ichans, mask,
+					   max_peak);
+		break;
+	default:
+		return -1;
+	}
+	return 0;
+}
+
+/* the peak in percent of full scale */
+static int peak_percent(unsigned int peak)
+{
+	signed int max;
+
+	max = 1 << (significant_bits_per_sample-1);
+	if (max <= 0)
+		max = 0x7fffffff;
+
+	if (bits_per_sample > 16)
+		return peak / (max / 100);
+	return peak * 100 / max;
+}
+
 /* peak handler */
 static void compute_max_peak(u_char *data, size_t samples)
 {
-	signed int val, max, perc[2], max_peak[2];
+	unsigned int max_peak[VUMETER_MAX_CHANNELS];
+	signed int val, perc[VUMETER_MAX_CHANNELS];
 	static int run = 0;
 	size_t osamples = samples;
-	int format_little_endian = snd_pcm_format_little_endian(hwparams.format);
 	int ichans, c;
 
-	if (vumeter == VUMETER_STEREO)
+	if (vumeter == VUMETER_MULTI)
+		ichans = hwparams.channels;
+	else if (vumeter == VUMETER_STEREO)
 		ichans = 2;
 	else
 		ichans = 1;
 
-	memset(max_peak, 0, sizeof(max_peak));
-	switch (bits_per_sample) {
-	case 8: {
-		signed char *valp = (signed char *)data;
-		signed char mask = snd_pcm_format_silence(hwparams.format);
-		c = 0;
-		while (samples-- > 0) {
-			val = *valp++ ^ mask;
-			val = abs(val);
-			if (max_peak[c] < val)
-				max_peak[c] = val;
-			if (vumeter == VUMETER_STEREO)
-				c = !c;
-		}
-		break;
-	}
-	case 16: {
-		signed short *valp = (signed short *)data;
-		signed short mask = snd_pcm_format_silence_16(hwparams.format);
-		signed short sval;
-
-		c = 0;
-		while (samples-- > 0) {
-			if (format_little_endian)
-				sval = le16toh(*valp);
-			else
-				sval = be16toh(*valp);
-			sval = abs(sval) ^ mask;
-			if (max_peak[c] < sval)
-				max_peak[c] = sval;
-			valp++;
-			if (vumeter == VUMETER_STEREO)
-				c = !c;
-		}
-		break;
-	}
-	case 24: {
-		unsigned char *valp = data;
-		signed int mask = snd_pcm_format_silence_32(hwparams.format);
-
-		c = 0;
-		while (samples-- > 0) {
-			if (format_little_endian) {
-				val = valp[0] | (valp[1]<<8) | (valp[2]<<16);
-			} else {
-				val = (valp[0]<<16) | (valp[1]<<8) | valp[2];
-			}
-			/* Correct signed bit in 32-bit value */
-			if (val & (1<<(bits_per_sample-1))) {
-				val |= 0xff<<24;	/* Negate upper bits too */
-			}
-			val = abs(val) ^ mask;
-			if (max_peak[c] < val)
-				max_peak[c] = val;
-			valp += 3;
-			if (vumeter == VUMETER_STEREO)
-				c = !c;
-		}
-		break;
-	}
-	case 32: {
-		signed int *valp = (signed int *)data;
-		signed int mask = snd_pcm_format_silence_32(hwparams.format);
-
-		c = 0;
-		while (samples-- > 0) {
-			if (format_little_endian)
-				val = le32toh(*valp);
-			else
-				val = be32toh(*valp);
-			val = abs(val) ^ mask;
-			if (max_peak[c] < val)
-				max_peak[c] = val;
-			valp++;
-			if (vumeter == VUMETER_STEREO)
-				c = !c;
-		}
-		break;
-	}
-	default:
+	if (compute_peaks(data, samples, ichans, max_peak) < 0) {
 		if (run == 0) {
 			fprintf(stderr, _("Unsupported bit size %d.\n"), (int)bits_per_sample);
 			run = 1;
 		}
 		return;
 	}
-	max = 1 << (significant_bits_per_sample-1);
-	if (max <= 0)
-		max = 0x7fffffff;
 
-	for (c = 0; c < ichans; c++) {
-		if (bits_per_sample > 16)
-			perc[c] = max_peak[c] / (max / 100);
-		else
-			perc[c] = max_peak[c] * 100 / max;
-	}
+	for (c = 0; c < ichans; c++)
+		perc[c] = peak_percent(max_peak[c]);
 
 	if (interleaved && verbose <= 2) {
-		static int maxperc[2];
+		static int maxperc[VUMETER_MAX_CHANNELS];
 		static time_t t=0;
 		const time_t tt=time(NULL);
 		if(tt>t) {
 			t=tt;
-			maxperc[0] = 0;
-			maxperc[1] = 0;
+			memset(maxperc, 0, sizeof(maxperc));
 		}
 		for (c = 0; c < ichans; c++)
 			if (perc[c] > maxperc[c])
 				maxperc[c] = perc[c];
 
 		putc('\r', stderr);
-		print_vu_meter(perc, maxperc);
+		print_vu_meter(perc, maxperc, ichans);
 		fflush(stderr);
 	}
 	else if (verbose==3) {
@@ -1927,15 +2450,211 @@ static void compute_max_peak(u_char *data, size_t samples)
 	}
 }
 
-static void do_test_position(void)
+/*
+ * Statistics of ring buffer position. The avail and delay given by
+ * snd_pcm_avail_delay() are compared to the ones in snd_pcm_status(), as
+ * drift. Absolute values of drift are counted in buckets of power of 2.
+ */
+#define POSITION_FILL_BUCKETS	16
+#define POSITION_DRIFT_BUCKETS	20
+
+struct position_range {
+	snd_pcm_sframes_t min;
+	snd_pcm_sframes_t max;
+	double sum;
+};
+
+static struct {
+	struct timespec start;
+	struct timespec last_dump;
+	int header_printed;
+	unsigned long long samples;
+	unsigned long long out_of_range;
+	unsigned long long status_out_of_range;
+	unsigned long long avail_over_delay;
+	struct position_range avail;
+	struct position_range delay;
+	struct position_range avail_drift;
+	struct position_range delay_drift;
+	/* the last one is for the values out of buffer */
+	unsigned long long avail_fill[POSITION_FILL_BUCKETS + 1];
+	unsigned long long avail_drift_hist[POSITION_DRIFT_BUCKETS];
+	unsigned long long delay_drift_hist[POSITION_DRIFT_BUCKETS];
+} position_stats;
+
+static void position_range_add(struct position_range *range,
+			       snd_pcm_sframes_t val)
 {
-	static long counter = 0;
-	static time_t tmr = -1;
-	time_t now;
-	static float availsum, delaysum, samples;
-	static snd_pcm_sframes_t maxavail, maxdelay;
-	static snd_pcm_sframes_t minavail, mindelay;
-	static snd_pcm_sframes_t badavail = 0, baddelay = 0;
+	if (position_stats.samples == 0) {
+		range->min = val;
+		range->max = val;
+	} else if (val < range->min) {
+		range->min = val;
+	} else if (val > range->max) {
+		range->max = val;
+	}
+	range->sum += val;
+}
+
+static void position_drift_add(unsigned long long *hist,
+			       snd_pcm_sframes_t drift)
+{
+	unsigned long long val = drift < 0 ? -(unsigned long long)drift : drift;
+	int i = 0;
+
+	while (val > 0 && i < POSITION_DRIFT_BUCKETS - 1) {
+		val >>= 1;
+		i++;
+	}
+	hist[i]++;
+}
+
+static void add_position_stats(snd_pcm_sframes_t avail,
+			       snd_pcm_sframes_t delay,
+			       snd_pcm_sframes_t savail,
+			       snd_pcm_sframes_t sdelay)
+{
+	int i;
+
+	if (position_stats.samples == 0) {
+		clock_gettime(CLOCK_MONOTONIC, &position_stats.start);
+		position_stats.last_dump = position_stats.start;
+	}
+
+	position_range_add(&position_stats.avail, avail);
+	position_range_add(&position_stats.delay, delay);
+	position_range_add(&position_stats.avail_drift, savail - avail);
+	position_range_add(&position_stats.delay_drift, sdelay - delay);
+
+	if (avail < 0 || buffer_frames <= 0 || avail >= buffer_frames)
+		i = POSITION_FILL_BUCKETS;
+	else
+		i = avail * POSITION_FILL_BUCKETS / buffer_frames;
+	position_stats.avail_fill[i]++;
+	position_drift_add(position_stats.avail_drift_hist, savail - avail);
+	position_drift_add(position_stats.delay_drift_hist, sdelay - delay);
+
+	position_stats.samples++;
+
+	if (position_stats_interval > 0) {
+		struct timespec now;
+
+		clock_gettime(CLOCK_MONOTONIC, &now);
+		if (now.tv_sec - position_stats.last_dump.tv_sec >=
+		    position_stats_interval) {
+			dump_position_stats();
+			position_stats.last_dump = now;
+		}
+	}
+}
+
+static double position_mean(const struct position_range *range)
+{
+	return position_stats.samples ? range->sum / position_stats.samples : 0;
+}
+
+static void dump_position_hist(const char *label,
+			       const unsigned long long *hist, int count)
+{
+	int i;
+
+	if (position_stats_format == POSITION_STATS_CSV) {
+		for (i = 0; i < count; i++)
+			fprintf(stderr, ",%llu", hist[i]);
+		return;
+	}
+
+	fprintf(stderr, ",\"%s\":[", label);
+	for (i = 0; i < count; i++)
+		fprintf(stderr, "%s%llu", i > 0 ? "," : "", hist[i]);
+	fprintf(stderr, "]");
+}
+
+static void dump_position_range(const char *label,
+				const struct position_range *range)
+{
+	if (position_stats_format == POSITION_STATS_CSV) {
+		fprintf(stderr, ",%li,%li,%.2f", (long)range->min,
+			(long)range->max, position_mean(range));
+	} else {
+		fprintf(stderr, ",\"%s\":{\"min\":%li,\"max\":%li,\"mean\":%.2f}",
+			label, (long)range->min, (long)range->max,
+			position_mean(range));
+	}
+}
+
+/* one line of CSV or JSON object for each call */
+static void dump_position_stats(void)
+{
+	static const char *const ranges[] = {
+		"avail", "delay", "avail_drift", "delay_drift",
+	};
+	struct timespec now;
+	double elapsed;
+	int i, j;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	elapsed = position_stats.samples == 0 ? 0 :
+		  (now.tv_sec - position_stats.start.tv_sec) +
+		  (now.tv_nsec - position_stats.start.tv_nsec) / 1e9;
+
+	if (position_stats_format == POSITION_STATS_CSV) {
+		if (!position_stats.header_printed) {
+			fprintf(stderr, "elapsed,buffer,samples,out_of_range,"
+				"status_out_of_range,avail_over_delay");
+			for (i = 0; i < 4; i++)
+				fprintf(stderr, ",%s_min,%s_max,%s_mean",
+					ranges[i], ranges[i], ranges[i]);
+			for (i = 0; i <= POSITION_FILL_BUCKETS; i++)
+				fprintf(stderr, ",avail_fill_%i", i);
+			for (i = 0; i < 2; i++) {
+				for (j = 0; j < POSITION_DRIFT_BUCKETS; j++)
+					fprintf(stderr, ",%s_hist_%i",
+						ranges[i + 2], j);
+			}
+			fprintf(stderr, "\n");
+			position_stats.header_printed = 1;
+		}
+		fprintf(stderr, "%.3f,%li,%llu,%llu,%llu,%llu", elapsed,
+			(long)buffer_frames, position_stats.samples,
+			position_stats.out_of_range,
+			position_stats.status_out_of_range,
+			position_stats.avail_over_delay);
+	} else {
+		fprintf(stderr, "{\"elapsed\":%.3f,\"buffer\":%li,"
+			"\"samples\":%llu,\"out_of_range\":%llu,"
+			"\"status_out_of_range\":%llu,"
+			"\"avail_over_delay\":%llu", elapsed,
+			(long)buffer_frames, position_stats.samples,
+			position_stats.out_of_range,
+			position_stats.status_out_of_range,
+			position_stats.avail_over_delay);
+	}
+
+	dump_position_range(ranges[0], &position_stats.avail);
+	dump_position_range(ranges[1], &position_stats.delay);
+	dump_position_range(ranges[2], &position_stats.avail_drift);
+	dump_position_range(ranges[3], &position_stats.delay_drift);
+	dump_position_hist("avail_fill", position_stats.avail_fill,
+			   POSITION_FILL_BUCKETS + 1);
+	dump_position_hist("avail_drift_hist", position_stats.avail_drift_hist,
+			   POSITION_DRIFT_BUCKETS);
+	dump_position_hist("delay_drift_hist", position_stats.delay_drift_hist,
+			   POSITION_DRIFT_BUCKETS);
+
+	fprintf(stderr, position_stats_format == POSITION_STATS_CSV ?
+		"\n" : "}\n");
+}
+
+static void do_test_position(void)
+{
+	static long counter = 0;
+	static time_t tmr = -1;
+	time_t now;
+	static float availsum, delaysum, samples;
+	static snd_pcm_sframes_t maxavail, maxdelay;
+	static snd_pcm_sframes_t minavail, mindelay;
+	static snd_pcm_sframes_t badavail = 0, baddelay = 0;
 	snd_pcm_sframes_t outofrange;
 	snd_pcm_sframes_t avail, delay, savail, sdelay;
 	snd_pcm_status_t *status;
@@ -1951,6 +2670,22 @@ static void do_test_position(void)
 	savail = snd_pcm_status_get_avail(status);
 	sdelay = snd_pcm_status_get_delay(status);
 	outofrange = (test_coef * (snd_pcm_sframes_t)buffer_frames) / 2;
+
+	/* just count suspicious positions without printing them */
+	if (position_stats_format) {
+		if (avail > outofrange || avail < -outofrange ||
+		    delay > outofrange || delay < -outofrange)
+			position_stats.out_of_range++;
+		else if (savail > outofrange || savail < -outofrange ||
+			 sdelay > outofrange || sdelay < -outofrange)
+			position_stats.status_out_of_range++;
+		else if (stream == SND_PCM_STREAM_CAPTURE &&
+			 (avail > delay || savail > sdelay))
+			position_stats.avail_over_delay++;
+		add_position_stats(avail, delay, savail, sdelay);
+		return;
+	}
+
 	if (avail > outofrange || avail < -outofrange ||
 	    delay > outofrange || delay < -outofrange) {
 		badavail = avail; baddelay = delay;
@@ -2027,17 +2762,19 @@ static void do_test_position(void)
 #ifdef CONFIG_SUPPORT_CHMAP
 static u_char *remap_data(u_char *data, size_t count)
 {
-	static u_char *tmp, *src, *dst;
+	static u_char *tmp;
 	static size_t tmp_size;
 	size_t sample_bytes = bits_per_sample / 8;
 	size_t step = bits_per_frame / 8;
 	size_t chunk_bytes;
+	unsigned int channels = hwparams.channels;
+	u_char *src, *dst;
 	unsigned int ch, i;
 
 	if (!hw_map)
 		return data;
 
-	chunk_bytes = count * bits_per_frame / 8;
+	chunk_bytes = count * step;
 	if (tmp_size < chunk_bytes) {
 		free(tmp);
 		tmp = malloc(chunk_bytes);
@@ -2045,13 +2782,20 @@ static u_char *remap_data(u_char *data, size_t count)
 			error(_("not enough memory"));
 			exit(1);
 		}
-		tmp_size = count;
+		tmp_size = chunk_bytes;
 	}
 
+	/* the kernels load samples by memcpy, the data can be unaligned */
+	if (step == sample_bytes * channels) {
+		sample_remap(tmp, data, count, channels, hw_map, sample_bytes);
+		return tmp;
+	}
+
+	/* the frames are padded */
 	src = data;
 	dst = tmp;
 	for (i = 0; i < count; i++) {
-		for (ch = 0; ch < hwparams.channels; ch++) {
+		for (ch = 0; ch < channels; ch++) {
 			memcpy(dst, src + sample_bytes * hw_map[ch],
 			       sample_bytes);
 			dst += sample_bytes;
@@ -2061,6 +2805,7 @@ static u_char *remap_data(u_char *data, size_t count)
 	return tmp;
 }
 
+/* Just the pointers to buffers are permuted. */
 static u_char **remap_datav(u_char **data, size_t count)
 {
 	static u_char **tmp;
@@ -2075,9 +2820,9 @@ static u_char **remap_datav(u_char **data, size_t count)
 			error(_("not enough memory"));
 			exit(1);
 		}
-		for (ch = 0; ch < hwparams.channels; ch++)
-			tmp[ch] = data[hw_map[ch]];
 	}
+	for (ch = 0; ch < hwparams.channels; ch++)
+		tmp[ch] = data[hw_map[ch]];
 	return tmp;
 }
 #else
@@ -2089,16 +2834,62 @@ static u_char **remap_datav(u_char **data, size_t count)
  *  write function
  */
 
+/*
+ * The additional devices get the same chunk before the first device, so
+ * that all of them have the same amount of frames when started by link.
+ */
+static void write_fanout(u_char *data, size_t count)
+{
+	int i;
+
+	for (i = 0; i < fanout_count; i++) {
+		snd_pcm_t *pcm = fanout_handles[i];
+		u_char *pos = data;
+		size_t rest = count;
+		ssize_t r;
+
+		while (rest > 0 && !in_aborting) {
+			r = writei_func(pcm, pos, rest);
+			if (r == -EAGAIN || (r >= 0 && (size_t)r < rest)) {
+				if (!test_nowait)
+					snd_pcm_wait(pcm, 100);
+			} else if (r == -EPIPE || r == -ESTRPIPE) {
+				if (!quiet_mode)
+					fprintf(stderr, _("%s on %s\n"),
+						r == -EPIPE ? _("underrun") : _("suspended"),
+						fanout_names[i]);
+				r = snd_pcm_recover(pcm, r, 1);
+				if (r < 0) {
+					error(_("write error on %s: %s"),
+					      fanout_names[i], snd_strerror(r));
+					prg_exit(EXIT_FAILURE);
+				}
+			} else if (r < 0) {
+				error(_("write error on %s: %s"), fanout_names[i],
+				      snd_strerror(r));
+				prg_exit(EXIT_FAILURE);
+			}
+			if (r > 0) {
+				rest -= r;
+				pos += frames_to_bytes(r);
+			}
+		}
+	}
+}
+
 static ssize_t pcm_write(u_char *data, size_t count)
 {
 	ssize_t r;
 	ssize_t result = 0;
 
-	if (count < chunk_size) {
-		snd_pcm_format_set_silence(hwparams.format, data + count * bits_per_frame / 8, (chunk_size - count) * hwparams.channels);
+	/* the tail of file is followed by the next file without padding */
+	if (count < chunk_size && !gapless) {
+		snd_pcm_format_set_silence(hwparams.format, data + frames_to_bytes(count), (chunk_size - count) * hwparams.channels);
 		count = chunk_size;
 	}
 	data = remap_data(data, count);
+	if (fanout_count > 0)
+		write_fanout(data, count);
 	while (count > 0 && !in_aborting) {
 		if (test_position)
 			do_test_position();
@@ -2122,7 +2913,7 @@ static ssize_t pcm_write(u_char *data, size_t count)
 				compute_max_peak(data, r * hwparams.channels);
 			result += r;
 			count -= r;
-			data += r * bits_per_frame / 8;
+			data += frames_to_bytes(r);
 		}
 	}
 	return result;
@@ -2138,7 +2929,7 @@ static ssize_t pcm_writev(u_char **data, unsigned int channels, size_t count)
 		size_t offset = count;
 		size_t remaining = chunk_size - count;
 		for (channel = 0; channel < channels; channel++)
-			snd_pcm_format_set_silence(hwparams.format, data[channel] + offset * bits_per_sample / 8, remaining);
+			snd_pcm_format_set_silence(hwparams.format, data[channel] + samples_to_bytes(offset), remaining);
 		count = chunk_size;
 	}
 	data = remap_datav(data, count);
@@ -2147,7 +2938,7 @@ static ssize_t pcm_writev(u_char **data, unsigned int channels, size_t count)
 		void *bufs[channels];
 		size_t offset = result;
 		for (channel = 0; channel < channels; channel++)
-			bufs[channel] = data[channel] + offset * bits_per_sample / 8;
+			bufs[channel] = data[channel] + samples_to_bytes(offset);
 		if (test_position)
 			do_test_position();
 		check_stdin();
@@ -2187,7 +2978,8 @@ static ssize_t pcm_read(u_char *data, size_t rcount)
 	size_t result = 0;
 	size_t count = rcount;
 
-	if (count != chunk_size) {
+	/* the size of chunk varies in the mode for latency */
+	if (count != chunk_size && !latency_budget) {
 		count = chunk_size;
 	}
 
@@ -2216,7 +3008,7 @@ static ssize_t pcm_read(u_char *data, size_t rcount)
 				compute_max_peak(data, r * hwparams.channels);
 			result += r;
 			count -= r;
-			data += r * bits_per_frame / 8;
+			data += frames_to_bytes(r);
 		}
 	}
 abort:
@@ -2240,7 +3032,7 @@ static ssize_t pcm_readv(u_char **data, unsigned int channels, size_t rcount)
 		void *bufs[channels];
 		size_t offset = result;
 		for (channel = 0; channel < channels; channel++)
-			bufs[channel] = data[channel] + offset * bits_per_sample / 8;
+			bufs[channel] = data[channel] + samples_to_bytes(offset);
 		if (test_position)
 			do_test_position();
 		check_stdin();
@@ -2275,12 +3067,24 @@ abort:
  *  ok, let's play a .voc file
  */
 
+/* the size of buffer to read VOC file */
+#define VOC_BUFFER_SIZE		(64 * 1024)
+
 static ssize_t voc_pcm_write(u_char *data, size_t count)
 {
 	ssize_t result = count, r;
 	size_t size;
 
 	while (count > 0 && !in_aborting) {
+		/* full chunks are transferred without copy */
+		if (buffer_pos == 0 && count >= chunk_bytes) {
+			if ((size_t)(r = pcm_write(data, chunk_size)) != chunk_size)
+				return r;
+			data += chunk_bytes;
+			count -= chunk_bytes;
+			continue;
+		}
+
 		size = count;
 		if (size > chunk_bytes - buffer_pos)
 			size = chunk_bytes - buffer_pos;
@@ -2297,43 +3101,45 @@ static ssize_t voc_pcm_write(u_char *data, size_t count)
 	return result;
 }
 
+/* the silence is filled in the buffer for chunk directly */
 static void voc_write_silence(unsigned x)
 {
-	unsigned l;
-	u_char *buf;
+	int filled = 0;
+	size_t size;
 
-	buf = (u_char *) malloc(chunk_bytes);
-	if (buf == NULL) {
-		error(_("can't allocate buffer for silence"));
-		return;		/* not fatal error */
-	}
-	snd_pcm_format_set_silence(hwparams.format, buf, chunk_size * hwparams.channels);
 	while (x > 0 && !in_aborting) {
-		l = x;
-		if (l > chunk_size)
-			l = chunk_size;
-		if (voc_pcm_write(buf, l) != (ssize_t)l) {
-			error(_("write error"));
-			prg_exit(EXIT_FAILURE);
+		size = x;
+		if (size > chunk_bytes - buffer_pos)
+			size = chunk_bytes - buffer_pos;
+		/* the full chunk of silence is reused as is */
+		if (!filled || buffer_pos > 0 || size < chunk_bytes)
+			snd_pcm_format_set_silence(hwparams.format,
+						   audiobuf + buffer_pos,
+						   bytes_to_samples(size));
+		filled = buffer_pos == 0 && size == chunk_bytes;
+		buffer_pos += size;
+		x -= size;
+		if ((size_t)buffer_pos == chunk_bytes) {
+			if (pcm_write(audiobuf, chunk_size) != (ssize_t)chunk_size) {
+				error(_("write error"));
+				prg_exit(EXIT_FAILURE);
+			}
+			buffer_pos = 0;
 		}
-		x -= l;
 	}
-	free(buf);
 }
 
 static void voc_pcm_flush(void)
 {
 	if (buffer_pos > 0) {
 		size_t b;
-		if (snd_pcm_format_set_silence(hwparams.format, audiobuf + buffer_pos, chunk_bytes - buffer_pos * 8 / bits_per_sample) < 0)
+		if (snd_pcm_format_set_silence(hwparams.format, audiobuf + buffer_pos, bytes_to_samples(chunk_bytes - buffer_pos)) < 0)
 			fprintf(stderr, _("voc_pcm_flush - silence error"));
 		b = chunk_size;
 		if (pcm_write(audiobuf, b) != (ssize_t)b)
 			error(_("voc_pcm_flush error"));
 	}
-	snd_pcm_nonblock(handle, 0);
-	snd_pcm_drain(handle);
-	snd_pcm_nonblock(handle, nonblock);
+	drain_pcms();
 }
 
 static void voc_play(int fd, int ofs, char *name)
@@ -2351,7 +3157,7 @@ static void voc_play(int fd, int ofs, char *name)
 #define COUNT(x)	nextblock -= x; in_buffer -= x; data += x
 #define COUNT1(x)	in_buffer -= x; data += x
 
-	data = buf = (u_char *)malloc(64 * 1024);
+	data = buf = (u_char *)malloc(VOC_BUFFER_SIZE);
 	buffer_pos = 0;
 	if (data == NULL) {
 		error(_("malloc error"));
@@ -2385,9 +3191,9 @@ static void voc_play(int fd, int ofs, char *name)
 		if (in_buffer < 32) {
 			/* move the rest of buffer to pos 0 and fill the buf up */
 			if (in_buffer)
-				memcpy(buf, data, in_buffer);
+				memmove(buf, data, in_buffer);
 			data = buf;
-			if ((l = safe_read(fd, buf + in_buffer, chunk_bytes - in_buffer)) > 0)
+			if ((l = safe_read(fd, buf + in_buffer, VOC_BUFFER_SIZE - in_buffer)) > 0)
 				in_buffer += l;
 			else if (!in_buffer) {
 				/* the file is truncated, so simulate 'Terminator' 
@@ -2738,7 +3544,7 @@ static void begin_au(int fd, size_t cnt)
 }
 
 /* closing .VOC */
-static void end_voc(int fd)
+static void end_voc(int fd, off64_t count)
 {
 	off64_t length_seek;
 	VocBlockType bt;
@@ -2753,7 +3559,7 @@ static void end_voc(int fd)
 	if (hwparams.channels > 1)
 		length_seek += sizeof(VocBlockType) + sizeof(VocExtBlock);
 	bt.type = 1;
-	cnt = fdcount;
+	cnt = count;
 	cnt += sizeof(VocVoiceData);	/* Channel_data block follows */
 	if (cnt > 0x00ffffff)
 		cnt = 0x00ffffff;
@@ -2764,7 +3570,7 @@ static void end_voc(int fd)
 		xwrite(fd, &bt, sizeof(VocBlockType));
 }
 
-static void end_wave(int fd)
+static void end_wave(int fd, off64_t count)
 {				/* only close output */
 	WaveChunkHeader cd;
 	off64_t length_seek;
@@ -2775,8 +3581,8 @@ static void end_wave(int fd)
 		      sizeof(WaveChunkHeader) +
 		      sizeof(WaveFmtBody);
 	cd.type = WAV_DATA;
-	cd.length = fdcount > 0x7fffffff ? LE_INT(0x7fffffff) : LE_INT(fdcount);
-	filelen = fdcount + 2*sizeof(WaveChunkHeader) + sizeof(WaveFmtBody) + 4;
+	cd.length = count > 0x7fffffff ? LE_INT(0x7fffffff) : LE_INT(count);
+	filelen = count + 2*sizeof(WaveChunkHeader) + sizeof(WaveFmtBody) + 4;
 	rifflen = filelen > 0x7fffffff ? LE_INT(0x7fffffff) : LE_INT(filelen);
 	if (lseek64(fd, 4, SEEK_SET) == 4)
 		xwrite(fd, &rifflen, 4);
@@ -2784,13 +3590,13 @@ static void end_wave(int fd)
 		xwrite(fd, &cd, sizeof(WaveChunkHeader));
 }
 
-static void end_au(int fd)
+static void end_au(int fd, off64_t count)
 {				/* only close output */
 	AuHeader ah;
 	off64_t length_seek;
 	
 	length_seek = (char *)&ah.data_size - (char *)&ah;
-	ah.data_size = fdcount > 0xffffffff ? 0xffffffff : BE_INT(fdcount);
+	ah.data_size = count > 0xffffffff ? 0xffffffff : BE_INT(count);
 	if (lseek64(fd, length_seek, SEEK_SET) == length_seek)
 		xwrite(fd, &ah.data_size, sizeof(ah.data_size));
 }
@@ -2816,6 +3622,272 @@ static void header(int rtype, char *name)
 	}
 }
 
+/* the window of read-ahead for mapped files */
+#define FILE_MMAP_READAHEAD	(1024 * 1024)
+
+/*
+ * write frames directly from the regular file mapped to memory, instead of
+ * reading them into audio buffer; returns -1 to fall back to read(2)
+ */
+/*
+ * The prefetch thread reads a regular file into a ring of bytes ahead of
+ * the playback position, so that a stall of read on network storage is
+ * absorbed by the ring, instead of causing underruns.
+ */
+#define PREFETCH_READ_SIZE	(64 * 1024)
+
+static struct {
+	pthread_t thread;
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+	int running;
+	int fd;
+	u_char *buf;
+	size_t size;
+	/* total bytes in each side, so that the depth is head - tail */
+	off64_t head;
+	off64_t tail;
+	off64_t remain;
+	int eof;
+	int err;
+	int stop;
+	size_t min_depth;
+	unsigned int stalls;
+} prefetch = {
+	.lock = PTHREAD_MUTEX_INITIALIZER,
+	.cond = PTHREAD_COND_INITIALIZER,
+};
+
+static void *prefetch_thread(void *arg)
+{
+	pthread_mutex_lock(&prefetch.lock);
+	while (!prefetch.stop && prefetch.remain > 0) {
+		size_t pos, len;
+		ssize_t r;
+
+		while (!prefetch.stop &&
+		       prefetch.head - prefetch.tail == (off64_t)prefetch.size)
+			pthread_cond_wait(&prefetch.cond, &prefetch.lock);
+		if (prefetch.stop)
+			break;
+
+		pos = prefetch.head % prefetch.size;
+		len = prefetch.size - (prefetch.head - prefetch.tail);
+		if (len > prefetch.size - pos)
+			len = prefetch.size - pos;
+		if (len > PREFETCH_READ_SIZE)
+			len = PREFETCH_READ_SIZE;
+		if ((off64_t)len > prefetch.remain)
+			len = prefetch.remain;
+
+		/* the area is not touched by reader until head moves */
+		pthread_mutex_unlock(&prefetch.lock);
+		r = read(prefetch.fd, prefetch.buf + pos, len);
+		pthread_mutex_lock(&prefetch.lock);
+
+		if (r < 0) {
+			if (errno == EINTR)
+				continue;
+			prefetch.err = errno;
+			break;
+		}
+		if (r == 0)
+			break;
+		prefetch.head += r;
+		prefetch.remain -= r;
+		pthread_cond_broadcast(&prefetch.cond);
+	}
+	prefetch.eof = 1;
+	pthread_cond_broadcast(&prefetch.cond);
+	pthread_mutex_unlock(&prefetch.lock);
+
+	return NULL;
+}
+
+/* the data is read by the thread just when the file is regular one */
+static void prefetch_start(int fd, off64_t remain)
+{
+	sigset_t sigset, prev;
+	struct stat st;
+	int err;
+
+	if (prefetch_mbytes == 0 || remain <= 0)
+		return;
+	if (fstat(fd, &st) < 0 || !S_ISREG(st.st_mode))
+		return;
+
+	if (prefetch.buf == NULL) {
+		prefetch.size = (size_t)prefetch_mbytes * 1024 * 1024;
+		prefetch.buf = malloc(prefetch.size);
+		if (prefetch.buf == NULL) {
+			error(_("not enough memory"));
+			prg_exit(EXIT_FAILURE);
+		}
+	}
+
+	prefetch.fd = fd;
+	prefetch.head = 0;
+	prefetch.tail = 0;
+	prefetch.remain = remain;
+	prefetch.eof = 0;
+	prefetch.err = 0;
+	prefetch.stop = 0;
+	prefetch.min_depth = prefetch.size;
+	prefetch.stalls = 0;
+
+	/* signals are handled by the main thread */
+	sigfillset(&sigset);
+	pthread_sigmask(SIG_BLOCK, &sigset, &prev);
+	err = pthread_create(&prefetch.thread, NULL, prefetch_thread, NULL);
+	pthread_sigmask(SIG_SETMASK, &prev, NULL);
+	if (err) {
+		fprintf(stderr, _("Warning: unable to start prefetch: %s\n"),
+			strerror(err));
+		return;
+	}
+	prefetch.running = 1;
+}
+
+static void prefetch_stop(void)
+{
+	if (!prefetch.running)
+		return;
+
+	pthread_mutex_lock(&prefetch.lock);
+	prefetch.stop = 1;
+	pthread_cond_broadcast(&prefetch.cond);
+	pthread_mutex_unlock(&prefetch.lock);
+	pthread_join(prefetch.thread, NULL);
+	prefetch.running = 0;
+
+	if (verbose)
+		fprintf(stderr, _("Prefetch: %zu bytes at least ahead of %zu, "
+				  "%u times empty\n"),
+			prefetch.min_depth, prefetch.size, prefetch.stalls);
+}
+
+/* behaves as safe_read() */
+static ssize_t prefetch_read(int fd, void *buf, size_t count)
+{
+	ssize_t result = 0;
+
+	if (!prefetch.running)
+		return safe_read(fd, buf, count);
+
+	pthread_mutex_lock(&prefetch.lock);
+	while (count > 0 && !in_aborting) {
+		size_t depth = prefetch.head - prefetch.tail;
+		size_t pos, len;
+
+		if (depth < prefetch.min_depth && !prefetch.eof)
+			prefetch.min_depth = depth;
+		if (depth == 0) {
+			if (prefetch.eof)
+				break;
+			prefetch.stalls++;
+			while (prefetch.head == prefetch.tail && !prefetch.eof)
+				pthread_cond_wait(&prefetch.cond,
+						  &prefetch.lock);
+			continue;
+		}
+
+		pos = prefetch.tail % prefetch.size;
+		len = depth;
+		if (len > prefetch.size - pos)
+			len = prefetch.size - pos;
+		if (len > count)
+			len = count;
+		memcpy(buf, prefetch.buf + pos, len);
+		prefetch.tail += len;
+		pthread_cond_broadcast(&prefetch.cond);
+
+		buf = (char *)buf + len;
+		count -= len;
+		result += len;
+	}
+	if (result == 0 && prefetch.err) {
+		errno = prefetch.err;
+		result = -1;
+	}
+	pthread_mutex_unlock(&prefetch.lock);
+
+	return result;
+}
+
+static int playback_go_mapped(int fd, size_t loaded, off64_t count)
+{
+	const off64_t page_mask = sysconf(_SC_PAGESIZE) - 1;
+	struct stat st;
+	off64_t offset, map_offset;
+	off64_t written = 0;
+	size_t map_size, head, advised, l;
+	u_char *map, *data;
+	ssize_t frames, r;
+
+	if (fstat(fd, &st) < 0 || !S_ISREG(st.st_mode))
+		return -1;
+	offset = lseek64(fd, 0, SEEK_CUR);
+	if (offset < 0 || offset < (off64_t)loaded)
+		return -1;
+
+	/* the loaded bytes are the beginning of data */
+	offset -= loaded;
+	if (count > st.st_size - offset)
+		count = st.st_size - offset;
+	if (count <= 0)
+		return -1;
+
+	map_offset = offset & ~page_mask;
+	head = offset - map_offset;
+	if ((unsigned long long)count > (size_t)-1 - head)
+		return -1;
+	map_size = count + head;
+	map = mmap(NULL, map_size, PROT_READ, MAP_PRIVATE, fd, map_offset);
+	if (map == MAP_FAILED)
+		return -1;
+	data = map + head;
+
+	/* start to read ahead, so that the first writes don't wait for disk */
+	posix_fadvise(fd, offset, count, POSIX_FADV_SEQUENTIAL);
+	madvise(map, map_size, MADV_SEQUENTIAL);
+	advised = map_size < FILE_MMAP_READAHEAD ? map_size : FILE_MMAP_READAHEAD;
+	madvise(map, advised, MADV_WILLNEED);
+
+	while (written < count && !in_aborting) {
+		l = count - written;
+		if (l > chunk_bytes)
+			l = chunk_bytes;
+
+		/* keep the window of read-ahead before the position */
+		if (advised < map_size &&
+		    head + written + l + FILE_MMAP_READAHEAD / 2 > advised) {
+			size_t len = map_size - advised;
+
+			if (len > FILE_MMAP_READAHEAD)
+				len = FILE_MMAP_READAHEAD;
+			madvise(map + advised, len, MADV_WILLNEED);
+			advised += len;
+		}
+
+		frames = bytes_to_frames(l);
+		if (l < chunk_bytes) {
+			/* the rest of chunk is filled with silence */
+			memcpy(audiobuf, data + written, l);
+			r = pcm_write(audiobuf, frames);
+		} else {
+			r = pcm_write(data + written, frames);
+		}
+		if (r != frames)
+			break;
+		written += l;
+		fdcount += l;
+	}
+
+	munmap(map, map_size);
+	lseek64(fd, offset + written, SEEK_SET);
+	return 0;
+}
+
 /* playing raw data */
 
 static void playback_go(int fd, size_t loaded, off64_t count, int rtype, char *name)
@@ -2825,11 +3897,30 @@ static void playback_go(int fd, size_t loaded, off64_t count, int rtype, char *n
 	off64_t c;
 
 	header(rtype, name);
-	set_params();
+
+	/*
+	 * The header of this file is parsed while the device still plays
+	 * the frames of the previous file in its buffer. The device keeps
+	 * running when the format is the same.
+	 */
+	if (!gapless_running ||
+	    memcmp(&gapless_params, &hwparams, sizeof(hwparams)) != 0) {
+		gapless_params = hwparams;
+		set_params();
+	}
+
+	if (file_mmap && playback_go_mapped(fd, loaded, count) == 0) {
+		written = count;
+		loaded = 0;
+	} else {
+		prefetch_start(fd, count - (off64_t)loaded);
+	}
 
 	while (loaded > chunk_bytes && written < count && !in_aborting) {
-		if (pcm_write(audiobuf + written, chunk_size) <= 0)
+		if (pcm_write(audiobuf + written, chunk_size) <= 0) {
+			prefetch_stop();
 			return;
+		}
 		written += chunk_bytes;
 		loaded -= chunk_bytes;
 	}
@@ -2853,7 +3944,7 @@ static void playback_go(int fd, size_t loaded, off64_t count, int rtype, char *n
 
 			if (c == 0)
 				break;
-			r = safe_read(fd, audiobuf + l, c);
+			r = prefetch_read(fd, audiobuf + l, c);
 			if (r < 0) {
 				perror(name);
 				prg_exit(EXIT_FAILURE);
@@ -2863,18 +3954,19 @@ static void playback_go(int fd, size_t loaded, off64_t count, int rtype, char *n
 				break;
 			l += r;
 		} while ((size_t)l < chunk_bytes);
-		l = l * 8 / bits_per_frame;
+		l = bytes_to_frames(l);
 		r = pcm_write(audiobuf, l);
 		if (r != l)
 			break;
-		r = r * bits_per_frame / 8;
+		r = frames_to_bytes(r);
 		written += r;
 		l = 0;
 	}
-	if (!in_aborting) {
-		snd_pcm_nonblock(handle, 0);
-		snd_pcm_drain(handle);
-		snd_pcm_nonblock(handle, nonblock);
+	prefetch_stop();
+	if (gapless_more_files && !in_aborting) {
+		gapless_running = 1;
+	} else if (!in_aborting) {
+		drain_pcms();
 	}
 }
 
@@ -3079,11 +4171,35 @@ size_t mystrftime(char *s, size_t max, const char *userformat,
 	return strftime(s, max, format, tm);
 }
 
-static int new_capture_file(char *name, char *namebuf, size_t namelen,
-			    int filecount)
+/* insert the number of file before the extension */
+static void numbered_file_name(const char *name, char *namebuf, size_t namelen,
+			       int filecount)
 {
 	char *s;
 	char buf[PATH_MAX-10];
+
+	/* get a copy of the original filename */
+	strncpy(buf, name, sizeof(buf));
+	buf[sizeof(buf)-1] = '\0';
+
+	/* separate extension from filename */
+	s = buf + strlen(buf);
+	while (s > buf && *s != '.' && *s != '/')
+		--s;
+	if (*s == '.')
+		*s++ = 0;
+	else if (*s == '/')
+		s = buf + strlen(buf);
+
+	if (*s)
+		snprintf(namebuf, namelen, "%s-%02i.%s", buf, filecount, s);
+	else
+		snprintf(namebuf, namelen, "%s-%02i", buf, filecount);
+}
+
+static int new_capture_file(char *name, char *namebuf, size_t namelen,
+			    int filecount)
+{
 	time_t t;
 	struct tm *tmp;
 
@@ -3101,35 +4217,16 @@ static int new_capture_file(char *name, char *namebuf, size_t namelen,
 		return filecount;
 	}
 
-	/* get a copy of the original filename */
-	strncpy(buf, name, sizeof(buf));
-	buf[sizeof(buf)-1] = '\0';
-
-	/* separate extension from filename */
-	s = buf + strlen(buf);
-	while (s > buf && *s != '.' && *s != '/')
-		--s;
-	if (*s == '.')
-		*s++ = 0;
-	else if (*s == '/')
-		s = buf + strlen(buf);
-
 	/* upon first jump to this if block rename the first file */
 	if (filecount == 1) {
-		if (*s)
-			snprintf(namebuf, namelen, "%s-01.%s", buf, s);
-		else
-			snprintf(namebuf, namelen, "%s-01", buf);
+		numbered_file_name(name, namebuf, namelen, 1);
 		remove(namebuf);
 		rename(name, namebuf);
 		filecount = 2;
 	}
 
 	/* name of the current file */
-	if (*s)
-		snprintf(namebuf, namelen, "%s-%02i.%s", buf, filecount, s);
-	else
-		snprintf(namebuf, namelen, "%s-%02i", buf, filecount);
+	numbered_file_name(name, namebuf, namelen, filecount);
 
 	return filecount;
 }
@@ -3186,6 +4283,605 @@ static int safe_open(const char *name)
 	return fd;
 }
 
+/* the number of bytes to capture into one file */
+static off64_t capture_file_rest(off64_t count)
+{
+	off64_t rest = count;
+
+	if (rest > fmt_rec_table[file_type].max_filesize)
+		rest = fmt_rec_table[file_type].max_filesize;
+	if (max_file_size && (rest > max_file_size))
+		rest = max_file_size;
+	return rest;
+}
+
+/*
+ * When the output is split by --max-file-time, the thread for rotation
+ * finalizes the header of old file and closes it, then opens the next file
+ * in advance under a temporary name, so that the capture loop just switches
+ * the file descriptor. The name with strftime(3) facility depends on the
+ * time of rotation, thus the file is opened in the capture loop for it.
+ */
+static struct {
+	pthread_t thread;
+	int running;
+	mode_t mode;
+	/* the file to be finalized */
+	int old_fd;
+	off64_t old_count;
+	char *orig_name;
+	int rename_first;
+	/* the file taken by the capture loop */
+	char cur_name[PATH_MAX+2];
+	char cur_tmpname[PATH_MAX+10];
+	int renamed;
+	/* the file prepared in advance */
+	int next_fd;
+	int next_filecount;
+	off64_t next_rest;
+	char next_name[PATH_MAX+2];
+	char next_tmpname[PATH_MAX+10];
+} rotation = {
+	.old_fd = -1,
+	.next_fd = -1,
+	.renamed = 1,
+};
+
+static void *rotation_thread(void *arg)
+{
+	if (!rotation.renamed) {
+		if (rename(rotation.cur_tmpname, rotation.cur_name) < 0)
+			perror(rotation.cur_name);
+		rotation.renamed = 1;
+	}
+
+	if (rotation.old_fd >= 0) {
+		if (fmt_rec_table[file_type].end)
+			fmt_rec_table[file_type].end(rotation.old_fd,
+						     rotation.old_count);
+		close(rotation.old_fd);
+		rotation.old_fd = -1;
+
+		if (rotation.rename_first) {
+			char namebuf[PATH_MAX+2];
+
+			numbered_file_name(rotation.orig_name, namebuf,
+					   sizeof(namebuf), 1);
+			remove(namebuf);
+			rename(rotation.orig_name, namebuf);
+		}
+	}
+
+	if (rotation.next_filecount > 0) {
+		numbered_file_name(rotation.orig_name, rotation.next_name,
+				   sizeof(rotation.next_name),
+				   rotation.next_filecount);
+		snprintf(rotation.next_tmpname, sizeof(rotation.next_tmpname),
+			 "%s.XXXXXX", rotation.next_name);
+		rotation.next_fd = mkstemp(rotation.next_tmpname);
+		if (rotation.next_fd >= 0) {
+			fchmod(rotation.next_fd, rotation.mode);
+			if (fmt_rec_table[file_type].start)
+				fmt_rec_table[file_type].start(rotation.next_fd,
+							       rotation.next_rest);
+		}
+	}
+
+	return NULL;
+}
+
+static void rotation_join(void)
+{
+	if (rotation.running) {
+		pthread_join(rotation.thread, NULL);
+		rotation.running = 0;
+	}
+}
+
+/* finalize the old file if any, and prepare the file with the number */
+static void rotation_start(int old_fd, off64_t old_count, int rename_first,
+			   int next_filecount, off64_t next_rest)
+{
+	sigset_t sigset, prev;
+	int err;
+
+	rotation_join();
+
+	rotation.old_fd = old_fd;
+	rotation.old_count = old_count;
+	rotation.rename_first = rename_first;
+	rotation.next_filecount = next_filecount;
+	rotation.next_rest = next_rest;
+
+	/* signals are handled by the capture thread */
+	sigfillset(&sigset);
+	pthread_sigmask(SIG_BLOCK, &sigset, &prev);
+	err = pthread_create(&rotation.thread, NULL, rotation_thread, NULL);
+	pthread_sigmask(SIG_SETMASK, &prev, NULL);
+	if (err) {
+		/* just do it in this thread */
+		rotation_thread(NULL);
+		return;
+	}
+	rotation.running = 1;
+}
+
+/*
+ * Return the file opened in advance, or -1. The file is renamed by the
+ * thread started next.
+ */
+static int rotation_take(char *namebuf, size_t namelen, int *filecount)
+{
+	int fd;
+
+	rotation_join();
+
+	fd = rotation.next_fd;
+	if (fd < 0)
+		return -1;
+	rotation.next_fd = -1;
+
+	strcpy(rotation.cur_name, rotation.next_name);
+	strcpy(rotation.cur_tmpname, rotation.next_tmpname);
+	rotation.renamed = 0;
+
+	strncpy(namebuf, rotation.next_name, namelen);
+	namebuf[namelen - 1] = '\0';
+	*filecount = rotation.next_filecount;
+	return fd;
+}
+
+/* remove the file opened in advance but unused */
+static void rotation_finish(void)
+{
+	rotation_join();
+
+	if (rotation.next_fd >= 0) {
+		close(rotation.next_fd);
+		unlink(rotation.next_tmpname);
+		rotation.next_fd = -1;
+	}
+}
+
+/*
+ * The writer thread takes buffers of captured chunk in a bounded ring, so
+ * that blocked writes to storage don't stall reading from the device, up to
+ * the depth of ring.
+ */
+static struct {
+	pthread_t thread;
+	int running;
+	sem_t filled;
+	sem_t empty;
+	u_char *bufs;
+	size_t slot_bytes;
+	size_t *sizes;
+	unsigned int head;	/* owned by the capture thread */
+	unsigned int tail;	/* owned by the writer thread */
+	int fd;
+	int err;
+	int warned;
+	unsigned int high_water_mark;
+} writer;
+
+static void *writer_thread(void *arg)
+{
+	while (1) {
+		unsigned int index;
+		size_t size;
+
+		while (sem_wait(&writer.filled) < 0 && errno == EINTR)
+			;
+
+		index = writer.tail % write_buffers;
+		size = writer.sizes[index];
+		/* the end of file */
+		if (size == (size_t)-1)
+			break;
+
+		/* the rest is discarded after any error */
+		if (!writer.err &&
+		    xwrite(writer.fd, writer.bufs + index * writer.slot_bytes,
+			   size) != (ssize_t)size)
+			writer.err = errno ? errno : EIO;
+
+		++writer.tail;
+		sem_post(&writer.empty);
+	}
+
+	return NULL;
+}
+
+static void writer_start(int fd)
+{
+	sigset_t sigset, prev;
+	int err;
+
+	if (writer.bufs == NULL) {
+		writer.slot_bytes = frames_to_bytes(capture_chunk_max);
+		writer.bufs = malloc(write_buffers * writer.slot_bytes);
+		writer.sizes = calloc(write_buffers, sizeof(*writer.sizes));
+		if (writer.bufs == NULL || writer.sizes == NULL) {
+			error(_("not enough memory"));
+			prg_exit(EXIT_FAILURE);
+		}
+	}
+
+	writer.fd = fd;
+	writer.err = 0;
+	writer.head = 0;
+	writer.tail = 0;
+	writer.warned = 0;
+	sem_init(&writer.filled, 0, 0);
+	sem_init(&writer.empty, 0, write_buffers);
+
+	/* signals are handled by the capture thread */
+	sigfillset(&sigset);
+	pthread_sigmask(SIG_BLOCK, &sigset, &prev);
+	err = pthread_create(&writer.thread, NULL, writer_thread, NULL);
+	pthread_sigmask(SIG_SETMASK, &prev, NULL);
+	if (err) {
+		error(_("unable to create writer thread: %s"), strerror(err));
+		prg_exit(EXIT_FAILURE);
+	}
+	writer.running = 1;
+}
+
+/* returns NULL when interrupted by signal */
+static u_char *writer_get_buffer(void)
+{
+	while (sem_wait(&writer.empty) < 0) {
+		if (errno != EINTR || in_aborting)
+			return NULL;
+	}
+
+	return writer.bufs + (writer.head % write_buffers) * writer.slot_bytes;
+}
+
+static int writer_queue(size_t size)
+{
+	int level;
+
+	writer.sizes[writer.head % write_buffers] = size;
+	++writer.head;
+	sem_post(&writer.filled);
+
+	if (sem_getvalue(&writer.filled, &level) == 0 && level >= 0) {
+		if ((unsigned int)level > writer.high_water_mark)
+			writer.high_water_mark = level;
+		if (!writer.warned && level * 4 >= write_buffers * 3) {
+			if (!quiet_mode)
+				fprintf(stderr, _("Warning: write buffers are filled: %i/%u\n"),
+					level, write_buffers);
+			writer.warned = 1;
+		} else if (writer.warned && level * 2 < write_buffers) {
+			writer.warned = 0;
+		}
+	}
+
+	if (writer.err) {
+		errno = writer.err;
+		return -1;
+	}
+	return 0;
+}
+
+/* all of queued buffers are written before returning */
+static int writer_finish(void)
+{
+	if (!writer.running)
+		return 0;
+
+	while (sem_wait(&writer.empty) < 0 && errno == EINTR)
+		;
+	writer.sizes[writer.head % write_buffers] = (size_t)-1;
+	sem_post(&writer.filled);
+
+	pthread_join(writer.thread, NULL);
+	writer.running = 0;
+	sem_destroy(&writer.filled);
+	sem_destroy(&writer.empty);
+
+	if (verbose)
+		fprintf(stderr, _("Write buffers: high-water mark %u/%u\n"),
+			writer.high_water_mark, write_buffers);
+
+	if (writer.err) {
+		errno = writer.err;
+		return -1;
+	}
+	return 0;
+}
+
+/*
+ * In the mode for latency, the chunk starts from one period, and doubles up
+ * to the budget when overrun occurs or frames are left after reading a
+ * chunk several times in a row, which means the loop runs behind.
+ */
+#define CAPTURE_BEHIND_COUNT	4
+
+static struct {
+	unsigned int xrun_count;
+	unsigned int behind;
+} adaptive;
+
+static void print_capture_chunk(void)
+{
+	if (verbose)
+		fprintf(stderr, _("Chunk: %lu frames (%lu us, up to %lu frames)\n"),
+			(unsigned long)capture_chunk,
+			(unsigned long)((double)capture_chunk * 1000000 /
+					hwparams.rate),
+			(unsigned long)capture_chunk_max);
+}
+
+static void setup_capture_chunk(void)
+{
+	capture_chunk = chunk_size;
+	capture_chunk_max = chunk_size;
+	if (!latency_budget)
+		return;
+
+	capture_chunk_max = (double)hwparams.rate * latency_budget / 1000000;
+	capture_chunk_max -= capture_chunk_max % chunk_size;
+	if (capture_chunk_max < chunk_size)
+		capture_chunk_max = chunk_size;
+
+	audiobuf = realloc(audiobuf, frames_to_bytes(capture_chunk_max));
+	if (audiobuf == NULL) {
+		error(_("not enough memory"));
+		prg_exit(EXIT_FAILURE);
+	}
+
+	adaptive.xrun_count = xrun_count;
+	adaptive.behind = 0;
+	print_capture_chunk();
+}
+
+static void update_capture_chunk(void)
+{
+	snd_pcm_sframes_t avail;
+	int grow = 0;
+
+	if (capture_chunk >= capture_chunk_max)
+		return;
+
+	if (adaptive.xrun_count != xrun_count) {
+		adaptive.xrun_count = xrun_count;
+		grow = 1;
+	} else {
+		avail = snd_pcm_avail_update(handle);
+		if (avail >= (snd_pcm_sframes_t)capture_chunk * 2)
+			grow = ++adaptive.behind >= CAPTURE_BEHIND_COUNT;
+		else
+			adaptive.behind = 0;
+	}
+	if (!grow)
+		return;
+
+	adaptive.behind = 0;
+	capture_chunk *= 2;
+	if (capture_chunk > capture_chunk_max)
+		capture_chunk = capture_chunk_max;
+	print_capture_chunk();
+}
+
+/*
+ * In triggered capture nothing is written while the peak of chunk is below
+ * trigger_level. The last chunks are kept in a ring so that the onset is
+ * written with the pre-roll. Each segment lasts till the level stays below
+ * for trigger_hangover, and goes to its own file named like the files of
+ * --max-file-time.
+ */
+static struct {
+	u_char *buf;
+	size_t size;
+	size_t pos;
+	size_t fill;
+} preroll;
+
+static void preroll_push(u_char *data, size_t bytes)
+{
+	size_t len;
+
+	if (preroll.size == 0)
+		return;
+	if (bytes >= preroll.size) {
+		memcpy(preroll.buf, data + bytes - preroll.size, preroll.size);
+		preroll.pos = 0;
+		preroll.fill = preroll.size;
+		return;
+	}
+	len = preroll.size - preroll.pos;
+	if (len > bytes)
+		len = bytes;
+	memcpy(preroll.buf + preroll.pos, data, len);
+	memcpy(preroll.buf, data + len, bytes - len);
+	preroll.pos = (preroll.pos + bytes) % preroll.size;
+	preroll.fill += bytes;
+	if (preroll.fill > preroll.size)
+		preroll.fill = preroll.size;
+}
+
+/* write the pre-roll in the order of capture, then discard it */
+static ssize_t preroll_flush(int fd)
+{
+	size_t start = (preroll.pos + preroll.size - preroll.fill) %
+		       (preroll.size ? preroll.size : 1);
+	size_t len = preroll.fill;
+	ssize_t written = 0;
+
+	if (len > preroll.size - start)
+		len = preroll.size - start;
+	if (len > 0 && xwrite(fd, preroll.buf + start, len) != len)
+		return -1;
+	written += len;
+	len = preroll.fill - len;
+	if (len > 0 && xwrite(fd, preroll.buf, len) != len)
+		return -1;
+	written += len;
+	preroll.pos = 0;
+	preroll.fill = 0;
+	return written;
+}
+
+static int chunk_is_loud(u_char *data, size_t frames)
+{
+	unsigned int peak;
+
+	compute_peaks(data, frames * hwparams.channels, 1, &peak);
+	return peak_percent(peak) >= trigger_level;
+}
+
+static void capture_triggered(char *orig_name)
+{
+	int filecount = 0;	/* number of files written */
+	char *name = orig_name;	/* current filename */
+	char namebuf[PATH_MAX+2];
+	off64_t count, rest = 0;
+	size_t quiet = 0;	/* frames below the level in the segment */
+	size_t hangover_frames;
+	struct stat statbuf;
+	ssize_t r;
+
+	count = calc_count();
+	if (count == 0)
+		count = LLONG_MAX;
+
+	header(file_type, name);
+
+	set_params();
+	setup_capture_chunk();
+
+	if (!name || !strcmp(name, "-")) {
+		error(_("trigger level is not available with stdout"));
+		prg_exit(EXIT_FAILURE);
+	}
+	if (bits_per_sample != 8 && bits_per_sample != 16 &&
+	    bits_per_sample != 24 && bits_per_sample != 32) {
+		error(_("trigger level is not available for bit size %d"),
+		      (int)bits_per_sample);
+		prg_exit(EXIT_FAILURE);
+	}
+	init_stdin();
+
+	hangover_frames = (size_t)hwparams.rate * trigger_hangover / 1000;
+	preroll.size = frames_to_bytes((size_t)hwparams.rate * trigger_preroll / 1000);
+	preroll.buf = malloc(preroll.size ? preroll.size : 1);
+	if (preroll.buf == NULL) {
+		error(_("not enough memory"));
+		prg_exit(EXIT_FAILURE);
+	}
+
+	fd = -1;
+	while (count > 0 && !in_aborting) {
+		size_t bytes = frames_to_bytes(capture_chunk);
+		size_t c = (count <= (off64_t)bytes) ? (size_t)count : bytes;
+		size_t f = bytes_to_frames(c);
+		size_t read, save;
+		int loud;
+
+		read = pcm_read(audiobuf, f);
+		if (read != f)
+			in_aborting = 1;
+		if (latency_budget)
+			update_capture_chunk();
+		save = frames_to_bytes(read);
+		count -= c;
+		loud = chunk_is_loud(audiobuf, read);
+
+		/* SIGUSR1 closes the current segment */
+		if (recycle_capture_file) {
+			recycle_capture_file = 0;
+			signal(SIGUSR1, signal_handler_recycle);
+			rest = 0;
+		}
+
+		if (fd >= 0 && rest < (off64_t)save) {
+			if (fmt_rec_table[file_type].end)
+				fmt_rec_table[file_type].end(fd, fdcount);
+			close(fd);
+			fd = -1;
+			/* the next file follows without gap */
+			if (quiet < hangover_frames)
+				loud = 1;
+		}
+
+		if (fd < 0) {
+			if (!loud) {
+				preroll_push(audiobuf, save);
+				continue;
+			}
+
+			/* upon the second file we start the numbering scheme */
+			if (filecount || use_strftime) {
+				filecount = new_capture_file(orig_name, namebuf,
+							     sizeof(namebuf),
+							     filecount);
+				name = namebuf;
+			}
+			if (!lstat(name, &statbuf)) {
+				if (S_ISREG(statbuf.st_mode))
+					remove(name);
+			}
+			fd = safe_open(name);
+			if (fd < 0) {
+				perror(name);
+				prg_exit(EXIT_FAILURE);
+			}
+			filecount++;
+			if (verbose)
+				fprintf(stderr, _("Triggered: %s\n"), name);
+
+			rest = capture_file_rest(LLONG_MAX);
+			rest -= rest % 2;
+			if (fmt_rec_table[file_type].start)
+				fmt_rec_table[file_type].start(fd, rest);
+			fdcount = 0;
+			r = preroll_flush(fd);
+			if (r < 0) {
+				perror(name);
+				prg_exit(EXIT_FAILURE);
+			}
+			/* the pre-roll can be longer than the limit of file */
+			rest = rest > r ? rest - r : 0;
+			fdcount += r;
+		}
+
+		if (xwrite(fd, audiobuf, save) != save) {
+			perror(name);
+			prg_exit(EXIT_FAILURE);
+		}
+		rest = rest > (off64_t)save ? rest - (off64_t)save : 0;
+		fdcount += save;
+
+		if (loud) {
+			quiet = 0;
+		} else {
+			quiet += read;
+			if (quiet >= hangover_frames) {
+				if (fmt_rec_table[file_type].end)
+					fmt_rec_table[file_type].end(fd, fdcount);
+				close(fd);
+				fd = -1;
+				quiet = 0;
+			}
+		}
+	}
+
+	if (fd >= 0) {
+		if (fmt_rec_table[file_type].end)
+			fmt_rec_table[file_type].end(fd, fdcount);
+		close(fd);
+		fd = -1;
+	}
+	free(preroll.buf);
+	preroll.buf = NULL;
+
+	if (in_aborting)
+		prg_exit(EXIT_FAILURE);
+}
+
 static void capture(char *orig_name)
 {
 	int tostdout=0;		/* boolean which describes output stream */
@@ -3194,6 +4890,15 @@ static void capture(char *orig_name)
 	char namebuf[PATH_MAX+2];
 	off64_t count, rest;		/* number of bytes to capture */
 	struct stat statbuf;
+	int prepared = 0;	/* the header is written in advance */
+	int in_advance;		/* the next file is opened in advance */
+	int next_fd = -1;
+	int next_filecount = 0;
+
+	if (trigger_level) {
+		capture_triggered(orig_name);
+		return;
+	}
 
 	/* get number of bytes to capture */
 	count = calc_count();
@@ -3215,6 +4920,7 @@ static void capture(char *orig_name)
 
 	/* setup sound hardware */
 	set_params();
+	setup_capture_chunk();
 
 	/* write to stdout? */
 	if (!name || !strcmp(name, "-")) {
@@ -3226,9 +4932,25 @@ static void capture(char *orig_name)
 	}
 	init_stdin();
 
+	in_advance = !tostdout && !use_strftime && max_file_size > 0;
+	if (in_advance) {
+		rotation.mode = umask(0);
+		umask(rotation.mode);
+		rotation.mode = 0644 & ~rotation.mode;
+		rotation.orig_name = orig_name;
+	}
+
 	do {
+		prepared = next_fd >= 0;
+		if (prepared) {
+			fd = next_fd;
+			next_fd = -1;
+			name = namebuf;
+			filecount = next_filecount + 1;
+		}
+
 		/* open a file to write */
-		if (!tostdout) {
+		if (!tostdout && !prepared) {
 			/* upon the second file we start the numbering scheme */
 			if (filecount || use_strftime) {
 				filecount = new_capture_file(orig_name, namebuf,
@@ -3250,28 +4972,46 @@ static void capture(char *orig_name)
 			filecount++;
 		}
 
-		rest = count;
-		if (rest > fmt_rec_table[file_type].max_filesize)
-			rest = fmt_rec_table[file_type].max_filesize;
-		if (max_file_size && (rest > max_file_size)) 
-			rest = max_file_size;
+		rest = capture_file_rest(count);
 
 		/* setup sample header */
-		if (fmt_rec_table[file_type].start)
+		if (!prepared && fmt_rec_table[file_type].start)
 			fmt_rec_table[file_type].start(fd, rest);
 
+		/* the header of next file is written with the expected size */
+		if (in_advance && filecount == 1)
+			rotation_start(-1, 0, 0, 2, capture_file_rest(count - rest));
+
 		/* capture */
 		fdcount = 0;
+		if (write_buffers > 0)
+			writer_start(fd);
 		while (rest > 0 && recycle_capture_file == 0 && !in_aborting) {
-			size_t c = (rest <= (off64_t)chunk_bytes) ?
-				(size_t)rest : chunk_bytes;
-			size_t f = c * 8 / bits_per_frame;
-			size_t read = pcm_read(audiobuf, f);
+			size_t bytes = frames_to_bytes(capture_chunk);
+			size_t c = (rest <= (off64_t)bytes) ?
+				(size_t)rest : bytes;
+			size_t f = bytes_to_frames(c);
+			u_char *buf = audiobuf;
+			size_t read;
 			size_t save;
+			if (write_buffers > 0) {
+				buf = writer_get_buffer();
+				if (buf == NULL)
+					break;
+			}
+			read = pcm_read(buf, f);
 			if (read != f)
 				in_aborting = 1;
-			save = read * bits_per_frame / 8;
-			if (xwrite(fd, audiobuf, save) != save) {
+			if (latency_budget)
+				update_capture_chunk();
+			save = frames_to_bytes(read);
+			if (write_buffers > 0) {
+				if (writer_queue(save) < 0) {
+					perror(name);
+					in_aborting = 1;
+					break;
+				}
+			} else if (xwrite(fd, buf, save) != save) {
 				perror(name);
 				in_aborting = 1;
 				break;
@@ -3280,6 +5020,10 @@ static void capture(char *orig_name)
 			rest -= c;
 			fdcount += c;
 		}
+		if (writer_finish() < 0) {
+			perror(name);
+			in_aborting = 1;
+		}
 
 		/* re-enable SIGUSR1 signal */
 		if (recycle_capture_file) {
@@ -3288,9 +5032,26 @@ static void capture(char *orig_name)
 		}
 
 		/* finish sample container */
-		if (!tostdout) {
+		if (in_advance && !in_aborting &&
+		    ((file_type == FORMAT_RAW && !timelimit && !sampleslimit) ||
+		     count > 0)) {
+			off64_t next_rest = capture_file_rest(count);
+
+			/* the next file has been opened in advance */
+			next_fd = rotation_take(namebuf, sizeof(namebuf),
+						&next_filecount);
+			rotation_start(fd, fdcount, filecount == 1,
+				       filecount == 1 ? 3 : filecount + 1,
+				       capture_file_rest(count - next_rest));
+			/* the first file is renamed by the thread */
+			if (filecount == 1)
+				filecount = 2;
+			fd = -1;
+		} else if (!tostdout) {
+			if (in_advance)
+				rotation_finish();
 			if (fmt_rec_table[file_type].end)
-				fmt_rec_table[file_type].end(fd);
+				fmt_rec_table[file_type].end(fd, fdcount);
 			close(fd);
 			fd = -1;
 		}
@@ -3302,6 +5063,9 @@ static void capture(char *orig_name)
 		 * requested counts of data are recorded
 		 */
 	} while ((file_type == FORMAT_RAW && !timelimit && !sampleslimit) || count > 0);
+
+	if (in_advance)
+		rotation_finish();
 }
 
 static void playbackv_go(int* fds, unsigned int channels, size_t loaded, off64_t count, int rtype, char **names)
@@ -3344,11 +5108,11 @@ static void playbackv_go(int* fds, unsigned int channels, size_t loaded, off64_t
 				break;
 			c += r;
 		} while (c < expected);
-		c = c * 8 / bits_per_sample;
+		c = bytes_to_samples(c);
 		r = pcm_writev(bufs, channels, c);
 		if ((size_t)r != c)
 			break;
-		r = r * bits_per_frame / 8;
+		r = frames_to_bytes(r);
 		count -= r;
 	}
 	if (!in_aborting) {
@@ -3379,17 +5143,17 @@ static void capturev_go(int* fds, unsigned int channels, off64_t count, int rtyp
 		c = count;
 		if (c > chunk_bytes)
 			c = chunk_bytes;
-		c = c * 8 / bits_per_frame;
+		c = bytes_to_frames(c);
 		if ((size_t)(r = pcm_readv(bufs, channels, c)) != c)
 			break;
-		rv = r * bits_per_sample / 8;
+		rv = samples_to_bytes(r);
 		for (channel = 0; channel < channels; ++channel) {
 			if ((size_t)xwrite(fds[channel], bufs[channel], rv) != rv) {
 				perror(names[channel]);
 				prg_exit(EXIT_FAILURE);
 			}
 		}
-		r = r * bits_per_frame / 8;
+		r = frames_to_bytes(r);
 		count -= r;
 		fdcount += r;
 	}
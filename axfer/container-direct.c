@@ -0,0 +1,298 @@
+// SPDX-License-Identifier: GPL-2.0
+//
+// container-direct.c - an I/O backend for data frames in containers to
+//			bypass page cache.
+//
+// Copyright (c) 2026 agent <agent@local>
+//
+// Licensed under the terms of the GNU General Public License, version 2.
+
+#include "container.h"
+#include "misc.h"
+
+#include <stdio.h>
+#include <errno.h>
+#include <string.h>
+#include <inttypes.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+
+// Enough for logical block size of usual storage devices.
+#define DIRECT_IO_ALIGNMENT	4096
+#define DIRECT_IO_MIN_BLOCK_SIZE	(64 * 1024)
+// The interval to drop page cache when O_DIRECT is not available.
+#define FADVISE_INTERVAL	(8 * 1024 * 1024)
+
+// For long capture, the page cache is filled with data frames which are
+// never read again. With O_DIRECT, data frames are queued to the buffer
+// aligned to the logical block, then written to the aligned offset of file.
+// The header of container and the rest of data frames are written without
+// O_DIRECT at flush. When the file system doesn't support O_DIRECT, data
+// frames are written as usual, then page cache is dropped periodically.
+struct direct_state {
+	bool direct;
+
+	char *buf;
+	unsigned int size;
+	// The position in the buffer.
+	unsigned int pos;
+	// The offset of file for the head of buffer.
+	off64_t offset;
+
+	// For the case that O_DIRECT is not available.
+	off64_t advised_offset;
+	off64_t written_offset;
+	uint64_t pending_byte_count;
+};
+
+static int set_direct_flag(int fd, bool enable)
+{
+	int mode;
+
+	mode = fcntl(fd, F_GETFL);
+	if (mode < 0)
+		return -errno;
+	if (enable)
+		mode |= O_DIRECT;
+	else
+		mode &= ~O_DIRECT;
+	if (fcntl(fd, F_SETFL, mode) < 0)
+		return -errno;
+
+	return 0;
+}
+
+static int write_buffer(struct container_context *cntr,
+			struct direct_state *state, unsigned int size)
+{
+	unsigned int consumed = 0;
+	ssize_t result;
+
+	while (consumed < size) {
+		result = pwrite64(cntr->fd, state->buf + consumed,
+				  size - consumed, state->offset + consumed);
+		if (result < 0) {
+			if (errno != EAGAIN && errno != EINTR)
+				return -errno;
+			continue;
+		}
+		consumed += result;
+	}
+
+	return 0;
+}
+
+static int direct_write(struct container_context *cntr, void *buf,
+			unsigned int byte_count)
+{
+	struct direct_state *state = cntr->io_private_data;
+	const char *src = buf;
+	unsigned int consumed = 0;
+	int err;
+
+	while (consumed < byte_count) {
+		unsigned int size = state->size - state->pos;
+
+		if (size > byte_count - consumed)
+			size = byte_count - consumed;
+		memcpy(state->buf + state->pos, src + consumed, size);
+		state->pos += size;
+		consumed += size;
+
+		if (state->pos == state->size) {
+			err = write_buffer(cntr, state, state->size);
+			if (err < 0)
+				return err;
+			state->offset += state->size;
+			state->pos = 0;
+		}
+	}
+
+	return 0;
+}
+
+static int direct_flush(struct container_context *cntr)
+{
+	struct direct_state *state = cntr->io_private_data;
+	int err;
+
+	// The size of the rest is not aligned.
+	err = set_direct_flag(cntr->fd, false);
+	if (err < 0)
+		return err;
+	state->direct = false;
+
+	if (state->pos > 0) {
+		err = write_buffer(cntr, state, state->pos);
+		if (err < 0)
+			return err;
+		state->offset += state->pos;
+		state->pos = 0;
+	}
+
+	if (lseek64(cntr->fd, state->offset, SEEK_SET) < 0)
+		return -errno;
+
+	return 0;
+}
+
+static int advise_write(struct container_context *cntr, void *buf,
+			unsigned int byte_count)
+{
+	struct direct_state *state = cntr->io_private_data;
+	off64_t offset;
+	int err;
+
+	err = container_recursive_write(cntr, buf, byte_count);
+	if (err < 0)
+		return err;
+
+	state->pending_byte_count += byte_count;
+	if (state->pending_byte_count < FADVISE_INTERVAL)
+		return 0;
+	state->pending_byte_count = 0;
+
+	offset = lseek64(cntr->fd, 0, SEEK_CUR);
+	if (offset < 0)
+		return -errno;
+
+	// The previous range is expected to be written back already. Only
+	// clean pages are dropped.
+	if (state->written_offset > state->advised_offset) {
+		sync_file_range(cntr->fd, state->advised_offset,
+				state->written_offset - state->advised_offset,
+				SYNC_FILE_RANGE_WAIT_BEFORE |
+				SYNC_FILE_RANGE_WRITE |
+				SYNC_FILE_RANGE_WAIT_AFTER);
+		posix_fadvise(cntr->fd, state->advised_offset,
+			      state->written_offset - state->advised_offset,
+			      POSIX_FADV_DONTNEED);
+		state->advised_offset = state->written_offset;
+	}
+
+	// Start write-back of the latest range, without waiting.
+	sync_file_range(cntr->fd, state->written_offset,
+			offset - state->written_offset, SYNC_FILE_RANGE_WRITE);
+	state->written_offset = offset;
+
+	return 0;
+}
+
+static void direct_release(struct container_context *cntr)
+{
+	struct direct_state *state = cntr->io_private_data;
+
+	if (state == NULL)
+		return;
+
+	if (state->direct)
+		set_direct_flag(cntr->fd, false);
+	free(state->buf);
+	free(state);
+
+	cntr->io_private_data = NULL;
+}
+
+int container_context_enable_direct(struct container_context *cntr,
+				    unsigned int frames_per_block)
+{
+	struct direct_state *state;
+	unsigned int bytes_per_frame;
+	struct stat st;
+	off64_t offset;
+	int err;
+
+	assert(cntr);
+	assert(cntr->bytes_per_sample > 0);
+	assert(cntr->samples_per_frame > 0);
+
+	if (cntr->type != CONTAINER_TYPE_BUILDER)
+		return -EINVAL;
+
+	// Page cache is not used for pipes and terminals.
+	if (cntr->stdio || fstat(cntr->fd, &st) < 0 || !S_ISREG(st.st_mode)) {
+		if (cntr->verbose > 0) {
+			fprintf(stderr,
+				"  direct: unavailable for this file, use "
+				"default I/O.\n");
+		}
+		return 0;
+	}
+
+	// The builder already wrote the header of container.
+	offset = lseek64(cntr->fd, 0, SEEK_CUR);
+	if (offset < 0)
+		return -errno;
+
+	state = calloc(1, sizeof(*state));
+	if (state == NULL)
+		return -ENOMEM;
+
+	bytes_per_frame = cntr->bytes_per_sample * cntr->samples_per_frame;
+	state->size = frames_per_block * bytes_per_frame;
+	if (state->size < DIRECT_IO_MIN_BLOCK_SIZE)
+		state->size = DIRECT_IO_MIN_BLOCK_SIZE;
+	state->size += DIRECT_IO_ALIGNMENT - 1;
+	state->size -= state->size % DIRECT_IO_ALIGNMENT;
+
+	err = posix_memalign((void **)&state->buf, DIRECT_IO_ALIGNMENT,
+			     state->size);
+	if (err > 0) {
+		free(state);
+		return -err;
+	}
+
+	// The header in the first block is written again.
+	state->offset = offset - offset % DIRECT_IO_ALIGNMENT;
+	state->pos = offset - state->offset;
+	if (state->pos > 0) {
+		ssize_t result = pread64(cntr->fd, state->buf, state->pos,
+					 state->offset);
+		if (result < 0) {
+			err = -errno;
+			goto error;
+		}
+		if (result < state->pos) {
+			err = -EIO;
+			goto error;
+		}
+	}
+
+	err = set_direct_flag(cntr->fd, true);
+	if (err < 0) {
+		free(state->buf);
+		state->buf = NULL;
+		state->advised_offset = offset;
+		state->written_offset = offset;
+
+		cntr->io_private_data = state;
+		cntr->process_bytes = advise_write;
+		cntr->release_io = direct_release;
+
+		if (cntr->verbose > 0) {
+			fprintf(stderr,
+				"  direct: O_DIRECT is unavailable, drop page "
+				"cache per %u bytes.\n", FADVISE_INTERVAL);
+		}
+
+		return 0;
+	}
+	state->direct = true;
+
+	cntr->io_private_data = state;
+	cntr->process_bytes = direct_write;
+	cntr->flush_bytes = direct_flush;
+	cntr->release_io = direct_release;
+
+	if (cntr->verbose > 0) {
+		fprintf(stderr, "  direct: %u bytes/block from offset %" PRId64
+			"\n", state->size, (int64_t)state->offset);
+	}
+
+	return 0;
+error:
+	free(state->buf);
+	free(state);
+	return err;
+}
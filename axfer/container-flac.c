@@ -0,0 +1,320 @@
+// SPDX-License-Identifier: GPL-2.0
+//
+// container-flac.c - a builder for a container of Free Lossless Audio Codec.
+//
+// Copyright (c) 2026 agent <agent@local>
+//
+// Licensed under the terms of the GNU General Public License, version 2.
+
+#include "container.h"
+#include "misc.h"
+
+#include <stdio.h>
+#include <errno.h>
+#include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <poll.h>
+
+#include <FLAC/stream_encoder.h>
+
+// Reference:
+//  * https://xiph.org/flac/format.html
+
+#define FLAC_MAX_CHANNELS	8
+#define COMPRESSION_LEVEL	5
+
+struct format_map {
+	snd_pcm_format_t format;
+	unsigned int bits_per_sample;
+};
+
+static const struct format_map format_maps[] = {
+	{SND_PCM_FORMAT_S8,		8},
+	{SND_PCM_FORMAT_S16_LE,		16},
+	{SND_PCM_FORMAT_S24_3LE,	24},
+	{SND_PCM_FORMAT_S24_LE,		24},
+	// Available since libFLAC v1.4.0.
+	{SND_PCM_FORMAT_S32_LE,		32},
+};
+
+// Data frames are encoded in 'process_bytes' callback. The callback is
+// expected to run in the dedicated thread of I/O (see container-thread.c),
+// and libFLAC encodes the blocks in its own worker threads if available.
+struct builder_state {
+	FLAC__StreamEncoder *encoder;
+	snd_pcm_format_t format;
+	unsigned int bytes_per_sample;
+	unsigned int samples_per_frame;
+
+	FLAC__int32 *samples;
+	unsigned int frames_per_samples;
+};
+
+static FLAC__StreamEncoderWriteStatus write_cb(
+					const FLAC__StreamEncoder *encoder,
+					const FLAC__byte buffer[], size_t bytes,
+					uint32_t samples, uint32_t current_frame,
+					void *client_data)
+{
+	struct container_context *cntr = client_data;
+	size_t consumed = 0;
+	ssize_t result;
+
+	// Encoded bytes should be written out even if interrupted, else the
+	// file is corrupted.
+	while (consumed < bytes) {
+		result = write(cntr->fd, buffer + consumed, bytes - consumed);
+		if (result < 0) {
+			struct pollfd pfd = {
+				.fd = cntr->fd,
+				.events = POLLOUT,
+			};
+
+			if (errno != EAGAIN && errno != EINTR)
+				return FLAC__STREAM_ENCODER_WRITE_STATUS_FATAL_ERROR;
+			poll(&pfd, 1, 100);
+			continue;
+		}
+		consumed += result;
+	}
+
+	return FLAC__STREAM_ENCODER_WRITE_STATUS_OK;
+}
+
+// The encoder seeks to the head of file to rewrite STREAMINFO metadata block
+// with the total number of samples and MD5 signature.
+static FLAC__StreamEncoderSeekStatus seek_cb(
+					const FLAC__StreamEncoder *encoder,
+					FLAC__uint64 absolute_byte_offset,
+					void *client_data)
+{
+	struct container_context *cntr = client_data;
+
+	if (cntr->stdio)
+		return FLAC__STREAM_ENCODER_SEEK_STATUS_UNSUPPORTED;
+
+	if (container_seek_offset(cntr, absolute_byte_offset) < 0)
+		return FLAC__STREAM_ENCODER_SEEK_STATUS_ERROR;
+
+	return FLAC__STREAM_ENCODER_SEEK_STATUS_OK;
+}
+
+static FLAC__StreamEncoderTellStatus tell_cb(
+					const FLAC__StreamEncoder *encoder,
+					FLAC__uint64 *absolute_byte_offset,
+					void *client_data)
+{
+	struct container_context *cntr = client_data;
+	off64_t pos;
+
+	if (cntr->stdio)
+		return FLAC__STREAM_ENCODER_TELL_STATUS_UNSUPPORTED;
+
+	pos = lseek64(cntr->fd, 0, SEEK_CUR);
+	if (pos < 0)
+		return FLAC__STREAM_ENCODER_TELL_STATUS_ERROR;
+	*absolute_byte_offset = pos;
+
+	return FLAC__STREAM_ENCODER_TELL_STATUS_OK;
+}
+
+static FLAC__int32 read_sample(const uint8_t *buf, snd_pcm_format_t format)
+{
+	switch (format) {
+	case SND_PCM_FORMAT_S8:
+		return (int8_t)buf[0];
+	case SND_PCM_FORMAT_S16_LE:
+		return (int16_t)(buf[0] | (buf[1] << 8));
+	case SND_PCM_FORMAT_S24_3LE:
+	case SND_PCM_FORMAT_S24_LE:
+		// Sign extension from 24 bit.
+		return (int32_t)(((uint32_t)buf[0] << 8) |
+				 ((uint32_t)buf[1] << 16) |
+				 ((uint32_t)buf[2] << 24)) >> 8;
+	case SND_PCM_FORMAT_S32_LE:
+		return (int32_t)((uint32_t)buf[0] | ((uint32_t)buf[1] << 8) |
+				 ((uint32_t)buf[2] << 16) |
+				 ((uint32_t)buf[3] << 24));
+	default:
+		return 0;
+	}
+}
+
+static int flac_encode(struct container_context *cntr, void *buf,
+		       unsigned int byte_count)
+{
+	struct builder_state *state = cntr->private_data;
+	unsigned int bytes_per_frame;
+	unsigned int frame_count;
+	const uint8_t *src = buf;
+
+	bytes_per_frame = state->bytes_per_sample * state->samples_per_frame;
+
+	// The caller gives the whole frames.
+	frame_count = byte_count / bytes_per_frame;
+	while (frame_count > 0) {
+		unsigned int count = frame_count;
+		unsigned int sample_count;
+		int i;
+
+		if (count > state->frames_per_samples)
+			count = state->frames_per_samples;
+
+		sample_count = count * state->samples_per_frame;
+		for (i = 0; i < sample_count; ++i) {
+			state->samples[i] = read_sample(src, state->format);
+			src += state->bytes_per_sample;
+		}
+
+		if (!FLAC__stream_encoder_process_interleaved(state->encoder,
+							state->samples, count))
+			return -EIO;
+
+		frame_count -= count;
+	}
+
+	return 0;
+}
+
+static int flac_finish(struct container_context *cntr)
+{
+	struct builder_state *state = cntr->private_data;
+	FLAC__StreamEncoderState encoder_state;
+
+	if (state->encoder == NULL)
+		return 0;
+
+	// The rest of samples are encoded, then STREAMINFO is updated.
+	if (!FLAC__stream_encoder_finish(state->encoder)) {
+		encoder_state = FLAC__stream_encoder_get_state(state->encoder);
+		fprintf(stderr, "FLAC encoder: %s\n",
+			FLAC__StreamEncoderStateString[encoder_state]);
+		return -EIO;
+	}
+
+	return 0;
+}
+
+static void flac_release(struct container_context *cntr)
+{
+	struct builder_state *state = cntr->private_data;
+
+	if (state == NULL)
+		return;
+
+	if (state->encoder)
+		FLAC__stream_encoder_delete(state->encoder);
+	state->encoder = NULL;
+
+	free(state->samples);
+	state->samples = NULL;
+}
+
+#if HAVE_FLAC_SET_NUM_THREADS
+static unsigned int decide_thread_count(void)
+{
+	long count = sysconf(_SC_NPROCESSORS_ONLN);
+
+	if (count < 1)
+		return 1;
+	if (count > 16)
+		return 16;
+	return (unsigned int)count;
+}
+#endif
+
+static int flac_builder_pre_process(struct container_context *cntr,
+				    snd_pcm_format_t *format,
+				    unsigned int *samples_per_frame,
+				    unsigned int *frames_per_second,
+				    uint64_t *byte_count)
+{
+	struct builder_state *state = cntr->private_data;
+	FLAC__StreamEncoderInitStatus status;
+	unsigned int block_size;
+	bool ok;
+	int i;
+
+	for (i = 0; i < ARRAY_SIZE(format_maps); ++i) {
+		if (format_maps[i].format == *format)
+			break;
+	}
+	if (i == ARRAY_SIZE(format_maps))
+		return -EINVAL;
+
+	if (*samples_per_frame > FLAC_MAX_CHANNELS) {
+		fprintf(stderr,
+			"FLAC container supports up to %u channels.\n",
+			FLAC_MAX_CHANNELS);
+		return -EINVAL;
+	}
+
+	state->format = *format;
+	state->bytes_per_sample = snd_pcm_format_physical_width(*format) / 8;
+	state->samples_per_frame = *samples_per_frame;
+
+	state->encoder = FLAC__stream_encoder_new();
+	if (state->encoder == NULL)
+		return -ENOMEM;
+	cntr->release_io = flac_release;
+
+	ok = FLAC__stream_encoder_set_channels(state->encoder,
+					       *samples_per_frame);
+	ok &= FLAC__stream_encoder_set_bits_per_sample(state->encoder,
+					format_maps[i].bits_per_sample);
+	ok &= FLAC__stream_encoder_set_sample_rate(state->encoder,
+						   *frames_per_second);
+	ok &= FLAC__stream_encoder_set_compression_level(state->encoder,
+							 COMPRESSION_LEVEL);
+	if (!ok)
+		return -EINVAL;
+
+#if HAVE_FLAC_SET_NUM_THREADS
+	// Each block is encoded in a thread of pool in libFLAC.
+	FLAC__stream_encoder_set_num_threads(state->encoder,
+					     decide_thread_count());
+#endif
+
+	status = FLAC__stream_encoder_init_stream(state->encoder, write_cb,
+						  seek_cb, tell_cb, NULL, cntr);
+	if (status != FLAC__STREAM_ENCODER_INIT_STATUS_OK) {
+		fprintf(stderr, "FLAC encoder: %s\n",
+			FLAC__StreamEncoderInitStatusString[status]);
+		return -EINVAL;
+	}
+
+	// Convert samples to 32 bit integer per block.
+	block_size = FLAC__stream_encoder_get_blocksize(state->encoder);
+	if (block_size == 0)
+		block_size = 4096;
+	state->frames_per_samples = block_size;
+	state->samples = calloc(block_size * *samples_per_frame,
+				sizeof(*state->samples));
+	if (state->samples == NULL)
+		return -ENOMEM;
+
+	cntr->process_bytes = flac_encode;
+	cntr->flush_bytes = flac_finish;
+
+	if (cntr->verbose > 0) {
+		fprintf(stderr, "  FLAC: compression level %u, %u frames/block",
+			COMPRESSION_LEVEL, block_size);
+#if HAVE_FLAC_SET_NUM_THREADS
+		fprintf(stderr, ", %u threads",
+			FLAC__stream_encoder_get_num_threads(state->encoder));
+#endif
+		fprintf(stderr, "\n");
+	}
+
+	return 0;
+}
+
+const struct container_builder container_builder_flac = {
+	.format = CONTAINER_FORMAT_FLAC,
+	.max_size = UINT64_MAX,
+	.ops = {
+		.pre_process	= flac_builder_pre_process,
+	},
+	.private_size = sizeof(struct builder_state),
+};
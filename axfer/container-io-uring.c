@@ -0,0 +1,363 @@
+// SPDX-License-Identifier: GPL-2.0
+//
+// container-io-uring.c - an I/O backend for data frames in containers by
+//			  io_uring(7).
+//
+// Copyright (c) 2026 agent <agent@local>
+//
+// Licensed under the terms of the GNU General Public License, version 2.
+
+#include "container.h"
+#include "misc.h"
+
+#include <sys/stat.h>
+#include <liburing.h>
+
+// Data frames are processed in a ring of slots. Each slot has the same size
+// as the buffer of PCM substream. Some slots are queued to the ring of
+// io_uring in advance so that the thread processing PCM substream doesn't
+// wait for completion of I/O as long as the slots are available.
+struct io_slot {
+	char *buf;
+	unsigned int size;
+	unsigned int pos;
+	bool queued;
+	int result;
+};
+
+struct io_uring_state {
+	struct io_uring ring;
+	struct io_slot *slots;
+	unsigned int slot_count;
+	unsigned int bytes_per_slot;
+	unsigned int index;
+	unsigned int queued_count;
+	off64_t offset;
+};
+
+static int reap_completion(struct container_context *cntr,
+			   struct io_uring_state *state)
+{
+	struct io_uring_cqe *cqe;
+	struct io_slot *slot;
+	int err;
+
+	while (1) {
+		err = io_uring_wait_cqe(&state->ring, &cqe);
+		if (err != -EINTR)
+			break;
+		if (cntr->interrupted)
+			return -EINTR;
+	}
+	if (err < 0)
+		return err;
+
+	slot = io_uring_cqe_get_data(cqe);
+	slot->result = cqe->res;
+	slot->queued = false;
+	--state->queued_count;
+	io_uring_cqe_seen(&state->ring, cqe);
+
+	return 0;
+}
+
+static int wait_for_slot(struct container_context *cntr,
+			 struct io_uring_state *state, struct io_slot *slot)
+{
+	int err;
+
+	// Completions are not always delivered in order of submission.
+	while (slot->queued) {
+		err = reap_completion(cntr, state);
+		if (err < 0)
+			return err;
+	}
+
+	return 0;
+}
+
+static int queue_slot(struct container_context *cntr,
+		      struct io_uring_state *state, struct io_slot *slot)
+{
+	struct io_uring_sqe *sqe;
+	int err;
+
+	sqe = io_uring_get_sqe(&state->ring);
+	if (sqe == NULL)
+		return -EBUSY;
+
+	if (cntr->type == CONTAINER_TYPE_PARSER) {
+		io_uring_prep_read(sqe, cntr->fd, slot->buf,
+				   state->bytes_per_slot, state->offset);
+		state->offset += state->bytes_per_slot;
+	} else {
+		io_uring_prep_write(sqe, cntr->fd, slot->buf, slot->size,
+				    state->offset);
+		state->offset += slot->size;
+	}
+	io_uring_sqe_set_data(sqe, slot);
+
+	slot->queued = true;
+	slot->result = 0;
+	++state->queued_count;
+
+	err = io_uring_submit(&state->ring);
+	if (err < 0)
+		return err;
+
+	return 0;
+}
+
+static int io_uring_read(struct container_context *cntr, void *buf,
+			 unsigned int byte_count)
+{
+	struct io_uring_state *state = cntr->io_private_data;
+	char *dst = buf;
+	unsigned int consumed = 0;
+	int err;
+
+	while (consumed < byte_count && !cntr->interrupted) {
+		struct io_slot *slot = &state->slots[state->index];
+		unsigned int size;
+
+		err = wait_for_slot(cntr, state, slot);
+		if (err < 0)
+			return err;
+		if (slot->result < 0)
+			return slot->result;
+
+		// Reach EOF.
+		if (slot->result == 0) {
+			cntr->eof = true;
+			return 0;
+		}
+		slot->size = slot->result;
+
+		size = slot->size - slot->pos;
+		if (size > byte_count - consumed)
+			size = byte_count - consumed;
+		memcpy(dst + consumed, slot->buf + slot->pos, size);
+		slot->pos += size;
+		consumed += size;
+
+		if (slot->pos == slot->size) {
+			// Short read means the end of file. The rest of slots
+			// are going to report it.
+			if (slot->size == state->bytes_per_slot) {
+				slot->pos = 0;
+				err = queue_slot(cntr, state, slot);
+				if (err < 0)
+					return err;
+			}
+			state->index = (state->index + 1) % state->slot_count;
+		}
+	}
+
+	return 0;
+}
+
+static int io_uring_write(struct container_context *cntr, void *buf,
+			  unsigned int byte_count)
+{
+	struct io_uring_state *state = cntr->io_private_data;
+	char *src = buf;
+	unsigned int consumed = 0;
+	int err;
+
+	while (consumed < byte_count && !cntr->interrupted) {
+		struct io_slot *slot = &state->slots[state->index];
+		unsigned int size;
+
+		err = wait_for_slot(cntr, state, slot);
+		if (err < 0)
+			return err;
+
+		// The slot was queued when it was filled with data frames.
+		if (slot->size == state->bytes_per_slot) {
+			if (slot->result < 0)
+				return slot->result;
+			if (slot->result != slot->size)
+				return -EIO;
+			slot->size = 0;
+		}
+
+		size = state->bytes_per_slot - slot->size;
+		if (size > byte_count - consumed)
+			size = byte_count - consumed;
+		memcpy(slot->buf + slot->size, src + consumed, size);
+		slot->size += size;
+		consumed += size;
+
+		if (slot->size == state->bytes_per_slot) {
+			err = queue_slot(cntr, state, slot);
+			if (err < 0)
+				return err;
+			state->index = (state->index + 1) % state->slot_count;
+		}
+	}
+
+	return 0;
+}
+
+static int io_uring_flush(struct container_context *cntr)
+{
+	struct io_uring_state *state = cntr->io_private_data;
+	struct io_slot *slot = &state->slots[state->index];
+	off64_t pos;
+	int i;
+	int err;
+
+	// Queue the rest of data frames.
+	if (cntr->type == CONTAINER_TYPE_BUILDER && !slot->queued &&
+	    slot->size > 0 && slot->size < state->bytes_per_slot) {
+		err = queue_slot(cntr, state, slot);
+		if (err < 0)
+			return err;
+	}
+
+	while (state->queued_count > 0) {
+		err = reap_completion(cntr, state);
+		if (err < 0)
+			return err;
+	}
+
+	if (cntr->type == CONTAINER_TYPE_BUILDER) {
+		for (i = 0; i < state->slot_count; ++i) {
+			slot = &state->slots[i];
+			if (slot->size == 0)
+				continue;
+			if (slot->result < 0)
+				return slot->result;
+			if (slot->result != slot->size)
+				return -EIO;
+			slot->size = 0;
+		}
+
+		// Some builders write trailer at current position.
+		pos = lseek64(cntr->fd, state->offset, SEEK_SET);
+		if (pos < 0)
+			return -errno;
+	}
+
+	return 0;
+}
+
+static void free_slots(struct io_uring_state *state)
+{
+	int i;
+
+	if (state->slots) {
+		for (i = 0; i < state->slot_count; ++i)
+			free(state->slots[i].buf);
+		free(state->slots);
+	}
+	free(state);
+}
+
+static void io_uring_release(struct container_context *cntr)
+{
+	struct io_uring_state *state = cntr->io_private_data;
+
+	if (state == NULL)
+		return;
+
+	// The kernel may still access to the slots. Wait for them.
+	cntr->interrupted = false;
+	while (state->queued_count > 0) {
+		if (reap_completion(cntr, state) < 0)
+			break;
+	}
+
+	io_uring_queue_exit(&state->ring);
+	free_slots(state);
+
+	cntr->io_private_data = NULL;
+}
+
+int container_context_enable_io_uring(struct container_context *cntr,
+				      unsigned int slot_count,
+				      unsigned int frames_per_slot)
+{
+	struct io_uring_state *state;
+	struct stat st;
+	int i;
+	int err;
+
+	assert(cntr);
+	assert(cntr->bytes_per_sample > 0);
+	assert(cntr->samples_per_frame > 0);
+
+	if (slot_count == 0 || frames_per_slot == 0)
+		return -EINVAL;
+
+	// Positional I/O is not available for pipes and terminals, nor for
+	// data frames split into several blocks of the file.
+	if (cntr->stdio || fstat(cntr->fd, &st) < 0 || !S_ISREG(st.st_mode) ||
+	    (cntr->type == CONTAINER_TYPE_PARSER &&
+	     cntr->process_bytes != container_recursive_read)) {
+		if (cntr->verbose > 0) {
+			fprintf(stderr,
+				"  io-uring: unavailable for this file, use "
+				"default I/O.\n");
+		}
+		return 0;
+	}
+
+	state = calloc(1, sizeof(*state));
+	if (state == NULL)
+		return -ENOMEM;
+
+	state->bytes_per_slot = cntr->bytes_per_sample *
+				cntr->samples_per_frame * frames_per_slot;
+	state->offset = lseek64(cntr->fd, 0, SEEK_CUR);
+	if (state->offset < 0) {
+		err = -errno;
+		goto error;
+	}
+
+	state->slots = calloc(slot_count, sizeof(*state->slots));
+	if (state->slots == NULL) {
+		err = -ENOMEM;
+		goto error;
+	}
+	state->slot_count = slot_count;
+
+	for (i = 0; i < slot_count; ++i) {
+		state->slots[i].buf = malloc(state->bytes_per_slot);
+		if (state->slots[i].buf == NULL) {
+			err = -ENOMEM;
+			goto error;
+		}
+	}
+
+	// This fails when io_uring is disabled in kernel.
+	err = io_uring_queue_init(slot_count, &state->ring, 0);
+	if (err < 0)
+		goto error;
+
+	cntr->io_private_data = state;
+	cntr->flush_bytes = io_uring_flush;
+	cntr->release_io = io_uring_release;
+
+	if (cntr->type == CONTAINER_TYPE_PARSER) {
+		// Read ahead for all of slots.
+		for (i = 0; i < slot_count; ++i) {
+			err = queue_slot(cntr, state, &state->slots[i]);
+			if (err < 0)
+				return err;
+		}
+		cntr->process_bytes = io_uring_read;
+	} else {
+		cntr->process_bytes = io_uring_write;
+	}
+
+	if (cntr->verbose > 0) {
+		fprintf(stderr, "  io-uring: %u slots, %u bytes/slot\n",
+			state->slot_count, state->bytes_per_slot);
+	}
+
+	return 0;
+error:
+	free_slots(state);
+	return err;
+}
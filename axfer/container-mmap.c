@@ -0,0 +1,131 @@
+// SPDX-License-Identifier: GPL-2.0
+//
+// container-mmap.c - an I/O backend for data frames in containers by mmap(2).
+//
+// Copyright (c) 2026 agent <agent@local>
+//
+// Licensed under the terms of the GNU General Public License, version 2.
+
+#include "container.h"
+#include "misc.h"
+
+#include <stdio.h>
+#include <errno.h>
+#include <string.h>
+#include <inttypes.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+// The whole file is mapped to process address space. Data frames are copied
+// from the mapping to the given buffer directly. When the buffer is the
+// mapped area of PCM substream (e.g. mmap-based scheduling model of
+// libasound backend), it's the only copy of data frames in this program.
+struct mmap_state {
+	char *map;
+	size_t map_size;
+	// The position of data frames in the mapping.
+	size_t pos;
+};
+
+static int mmap_read(struct container_context *cntr, void *buf,
+		     unsigned int byte_count)
+{
+	struct mmap_state *state = cntr->io_private_data;
+	size_t size;
+
+	size = state->map_size - state->pos;
+	if (size > byte_count)
+		size = byte_count;
+
+	memcpy(buf, state->map + state->pos, size);
+	state->pos += size;
+
+	// Reach EOF.
+	if (size < byte_count)
+		cntr->eof = true;
+
+	return 0;
+}
+
+static void mmap_release(struct container_context *cntr)
+{
+	struct mmap_state *state = cntr->io_private_data;
+
+	if (state == NULL)
+		return;
+
+	munmap(state->map, state->map_size);
+	free(state);
+
+	cntr->io_private_data = NULL;
+}
+
+int container_context_enable_mmap(struct container_context *cntr)
+{
+	struct mmap_state *state;
+	struct stat st;
+	off64_t offset;
+	off64_t map_offset;
+	long page_size;
+	int err;
+
+	assert(cntr);
+
+	if (cntr->type != CONTAINER_TYPE_PARSER)
+		return -EINVAL;
+
+	// Mapping is not available for pipes and terminals, nor for data
+	// frames split into several blocks of the file.
+	if (cntr->stdio || fstat(cntr->fd, &st) < 0 || !S_ISREG(st.st_mode) ||
+	    cntr->process_bytes != container_recursive_read) {
+		if (cntr->verbose > 0) {
+			fprintf(stderr,
+				"  mmap: unavailable for this file, use "
+				"default I/O.\n");
+		}
+		return 0;
+	}
+
+	// The parser already read the header of container.
+	offset = lseek64(cntr->fd, 0, SEEK_CUR);
+	if (offset < 0)
+		return -errno;
+	// No data frames to map.
+	if (offset >= st.st_size)
+		return 0;
+
+	page_size = sysconf(_SC_PAGESIZE);
+	if (page_size <= 0)
+		return -ENXIO;
+	map_offset = offset - offset % page_size;
+
+	state = calloc(1, sizeof(*state));
+	if (state == NULL)
+		return -ENOMEM;
+
+	state->map_size = st.st_size - map_offset;
+	state->pos = offset - map_offset;
+
+	state->map = mmap(NULL, state->map_size, PROT_READ, MAP_PRIVATE,
+			  cntr->fd, map_offset);
+	if (state->map == MAP_FAILED) {
+		err = -errno;
+		free(state);
+		return err;
+	}
+
+	// Data frames are read forward.
+	madvise(state->map, state->map_size, MADV_SEQUENTIAL);
+
+	cntr->io_private_data = state;
+	cntr->process_bytes = mmap_read;
+	cntr->release_io = mmap_release;
+
+	if (cntr->verbose > 0) {
+		fprintf(stderr, "  mmap: %zu bytes from offset %" PRId64 "\n",
+			state->map_size - state->pos, (int64_t)offset);
+	}
+
+	return 0;
+}
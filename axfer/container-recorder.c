@@ -0,0 +1,386 @@
+// SPDX-License-Identifier: GPL-2.0
+//
+// container-recorder.c - keep the last data frames of capture in memory and
+//			  dump them to files on trigger.
+//
+// Copyright (c) 2026 agent <agent@local>
+//
+// Licensed under the terms of the GNU General Public License, version 2.
+
+#include "container.h"
+#include "misc.h"
+
+#include <stdio.h>
+#include <errno.h>
+#include <string.h>
+#include <signal.h>
+#include <unistd.h>
+#include <inttypes.h>
+#include <pthread.h>
+#include <semaphore.h>
+#include <stdatomic.h>
+
+// The PCM thread writes data frames into a ring which is allocated in
+// advance, and nothing reaches storage until a trigger. After the trigger
+// and the post-roll, the range of the ring is handed to a dedicated thread
+// which writes it to a new file by a builder, while the PCM thread keeps
+// writing. The ring has room for twice of pre-roll and post-roll so that
+// the dump has the same time to finish before its frames are overwritten.
+// Nothing is locked; the dump thread copies a chunk, then checks the
+// position of the PCM thread to detect the chunk was overwritten meanwhile.
+#define DUMP_CHUNK_FRAMES	4096
+
+struct recorder_state {
+	char *ring;
+	uint64_t capacity;
+	unsigned int bytes_per_frame;
+	uint64_t pre_roll_bytes;
+	uint64_t post_roll_bytes;
+
+	// The total bytes written by the PCM thread.
+	atomic_uint_fast64_t written;
+
+	// Set by container_context_trigger_recorder() in the loop of transmission.
+	atomic_bool triggered;
+
+	// In the PCM thread, the range to dump after the post-roll.
+	bool armed;
+	uint64_t start;
+	uint64_t end;
+
+	// The range handed to the dump thread.
+	uint64_t dump_start;
+	uint64_t dump_end;
+	atomic_bool dumping;
+	sem_t request;
+
+	pthread_t thread;
+	bool thread_running;
+	atomic_bool closing;
+	atomic_int err;
+
+	snd_pcm_format_t format;
+	enum container_format dump_format;
+	unsigned int dump_count;
+	char *chunk;
+	int (*open_dump)(struct container_context *cntr, void *private_data,
+			 unsigned int index, int *fd);
+	void *private_data;
+
+	void (*release_io)(struct container_context *cntr);
+};
+
+static void copy_from_ring(struct recorder_state *state, char *dst,
+			   uint64_t pos, unsigned int size)
+{
+	unsigned int offset = pos % state->capacity;
+	unsigned int len = size;
+
+	if (len > state->capacity - offset)
+		len = state->capacity - offset;
+	memcpy(dst, state->ring + offset, len);
+	if (len < size)
+		memcpy(dst + len, state->ring, size - len);
+}
+
+// In the dump thread.
+static int write_dump(struct container_context *cntr,
+		      struct recorder_state *state, uint64_t start,
+		      uint64_t end)
+{
+	struct container_context dump = {0};
+	snd_pcm_format_t format = state->format;
+	unsigned int channels = cntr->samples_per_frame;
+	unsigned int rate = cntr->frames_per_second;
+	uint64_t frame_count;
+	uint64_t pos;
+	int fd;
+	int err;
+
+	err = state->open_dump(cntr, state->private_data, ++state->dump_count,
+			       &fd);
+	if (err < 0)
+		return err;
+
+	err = container_builder_init(&dump, fd, state->dump_format, 0);
+	if (err < 0)
+		goto end;
+	err = container_context_pre_process(&dump, &format, &channels, &rate,
+					    &frame_count);
+	if (err < 0)
+		goto end;
+
+	for (pos = start; pos < end; ) {
+		unsigned int size = DUMP_CHUNK_FRAMES * state->bytes_per_frame;
+		unsigned int count;
+
+		if (size > end - pos)
+			size = end - pos;
+		copy_from_ring(state, state->chunk, pos, size);
+
+		// The copy is valid unless the PCM thread reached it.
+		atomic_thread_fence(memory_order_acquire);
+		if (atomic_load_explicit(&state->written,
+				memory_order_relaxed) > pos + state->capacity) {
+			fprintf(stderr,
+				"recorder: dump %u is truncated since the ring "
+				"was overrun\n", state->dump_count);
+			err = -ENOBUFS;
+			break;
+		}
+
+		count = size / state->bytes_per_frame;
+		err = container_context_process_frames(&dump, state->chunk,
+						       &count);
+		if (err < 0)
+			break;
+		pos += size;
+	}
+
+	container_context_post_process(&dump, &frame_count);
+	if (cntr->verbose > 0) {
+		fprintf(stderr, "  recorder: dump %u: %" PRIu64 " frames\n",
+			state->dump_count, frame_count);
+	}
+end:
+	container_context_destroy(&dump);
+	close(fd);
+	return err;
+}
+
+static void *dump_thread(void *arg)
+{
+	struct container_context *cntr = arg;
+	struct recorder_state *state = cntr->io_private_data;
+	int err;
+
+	while (1) {
+		while (sem_wait(&state->request) < 0) {
+			if (errno != EINTR)
+				return NULL;
+		}
+
+		if (atomic_load(&state->dumping)) {
+			err = write_dump(cntr, state, state->dump_start,
+					 state->dump_end);
+			if (err < 0)
+				atomic_store(&state->err, err);
+			atomic_store(&state->dumping, false);
+		}
+
+		if (atomic_load(&state->closing))
+			break;
+	}
+
+	return NULL;
+}
+
+// The range is read by the dump thread after the semaphore is posted.
+static void request_dump(struct recorder_state *state, uint64_t start,
+			 uint64_t end)
+{
+	state->dump_start = start;
+	state->dump_end = end;
+	atomic_store(&state->dumping, true);
+	sem_post(&state->request);
+}
+
+// In the PCM thread.
+static int recorder_write(struct container_context *cntr, void *buf,
+			  unsigned int byte_count)
+{
+	struct recorder_state *state = cntr->io_private_data;
+	uint64_t pos = atomic_load_explicit(&state->written,
+					    memory_order_relaxed);
+	unsigned int offset = pos % state->capacity;
+	unsigned int len = byte_count;
+
+	if (len > state->capacity - offset)
+		len = state->capacity - offset;
+	memcpy(state->ring + offset, buf, len);
+	if (len < byte_count)
+		memcpy(state->ring, (char *)buf + len, byte_count - len);
+	pos += byte_count;
+	atomic_store_explicit(&state->written, pos, memory_order_release);
+
+	if (atomic_exchange(&state->triggered, false)) {
+		if (state->armed || atomic_load(&state->dumping)) {
+			if (cntr->verbose > 0) {
+				fprintf(stderr,
+					"  recorder: trigger ignored during "
+					"dump\n");
+			}
+		} else {
+			state->armed = true;
+			state->start = pos > state->pre_roll_bytes ?
+				       pos - state->pre_roll_bytes : 0;
+			state->end = pos + state->post_roll_bytes;
+		}
+	}
+
+	if (state->armed && pos >= state->end) {
+		state->armed = false;
+		request_dump(state, state->start, state->end);
+	}
+
+	return 0;
+}
+
+static void join_thread(struct recorder_state *state)
+{
+	if (!state->thread_running)
+		return;
+
+	atomic_store(&state->closing, true);
+	sem_post(&state->request);
+
+	pthread_join(state->thread, NULL);
+	state->thread_running = false;
+}
+
+// The dump in post-roll is written with the frames so far.
+static int recorder_flush(struct container_context *cntr)
+{
+	struct recorder_state *state = cntr->io_private_data;
+
+	if (state->armed) {
+		state->armed = false;
+		if (!atomic_load(&state->dumping)) {
+			request_dump(state, state->start,
+				     atomic_load(&state->written));
+		}
+	}
+
+	join_thread(state);
+
+	return atomic_load(&state->err);
+}
+
+static void free_state(struct recorder_state *state)
+{
+	free(state->ring);
+	free(state->chunk);
+	sem_destroy(&state->request);
+	free(state);
+}
+
+static void recorder_release(struct container_context *cntr)
+{
+	struct recorder_state *state = cntr->io_private_data;
+	void (*release_io)(struct container_context *cntr);
+
+	if (state == NULL)
+		return;
+
+	join_thread(state);
+	release_io = state->release_io;
+	free_state(state);
+
+	cntr->io_private_data = NULL;
+
+	if (release_io)
+		release_io(cntr);
+}
+
+// Safe to call in a handler of UNIX signal.
+void container_context_trigger_recorder(struct container_context *cntr)
+{
+	struct recorder_state *state = cntr->io_private_data;
+
+	if (state != NULL && cntr->process_bytes == recorder_write)
+		atomic_store(&state->triggered, true);
+}
+
+int container_context_enable_recorder(struct container_context *cntr,
+			snd_pcm_format_t format,
+			enum container_format dump_format,
+			unsigned int pre_roll_msec,
+			unsigned int post_roll_msec,
+			int (*open_dump)(struct container_context *cntr,
+					 void *private_data, unsigned int index,
+					 int *fd),
+			void *private_data)
+{
+	struct recorder_state *state;
+	uint64_t frame_count;
+	sigset_t mask;
+	sigset_t old_mask;
+	int err;
+
+	assert(cntr);
+	assert(cntr->bytes_per_sample > 0);
+	assert(cntr->samples_per_frame > 0);
+	assert(cntr->frames_per_second > 0);
+	assert(open_dump);
+
+	if (cntr->type != CONTAINER_TYPE_BUILDER || pre_roll_msec == 0)
+		return -EINVAL;
+
+	state = calloc(1, sizeof(*state));
+	if (state == NULL)
+		return -ENOMEM;
+	sem_init(&state->request, 0, 0);
+
+	state->bytes_per_frame = cntr->bytes_per_sample *
+				 cntr->samples_per_frame;
+	state->pre_roll_bytes = (uint64_t)cntr->frames_per_second *
+				pre_roll_msec / 1000 * state->bytes_per_frame;
+	state->post_roll_bytes = (uint64_t)cntr->frames_per_second *
+				 post_roll_msec / 1000 * state->bytes_per_frame;
+
+	frame_count = (uint64_t)cntr->frames_per_second *
+		      (pre_roll_msec + post_roll_msec) / 1000 * 2;
+	if (frame_count * state->bytes_per_frame > UINT32_MAX) {
+		err = -EFBIG;
+		goto error;
+	}
+	state->capacity = frame_count * state->bytes_per_frame;
+
+	// Touch all of pages so that no page fault occurs in the PCM thread.
+	state->ring = malloc(state->capacity);
+	state->chunk = malloc(DUMP_CHUNK_FRAMES * state->bytes_per_frame);
+	if (state->ring == NULL || state->chunk == NULL) {
+		err = -ENOMEM;
+		goto error;
+	}
+	memset(state->ring, 0, state->capacity);
+
+	atomic_init(&state->written, 0);
+	atomic_init(&state->triggered, false);
+	atomic_init(&state->dumping, false);
+	atomic_init(&state->closing, false);
+	atomic_init(&state->err, 0);
+
+	state->format = format;
+	state->dump_format = dump_format;
+	state->open_dump = open_dump;
+	state->private_data = private_data;
+	state->release_io = cntr->release_io;
+
+	cntr->io_private_data = state;
+
+	// UNIX signals should be delivered to the PCM thread.
+	sigfillset(&mask);
+	pthread_sigmask(SIG_SETMASK, &mask, &old_mask);
+	err = -pthread_create(&state->thread, NULL, dump_thread, cntr);
+	pthread_sigmask(SIG_SETMASK, &old_mask, NULL);
+	if (err < 0) {
+		cntr->io_private_data = NULL;
+		goto error;
+	}
+	state->thread_running = true;
+
+	cntr->process_bytes = recorder_write;
+	cntr->flush_bytes = recorder_flush;
+	cntr->release_io = recorder_release;
+
+	if (cntr->verbose > 0) {
+		fprintf(stderr, "  recorder: ring of %" PRIu64 " frames\n",
+			frame_count);
+	}
+
+	return 0;
+error:
+	free_state(state);
+	return err;
+}
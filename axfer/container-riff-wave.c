@@ -18,14 +18,22 @@
 // - RFC 2361 'WAVE and AVI Codec Registries' at ietf.org
 // - 'mmreg.h' in Wine project
 // - 'mmreg.h' in ReactOS project
+// - EBU Tech 3306 'RF64: An extended File Format for Audio' at tech.ebu.ch
 
 #define RIFF_MAGIC		"RIF"	// A common part.
 
 #define RIFF_CHUNK_ID_LE	"RIFF"
 #define RIFF_CHUNK_ID_BE	"RIFX"
+#define RF64_CHUNK_ID		"RF64"
 #define RIFF_FORM_WAVE		"WAVE"
+#define DS64_SUBCHUNK_ID	"ds64"
 #define FMT_SUBCHUNK_ID		"fmt "
 #define DATA_SUBCHUNK_ID	"data"
+#define CUE_SUBCHUNK_ID		"cue "
+#define LIST_SUBCHUNK_ID	"LIST"
+#define ADTL_FORM_ID		"adtl"
+#define LTXT_SUBCHUNK_ID	"ltxt"
+#define GAP_PURPOSE_ID		"gap "
 
 // See 'WAVE and AVI Codec Registries (Historic Registry)' in 'iana.org'.
 // https://www.iana.org/assignments/wave-avi-codec-registry/
@@ -93,6 +101,22 @@ struct riff_subchunk {
 	uint8_t data[0];
 };
 
+// For RF64, the sizes in the chunk header and the data subchunk are -1, and
+// 64 bit sizes are in this subchunk instead.
+struct wave_ds64_subchunk {
+	uint8_t id[4];
+	uint32_t size;
+
+	uint32_t riff_size_low;
+	uint32_t riff_size_high;
+	uint32_t data_size_low;
+	uint32_t data_size_high;
+	uint32_t sample_count_low;
+	uint32_t sample_count_high;
+	uint32_t table_length;
+	uint8_t table[0];
+};
+
 struct wave_fmt_subchunk {
 	uint8_t id[4];
 	uint32_t size;
@@ -113,8 +137,41 @@ struct wave_data_subchunk {
 	uint8_t frames[0];
 };
 
+// Runs of silence skipped in capture are listed by cue points following data
+// subchunk. Each of them has labeled text with the number of skipped frames.
+struct wave_cue_point {
+	uint32_t id;
+	uint32_t position;
+	uint8_t chunk_id[4];
+	uint32_t chunk_start;
+	uint32_t block_start;
+	uint32_t sample_offset;
+};
+
+struct wave_cue_subchunk {
+	uint8_t id[4];
+	uint32_t size;
+
+	uint32_t point_count;
+	struct wave_cue_point points[0];
+};
+
+struct wave_ltxt_subchunk {
+	uint8_t id[4];
+	uint32_t size;
+
+	uint32_t cue_id;
+	uint32_t sample_length;
+	uint8_t purpose[4];
+	uint16_t country;
+	uint16_t language;
+	uint16_t dialect;
+	uint16_t code_page;
+};
+
 struct parser_state {
 	bool be;
+	bool rf64;
 	enum wave_format format;
 	unsigned int samples_per_frame;
 	unsigned int frames_per_second;
@@ -122,19 +179,24 @@ struct parser_state {
 	unsigned int bytes_per_frame;
 	unsigned int bytes_per_sample;
 	unsigned int avail_bits_in_sample;
-	unsigned int byte_count;
+	uint64_t ds64_data_size;
+	uint64_t byte_count;
 };
 
 static int parse_riff_chunk_header(struct parser_state *state,
 				   struct riff_chunk *chunk,
 				   uint64_t *byte_count)
 {
-	if (!memcmp(chunk->id, RIFF_CHUNK_ID_BE, sizeof(chunk->id)))
+	if (!memcmp(chunk->id, RIFF_CHUNK_ID_BE, sizeof(chunk->id))) {
 		state->be = true;
-	else if (!memcmp(chunk->id, RIFF_CHUNK_ID_LE, sizeof(chunk->id)))
+	} else if (!memcmp(chunk->id, RIFF_CHUNK_ID_LE, sizeof(chunk->id))) {
 		state->be = false;
-	else
+	} else if (!memcmp(chunk->id, RF64_CHUNK_ID, sizeof(chunk->id))) {
+		state->be = false;
+		state->rf64 = true;
+	} else {
 		return -EINVAL;
+	}
 
 	if (state->be)
 		*byte_count = be32toh(chunk->size);
@@ -212,6 +274,16 @@ static int parse_wave_fmt_subchunk(struct parser_state *state,
 	return 0;
 }
 
+static int parse_wave_ds64_subchunk(struct parser_state *state,
+				    struct wave_ds64_subchunk *subchunk)
+{
+	state->ds64_data_size =
+		((uint64_t)le32toh(subchunk->data_size_high) << 32) |
+		le32toh(subchunk->data_size_low);
+
+	return 0;
+}
+
 static int parse_wave_data_subchunk(struct parser_state *state,
 				    struct wave_data_subchunk *subchunk)
 {
@@ -220,6 +292,9 @@ static int parse_wave_data_subchunk(struct parser_state *state,
 	else
 		state->byte_count = le32toh(subchunk->size);
 
+	if (state->rf64 && state->byte_count == UINT32_MAX)
+		state->byte_count = state->ds64_data_size;
+
 	return 0;
 }
 
@@ -227,11 +302,13 @@ static int parse_wave_subchunk(struct container_context *cntr)
 {
 	union {
 		struct riff_subchunk subchunk;
+		struct wave_ds64_subchunk ds64_subchunk;
 		struct wave_fmt_subchunk fmt_subchunk;
 		struct wave_data_subchunk data_subchunk;
 	} buf = {0};
 	enum {
 		SUBCHUNK_TYPE_UNKNOWN = -1,
+		SUBCHUNK_TYPE_DS64,
 		SUBCHUNK_TYPE_FMT,
 		SUBCHUNK_TYPE_DATA,
 	} subchunk_type;
@@ -255,8 +332,12 @@ static int parse_wave_subchunk(struct container_context *cntr)
 			subchunk_data_size = le32toh(buf.subchunk.size);
 
 		// Detect type of subchunk.
-		if (!memcmp(buf.subchunk.id, FMT_SUBCHUNK_ID,
+		if (state->rf64 &&
+		    !memcmp(buf.subchunk.id, DS64_SUBCHUNK_ID,
 			    sizeof(buf.subchunk.id))) {
+			subchunk_type = SUBCHUNK_TYPE_DS64;
+		} else if (!memcmp(buf.subchunk.id, FMT_SUBCHUNK_ID,
+				   sizeof(buf.subchunk.id))) {
 			subchunk_type = SUBCHUNK_TYPE_FMT;
 		} else if (!memcmp(buf.subchunk.id, DATA_SUBCHUNK_ID,
 				   sizeof(buf.subchunk.id))) {
@@ -267,7 +348,11 @@ static int parse_wave_subchunk(struct container_context *cntr)
 
 		if (subchunk_type != SUBCHUNK_TYPE_UNKNOWN) {
 			// Parse data of this subchunk.
-			if (subchunk_type == SUBCHUNK_TYPE_FMT) {
+			if (subchunk_type == SUBCHUNK_TYPE_DS64) {
+				required_size =
+					sizeof(struct wave_ds64_subchunk) -
+					sizeof(struct riff_chunk);
+			} else if (subchunk_type == SUBCHUNK_TYPE_FMT) {
 				required_size =
 					sizeof(struct wave_fmt_subchunk) -
 					sizeof(struct riff_chunk);
@@ -288,7 +373,10 @@ static int parse_wave_subchunk(struct container_context *cntr)
 				return 0;
 			subchunk_data_size -= required_size;
 
-			if (subchunk_type == SUBCHUNK_TYPE_FMT) {
+			if (subchunk_type == SUBCHUNK_TYPE_DS64) {
+				err = parse_wave_ds64_subchunk(state,
+							&buf.ds64_subchunk);
+			} else if (subchunk_type == SUBCHUNK_TYPE_FMT) {
 				err = parse_wave_fmt_subchunk(state,
 							&buf.fmt_subchunk);
 			} else if (subchunk_type == SUBCHUNK_TYPE_DATA) {
@@ -388,11 +476,14 @@ static int wave_parser_pre_process(struct container_context *cntr,
 
 struct builder_state {
 	bool be;
+	bool rf64;
 	enum wave_format format;
 	unsigned int avail_bits_in_sample;
 	unsigned int bytes_per_sample;
 	unsigned int samples_per_frame;
 	unsigned int frames_per_second;
+	// The size of subchunks following data subchunk.
+	uint64_t trailer_byte_count;
 };
 
 static void build_riff_chunk_header(struct riff_chunk *chunk,
@@ -485,7 +576,9 @@ static int write_riff_chunk_for_wave(struct container_context *cntr,
 		total_byte_count = cntr->max_size;
 	else
 		total_byte_count += byte_count;
-	build_riff_chunk_header(&buf.chunk, total_byte_count, state->be);
+	build_riff_chunk_header(&buf.chunk,
+				total_byte_count + state->trailer_byte_count,
+				state->be);
 	err = container_recursive_write(cntr, &buf, sizeof(buf.chunk));
 	if (err < 0)
 		return err;
@@ -507,6 +600,79 @@ static int write_riff_chunk_for_wave(struct container_context *cntr,
 	return container_recursive_write(cntr, &buf, sizeof(buf.data_subchunk));
 }
 
+static void build_wave_ds64_subchunk(struct wave_ds64_subchunk *subchunk,
+				     struct builder_state *state,
+				     uint64_t byte_count)
+{
+	unsigned int bytes_per_frame =
+			state->bytes_per_sample * state->samples_per_frame;
+	uint64_t riff_size;
+	uint64_t sample_count;
+	uint64_t size;
+
+	// No table.
+	size = sizeof(struct wave_ds64_subchunk) - sizeof(struct riff_subchunk);
+	build_subchunk_header((struct riff_subchunk *)subchunk,
+			      DS64_SUBCHUNK_ID, size, false);
+
+	riff_size = sizeof(struct riff_chunk_data) +
+		    sizeof(struct wave_ds64_subchunk) +
+		    sizeof(struct wave_fmt_subchunk) +
+		    sizeof(struct wave_data_subchunk) + byte_count +
+		    state->trailer_byte_count;
+	sample_count = byte_count / bytes_per_frame;
+
+	subchunk->riff_size_low = htole32(riff_size & UINT32_MAX);
+	subchunk->riff_size_high = htole32(riff_size >> 32);
+	subchunk->data_size_low = htole32(byte_count & UINT32_MAX);
+	subchunk->data_size_high = htole32(byte_count >> 32);
+	subchunk->sample_count_low = htole32(sample_count & UINT32_MAX);
+	subchunk->sample_count_high = htole32(sample_count >> 32);
+	subchunk->table_length = 0;
+}
+
+static int write_rf64_chunk_for_wave(struct container_context *cntr,
+				     uint64_t byte_count)
+{
+	struct builder_state *state = cntr->private_data;
+	union {
+		struct riff_chunk chunk;
+		struct riff_chunk_data chunk_data;
+		struct wave_ds64_subchunk ds64_subchunk;
+		struct wave_fmt_subchunk fmt_subchunk;
+		struct wave_data_subchunk data_subchunk;
+	} buf = {0};
+	int err;
+
+	// Chunk header. The size is in ds64 subchunk.
+	memcpy(buf.chunk.id, RF64_CHUNK_ID, sizeof(buf.chunk.id));
+	buf.chunk.size = htole32(UINT32_MAX);
+	err = container_recursive_write(cntr, &buf, sizeof(buf.chunk));
+	if (err < 0)
+		return err;
+
+	// Chunk data header.
+	memcpy(buf.chunk_data.id, RIFF_FORM_WAVE, sizeof(buf.chunk_data.id));
+	err = container_recursive_write(cntr, &buf, sizeof(buf.chunk_data));
+	if (err < 0)
+		return err;
+
+	// A subchunk for 64 bit sizes should be the first one.
+	build_wave_ds64_subchunk(&buf.ds64_subchunk, state, byte_count);
+	err = container_recursive_write(cntr, &buf, sizeof(buf.ds64_subchunk));
+	if (err < 0)
+		return err;
+
+	build_wave_format_subchunk(&buf.fmt_subchunk, state);
+	err = container_recursive_write(cntr, &buf, sizeof(buf.fmt_subchunk));
+	if (err < 0)
+		return err;
+
+	// The size is in ds64 subchunk.
+	build_wave_data_subchunk(&buf.data_subchunk, UINT32_MAX, false);
+	return container_recursive_write(cntr, &buf, sizeof(buf.data_subchunk));
+}
+
 static int wave_builder_pre_process(struct container_context *cntr,
 				    snd_pcm_format_t *format,
 				    unsigned int *samples_per_frame,
@@ -532,18 +698,180 @@ static int wave_builder_pre_process(struct container_context *cntr,
 
 	state->be = (snd_pcm_format_big_endian(*format) == 1);
 
+	if (state->rf64)
+		return write_rf64_chunk_for_wave(cntr, *byte_count);
 	return write_riff_chunk_for_wave(cntr, *byte_count);
 }
 
+static int rf64_builder_pre_process(struct container_context *cntr,
+				    snd_pcm_format_t *format,
+				    unsigned int *samples_per_frame,
+				    unsigned int *frames_per_second,
+				    uint64_t *byte_count)
+{
+	struct builder_state *state = cntr->private_data;
+
+	// RF64 has no variant for big endian.
+	if (snd_pcm_format_big_endian(*format) == 1)
+		return -EINVAL;
+	state->rf64 = true;
+
+	return wave_builder_pre_process(cntr, format, samples_per_frame,
+					frames_per_second, byte_count);
+}
+
+static uint32_t build_u32(uint64_t val, bool be)
+{
+	if (val > UINT32_MAX)
+		val = UINT32_MAX;
+	return be ? htobe32(val) : htole32(val);
+}
+
+static int write_gap_subchunks(struct container_context *cntr,
+			       const struct container_gap *gaps,
+			       unsigned int gap_count)
+{
+	struct builder_state *state = cntr->private_data;
+	union {
+		struct wave_cue_subchunk cue_subchunk;
+		struct wave_cue_point cue_point;
+		struct riff_subchunk list_subchunk;
+		struct riff_chunk_data list_data;
+		struct wave_ltxt_subchunk ltxt_subchunk;
+	} buf = {0};
+	uint64_t size;
+	unsigned int i;
+	int err;
+
+	size = sizeof(buf.cue_subchunk.point_count) +
+	       sizeof(struct wave_cue_point) * gap_count;
+	build_subchunk_header((struct riff_subchunk *)&buf.cue_subchunk,
+			      CUE_SUBCHUNK_ID, size, state->be);
+	buf.cue_subchunk.point_count = build_u32(gap_count, state->be);
+	err = container_recursive_write(cntr, &buf, sizeof(buf.cue_subchunk));
+	if (err < 0)
+		return err;
+
+	for (i = 0; i < gap_count; ++i) {
+		memset(&buf, 0, sizeof(buf));
+		buf.cue_point.id = build_u32(i + 1, state->be);
+		buf.cue_point.position = build_u32(gaps[i].frame_offset,
+						   state->be);
+		memcpy(buf.cue_point.chunk_id, DATA_SUBCHUNK_ID,
+		       sizeof(buf.cue_point.chunk_id));
+		buf.cue_point.sample_offset = build_u32(gaps[i].frame_offset,
+							state->be);
+		err = container_recursive_write(cntr, &buf,
+						sizeof(buf.cue_point));
+		if (err < 0)
+			return err;
+	}
+
+	memset(&buf, 0, sizeof(buf));
+	size = sizeof(struct riff_chunk_data) +
+	       sizeof(struct wave_ltxt_subchunk) * gap_count;
+	build_subchunk_header(&buf.list_subchunk, LIST_SUBCHUNK_ID, size,
+			      state->be);
+	err = container_recursive_write(cntr, &buf, sizeof(buf.list_subchunk));
+	if (err < 0)
+		return err;
+
+	memcpy(buf.list_data.id, ADTL_FORM_ID, sizeof(buf.list_data.id));
+	err = container_recursive_write(cntr, &buf, sizeof(buf.list_data));
+	if (err < 0)
+		return err;
+
+	for (i = 0; i < gap_count; ++i) {
+		memset(&buf, 0, sizeof(buf));
+		size = sizeof(struct wave_ltxt_subchunk) -
+		       sizeof(struct riff_subchunk);
+		build_subchunk_header((struct riff_subchunk *)&buf.ltxt_subchunk,
+				      LTXT_SUBCHUNK_ID, size, state->be);
+		buf.ltxt_subchunk.cue_id = build_u32(i + 1, state->be);
+		buf.ltxt_subchunk.sample_length =
+				build_u32(gaps[i].frame_count, state->be);
+		memcpy(buf.ltxt_subchunk.purpose, GAP_PURPOSE_ID,
+		       sizeof(buf.ltxt_subchunk.purpose));
+		err = container_recursive_write(cntr, &buf,
+						sizeof(buf.ltxt_subchunk));
+		if (err < 0)
+			return err;
+	}
+
+	return 0;
+}
+
+// The subchunks for gaps follow data subchunk, aligned to word.
+static int write_trailer(struct container_context *cntr,
+			 uint64_t handled_byte_count)
+{
+	struct builder_state *state = cntr->private_data;
+	const struct container_gap *gaps;
+	unsigned int gap_count;
+	uint64_t byte_count;
+	off64_t offset;
+	int err;
+
+	state->trailer_byte_count = 0;
+
+	gap_count = container_silence_get_gaps(cntr, &gaps);
+	if (gap_count == 0)
+		return 0;
+
+	byte_count = (handled_byte_count % 2) +
+		     sizeof(struct wave_cue_subchunk) +
+		     sizeof(struct wave_cue_point) * gap_count +
+		     sizeof(struct riff_subchunk) +
+		     sizeof(struct riff_chunk_data) +
+		     sizeof(struct wave_ltxt_subchunk) * gap_count;
+	if (handled_byte_count > cntr->max_size - byte_count) {
+		fprintf(stderr,
+			"The list of gaps is not written due to the size.\n");
+		return 0;
+	}
+
+	offset = sizeof(struct riff_chunk) + sizeof(struct riff_chunk_data) +
+		 sizeof(struct wave_fmt_subchunk) +
+		 sizeof(struct wave_data_subchunk) + handled_byte_count;
+	if (state->rf64)
+		offset += sizeof(struct wave_ds64_subchunk);
+	err = container_seek_offset(cntr, offset);
+	if (err < 0)
+		return err;
+
+	if (handled_byte_count % 2) {
+		uint8_t pad = 0;
+
+		err = container_recursive_write(cntr, &pad, sizeof(pad));
+		if (err < 0)
+			return err;
+	}
+
+	err = write_gap_subchunks(cntr, gaps, gap_count);
+	if (err < 0)
+		return err;
+
+	state->trailer_byte_count = byte_count;
+
+	return 0;
+}
+
 static int wave_builder_post_process(struct container_context *cntr,
 				     uint64_t handled_byte_count)
 {
+	struct builder_state *state = cntr->private_data;
 	int err;
 
+	err = write_trailer(cntr, handled_byte_count);
+	if (err < 0)
+		return err;
+
 	err = container_seek_offset(cntr, 0);
 	if (err < 0)
 		return err;
 
+	if (state->rf64)
+		return write_rf64_chunk_for_wave(cntr, handled_byte_count);
 	return write_riff_chunk_for_wave(cntr, handled_byte_count);
 }
 
@@ -572,3 +900,31 @@ const struct container_builder container_builder_riff_wave = {
 	},
 	.private_size = sizeof(struct builder_state),
 };
+
+const struct container_parser container_parser_rf64 = {
+	.format = CONTAINER_FORMAT_RF64,
+	.magic = RF64_CHUNK_ID,
+	.max_size = UINT64_MAX -
+		    sizeof(struct riff_chunk_data) -
+		    sizeof(struct wave_ds64_subchunk) -
+		    sizeof(struct wave_fmt_subchunk) -
+		    sizeof(struct wave_data_subchunk),
+	.ops = {
+		.pre_process	= wave_parser_pre_process,
+	},
+	.private_size = sizeof(struct parser_state),
+};
+
+const struct container_builder container_builder_rf64 = {
+	.format = CONTAINER_FORMAT_RF64,
+	.max_size = UINT64_MAX -
+		    sizeof(struct riff_chunk_data) -
+		    sizeof(struct wave_ds64_subchunk) -
+		    sizeof(struct wave_fmt_subchunk) -
+		    sizeof(struct wave_data_subchunk),
+	.ops = {
+		.pre_process	= rf64_builder_pre_process,
+		.post_process	= wave_builder_post_process,
+	},
+	.private_size = sizeof(struct builder_state),
+};
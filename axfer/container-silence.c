@@ -0,0 +1,484 @@
+// SPDX-License-Identifier: GPL-2.0
+//
+// container-silence.c - detect runs of silence in data frames for builders.
+//
+// Copyright (c) 2026 agent <agent@local>
+//
+// Licensed under the terms of the GNU General Public License, version 2.
+
+#include "container.h"
+#include "misc.h"
+
+#include <stdio.h>
+#include <errno.h>
+#include <math.h>
+#include <inttypes.h>
+
+// Samples in a chunk are evaluated without any branch so that compilers can
+// vectorize the loop. Only the chunk including loud sample is scanned again.
+#define SCAN_CHUNK	16
+
+struct silence_state {
+	enum container_silence_mode mode;
+	snd_pcm_format_t format;
+	uint64_t min_frame_count;
+
+	// Parameters of the scanner in the domain of samples.
+	int32_t threshold;
+	unsigned int shift;
+	uint32_t flip;
+	float threshold_float;
+	double threshold_double;
+	int (*find_first)(const void *buf, unsigned int count,
+			  const struct silence_state *state);
+	int (*find_last)(const void *buf, unsigned int count,
+			 const struct silence_state *state);
+
+	// Frames in the current run of silence.
+	uint64_t silent_frame_count;
+	bool skipping;
+	uint64_t skipped_frame_count;
+	uint64_t total_skipped_frame_count;
+
+	struct container_gap *gaps;
+	unsigned int gap_count;
+	unsigned int gap_capacity;
+
+	int (*open_next)(struct container_context *cntr, void *private_data,
+			 int *fd);
+	void *private_data;
+	unsigned int split_count;
+};
+
+static inline bool s8_is_loud(uint8_t val, const struct silence_state *state)
+{
+	int32_t v = (int8_t)(val ^ state->flip);
+
+	return (v > state->threshold) | (v < -state->threshold);
+}
+
+static inline bool s16_is_loud(uint16_t val, const struct silence_state *state)
+{
+	int32_t v = (int16_t)(val ^ state->flip);
+
+	return (v > state->threshold) | (v < -state->threshold);
+}
+
+// The samples of 24 bit in 32 bit container are shifted to MSB.
+static inline bool s32_is_loud(uint32_t val, const struct silence_state *state)
+{
+	int32_t v = (int32_t)((val << state->shift) ^ state->flip);
+
+	return (v > state->threshold) | (v < -state->threshold);
+}
+
+static inline bool float_is_loud(float val, const struct silence_state *state)
+{
+	return (val > state->threshold_float) |
+	       (val < -state->threshold_float);
+}
+
+static inline bool double_is_loud(double val,
+				  const struct silence_state *state)
+{
+	return (val > state->threshold_double) |
+	       (val < -state->threshold_double);
+}
+
+#define DEFINE_SCANNERS(name, type)					\
+static int name##_find_first(const void *buf, unsigned int count,	\
+			     const struct silence_state *state)		\
+{									\
+	const type *samples = buf;					\
+	unsigned int i, j;						\
+									\
+	for (i = 0; i + SCAN_CHUNK <= count; i += SCAN_CHUNK) {		\
+		bool loud = false;					\
+		for (j = 0; j < SCAN_CHUNK; ++j)			\
+			loud |= name##_is_loud(samples[i + j], state);	\
+		if (loud)						\
+			break;						\
+	}								\
+	for (; i < count; ++i) {					\
+		if (name##_is_loud(samples[i], state))			\
+			return i;					\
+	}								\
+	return -1;							\
+}									\
+									\
+static int name##_find_last(const void *buf, unsigned int count,	\
+			    const struct silence_state *state)		\
+{									\
+	const type *samples = buf;					\
+	unsigned int i, j;						\
+									\
+	for (i = count; i >= SCAN_CHUNK; i -= SCAN_CHUNK) {		\
+		bool loud = false;					\
+		for (j = i - SCAN_CHUNK; j < i; ++j)			\
+			loud |= name##_is_loud(samples[j], state);	\
+		if (loud)						\
+			break;						\
+	}								\
+	while (i > 0) {							\
+		--i;							\
+		if (name##_is_loud(samples[i], state))			\
+			return i;					\
+	}								\
+	return -1;							\
+}
+
+DEFINE_SCANNERS(s8, uint8_t)
+DEFINE_SCANNERS(s16, uint16_t)
+DEFINE_SCANNERS(s32, uint32_t)
+DEFINE_SCANNERS(float, float)
+DEFINE_SCANNERS(double, double)
+
+static int prepare_scanner(struct silence_state *state,
+			   snd_pcm_format_t format, double amplitude)
+{
+	int phys_width = snd_pcm_format_physical_width(format);
+	int width = snd_pcm_format_width(format);
+	double full_scale;
+
+	// The samples in the other byte order are not supported.
+	if (phys_width > 8 && snd_pcm_format_cpu_endian(format) != 1)
+		return -EINVAL;
+
+	if (snd_pcm_format_float(format) == 1) {
+		if (phys_width == 32) {
+			state->find_first = float_find_first;
+			state->find_last = float_find_last;
+		} else {
+			state->find_first = double_find_first;
+			state->find_last = double_find_last;
+		}
+		state->threshold_float = amplitude;
+		state->threshold_double = amplitude;
+		return 0;
+	}
+
+	if (snd_pcm_format_linear(format) != 1 || width > phys_width)
+		return -EINVAL;
+
+	if (phys_width == 8) {
+		state->find_first = s8_find_first;
+		state->find_last = s8_find_last;
+	} else if (phys_width == 16) {
+		state->find_first = s16_find_first;
+		state->find_last = s16_find_last;
+	} else if (phys_width == 32) {
+		state->find_first = s32_find_first;
+		state->find_last = s32_find_last;
+		state->shift = 32 - width;
+	} else {
+		// Samples in 3 bytes.
+		return -EINVAL;
+	}
+
+	// Unsigned samples are biased by the half of full scale.
+	if (snd_pcm_format_signed(format) != 1)
+		state->flip = 1u << (phys_width - 1);
+
+	full_scale = ldexp(1.0, phys_width - 1);
+	if (amplitude * full_scale >= (double)INT32_MAX)
+		state->threshold = INT32_MAX;
+	else
+		state->threshold = (int32_t)(amplitude * full_scale);
+
+	return 0;
+}
+
+int container_context_enable_silence(struct container_context *cntr,
+			snd_pcm_format_t format, double threshold_db,
+			unsigned int duration_msec,
+			enum container_silence_mode mode,
+			int (*open_next)(struct container_context *cntr,
+					 void *private_data, int *fd),
+			void *private_data)
+{
+	struct silence_state *state;
+	int err;
+
+	assert(cntr);
+	assert(cntr->frames_per_second > 0);
+
+	if (cntr->type != CONTAINER_TYPE_BUILDER)
+		return -EINVAL;
+	if (mode >= CONTAINER_SILENCE_MODE_COUNT || duration_msec == 0)
+		return -EINVAL;
+	if (mode == CONTAINER_SILENCE_MODE_SPLIT && open_next == NULL)
+		return -EINVAL;
+
+	state = calloc(1, sizeof(*state));
+	if (state == NULL)
+		return -ENOMEM;
+
+	err = prepare_scanner(state, format, pow(10.0, threshold_db / 20.0));
+	if (err < 0) {
+		fprintf(stderr,
+			"Silence is not detected for the format of samples: "
+			"%s\n", snd_pcm_format_name(format));
+		free(state);
+		return err;
+	}
+
+	state->mode = mode;
+	state->format = format;
+	state->min_frame_count = (uint64_t)duration_msec *
+				 cntr->frames_per_second / 1000;
+	if (state->min_frame_count == 0)
+		state->min_frame_count = 1;
+	state->open_next = open_next;
+	state->private_data = private_data;
+
+	// Each file starts at the first loud frame.
+	if (mode == CONTAINER_SILENCE_MODE_SPLIT)
+		state->skipping = true;
+
+	cntr->silence_private_data = state;
+
+	if (cntr->verbose > 0) {
+		fprintf(stderr, "  silence: threshold %.1f dBFS, %" PRIu64
+			" frames\n", threshold_db, state->min_frame_count);
+	}
+
+	return 0;
+}
+
+static int write_frames(struct container_context *cntr, char *buf,
+			unsigned int frame_count)
+{
+	unsigned int bytes_per_frame =
+			cntr->bytes_per_sample * cntr->samples_per_frame;
+	unsigned int byte_count = frame_count * bytes_per_frame;
+	int err;
+
+	if (cntr->eof || byte_count == 0)
+		return 0;
+
+	if (cntr->handled_byte_count > cntr->max_size - byte_count)
+		byte_count = cntr->max_size - cntr->handled_byte_count;
+
+	err = cntr->process_bytes(cntr, buf, byte_count);
+	if (err < 0)
+		return err;
+
+	cntr->handled_byte_count += byte_count;
+	if (cntr->handled_byte_count == cntr->max_size)
+		cntr->eof = true;
+
+	return 0;
+}
+
+static int add_gap(struct container_context *cntr)
+{
+	struct silence_state *state = cntr->silence_private_data;
+	unsigned int bytes_per_frame =
+			cntr->bytes_per_sample * cntr->samples_per_frame;
+	struct container_gap *gap;
+
+	if (state->gap_count == state->gap_capacity) {
+		unsigned int capacity = state->gap_capacity * 2;
+		struct container_gap *gaps;
+
+		if (capacity == 0)
+			capacity = 16;
+		gaps = realloc(state->gaps, capacity * sizeof(*gaps));
+		if (gaps == NULL)
+			return -ENOMEM;
+		state->gaps = gaps;
+		state->gap_capacity = capacity;
+	}
+
+	gap = &state->gaps[state->gap_count++];
+	gap->frame_offset = cntr->handled_byte_count / bytes_per_frame;
+	gap->frame_count = state->skipped_frame_count;
+
+	return 0;
+}
+
+// The header of current file is rewritten, then the next file is used. Data
+// frames are written by the default I/O only, thus nothing is queued.
+static int split_file(struct container_context *cntr)
+{
+	struct silence_state *state = cntr->silence_private_data;
+	snd_pcm_format_t format = state->format;
+	unsigned int samples_per_frame = cntr->samples_per_frame;
+	unsigned int frames_per_second = cntr->frames_per_second;
+	uint64_t byte_count;
+	int fd;
+	int err;
+
+	if (!cntr->stdio && cntr->ops->post_process) {
+		err = cntr->ops->post_process(cntr, cntr->handled_byte_count);
+		if (err < 0)
+			return err;
+	}
+	fsync(cntr->fd);
+
+	err = state->open_next(cntr, state->private_data, &fd);
+	if (err < 0)
+		return err;
+	cntr->fd = fd;
+	cntr->handled_byte_count = 0;
+	cntr->eof = false;
+	++state->split_count;
+
+	byte_count = cntr->max_size;
+	if (cntr->ops->pre_process) {
+		err = cntr->ops->pre_process(cntr, &format, &samples_per_frame,
+					     &frames_per_second, &byte_count);
+		if (err < 0)
+			return err;
+	}
+
+	return 0;
+}
+
+static int finish_skipping(struct container_context *cntr)
+{
+	struct silence_state *state = cntr->silence_private_data;
+	int err = 0;
+
+	state->total_skipped_frame_count += state->skipped_frame_count;
+
+	if (state->mode == CONTAINER_SILENCE_MODE_SKIP) {
+		if (state->skipped_frame_count > 0)
+			err = add_gap(cntr);
+	} else if (cntr->handled_byte_count > 0) {
+		err = split_file(cntr);
+	}
+
+	state->skipping = false;
+	state->skipped_frame_count = 0;
+	state->silent_frame_count = 0;
+
+	return err;
+}
+
+// The run of silence is detected at the resolution of frame. Frames in the
+// run are written till the run reaches the minimum duration, then skipped
+// till any loud sample appears.
+int container_silence_process(struct container_context *cntr, char *buf,
+			      unsigned int frame_count)
+{
+	struct silence_state *state = cntr->silence_private_data;
+	unsigned int samples_per_frame = cntr->samples_per_frame;
+	unsigned int bytes_per_frame =
+			cntr->bytes_per_sample * samples_per_frame;
+	unsigned int kept = 0;
+	unsigned int pos = 0;
+	int index;
+	int err;
+
+	while (pos < frame_count) {
+		char *frames = buf + pos * bytes_per_frame;
+		unsigned int count = frame_count - pos;
+
+		if (state->skipping) {
+			index = state->find_first(frames,
+						  count * samples_per_frame,
+						  state);
+			if (index < 0) {
+				state->skipped_frame_count += count;
+				pos = frame_count;
+				kept = frame_count;
+				break;
+			}
+
+			state->skipped_frame_count += index / samples_per_frame;
+			pos += index / samples_per_frame;
+			kept = pos;
+
+			err = finish_skipping(cntr);
+			if (err < 0)
+				return err;
+		} else {
+			// No run of silence reaches the minimum duration in
+			// the frames of window when any loud sample is in it.
+			uint64_t window = state->min_frame_count -
+					  state->silent_frame_count;
+
+			if (count > window)
+				count = window;
+
+			index = state->find_last(frames,
+						 count * samples_per_frame,
+						 state);
+			if (index < 0) {
+				state->silent_frame_count += count;
+			} else {
+				state->silent_frame_count =
+					count - index / samples_per_frame - 1;
+			}
+			pos += count;
+
+			if (state->silent_frame_count >=
+						state->min_frame_count) {
+				err = write_frames(cntr,
+						   buf + kept * bytes_per_frame,
+						   pos - kept);
+				if (err < 0)
+					return err;
+				kept = pos;
+				state->skipping = true;
+			}
+		}
+	}
+
+	return write_frames(cntr, buf + kept * bytes_per_frame,
+			    frame_count - kept);
+}
+
+// The run of silence at the end is also recorded.
+int container_silence_flush(struct container_context *cntr)
+{
+	struct silence_state *state = cntr->silence_private_data;
+	int err = 0;
+
+	if (cntr->verbose > 0) {
+		fprintf(stderr, "  silence: skipped frames: %" PRIu64 "\n",
+			state->total_skipped_frame_count +
+			state->skipped_frame_count);
+		if (state->mode == CONTAINER_SILENCE_MODE_SPLIT) {
+			fprintf(stderr, "  silence: split files: %u\n",
+				state->split_count);
+		}
+	}
+
+	if (state->mode == CONTAINER_SILENCE_MODE_SKIP && state->skipping &&
+	    state->skipped_frame_count > 0)
+		err = add_gap(cntr);
+
+	state->total_skipped_frame_count += state->skipped_frame_count;
+	state->skipping = false;
+	state->skipped_frame_count = 0;
+
+	return err;
+}
+
+unsigned int container_silence_get_gaps(struct container_context *cntr,
+					const struct container_gap **gaps)
+{
+	struct silence_state *state = cntr->silence_private_data;
+
+	if (state == NULL || state->mode != CONTAINER_SILENCE_MODE_SKIP) {
+		*gaps = NULL;
+		return 0;
+	}
+
+	*gaps = state->gaps;
+	return state->gap_count;
+}
+
+void container_silence_release(struct container_context *cntr)
+{
+	struct silence_state *state = cntr->silence_private_data;
+
+	if (state == NULL)
+		return;
+
+	free(state->gaps);
+	free(state);
+	cntr->silence_private_data = NULL;
+}
@@ -0,0 +1,206 @@
+// SPDX-License-Identifier: GPL-2.0
+//
+// container-splice.c - an I/O backend for data frames in containers by
+//			vmsplice(2) to pipes.
+//
+// Copyright (c) 2026 agent <agent@local>
+//
+// Licensed under the terms of the GNU General Public License, version 2.
+
+#include "container.h"
+#include "misc.h"
+
+#include <stdio.h>
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/ioctl.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+
+// The ring is enough larger than the capacity of pipe.
+#define RING_SIZE_RATIO		4
+#define DEFAULT_PIPE_SIZE	65536
+#define DRAIN_INTERVAL_MSEC	10
+
+// The pages of buffer are attached to the pipe by vmsplice(2) instead of
+// copying to the buffer of pipe in kernel space. The pages should not be
+// changed until the reader of pipe consumes them, while the buffer given by
+// callers is reused soon (e.g. the mapped area of PCM substream). Data
+// frames are therefore copied to a ring several times larger than the
+// capacity of pipe. Once data frames of the capacity are attached after a
+// page, the page is not referred by the pipe anymore.
+struct splice_state {
+	char *ring;
+	unsigned int ring_size;
+	// The position in the ring.
+	unsigned int pos;
+	unsigned int pipe_size;
+};
+
+static int splice_to_pipe(struct container_context *cntr, char *buf,
+			  unsigned int byte_count)
+{
+	struct iovec iov = {
+		.iov_base = buf,
+		.iov_len = byte_count,
+	};
+	ssize_t result;
+
+	while (iov.iov_len > 0 && !cntr->interrupted) {
+		result = vmsplice(cntr->fd, &iov, 1,
+				  SPLICE_F_MORE | SPLICE_F_NONBLOCK);
+		if (result < 0) {
+			struct pollfd pfd = {
+				.fd = cntr->fd,
+				.events = POLLOUT,
+			};
+
+			if (errno == EINTR)
+				continue;
+			if (errno != EAGAIN)
+				return -errno;
+
+			// Wait for the reader of pipe.
+			if (poll(&pfd, 1, -1) < 0 && errno != EINTR)
+				return -errno;
+			continue;
+		}
+
+		iov.iov_base = (char *)iov.iov_base + result;
+		iov.iov_len -= result;
+	}
+
+	return 0;
+}
+
+static int splice_write(struct container_context *cntr, void *buf,
+			unsigned int byte_count)
+{
+	struct splice_state *state = cntr->io_private_data;
+	const char *src = buf;
+	unsigned int consumed = 0;
+	int err;
+
+	while (consumed < byte_count) {
+		unsigned int size = state->ring_size - state->pos;
+
+		if (size > byte_count - consumed)
+			size = byte_count - consumed;
+
+		memcpy(state->ring + state->pos, src + consumed, size);
+		err = splice_to_pipe(cntr, state->ring + state->pos, size);
+		if (err < 0)
+			return err;
+
+		state->pos = (state->pos + size) % state->ring_size;
+		consumed += size;
+	}
+
+	return 0;
+}
+
+// The pipe still refers to the pages attached last. Wait until the reader
+// consumes them or goes away.
+static bool drain_pipe(struct container_context *cntr)
+{
+	struct pollfd pfd = {
+		.fd = cntr->fd,
+		.events = POLLOUT,
+	};
+	int queued;
+
+	while (!cntr->interrupted) {
+		if (ioctl(cntr->fd, FIONREAD, &queued) < 0 || queued == 0)
+			return true;
+
+		if (poll(&pfd, 1, DRAIN_INTERVAL_MSEC) < 0) {
+			if (errno != EINTR)
+				return false;
+			continue;
+		}
+		// No reader, the pages are not read anymore.
+		if (pfd.revents & POLLERR)
+			return true;
+	}
+
+	return false;
+}
+
+static void splice_release(struct container_context *cntr)
+{
+	struct splice_state *state = cntr->io_private_data;
+
+	if (state == NULL)
+		return;
+
+	// At interruption, the ring is left to the end of process since data
+	// frames in it can still be read.
+	if (drain_pipe(cntr))
+		free(state->ring);
+	free(state);
+
+	cntr->io_private_data = NULL;
+}
+
+int container_context_enable_splice(struct container_context *cntr)
+{
+	struct splice_state *state;
+	struct stat st;
+	long page_size;
+	int pipe_size;
+	int err;
+
+	assert(cntr);
+
+	if (cntr->type != CONTAINER_TYPE_BUILDER)
+		return -EINVAL;
+
+	// Available for pipes only.
+	if (fstat(cntr->fd, &st) < 0 || !S_ISFIFO(st.st_mode)) {
+		if (cntr->verbose > 0) {
+			fprintf(stderr,
+				"  splice: unavailable for this file, use "
+				"default I/O.\n");
+		}
+		return 0;
+	}
+
+	page_size = sysconf(_SC_PAGESIZE);
+	if (page_size <= 0)
+		return -ENXIO;
+
+	pipe_size = fcntl(cntr->fd, F_GETPIPE_SZ);
+	if (pipe_size <= 0)
+		pipe_size = DEFAULT_PIPE_SIZE;
+
+	state = calloc(1, sizeof(*state));
+	if (state == NULL)
+		return -ENOMEM;
+
+	state->pipe_size = pipe_size;
+	state->ring_size = pipe_size * RING_SIZE_RATIO;
+	state->ring_size += page_size - 1;
+	state->ring_size -= state->ring_size % page_size;
+
+	err = posix_memalign((void **)&state->ring, page_size,
+			     state->ring_size);
+	if (err > 0) {
+		free(state);
+		return -err;
+	}
+
+	cntr->io_private_data = state;
+	cntr->process_bytes = splice_write;
+	cntr->release_io = splice_release;
+
+	if (cntr->verbose > 0) {
+		fprintf(stderr,
+			"  splice: %u bytes of ring for %u bytes of pipe\n",
+			state->ring_size, state->pipe_size);
+	}
+
+	return 0;
+}
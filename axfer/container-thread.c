@@ -0,0 +1,561 @@
+// SPDX-License-Identifier: GPL-2.0
+//
+// container-thread.c - an I/O backend for data frames in containers by a
+//			dedicated thread.
+//
+// Copyright (c) 2026 agent <agent@local>
+//
+// Licensed under the terms of the GNU General Public License, version 2.
+
+#include "container.h"
+#include "misc.h"
+
+#include <stdio.h>
+#include <errno.h>
+#include <string.h>
+#include <signal.h>
+#include <poll.h>
+#include <pthread.h>
+#include <semaphore.h>
+#include <stdatomic.h>
+
+// Data frames are exchanged between the thread to process PCM substream and
+// the dedicated thread for I/O in a ring of blocks. The ring has one producer
+// and one consumer; for parsers, the I/O thread produces blocks and the PCM
+// thread consumes them, and vice versa for builders. The indices of ring are
+// updated by atomic operations and semaphores are used just to sleep when
+// the ring is empty or full.
+struct io_block {
+	char *buf;
+	unsigned int size;
+};
+
+struct io_thread_state {
+	struct io_block *blocks;
+	unsigned int block_count;
+	unsigned int bytes_per_block;
+
+	// Incremented by producer.
+	atomic_uint head;
+	// Incremented by consumer.
+	atomic_uint tail;
+	sem_t filled;
+	sem_t empty;
+
+	// The position in the block which the PCM thread processes.
+	unsigned int pos;
+
+	pthread_t thread;
+	bool thread_running;
+	atomic_bool closing;
+	atomic_int err;
+
+	// Format-specific encoding of builders runs in the I/O thread.
+	int (*process_bytes)(struct container_context *cntr, void *buf,
+			     unsigned int byte_count);
+	int (*flush_bytes)(struct container_context *cntr);
+	void (*release_io)(struct container_context *cntr);
+
+	// For statistics.
+	unsigned int high_water_mark;
+	uint64_t fill_level_sum;
+	uint64_t sample_count;
+	unsigned int stall_count;
+};
+
+static inline unsigned int get_fill_level(struct io_thread_state *state)
+{
+	return atomic_load_explicit(&state->head, memory_order_acquire) -
+	       atomic_load_explicit(&state->tail, memory_order_acquire);
+}
+
+static void update_statistics(struct io_thread_state *state)
+{
+	unsigned int level = get_fill_level(state);
+
+	if (level > state->high_water_mark)
+		state->high_water_mark = level;
+	state->fill_level_sum += level;
+	++state->sample_count;
+}
+
+static int wait_for_semaphore(struct container_context *cntr, sem_t *sem)
+{
+	if (sem_trywait(sem) == 0)
+		return 0;
+
+	while (sem_wait(sem) < 0) {
+		if (errno != EINTR)
+			return -errno;
+		if (cntr != NULL && cntr->interrupted)
+			return -EINTR;
+	}
+
+	return 1;
+}
+
+// Wake up periodically so that the I/O thread is joined even if the file is
+// not ready, e.g. pipe.
+static int wait_for_fd(struct io_thread_state *state, int fd, short events)
+{
+	struct pollfd pfd = {
+		.fd = fd,
+		.events = events,
+	};
+	int result;
+
+	while (1) {
+		if (atomic_load(&state->closing))
+			return -EINTR;
+
+		result = poll(&pfd, 1, 100);
+		if (result > 0)
+			break;
+		if (result < 0 && errno != EINTR)
+			return -errno;
+	}
+
+	return 0;
+}
+
+// In I/O thread. The descriptor is configured with non-blocking mode, thus
+// wait for it.
+static int read_block(struct io_thread_state *state, int fd,
+		      struct io_block *block, unsigned int size, bool *eof)
+{
+	ssize_t result;
+	int err;
+
+	block->size = 0;
+	while (block->size < size) {
+		result = read(fd, block->buf + block->size, size - block->size);
+		if (result < 0) {
+			if (errno != EAGAIN && errno != EINTR)
+				return -errno;
+			err = wait_for_fd(state, fd, POLLIN);
+			if (err < 0)
+				return err;
+			continue;
+		}
+		if (result == 0) {
+			*eof = true;
+			break;
+		}
+		block->size += result;
+	}
+
+	return 0;
+}
+
+static int write_block(struct io_thread_state *state, int fd,
+		       struct io_block *block)
+{
+	unsigned int consumed = 0;
+	ssize_t result;
+	int err;
+
+	while (consumed < block->size) {
+		result = write(fd, block->buf + consumed, block->size - consumed);
+		if (result < 0) {
+			if (errno != EAGAIN && errno != EINTR)
+				return -errno;
+			err = wait_for_fd(state, fd, POLLOUT);
+			if (err < 0)
+				return err;
+			continue;
+		}
+		consumed += result;
+	}
+
+	return 0;
+}
+
+static void *parser_thread(void *arg)
+{
+	struct container_context *cntr = arg;
+	struct io_thread_state *state = cntr->io_private_data;
+	bool eof = false;
+	int err = 0;
+
+	while (!eof) {
+		struct io_block *block;
+		unsigned int head;
+
+		err = wait_for_semaphore(NULL, &state->empty);
+		if (err < 0)
+			break;
+		if (atomic_load(&state->closing))
+			break;
+
+		head = atomic_load_explicit(&state->head, memory_order_relaxed);
+		block = &state->blocks[head % state->block_count];
+		err = read_block(state, cntr->fd, block, state->bytes_per_block,
+				 &eof);
+		if (err < 0)
+			break;
+
+		// Publish the block. A short block means the end of file.
+		atomic_store_explicit(&state->head, head + 1,
+				      memory_order_release);
+		sem_post(&state->filled);
+	}
+
+	if (err < 0) {
+		atomic_store(&state->err, err);
+		// Wake up the PCM thread.
+		sem_post(&state->filled);
+	}
+
+	return NULL;
+}
+
+static void *builder_thread(void *arg)
+{
+	struct container_context *cntr = arg;
+	struct io_thread_state *state = cntr->io_private_data;
+	int err = 0;
+
+	while (1) {
+		struct io_block *block;
+		unsigned int tail;
+
+		err = wait_for_semaphore(NULL, &state->filled);
+		if (err < 0)
+			break;
+
+		tail = atomic_load_explicit(&state->tail, memory_order_relaxed);
+		if (tail == atomic_load_explicit(&state->head,
+						 memory_order_acquire)) {
+			// Posted just to finish.
+			if (atomic_load(&state->closing))
+				break;
+			continue;
+		}
+
+		block = &state->blocks[tail % state->block_count];
+		if (state->process_bytes != container_recursive_write)
+			err = state->process_bytes(cntr, block->buf,
+						   block->size);
+		else
+			err = write_block(state, cntr->fd, block);
+		if (err < 0)
+			break;
+
+		atomic_store_explicit(&state->tail, tail + 1,
+				      memory_order_release);
+		sem_post(&state->empty);
+	}
+
+	if (err < 0) {
+		atomic_store(&state->err, err);
+		// Wake up the PCM thread.
+		sem_post(&state->empty);
+	}
+
+	return NULL;
+}
+
+static int thread_read(struct container_context *cntr, void *buf,
+		       unsigned int byte_count)
+{
+	struct io_thread_state *state = cntr->io_private_data;
+	char *dst = buf;
+	unsigned int consumed = 0;
+	int err;
+
+	update_statistics(state);
+
+	while (consumed < byte_count && !cntr->interrupted) {
+		struct io_block *block;
+		unsigned int tail;
+		unsigned int size;
+
+		tail = atomic_load_explicit(&state->tail, memory_order_relaxed);
+		if (tail == atomic_load_explicit(&state->head,
+						 memory_order_acquire)) {
+			err = atomic_load(&state->err);
+			if (err < 0)
+				return err;
+
+			err = wait_for_semaphore(cntr, &state->filled);
+			if (err < 0)
+				return err;
+			if (err > 0)
+				++state->stall_count;
+			// The semaphore is consumed below.
+			sem_post(&state->filled);
+			continue;
+		}
+
+		block = &state->blocks[tail % state->block_count];
+
+		// Reach EOF.
+		if (block->size == 0) {
+			cntr->eof = true;
+			return 0;
+		}
+
+		size = block->size - state->pos;
+		if (size > byte_count - consumed)
+			size = byte_count - consumed;
+		memcpy(dst + consumed, block->buf + state->pos, size);
+		state->pos += size;
+		consumed += size;
+
+		if (state->pos == block->size) {
+			// Short block means EOF. Keep it to report EOF again.
+			if (block->size < state->bytes_per_block) {
+				block->size = 0;
+				state->pos = 0;
+				continue;
+			}
+
+			// Release the block to I/O thread.
+			sem_trywait(&state->filled);
+			state->pos = 0;
+			atomic_store_explicit(&state->tail, tail + 1,
+					      memory_order_release);
+			sem_post(&state->empty);
+		}
+	}
+
+	return 0;
+}
+
+static int thread_write(struct container_context *cntr, void *buf,
+			unsigned int byte_count)
+{
+	struct io_thread_state *state = cntr->io_private_data;
+	char *src = buf;
+	unsigned int consumed = 0;
+	int err;
+
+	update_statistics(state);
+
+	err = atomic_load(&state->err);
+	if (err < 0)
+		return err;
+
+	while (consumed < byte_count && !cntr->interrupted) {
+		struct io_block *block;
+		unsigned int head;
+		unsigned int size;
+
+		head = atomic_load_explicit(&state->head, memory_order_relaxed);
+
+		// Acquire an empty block at first.
+		if (state->pos == 0) {
+			err = wait_for_semaphore(cntr, &state->empty);
+			if (err < 0)
+				return err;
+			if (err > 0)
+				++state->stall_count;
+
+			err = atomic_load(&state->err);
+			if (err < 0)
+				return err;
+		}
+
+		block = &state->blocks[head % state->block_count];
+
+		size = state->bytes_per_block - state->pos;
+		if (size > byte_count - consumed)
+			size = byte_count - consumed;
+		memcpy(block->buf + state->pos, src + consumed, size);
+		state->pos += size;
+		consumed += size;
+
+		if (state->pos == state->bytes_per_block) {
+			block->size = state->pos;
+			state->pos = 0;
+			atomic_store_explicit(&state->head, head + 1,
+					      memory_order_release);
+			sem_post(&state->filled);
+		}
+	}
+
+	return 0;
+}
+
+static void join_thread(struct io_thread_state *state)
+{
+	if (!state->thread_running)
+		return;
+
+	atomic_store(&state->closing, true);
+	sem_post(&state->filled);
+	sem_post(&state->empty);
+
+	pthread_join(state->thread, NULL);
+	state->thread_running = false;
+}
+
+static int thread_flush(struct container_context *cntr)
+{
+	struct io_thread_state *state = cntr->io_private_data;
+	unsigned int head;
+
+	if (cntr->type == CONTAINER_TYPE_BUILDER) {
+		// Queue the rest of data frames.
+		if (state->pos > 0) {
+			head = atomic_load_explicit(&state->head,
+						    memory_order_relaxed);
+			state->blocks[head % state->block_count].size =
+								state->pos;
+			state->pos = 0;
+			atomic_store_explicit(&state->head, head + 1,
+					      memory_order_release);
+			sem_post(&state->filled);
+		}
+	}
+
+	// The I/O thread of builder finishes after writing all of blocks.
+	join_thread(state);
+
+	if (atomic_load(&state->err) == 0 && state->flush_bytes)
+		atomic_store(&state->err, state->flush_bytes(cntr));
+
+	if (cntr->verbose > 0) {
+		fprintf(stderr, "  thread: high-water mark: %u/%u blocks\n",
+			state->high_water_mark, state->block_count);
+		if (state->sample_count > 0) {
+			fprintf(stderr,
+				"  thread: average fill level: %.2f blocks\n",
+				(double)state->fill_level_sum /
+				state->sample_count);
+		}
+		fprintf(stderr, "  thread: stalls in PCM thread: %u\n",
+			state->stall_count);
+	}
+
+	return atomic_load(&state->err);
+}
+
+static int thread_get_fill(struct container_context *cntr,
+			   unsigned int *level, unsigned int *capacity)
+{
+	struct io_thread_state *state = cntr->io_private_data;
+
+	if (state == NULL)
+		return -ENXIO;
+
+	*level = get_fill_level(state);
+	*capacity = state->block_count;
+
+	return 0;
+}
+
+static void free_blocks(struct io_thread_state *state)
+{
+	int i;
+
+	if (state->blocks) {
+		for (i = 0; i < state->block_count; ++i)
+			free(state->blocks[i].buf);
+		free(state->blocks);
+	}
+	sem_destroy(&state->filled);
+	sem_destroy(&state->empty);
+	free(state);
+}
+
+static void thread_release(struct container_context *cntr)
+{
+	struct io_thread_state *state = cntr->io_private_data;
+	void (*release_io)(struct container_context *cntr);
+
+	if (state == NULL)
+		return;
+
+	join_thread(state);
+	release_io = state->release_io;
+	free_blocks(state);
+
+	cntr->io_private_data = NULL;
+	cntr->get_io_fill = NULL;
+
+	if (release_io)
+		release_io(cntr);
+}
+
+int container_context_enable_thread(struct container_context *cntr,
+				    unsigned int block_count,
+				    unsigned int frames_per_block)
+{
+	struct io_thread_state *state;
+	sigset_t mask;
+	sigset_t old_mask;
+	int i;
+	int err;
+
+	assert(cntr);
+	assert(cntr->bytes_per_sample > 0);
+	assert(cntr->samples_per_frame > 0);
+
+	if (block_count == 0 || frames_per_block == 0)
+		return -EINVAL;
+
+	state = calloc(1, sizeof(*state));
+	if (state == NULL)
+		return -ENOMEM;
+
+	state->bytes_per_block = cntr->bytes_per_sample *
+				 cntr->samples_per_frame * frames_per_block;
+	atomic_init(&state->head, 0);
+	atomic_init(&state->tail, 0);
+	atomic_init(&state->closing, false);
+	atomic_init(&state->err, 0);
+	sem_init(&state->filled, 0, 0);
+	sem_init(&state->empty, 0, block_count);
+
+	state->blocks = calloc(block_count, sizeof(*state->blocks));
+	if (state->blocks == NULL) {
+		err = -ENOMEM;
+		goto error;
+	}
+	state->block_count = block_count;
+
+	for (i = 0; i < block_count; ++i) {
+		state->blocks[i].buf = malloc(state->bytes_per_block);
+		if (state->blocks[i].buf == NULL) {
+			err = -ENOMEM;
+			goto error;
+		}
+	}
+
+	state->process_bytes = cntr->process_bytes;
+	state->flush_bytes = cntr->flush_bytes;
+	state->release_io = cntr->release_io;
+
+	cntr->io_private_data = state;
+
+	// UNIX signals should be delivered to the PCM thread.
+	sigfillset(&mask);
+	pthread_sigmask(SIG_SETMASK, &mask, &old_mask);
+	if (cntr->type == CONTAINER_TYPE_PARSER)
+		err = -pthread_create(&state->thread, NULL, parser_thread, cntr);
+	else
+		err = -pthread_create(&state->thread, NULL, builder_thread, cntr);
+	pthread_sigmask(SIG_SETMASK, &old_mask, NULL);
+	if (err < 0) {
+		cntr->io_private_data = NULL;
+		goto error;
+	}
+	state->thread_running = true;
+
+	cntr->process_bytes = (cntr->type == CONTAINER_TYPE_PARSER) ?
+			      thread_read : thread_write;
+	cntr->flush_bytes = thread_flush;
+	cntr->release_io = thread_release;
+	cntr->get_io_fill = thread_get_fill;
+
+	if (cntr->verbose > 0) {
+		fprintf(stderr, "  thread: %u blocks, %u bytes/block\n",
+			state->block_count, state->bytes_per_block);
+	}
+
+	return 0;
+error:
+	free_blocks(state);
+	return err;
+}
@@ -12,6 +12,11 @@
 // Not portable to all of UNIX platforms.
 #include <endian.h>
 
+#include <stdio.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+
 // References:
 //  - http://sox.sourceforge.net/
 
@@ -303,6 +308,14 @@ static unsigned int parse_time_constant(uint16_t code,
 	return 0;
 }
 
+// An entry of index for data blocks. Data frames in the blocks are handled as
+// one stream.
+struct block_index_entry {
+	uint64_t pos;		// The position in the stream.
+	uint64_t offset;	// The offset of frames in the file.
+	uint64_t size;
+};
+
 struct parser_state {
 	unsigned int version;
 	bool extended;
@@ -312,6 +325,12 @@ struct parser_state {
 	unsigned int bytes_per_sample;
 	enum code_id code_id;
 	uint32_t byte_count;
+
+	// For index of data blocks.
+	struct block_index_entry *entries;
+	unsigned int entry_count;
+	unsigned int current;
+	uint64_t pos;
 };
 
 static int parse_container_header(struct parser_state *state,
@@ -401,6 +420,37 @@ static int parse_extended_v110_format(struct parser_state *state,
 	return 0;
 }
 
+// The time constant of v1.10 data block is obsoleted by the extended format
+// block, while it still expresses the rate of frames, or the rate of samples
+// as the v1.10 format describes.
+static bool check_v110_time_constant(struct parser_state *state,
+				     uint8_t time_const)
+{
+	unsigned int rates[2];
+	unsigned int frames_per_second;
+	uint16_t code;
+	int i;
+
+	if (!state->extended) {
+		if (parse_time_constant(time_const, 1, &frames_per_second,
+					false) < 0)
+			return false;
+		return frames_per_second == state->frames_per_second;
+	}
+
+	rates[0] = state->frames_per_second;
+	rates[1] = state->frames_per_second * state->samples_per_frame;
+	for (i = 0; i < ARRAY_SIZE(rates); ++i) {
+		if (build_time_constant(rates[i], 1, &code, false) < 0)
+			continue;
+		if ((uint8_t)code == time_const ||
+		    (uint8_t)(code - 1) == time_const)
+			return true;
+	}
+
+	return false;
+}
+
 static int parse_v110_data(struct parser_state *state,
 			   struct block_v110_data *block)
 {
@@ -408,7 +458,10 @@ static int parse_v110_data(struct parser_state *state,
 	unsigned int frames_per_second;
 	int err;
 
-	if (!state->extended) {
+	if (state->extended) {
+		if (!check_v110_time_constant(state, block->time_const))
+			return -EIO;
+	} else {
 		state->code_id = block->code_id;
 		if (!check_code_id(state->code_id, VOC_VERSION_1_10))
 			return -EIO;
@@ -553,6 +606,413 @@ again:
 	return 0;
 }
 
+#define INDEX_ENTRY_CHUNK	64
+
+static int add_index_entry(struct parser_state *state, uint64_t offset,
+			   uint64_t size)
+{
+	struct block_index_entry *entry;
+
+	if (size == 0)
+		return 0;
+
+	if (state->entry_count % INDEX_ENTRY_CHUNK == 0) {
+		entry = realloc(state->entries,
+				sizeof(*entry) *
+				(state->entry_count + INDEX_ENTRY_CHUNK));
+		if (entry == NULL)
+			return -ENOMEM;
+		state->entries = entry;
+	}
+
+	entry = state->entries + state->entry_count;
+	if (state->entry_count > 0)
+		entry->pos = entry[-1].pos + entry[-1].size;
+	else
+		entry->pos = 0;
+	entry->offset = offset;
+	entry->size = size;
+	++state->entry_count;
+
+	return 0;
+}
+
+static ssize_t read_at(int fd, void *buf, size_t size, off64_t offset)
+{
+	size_t consumed = 0;
+	ssize_t result;
+
+	while (consumed < size) {
+		result = pread64(fd, (char *)buf + consumed, size - consumed,
+				 offset + consumed);
+		if (result < 0) {
+			if (errno == EINTR || errno == EAGAIN)
+				continue;
+			return -errno;
+		}
+		if (result == 0)
+			break;
+		consumed += result;
+	}
+
+	return consumed;
+}
+
+// The data block is available as a continuation when it has the same format
+// as the first one.
+static int parse_following_data_block(struct parser_state *state, int fd,
+				      struct block_header *header,
+				      off64_t offset, unsigned int *size)
+{
+	union {
+		struct block_v110_data v110_data;
+		struct block_v120_format v120_format;
+	} buf;
+	unsigned int length;
+	ssize_t len;
+
+	if (header->type == BLOCK_TYPE_V110_DATA)
+		length = sizeof(buf.v110_data) - sizeof(*header);
+	else
+		length = sizeof(buf.v120_format) - sizeof(*header);
+
+	len = read_at(fd, (char *)&buf + sizeof(*header), length, offset);
+	if (len < 0)
+		return len;
+	if (len < length || *size < length)
+		return 0;
+
+	if (header->type == BLOCK_TYPE_V110_DATA) {
+		if (state->version != VOC_VERSION_1_10 ||
+		    buf.v110_data.code_id != state->code_id ||
+		    !check_v110_time_constant(state,
+					      buf.v110_data.time_const))
+			return 0;
+	} else {
+		struct block_v120_format *block = &buf.v120_format;
+
+		if (state->version != VOC_VERSION_1_20 ||
+		    le32toh(block->frames_per_second) !=
+					state->frames_per_second ||
+		    block->bits_per_sample != state->bytes_per_sample * 8 ||
+		    block->samples_per_frame != state->samples_per_frame ||
+		    le16toh(block->code_id) != state->code_id)
+			return 0;
+	}
+
+	*size -= length;
+
+	return length;
+}
+
+// Walk headers of the blocks after the first data block without reading data
+// frames. The following data blocks of continuation and the same format are
+// indexed. The other blocks such as silence and repeat are skipped.
+static int scan_data_blocks(struct container_context *cntr, off64_t offset,
+			    off64_t file_size)
+{
+	struct parser_state *state = cntr->private_data;
+	struct block_index_entry *entry;
+	int err;
+
+	err = add_index_entry(state, offset, state->byte_count);
+	if (err < 0)
+		return err;
+	offset += state->byte_count;
+
+	while (offset < file_size) {
+		struct block_header header;
+		unsigned int size;
+		ssize_t len;
+
+		len = read_at(cntr->fd, &header, sizeof(header), offset);
+		if (len < 0)
+			return len;
+		if (len < sizeof(header) ||
+		    header.type == BLOCK_TYPE_TERMINATOR ||
+		    header.type > BLOCK_TYPE_V120_DATA)
+			break;
+		size = parse_block_data_size(header.size);
+		offset += sizeof(header);
+
+		if (header.type == BLOCK_TYPE_CONTINUOUS_DATA) {
+			err = add_index_entry(state, offset, size);
+		} else if (header.type == BLOCK_TYPE_V110_DATA ||
+			   header.type == BLOCK_TYPE_V120_DATA) {
+			unsigned int frame_size = size;
+
+			len = parse_following_data_block(state, cntr->fd,
+							 &header, offset,
+							 &frame_size);
+			if (len <= 0) {
+				err = len;
+				break;
+			}
+			err = add_index_entry(state, offset + len, frame_size);
+		}
+		if (err < 0)
+			return err;
+
+		offset += size;
+	}
+
+	// Truncated file.
+	entry = state->entries + state->entry_count - 1;
+	if (entry->offset + entry->size > file_size)
+		entry->size = file_size - entry->offset;
+
+	return err;
+}
+
+#define INDEX_MAGIC	"AXFVOCIX"
+#define INDEX_VERSION	1
+
+// The sidecar file of index, aligned to little endian.
+struct index_file_header {
+	uint8_t magic[8];
+	uint32_t version;
+	uint32_t entry_count;
+	uint64_t file_size;
+	uint64_t mtime_sec;
+	uint64_t mtime_nsec;
+};
+
+struct index_file_entry {
+	uint64_t offset;
+	uint64_t size;
+};
+
+// Return positive value when loaded.
+static int load_block_index(struct container_context *cntr,
+			    const struct stat *st, off64_t offset)
+{
+	struct parser_state *state = cntr->private_data;
+	struct index_file_header header;
+	struct index_file_entry *entries = NULL;
+	unsigned int entry_count;
+	ssize_t len;
+	int fd;
+	int i;
+	int err = 0;
+
+	fd = open(cntr->index_path, O_RDONLY);
+	if (fd < 0)
+		return 0;
+
+	len = read_at(fd, &header, sizeof(header), 0);
+	if (len != sizeof(header) ||
+	    memcmp(header.magic, INDEX_MAGIC, sizeof(header.magic)) ||
+	    le32toh(header.version) != INDEX_VERSION ||
+	    le64toh(header.file_size) != st->st_size ||
+	    le64toh(header.mtime_sec) != st->st_mtim.tv_sec ||
+	    le64toh(header.mtime_nsec) != st->st_mtim.tv_nsec)
+		goto end;
+
+	entry_count = le32toh(header.entry_count);
+	if (entry_count == 0 ||
+	    entry_count > st->st_size / sizeof(struct block_header))
+		goto end;
+
+	entries = calloc(entry_count, sizeof(*entries));
+	if (entries == NULL) {
+		err = -ENOMEM;
+		goto end;
+	}
+
+	len = read_at(fd, entries, sizeof(*entries) * entry_count,
+		      sizeof(header));
+	if (len != sizeof(*entries) * entry_count)
+		goto end;
+
+	// The first entry should be for the data block just parsed.
+	if (le64toh(entries[0].offset) != offset ||
+	    le64toh(entries[0].size) != state->byte_count)
+		goto end;
+
+	for (i = 0; i < entry_count; ++i) {
+		uint64_t entry_offset = le64toh(entries[i].offset);
+		uint64_t entry_size = le64toh(entries[i].size);
+
+		if (entry_offset + entry_size > st->st_size)
+			break;
+
+		err = add_index_entry(state, entry_offset, entry_size);
+		if (err < 0)
+			break;
+	}
+	if (err >= 0 && i == entry_count)
+		err = 1;
+	else if (err >= 0)
+		state->entry_count = 0;
+end:
+	free(entries);
+	close(fd);
+
+	return err;
+}
+
+static int save_block_index(struct container_context *cntr,
+			    const struct stat *st)
+{
+	struct parser_state *state = cntr->private_data;
+	struct index_file_header header = {0};
+	struct index_file_entry entry;
+	int fd;
+	int i;
+	int err = 0;
+
+	fd = open(cntr->index_path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if (fd < 0)
+		return -errno;
+
+	memcpy(header.magic, INDEX_MAGIC, sizeof(header.magic));
+	header.version = htole32(INDEX_VERSION);
+	header.entry_count = htole32(state->entry_count);
+	header.file_size = htole64(st->st_size);
+	header.mtime_sec = htole64(st->st_mtim.tv_sec);
+	header.mtime_nsec = htole64(st->st_mtim.tv_nsec);
+
+	if (write(fd, &header, sizeof(header)) != sizeof(header))
+		err = -EIO;
+
+	for (i = 0; err >= 0 && i < state->entry_count; ++i) {
+		entry.offset = htole64(state->entries[i].offset);
+		entry.size = htole64(state->entries[i].size);
+		if (write(fd, &entry, sizeof(entry)) != sizeof(entry))
+			err = -EIO;
+	}
+
+	close(fd);
+
+	return err;
+}
+
+// The index is built just for seekable files. Data frames are read from the
+// first data block only for the others.
+static int build_block_index(struct container_context *cntr)
+{
+	struct parser_state *state = cntr->private_data;
+	struct stat st;
+	off64_t offset;
+	bool loaded = false;
+	int err;
+
+	if (cntr->stdio || fstat(cntr->fd, &st) < 0 || !S_ISREG(st.st_mode))
+		return 0;
+
+	offset = lseek64(cntr->fd, 0, SEEK_CUR);
+	if (offset < 0)
+		return -errno;
+
+	if (cntr->index_path) {
+		err = load_block_index(cntr, &st, offset);
+		if (err < 0)
+			return err;
+		loaded = (err > 0);
+	}
+
+	if (!loaded) {
+		err = scan_data_blocks(cntr, offset, st.st_size);
+		if (err < 0)
+			return err;
+
+		if (cntr->index_path) {
+			err = save_block_index(cntr, &st);
+			if (err < 0 && cntr->verbose > 0) {
+				fprintf(stderr,
+					"  block index: fail to save to %s: "
+					"%s\n", cntr->index_path,
+					strerror(-err));
+			}
+		}
+	}
+
+	if (cntr->verbose > 0) {
+		fprintf(stderr, "  block index: %u entries, %s\n",
+			state->entry_count, loaded ? "loaded" : "scanned");
+	}
+
+	return 0;
+}
+
+static int read_indexed_blocks(struct container_context *cntr, void *buf,
+			       unsigned int byte_count)
+{
+	struct parser_state *state = cntr->private_data;
+	char *dst = buf;
+	int err;
+
+	while (byte_count > 0) {
+		struct block_index_entry *entry = state->entries +
+						  state->current;
+		uint64_t end = entry->pos + entry->size;
+		unsigned int size;
+
+		if (state->pos == end) {
+			if (state->current + 1 >= state->entry_count) {
+				cntr->eof = true;
+				return 0;
+			}
+			++state->current;
+			err = container_seek_offset(cntr, entry[1].offset);
+			if (err < 0)
+				return err;
+			continue;
+		}
+
+		size = byte_count;
+		if (size > end - state->pos)
+			size = end - state->pos;
+
+		err = container_recursive_read(cntr, dst, size);
+		if (err < 0)
+			return err;
+		if (cntr->eof || cntr->interrupted)
+			return 0;
+
+		dst += size;
+		byte_count -= size;
+		state->pos += size;
+	}
+
+	return 0;
+}
+
+// The entry including the position is found by binary search.
+static int seek_indexed_blocks(struct container_context *cntr,
+			       uint64_t byte_offset)
+{
+	struct parser_state *state = cntr->private_data;
+	struct block_index_entry *entry;
+	unsigned int low;
+	unsigned int high;
+
+	// Not seekable.
+	if (state->entry_count == 0)
+		return -ESPIPE;
+
+	low = 0;
+	high = state->entry_count;
+	while (high - low > 1) {
+		unsigned int mid = low + (high - low) / 2;
+
+		if (state->entries[mid].pos <= byte_offset)
+			low = mid;
+		else
+			high = mid;
+	}
+
+	entry = state->entries + low;
+	if (byte_offset > entry->pos + entry->size)
+		return -EINVAL;
+
+	state->current = low;
+	state->pos = byte_offset;
+
+	return container_seek_offset(cntr,
+				     entry->offset + byte_offset - entry->pos);
+}
+
 static int voc_parser_pre_process(struct container_context *cntr,
 				  snd_pcm_format_t *format,
 				  unsigned int *samples_per_frame,
@@ -582,12 +1042,36 @@ static int voc_parser_pre_process(struct container_context *cntr,
 	*samples_per_frame = state->samples_per_frame;
 	*frames_per_second = state->frames_per_second;
 
+	err = build_block_index(cntr);
+	if (err < 0)
+		return err;
+
+	// Data frames in the following blocks are read as continuation.
+	if (state->entry_count > 1) {
+		struct block_index_entry *last =
+				state->entries + state->entry_count - 1;
+
+		cntr->process_bytes = read_indexed_blocks;
+		cntr->max_size = last->pos + last->size;
+		*byte_count = cntr->max_size;
+		return 0;
+	}
+
 	// This program handles PCM frames in this data block only.
 	*byte_count = state->byte_count;
 
 	return 0;
 }
 
+static void voc_parser_release(struct container_context *cntr)
+{
+	struct parser_state *state = cntr->private_data;
+
+	free(state->entries);
+	state->entries = NULL;
+	state->entry_count = 0;
+}
+
 struct builder_state {
 	unsigned int version;
 	bool extended;
@@ -819,6 +1303,8 @@ const struct container_parser container_parser_voc = {
 		    sizeof(struct block_terminator),
 	.ops = {
 		.pre_process	= voc_parser_pre_process,
+		.release	= voc_parser_release,
+		.seek		= seek_indexed_blocks,
 	},
 	.private_size = sizeof(struct parser_state),
 };
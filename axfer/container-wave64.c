@@ -0,0 +1,430 @@
+// SPDX-License-Identifier: GPL-2.0
+//
+// container-wave64.c - a parser/builder for a container of Sony Wave64 File.
+//
+// Copyright (c) 2026 agent <agent@local>
+//
+// Licensed under the terms of the GNU General Public License, version 2.
+
+#include "container.h"
+#include "misc.h"
+
+// Not portable to all of UNIX platforms.
+#include <endian.h>
+
+// References:
+// - 'Sony Wave64' specification at sonicfoundry.com (via archive.org)
+// - 'Multiple channel audio data and WAVE files' at msdn.microsoft.com
+
+// The chunks are identified by GUID, then its size is in 64 bit. The size
+// includes the header of chunk. Each chunk is aligned to 8 bytes.
+#define W64_MAGIC		"riff"
+#define W64_CHUNK_ALIGN		8
+
+static const uint8_t riff_guid[16] = {
+	0x72, 0x69, 0x66, 0x66, 0x2e, 0x91, 0xcf, 0x11,
+	0xa5, 0xd6, 0x28, 0xdb, 0x04, 0xc1, 0x00, 0x00,
+};
+static const uint8_t wave_guid[16] = {
+	0x77, 0x61, 0x76, 0x65, 0xf3, 0xac, 0xd3, 0x11,
+	0x8c, 0xd1, 0x00, 0xc0, 0x4f, 0x8e, 0xdb, 0x8a,
+};
+static const uint8_t fmt_guid[16] = {
+	0x66, 0x6d, 0x74, 0x20, 0xf3, 0xac, 0xd3, 0x11,
+	0x8c, 0xd1, 0x00, 0xc0, 0x4f, 0x8e, 0xdb, 0x8a,
+};
+static const uint8_t data_guid[16] = {
+	0x64, 0x61, 0x74, 0x61, 0xf3, 0xac, 0xd3, 0x11,
+	0x8c, 0xd1, 0x00, 0xc0, 0x4f, 0x8e, 0xdb, 0x8a,
+};
+
+enum wave_format {
+	WAVE_FORMAT_PCM			= 0x0001,
+	WAVE_FORMAT_IEEE_FLOAT		= 0x0003,
+	WAVE_FORMAT_ALAW		= 0x0006,
+	WAVE_FORMAT_MULAW		= 0x0007,
+	// The others are not supported.
+};
+
+struct format_map {
+	enum wave_format wformat;
+	snd_pcm_format_t format;
+};
+
+// Wave64 has no variant for big endian.
+static const struct format_map format_maps[] = {
+	{WAVE_FORMAT_PCM,	SND_PCM_FORMAT_U8},
+	{WAVE_FORMAT_PCM,	SND_PCM_FORMAT_S16_LE},
+	{WAVE_FORMAT_PCM,	SND_PCM_FORMAT_S24_LE},
+	{WAVE_FORMAT_PCM,	SND_PCM_FORMAT_S32_LE},
+	{WAVE_FORMAT_PCM,	SND_PCM_FORMAT_S24_3LE},
+	{WAVE_FORMAT_PCM,	SND_PCM_FORMAT_S20_3LE},
+	{WAVE_FORMAT_PCM,	SND_PCM_FORMAT_S18_3LE},
+	{WAVE_FORMAT_IEEE_FLOAT, SND_PCM_FORMAT_FLOAT_LE},
+	{WAVE_FORMAT_IEEE_FLOAT, SND_PCM_FORMAT_FLOAT64_LE},
+	{WAVE_FORMAT_ALAW,	SND_PCM_FORMAT_A_LAW},
+	{WAVE_FORMAT_MULAW,	SND_PCM_FORMAT_MU_LAW},
+};
+
+struct w64_chunk {
+	uint8_t guid[16];
+	uint64_t size;
+
+	uint8_t data[0];
+};
+
+struct w64_chunk_data {
+	uint8_t guid[16];
+
+	uint8_t subchunks[0];
+};
+
+struct w64_fmt_subchunk {
+	uint8_t guid[16];
+	uint64_t size;
+
+	uint16_t format;
+	uint16_t samples_per_frame;
+	uint32_t frames_per_second;
+	uint32_t average_bytes_per_second;
+	uint16_t bytes_per_frame;
+	uint16_t bits_per_sample;
+	uint8_t extension[0];
+};
+
+struct w64_data_subchunk {
+	uint8_t guid[16];
+	uint64_t size;
+
+	uint8_t frames[0];
+};
+
+struct parser_state {
+	enum wave_format format;
+	unsigned int samples_per_frame;
+	unsigned int frames_per_second;
+	unsigned int average_bytes_per_second;
+	unsigned int bytes_per_frame;
+	unsigned int avail_bits_in_sample;
+	uint64_t byte_count;
+};
+
+static int parse_w64_chunk(struct container_context *cntr)
+{
+	union {
+		struct w64_chunk chunk;
+		struct w64_chunk_data chunk_data;
+	} buf = {0};
+	int err;
+
+	// Chunk header. 4 bytes were alread read to detect container type.
+	memcpy(buf.chunk.guid, cntr->magic, sizeof(cntr->magic));
+	err = container_recursive_read(cntr,
+				       (char *)&buf.chunk + sizeof(cntr->magic),
+				       sizeof(buf.chunk) - sizeof(cntr->magic));
+	if (err < 0)
+		return err;
+	if (cntr->eof)
+		return 0;
+
+	if (memcmp(buf.chunk.guid, riff_guid, sizeof(riff_guid)))
+		return -EINVAL;
+
+	// Chunk data header.
+	err = container_recursive_read(cntr, &buf, sizeof(buf.chunk_data));
+	if (err < 0)
+		return err;
+	if (cntr->eof)
+		return 0;
+
+	if (memcmp(buf.chunk_data.guid, wave_guid, sizeof(wave_guid)))
+		return -EINVAL;
+
+	return 0;
+}
+
+static int parse_w64_fmt_subchunk(struct parser_state *state,
+				  struct w64_fmt_subchunk *subchunk)
+{
+	state->format = le16toh(subchunk->format);
+	state->samples_per_frame = le16toh(subchunk->samples_per_frame);
+	state->frames_per_second = le32toh(subchunk->frames_per_second);
+	state->average_bytes_per_second =
+				le32toh(subchunk->average_bytes_per_second);
+	state->bytes_per_frame = le16toh(subchunk->bytes_per_frame);
+	state->avail_bits_in_sample = le16toh(subchunk->bits_per_sample);
+
+	if (state->average_bytes_per_second !=
+			state->bytes_per_frame * state->frames_per_second)
+		return -EINVAL;
+
+	return 0;
+}
+
+static int parse_w64_subchunk(struct container_context *cntr)
+{
+	union {
+		struct w64_chunk subchunk;
+		struct w64_fmt_subchunk fmt_subchunk;
+		struct w64_data_subchunk data_subchunk;
+	} buf = {0};
+	struct parser_state *state = cntr->private_data;
+	uint64_t subchunk_size;
+	uint64_t subchunk_data_size;
+	unsigned int required_size;
+	bool fmt_found = false;
+	int err;
+
+	while (1) {
+		err = container_recursive_read(cntr, &buf,
+					       sizeof(buf.subchunk));
+		if (err < 0)
+			return err;
+		if (cntr->eof)
+			return 0;
+
+		subchunk_size = le64toh(buf.subchunk.size);
+		if (subchunk_size < sizeof(buf.subchunk))
+			return -EINVAL;
+		subchunk_data_size = subchunk_size - sizeof(buf.subchunk);
+
+		// Frame data follows the header of subchunk.
+		if (!memcmp(buf.subchunk.guid, data_guid, sizeof(data_guid))) {
+			if (!fmt_found)
+				return -EINVAL;
+			state->byte_count = subchunk_data_size;
+			break;
+		}
+
+		if (!memcmp(buf.subchunk.guid, fmt_guid, sizeof(fmt_guid))) {
+			required_size = sizeof(struct w64_fmt_subchunk) -
+					sizeof(struct w64_chunk);
+			if (subchunk_data_size < required_size)
+				return -EINVAL;
+
+			err = container_recursive_read(cntr, &buf.subchunk.data,
+						       required_size);
+			if (err < 0)
+				return err;
+			if (cntr->eof)
+				return 0;
+			subchunk_data_size -= required_size;
+
+			err = parse_w64_fmt_subchunk(state, &buf.fmt_subchunk);
+			if (err < 0)
+				return err;
+			fmt_found = true;
+		}
+
+		// Go to next subchunk with padding for alignment.
+		if (subchunk_size % W64_CHUNK_ALIGN > 0) {
+			subchunk_data_size += W64_CHUNK_ALIGN -
+					      subchunk_size % W64_CHUNK_ALIGN;
+		}
+		while (subchunk_data_size > 0) {
+			unsigned int consume;
+
+			if (subchunk_data_size > sizeof(buf))
+				consume = sizeof(buf);
+			else
+				consume = subchunk_data_size;
+
+			err = container_recursive_read(cntr, &buf, consume);
+			if (err < 0)
+				return err;
+			if (cntr->eof)
+				return 0;
+			subchunk_data_size -= consume;
+		}
+	}
+
+	return 0;
+}
+
+static int w64_parser_pre_process(struct container_context *cntr,
+				  snd_pcm_format_t *format,
+				  unsigned int *samples_per_frame,
+				  unsigned int *frames_per_second,
+				  uint64_t *byte_count)
+{
+	struct parser_state *state = cntr->private_data;
+	int phys_width;
+	const struct format_map *map;
+	int i;
+	int err;
+
+	err = parse_w64_chunk(cntr);
+	if (err < 0)
+		return err;
+
+	err = parse_w64_subchunk(cntr);
+	if (err < 0)
+		return err;
+
+	phys_width = 8 * state->average_bytes_per_second /
+		     state->samples_per_frame / state->frames_per_second;
+
+	for (i = 0; i < ARRAY_SIZE(format_maps); ++i) {
+		map = &format_maps[i];
+		if (state->format != map->wformat)
+			continue;
+		if (state->avail_bits_in_sample !=
+					snd_pcm_format_width(map->format))
+			continue;
+		if (phys_width != snd_pcm_format_physical_width(map->format))
+			continue;
+
+		break;
+	}
+	if (i == ARRAY_SIZE(format_maps))
+		return -EINVAL;
+
+	// Set parameters.
+	*format = format_maps[i].format;
+	*samples_per_frame = state->samples_per_frame;
+	*frames_per_second = state->frames_per_second;
+	*byte_count = state->byte_count;
+
+	return 0;
+}
+
+struct builder_state {
+	enum wave_format format;
+	unsigned int avail_bits_in_sample;
+	unsigned int bytes_per_sample;
+	unsigned int samples_per_frame;
+	unsigned int frames_per_second;
+};
+
+static void build_w64_chunk_header(struct w64_chunk *chunk,
+				   const uint8_t *guid, uint64_t size)
+{
+	memcpy(chunk->guid, guid, sizeof(chunk->guid));
+	chunk->size = htole64(size);
+}
+
+static void build_w64_fmt_subchunk(struct w64_fmt_subchunk *subchunk,
+				   struct builder_state *state)
+{
+	unsigned int bytes_per_frame =
+			state->bytes_per_sample * state->samples_per_frame;
+	unsigned int average_bytes_per_second = state->bytes_per_sample *
+			state->samples_per_frame * state->frames_per_second;
+
+	// No extensions. The size is already aligned to 8 bytes.
+	build_w64_chunk_header((struct w64_chunk *)subchunk, fmt_guid,
+			       sizeof(struct w64_fmt_subchunk));
+
+	subchunk->format = htole16(state->format);
+	subchunk->samples_per_frame = htole16(state->samples_per_frame);
+	subchunk->frames_per_second = htole32(state->frames_per_second);
+	subchunk->average_bytes_per_second = htole32(average_bytes_per_second);
+	subchunk->bytes_per_frame = htole16(bytes_per_frame);
+	subchunk->bits_per_sample = htole16(state->avail_bits_in_sample);
+}
+
+static int write_w64_chunk(struct container_context *cntr, uint64_t byte_count)
+{
+	struct builder_state *state = cntr->private_data;
+	union {
+		struct w64_chunk chunk;
+		struct w64_chunk_data chunk_data;
+		struct w64_fmt_subchunk fmt_subchunk;
+		struct w64_data_subchunk data_subchunk;
+	} buf = {0};
+	uint64_t total_byte_count;
+	int err;
+
+	// Chunk header. The data subchunk is the last one, thus no padding.
+	total_byte_count = sizeof(struct w64_chunk) +
+			   sizeof(struct w64_chunk_data) +
+			   sizeof(struct w64_fmt_subchunk) +
+			   sizeof(struct w64_data_subchunk);
+	total_byte_count += byte_count;
+	build_w64_chunk_header(&buf.chunk, riff_guid, total_byte_count);
+	err = container_recursive_write(cntr, &buf, sizeof(buf.chunk));
+	if (err < 0)
+		return err;
+
+	// Chunk data header.
+	memcpy(buf.chunk_data.guid, wave_guid, sizeof(buf.chunk_data.guid));
+	err = container_recursive_write(cntr, &buf, sizeof(buf.chunk_data));
+	if (err < 0)
+		return err;
+
+	build_w64_fmt_subchunk(&buf.fmt_subchunk, state);
+	err = container_recursive_write(cntr, &buf, sizeof(buf.fmt_subchunk));
+	if (err < 0)
+		return err;
+
+	build_w64_chunk_header((struct w64_chunk *)&buf.data_subchunk,
+			       data_guid,
+			       sizeof(struct w64_data_subchunk) + byte_count);
+	return container_recursive_write(cntr, &buf, sizeof(buf.data_subchunk));
+}
+
+static int w64_builder_pre_process(struct container_context *cntr,
+				   snd_pcm_format_t *format,
+				   unsigned int *samples_per_frame,
+				   unsigned int *frames_per_second,
+				   uint64_t *byte_count)
+{
+	struct builder_state *state = cntr->private_data;
+	int i;
+
+	// Validate parameters.
+	for (i = 0; i < ARRAY_SIZE(format_maps); ++i) {
+		if (format_maps[i].format == *format)
+			break;
+	}
+	if (i == ARRAY_SIZE(format_maps))
+		return -EINVAL;
+
+	state->format = format_maps[i].wformat;
+	state->avail_bits_in_sample = snd_pcm_format_width(*format);
+	state->bytes_per_sample = snd_pcm_format_physical_width(*format) / 8;
+	state->samples_per_frame = *samples_per_frame;
+	state->frames_per_second = *frames_per_second;
+
+	return write_w64_chunk(cntr, *byte_count);
+}
+
+static int w64_builder_post_process(struct container_context *cntr,
+				    uint64_t handled_byte_count)
+{
+	int err;
+
+	err = container_seek_offset(cntr, 0);
+	if (err < 0)
+		return err;
+
+	return write_w64_chunk(cntr, handled_byte_count);
+}
+
+const struct container_parser container_parser_w64 = {
+	.format = CONTAINER_FORMAT_W64,
+	.magic = W64_MAGIC,
+	.max_size = UINT64_MAX -
+		    sizeof(struct w64_chunk) -
+		    sizeof(struct w64_chunk_data) -
+		    sizeof(struct w64_fmt_subchunk) -
+		    sizeof(struct w64_data_subchunk),
+	.ops = {
+		.pre_process	= w64_parser_pre_process,
+	},
+	.private_size = sizeof(struct parser_state),
+};
+
+const struct container_builder container_builder_w64 = {
+	.format = CONTAINER_FORMAT_W64,
+	.max_size = UINT64_MAX -
+		    sizeof(struct w64_chunk) -
+		    sizeof(struct w64_chunk_data) -
+		    sizeof(struct w64_fmt_subchunk) -
+		    sizeof(struct w64_data_subchunk),
+	.ops = {
+		.pre_process	= w64_builder_pre_process,
+		.post_process	= w64_builder_post_process,
+	},
+	.private_size = sizeof(struct builder_state),
+};
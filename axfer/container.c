@@ -14,6 +14,7 @@
 #include <string.h>
 #include <fcntl.h>
 #include <inttypes.h>
+#include <sys/stat.h>
 
 static const char *const cntr_type_labels[] = {
 	[CONTAINER_TYPE_PARSER] = "parser",
@@ -24,14 +25,24 @@ static const char *const cntr_format_labels[] = {
 	[CONTAINER_FORMAT_RIFF_WAVE] = "riff/wave",
 	[CONTAINER_FORMAT_AU] = "au",
 	[CONTAINER_FORMAT_VOC] = "voc",
+	[CONTAINER_FORMAT_RF64] = "rf64",
+	[CONTAINER_FORMAT_W64] = "wave64",
 	[CONTAINER_FORMAT_RAW] = "raw",
+#if WITH_FLAC
+	[CONTAINER_FORMAT_FLAC] = "flac",
+#endif
 };
 
 static const char *const suffixes[] = {
 	[CONTAINER_FORMAT_RIFF_WAVE]	= ".wav",
 	[CONTAINER_FORMAT_AU]		= ".au",
 	[CONTAINER_FORMAT_VOC]		= ".voc",
+	[CONTAINER_FORMAT_RF64]		= ".wav",
+	[CONTAINER_FORMAT_W64]		= ".w64",
 	[CONTAINER_FORMAT_RAW]		= "",
+#if WITH_FLAC
+	[CONTAINER_FORMAT_FLAC]		= ".flac",
+#endif
 };
 
 const char *const container_suffix_from_format(enum container_format format)
@@ -103,6 +114,10 @@ enum container_format container_format_from_path(const char *path)
 	for (i = 0; i < ARRAY_SIZE(suffixes); ++i) {
 		suffix = suffixes[i];
 
+		// Raw container is the fallback.
+		if (suffix[0] == '\0')
+			continue;
+
 		// Check last part of the string.
 		pos = path + strlen(path) - strlen(suffix);
 		if (!strcmp(pos, suffix))
@@ -150,6 +165,8 @@ int container_parser_init(struct container_context *cntr, int fd,
 		[CONTAINER_FORMAT_RIFF_WAVE] = &container_parser_riff_wave,
 		[CONTAINER_FORMAT_AU] = &container_parser_au,
 		[CONTAINER_FORMAT_VOC] = &container_parser_voc,
+		[CONTAINER_FORMAT_RF64] = &container_parser_rf64,
+		[CONTAINER_FORMAT_W64] = &container_parser_w64,
 	};
 	const struct container_parser *parser;
 	unsigned int size;
@@ -228,7 +245,12 @@ int container_builder_init(struct container_context *cntr, int fd,
 		[CONTAINER_FORMAT_RIFF_WAVE] = &container_builder_riff_wave,
 		[CONTAINER_FORMAT_AU] = &container_builder_au,
 		[CONTAINER_FORMAT_VOC] = &container_builder_voc,
+		[CONTAINER_FORMAT_RF64] = &container_builder_rf64,
+		[CONTAINER_FORMAT_W64] = &container_builder_w64,
 		[CONTAINER_FORMAT_RAW] = &container_builder_raw,
+#if WITH_FLAC
+		[CONTAINER_FORMAT_FLAC] = &container_builder_flac,
+#endif
 	};
 	const struct container_builder *builder;
 	int err;
@@ -279,6 +301,118 @@ int container_builder_init(struct container_context *cntr, int fd,
 	return 0;
 }
 
+// The parser of some containers maintains index of data blocks in the file
+// with the given path to save time to scan the file next time.
+int container_parser_set_index_path(struct container_context *cntr,
+				    const char *path)
+{
+	assert(cntr);
+	assert(path);
+
+	if (cntr->type != CONTAINER_TYPE_PARSER)
+		return -EINVAL;
+
+	free(cntr->index_path);
+	cntr->index_path = strdup(path);
+	if (cntr->index_path == NULL)
+		return -ENOMEM;
+
+	return 0;
+}
+
+// The position is given by either the number of frames or time in
+// microseconds. The latter is converted by the rate in the container.
+int container_parser_set_start_position(struct container_context *cntr,
+					uint64_t frame, uint64_t usec)
+{
+	assert(cntr);
+
+	if (cntr->type != CONTAINER_TYPE_PARSER)
+		return -EINVAL;
+	if (frame > 0 && usec > 0)
+		return -EINVAL;
+
+	cntr->start_frame = frame;
+	cntr->start_usec = usec;
+
+	return 0;
+}
+
+// For the files not seekable, data frames are read and discarded.
+static int discard_bytes(struct container_context *cntr, uint64_t byte_count)
+{
+	char buf[4096];
+
+	// The magic bytes of raw container are a part of data frames.
+	if (cntr->format == CONTAINER_FORMAT_RAW && !cntr->magic_handled) {
+		unsigned int size = sizeof(cntr->magic);
+		int err;
+
+		if (byte_count >= size) {
+			cntr->magic_handled = true;
+			byte_count -= size;
+		} else {
+			memmove(cntr->magic, cntr->magic + byte_count,
+				size - byte_count);
+			err = container_recursive_read(cntr,
+					cntr->magic + size - byte_count,
+					byte_count);
+			if (err < 0)
+				return err;
+			if (cntr->eof)
+				return -EINVAL;
+			byte_count = 0;
+		}
+	}
+
+	while (byte_count > 0) {
+		unsigned int size = sizeof(buf);
+		int err;
+
+		if (size > byte_count)
+			size = byte_count;
+		err = container_recursive_read(cntr, buf, size);
+		if (err < 0)
+			return err;
+		if (cntr->eof || cntr->interrupted)
+			return -EINTR;
+		byte_count -= size;
+	}
+
+	return 0;
+}
+
+static int seek_start_position(struct container_context *cntr,
+			       uint64_t byte_offset)
+{
+	struct stat st;
+	off64_t offset;
+	int err;
+
+	// The parser with index of data blocks.
+	if (cntr->ops->seek) {
+		err = cntr->ops->seek(cntr, byte_offset);
+		if (err != -ESPIPE)
+			return err;
+	} else if (cntr->process_bytes != container_recursive_read) {
+		return -ENXIO;
+	}
+
+	if (cntr->stdio || fstat(cntr->fd, &st) < 0 || !S_ISREG(st.st_mode))
+		return discard_bytes(cntr, byte_offset);
+
+	// Data frames in the container follows the header.
+	offset = lseek64(cntr->fd, 0, SEEK_CUR);
+	if (offset < 0)
+		return -errno;
+	if (cntr->format == CONTAINER_FORMAT_RAW && !cntr->magic_handled) {
+		offset -= sizeof(cntr->magic);
+		cntr->magic_handled = true;
+	}
+
+	return container_seek_offset(cntr, offset + byte_offset);
+}
+
 int container_context_pre_process(struct container_context *cntr,
 				  snd_pcm_format_t *format,
 				  unsigned int *samples_per_frame,
@@ -329,7 +463,7 @@ int container_context_pre_process(struct container_context *cntr,
 
 	bytes_per_frame = cntr->bytes_per_sample * *samples_per_frame;
 	*frame_count = byte_count / bytes_per_frame;
-	cntr->max_size -= cntr->max_size / bytes_per_frame;
+	cntr->max_size -= cntr->max_size % bytes_per_frame;
 
 	if (cntr->verbose > 0) {
 		fprintf(stderr, "Container: %s\n",
@@ -353,6 +487,35 @@ int container_context_pre_process(struct container_context *cntr,
 		}
 	}
 
+	if (cntr->type == CONTAINER_TYPE_PARSER &&
+	    (cntr->start_frame > 0 || cntr->start_usec > 0)) {
+		uint64_t start_frame = cntr->start_frame;
+
+		if (start_frame == 0) {
+			start_frame = cntr->start_usec * *frames_per_second /
+				      1000000;
+		}
+		if (start_frame >= *frame_count) {
+			fprintf(stderr,
+				"The start position is beyond the end of "
+				"data frames: %" PRIu64 " frames.\n",
+				*frame_count);
+			return -EINVAL;
+		}
+
+		err = seek_start_position(cntr, start_frame * bytes_per_frame);
+		if (err < 0)
+			return err;
+
+		*frame_count -= start_frame;
+		cntr->max_size -= start_frame * bytes_per_frame;
+
+		if (cntr->verbose > 0) {
+			fprintf(stderr, "  Start frame: %" PRIu64 "\n",
+				start_frame);
+		}
+	}
+
 	return 0;
 }
 
@@ -386,6 +549,14 @@ int container_context_process_frames(struct container_context *cntr,
 		cntr->magic_handled = true;
 	}
 
+	// Runs of silence are not written.
+	if (cntr->silence_private_data) {
+		err = container_silence_process(cntr, buf, *frame_count);
+		if (err < 0)
+			*frame_count = 0;
+		return err;
+	}
+
 	// Each container has limitation for its volume for sample data.
 	if (cntr->handled_byte_count > cntr->max_size - byte_count)
 		byte_count = cntr->max_size - cntr->handled_byte_count;
@@ -407,6 +578,132 @@ int container_context_process_frames(struct container_context *cntr,
 	return 0;
 }
 
+int container_context_preallocate(struct container_context *cntr,
+				  uint64_t frame_count)
+{
+	uint64_t byte_count;
+	off64_t offset;
+
+	assert(cntr);
+
+	if (cntr->type != CONTAINER_TYPE_BUILDER || cntr->stdio)
+		return 0;
+	if (cntr->bytes_per_sample == 0 || cntr->samples_per_frame == 0)
+		return -EINVAL;
+
+	byte_count = frame_count * cntr->bytes_per_sample *
+		     cntr->samples_per_frame;
+	if (byte_count > cntr->max_size)
+		byte_count = cntr->max_size;
+
+	offset = lseek64(cntr->fd, 0, SEEK_CUR);
+	if (offset < 0)
+		return -errno;
+
+	// The size of file is not changed so that the file is valid even if
+	// the transmission is interrupted.
+	if (fallocate64(cntr->fd, FALLOC_FL_KEEP_SIZE, offset, byte_count) < 0)
+		return -errno;
+
+	if (cntr->verbose > 0) {
+		fprintf(stderr, "  Preallocated bytes: %" PRIu64 "\n",
+			byte_count);
+	}
+
+	return 0;
+}
+
+// Data frames in the existing file are kept, then the new data frames are
+// appended. The header is already rewritten by builder.
+int container_context_resume(struct container_context *cntr,
+			     uint64_t frame_count)
+{
+	uint64_t byte_count;
+	off64_t offset;
+	int err;
+
+	assert(cntr);
+	assert(cntr->bytes_per_sample > 0);
+	assert(cntr->samples_per_frame > 0);
+
+	if (cntr->type != CONTAINER_TYPE_BUILDER || cntr->stdio)
+		return -EINVAL;
+
+	byte_count = frame_count * cntr->bytes_per_sample *
+		     cntr->samples_per_frame;
+	if (byte_count > cntr->max_size)
+		return -EFBIG;
+
+	offset = lseek64(cntr->fd, 0, SEEK_CUR);
+	if (offset < 0)
+		return -errno;
+	offset += byte_count;
+
+	// Discard incomplete frame at the end.
+	if (ftruncate(cntr->fd, offset) < 0)
+		return -errno;
+	err = container_seek_offset(cntr, offset);
+	if (err < 0)
+		return err;
+
+	cntr->handled_byte_count = byte_count;
+
+	if (cntr->verbose > 0) {
+		fprintf(stderr, "  Resumed frames: %" PRIu64 "\n",
+			frame_count);
+	}
+
+	return 0;
+}
+
+// The header is rewritten with the current size so that the file is valid
+// even if this program is killed. Available for the default I/O only since
+// data frames are queued in the other backends.
+int container_context_checkpoint(struct container_context *cntr)
+{
+	off64_t offset;
+	int err;
+
+	assert(cntr);
+
+	if (cntr->type != CONTAINER_TYPE_BUILDER)
+		return -EINVAL;
+	if (cntr->process_bytes != container_recursive_write)
+		return -ENXIO;
+
+	if (cntr->stdio || cntr->ops == NULL || cntr->ops->post_process == NULL)
+		return 0;
+
+	offset = lseek64(cntr->fd, 0, SEEK_CUR);
+	if (offset < 0)
+		return -errno;
+
+	// Data frames should reach storage before the header.
+	if (fdatasync(cntr->fd) < 0)
+		return -errno;
+
+	err = cntr->ops->post_process(cntr, cntr->handled_byte_count);
+	if (err < 0)
+		return err;
+
+	return container_seek_offset(cntr, offset);
+}
+
+// For instrumentation in the middle of transmission. The backend tells it
+// without locking.
+int container_context_get_io_fill(struct container_context *cntr,
+				  unsigned int *level, unsigned int *capacity)
+{
+	assert(cntr);
+	assert(level);
+	assert(capacity);
+
+	if (cntr->get_io_fill == NULL)
+		return -ENXIO;
+
+	return cntr->get_io_fill(cntr, level, capacity);
+}
+
 int container_context_post_process(struct container_context *cntr,
 				   uint64_t *frame_count)
 {
@@ -420,8 +717,17 @@ int container_context_post_process(struct container_context *cntr,
 			cntr->handled_byte_count);
 	}
 
+	// Queued data frames should be handled before the header.
+	if (cntr->flush_bytes) {
+		cntr->interrupted = false;
+		err = cntr->flush_bytes(cntr);
+	}
+
+	if (err >= 0 && cntr->silence_private_data)
+		err = container_silence_flush(cntr);
+
 	// NOTE* we cannot seek when using standard input/output.
-	if (!cntr->stdio && cntr->ops && cntr->ops->post_process) {
+	if (err >= 0 && !cntr->stdio && cntr->ops && cntr->ops->post_process) {
 		// Usually, need to write out processed bytes in container
 		// header even it this program is interrupted.
 		cntr->interrupted = false;
@@ -451,9 +757,23 @@ void container_context_destroy(struct container_context *cntr)
 {
 	assert(cntr);
 
+	if (cntr->release_io)
+		cntr->release_io(cntr);
+	cntr->release_io = NULL;
+	cntr->flush_bytes = NULL;
+	cntr->get_io_fill = NULL;
+
+	if (cntr->ops && cntr->ops->release && cntr->private_data)
+		cntr->ops->release(cntr);
+
 	if (cntr->private_data)
 		free(cntr->private_data);
 
+	free(cntr->index_path);
+
+	container_silence_release(cntr);
+
 	cntr->fd = 0;
 	cntr->private_data = NULL;
+	cntr->index_path = NULL;
 }
@@ -17,6 +17,8 @@
 
 #include <alsa/asoundlib.h>
 
+#include "aconfig.h"
+
 enum container_type {
 	CONTAINER_TYPE_PARSER = 0,
 	CONTAINER_TYPE_BUILDER,
@@ -27,10 +29,37 @@ enum container_format {
 	CONTAINER_FORMAT_RIFF_WAVE = 0,
 	CONTAINER_FORMAT_AU,
 	CONTAINER_FORMAT_VOC,
+	CONTAINER_FORMAT_RF64,
+	CONTAINER_FORMAT_W64,
 	CONTAINER_FORMAT_RAW,
+#if WITH_FLAC
+	CONTAINER_FORMAT_FLAC,
+#endif
 	CONTAINER_FORMAT_COUNT,
 };
 
+enum container_io_type {
+	CONTAINER_IO_TYPE_DEFAULT = 0,
+	CONTAINER_IO_TYPE_IO_URING,
+	CONTAINER_IO_TYPE_MMAP,
+	CONTAINER_IO_TYPE_THREAD,
+	CONTAINER_IO_TYPE_DIRECT,
+	CONTAINER_IO_TYPE_SPLICE,
+	CONTAINER_IO_TYPE_COUNT,
+};
+
+enum container_silence_mode {
+	CONTAINER_SILENCE_MODE_SKIP = 0,
+	CONTAINER_SILENCE_MODE_SPLIT,
+	CONTAINER_SILENCE_MODE_COUNT,
+};
+
+// A run of silence skipped by builder. The offset is in written frames.
+struct container_gap {
+	uint64_t frame_offset;
+	uint64_t frame_count;
+};
+
 struct container_ops;
 
 struct container_context {
@@ -38,6 +67,13 @@ struct container_context {
 	int fd;
 	int (*process_bytes)(struct container_context *cntr,
 			     void *buffer, unsigned int byte_count);
+	// For optional backend of I/O for data frames.
+	int (*flush_bytes)(struct container_context *cntr);
+	void (*release_io)(struct container_context *cntr);
+	// Optional, to tell fill level of queue in the backend.
+	int (*get_io_fill)(struct container_context *cntr, unsigned int *level,
+			   unsigned int *capacity);
+	void *io_private_data;
 	bool magic_handled;
 	bool eof;
 	bool interrupted;
@@ -56,6 +92,16 @@ struct container_context {
 
 	unsigned int verbose;
 	uint64_t handled_byte_count;
+
+	// For parsers to persist index of data blocks.
+	char *index_path;
+
+	// For parsers to start at the position.
+	uint64_t start_frame;
+	uint64_t start_usec;
+
+	// For builders to detect runs of silence.
+	void *silence_private_data;
 };
 
 const char *const container_suffix_from_format(enum container_format format);
@@ -64,6 +110,10 @@ int container_parser_init(struct container_context *cntr, int fd,
 			  unsigned int verbose);
 int container_builder_init(struct container_context *cntr, int fd,
 			   enum container_format format, unsigned int verbose);
+int container_parser_set_index_path(struct container_context *cntr,
+				    const char *path);
+int container_parser_set_start_position(struct container_context *cntr,
+					uint64_t frame, uint64_t usec);
 void container_context_destroy(struct container_context *cntr);
 int container_context_pre_process(struct container_context *cntr,
 				  snd_pcm_format_t *format,
@@ -76,6 +126,41 @@ int container_context_process_frames(struct container_context *cntr,
 int container_context_post_process(struct container_context *cntr,
 				   uint64_t *frame_count);
 
+int container_context_enable_io_uring(struct container_context *cntr,
+				      unsigned int slot_count,
+				      unsigned int frames_per_slot);
+int container_context_enable_mmap(struct container_context *cntr);
+int container_context_enable_thread(struct container_context *cntr,
+				    unsigned int block_count,
+				    unsigned int frames_per_block);
+int container_context_enable_direct(struct container_context *cntr,
+				    unsigned int frames_per_block);
+int container_context_enable_splice(struct container_context *cntr);
+int container_context_preallocate(struct container_context *cntr,
+				  uint64_t frame_count);
+int container_context_resume(struct container_context *cntr,
+			     uint64_t frame_count);
+int container_context_checkpoint(struct container_context *cntr);
+int container_context_get_io_fill(struct container_context *cntr,
+				  unsigned int *level, unsigned int *capacity);
+int container_context_enable_silence(struct container_context *cntr,
+			snd_pcm_format_t format, double threshold_db,
+			unsigned int duration_msec,
+			enum container_silence_mode mode,
+			int (*open_next)(struct container_context *cntr,
+					 void *private_data, int *fd),
+			void *private_data);
+int container_context_enable_recorder(struct container_context *cntr,
+			snd_pcm_format_t format,
+			enum container_format dump_format,
+			unsigned int pre_roll_msec,
+			unsigned int post_roll_msec,
+			int (*open_dump)(struct container_context *cntr,
+					 void *private_data, unsigned int index,
+					 int *fd),
+			void *private_data);
+void container_context_trigger_recorder(struct container_context *cntr);
+
 // For internal use in 'container' module.
 
 struct container_ops {
@@ -86,6 +171,8 @@ struct container_ops {
 			   uint64_t *byte_count);
 	int (*post_process)(struct container_context *cntr,
 			    uint64_t handled_byte_count);
+	void (*release)(struct container_context *cntr);
+	int (*seek)(struct container_context *cntr, uint64_t byte_offset);
 };
 struct container_parser {
 	enum container_format format;
@@ -109,9 +196,22 @@ int container_recursive_write(struct container_context *cntr, void *buf,
 			      unsigned int byte_count);
 int container_seek_offset(struct container_context *cntr, off64_t offset);
 
+int container_silence_process(struct container_context *cntr, char *buf,
+			      unsigned int frame_count);
+int container_silence_flush(struct container_context *cntr);
+unsigned int container_silence_get_gaps(struct container_context *cntr,
+					const struct container_gap **gaps);
+void container_silence_release(struct container_context *cntr);
+
 extern const struct container_parser container_parser_riff_wave;
 extern const struct container_builder container_builder_riff_wave;
 
+extern const struct container_parser container_parser_rf64;
+extern const struct container_builder container_builder_rf64;
+
+extern const struct container_parser container_parser_w64;
+extern const struct container_builder container_builder_w64;
+
 extern const struct container_parser container_parser_au;
 extern const struct container_builder container_builder_au;
 
@@ -121,4 +221,8 @@ extern const struct container_builder container_builder_voc;
 extern const struct container_parser container_parser_raw;
 extern const struct container_builder container_builder_raw;
 
+#if WITH_FLAC
+extern const struct container_builder container_builder_flac;
+#endif
+
 #endif
@@ -8,41 +8,57 @@
 
 #include "frame-cache.h"
 
-static void align_frames_in_i(struct frame_cache *cache,
-			      unsigned int consumed_count)
+static void *get_view(struct frame_cache *cache, void *view,
+		      unsigned int frame_offset)
 {
-	char *buf = cache->buf;
-	unsigned int offset;
-	unsigned int size;
+	if (cache->access == SND_PCM_ACCESS_RW_INTERLEAVED) {
+		char *buf = cache->buf;
 
-	cache->remained_count -= consumed_count;
+		return buf + cache->bytes_per_sample *
+			     cache->samples_per_frame * frame_offset;
+	} else {
+		char **bufs = cache->buf;
+		char **ptrs = view;
+		int i;
+
+		for (i = 0; i < cache->samples_per_frame; ++i)
+			ptrs[i] = bufs[i] + cache->bytes_per_sample *
+					    frame_offset;
+		return ptrs;
+	}
+}
+
+// Return the oldest frames. The count of frames may be less than the count of
+// cached frames when the frames wrap around the end of cache.
+void *frame_cache_get_head(struct frame_cache *cache,
+			   unsigned int *frame_count)
+{
+	unsigned int count = cache->frames_per_cache - cache->head;
 
-	offset = cache->bytes_per_sample * cache->samples_per_frame *
-		 consumed_count;
-	size = cache->bytes_per_sample * cache->samples_per_frame *
-	       cache->remained_count;
-	memmove(buf, buf + offset, size);
+	if (count > cache->remained_count)
+		count = cache->remained_count;
+	*frame_count = count;
 
-	cache->buf_ptr = buf + size;
+	return get_view(cache, cache->head_ptr, cache->head);
 }
 
-static void align_frames_in_n(struct frame_cache *cache,
-			      unsigned int consumed_count)
+// Return the space for new frames. The count of frames may be less than the
+// count of available space when the space wraps around the end of cache.
+void *frame_cache_get_tail(struct frame_cache *cache,
+			   unsigned int *frame_count)
 {
-	char **bufs = cache->buf;
-	char **buf_ptrs = cache->buf_ptr;
-	unsigned int offset;
-	unsigned int size;
-	int i;
-
-	cache->remained_count -= consumed_count;
-
-	for (i = 0; i < cache->samples_per_frame; ++i) {
-		offset = cache->bytes_per_sample * consumed_count;
-		size = cache->bytes_per_sample * cache->remained_count;
-		memmove(bufs[i], bufs[i] + offset, size);
-		buf_ptrs[i] = bufs[i] + size;
+	unsigned int tail = cache->head + cache->remained_count;
+	unsigned int count;
+
+	if (tail < cache->frames_per_cache) {
+		count = cache->frames_per_cache - tail;
+	} else {
+		tail -= cache->frames_per_cache;
+		count = cache->head - tail;
 	}
+	*frame_count = count;
+
+	return get_view(cache, cache->tail_ptr, tail);
 }
 
 int frame_cache_init(struct frame_cache *cache, snd_pcm_access_t access,
@@ -50,43 +66,49 @@ int frame_cache_init(struct frame_cache *cache, snd_pcm_access_t access,
 		     unsigned int samples_per_frame,
 		     unsigned int frames_per_cache)
 {
+	if (access != SND_PCM_ACCESS_RW_INTERLEAVED &&
+	    access != SND_PCM_ACCESS_RW_NONINTERLEAVED)
+		return -EINVAL;
+
 	cache->access = access;
+	cache->head = 0;
 	cache->remained_count = 0;
 	cache->bytes_per_sample = bytes_per_sample;
 	cache->samples_per_frame = samples_per_frame;
 	cache->frames_per_cache = frames_per_cache;
 
-	if (access == SND_PCM_ACCESS_RW_INTERLEAVED)
-		cache->align_frames = align_frames_in_i;
-	else if (access == SND_PCM_ACCESS_RW_NONINTERLEAVED)
-		cache->align_frames = align_frames_in_n;
-	else
-		return -EINVAL;
-
 	if (access == SND_PCM_ACCESS_RW_INTERLEAVED) {
 		char *buf;
 
-		buf = calloc(frames_per_cache,
-			     bytes_per_sample * samples_per_frame);
+		buf = page_buffer_alloc((size_t)frames_per_cache *
+					bytes_per_sample * samples_per_frame,
+					&cache->mode);
 		if (buf == NULL)
 			goto nomem;
 		cache->buf = buf;
-		cache->buf_ptr = buf;
 	} else {
 		char **bufs = calloc(samples_per_frame, sizeof(*bufs));
-		char **buf_ptrs = calloc(samples_per_frame, sizeof(*buf_ptrs));
+		char **head_ptrs = calloc(samples_per_frame, sizeof(*head_ptrs));
+		char **tail_ptrs = calloc(samples_per_frame, sizeof(*tail_ptrs));
+		size_t bytes_per_channel;
+		char *buf;
 		int i;
 
 		cache->buf = bufs;
-		cache->buf_ptr = buf_ptrs;
-		if (bufs == NULL || buf_ptrs == NULL)
+		cache->head_ptr = head_ptrs;
+		cache->tail_ptr = tail_ptrs;
+		if (bufs == NULL || head_ptrs == NULL || tail_ptrs == NULL)
 			goto nomem;
-		for (i = 0; i < samples_per_frame; ++i) {
-			bufs[i] = calloc(frames_per_cache, bytes_per_sample);
-			if (bufs[i] == NULL)
-				goto nomem;
-			buf_ptrs[i] = bufs[i];
-		}
+
+		// Frames for all of channels are in one buffer to reduce the
+		// number of pages.
+		bytes_per_channel = (size_t)frames_per_cache * bytes_per_sample;
+		buf = page_buffer_alloc(bytes_per_channel * samples_per_frame,
+					&cache->mode);
+		if (buf == NULL)
+			goto nomem;
+		for (i = 0; i < samples_per_frame; ++i)
+			bufs[i] = buf + bytes_per_channel * i;
 	}
 
 
@@ -101,13 +123,13 @@ void frame_cache_destroy(struct frame_cache *cache)
 {
 	if (cache->access == SND_PCM_ACCESS_RW_NONINTERLEAVED) {
 		char **bufs = cache->buf;
-		if (bufs) {
-			int i;
-			for (i = 0; i < cache->samples_per_frame; ++i)
-				free(bufs[i]);
-		}
-		free(cache->buf_ptr);
+		if (bufs)
+			page_buffer_free(bufs[0]);
+		free(cache->head_ptr);
+		free(cache->tail_ptr);
+		free(cache->buf);
+	} else {
+		page_buffer_free(cache->buf);
 	}
-	free(cache->buf);
 	memset(cache, 0, sizeof(*cache));
 }
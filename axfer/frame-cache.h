@@ -6,12 +6,22 @@
 //
 // Licensed under the terms of the GNU General Public License, version 2.
 
+#include "page-buffer.h"
+
 #include <alsa/asoundlib.h>
 
+// The cache is a ring of data frames. Frames are not moved in the cache; the
+// oldest frames and the space after the newest frames are available as views
+// of two segments at most.
 struct frame_cache {
 	void *buf;
-	void *buf_ptr;
 
+	// The views. For non-interleaved access, they're arrays of pointers
+	// for each channel.
+	void *head_ptr;
+	void *tail_ptr;
+
+	unsigned int head;
 	unsigned int remained_count;
 
 	snd_pcm_access_t access;
@@ -19,8 +29,8 @@ struct frame_cache {
 	unsigned int samples_per_frame;
 	unsigned int frames_per_cache;
 
-	void (*align_frames)(struct frame_cache *cache,
-			     unsigned int consumed_count);
+	// The mode of pages for frames.
+	enum page_buffer_mode mode;
 };
 
 int frame_cache_init(struct frame_cache *cache, snd_pcm_access_t access,
@@ -29,6 +39,11 @@ int frame_cache_init(struct frame_cache *cache, snd_pcm_access_t access,
 		     unsigned int frames_per_cache);
 void frame_cache_destroy(struct frame_cache *cache);
 
+void *frame_cache_get_head(struct frame_cache *cache,
+			   unsigned int *frame_count);
+void *frame_cache_get_tail(struct frame_cache *cache,
+			   unsigned int *frame_count);
+
 static inline unsigned int frame_cache_get_count(struct frame_cache *cache)
 {
 	return cache->remained_count;
@@ -43,5 +58,12 @@ static inline void frame_cache_increase_count(struct frame_cache *cache,
 static inline void frame_cache_reduce(struct frame_cache *cache,
 				      unsigned int consumed_count)
 {
-	cache->align_frames(cache, consumed_count);
+	cache->remained_count -= consumed_count;
+
+	// Rewind to keep the views as large as possible.
+	if (cache->remained_count == 0)
+		cache->head = 0;
+	else
+		cache->head = (cache->head + consumed_count) %
+			      cache->frames_per_cache;
 }
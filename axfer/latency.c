@@ -0,0 +1,65 @@
+// SPDX-License-Identifier: GPL-2.0
+//
+// latency.c - a histogram of latency in log2 buckets.
+//
+// Copyright (c) 2026 agent <agent@local>
+//
+// Licensed under the terms of the GNU General Public License, version 2.
+
+#include "latency.h"
+
+static unsigned int bucket_from_nsec(uint64_t nsec)
+{
+	unsigned int index = 0;
+
+	while (nsec > 1) {
+		nsec >>= 1;
+		++index;
+	}
+
+	return index;
+}
+
+void latency_histogram_add(struct latency_histogram *hist, uint64_t nsec)
+{
+	++hist->buckets[bucket_from_nsec(nsec)];
+	++hist->count;
+	if (nsec > hist->max)
+		hist->max = nsec;
+}
+
+// Return the upper bound of bucket which includes the percentile. The value
+// is not larger than the maximum.
+uint64_t latency_histogram_get_percentile(const struct latency_histogram *hist,
+					  double percentile)
+{
+	uint64_t threshold;
+	uint64_t accumulated = 0;
+	uint64_t bound;
+	int i;
+
+	if (hist->count == 0)
+		return 0;
+
+	// Round up.
+	threshold = (uint64_t)(hist->count * percentile / 100.0);
+	if ((double)threshold < hist->count * percentile / 100.0)
+		++threshold;
+	if (threshold == 0)
+		threshold = 1;
+
+	for (i = 0; i < LATENCY_BUCKET_COUNT; ++i) {
+		accumulated += hist->buckets[i];
+		if (accumulated >= threshold)
+			break;
+	}
+
+	if (i >= LATENCY_BUCKET_COUNT - 1)
+		return hist->max;
+
+	bound = (2ull << i) - 1;
+	if (bound > hist->max)
+		bound = hist->max;
+
+	return bound;
+}
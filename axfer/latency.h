@@ -0,0 +1,36 @@
+// SPDX-License-Identifier: GPL-2.0
+//
+// latency.h - a histogram of latency in log2 buckets.
+//
+// Copyright (c) 2026 agent <agent@local>
+//
+// Licensed under the terms of the GNU General Public License, version 2.
+
+#ifndef __ALSA_UTILS_AXFER_LATENCY__H_
+#define __ALSA_UTILS_AXFER_LATENCY__H_
+
+#include <stdint.h>
+#include <time.h>
+
+// The n-th bucket counts samples in a range of [2^n, 2^(n+1)) nsec, except
+// for the first bucket which counts samples less than 2 nsec.
+#define LATENCY_BUCKET_COUNT	64
+
+struct latency_histogram {
+	uint64_t buckets[LATENCY_BUCKET_COUNT];
+	uint64_t count;
+	uint64_t max;
+};
+
+void latency_histogram_add(struct latency_histogram *hist, uint64_t nsec);
+uint64_t latency_histogram_get_percentile(const struct latency_histogram *hist,
+					  double percentile);
+
+static inline uint64_t latency_elapsed_nsec(const struct timespec *begin,
+					    const struct timespec *end)
+{
+	return (uint64_t)(end->tv_sec - begin->tv_sec) * 1000000000ull +
+	       end->tv_nsec - begin->tv_nsec;
+}
+
+#endif
@@ -20,6 +20,7 @@
 enum subcmds {
 	SUBCMD_TRANSFER = 0,
 	SUBCMD_LIST,
+	SUBCMD_BENCH,
 	SUBCMD_HELP,
 	SUBCMD_VERSION,
 };
@@ -71,6 +72,7 @@ static void print_help(void)
 "Usage:\n"
 "  axfer transfer DIRECTION OPTIONS\n"
 "  axfer list DIRECTION OPTIONS\n"
+"  axfer bench DIRECTION OPTIONS\n"
 "  axfer version\n"
 "  axfer help\n"
 "\n"
@@ -204,6 +206,7 @@ static bool detect_subcmd(int argc, char *const *argv, enum subcmds *subcmd)
 	static const char *const subcmds[] = {
 		[SUBCMD_TRANSFER] = "transfer",
 		[SUBCMD_LIST] = "list",
+		[SUBCMD_BENCH] = "bench",
 		[SUBCMD_HELP] = "help",
 		[SUBCMD_VERSION] = "version",
 	};
@@ -276,6 +279,8 @@ int main(int argc, char *const *argv)
 		err = subcmd_transfer(argc, argv, direction);
 	else if (subcmd == SUBCMD_LIST)
 		err = subcmd_list(argc, argv, direction);
+	else if (subcmd == SUBCMD_BENCH)
+		err = subcmd_bench(argc, argv, direction);
 	else if (subcmd == SUBCMD_VERSION)
 		print_version(argv[0]);
 	else
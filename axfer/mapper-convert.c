@@ -0,0 +1,249 @@
+// SPDX-License-Identifier: GPL-2.0
+//
+// mapper-convert.c - a stage to convert sample format between buffer with
+//		      data frames and formatted files.
+//
+// Copyright (c) 2026 agent <agent@local>
+//
+// Licensed under the terms of the GNU General Public License, version 2.
+
+#include "mapper.h"
+#include "misc.h"
+#include "page-buffer.h"
+#include "sample-kernels.h"
+
+#include <stdio.h>
+
+// Each sample is read to 32 bit signed integer aligned to MSB, then written
+// in the other format by the kernels in sample-kernels.h. The least
+// significant bits are truncated when the destination is narrower than the
+// source.
+
+#define KERNEL_ENTRY(src, dst)						\
+	{ SND_PCM_FORMAT_##src, SND_PCM_FORMAT_##dst,			\
+	  sample_convert_##src##_to_##dst },
+
+// Generate kernels for each pair of supported formats.
+#define FOR_EACH_DST(macro, src)					\
+	macro(src, S8) macro(src, U8)					\
+	macro(src, S16_LE) macro(src, S16_BE)				\
+	macro(src, S24_LE) macro(src, S24_BE)				\
+	macro(src, S24_3LE) macro(src, S24_3BE)				\
+	macro(src, S32_LE) macro(src, S32_BE)
+
+#define FOR_EACH_PAIR(macro)						\
+	FOR_EACH_DST(macro, S8) FOR_EACH_DST(macro, U8)			\
+	FOR_EACH_DST(macro, S16_LE) FOR_EACH_DST(macro, S16_BE)		\
+	FOR_EACH_DST(macro, S24_LE) FOR_EACH_DST(macro, S24_BE)		\
+	FOR_EACH_DST(macro, S24_3LE) FOR_EACH_DST(macro, S24_3BE)	\
+	FOR_EACH_DST(macro, S32_LE) FOR_EACH_DST(macro, S32_BE)
+
+FOR_EACH_PAIR(DEFINE_SAMPLE_CONVERT_KERNEL)
+
+typedef void (*convert_kernel_t)(void *dst_buf, const void *src_buf,
+				 unsigned int sample_count);
+
+static const struct {
+	snd_pcm_format_t src;
+	snd_pcm_format_t dst;
+	convert_kernel_t kernel;
+} kernels[] = {
+	FOR_EACH_PAIR(KERNEL_ENTRY)
+};
+
+struct mapper_conversion {
+	convert_kernel_t kernel;
+	snd_pcm_format_t pcm_format;
+	snd_pcm_format_t cntr_format;
+
+	// The intermediate buffer in the format for containers.
+	char *buf;
+	// For non-interleaved access.
+	char **vector;
+};
+
+static convert_kernel_t find_kernel(snd_pcm_format_t src,
+				    snd_pcm_format_t dst)
+{
+	int i;
+
+	for (i = 0; i < ARRAY_SIZE(kernels); ++i) {
+		if (kernels[i].src == src && kernels[i].dst == dst)
+			return kernels[i].kernel;
+	}
+
+	return NULL;
+}
+
+bool mapper_conversion_is_available(snd_pcm_format_t src,
+				    snd_pcm_format_t dst)
+{
+	return find_kernel(src, dst) != NULL;
+}
+
+snd_pcm_format_t mapper_conversion_select_format(snd_pcm_format_t format,
+					const snd_pcm_format_mask_t *mask)
+{
+	snd_pcm_format_t candidate = SND_PCM_FORMAT_UNKNOWN;
+	int width = snd_pcm_format_width(format);
+	int i;
+
+	if (!mapper_conversion_is_available(format, format))
+		return SND_PCM_FORMAT_UNKNOWN;
+
+	// The narrowest one not to lose precision is preferred, else the
+	// widest one.
+	for (i = 0; i < ARRAY_SIZE(kernels); ++i) {
+		snd_pcm_format_t dst = kernels[i].dst;
+		int w;
+
+		if (kernels[i].src != format ||
+		    !snd_pcm_format_mask_test(mask, dst))
+			continue;
+
+		if (candidate == SND_PCM_FORMAT_UNKNOWN) {
+			candidate = dst;
+			continue;
+		}
+
+		w = snd_pcm_format_width(candidate);
+		if (w < width) {
+			if (snd_pcm_format_width(dst) > w)
+				candidate = dst;
+		} else if (snd_pcm_format_width(dst) >= width &&
+			   snd_pcm_format_physical_width(dst) <
+			   snd_pcm_format_physical_width(candidate)) {
+			candidate = dst;
+		}
+	}
+
+	return candidate;
+}
+
+int mapper_context_enable_conversion(struct mapper_context *mapper,
+				     snd_pcm_format_t pcm_format,
+				     snd_pcm_format_t cntr_format)
+{
+	struct mapper_conversion *conv;
+	convert_kernel_t kernel;
+	unsigned int bytes_per_buffer;
+	unsigned int bytes_per_channel;
+	int i;
+
+	assert(mapper);
+	assert(mapper->conversion == NULL);
+
+	// The mapper processes data frames in the format for containers.
+	if (mapper->bytes_per_sample * 8 !=
+				snd_pcm_format_physical_width(cntr_format))
+		return -EINVAL;
+
+	if (mapper->type == MAPPER_TYPE_DEMUXER)
+		kernel = find_kernel(pcm_format, cntr_format);
+	else
+		kernel = find_kernel(cntr_format, pcm_format);
+	if (kernel == NULL)
+		return -ENXIO;
+
+	conv = calloc(1, sizeof(*conv));
+	if (conv == NULL)
+		return -ENOMEM;
+	conv->kernel = kernel;
+	conv->pcm_format = pcm_format;
+	conv->cntr_format = cntr_format;
+
+	bytes_per_channel = mapper->bytes_per_sample *
+			    mapper->frames_per_buffer;
+	bytes_per_buffer = bytes_per_channel * mapper->samples_per_frame;
+	conv->buf = page_buffer_alloc(bytes_per_buffer, NULL);
+	if (conv->buf == NULL) {
+		free(conv);
+		return -ENOMEM;
+	}
+
+	if (mapper->access == SND_PCM_ACCESS_RW_NONINTERLEAVED ||
+	    mapper->access == SND_PCM_ACCESS_MMAP_NONINTERLEAVED) {
+		conv->vector = calloc(mapper->samples_per_frame,
+				      sizeof(*conv->vector));
+		if (conv->vector == NULL) {
+			page_buffer_free(conv->buf);
+			free(conv);
+			return -ENOMEM;
+		}
+		for (i = 0; i < mapper->samples_per_frame; ++i)
+			conv->vector[i] = conv->buf + bytes_per_channel * i;
+	}
+
+	mapper->conversion = conv;
+
+	if (mapper->verbose > 0) {
+		fprintf(stderr, "  conversion: %s => %s\n",
+			snd_pcm_format_name(mapper->type == MAPPER_TYPE_DEMUXER ?
+					    pcm_format : cntr_format),
+			snd_pcm_format_name(mapper->type == MAPPER_TYPE_DEMUXER ?
+					    cntr_format : pcm_format));
+	}
+
+	return 0;
+}
+
+static void convert_frames(struct mapper_context *mapper, void *dst,
+			   const void *src, unsigned int frame_count)
+{
+	struct mapper_conversion *conv = mapper->conversion;
+	int i;
+
+	if (conv->vector == NULL) {
+		conv->kernel(dst, src, frame_count * mapper->samples_per_frame);
+	} else {
+		char **dst_bufs = dst;
+		char *const *src_bufs = src;
+
+		for (i = 0; i < mapper->samples_per_frame; ++i)
+			conv->kernel(dst_bufs[i], src_bufs[i], frame_count);
+	}
+}
+
+int mapper_conversion_process_frames(struct mapper_context *mapper,
+				     void *frame_buffer,
+				     unsigned int *frame_count,
+				     struct container_context *cntrs)
+{
+	struct mapper_conversion *conv = mapper->conversion;
+	void *buf;
+	int err;
+
+	if (conv->vector)
+		buf = conv->vector;
+	else
+		buf = conv->buf;
+
+	if (mapper->type == MAPPER_TYPE_DEMUXER) {
+		convert_frames(mapper, buf, frame_buffer, *frame_count);
+		return mapper->ops->process_frames(mapper, buf, frame_count,
+						   cntrs, mapper->cntr_count);
+	}
+
+	err = mapper->ops->process_frames(mapper, buf, frame_count, cntrs,
+					  mapper->cntr_count);
+	if (err < 0)
+		return err;
+	if (*frame_count > 0)
+		convert_frames(mapper, frame_buffer, buf, *frame_count);
+
+	return 0;
+}
+
+void mapper_conversion_release(struct mapper_context *mapper)
+{
+	struct mapper_conversion *conv = mapper->conversion;
+
+	if (conv == NULL)
+		return;
+
+	free(conv->vector);
+	page_buffer_free(conv->buf);
+	free(conv);
+
+	mapper->conversion = NULL;
+}
@@ -8,67 +8,70 @@
 
 #include "mapper.h"
 #include "misc.h"
+#include "page-buffer.h"
+#include "sample-kernels.h"
+
+#include <pthread.h>
+#include <signal.h>
+
+// The containers are processed by the pool of workers in parallel so that
+// a slow file doesn't delay the others. The thread to process PCM substream
+// takes part in the work, then waits for the workers until all of the
+// containers are processed, since the buffer is reused for next period.
+struct worker_pool {
+	pthread_t *threads;
+	unsigned int thread_count;
+
+	pthread_mutex_t lock;
+	pthread_cond_t start;
+	pthread_cond_t done;
+	unsigned int generation;
+	unsigned int busy_count;
+	bool closing;
+
+	// The work in current period.
+	char **bufs;
+	unsigned int frame_count;
+	struct container_context *cntrs;
+	unsigned int cntr_count;
+	unsigned int next_index;
+	unsigned int handled_frame_count;
+	int err;
+};
 
 struct multiple_state {
 	void (*align_frames)(void *frame_buf, unsigned int frame_count,
 			     char **buf, unsigned int bytes_per_sample,
-			     struct container_context *cntrs,
+			     const unsigned int *cntr_channels,
 			     unsigned int cntr_count);
 	char **bufs;
+	// The number of channels in each container.
+	unsigned int *cntr_channels;
 	unsigned int cntr_count;
+
+	struct worker_pool *pool;
 };
 
+// src: first channel in each of interleaved buffers in containers =>
+// dst:interleaved.
 static void align_to_i(void *frame_buf, unsigned int frame_count,
 		       char **src_bufs, unsigned int bytes_per_sample,
-		       struct container_context *cntrs, unsigned int cntr_count)
+		       const unsigned int *cntr_channels,
+		       unsigned int cntr_count)
 {
-	char *dst = frame_buf;
-	char *src;
-	unsigned int dst_pos;
-	unsigned int src_pos;
-	struct container_context *cntr;
-	int i, j;
-
-	// src: first channel in each of interleaved buffers in containers =>
-	// dst:interleaved.
-	for (i = 0; i < cntr_count; ++i) {
-		src = src_bufs[i];
-		cntr = cntrs + i;
-
-		for (j = 0; j < frame_count; ++j) {
-			// Use first src channel for each of dst channel.
-			src_pos = bytes_per_sample * cntr->samples_per_frame * j;
-			dst_pos = bytes_per_sample * (cntr_count * j + i);
-
-			memcpy(dst + dst_pos, src + src_pos, bytes_per_sample);
-		}
-	}
+	sample_interleave(frame_buf, src_bufs, cntr_channels, cntr_count,
+			  frame_count, bytes_per_sample);
 }
 
+// Each container receives the samples as many as its channels; e.g. for
+// each device.
 static void align_from_i(void *frame_buf, unsigned int frame_count,
 			 char **dst_bufs, unsigned int bytes_per_sample,
-			 struct container_context *cntrs,
+			 const unsigned int *cntr_channels,
 			 unsigned int cntr_count)
 {
-	char *src = frame_buf;
-	char *dst;
-	unsigned int src_pos;
-	unsigned int dst_pos;
-	struct container_context *cntr;
-	int i, j;
-
-	for (i = 0; i < cntr_count; ++i) {
-		dst = dst_bufs[i];
-		cntr = cntrs + i;
-
-		for (j = 0; j < frame_count; ++j) {
-			// Use first src channel for each of dst channel.
-			src_pos = bytes_per_sample * (cntr_count * j + i);
-			dst_pos = bytes_per_sample * cntr->samples_per_frame * j;
-
-			memcpy(dst + dst_pos, src + src_pos, bytes_per_sample);
-		}
-	}
+	sample_deinterleave(dst_bufs, cntr_channels, cntr_count, frame_buf,
+			    frame_count, bytes_per_sample);
 }
 
 static int multiple_pre_process(struct mapper_context *mapper,
@@ -109,20 +112,26 @@ static int multiple_pre_process(struct mapper_context *mapper,
 			return -EINVAL;
 	}
 
-	if (state->align_frames) {
-		// Furthermore, in demuxer case, each container should be
-		// configured to store one sample per frame.
-		if (mapper->type == MAPPER_TYPE_DEMUXER) {
-			for (i = 0; i < cntr_count; ++i) {
-				cntr = cntrs + i;
-				if (cntr->samples_per_frame != 1)
-					return -EINVAL;
-			}
+	// Furthermore, in demuxer case for non-interleaved buffer, each
+	// container should be configured to store one sample per frame.
+	if (!state->align_frames && mapper->type == MAPPER_TYPE_DEMUXER) {
+		for (i = 0; i < cntr_count; ++i) {
+			cntr = cntrs + i;
+			if (cntr->samples_per_frame != 1)
+				return -EINVAL;
 		}
+	}
+
+	if (state->align_frames) {
+		enum page_buffer_mode mode = PAGE_BUFFER_MODE_HEAP;
 
 		state->bufs = calloc(cntr_count, sizeof(char *));
 		if (state->bufs == NULL)
 			return -ENOMEM;
+		state->cntr_channels = calloc(cntr_count,
+					      sizeof(*state->cntr_channels));
+		if (state->cntr_channels == NULL)
+			return -ENOMEM;
 
 		for (i = 0; i < cntr_count; ++i) {
 			unsigned int bytes_per_buffer;
@@ -130,22 +139,115 @@ static int multiple_pre_process(struct mapper_context *mapper,
 			// Allocate intermediate buffer as the same size as a
 			// period for each of containers.
 			cntr = cntrs + i;
+			state->cntr_channels[i] = cntr->samples_per_frame;
 
 			bytes_per_buffer = mapper->bytes_per_sample *
 					   cntr->samples_per_frame *
 					   mapper->frames_per_buffer;
 
-			state->bufs[i] = malloc(bytes_per_buffer);
+			state->bufs[i] = page_buffer_alloc(bytes_per_buffer,
+							   &mode);
 			if (state->bufs[i] == NULL)
 				return -ENOMEM;
-			memset(state->bufs[i], 0, bytes_per_buffer);
+		}
+
+		if (mapper->verbose > 0) {
+			fprintf(stderr, "  pages for buffers: %s\n",
+				page_buffer_mode_name(mode));
 		}
 	}
 
 	return 0;
 }
 
-static int process_containers(char **src_bufs, unsigned int *frame_count,
+static void run_work(struct worker_pool *pool)
+{
+	unsigned int index;
+	unsigned int frame_count;
+	int err;
+
+	while (1) {
+		pthread_mutex_lock(&pool->lock);
+		index = pool->next_index;
+		if (index < pool->cntr_count)
+			++pool->next_index;
+		pthread_mutex_unlock(&pool->lock);
+		if (index >= pool->cntr_count)
+			break;
+
+		frame_count = pool->frame_count;
+		err = container_context_process_frames(pool->cntrs + index,
+						       pool->bufs[index],
+						       &frame_count);
+
+		pthread_mutex_lock(&pool->lock);
+		if (err < 0 && pool->err == 0)
+			pool->err = err;
+		if (frame_count < pool->handled_frame_count)
+			pool->handled_frame_count = frame_count;
+		pthread_mutex_unlock(&pool->lock);
+	}
+}
+
+static void *worker_thread(void *arg)
+{
+	struct worker_pool *pool = arg;
+	unsigned int generation = 0;
+
+	pthread_mutex_lock(&pool->lock);
+	while (1) {
+		while (generation == pool->generation && !pool->closing)
+			pthread_cond_wait(&pool->start, &pool->lock);
+		if (pool->closing)
+			break;
+		generation = pool->generation;
+		pthread_mutex_unlock(&pool->lock);
+
+		run_work(pool);
+
+		pthread_mutex_lock(&pool->lock);
+		if (--pool->busy_count == 0)
+			pthread_cond_signal(&pool->done);
+	}
+	pthread_mutex_unlock(&pool->lock);
+
+	return NULL;
+}
+
+static int dispatch_containers(struct worker_pool *pool, char **bufs,
+			       unsigned int *frame_count,
+			       struct container_context *cntrs,
+			       unsigned int cntr_count)
+{
+	pthread_mutex_lock(&pool->lock);
+	pool->bufs = bufs;
+	pool->frame_count = *frame_count;
+	pool->cntrs = cntrs;
+	pool->cntr_count = cntr_count;
+	pool->next_index = 0;
+	pool->handled_frame_count = *frame_count;
+	pool->err = 0;
+	pool->busy_count = pool->thread_count;
+	++pool->generation;
+	pthread_cond_broadcast(&pool->start);
+	pthread_mutex_unlock(&pool->lock);
+
+	run_work(pool);
+
+	// Join at the end of period.
+	pthread_mutex_lock(&pool->lock);
+	while (pool->busy_count > 0)
+		pthread_cond_wait(&pool->done, &pool->lock);
+	pthread_mutex_unlock(&pool->lock);
+
+	// The minimum in the containers.
+	*frame_count = pool->handled_frame_count;
+
+	return pool->err;
+}
+
+static int process_containers(struct multiple_state *state, char **src_bufs,
+			      unsigned int *frame_count,
 			      struct container_context *cntrs,
 			      unsigned int cntr_count)
 {
@@ -154,6 +256,11 @@ static int process_containers(char **src_bufs, unsigned int *frame_count,
 	int i;
 	int err = 0;
 
+	if (state->pool) {
+		return dispatch_containers(state->pool, src_bufs, frame_count,
+					   cntrs, cntr_count);
+	}
+
 	// TODO: arrangement for *frame_count.
 	for (i = 0; i < cntr_count; ++i) {
 		cntr = &cntrs[i];
@@ -185,15 +292,16 @@ static int multiple_muxer_process_frames(struct mapper_context *mapper,
 	} else {
 		src_bufs = state->bufs;
 	}
-	err = process_containers(src_bufs, frame_count, cntrs, cntr_count);
+	err = process_containers(state, src_bufs, frame_count, cntrs,
+				 cntr_count);
 	if (err < 0)
 		return err;
 
 	// Unlikely.
 	if (src_bufs != frame_buf && *frame_count > 0) {
 		state->align_frames(frame_buf, *frame_count, src_bufs,
-				    mapper->bytes_per_sample, cntrs,
-				    cntr_count);
+				    mapper->bytes_per_sample,
+				    state->cntr_channels, cntr_count);
 	}
 
 	return 0;
@@ -216,11 +324,86 @@ static int multiple_demuxer_process_frames(struct mapper_context *mapper,
 	} else {
 		dst_bufs = state->bufs;
 		state->align_frames(frame_buf, *frame_count, dst_bufs,
-				    mapper->bytes_per_sample, cntrs,
-				    cntr_count);
+				    mapper->bytes_per_sample,
+				    state->cntr_channels, cntr_count);
+	}
+
+	return process_containers(state, dst_bufs, frame_count, cntrs,
+				  cntr_count);
+}
+
+static void release_pool(struct worker_pool *pool)
+{
+	int i;
+
+	pthread_mutex_lock(&pool->lock);
+	pool->closing = true;
+	pthread_cond_broadcast(&pool->start);
+	pthread_mutex_unlock(&pool->lock);
+
+	for (i = 0; i < pool->thread_count; ++i)
+		pthread_join(pool->threads[i], NULL);
+
+	pthread_cond_destroy(&pool->done);
+	pthread_cond_destroy(&pool->start);
+	pthread_mutex_destroy(&pool->lock);
+	free(pool->threads);
+	free(pool);
+}
+
+static int multiple_enable_workers(struct mapper_context *mapper,
+				   unsigned int worker_count)
+{
+	struct multiple_state *state = mapper->private_data;
+	struct worker_pool *pool;
+	sigset_t mask;
+	sigset_t old_mask;
+	int err = 0;
+
+	if (state->pool)
+		return -EBUSY;
+
+	// The thread to process PCM substream is also a worker.
+	if (worker_count < 2)
+		return 0;
+	if (worker_count > state->cntr_count)
+		worker_count = state->cntr_count;
+
+	pool = calloc(1, sizeof(*pool));
+	if (pool == NULL)
+		return -ENOMEM;
+
+	pool->threads = calloc(worker_count - 1, sizeof(*pool->threads));
+	if (pool->threads == NULL) {
+		free(pool);
+		return -ENOMEM;
+	}
+	pthread_mutex_init(&pool->lock, NULL);
+	pthread_cond_init(&pool->start, NULL);
+	pthread_cond_init(&pool->done, NULL);
+
+	// UNIX signals should be delivered to the PCM thread.
+	sigfillset(&mask);
+	pthread_sigmask(SIG_SETMASK, &mask, &old_mask);
+	while (pool->thread_count < worker_count - 1) {
+		err = -pthread_create(pool->threads + pool->thread_count, NULL,
+				      worker_thread, pool);
+		if (err < 0)
+			break;
+		++pool->thread_count;
+	}
+	pthread_sigmask(SIG_SETMASK, &old_mask, NULL);
+	if (err < 0) {
+		release_pool(pool);
+		return err;
 	}
 
-	return process_containers(dst_bufs, frame_count, cntrs, cntr_count);
+	state->pool = pool;
+
+	if (mapper->verbose > 0)
+		fprintf(stderr, "  workers: %u\n", worker_count);
+
+	return 0;
 }
 
 static void multiple_post_process(struct mapper_context *mapper)
@@ -228,15 +411,21 @@ static void multiple_post_process(struct mapper_context *mapper)
 	struct multiple_state *state = mapper->private_data;
 	int i;
 
+	if (state->pool)
+		release_pool(state->pool);
+	state->pool = NULL;
+
 	if (state->bufs) {
 		for (i = 0; i < state->cntr_count; ++i) {
 			if (state->bufs[i])
-				free(state->bufs[i]);
+				page_buffer_free(state->bufs[i]);
 		}
 		free(state->bufs);
 	}
+	free(state->cntr_channels);
 
 	state->bufs = NULL;
+	state->cntr_channels = NULL;
 	state->align_frames = NULL;
 }
 
@@ -244,6 +433,7 @@ const struct mapper_data mapper_muxer_multiple = {
 	.ops = {
 		.pre_process = multiple_pre_process,
 		.process_frames = multiple_muxer_process_frames,
+		.enable_workers = multiple_enable_workers,
 		.post_process = multiple_post_process,
 	},
 	.private_size = sizeof(struct multiple_state),
@@ -253,6 +443,7 @@ const struct mapper_data mapper_demuxer_multiple = {
 	.ops = {
 		.pre_process = multiple_pre_process,
 		.process_frames = multiple_demuxer_process_frames,
+		.enable_workers = multiple_enable_workers,
 		.post_process = multiple_post_process,
 	},
 	.private_size = sizeof(struct multiple_state),
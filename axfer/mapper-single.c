@@ -8,6 +8,8 @@
 
 #include "mapper.h"
 #include "misc.h"
+#include "page-buffer.h"
+#include "sample-kernels.h"
 
 struct single_state {
 	void (*align_frames)(void *frame_buf, unsigned int frame_count,
@@ -21,21 +23,10 @@ static void align_to_vector(void *frame_buf, unsigned int frame_count,
 			    unsigned samples_per_frame)
 {
 	char **dst_bufs = frame_buf;
-	char *dst;
-	unsigned int src_pos;
-	unsigned int dst_pos;
-	int i, j;
 
 	// src: interleaved => dst: a set of interleaved buffers.
-	for (i = 0; i < samples_per_frame; ++i) {
-		dst = dst_bufs[i];
-		for (j = 0; j < frame_count; ++j) {
-			src_pos = bytes_per_sample * (samples_per_frame * j + i);
-			dst_pos = bytes_per_sample * j;
-
-			memcpy(dst + dst_pos, src + src_pos, bytes_per_sample);
-		}
-	}
+	sample_deinterleave(dst_bufs, NULL, samples_per_frame, src, frame_count,
+			    bytes_per_sample);
 }
 
 static void align_from_vector(void *frame_buf, unsigned int frame_count,
@@ -43,21 +34,10 @@ static void align_from_vector(void *frame_buf, unsigned int frame_count,
 			      unsigned int samples_per_frame)
 {
 	char **src_bufs = frame_buf;
-	char *src;
-	unsigned int dst_pos;
-	unsigned int src_pos;
-	int i, j;
 
 	// src: a set of interleaved buffers => dst:interleaved.
-	for (i = 0; i < samples_per_frame; ++i) {
-		src = src_bufs[i];
-		for (j = 0; j < frame_count; ++j) {
-			src_pos = bytes_per_sample * j;
-			dst_pos = bytes_per_sample * (samples_per_frame * j + i);
-
-			memcpy(dst + dst_pos, src + src_pos, bytes_per_sample);
-		}
-	}
+	sample_interleave(dst, src_bufs, NULL, samples_per_frame, frame_count,
+			  bytes_per_sample);
 }
 
 static int single_pre_process(struct mapper_context *mapper,
@@ -66,6 +46,7 @@ static int single_pre_process(struct mapper_context *mapper,
 {
 	struct single_state *state = mapper->private_data;
 	unsigned int bytes_per_buffer;
+	enum page_buffer_mode mode;
 
 	if (cntrs->bytes_per_sample != mapper->bytes_per_sample ||
 	    cntrs->samples_per_frame != mapper->samples_per_frame)
@@ -97,10 +78,14 @@ static int single_pre_process(struct mapper_context *mapper,
 		bytes_per_buffer = mapper->bytes_per_sample *
 				   mapper->samples_per_frame *
 				   mapper->frames_per_buffer;
-		state->buf = malloc(bytes_per_buffer);
+		state->buf = page_buffer_alloc(bytes_per_buffer, &mode);
 		if (state->buf == NULL)
 			return -ENOMEM;
-		memset(state->buf, 0, bytes_per_buffer);
+
+		if (mapper->verbose > 0) {
+			fprintf(stderr, "  pages for buffer: %s\n",
+				page_buffer_mode_name(mode));
+		}
 	}
 
 	return 0;
@@ -166,7 +151,7 @@ static void single_post_process(struct mapper_context *mapper)
 	struct single_state *state = mapper->private_data;
 
 	if (state->buf)
-		free(state->buf);
+		page_buffer_free(state->buf);
 
 	state->buf = NULL;
 	state->align_frames = NULL;
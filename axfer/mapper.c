@@ -85,10 +85,20 @@ int mapper_context_pre_process(struct mapper_context *mapper,
 	assert(cntrs);
 
 	// The purpose of multiple target is to mux/demux each channels to/from
-	// containers.
-	if (mapper->target == MAPPER_TARGET_MULTIPLE &&
-	    samples_per_frame != mapper->cntr_count)
-		return -EINVAL;
+	// containers. In demuxer case, a container can store several channels.
+	if (mapper->target == MAPPER_TARGET_MULTIPLE) {
+		if (mapper->type == MAPPER_TYPE_DEMUXER) {
+			unsigned int total = 0;
+			int i;
+
+			for (i = 0; i < mapper->cntr_count; ++i)
+				total += cntrs[i].samples_per_frame;
+			if (samples_per_frame != total)
+				return -EINVAL;
+		} else if (samples_per_frame != mapper->cntr_count) {
+			return -EINVAL;
+		}
+	}
 
 	mapper->access = access;
 	mapper->bytes_per_sample = bytes_per_sample;
@@ -128,22 +138,43 @@ int mapper_context_process_frames(struct mapper_context *mapper,
 	assert(*frame_count <= mapper->frames_per_buffer);
 	assert(cntrs);
 
+	if (mapper->conversion) {
+		return mapper_conversion_process_frames(mapper, frame_buffer,
+							frame_count, cntrs);
+	}
+
 	return mapper->ops->process_frames(mapper, frame_buffer, frame_count,
 					    cntrs, mapper->cntr_count);
 }
 
+int mapper_context_enable_workers(struct mapper_context *mapper,
+				  unsigned int worker_count)
+{
+	assert(mapper);
+
+	// The pool of workers is useful for several containers only.
+	if (mapper->ops == NULL || mapper->ops->enable_workers == NULL)
+		return -ENXIO;
+
+	return mapper->ops->enable_workers(mapper, worker_count);
+}
+
 void mapper_context_post_process(struct mapper_context *mapper)
 {
 	assert(mapper);
 
 	if (mapper->ops && mapper->ops->post_process)
 		mapper->ops->post_process(mapper);
+
+	mapper_conversion_release(mapper);
 }
 
 void mapper_context_destroy(struct mapper_context *mapper)
 {
 	assert(mapper);
 
+	mapper_conversion_release(mapper);
+
 	if (mapper->private_data)
 		free(mapper->private_data);
 	mapper->private_data = NULL;
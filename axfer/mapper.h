@@ -25,6 +25,7 @@ enum mapper_target {
 };
 
 struct mapper_ops;
+struct mapper_conversion;
 
 struct mapper_context {
 	enum mapper_type type;
@@ -41,6 +42,9 @@ struct mapper_context {
 	unsigned int samples_per_frame;
 	snd_pcm_uframes_t frames_per_buffer;
 
+	// For conversion of sample format between buffer and containers.
+	struct mapper_conversion *conversion;
+
 	unsigned int verbose;
 };
 
@@ -57,9 +61,19 @@ int mapper_context_process_frames(struct mapper_context *mapper,
 				  void *frame_buffer,
 				  unsigned int *frame_count,
 				  struct container_context *cntrs);
+int mapper_context_enable_workers(struct mapper_context *mapper,
+				  unsigned int worker_count);
+int mapper_context_enable_conversion(struct mapper_context *mapper,
+				     snd_pcm_format_t pcm_format,
+				     snd_pcm_format_t cntr_format);
 void mapper_context_post_process(struct mapper_context *mapper);
 void mapper_context_destroy(struct mapper_context *mapper);
 
+bool mapper_conversion_is_available(snd_pcm_format_t src,
+				    snd_pcm_format_t dst);
+snd_pcm_format_t mapper_conversion_select_format(snd_pcm_format_t format,
+					const snd_pcm_format_mask_t *mask);
+
 // For internal use in 'mapper' module.
 
 struct mapper_ops {
@@ -70,6 +84,8 @@ struct mapper_ops {
 			      void *frame_buffer, unsigned int *frame_count,
 			      struct container_context *cntrs,
 			      unsigned int cntr_count);
+	int (*enable_workers)(struct mapper_context *mapper,
+			      unsigned int worker_count);
 	void (*post_process)(struct mapper_context *mapper);
 };
 
@@ -84,4 +100,10 @@ extern const struct mapper_data mapper_demuxer_single;
 extern const struct mapper_data mapper_muxer_multiple;
 extern const struct mapper_data mapper_demuxer_multiple;
 
+int mapper_conversion_process_frames(struct mapper_context *mapper,
+				     void *frame_buffer,
+				     unsigned int *frame_count,
+				     struct container_context *cntrs);
+void mapper_conversion_release(struct mapper_context *mapper);
+
 #endif
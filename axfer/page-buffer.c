@@ -0,0 +1,186 @@
+// SPDX-License-Identifier: GPL-2.0
+//
+// page-buffer.c - an allocator of buffers backed by huge pages.
+//
+// Copyright (c) 2026 agent <agent@local>
+//
+// Licensed under the terms of the GNU General Public License, version 2.
+
+#include "page-buffer.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#define DEFAULT_HUGEPAGE_SIZE	(2 * 1024 * 1024)
+
+// The header is put before the buffer to keep the way to release it. The
+// size keeps alignment of buffer to cache line.
+#define HEADER_SIZE		64
+
+struct page_buffer_header {
+	size_t length;
+	enum page_buffer_mode mode;
+};
+
+static const char *const mode_names[] = {
+	[PAGE_BUFFER_MODE_HEAP] = "heap",
+	[PAGE_BUFFER_MODE_HUGETLB] = "hugetlb",
+	[PAGE_BUFFER_MODE_THP] = "transparent-hugepage",
+};
+
+static size_t hugepage_size(void)
+{
+	static size_t size;
+	char line[64];
+	FILE *fp;
+
+	if (size > 0)
+		return size;
+
+	size = DEFAULT_HUGEPAGE_SIZE;
+
+	fp = fopen("/proc/meminfo", "r");
+	if (fp == NULL)
+		return size;
+
+	while (fgets(line, sizeof(line), fp) != NULL) {
+		unsigned long kb;
+
+		if (sscanf(line, "Hugepagesize: %lu kB", &kb) == 1) {
+			if (kb > 0)
+				size = kb * 1024;
+			break;
+		}
+	}
+
+	fclose(fp);
+
+	return size;
+}
+
+// Touch each page in advance so that page faults don't occur during
+// transmission.
+static void prefault(char *buf, size_t length)
+{
+	long page_size = sysconf(_SC_PAGESIZE);
+	size_t pos;
+
+	if (page_size <= 0)
+		page_size = 4096;
+
+	for (pos = 0; pos < length; pos += page_size)
+		((volatile char *)buf)[pos] = 0;
+}
+
+static void *map_hugetlb(size_t length)
+{
+#ifdef MAP_HUGETLB
+	void *buf;
+
+	// Available when huge pages are reserved in the pool.
+	buf = mmap(NULL, length, PROT_READ | PROT_WRITE,
+		   MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB | MAP_POPULATE,
+		   -1, 0);
+	if (buf != MAP_FAILED)
+		return buf;
+#endif
+	return NULL;
+}
+
+static void *map_thp(size_t length, size_t align)
+{
+#ifdef MADV_HUGEPAGE
+	char *buf;
+	size_t head;
+	size_t tail;
+
+	// Map extra area to align the buffer to the size of huge page, then
+	// unmap the rest.
+	buf = mmap(NULL, length + align, PROT_READ | PROT_WRITE,
+		   MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (buf == MAP_FAILED)
+		return NULL;
+
+	head = (align - (uintptr_t)buf % align) % align;
+	tail = align - head;
+	if (head > 0)
+		munmap(buf, head);
+	munmap(buf + head + length, tail);
+	buf += head;
+
+	// Unavailable when disabled in system.
+	if (madvise(buf, length, MADV_HUGEPAGE) < 0) {
+		munmap(buf, length);
+		return NULL;
+	}
+
+	prefault(buf, length);
+
+	return buf;
+#else
+	return NULL;
+#endif
+}
+
+// Buffers smaller than a huge page are allocated from heap since the huge
+// page is wasted mostly.
+void *page_buffer_alloc(size_t size, enum page_buffer_mode *mode)
+{
+	struct page_buffer_header *header = NULL;
+	size_t length = size + HEADER_SIZE;
+	size_t align = hugepage_size();
+	enum page_buffer_mode m = PAGE_BUFFER_MODE_HEAP;
+
+	if (length >= align) {
+		length = (length + align - 1) / align * align;
+
+		header = map_hugetlb(length);
+		if (header != NULL) {
+			m = PAGE_BUFFER_MODE_HUGETLB;
+		} else {
+			header = map_thp(length, align);
+			if (header != NULL)
+				m = PAGE_BUFFER_MODE_THP;
+		}
+	}
+
+	if (header == NULL) {
+		length = size + HEADER_SIZE;
+		header = calloc(1, length);
+		if (header == NULL)
+			return NULL;
+	}
+
+	header->length = length;
+	header->mode = m;
+
+	if (mode)
+		*mode = m;
+
+	return (char *)header + HEADER_SIZE;
+}
+
+void page_buffer_free(void *buf)
+{
+	struct page_buffer_header *header;
+
+	if (buf == NULL)
+		return;
+
+	header = (struct page_buffer_header *)((char *)buf - HEADER_SIZE);
+	if (header->mode == PAGE_BUFFER_MODE_HEAP)
+		free(header);
+	else
+		munmap(header, header->length);
+}
+
+const char *page_buffer_mode_name(enum page_buffer_mode mode)
+{
+	if (mode >= PAGE_BUFFER_MODE_COUNT)
+		return "unknown";
+	return mode_names[mode];
+}
@@ -0,0 +1,25 @@
+// SPDX-License-Identifier: GPL-2.0
+//
+// page-buffer.h - a header for allocator of buffers backed by huge pages.
+//
+// Copyright (c) 2026 agent <agent@local>
+//
+// Licensed under the terms of the GNU General Public License, version 2.
+
+#ifndef __ALSA_UTILS_AXFER_PAGE_BUFFER__H_
+#define __ALSA_UTILS_AXFER_PAGE_BUFFER__H_
+
+#include <stddef.h>
+
+enum page_buffer_mode {
+	PAGE_BUFFER_MODE_HEAP = 0,
+	PAGE_BUFFER_MODE_HUGETLB,
+	PAGE_BUFFER_MODE_THP,
+	PAGE_BUFFER_MODE_COUNT,
+};
+
+void *page_buffer_alloc(size_t size, enum page_buffer_mode *mode);
+void page_buffer_free(void *buf);
+const char *page_buffer_mode_name(enum page_buffer_mode mode);
+
+#endif
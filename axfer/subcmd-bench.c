@@ -0,0 +1,498 @@
+// SPDX-License-Identifier: GPL-2.0
+//
+// subcmd-bench.c - operations for bench sub command.
+//
+// Copyright (c) 2026 agent <agent@local>
+//
+// Licensed under the terms of the GNU General Public License, version 2.
+
+#include "subcmd.h"
+#include "misc.h"
+
+#include <getopt.h>
+#include <stdbool.h>
+#include <inttypes.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <sys/resource.h>
+
+// Each element of matrix is given as comma-separated list.
+#define MAX_ENTRY_COUNT	16
+
+enum bench_access {
+	BENCH_ACCESS_RW = 0,
+	BENCH_ACCESS_MMAP,
+	BENCH_ACCESS_COUNT,
+};
+
+enum bench_sched_model {
+	BENCH_SCHED_MODEL_IRQ = 0,
+	BENCH_SCHED_MODEL_TIMER,
+	BENCH_SCHED_MODEL_COUNT,
+};
+
+static const char *const access_labels[] = {
+	[BENCH_ACCESS_RW] = "rw",
+	[BENCH_ACCESS_MMAP] = "mmap",
+};
+
+static const char *const sched_model_labels[] = {
+	[BENCH_SCHED_MODEL_IRQ] = "irq",
+	[BENCH_SCHED_MODEL_TIMER] = "timer",
+};
+
+static const char *const waiter_type_labels[] = {
+	"default",
+	"poll",
+	"select",
+	"epoll",
+	"timerfd",
+};
+
+struct bench_matrix {
+	unsigned int accesses[MAX_ENTRY_COUNT];
+	unsigned int access_count;
+	unsigned int sched_models[MAX_ENTRY_COUNT];
+	unsigned int sched_model_count;
+	unsigned int waiter_types[MAX_ENTRY_COUNT];
+	unsigned int waiter_type_count;
+	unsigned int period_sizes[MAX_ENTRY_COUNT];
+	unsigned int period_size_count;
+	unsigned int channels[MAX_ENTRY_COUNT];
+	unsigned int channel_count;
+};
+
+struct bench_context {
+	char *node_literal;
+	char *sample_format_literal;
+	unsigned int frames_per_second;
+	unsigned int duration_seconds;
+	bool verbose;
+	bool help;
+
+	struct bench_matrix matrix;
+};
+
+struct bench_case {
+	unsigned int access;
+	unsigned int sched_model;
+	unsigned int waiter_type;
+	unsigned int period_size;
+	unsigned int channels;
+};
+
+struct bench_result {
+	int err;
+	struct subcmd_transfer_stats stats;
+};
+
+static void print_help(void)
+{
+	printf(
+"Usage:\n"
+"  axfer bench DIRECTION [ OPTIONS ]\n"
+"\n"
+"  where:\n"
+"    DIRECTION = capture | playback\n"
+"    OPTIONS:\n"
+"      -h, --help              help\n"
+"      -v, --verbose           show output of each transfer\n"
+"      -D, --device=NODE       node name of PCM (default: null)\n"
+"      -f, --format=FORMAT     sample format (default: S16_LE)\n"
+"      -r, --rate=#            sampling rate (default: 48000)\n"
+"      -d, --duration=#        seconds of each transfer (default: 3)\n"
+"      --access=LIST           rw, mmap (default: rw,mmap)\n"
+"      --sched-model=LIST      irq, timer (default: irq,timer)\n"
+"      --waiter-type=LIST      default, poll, select, epoll, timerfd\n"
+"                              (default: all)\n"
+"      --period-size=LIST      frames per period (default: 256,1024)\n"
+"      --channels=LIST         samples per frame (default: 2)\n"
+"\n"
+"  LIST is comma-separated values.\n"
+	);
+}
+
+static int parse_labels(const char *literal, const char *const *labels,
+			unsigned int label_count, unsigned int *entries,
+			unsigned int *entry_count)
+{
+	char *list;
+	char *token;
+	char *saveptr;
+	int i;
+	int err = 0;
+
+	list = strdup(literal);
+	if (list == NULL)
+		return -ENOMEM;
+
+	*entry_count = 0;
+	for (token = strtok_r(list, ",", &saveptr); token != NULL;
+	     token = strtok_r(NULL, ",", &saveptr)) {
+		for (i = 0; i < label_count; ++i) {
+			if (!strcmp(token, labels[i]))
+				break;
+		}
+		if (i == label_count || *entry_count >= MAX_ENTRY_COUNT) {
+			fprintf(stderr, "Invalid entry: '%s'\n", token);
+			err = -EINVAL;
+			break;
+		}
+		entries[(*entry_count)++] = i;
+	}
+
+	free(list);
+
+	return err;
+}
+
+static int parse_numbers(const char *literal, unsigned int *entries,
+			 unsigned int *entry_count)
+{
+	char *list;
+	char *token;
+	char *saveptr;
+	long val;
+	int err = 0;
+
+	list = strdup(literal);
+	if (list == NULL)
+		return -ENOMEM;
+
+	*entry_count = 0;
+	for (token = strtok_r(list, ",", &saveptr); token != NULL;
+	     token = strtok_r(NULL, ",", &saveptr)) {
+		val = arg_parse_decimal_num(token, &err);
+		if (err < 0 || val <= 0 || *entry_count >= MAX_ENTRY_COUNT) {
+			fprintf(stderr, "Invalid entry: '%s'\n", token);
+			err = -EINVAL;
+			break;
+		}
+		entries[(*entry_count)++] = (unsigned int)val;
+	}
+
+	free(list);
+
+	return err;
+}
+
+static int parse_args(struct bench_context *ctx, int argc, char *const *argv)
+{
+	enum no_short_opts {
+		// 200 or later belong to non us-ascii character set.
+		OPT_ACCESS = 200,
+		OPT_SCHED_MODEL,
+		OPT_WAITER_TYPE,
+		OPT_PERIOD_SIZE,
+		OPT_CHANNELS,
+	};
+	static const char *s_opts = "hvD:f:r:d:";
+	static const struct option l_opts[] = {
+		{"help",		0, NULL, 'h'},
+		{"verbose",		0, NULL, 'v'},
+		{"device",		1, NULL, 'D'},
+		{"format",		1, NULL, 'f'},
+		{"rate",		1, NULL, 'r'},
+		{"duration",		1, NULL, 'd'},
+		{"access",		1, NULL, OPT_ACCESS},
+		{"sched-model",		1, NULL, OPT_SCHED_MODEL},
+		{"waiter-type",		1, NULL, OPT_WAITER_TYPE},
+		{"period-size",		1, NULL, OPT_PERIOD_SIZE},
+		{"channels",		1, NULL, OPT_CHANNELS},
+		{NULL,			0, NULL, 0}
+	};
+	struct bench_matrix *matrix = &ctx->matrix;
+	const char *access_literal = "rw,mmap";
+	const char *sched_model_literal = "irq,timer";
+	const char *waiter_type_literal = "default,poll,select,epoll,timerfd";
+	const char *period_size_literal = "256,1024";
+	const char *channels_literal = "2";
+	int err = 0;
+
+	optind = 1;
+	opterr = 1;
+	while (err == 0) {
+		int key = getopt_long(argc, argv, s_opts, l_opts, NULL);
+		if (key < 0)
+			break;
+
+		if (key == 'h')
+			ctx->help = true;
+		else if (key == 'v')
+			ctx->verbose = true;
+		else if (key == 'D')
+			ctx->node_literal = arg_duplicate_string(optarg, &err);
+		else if (key == 'f')
+			ctx->sample_format_literal =
+					arg_duplicate_string(optarg, &err);
+		else if (key == 'r')
+			ctx->frames_per_second = arg_parse_decimal_num(optarg, &err);
+		else if (key == 'd')
+			ctx->duration_seconds = arg_parse_decimal_num(optarg, &err);
+		else if (key == OPT_ACCESS)
+			access_literal = optarg;
+		else if (key == OPT_SCHED_MODEL)
+			sched_model_literal = optarg;
+		else if (key == OPT_WAITER_TYPE)
+			waiter_type_literal = optarg;
+		else if (key == OPT_PERIOD_SIZE)
+			period_size_literal = optarg;
+		else if (key == OPT_CHANNELS)
+			channels_literal = optarg;
+		else
+			err = -EINVAL;
+	}
+	if (err < 0)
+		return err;
+
+	if (ctx->node_literal == NULL) {
+		ctx->node_literal = strdup("null");
+		if (ctx->node_literal == NULL)
+			return -ENOMEM;
+	}
+	if (ctx->sample_format_literal == NULL) {
+		ctx->sample_format_literal = strdup("S16_LE");
+		if (ctx->sample_format_literal == NULL)
+			return -ENOMEM;
+	}
+	if (ctx->frames_per_second == 0)
+		ctx->frames_per_second = 48000;
+	if (ctx->duration_seconds == 0)
+		ctx->duration_seconds = 3;
+
+	err = parse_labels(access_literal, access_labels,
+			   ARRAY_SIZE(access_labels), matrix->accesses,
+			   &matrix->access_count);
+	if (err < 0)
+		return err;
+	err = parse_labels(sched_model_literal, sched_model_labels,
+			   ARRAY_SIZE(sched_model_labels), matrix->sched_models,
+			   &matrix->sched_model_count);
+	if (err < 0)
+		return err;
+	err = parse_labels(waiter_type_literal, waiter_type_labels,
+			   ARRAY_SIZE(waiter_type_labels), matrix->waiter_types,
+			   &matrix->waiter_type_count);
+	if (err < 0)
+		return err;
+	err = parse_numbers(period_size_literal, matrix->period_sizes,
+			    &matrix->period_size_count);
+	if (err < 0)
+		return err;
+
+	return parse_numbers(channels_literal, matrix->channels,
+			     &matrix->channel_count);
+}
+
+// Timer-based scheduling model is available with mmap operation only.
+static bool is_valid_case(const struct bench_case *bcase)
+{
+	return bcase->sched_model != BENCH_SCHED_MODEL_TIMER ||
+	       bcase->access == BENCH_ACCESS_MMAP;
+}
+
+// In child process.
+static void run_transfer(struct bench_context *ctx,
+			 const struct bench_case *bcase,
+			 snd_pcm_stream_t direction, int fd)
+{
+	char format[64];
+	char rate[32];
+	char channels[32];
+	char duration[32];
+	char period_size[64];
+	char buffer_size[64];
+	char sched_model[64];
+	char waiter_type[64];
+	char *argv[32];
+	struct bench_result result = {0};
+	int argc = 0;
+
+	snprintf(format, sizeof(format), "--format=%s",
+		 ctx->sample_format_literal);
+	snprintf(rate, sizeof(rate), "--rate=%u", ctx->frames_per_second);
+	snprintf(channels, sizeof(channels), "--channels=%u", bcase->channels);
+	snprintf(duration, sizeof(duration), "--duration=%u",
+		 ctx->duration_seconds);
+	snprintf(period_size, sizeof(period_size), "--period-size=%u",
+		 bcase->period_size);
+	snprintf(buffer_size, sizeof(buffer_size), "--buffer-size=%u",
+		 bcase->period_size * 4);
+	snprintf(sched_model, sizeof(sched_model), "--sched-model=%s",
+		 sched_model_labels[bcase->sched_model]);
+	snprintf(waiter_type, sizeof(waiter_type), "--waiter-type=%s",
+		 waiter_type_labels[bcase->waiter_type]);
+
+	argv[argc++] = "axfer";
+	argv[argc++] = "--quiet";
+	argv[argc++] = "-D";
+	argv[argc++] = ctx->node_literal;
+	argv[argc++] = "--file-type=raw";
+	argv[argc++] = format;
+	argv[argc++] = rate;
+	argv[argc++] = channels;
+	argv[argc++] = duration;
+	argv[argc++] = period_size;
+	argv[argc++] = buffer_size;
+	argv[argc++] = sched_model;
+	if (bcase->access == BENCH_ACCESS_MMAP)
+		argv[argc++] = "--mmap";
+	if (bcase->waiter_type > 0) {
+		// The waiter is available with nonblocking mode for rw.
+		if (bcase->access == BENCH_ACCESS_RW)
+			argv[argc++] = "--nonblock";
+		argv[argc++] = waiter_type;
+	}
+	if (direction == SND_PCM_STREAM_CAPTURE)
+		argv[argc++] = "/dev/null";
+	else
+		argv[argc++] = "/dev/zero";
+	argv[argc] = NULL;
+
+	if (!ctx->verbose) {
+		int null_fd = open("/dev/null", O_WRONLY);
+		if (null_fd >= 0) {
+			dup2(null_fd, STDERR_FILENO);
+			close(null_fd);
+		}
+	}
+
+	result.err = subcmd_transfer_with_stats(argc, argv, direction,
+						&result.stats);
+
+	if (write(fd, &result, sizeof(result)) != sizeof(result))
+		_exit(EXIT_FAILURE);
+	_exit(EXIT_SUCCESS);
+}
+
+static int run_case(struct bench_context *ctx, const struct bench_case *bcase,
+		    snd_pcm_stream_t direction)
+{
+	struct bench_result result = {0};
+	struct rusage usage;
+	uint64_t cpu_usec;
+	double audio_seconds;
+	int fds[2];
+	pid_t pid;
+	int status;
+	ssize_t len;
+
+	if (pipe(fds) < 0)
+		return -errno;
+
+	// Each transfer runs in child process to measure its resource usage.
+	fflush(stdout);
+	pid = fork();
+	if (pid < 0) {
+		close(fds[0]);
+		close(fds[1]);
+		return -errno;
+	}
+	if (pid == 0) {
+		close(fds[0]);
+		run_transfer(ctx, bcase, direction, fds[1]);
+	}
+
+	close(fds[1]);
+	len = read(fds[0], &result, sizeof(result));
+	close(fds[0]);
+
+	if (wait4(pid, &status, 0, &usage) < 0)
+		return -errno;
+	if (len != sizeof(result) || !WIFEXITED(status) ||
+	    WEXITSTATUS(status) != EXIT_SUCCESS)
+		result.err = -ECHILD;
+
+	printf("%s,%s,%s,%u,%u,",
+	       access_labels[bcase->access],
+	       sched_model_labels[bcase->sched_model],
+	       waiter_type_labels[bcase->waiter_type],
+	       bcase->period_size, bcase->channels);
+
+	audio_seconds = (double)result.stats.frame_count /
+			ctx->frames_per_second;
+	if (result.err < 0 || audio_seconds == 0.0) {
+		printf("%s,%" PRIu64 ",,,,%u\n",
+		       result.err < 0 ? snd_strerror(result.err) : "no-frames",
+		       result.stats.frame_count, result.stats.xrun_count);
+		return 0;
+	}
+
+	cpu_usec = (uint64_t)usage.ru_utime.tv_sec * 1000000 +
+		   usage.ru_utime.tv_usec +
+		   (uint64_t)usage.ru_stime.tv_sec * 1000000 +
+		   usage.ru_stime.tv_usec;
+
+	// Voluntary context switches are regarded as wakeups from waiters.
+	printf("ok,%" PRIu64 ",%.1f,%.1f,%.1f,%u\n",
+	       result.stats.frame_count,
+	       cpu_usec / audio_seconds,
+	       usage.ru_nvcsw / audio_seconds,
+	       result.stats.iteration_count / audio_seconds,
+	       result.stats.xrun_count);
+
+	return 0;
+}
+
+static int run_matrix(struct bench_context *ctx, snd_pcm_stream_t direction)
+{
+	struct bench_matrix *matrix = &ctx->matrix;
+	struct bench_case bcase;
+	int a, s, w, p, c;
+	int err;
+
+	printf("# axfer bench: direction=%s device=%s format=%s rate=%u "
+	       "duration=%u\n",
+	       snd_pcm_stream_name(direction), ctx->node_literal,
+	       ctx->sample_format_literal, ctx->frames_per_second,
+	       ctx->duration_seconds);
+	printf("access,sched_model,waiter_type,period_size,channels,result,"
+	       "frames,cpu_usec_per_sec,wakeups_per_sec,iterations_per_sec,"
+	       "xruns\n");
+
+	for (a = 0; a < matrix->access_count; ++a) {
+	for (s = 0; s < matrix->sched_model_count; ++s) {
+	for (w = 0; w < matrix->waiter_type_count; ++w) {
+	for (p = 0; p < matrix->period_size_count; ++p) {
+	for (c = 0; c < matrix->channel_count; ++c) {
+		bcase.access = matrix->accesses[a];
+		bcase.sched_model = matrix->sched_models[s];
+		bcase.waiter_type = matrix->waiter_types[w];
+		bcase.period_size = matrix->period_sizes[p];
+		bcase.channels = matrix->channels[c];
+
+		if (!is_valid_case(&bcase))
+			continue;
+
+		err = run_case(ctx, &bcase, direction);
+		if (err < 0)
+			return err;
+	}
+	}
+	}
+	}
+	}
+
+	return 0;
+}
+
+int subcmd_bench(int argc, char *const *argv, snd_pcm_stream_t direction)
+{
+	struct bench_context ctx = {0};
+	int err;
+
+	err = parse_args(&ctx, argc, argv);
+	if (err >= 0) {
+		if (ctx.help)
+			print_help();
+		else
+			err = run_matrix(&ctx, direction);
+	}
+
+	free(ctx.node_literal);
+	free(ctx.sample_format_literal);
+
+	return err;
+}
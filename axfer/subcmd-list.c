@@ -11,6 +11,10 @@
 
 #include <getopt.h>
 #include <stdbool.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/stat.h>
 
 enum list_op {
 	LIST_OP_DEVICE = 0,
@@ -18,44 +22,92 @@ enum list_op {
 	LIST_OP_HELP,
 };
 
-static int dump_device(snd_ctl_t *handle, const char *id, const char *name,
+struct list_opts {
+	bool json;
+	bool cache;
+};
+
+static void print_json_string(FILE *out, const char *str)
+{
+	fputc('"', out);
+	for (; str != NULL && *str != '\0'; ++str) {
+		if (*str == '"' || *str == '\\')
+			fprintf(out, "\\%c", *str);
+		else if ((unsigned char)*str < 0x20)
+			fprintf(out, "\\u%04x", (unsigned char)*str);
+		else
+			fputc(*str, out);
+	}
+	fputc('"', out);
+}
+
+static int dump_device(FILE *out, bool json, snd_ctl_t *handle,
+		       const char *id, const char *name,
 		       snd_pcm_stream_t direction, snd_pcm_info_t *info)
 {
 	unsigned int count;
 	int i;
 	int err;
 
-	printf("card %i: %s [%s], device %i: %s [%s]\n",
-	       snd_pcm_info_get_card(info), id, name,
-	       snd_pcm_info_get_device(info), snd_pcm_info_get_id(info),
-	       snd_pcm_info_get_name(info));
-
 	count = snd_pcm_info_get_subdevices_count(info);
-	printf("  Subdevices: %i/%u\n",
-	       snd_pcm_info_get_subdevices_avail(info), count);
+
+	if (json) {
+		fprintf(out, "{\"device\":%i,\"id\":",
+			snd_pcm_info_get_device(info));
+		print_json_string(out, snd_pcm_info_get_id(info));
+		fprintf(out, ",\"name\":");
+		print_json_string(out, snd_pcm_info_get_name(info));
+		fprintf(out, ",\"subdevices_avail\":%i,\"subdevices_count\":%u,"
+			"\"subdevices\":[",
+			snd_pcm_info_get_subdevices_avail(info), count);
+	} else {
+		fprintf(out, "card %i: %s [%s], device %i: %s [%s]\n",
+			snd_pcm_info_get_card(info), id, name,
+			snd_pcm_info_get_device(info), snd_pcm_info_get_id(info),
+			snd_pcm_info_get_name(info));
+		fprintf(out, "  Subdevices: %i/%u\n",
+			snd_pcm_info_get_subdevices_avail(info), count);
+	}
 
 	for (i = 0; i < count; ++i) {
 		snd_pcm_info_set_subdevice(info, i);
 
 		err = snd_ctl_pcm_info(handle, info);
 		if (err < 0) {
-			printf("control digital audio playback info (%i): %s",
-			       snd_pcm_info_get_card(info), snd_strerror(err));
+			if (!json) {
+				fprintf(out,
+					"control digital audio playback info (%i): %s",
+					snd_pcm_info_get_card(info),
+					snd_strerror(err));
+			}
 			continue;
 		}
 
-		printf("  Subdevice #%i: %s\n",
-		       i, snd_pcm_info_get_subdevice_name(info));
+		if (json) {
+			fprintf(out, "%s{\"subdevice\":%i,\"name\":",
+				i > 0 ? "," : "", i);
+			print_json_string(out,
+					  snd_pcm_info_get_subdevice_name(info));
+			fputc('}', out);
+		} else {
+			fprintf(out, "  Subdevice #%i: %s\n",
+				i, snd_pcm_info_get_subdevice_name(info));
+		}
 	}
 
+	if (json)
+		fprintf(out, "]}");
+
 	return 0;
 }
 
-static int dump_devices(snd_ctl_t *handle, const char *id, const char *name,
+static int dump_devices(FILE *out, bool json, snd_ctl_t *handle,
+			const char *id, const char *name,
 			snd_pcm_stream_t direction)
 {
 	snd_pcm_info_t *info;
 	int device = -1;
+	int count = 0;
 	int err;
 
 	err = snd_pcm_info_malloc(&info);
@@ -76,7 +128,9 @@ static int dump_devices(snd_ctl_t *handle, const char *id, const char *name,
 		if (err < 0)
 			continue;
 
-		err = dump_device(handle, id, name, direction, info);
+		if (json && count++ > 0)
+			fputc(',', out);
+		err = dump_device(out, json, handle, id, name, direction, info);
 		if (err < 0)
 			break;
 	}
@@ -85,9 +139,10 @@ static int dump_devices(snd_ctl_t *handle, const char *id, const char *name,
 	return err;
 }
 
-static int list_devices(snd_pcm_stream_t direction)
+static int list_devices(FILE *out, bool json, snd_pcm_stream_t direction)
 {
 	int card = -1;
+	int count = 0;
 	char name[32];
 	snd_ctl_t *handle;
 	snd_ctl_card_info_t *info;
@@ -97,29 +152,53 @@ static int list_devices(snd_pcm_stream_t direction)
 	if (err < 0)
 		return err;
 
+	if (json) {
+		fprintf(out, "{\"direction\":\"%s\",\"cards\":[",
+			snd_pcm_stream_name(direction));
+	}
+
 	// Not found.
 	if (snd_card_next(&card) < 0 || card < 0)
 		goto end;
 
-	printf("**** List of %s Hardware Devices ****\n",
-	       snd_pcm_stream_name(direction));
+	if (!json) {
+		fprintf(out, "**** List of %s Hardware Devices ****\n",
+			snd_pcm_stream_name(direction));
+	}
 
 	while (card >= 0) {
 		sprintf(name, "hw:%d", card);
 		err = snd_ctl_open(&handle, name, 0);
 		if (err < 0) {
-			printf("control open (%i): %s",
-			       card, snd_strerror(err));
+			if (!json) {
+				fprintf(out, "control open (%i): %s",
+					card, snd_strerror(err));
+			}
 		} else {
 			err = snd_ctl_card_info(handle, info);
 			if (err < 0) {
-				printf("control hardware info (%i): %s",
-				       card, snd_strerror(err));
+				if (!json) {
+					fprintf(out,
+						"control hardware info (%i): %s",
+						card, snd_strerror(err));
+				}
 			} else {
-				err = dump_devices(handle,
+				if (json) {
+					fprintf(out, "%s{\"card\":%i,\"id\":",
+						count++ > 0 ? "," : "", card);
+					print_json_string(out,
+						snd_ctl_card_info_get_id(info));
+					fprintf(out, ",\"name\":");
+					print_json_string(out,
+						snd_ctl_card_info_get_name(info));
+					fprintf(out, ",\"devices\":[");
+				}
+				err = dump_devices(out, json, handle,
 					snd_ctl_card_info_get_id(info),
 					snd_ctl_card_info_get_name(info),
 					direction);
+				if (json)
+					fprintf(out, "]}");
 			}
 			snd_ctl_close(handle);
 		}
@@ -129,22 +208,184 @@ static int list_devices(snd_pcm_stream_t direction)
 
 		// Go to next.
 		if (snd_card_next(&card) < 0) {
-			printf("snd_card_next");
+			if (!json)
+				fprintf(out, "snd_card_next");
 			break;
 		}
 	}
 end:
+	if (json)
+		fprintf(out, "]}\n");
 	free(info);
 	return err;
 }
 
-static int list_pcms(snd_pcm_stream_t direction)
+// The key of cached device list. Any node added or removed under /dev/snd
+// changes the mtime of the directory, and any uevent of the system bumps the
+// sequence number. Without either of them, nothing is cached.
+static bool read_cache_key(char *key, size_t size, snd_pcm_stream_t direction,
+			   bool json)
+{
+	unsigned long long seqnum;
+	struct stat st;
+	FILE *fp;
+	int count;
+
+	if (stat("/dev/snd", &st) < 0)
+		return false;
+
+	fp = fopen("/sys/kernel/uevent_seqnum", "r");
+	if (fp == NULL)
+		return false;
+	count = fscanf(fp, "%llu", &seqnum);
+	fclose(fp);
+	if (count != 1)
+		return false;
+
+	snprintf(key, size, "%s %s %lld.%09ld %llu\n",
+		 snd_pcm_stream_name(direction), json ? "json" : "text",
+		 (long long)st.st_mtim.tv_sec, st.st_mtim.tv_nsec, seqnum);
+	return true;
+}
+
+static char *cache_path(snd_pcm_stream_t direction, bool json)
+{
+	const char *base = getenv("XDG_CACHE_HOME");
+	const char *subdir = "";
+	char *path;
+	int len;
+
+	if (base == NULL || *base == '\0') {
+		base = getenv("HOME");
+		subdir = "/.cache";
+		if (base == NULL || *base == '\0')
+			return NULL;
+	}
+
+	len = snprintf(NULL, 0, "%s%s/axfer/list-%s.%s", base, subdir,
+		       snd_pcm_stream_name(direction), json ? "json" : "txt");
+	path = malloc(len + 1);
+	if (path == NULL)
+		return NULL;
+	snprintf(path, len + 1, "%s%s/axfer/list-%s.%s", base, subdir,
+		 snd_pcm_stream_name(direction), json ? "json" : "txt");
+
+	return path;
+}
+
+// The first line of the cache file is the key, the rest is the output.
+static bool print_cached(const char *path, const char *key)
+{
+	char buf[4096];
+	size_t len;
+	bool hit = false;
+	FILE *fp;
+
+	fp = fopen(path, "r");
+	if (fp == NULL)
+		return false;
+
+	if (fgets(buf, sizeof(buf), fp) != NULL && !strcmp(buf, key)) {
+		while ((len = fread(buf, 1, sizeof(buf), fp)) > 0)
+			fwrite(buf, 1, len, stdout);
+		hit = !ferror(fp);
+	}
+
+	fclose(fp);
+	return hit;
+}
+
+// Written to a temporary file and renamed, so that concurrent runs read
+// either the old or the new list.
+static void store_cache(const char *path, const char *key, const char *data,
+			size_t size)
+{
+	char *tmp;
+	char *pos;
+	FILE *fp;
+	int len;
+
+	len = strlen(path) + 16;
+	tmp = malloc(len);
+	if (tmp == NULL)
+		return;
+
+	// Create the directories in the path.
+	snprintf(tmp, len, "%s", path);
+	for (pos = strchr(tmp + 1, '/'); pos != NULL; pos = strchr(pos + 1, '/')) {
+		*pos = '\0';
+		mkdir(tmp, 0700);
+		*pos = '/';
+	}
+
+	snprintf(tmp, len, "%s.%d", path, (int)getpid());
+	fp = fopen(tmp, "w");
+	if (fp == NULL)
+		goto end;
+	fputs(key, fp);
+	fwrite(data, 1, size, fp);
+	if (fclose(fp) != 0 || rename(tmp, path) < 0)
+		unlink(tmp);
+end:
+	free(tmp);
+}
+
+static int list_devices_cached(const struct list_opts *opts,
+			       snd_pcm_stream_t direction)
+{
+	char key[128];
+	char *path = NULL;
+	char *data = NULL;
+	size_t size = 0;
+	FILE *out;
+	int err;
+
+	if (!opts->cache)
+		return list_devices(stdout, opts->json, direction);
+
+	if (read_cache_key(key, sizeof(key), direction, opts->json))
+		path = cache_path(direction, opts->json);
+	if (path == NULL)
+		return list_devices(stdout, opts->json, direction);
+
+	if (print_cached(path, key)) {
+		free(path);
+		return 0;
+	}
+
+	out = open_memstream(&data, &size);
+	if (out == NULL) {
+		free(path);
+		return -ENOMEM;
+	}
+	err = list_devices(out, opts->json, direction);
+	if (fclose(out) != 0) {
+		err = -ENOMEM;
+	} else {
+		fwrite(data, 1, size, stdout);
+		// The list changed while it was dumped, if the key changed.
+		if (err >= 0) {
+			char now[128];
+
+			if (read_cache_key(now, sizeof(now), direction,
+					   opts->json) && !strcmp(key, now))
+				store_cache(path, key, data, size);
+		}
+	}
+
+	free(data);
+	free(path);
+	return err;
+}
+
+static int list_pcms(bool json, snd_pcm_stream_t direction)
 {
 	static const char *const filters[] = {
 		[SND_PCM_STREAM_CAPTURE]	= "Input",
 		[SND_PCM_STREAM_PLAYBACK]	= "Output",
 	};
 	const char *filter;
+	int count = 0;
 	void **hints;
 	void **n;
 	char *io;
@@ -156,6 +397,11 @@ static int list_pcms(snd_pcm_stream_t direction)
 
 	filter = filters[direction];
 
+	if (json) {
+		printf("{\"direction\":\"%s\",\"pcms\":[",
+		       snd_pcm_stream_name(direction));
+	}
+
 	for (n = hints; *n != NULL; ++n) {
 		io = snd_device_name_get_hint(*n, "IOID");
 		if (io != NULL && strcmp(io, filter) != 0) {
@@ -163,9 +409,24 @@ static int list_pcms(snd_pcm_stream_t direction)
 			continue;
 		}
 
+		free(io);
+
 		name = snd_device_name_get_hint(*n, "NAME");
 		desc = snd_device_name_get_hint(*n, "DESC");
 
+		if (json) {
+			printf("%s{\"name\":", count++ > 0 ? "," : "");
+			print_json_string(stdout, name);
+			if (desc != NULL) {
+				printf(",\"description\":");
+				print_json_string(stdout, desc);
+			}
+			printf("}");
+			free(name);
+			free(desc);
+			continue;
+		}
+
 		printf("%s\n", name);
 		if (desc == NULL) {
 			free(name);
@@ -185,6 +446,9 @@ static int list_pcms(snd_pcm_stream_t direction)
 		putchar('\n');
 	}
 
+	if (json)
+		printf("]}\n");
+
 	snd_device_name_free_hint(hints);
 
 	return 0;
@@ -199,6 +463,11 @@ static void print_help(void)
 "  where:\n"
 "    DIRECTION = capture | playback\n"
 "    TARGET = device | pcm\n"
+"\n"
+"  options:\n"
+"    -j, --json     print the list as JSON\n"
+"    -c, --cache    reuse the device list until a device node or uevent\n"
+"                   changes\n"
 	);
 }
 
@@ -252,20 +521,51 @@ static int detect_operation(int argc, char *const *argv, enum list_op *op)
 	return false;
 }
 
+// In the compatible mode, the short options are the ones of aplay(1).
+static void parse_options(int argc, char *const *argv, bool compat,
+			  struct list_opts *opts)
+{
+	const char *s_opts = compat ? "" : "jc";
+	static const struct option l_opts[] = {
+		{"json",	0, NULL, 'j'},
+		{"cache",	0, NULL, 'c'},
+		{NULL,		0, NULL, 0}
+	};
+
+	optind = 0;
+	opterr = 0;
+	while (1) {
+		int c = getopt_long(argc, argv, s_opts, l_opts, NULL);
+		if (c < 0)
+			break;
+		if (c == 'j')
+			opts->json = true;
+		else if (c == 'c')
+			opts->cache = true;
+	}
+}
+
 int subcmd_list(int argc, char *const *argv, snd_pcm_stream_t direction)
 {
+	struct list_opts opts = {0};
 	enum list_op op = LIST_OP_HELP;
+	bool compat = false;
 	int err = 0;
 
 	// Renewed command system.
-	if (!detect_operation(argc, argv, &op) &&
-	    !decide_operation(argc, argv, &op))
+	if (!detect_operation(argc, argv, &op)) {
+		compat = true;
+		if (!decide_operation(argc, argv, &op))
 			err = -EINVAL;
+	}
+
+	if (op != LIST_OP_HELP)
+		parse_options(argc, argv, compat, &opts);
 
 	if (op == LIST_OP_DEVICE)
-		err = list_devices(direction);
+		err = list_devices_cached(&opts, direction);
 	else if (op == LIST_OP_PCM)
-		err = list_pcms(direction);
+		err = list_pcms(opts.json, direction);
 	else
 		print_help();
 
@@ -9,9 +9,11 @@
 #include "xfer.h"
 #include "subcmd.h"
 #include "misc.h"
+#include "probes.h"
 
 #include <signal.h>
 #include <inttypes.h>
+#include <sys/stat.h>
 
 struct context {
 	struct xfer_context xfer;
@@ -21,6 +23,11 @@ struct context {
 
 	int *cntr_fds;
 
+	unsigned int iteration_count;
+
+	// For split mode of silence.
+	unsigned int split_count;
+
 	// NOTE: To handling Unix signal.
 	bool interrupted;
 	int signal;
@@ -95,6 +102,28 @@ static void handle_unix_signal_for_suspend(int sig)
 	xfer_context_pause(&ctx_ptr->xfer, false);
 }
 
+// The recorders are triggered by the loop of transmission.
+static volatile sig_atomic_t recorder_trigger_requested;
+
+static void handle_unix_signal_for_recorder(int sig)
+{
+	recorder_trigger_requested = 1;
+}
+
+// Available after the containers are prepared.
+static int prepare_recorder_signal_handler(struct context *ctx)
+{
+	struct sigaction sa = {0};
+
+	sigemptyset(&sa.sa_mask);
+	sa.sa_flags = SA_RESTART;
+	sa.sa_handler = handle_unix_signal_for_recorder;
+	if (sigaction(SIGUSR1, &sa, NULL) < 0)
+		return -errno;
+
+	return 0;
+}
+
 static int prepare_signal_handler(struct context *ctx)
 {
 	struct sigaction sa = {0};
@@ -162,6 +191,159 @@ static int allocate_containers(struct context *ctx, unsigned int count)
 	return 0;
 }
 
+// The number of data frames in the existing file is calculated by the length
+// of file, thus it doesn't matter whether the header was updated or not.
+static int probe_resumed_file(struct context *ctx, const char *path, int fd,
+			      snd_pcm_format_t format, unsigned int channels,
+			      unsigned int rate, off64_t *offset,
+			      uint64_t *frame_count)
+{
+	struct container_context cntr = {0};
+	snd_pcm_format_t detected_format = SND_PCM_FORMAT_UNKNOWN;
+	unsigned int detected_channels = 0;
+	unsigned int detected_rate = 0;
+	unsigned int bytes_per_frame;
+	uint64_t byte_count;
+	struct stat st;
+	int err = 0;
+
+	*offset = 0;
+	*frame_count = 0;
+
+	if (fstat(fd, &st) < 0)
+		return -errno;
+	// A new file.
+	if (!S_ISREG(st.st_mode) || st.st_size == 0)
+		return 0;
+
+	if (ctx->xfer.cntr_format != CONTAINER_FORMAT_RAW) {
+		err = container_parser_init(&cntr, fd, 0);
+		if (err < 0)
+			goto end;
+		if (cntr.format != ctx->xfer.cntr_format) {
+			fprintf(stderr,
+				"The type of '%s' is different from the "
+				"given one.\n", path);
+			err = -EINVAL;
+			goto end;
+		}
+
+		err = container_context_pre_process(&cntr, &detected_format,
+						    &detected_channels,
+						    &detected_rate, &byte_count);
+		if (err < 0)
+			goto end;
+
+		if (detected_format != format || detected_channels != channels ||
+		    detected_rate != rate) {
+			fprintf(stderr,
+				"The parameters of '%s' are different from the "
+				"ones of transmission.\n", path);
+			err = -EINVAL;
+			goto end;
+		}
+
+		*offset = lseek64(fd, 0, SEEK_CUR);
+		if (*offset < 0) {
+			err = -errno;
+			goto end;
+		}
+	}
+
+	bytes_per_frame = snd_pcm_format_physical_width(format) / 8 * channels;
+	byte_count = st.st_size - *offset;
+	*frame_count = byte_count / bytes_per_frame;
+
+	// The builder writes the header again.
+	if (lseek64(fd, 0, SEEK_SET) < 0)
+		err = -errno;
+end:
+	container_context_destroy(&cntr);
+	return err;
+}
+
+// The name of the file has sequential number before the suffix.
+static char *numbered_path(const char *path, enum container_format format,
+			   unsigned int number)
+{
+	const char *suffix = container_suffix_from_format(format);
+	unsigned int base_len = strlen(path);
+	unsigned int len;
+	char *next;
+
+	if (base_len > strlen(suffix) &&
+	    !strcmp(path + base_len - strlen(suffix), suffix))
+		base_len -= strlen(suffix);
+	else
+		suffix = "";
+
+	len = base_len + strlen(suffix) + 12;
+	next = malloc(len);
+	if (next != NULL)
+		snprintf(next, len, "%.*s-%u%s", base_len, path, number, suffix);
+
+	return next;
+}
+
+// In split mode of silence, the next file has sequential number in its name.
+static int open_next_file(struct container_context *cntr, void *private_data,
+			  int *fd)
+{
+	struct context *ctx = private_data;
+	unsigned int index = cntr - ctx->cntrs;
+	char *next;
+	int err = 0;
+
+	next = numbered_path(ctx->xfer.paths[index], ctx->xfer.cntr_format,
+			     ++ctx->split_count);
+	if (next == NULL)
+		return -ENOMEM;
+
+	*fd = open(next, O_RDWR | O_CREAT | O_TRUNC, 0644);
+	if (*fd < 0) {
+		err = -errno;
+		fprintf(stderr, "Fail to open '%s': %s\n", next,
+			strerror(-err));
+	} else {
+		close(ctx->cntr_fds[index]);
+		ctx->cntr_fds[index] = *fd;
+		if (ctx->xfer.verbose > 0)
+			fprintf(stderr, "Next file: %s\n", next);
+	}
+
+	free(next);
+
+	return err;
+}
+
+// In the thread of recorder, each dump has sequential number in its name.
+static int open_dump_file(struct container_context *cntr, void *private_data,
+			  unsigned int number, int *fd)
+{
+	struct context *ctx = private_data;
+	unsigned int index = cntr - ctx->cntrs;
+	char *path;
+	int err = 0;
+
+	path = numbered_path(ctx->xfer.paths[index], ctx->xfer.cntr_format,
+			     number);
+	if (path == NULL)
+		return -ENOMEM;
+
+	*fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+	if (*fd < 0) {
+		err = -errno;
+		fprintf(stderr, "Fail to open '%s': %s\n", path,
+			strerror(-err));
+	} else if (ctx->xfer.verbose > 0) {
+		fprintf(stderr, "Dump file: %s\n", path);
+	}
+
+	free(path);
+
+	return err;
+}
+
 static int capture_pre_process(struct context *ctx, snd_pcm_access_t *access,
 			       snd_pcm_uframes_t *frames_per_buffer,
 			       uint64_t *total_frame_count)
@@ -179,12 +361,19 @@ static int capture_pre_process(struct context *ctx, snd_pcm_access_t *access,
 	if (err < 0)
 		return err;
 
+	// The format of samples in files can be different from the one of
+	// PCM substream.
+	sample_format = ctx->xfer.cntr_sample_format;
+
 	// Prepare for containers.
 	err = allocate_containers(ctx, ctx->xfer.path_count);
 	if (err < 0)
 		return err;
 
-	if (ctx->cntr_count > 1)
+	// A container for each device, or each channel.
+	if (ctx->xfer.device_count > 1)
+		channels = samples_per_frame / ctx->xfer.device_count;
+	else if (ctx->cntr_count > 1)
 		channels = 1;
 	else
 		channels = samples_per_frame;
@@ -194,19 +383,40 @@ static int capture_pre_process(struct context *ctx, snd_pcm_access_t *access,
 		const char *path = ctx->xfer.paths[i];
 		int fd;
 		uint64_t frame_count;
+		uint64_t resumed_frame_count = 0;
+		off64_t data_offset = 0;
 
 		if (!strcmp(path, "-")) {
 			fd = fileno(stdout);
+		} else if (ctx->xfer.recorder) {
+			// Data frames are kept in the ring of recorder.
+			fd = open("/dev/null", O_WRONLY);
+			if (fd < 0)
+				return -errno;
 		} else {
-			fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+			int mode = O_RDWR | O_CREAT;
+
+			if (!ctx->xfer.resume)
+				mode |= O_TRUNC;
+			fd = open(path, mode, 0644);
 			if (fd < 0)
 				return -errno;
 		}
 		ctx->cntr_fds[i] = fd;
 
+		if (ctx->xfer.resume) {
+			err = probe_resumed_file(ctx, path, fd, sample_format,
+						 channels, frames_per_second,
+						 &data_offset,
+						 &resumed_frame_count);
+			if (err < 0)
+				return err;
+		}
+
 		err = container_builder_init(ctx->cntrs + i, ctx->cntr_fds[i],
-					     ctx->xfer.cntr_format,
-					     ctx->xfer.verbose > 1);
+				ctx->xfer.recorder ? CONTAINER_FORMAT_RAW :
+						     ctx->xfer.cntr_format,
+				ctx->xfer.verbose > 1);
 		if (err < 0)
 			return err;
 
@@ -217,6 +427,52 @@ static int capture_pre_process(struct context *ctx, snd_pcm_access_t *access,
 		if (err < 0)
 			return err;
 
+		if (resumed_frame_count > 0) {
+			// Data frames should follow the header at the same
+			// position.
+			if (lseek64(fd, 0, SEEK_CUR) != data_offset) {
+				fprintf(stderr,
+					"The header of '%s' is not available to "
+					"resume.\n", path);
+				return -EINVAL;
+			}
+
+			if (resumed_frame_count >= frame_count) {
+				fprintf(stderr,
+					"'%s' has already %" PRIu64 " frames, "
+					"as many as requested.\n", path,
+					resumed_frame_count);
+				return -EINVAL;
+			}
+
+			err = container_context_resume(ctx->cntrs + i,
+						       resumed_frame_count);
+			if (err < 0)
+				return err;
+			frame_count -= resumed_frame_count;
+		}
+
+		if (ctx->xfer.silence) {
+			err = container_context_enable_silence(ctx->cntrs + i,
+					sample_format,
+					ctx->xfer.silence_threshold_db,
+					ctx->xfer.silence_duration_msec,
+					ctx->xfer.silence_mode,
+					open_next_file, ctx);
+			if (err < 0)
+				return err;
+		}
+
+		if (ctx->xfer.recorder) {
+			err = container_context_enable_recorder(ctx->cntrs + i,
+					sample_format, ctx->xfer.cntr_format,
+					ctx->xfer.recorder_seconds * 1000,
+					ctx->xfer.recorder_post_roll_seconds * 1000,
+					open_dump_file, ctx);
+			if (err < 0)
+				return err;
+		}
+
 		if (*total_frame_count == 0)
 			*total_frame_count = frame_count;
 		if (frame_count < *total_frame_count)
@@ -263,6 +519,27 @@ static int playback_pre_process(struct context *ctx, snd_pcm_access_t *access,
 		if (err < 0)
 			return err;
 
+		if (ctx->xfer.block_index && strcmp(path, "-") &&
+		    ctx->cntrs[i].format == CONTAINER_FORMAT_VOC) {
+			char *index_path;
+
+			index_path = malloc(strlen(path) + sizeof(".idx"));
+			if (index_path == NULL)
+				return -ENOMEM;
+			sprintf(index_path, "%s.idx", path);
+			err = container_parser_set_index_path(ctx->cntrs + i,
+							      index_path);
+			free(index_path);
+			if (err < 0)
+				return err;
+		}
+
+		err = container_parser_set_start_position(ctx->cntrs + i,
+							  ctx->xfer.start_frame,
+							  ctx->xfer.start_usec);
+		if (err < 0)
+			return err;
+
 		if (i == 0) {
 			// For a raw container.
 			format = ctx->xfer.sample_format;
@@ -353,7 +630,7 @@ static int context_pre_process(struct context *ctx, snd_pcm_stream_t direction,
 		return err;
 
 	bytes_per_sample =
-		snd_pcm_format_physical_width(ctx->xfer.sample_format) / 8;
+		snd_pcm_format_physical_width(ctx->xfer.cntr_sample_format) / 8;
 	if (bytes_per_sample <= 0)
 		return -ENXIO;
 	err = mapper_context_pre_process(&ctx->mapper, access, bytes_per_sample,
@@ -362,8 +639,106 @@ static int context_pre_process(struct context *ctx, snd_pcm_stream_t direction,
 	if (err < 0)
 		return err;
 
+	if (ctx->xfer.cntr_sample_format != ctx->xfer.sample_format) {
+		err = mapper_context_enable_conversion(&ctx->mapper,
+						ctx->xfer.sample_format,
+						ctx->xfer.cntr_sample_format);
+		if (err < 0)
+			return err;
+	}
+
+	if (ctx->xfer.file_worker_count > 0) {
+		err = mapper_context_enable_workers(&ctx->mapper,
+						    ctx->xfer.file_worker_count);
+		if (err < 0)
+			return err;
+	}
+
+#if WITH_LIBURING
+	if (ctx->xfer.cntr_io_type == CONTAINER_IO_TYPE_IO_URING) {
+		int i;
+
+		for (i = 0; i < ctx->cntr_count; ++i) {
+			err = container_context_enable_io_uring(ctx->cntrs + i,
+						ctx->xfer.cntr_io_depth,
+						frames_per_buffer);
+			if (err < 0)
+				return err;
+		}
+	}
+#endif
+
+	if (ctx->xfer.cntr_io_type == CONTAINER_IO_TYPE_MMAP) {
+		int i;
+
+		for (i = 0; i < ctx->cntr_count; ++i) {
+			err = container_context_enable_mmap(ctx->cntrs + i);
+			if (err < 0)
+				return err;
+		}
+	} else if (ctx->xfer.cntr_io_type == CONTAINER_IO_TYPE_THREAD) {
+		int i;
+
+		for (i = 0; i < ctx->cntr_count; ++i) {
+			err = container_context_enable_thread(ctx->cntrs + i,
+						ctx->xfer.cntr_io_depth,
+						frames_per_buffer);
+			if (err < 0)
+				return err;
+		}
+	} else if (ctx->xfer.cntr_io_type == CONTAINER_IO_TYPE_DIRECT) {
+		int i;
+
+		for (i = 0; i < ctx->cntr_count; ++i) {
+			err = container_context_enable_direct(ctx->cntrs + i,
+							      frames_per_buffer);
+			if (err < 0)
+				return err;
+		}
+	} else if (ctx->xfer.cntr_io_type == CONTAINER_IO_TYPE_SPLICE) {
+		int i;
+
+		for (i = 0; i < ctx->cntr_count; ++i) {
+			err = container_context_enable_splice(ctx->cntrs + i);
+			if (err < 0)
+				return err;
+		}
+	}
+
 	xfer_options_calculate_duration(&ctx->xfer, total_frame_count);
 
+	if (ctx->xfer.preallocate) {
+		int i;
+
+		for (i = 0; i < ctx->cntr_count; ++i) {
+			err = container_context_preallocate(ctx->cntrs + i,
+							    *total_frame_count);
+			// Not fatal.
+			if (err < 0 && ctx->xfer.verbose > 0) {
+				fprintf(stderr,
+					"Fail to preallocate '%s': %s\n",
+					ctx->xfer.paths[i], strerror(-err));
+			}
+		}
+	}
+
+	return 0;
+}
+
+static int context_checkpoint(struct context *ctx)
+{
+	int i;
+	int err;
+
+	for (i = 0; i < ctx->cntr_count; ++i) {
+		err = container_context_checkpoint(ctx->cntrs + i);
+		if (err < 0) {
+			fprintf(stderr, "Fail to update the header of '%s': %s\n",
+				ctx->xfer.paths[i], strerror(-err));
+			return err;
+		}
+	}
+
 	return 0;
 }
 
@@ -374,9 +749,14 @@ static int context_process_frames(struct context *ctx,
 {
 	bool verbose = ctx->xfer.verbose > 2;
 	unsigned int frame_count;
+	uint64_t checkpoint_interval;
+	uint64_t pending_frame_count = 0;
 	int i;
 	int err = 0;
 
+	checkpoint_interval = (uint64_t)ctx->xfer.checkpoint_seconds *
+			      ctx->xfer.frames_per_second;
+
 	if (!ctx->xfer.quiet) {
 		fprintf(stderr,
 			"%s: Format '%s', Rate %u Hz, Channels ",
@@ -396,10 +776,14 @@ static int context_process_frames(struct context *ctx,
 	while (!ctx->interrupted) {
 		struct container_context *cntr;
 
+		++ctx->iteration_count;
+
 		// Tell remains to expected frame count.
 		frame_count = expected_frame_count - *actual_frame_count;
 		err = xfer_context_process_frames(&ctx->xfer, &ctx->mapper,
 						  ctx->cntrs, &frame_count);
+		PROBE3(axfer, process_frames, *actual_frame_count,
+		       err < 0 ? 0 : frame_count, err);
 		if (err < 0) {
 			if (err == -EAGAIN || err == -EINTR)
 				continue;
@@ -420,6 +804,22 @@ static int context_process_frames(struct context *ctx,
 		*actual_frame_count += frame_count;
 		if (*actual_frame_count >= expected_frame_count)
 			break;
+
+		if (recorder_trigger_requested) {
+			recorder_trigger_requested = 0;
+			for (i = 0; i < ctx->cntr_count; ++i)
+				container_context_trigger_recorder(ctx->cntrs + i);
+		}
+
+		if (checkpoint_interval > 0) {
+			pending_frame_count += frame_count;
+			if (pending_frame_count >= checkpoint_interval) {
+				pending_frame_count = 0;
+				err = context_checkpoint(ctx);
+				if (err < 0)
+					break;
+			}
+		}
 	}
 
 	if (!ctx->xfer.quiet) {
@@ -446,6 +846,10 @@ static void context_post_process(struct context *ctx,
 
 	xfer_context_post_process(&ctx->xfer);
 
+	// The recorder is released with the containers.
+	if (ctx->xfer.recorder)
+		signal(SIGUSR1, SIG_IGN);
+
 	if (ctx->cntrs) {
 		for (i = 0; i < ctx->cntr_count; ++i) {
 			container_context_post_process(ctx->cntrs + i,
@@ -470,7 +874,9 @@ static void context_destroy(struct context *ctx)
 	xfer_context_destroy(&ctx->xfer);
 }
 
-int subcmd_transfer(int argc, char *const *argv, snd_pcm_stream_t direction)
+int subcmd_transfer_with_stats(int argc, char *const *argv,
+			       snd_pcm_stream_t direction,
+			       struct subcmd_transfer_stats *stats)
 {
 	struct context ctx = {0};
 	uint64_t expected_frame_count = 0;
@@ -491,12 +897,29 @@ int subcmd_transfer(int argc, char *const *argv, snd_pcm_stream_t direction)
 	if (err < 0)
 		goto end;
 
+	if (ctx.xfer.recorder) {
+		err = prepare_recorder_signal_handler(&ctx);
+		if (err < 0)
+			goto end;
+	}
+
 	err = context_process_frames(&ctx, direction, expected_frame_count,
 				     &actual_frame_count);
 end:
+	if (stats) {
+		stats->frame_count = actual_frame_count;
+		stats->iteration_count = ctx.iteration_count;
+		stats->xrun_count = ctx.xfer.xrun_count;
+	}
+
 	context_post_process(&ctx, actual_frame_count);
 
 	context_destroy(&ctx);
 
 	return err;
 }
+
+int subcmd_transfer(int argc, char *const *argv, snd_pcm_stream_t direction)
+{
+	return subcmd_transfer_with_stats(argc, argv, direction, NULL);
+}
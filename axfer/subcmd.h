@@ -11,8 +11,19 @@
 
 #include <alsa/asoundlib.h>
 
+struct subcmd_transfer_stats {
+	uint64_t frame_count;
+	unsigned int iteration_count;
+	unsigned int xrun_count;
+};
+
 int subcmd_list(int argc, char *const *argv, snd_pcm_stream_t direction);
 
 int subcmd_transfer(int argc, char *const *argv, snd_pcm_stream_t direction);
+int subcmd_transfer_with_stats(int argc, char *const *argv,
+			       snd_pcm_stream_t direction,
+			       struct subcmd_transfer_stats *stats);
+
+int subcmd_bench(int argc, char *const *argv, snd_pcm_stream_t direction);
 
 #endif
@@ -0,0 +1,774 @@
+// SPDX-License-Identifier: GPL-2.0
+//
+// benchmark.c - a benchmark for throughput of containers and mappers.
+//
+// Copyright (c) 2026 agent <agent@local>
+//
+// Licensed under the terms of the GNU General Public License, version 2.
+
+#include <aconfig.h>
+#ifdef HAVE_MEMFD_CREATE
+#define _GNU_SOURCE
+#endif
+
+#include "../mapper.h"
+#include "../misc.h"
+
+#include "generator.h"
+#include "sample-kernels.h"
+#include "bench.h"
+
+#ifdef HAVE_MEMFD_CREATE
+#include <sys/mman.h>
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <stdbool.h>
+
+#include <assert.h>
+
+// The amount of bytes pushed through each trial by default.
+#define DEFAULT_MEGABYTES	8
+
+// Print one JSON object per trial instead of the table, for tracking.
+static bool json;
+
+static const char *const cntr_format_names[] = {
+	[CONTAINER_FORMAT_RIFF_WAVE] = "riff/wave",
+	[CONTAINER_FORMAT_AU] = "au",
+	[CONTAINER_FORMAT_VOC] = "voc",
+	[CONTAINER_FORMAT_RF64] = "rf64",
+	[CONTAINER_FORMAT_W64] = "wave64",
+	[CONTAINER_FORMAT_RAW] = "raw",
+};
+
+struct bench_trial {
+	enum container_format cntr_format;
+	uint64_t byte_count;
+};
+
+// The fields identifying a trial; the keys keep the same order in each run.
+static void print_trial(const char *suite, const char *name,
+			snd_pcm_format_t sample_format,
+			unsigned int samples_per_frame, unsigned int frame_count)
+{
+	if (json) {
+		printf("{ \"suite\": \"%s\", \"name\": \"%s\", "
+		       "\"format\": \"%s\", \"channels\": %u, "
+		       "\"frames\": %u",
+		       suite, name, snd_pcm_format_name(sample_format),
+		       samples_per_frame, frame_count);
+		return;
+	}
+
+	printf("%-10s %-10s %3u %6u", name, snd_pcm_format_name(sample_format),
+	       samples_per_frame, frame_count);
+}
+
+static int open_fd(const char *name)
+{
+	int fd;
+
+#ifdef HAVE_MEMFD_CREATE
+	fd = memfd_create(name, 0);
+#else
+	fd = open(name, O_RDWR | O_CREAT | O_TRUNC, 0644);
+#endif
+	if (fd < 0)
+		return -errno;
+
+	return fd;
+}
+
+static int rewind_fd(int fd)
+{
+	if (lseek64(fd, 0, SEEK_SET) < 0)
+		return -errno;
+	return 0;
+}
+
+static void bench_builder(struct container_context *cntr, int fd,
+			  enum container_format format,
+			  snd_pcm_format_t sample_format,
+			  unsigned int samples_per_frame,
+			  void *frame_buffer, unsigned int frame_count,
+			  unsigned int repeat_count, struct bench_cost *cost)
+{
+	snd_pcm_format_t sample = sample_format;
+	unsigned int channels = samples_per_frame;
+	unsigned int rate = 48000;
+	uint64_t max_frame_count = 0;
+	uint64_t total_frame_count;
+	unsigned int bytes_per_frame;
+	int i;
+	int err;
+
+	err = container_builder_init(cntr, fd, format, 0);
+	assert(err == 0);
+
+	err = container_context_pre_process(cntr, &sample, &channels, &rate,
+					    &max_frame_count);
+	assert(err == 0);
+	assert(max_frame_count >= (uint64_t)frame_count * repeat_count);
+
+	bytes_per_frame = cntr->bytes_per_sample * cntr->samples_per_frame;
+
+	for (i = 0; i < repeat_count; ++i) {
+		unsigned int handled_frame_count = frame_count;
+
+		bench_cost_begin(cost);
+		err = container_context_process_frames(cntr, frame_buffer,
+						       &handled_frame_count);
+		bench_cost_end(cost, handled_frame_count, bytes_per_frame);
+		assert(err == 0);
+		assert(handled_frame_count == frame_count);
+	}
+
+	err = container_context_post_process(cntr, &total_frame_count);
+	assert(err == 0);
+	assert(total_frame_count == (uint64_t)frame_count * repeat_count);
+
+	container_context_destroy(cntr);
+}
+
+static void bench_parser(struct container_context *cntr, int fd,
+			 snd_pcm_format_t sample_format,
+			 unsigned int samples_per_frame,
+			 void *frame_buffer, void *check_buffer,
+			 unsigned int frame_count, unsigned int repeat_count,
+			 struct bench_cost *cost)
+{
+	snd_pcm_format_t sample = sample_format;
+	unsigned int channels = samples_per_frame;
+	unsigned int rate = 48000;
+	uint64_t total_frame_count;
+	unsigned int bytes_per_frame;
+	int i;
+	int err;
+
+	err = container_parser_init(cntr, fd, 0);
+	assert(err == 0);
+
+	err = container_context_pre_process(cntr, &sample, &channels, &rate,
+					    &total_frame_count);
+	assert(err == 0);
+	assert(sample == sample_format);
+	assert(channels == samples_per_frame);
+	assert(total_frame_count == (uint64_t)frame_count * repeat_count);
+
+	bytes_per_frame = cntr->bytes_per_sample * cntr->samples_per_frame;
+
+	for (i = 0; i < repeat_count; ++i) {
+		unsigned int handled_frame_count = frame_count;
+
+		bench_cost_begin(cost);
+		err = container_context_process_frames(cntr, check_buffer,
+						       &handled_frame_count);
+		bench_cost_end(cost, handled_frame_count, bytes_per_frame);
+		assert(err == 0);
+		assert(handled_frame_count == frame_count);
+
+		err = memcmp(frame_buffer, check_buffer,
+			     frame_count * bytes_per_frame);
+		assert(err == 0);
+	}
+
+	err = container_context_post_process(cntr, &total_frame_count);
+	assert(err == 0);
+
+	container_context_destroy(cntr);
+}
+
+static int bench_container(struct test_generator *gen,
+			   snd_pcm_access_t access,
+			   snd_pcm_format_t sample_format,
+			   unsigned int samples_per_frame, void *frame_buffer,
+			   unsigned int frame_count)
+{
+	struct bench_trial *trial = gen->private_data;
+	struct container_context cntr = {0};
+	struct bench_cost write_cost = {0};
+	struct bench_cost read_cost = {0};
+	unsigned int size;
+	unsigned int repeat_count;
+	void *buf;
+	int fd;
+	int err;
+
+	size = frame_count * samples_per_frame *
+			snd_pcm_format_physical_width(sample_format) / 8;
+	repeat_count = (trial->byte_count + size - 1) / size;
+
+	buf = malloc(size);
+	if (buf == NULL)
+		return -ENOMEM;
+
+	fd = open_fd("benchmark");
+	if (fd < 0) {
+		free(buf);
+		return fd;
+	}
+
+	bench_builder(&cntr, fd, trial->cntr_format, sample_format,
+		      samples_per_frame, frame_buffer, frame_count,
+		      repeat_count, &write_cost);
+
+	err = rewind_fd(fd);
+	if (err < 0)
+		goto end;
+
+	bench_parser(&cntr, fd, sample_format, samples_per_frame, frame_buffer,
+		     buf, frame_count, repeat_count, &read_cost);
+
+	print_trial("container", cntr_format_names[trial->cntr_format],
+		    sample_format, samples_per_frame, frame_count);
+	bench_print_cost("write", &write_cost, json);
+	bench_print_cost("read", &read_cost, json);
+	printf(json ? " }\n" : "\n");
+end:
+	close(fd);
+	free(buf);
+
+	return err;
+}
+
+static void bench_demuxer(struct container_context *cntrs,
+			  unsigned int cntr_count, int *fds,
+			  snd_pcm_access_t access,
+			  snd_pcm_format_t sample_format,
+			  unsigned int samples_per_frame,
+			  void *frame_buffer, unsigned int frame_count,
+			  unsigned int repeat_count, struct bench_cost *cost)
+{
+	struct mapper_context mapper = {0};
+	unsigned int bytes_per_sample;
+	uint64_t total_frame_count;
+	int i;
+	int err;
+
+	for (i = 0; i < cntr_count; ++i) {
+		snd_pcm_format_t format = sample_format;
+		unsigned int channels;
+		unsigned int rate = 48000;
+
+		if (cntr_count > 1)
+			channels = 1;
+		else
+			channels = samples_per_frame;
+
+		err = container_builder_init(cntrs + i, fds[i],
+					     CONTAINER_FORMAT_RAW, 0);
+		assert(err == 0);
+		err = container_context_pre_process(cntrs + i, &format,
+						    &channels, &rate,
+						    &total_frame_count);
+		assert(err == 0);
+	}
+
+	bytes_per_sample = snd_pcm_format_physical_width(sample_format) / 8;
+
+	err = mapper_context_init(&mapper, MAPPER_TYPE_DEMUXER, cntr_count, 0);
+	assert(err == 0);
+	err = mapper_context_pre_process(&mapper, access, bytes_per_sample,
+					 samples_per_frame, frame_count, cntrs);
+	assert(err == 0);
+
+	for (i = 0; i < repeat_count; ++i) {
+		unsigned int handled_frame_count = frame_count;
+
+		bench_cost_begin(cost);
+		err = mapper_context_process_frames(&mapper, frame_buffer,
+						    &handled_frame_count,
+						    cntrs);
+		bench_cost_end(cost, handled_frame_count,
+			       bytes_per_sample * samples_per_frame);
+		assert(err == 0);
+		assert(handled_frame_count == frame_count);
+	}
+
+	mapper_context_post_process(&mapper);
+	mapper_context_destroy(&mapper);
+
+	for (i = 0; i < cntr_count; ++i) {
+		container_context_post_process(cntrs + i, &total_frame_count);
+		assert(total_frame_count == (uint64_t)frame_count * repeat_count);
+		container_context_destroy(cntrs + i);
+	}
+}
+
+static void bench_muxer(struct container_context *cntrs,
+			unsigned int cntr_count, int *fds,
+			snd_pcm_access_t access,
+			snd_pcm_format_t sample_format,
+			unsigned int samples_per_frame,
+			void *frame_buffer, void *check_buffer,
+			unsigned int frame_count, unsigned int repeat_count,
+			struct bench_cost *cost)
+{
+	struct mapper_context mapper = {0};
+	unsigned int bytes_per_sample;
+	uint64_t total_frame_count;
+	int i;
+	int err;
+
+	for (i = 0; i < cntr_count; ++i) {
+		snd_pcm_format_t format = sample_format;
+		unsigned int channels;
+		unsigned int rate = 48000;
+
+		if (cntr_count > 1)
+			channels = 1;
+		else
+			channels = samples_per_frame;
+
+		err = container_parser_init(cntrs + i, fds[i], 0);
+		assert(err == 0);
+		err = container_context_pre_process(cntrs + i, &format,
+						    &channels, &rate,
+						    &total_frame_count);
+		assert(err == 0);
+		assert(total_frame_count == (uint64_t)frame_count * repeat_count);
+	}
+
+	bytes_per_sample = snd_pcm_format_physical_width(sample_format) / 8;
+
+	err = mapper_context_init(&mapper, MAPPER_TYPE_MUXER, cntr_count, 0);
+	assert(err == 0);
+	err = mapper_context_pre_process(&mapper, access, bytes_per_sample,
+					 samples_per_frame, frame_count, cntrs);
+	assert(err == 0);
+
+	for (i = 0; i < repeat_count; ++i) {
+		unsigned int handled_frame_count = frame_count;
+
+		bench_cost_begin(cost);
+		err = mapper_context_process_frames(&mapper, check_buffer,
+						    &handled_frame_count,
+						    cntrs);
+		bench_cost_end(cost, handled_frame_count,
+			       bytes_per_sample * samples_per_frame);
+		assert(err == 0);
+		assert(handled_frame_count == frame_count);
+
+		if (access == SND_PCM_ACCESS_RW_NONINTERLEAVED) {
+			char **src = frame_buffer;
+			char **dst = check_buffer;
+			int j;
+
+			for (j = 0; j < samples_per_frame; ++j) {
+				err = memcmp(src[j], dst[j],
+					     frame_count * bytes_per_sample);
+				assert(err == 0);
+			}
+		} else {
+			err = memcmp(frame_buffer, check_buffer,
+				frame_count * bytes_per_sample *
+				samples_per_frame);
+			assert(err == 0);
+		}
+	}
+
+	mapper_context_post_process(&mapper);
+	mapper_context_destroy(&mapper);
+
+	for (i = 0; i < cntr_count; ++i) {
+		container_context_post_process(cntrs + i, &total_frame_count);
+		container_context_destroy(cntrs + i);
+	}
+}
+
+static void *allocate_check_buffer(snd_pcm_access_t access,
+				   snd_pcm_format_t sample_format,
+				   unsigned int samples_per_frame,
+				   unsigned int frame_count)
+{
+	unsigned int size;
+	char **bufs;
+	int i;
+
+	size = frame_count * snd_pcm_format_physical_width(sample_format) / 8;
+
+	if (access != SND_PCM_ACCESS_RW_NONINTERLEAVED)
+		return malloc(size * samples_per_frame);
+
+	bufs = calloc(samples_per_frame, sizeof(*bufs));
+	if (bufs == NULL)
+		return NULL;
+
+	for (i = 0; i < samples_per_frame; ++i) {
+		bufs[i] = malloc(size);
+		if (bufs[i] == NULL) {
+			for (; i >= 0; --i)
+				free(bufs[i]);
+			free(bufs);
+			return NULL;
+		}
+	}
+
+	return bufs;
+}
+
+static void release_check_buffer(void *check_buffer, snd_pcm_access_t access,
+				 unsigned int samples_per_frame)
+{
+	if (access == SND_PCM_ACCESS_RW_NONINTERLEAVED) {
+		char **bufs = check_buffer;
+		int i;
+
+		for (i = 0; i < samples_per_frame; ++i)
+			free(bufs[i]);
+	}
+
+	free(check_buffer);
+}
+
+static int bench_mapper_with_cntrs(struct bench_trial *trial,
+				   snd_pcm_access_t access,
+				   snd_pcm_format_t sample_format,
+				   unsigned int samples_per_frame,
+				   void *frame_buffer, void *check_buffer,
+				   unsigned int frame_count,
+				   unsigned int cntr_count)
+{
+	struct container_context *cntrs;
+	struct bench_cost demux_cost = {0};
+	struct bench_cost mux_cost = {0};
+	unsigned int size;
+	unsigned int repeat_count;
+	int *fds;
+	int i;
+	int err = 0;
+
+	size = frame_count * samples_per_frame *
+			snd_pcm_format_physical_width(sample_format) / 8;
+	repeat_count = (trial->byte_count + size - 1) / size;
+
+	cntrs = calloc(cntr_count, sizeof(*cntrs));
+	fds = calloc(cntr_count, sizeof(*fds));
+	if (cntrs == NULL || fds == NULL) {
+		err = -ENOMEM;
+		goto end;
+	}
+
+	for (i = 0; i < cntr_count; ++i)
+		fds[i] = -1;
+
+	for (i = 0; i < cntr_count; ++i) {
+		fds[i] = open_fd("benchmark");
+		if (fds[i] < 0) {
+			err = fds[i];
+			goto end;
+		}
+	}
+
+	bench_demuxer(cntrs, cntr_count, fds, access, sample_format,
+		      samples_per_frame, frame_buffer, frame_count,
+		      repeat_count, &demux_cost);
+
+	for (i = 0; i < cntr_count; ++i) {
+		err = rewind_fd(fds[i]);
+		if (err < 0)
+			goto end;
+	}
+
+	bench_muxer(cntrs, cntr_count, fds, access, sample_format,
+		    samples_per_frame, frame_buffer, check_buffer,
+		    frame_count, repeat_count, &mux_cost);
+
+	print_trial("mapper", cntr_count > 1 ? "multiple" : "single",
+		    sample_format, samples_per_frame, frame_count);
+	bench_print_cost("demux", &demux_cost, json);
+	bench_print_cost("mux", &mux_cost, json);
+	if (json)
+		printf(", \"access\": \"%s\" }\n", snd_pcm_access_name(access));
+	else
+		printf(" %s\n", snd_pcm_access_name(access));
+end:
+	if (fds) {
+		for (i = 0; i < cntr_count; ++i) {
+			if (fds[i] >= 0)
+				close(fds[i]);
+		}
+	}
+	free(fds);
+	free(cntrs);
+
+	return err;
+}
+
+static int bench_mapper(struct test_generator *gen, snd_pcm_access_t access,
+			snd_pcm_format_t sample_format,
+			unsigned int samples_per_frame, void *frame_buffer,
+			unsigned int frame_count)
+{
+	struct bench_trial *trial = gen->private_data;
+	void *check_buffer;
+	int err;
+
+	check_buffer = allocate_check_buffer(access, sample_format,
+					     samples_per_frame, frame_count);
+	if (check_buffer == NULL)
+		return -ENOMEM;
+
+	// The single mapper for one container with all of channels.
+	err = bench_mapper_with_cntrs(trial, access, sample_format,
+				      samples_per_frame, frame_buffer,
+				      check_buffer, frame_count, 1);
+	if (err < 0)
+		goto end;
+
+	// The multiple mapper for containers with one channel.
+	if (samples_per_frame > 1) {
+		err = bench_mapper_with_cntrs(trial, access, sample_format,
+					      samples_per_frame, frame_buffer,
+					      check_buffer, frame_count,
+					      samples_per_frame);
+	}
+end:
+	release_check_buffer(check_buffer, access, samples_per_frame);
+
+	return err;
+}
+
+// The peak kernels of the VU meter in aplay over the same buffers.
+// The peaks are stored here so that the scans are not optimized out.
+static volatile unsigned int peak_sink;
+
+static int bench_peak(struct test_generator *gen, snd_pcm_access_t access,
+		      snd_pcm_format_t sample_format,
+		      unsigned int samples_per_frame, void *frame_buffer,
+		      unsigned int frame_count)
+{
+	struct bench_trial *trial = gen->private_data;
+	struct bench_cost cost = {0};
+	unsigned int peaks[samples_per_frame];
+	unsigned int bytes_per_frame;
+	unsigned int repeat_count;
+	int i;
+
+	bytes_per_frame = samples_per_frame *
+			  snd_pcm_format_physical_width(sample_format) / 8;
+	repeat_count = (trial->byte_count + frame_count * bytes_per_frame - 1) /
+		       (frame_count * bytes_per_frame);
+
+	for (i = 0; i < repeat_count; ++i) {
+		memset(peaks, 0, sizeof(peaks));
+		bench_cost_begin(&cost);
+		switch (sample_format) {
+		case SND_PCM_FORMAT_S16_LE:
+			sample_peaks_16le(frame_buffer, frame_count,
+					  samples_per_frame, 0, peaks);
+			break;
+		case SND_PCM_FORMAT_S24_3LE:
+			sample_peaks_24(frame_buffer, frame_count,
+					samples_per_frame, 0, peaks, 1);
+			break;
+		case SND_PCM_FORMAT_S32_LE:
+			sample_peaks_32le(frame_buffer, frame_count,
+					  samples_per_frame, 0, peaks);
+			break;
+		default:
+			return -EINVAL;
+		}
+		bench_cost_end(&cost, frame_count, bytes_per_frame);
+		peak_sink += peaks[0];
+	}
+
+	print_trial("kernel", "peak", sample_format, samples_per_frame,
+		    frame_count);
+	bench_print_cost("scan", &cost, json);
+	printf(json ? " }\n" : "\n");
+
+	return 0;
+}
+
+// The channel map of aplay (remap_data()) over the same buffers, with the
+// channels in the reverse order.
+static int bench_remap(struct test_generator *gen, snd_pcm_access_t access,
+		       snd_pcm_format_t sample_format,
+		       unsigned int samples_per_frame, void *frame_buffer,
+		       unsigned int frame_count)
+{
+	struct bench_trial *trial = gen->private_data;
+	struct bench_cost cost = {0};
+	unsigned int map[samples_per_frame];
+	unsigned int bytes_per_sample;
+	unsigned int bytes_per_frame;
+	unsigned int repeat_count;
+	void *dst;
+	int i;
+
+	bytes_per_sample = snd_pcm_format_physical_width(sample_format) / 8;
+	bytes_per_frame = samples_per_frame * bytes_per_sample;
+	repeat_count = (trial->byte_count + frame_count * bytes_per_frame - 1) /
+		       (frame_count * bytes_per_frame);
+
+	dst = malloc(frame_count * bytes_per_frame);
+	if (dst == NULL)
+		return -ENOMEM;
+	for (i = 0; i < samples_per_frame; ++i)
+		map[i] = samples_per_frame - 1 - i;
+
+	for (i = 0; i < repeat_count; ++i) {
+		bench_cost_begin(&cost);
+		sample_remap(dst, frame_buffer, frame_count, samples_per_frame,
+			     map, bytes_per_sample);
+		bench_cost_end(&cost, frame_count, bytes_per_frame);
+	}
+	free(dst);
+
+	print_trial("kernel", "remap", sample_format, samples_per_frame,
+		    frame_count);
+	bench_print_cost("remap", &cost, json);
+	printf(json ? " }\n" : "\n");
+
+	return 0;
+}
+
+static int run_grid(uint64_t access_mask, uint64_t sample_format_mask,
+		    enum container_format cntr_format, uint64_t byte_count,
+		    generator_cb_t cb)
+{
+	static const unsigned int channels_entries[] = {1, 2, 8};
+	static const unsigned int frames_entries[] = {64, 1024, 8192};
+	struct test_generator gen = {0};
+	struct bench_trial *trial;
+	int i, j;
+	int err = 0;
+
+	for (i = 0; i < ARRAY_SIZE(channels_entries); ++i) {
+		unsigned int channels = channels_entries[i];
+
+		for (j = 0; j < ARRAY_SIZE(frames_entries); ++j) {
+			unsigned int frames = frames_entries[j];
+
+			err = generator_context_init(&gen, access_mask,
+						     sample_format_mask,
+						     channels, channels,
+						     frames, frames, 1,
+						     sizeof(*trial));
+			if (err >= 0) {
+				trial = gen.private_data;
+				trial->cntr_format = cntr_format;
+				trial->byte_count = byte_count;
+				err = generator_context_run(&gen, cb);
+			}
+
+			generator_context_destroy(&gen);
+
+			if (err < 0)
+				return err;
+		}
+	}
+
+	return err;
+}
+
+int main(int argc, const char *argv[])
+{
+	static const uint64_t sample_format_masks[] = {
+		[CONTAINER_FORMAT_RIFF_WAVE] =
+			(1ull << SND_PCM_FORMAT_U8) |
+			(1ull << SND_PCM_FORMAT_S16_LE) |
+			(1ull << SND_PCM_FORMAT_S24_3LE) |
+			(1ull << SND_PCM_FORMAT_S32_LE) |
+			(1ull << SND_PCM_FORMAT_FLOAT_LE),
+		[CONTAINER_FORMAT_AU] =
+			(1ull << SND_PCM_FORMAT_S16_BE) |
+			(1ull << SND_PCM_FORMAT_S32_BE) |
+			(1ull << SND_PCM_FORMAT_FLOAT_BE),
+		[CONTAINER_FORMAT_VOC] =
+			(1ull << SND_PCM_FORMAT_U8) |
+			(1ull << SND_PCM_FORMAT_S16_LE),
+		[CONTAINER_FORMAT_RF64] =
+			(1ull << SND_PCM_FORMAT_S16_LE) |
+			(1ull << SND_PCM_FORMAT_S24_3LE) |
+			(1ull << SND_PCM_FORMAT_S32_LE),
+		[CONTAINER_FORMAT_W64] =
+			(1ull << SND_PCM_FORMAT_S16_LE) |
+			(1ull << SND_PCM_FORMAT_S24_3LE) |
+			(1ull << SND_PCM_FORMAT_S32_LE),
+		[CONTAINER_FORMAT_RAW] =
+			(1ull << SND_PCM_FORMAT_S16_LE) |
+			(1ull << SND_PCM_FORMAT_S24_3LE) |
+			(1ull << SND_PCM_FORMAT_S32_LE),
+	};
+	static const uint64_t mapper_sample_format_mask =
+		(1ull << SND_PCM_FORMAT_S16_LE) |
+		(1ull << SND_PCM_FORMAT_S24_3LE) |
+		(1ull << SND_PCM_FORMAT_S32_LE);
+	static const uint64_t mapper_access_mask =
+		(1ull << SND_PCM_ACCESS_RW_INTERLEAVED) |
+		(1ull << SND_PCM_ACCESS_RW_NONINTERLEAVED);
+	uint64_t byte_count;
+	int i;
+	int err = 0;
+
+	if (argc > 1 && strcmp(argv[1], "--json") == 0) {
+		json = true;
+		--argc;
+		++argv;
+	}
+
+	byte_count = DEFAULT_MEGABYTES;
+	if (argc > 1) {
+		char *term;
+
+		errno = 0;
+		byte_count = strtoul(argv[1], &term, 10);
+		if (errno || *term != '\0' || byte_count == 0) {
+			printf("Usage: %s [--json] [megabytes per trial]\n",
+			       argv[0]);
+			return EXIT_FAILURE;
+		}
+	}
+	byte_count *= 1024 * 1024;
+
+	if (!json)
+		printf("%-10s %-10s %3s %6s %10s %10s %10s %10s\n",
+		       "container", "format", "ch", "frames", "write MB/s",
+		       "cyc/frame", "read MB/s", "cyc/frame");
+	for (i = 0; i < ARRAY_SIZE(sample_format_masks); ++i) {
+		err = run_grid(1ull << SND_PCM_ACCESS_RW_INTERLEAVED,
+			       sample_format_masks[i], i, byte_count,
+			       bench_container);
+		if (err < 0)
+			goto end;
+	}
+
+	if (!json)
+		printf("\n%-10s %-10s %3s %6s %10s %10s %10s %10s %s\n",
+		       "mapper", "format", "ch", "frames", "demux MB/s",
+		       "cyc/frame", "mux MB/s", "cyc/frame", "access");
+	err = run_grid(mapper_access_mask, mapper_sample_format_mask,
+		       CONTAINER_FORMAT_RAW, byte_count, bench_mapper);
+	if (err < 0)
+		goto end;
+
+	if (!json)
+		printf("\n%-10s %-10s %3s %6s %10s %10s\n",
+		       "kernel", "format", "ch", "frames", "scan MB/s",
+		       "cyc/frame");
+	err = run_grid(1ull << SND_PCM_ACCESS_RW_INTERLEAVED,
+		       mapper_sample_format_mask, CONTAINER_FORMAT_RAW,
+		       byte_count, bench_peak);
+	if (err < 0)
+		goto end;
+
+	if (!json)
+		printf("\n%-10s %-10s %3s %6s %10s %10s\n",
+		       "kernel", "format", "ch", "frames", "remap MB/s",
+		       "cyc/frame");
+	err = run_grid(1ull << SND_PCM_ACCESS_RW_INTERLEAVED,
+		       mapper_sample_format_mask, CONTAINER_FORMAT_RAW,
+		       byte_count, bench_remap);
+end:
+	if (err < 0) {
+		fprintf(stderr, "%s\n", strerror(-err));
+		return EXIT_FAILURE;
+	}
+
+	return EXIT_SUCCESS;
+}
@@ -33,6 +33,21 @@ struct container_trial {
 	bool verbose;
 };
 
+static void enable_io(struct container_context *cntr,
+		      enum container_io_type io_type)
+{
+	int err = 0;
+
+	// The size of block is not aligned to the count of frames in test.
+	if (io_type == CONTAINER_IO_TYPE_MMAP)
+		err = container_context_enable_mmap(cntr);
+	else if (io_type == CONTAINER_IO_TYPE_THREAD)
+		err = container_context_enable_thread(cntr, 4, 127);
+	else if (io_type == CONTAINER_IO_TYPE_DIRECT)
+		err = container_context_enable_direct(cntr, 127);
+	assert(err == 0);
+}
+
 static void test_builder(struct container_context *cntr, int fd,
 			 enum container_format format,
 			 snd_pcm_access_t access,
@@ -40,7 +55,7 @@ static void test_builder(struct container_context *cntr, int fd,
 			 unsigned int samples_per_frame,
 			 unsigned int frames_per_second,
 			 void *frame_buffer, unsigned int frame_count,
-			 bool verbose)
+			 enum container_io_type io_type, bool verbose)
 {
 	snd_pcm_format_t sample;
 	unsigned int channels;
@@ -65,6 +80,8 @@ static void test_builder(struct container_context *cntr, int fd,
 	assert(rate == frames_per_second);
 	assert(max_frame_count > 0);
 
+	enable_io(cntr, io_type);
+
 	handled_frame_count = frame_count;
 	err = container_context_process_frames(cntr, frame_buffer,
 					       &handled_frame_count);
@@ -86,7 +103,7 @@ static void test_parser(struct container_context *cntr, int fd,
 		        unsigned int samples_per_frame,
 		        unsigned int frames_per_second,
 		        void *frame_buffer, unsigned int frame_count,
-			bool verbose)
+			enum container_io_type io_type, bool verbose)
 {
 	snd_pcm_format_t sample;
 	unsigned int channels;
@@ -110,6 +127,8 @@ static void test_parser(struct container_context *cntr, int fd,
 	assert(rate == frames_per_second);
 	assert(total_frame_count == frame_count);
 
+	enable_io(cntr, io_type);
+
 	handled_frame_count = total_frame_count;
 	err = container_context_process_frames(cntr, frame_buffer,
 					       &handled_frame_count);
@@ -129,6 +148,12 @@ static int callback(struct test_generator *gen, snd_pcm_access_t access,
 		    unsigned int samples_per_frame, void *frame_buffer,
 		    unsigned int frame_count)
 {
+	static const enum container_io_type io_types[] = {
+		CONTAINER_IO_TYPE_DEFAULT,
+		CONTAINER_IO_TYPE_MMAP,
+		CONTAINER_IO_TYPE_THREAD,
+		CONTAINER_IO_TYPE_DIRECT,
+	};
 	static const unsigned int entries[] = {
 		[0] = 44100,
 		[1] = 48000,
@@ -144,6 +169,7 @@ static int callback(struct test_generator *gen, snd_pcm_access_t access,
 	void *buf;
 	int i;
 	int err = 0;
+	int j;
 
 	size = frame_count * samples_per_frame *
 			snd_pcm_format_physical_width(sample_format) / 8;
@@ -167,30 +193,314 @@ static int callback(struct test_generator *gen, snd_pcm_access_t access,
 			break;
 		}
 
-		test_builder(&trial->cntr, fd, trial->format, access,
-			     sample_format, samples_per_frame,
-			     frames_per_second, frame_buffer, frame_count,
-			     trial->verbose);
-
-		pos = lseek64(fd, 0, SEEK_SET);
-		if (pos < 0) {
-			err = -errno;
+		for (j = 0; j < ARRAY_SIZE(io_types); ++j) {
+			enum container_io_type io_type = io_types[j];
+
+			pos = lseek64(fd, 0, SEEK_SET);
+			if (pos < 0 || ftruncate(fd, 0) < 0) {
+				err = -errno;
+				break;
+			}
+
+			// The mmap type of I/O is just for parsers, and the
+			// direct type of I/O is just for builders.
+			test_builder(&trial->cntr, fd, trial->format, access,
+				     sample_format, samples_per_frame,
+				     frames_per_second, frame_buffer,
+				     frame_count,
+				     io_type == CONTAINER_IO_TYPE_MMAP ?
+				     CONTAINER_IO_TYPE_DEFAULT : io_type,
+				     trial->verbose);
+
+			pos = lseek64(fd, 0, SEEK_SET);
+			if (pos < 0) {
+				err = -errno;
+				break;
+			}
+
+			memset(buf, 0, size);
+			test_parser(&trial->cntr, fd, trial->format, access,
+				    sample_format, samples_per_frame,
+				    frames_per_second, buf, frame_count,
+				    io_type == CONTAINER_IO_TYPE_DIRECT ?
+				    CONTAINER_IO_TYPE_DEFAULT : io_type,
+				    trial->verbose);
+
+			err = memcmp(buf, frame_buffer, size);
+			assert(err == 0);
+		}
+		if (err < 0)
 			break;
+
+		close(fd);
+	}
+
+	free(buf);
+
+	return err;
+}
+
+static void write_bytes(int fd, const void *buf, unsigned int size)
+{
+	ssize_t len;
+
+	len = write(fd, buf, size);
+	assert(len == size);
+}
+
+// The size of frames is added to the size field for data blocks.
+static void write_voc_block(int fd, uint8_t type, const void *data,
+			    unsigned int size, unsigned int frame_size)
+{
+	uint8_t header[4];
+	unsigned int length = size + frame_size;
+
+	header[0] = type;
+	header[1] = length & 0xff;
+	header[2] = (length >> 8) & 0xff;
+	header[3] = (length >> 16) & 0xff;
+	write_bytes(fd, header, sizeof(header));
+	write_bytes(fd, data, size);
+}
+
+static void parse_voc_blocks(int fd, const char *index_path,
+			     uint64_t start_frame, const char *frames,
+			     unsigned int byte_count)
+{
+	struct container_context cntr = {0};
+	snd_pcm_format_t format = SND_PCM_FORMAT_UNKNOWN;
+	unsigned int channels = 0;
+	unsigned int rate = 0;
+	uint64_t frame_count;
+	unsigned int handled_frame_count;
+	char *buf;
+	int err;
+
+	lseek64(fd, 0, SEEK_SET);
+
+	err = container_parser_init(&cntr, fd, 0);
+	assert(err == 0);
+	if (index_path) {
+		err = container_parser_set_index_path(&cntr, index_path);
+		assert(err == 0);
+	}
+	err = container_parser_set_start_position(&cntr, start_frame, 0);
+	assert(err == 0);
+
+	err = container_context_pre_process(&cntr, &format, &channels, &rate,
+					    &frame_count);
+	assert(err == 0);
+	assert(format == SND_PCM_FORMAT_S16_LE);
+	assert(channels == 2);
+	assert(rate == 48000);
+	assert(frame_count == byte_count / 4 - start_frame);
+
+	frames += start_frame * 4;
+	byte_count -= start_frame * 4;
+
+	// Read over boundaries of blocks at once.
+	buf = malloc(byte_count);
+	assert(buf != NULL);
+	handled_frame_count = frame_count;
+	err = container_context_process_frames(&cntr, buf,
+					       &handled_frame_count);
+	assert(err == 0);
+	assert(handled_frame_count == frame_count);
+	assert(memcmp(buf, frames, byte_count) == 0);
+	free(buf);
+
+	container_context_destroy(&cntr);
+}
+
+// Data frames are split into several blocks with the other blocks between
+// them.
+static void test_voc_blocks(void)
+{
+	static const uint8_t header[26] = {
+		'C', 'r', 'e', 'a', 't', 'i', 'v', 'e', ' ',
+		'V', 'o', 'i', 'c', 'e', ' ', 'F', 'i', 'l', 'e', 0x1a,
+		0x1a, 0x00,	// Header size.
+		0x14, 0x01,	// v1.20.
+		0x1f, 0x11,	// 0x1234 + ~0x0114.
+	};
+	static const uint8_t format[12] = {
+		0x80, 0xbb, 0x00, 0x00,		// 48000.
+		16, 2,				// 16 bits, 2 channels.
+		0x04, 0x00,			// S16_LE.
+		0x00, 0x00, 0x00, 0x00,
+	};
+	static const uint8_t silence[3] = {0xff, 0x00, 0x80};
+	static const uint8_t terminator = 0x00;
+	static const unsigned int sizes[] = {4000, 1024, 3072};
+	const char *const index_path = "voc-blocks.idx";
+	unsigned int byte_count = 0;
+	char *frames;
+	int fd;
+	int i;
+	int err;
+
+	for (i = 0; i < ARRAY_SIZE(sizes); ++i)
+		byte_count += sizes[i];
+	frames = malloc(byte_count);
+	assert(frames != NULL);
+	for (i = 0; i < byte_count; ++i)
+		frames[i] = random();
+
+#ifdef HAVE_MEMFD_CREATE
+	fd = memfd_create("voc-blocks", 0);
+#else
+	fd = open("voc-blocks", O_RDWR | O_CREAT | O_TRUNC, 0644);
+#endif
+	assert(fd >= 0);
+
+	write_bytes(fd, header, sizeof(header));
+	write_voc_block(fd, 0x09, format, sizeof(format), sizes[0]);
+	write_bytes(fd, frames, sizes[0]);
+	write_voc_block(fd, 0x03, silence, sizeof(silence), 0);
+	write_voc_block(fd, 0x02, frames + sizes[0], 0, sizes[1]);
+	write_bytes(fd, frames + sizes[0], sizes[1]);
+	write_voc_block(fd, 0x05, "hoge", 5, 0);
+	write_voc_block(fd, 0x09, format, sizeof(format), sizes[2]);
+	write_bytes(fd, frames + sizes[0] + sizes[1], sizes[2]);
+	write_bytes(fd, &terminator, sizeof(terminator));
+
+	parse_voc_blocks(fd, NULL, 0, frames, byte_count);
+
+	// Saved at first, then loaded.
+	unlink(index_path);
+	parse_voc_blocks(fd, index_path, 0, frames, byte_count);
+	err = access(index_path, F_OK);
+	assert(err == 0);
+	parse_voc_blocks(fd, index_path, 0, frames, byte_count);
+	unlink(index_path);
+
+	// Start in the middle of the first block, at the boundary of blocks,
+	// and in the middle of the last block.
+	parse_voc_blocks(fd, NULL, 100, frames, byte_count);
+	parse_voc_blocks(fd, NULL, sizes[0] / 4, frames, byte_count);
+	parse_voc_blocks(fd, NULL, (sizes[0] + sizes[1]) / 4 + 10, frames,
+			 byte_count);
+
+	close(fd);
+	free(frames);
+}
+
+// Runs of silence longer than the minimum duration are skipped, then listed
+// in cue subchunk.
+static void test_silence_gaps(void)
+{
+	static const struct {
+		unsigned int frame_count;
+		bool loud;
+	} runs[] = {
+		{1000, true},
+		{2000, false},
+		{500, true},
+		{300, false},	// Shorter than the minimum duration.
+		{700, true},
+		{1500, false},
+	};
+	static const struct container_gap expected_gaps[] = {
+		{1480, 1520},
+		{3460, 1020},
+	};
+	struct container_context cntr = {0};
+	snd_pcm_format_t format = SND_PCM_FORMAT_S16_LE;
+	unsigned int channels = 2;
+	unsigned int rate = 48000;
+	const struct container_gap *gaps;
+	unsigned int frame_count = 0;
+	unsigned int written_frame_count;
+	uint64_t max_frame_count;
+	uint64_t handled_frame_count;
+	int16_t *frames;
+	unsigned int gap_count;
+	unsigned int pos;
+	char id[4];
+	int fd;
+	int i, j;
+	int err;
+
+	for (i = 0; i < ARRAY_SIZE(runs); ++i)
+		frame_count += runs[i].frame_count;
+	frames = calloc(frame_count, sizeof(*frames) * channels);
+	assert(frames != NULL);
+
+	// Loud in one of channels.
+	pos = 0;
+	for (i = 0; i < ARRAY_SIZE(runs); ++i) {
+		for (j = 0; j < runs[i].frame_count; ++j) {
+			if (runs[i].loud)
+				frames[(pos + j) * channels + 1] = 10000;
 		}
+		pos += runs[i].frame_count;
+	}
 
-		test_parser(&trial->cntr, fd, trial->format, access,
-			    sample_format, samples_per_frame, frames_per_second,
-			    buf, frame_count, trial->verbose);
+#ifdef HAVE_MEMFD_CREATE
+	fd = memfd_create("silence-gaps", 0);
+#else
+	fd = open("silence-gaps", O_RDWR | O_CREAT | O_TRUNC, 0644);
+#endif
+	assert(fd >= 0);
 
-		err = memcmp(buf, frame_buffer, size);
+	err = container_builder_init(&cntr, fd, CONTAINER_FORMAT_RIFF_WAVE, 0);
+	assert(err == 0);
+	err = container_context_pre_process(&cntr, &format, &channels, &rate,
+					    &max_frame_count);
+	assert(err == 0);
+	// 10 msec.
+	err = container_context_enable_silence(&cntr, format, -60.0, 10,
+					       CONTAINER_SILENCE_MODE_SKIP,
+					       NULL, NULL);
+	assert(err == 0);
+
+	// Over boundaries of runs.
+	for (pos = 0; pos < frame_count; pos += 333) {
+		unsigned int count = frame_count - pos;
+
+		if (count > 333)
+			count = 333;
+		err = container_context_process_frames(&cntr,
+				frames + pos * channels, &count);
 		assert(err == 0);
+	}
 
-		close(fd);
+	err = container_context_post_process(&cntr, &handled_frame_count);
+	assert(err == 0);
+	written_frame_count = 1000 + 480 + 500 + 300 + 700 + 480;
+	assert(handled_frame_count == written_frame_count);
+
+	gap_count = container_silence_get_gaps(&cntr, &gaps);
+	assert(gap_count == ARRAY_SIZE(expected_gaps));
+	for (i = 0; i < gap_count; ++i) {
+		assert(gaps[i].frame_offset == expected_gaps[i].frame_offset);
+		assert(gaps[i].frame_count == expected_gaps[i].frame_count);
 	}
 
-	free(buf);
+	container_context_destroy(&cntr);
+
+	// The cue subchunk follows data subchunk.
+	lseek64(fd, 44 + written_frame_count * channels * sizeof(*frames),
+		SEEK_SET);
+	err = read(fd, id, sizeof(id));
+	assert(err == sizeof(id));
+	assert(memcmp(id, "cue ", sizeof(id)) == 0);
+
+	// Parsers stop at the end of data subchunk.
+	lseek64(fd, 0, SEEK_SET);
+	format = SND_PCM_FORMAT_UNKNOWN;
+	channels = 0;
+	rate = 0;
+	err = container_parser_init(&cntr, fd, 0);
+	assert(err == 0);
+	err = container_context_pre_process(&cntr, &format, &channels, &rate,
+					    &max_frame_count);
+	assert(err == 0);
+	assert(max_frame_count == written_frame_count);
+	container_context_destroy(&cntr);
 
-	return err;
+	close(fd);
+	free(frames);
 }
 
 int main(int argc, const char *argv[])
@@ -229,6 +539,30 @@ int main(int argc, const char *argv[])
 			(1ull << SND_PCM_FORMAT_S16_LE) |
 			(1ull << SND_PCM_FORMAT_MU_LAW) |
 			(1ull << SND_PCM_FORMAT_A_LAW),
+		[CONTAINER_FORMAT_RF64] =
+			(1ull << SND_PCM_FORMAT_U8) |
+			(1ull << SND_PCM_FORMAT_S16_LE) |
+			(1ull << SND_PCM_FORMAT_S24_LE) |
+			(1ull << SND_PCM_FORMAT_S32_LE) |
+			(1ull << SND_PCM_FORMAT_FLOAT_LE) |
+			(1ull << SND_PCM_FORMAT_FLOAT64_LE) |
+			(1ull << SND_PCM_FORMAT_MU_LAW) |
+			(1ull << SND_PCM_FORMAT_A_LAW) |
+			(1ull << SND_PCM_FORMAT_S24_3LE) |
+			(1ull << SND_PCM_FORMAT_S20_3LE) |
+			(1ull << SND_PCM_FORMAT_S18_3LE),
+		[CONTAINER_FORMAT_W64] =
+			(1ull << SND_PCM_FORMAT_U8) |
+			(1ull << SND_PCM_FORMAT_S16_LE) |
+			(1ull << SND_PCM_FORMAT_S24_LE) |
+			(1ull << SND_PCM_FORMAT_S32_LE) |
+			(1ull << SND_PCM_FORMAT_FLOAT_LE) |
+			(1ull << SND_PCM_FORMAT_FLOAT64_LE) |
+			(1ull << SND_PCM_FORMAT_MU_LAW) |
+			(1ull << SND_PCM_FORMAT_A_LAW) |
+			(1ull << SND_PCM_FORMAT_S24_3LE) |
+			(1ull << SND_PCM_FORMAT_S20_3LE) |
+			(1ull << SND_PCM_FORMAT_S18_3LE),
 		[CONTAINER_FORMAT_RAW] =
 			(1ull << SND_PCM_FORMAT_S8) |
 			(1ull << SND_PCM_FORMAT_U8) |
@@ -320,5 +654,8 @@ int main(int argc, const char *argv[])
 		return EXIT_FAILURE;
 	}
 
+	test_voc_blocks();
+	test_silence_gaps();
+
 	return EXIT_SUCCESS;
 }
@@ -56,6 +56,12 @@ static void test_demuxer(struct mapper_context *mapper, snd_pcm_access_t access,
 					 cntrs);
 	assert(err == 0);
 
+	// Many containers are processed by workers.
+	if (cntr_count > 4) {
+		err = mapper_context_enable_workers(mapper, 4);
+		assert(err == 0);
+	}
+
 	total_frame_count = frame_count;
 	err = mapper_context_process_frames(mapper, frame_buffer,
 					    &total_frame_count, cntrs);
@@ -147,6 +153,12 @@ static void test_muxer(struct mapper_context *mapper, snd_pcm_access_t access,
 					 cntrs);
 	assert(err == 0);
 
+	// Many containers are processed by workers.
+	if (cntr_count > 4) {
+		err = mapper_context_enable_workers(mapper, 4);
+		assert(err == 0);
+	}
+
 	total_frame_count = frame_count;
 	err = mapper_context_process_frames(mapper, frame_buffer,
 					    &total_frame_count, cntrs);
@@ -427,6 +439,139 @@ static int callback(struct test_generator *gen, snd_pcm_access_t access,
 		       frame_buffer, frame_count, samples_per_frame);
 };
 
+static void convert_frames(struct container_context *cntr,
+			   enum mapper_type type, snd_pcm_access_t access,
+			   snd_pcm_format_t pcm_format,
+			   snd_pcm_format_t cntr_format,
+			   unsigned int samples_per_frame,
+			   void *frame_buffer, unsigned int frame_count)
+{
+	struct mapper_context mapper = {0};
+	unsigned int count;
+	int err;
+
+	err = mapper_context_init(&mapper, type, 1, 0);
+	assert(err == 0);
+
+	err = mapper_context_pre_process(&mapper, access,
+				snd_pcm_format_physical_width(cntr_format) / 8,
+				samples_per_frame, frame_count, cntr);
+	assert(err == 0);
+
+	err = mapper_context_enable_conversion(&mapper, pcm_format,
+					       cntr_format);
+	assert(err == 0);
+
+	count = frame_count;
+	err = mapper_context_process_frames(&mapper, frame_buffer, &count,
+					    cntr);
+	assert(err == 0);
+	assert(count == frame_count);
+
+	mapper_context_post_process(&mapper);
+	mapper_context_destroy(&mapper);
+}
+
+// The format for files is enough wide not to lose any bit.
+static void test_conversion(snd_pcm_access_t access,
+			    snd_pcm_format_t pcm_format,
+			    snd_pcm_format_t cntr_format)
+{
+	static const unsigned int samples_per_frame = 3;
+	static const unsigned int frame_count = 1000;
+	struct container_context cntr = {0};
+	unsigned int bytes_per_buffer;
+	char *vectors[2][samples_per_frame];
+	char *bufs[2];
+	void *frame_buffers[2];
+	snd_pcm_format_t format;
+	unsigned int channels;
+	unsigned int rate;
+	uint64_t total_frame_count;
+	int fd;
+	int i, j;
+	int err;
+
+	bytes_per_buffer = snd_pcm_format_physical_width(pcm_format) / 8 *
+			   samples_per_frame * frame_count;
+
+	for (i = 0; i < 2; ++i) {
+		bufs[i] = calloc(1, bytes_per_buffer);
+		assert(bufs[i] != NULL);
+
+		if (access == SND_PCM_ACCESS_RW_NONINTERLEAVED ||
+		    access == SND_PCM_ACCESS_MMAP_NONINTERLEAVED) {
+			for (j = 0; j < samples_per_frame; ++j) {
+				vectors[i][j] = bufs[i] +
+					bytes_per_buffer / samples_per_frame * j;
+			}
+			frame_buffers[i] = vectors[i];
+		} else {
+			frame_buffers[i] = bufs[i];
+		}
+	}
+
+	// The most significant byte of S24_LE is for sign extension.
+	for (i = 0; i < bytes_per_buffer; ++i)
+		bufs[0][i] = random();
+	if (pcm_format == SND_PCM_FORMAT_S24_LE) {
+		int32_t *samples = (int32_t *)bufs[0];
+
+		for (i = 0; i < bytes_per_buffer / 4; ++i)
+			samples[i] = (int32_t)((uint32_t)samples[i] << 8) >> 8;
+	}
+
+#ifdef HAVE_MEMFD_CREATE
+	fd = memfd_create("conversion", 0);
+#else
+	fd = open("conversion", O_RDWR | O_CREAT | O_TRUNC, 0644);
+#endif
+	assert(fd >= 0);
+
+	err = container_builder_init(&cntr, fd, CONTAINER_FORMAT_RAW, 0);
+	assert(err == 0);
+	format = cntr_format;
+	channels = samples_per_frame;
+	rate = 48000;
+	err = container_context_pre_process(&cntr, &format, &channels, &rate,
+					    &total_frame_count);
+	assert(err == 0);
+
+	convert_frames(&cntr, MAPPER_TYPE_DEMUXER, access, pcm_format,
+		       cntr_format, samples_per_frame, frame_buffers[0],
+		       frame_count);
+
+	container_context_post_process(&cntr, &total_frame_count);
+	assert(total_frame_count == frame_count);
+	container_context_destroy(&cntr);
+
+	assert(lseek64(fd, 0, SEEK_SET) == 0);
+
+	err = container_parser_init(&cntr, fd, 0);
+	assert(err == 0);
+	format = cntr_format;
+	channels = samples_per_frame;
+	rate = 48000;
+	err = container_context_pre_process(&cntr, &format, &channels, &rate,
+					    &total_frame_count);
+	assert(err == 0);
+	assert(total_frame_count == frame_count);
+
+	convert_frames(&cntr, MAPPER_TYPE_MUXER, access, pcm_format,
+		       cntr_format, samples_per_frame, frame_buffers[1],
+		       frame_count);
+
+	container_context_post_process(&cntr, &total_frame_count);
+	container_context_destroy(&cntr);
+	close(fd);
+
+	err = memcmp(bufs[0], bufs[1], bytes_per_buffer);
+	assert(err == 0);
+
+	free(bufs[0]);
+	free(bufs[1]);
+}
+
 int main(int argc, const char *argv[])
 {
 	// Test 8/16/18/20/24/32/64 bytes per sample.
@@ -511,6 +656,28 @@ int main(int argc, const char *argv[])
 	err = generator_context_run(&gen, callback);
 
 	generator_context_destroy(&gen);
+
+	if (err == 0) {
+		static const snd_pcm_format_t pairs[][2] = {
+			{SND_PCM_FORMAT_S16_LE, SND_PCM_FORMAT_S24_3LE},
+			{SND_PCM_FORMAT_S16_BE, SND_PCM_FORMAT_S16_LE},
+			{SND_PCM_FORMAT_U8, SND_PCM_FORMAT_S32_BE},
+			{SND_PCM_FORMAT_S24_3BE, SND_PCM_FORMAT_S24_LE},
+			{SND_PCM_FORMAT_S24_LE, SND_PCM_FORMAT_S32_LE},
+		};
+
+		for (i = 0; i < ARRAY_SIZE(pairs); ++i) {
+			for (access = SND_PCM_ACCESS_MMAP_INTERLEAVED;
+			     access <= SND_PCM_ACCESS_RW_NONINTERLEAVED;
+			     ++access) {
+				if (access == SND_PCM_ACCESS_MMAP_COMPLEX ||
+				    !(access_mask & (1ull << access)))
+					continue;
+				test_conversion(access, pairs[i][0],
+						pairs[i][1]);
+			}
+		}
+	}
 end:
 	if (paths) {
 		for (i = 0; i < samples_per_frame; ++i)
@@ -62,13 +62,16 @@ static int epoll_wait_event(struct waiter_context *waiter, int timeout_msec)
 		return -errno;
 	ev_count = (unsigned int)err;
 
+	for (i = 0; i < waiter->pfd_count; ++i)
+		waiter->pfds[i].revents = 0;
+
 	if (ev_count > 0) {
 		// Reconstruct data of pollfd structure.
 		for (i = 0; i < ev_count; ++i) {
 			struct epoll_event *ev = &state->events[i];
 			for (j = 0; j < waiter->pfd_count; ++j) {
-				if (waiter->pfds[i].fd == ev->data.fd) {
-					waiter->pfds[i].revents = ev->events;
+				if (waiter->pfds[j].fd == ev->data.fd) {
+					waiter->pfds[j].revents = ev->events;
 					break;
 				}
 			}
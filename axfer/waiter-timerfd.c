@@ -0,0 +1,168 @@
+// SPDX-License-Identifier: GPL-2.0
+//
+// waiter-timerfd.c - Waiter for event notification by epoll(7) and
+//		      timerfd_create(2).
+//
+// Copyright (c) 2026 agent <agent@local>
+//
+// Licensed under the terms of the GNU General Public License, version 2.
+
+#include "waiter.h"
+#include "misc.h"
+
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <errno.h>
+#include <sys/types.h>
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
+
+// In addition to file descriptors for PCM substream, a file descriptor of
+// timerfd is added to the epoll set. The timer is programmed by callers at
+// the time when enough frames are expected to be available, with finer
+// granularity than timeout of epoll_wait(2).
+struct timerfd_state {
+	int epfd;
+	int timerfd;
+	struct epoll_event *events;
+	unsigned int ev_count;
+};
+
+static int timerfd_prepare(struct waiter_context *waiter)
+{
+	struct timerfd_state *state = waiter->private_data;
+	struct epoll_event ev = {0};
+	int i;
+
+	state->epfd = -1;
+	state->timerfd = -1;
+
+	// One more for the timer.
+	state->ev_count = waiter->pfd_count + 1;
+	state->events = calloc(state->ev_count, sizeof(*state->events));
+	if (state->events == NULL)
+		return -ENOMEM;
+
+	state->epfd = epoll_create(1);
+	if (state->epfd < 0)
+		return -errno;
+
+	for (i = 0; i < waiter->pfd_count; ++i) {
+		ev.data.fd = waiter->pfds[i].fd;
+		ev.events = waiter->pfds[i].events;
+		if (epoll_ctl(state->epfd, EPOLL_CTL_ADD, ev.data.fd, &ev) < 0)
+			return -errno;
+	}
+
+	state->timerfd = timerfd_create(CLOCK_MONOTONIC,
+					TFD_NONBLOCK | TFD_CLOEXEC);
+	if (state->timerfd < 0)
+		return -errno;
+
+	ev.data.fd = state->timerfd;
+	ev.events = EPOLLIN;
+	if (epoll_ctl(state->epfd, EPOLL_CTL_ADD, ev.data.fd, &ev) < 0)
+		return -errno;
+
+	return 0;
+}
+
+static int timerfd_set_wakeup(struct waiter_context *waiter, uint64_t nsec)
+{
+	struct timerfd_state *state = waiter->private_data;
+	struct itimerspec its = {0};
+
+	// Zero disarms the timer, thus expire immediately instead.
+	if (nsec == 0)
+		nsec = 1;
+
+	its.it_value.tv_sec = nsec / 1000000000;
+	its.it_value.tv_nsec = nsec % 1000000000;
+	if (timerfd_settime(state->timerfd, 0, &its, NULL) < 0)
+		return -errno;
+
+	return 0;
+}
+
+static int timerfd_wait_event(struct waiter_context *waiter, int timeout_msec)
+{
+	struct timerfd_state *state = waiter->private_data;
+	unsigned int ev_count;
+	unsigned int count;
+	int i, j;
+	int err;
+
+	memset(state->events, 0, state->ev_count * sizeof(*state->events));
+	err = epoll_wait(state->epfd, state->events, state->ev_count,
+			 timeout_msec);
+	if (err < 0)
+		return -errno;
+	ev_count = (unsigned int)err;
+
+	for (i = 0; i < waiter->pfd_count; ++i)
+		waiter->pfds[i].revents = 0;
+
+	// Reconstruct data of pollfd structure. Expiration of the timer is
+	// not counted, as well as timeout.
+	count = 0;
+	for (i = 0; i < ev_count; ++i) {
+		struct epoll_event *ev = &state->events[i];
+
+		if (ev->data.fd == state->timerfd) {
+			uint64_t expirations;
+
+			if (read(state->timerfd, &expirations,
+				 sizeof(expirations)) < 0 && errno != EAGAIN)
+				return -errno;
+			continue;
+		}
+
+		for (j = 0; j < waiter->pfd_count; ++j) {
+			if (waiter->pfds[j].fd == ev->data.fd) {
+				waiter->pfds[j].revents = ev->events;
+				++count;
+				break;
+			}
+		}
+	}
+
+	return count;
+}
+
+static void timerfd_release(struct waiter_context *waiter)
+{
+	struct timerfd_state *state = waiter->private_data;
+	int i;
+
+	if (state->epfd >= 0) {
+		for (i = 0; i < waiter->pfd_count; ++i) {
+			int fd = waiter->pfds[i].fd;
+			epoll_ctl(state->epfd, EPOLL_CTL_DEL, fd, NULL);
+		}
+		if (state->timerfd >= 0)
+			epoll_ctl(state->epfd, EPOLL_CTL_DEL, state->timerfd,
+				  NULL);
+		close(state->epfd);
+	}
+
+	if (state->timerfd >= 0)
+		close(state->timerfd);
+
+	free(state->events);
+	state->events = NULL;
+
+	state->ev_count = 0;
+	state->epfd = -1;
+	state->timerfd = -1;
+}
+
+const struct waiter_data waiter_timerfd = {
+	.ops = {
+		.prepare	= timerfd_prepare,
+		.set_wakeup	= timerfd_set_wakeup,
+		.wait_event	= timerfd_wait_event,
+		.release	= timerfd_release,
+	},
+	.private_size = sizeof(struct timerfd_state),
+};
@@ -19,6 +19,7 @@ static const char *const waiter_type_labels[] = {
 	[WAITER_TYPE_POLL] = "poll",
 	[WAITER_TYPE_SELECT] = "select",
 	[WAITER_TYPE_EPOLL] = "epoll",
+	[WAITER_TYPE_TIMERFD] = "timerfd",
 };
 
 enum waiter_type waiter_type_from_label(const char *label)
@@ -48,6 +49,7 @@ int waiter_context_init(struct waiter_context *waiter,
 		{WAITER_TYPE_POLL,	&waiter_poll},
 		{WAITER_TYPE_SELECT,	&waiter_select},
 		{WAITER_TYPE_EPOLL,	&waiter_epoll},
+		{WAITER_TYPE_TIMERFD,	&waiter_timerfd},
 	};
 	int i;
 
@@ -82,6 +84,15 @@ int waiter_context_prepare(struct waiter_context *waiter)
 	return waiter->ops->prepare(waiter);
 }
 
+// Program the time for next wakeup, relative to current time.
+int waiter_context_set_wakeup(struct waiter_context *waiter, uint64_t nsec)
+{
+	if (waiter->ops->set_wakeup == NULL)
+		return -ENXIO;
+
+	return waiter->ops->set_wakeup(waiter, nsec);
+}
+
 int waiter_context_wait_event(struct waiter_context *waiter,
 				int timeout_msec)
 {
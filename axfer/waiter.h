@@ -10,12 +10,14 @@
 #define __ALSA_UTILS_AXFER_WAITER__H_
 
 #include <poll.h>
+#include <stdint.h>
 
 enum waiter_type {
 	WAITER_TYPE_DEFAULT = 0,
 	WAITER_TYPE_POLL,
 	WAITER_TYPE_SELECT,
 	WAITER_TYPE_EPOLL,
+	WAITER_TYPE_TIMERFD,
 	WAITER_TYPE_COUNT,
 };
 
@@ -36,6 +38,7 @@ const char *waiter_label_from_type(enum waiter_type type);
 int waiter_context_init(struct waiter_context *waiter,
 			enum waiter_type type, unsigned int pfd_count);
 int waiter_context_prepare(struct waiter_context *waiter);
+int waiter_context_set_wakeup(struct waiter_context *waiter, uint64_t nsec);
 int waiter_context_wait_event(struct waiter_context *waiter,
 				int timeout_msec);
 void waiter_context_release(struct waiter_context *waiter);
@@ -45,6 +48,8 @@ void waiter_context_destroy(struct waiter_context *waiter);
 
 struct waiter_ops {
 	int (*prepare)(struct waiter_context *waiter);
+	// Optional.
+	int (*set_wakeup)(struct waiter_context *waiter, uint64_t nsec);
 	int (*wait_event)(struct waiter_context *waiter, int timeout_msec);
 	void (*release)(struct waiter_context *waiter);
 };
@@ -57,5 +62,6 @@ struct waiter_data {
 extern const struct waiter_data waiter_poll;
 extern const struct waiter_data waiter_select;
 extern const struct waiter_data waiter_epoll;
+extern const struct waiter_data waiter_timerfd;
 
 #endif
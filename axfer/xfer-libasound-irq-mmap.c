@@ -67,10 +67,11 @@ static int irq_mmap_pre_process(struct libasound_state *state)
 	return 0;
 }
 
-static int irq_mmap_process_frames(struct libasound_state *state,
-				   unsigned int *frame_count,
-				   struct mapper_context *mapper,
-				   struct container_context *cntrs)
+// Process data frames in the mapped area up to the boundary of buffer.
+static int process_mapped_frames(struct libasound_state *state,
+				 unsigned int *frame_count,
+				 struct mapper_context *mapper,
+				 struct container_context *cntrs)
 {
 	struct map_layout *layout = state->private_data;
 	const snd_pcm_channel_area_t *areas;
@@ -81,6 +82,64 @@ static int irq_mmap_process_frames(struct libasound_state *state,
 	snd_pcm_sframes_t consumed_count;
 	int err;
 
+	avail = *frame_count;
+	err = snd_pcm_mmap_begin(state->handle, &areas, &frame_offset, &avail);
+	if (err < 0)
+		return err;
+
+	// Trim according up to expected frame count.
+	if (*frame_count < avail)
+		avail_count = *frame_count;
+	else
+		avail_count = (unsigned int)avail;
+
+	// TODO: Perhaps, the complex layout can be supported as a variation of
+	// vector type. However, there's no driver with this layout.
+	if (layout->vector == NULL) {
+		char *buf;
+		buf = areas[0].addr;
+		buf += snd_pcm_frames_to_bytes(state->handle, frame_offset);
+		frame_buf = buf;
+	} else {
+		int i;
+		for (i = 0; i < layout->samples_per_frame; ++i) {
+			layout->vector[i] = areas[i].addr;
+			layout->vector[i] += snd_pcm_samples_to_bytes(
+						state->handle, frame_offset);
+		}
+		frame_buf = layout->vector;
+	}
+
+	err = mapper_context_process_frames(mapper, frame_buf, &avail_count,
+					    cntrs);
+	if (err < 0)
+		return err;
+	if (avail_count == 0) {
+		*frame_count = 0;
+		return 0;
+	}
+
+	consumed_count = snd_pcm_mmap_commit(state->handle, frame_offset,
+					     avail_count);
+	if (consumed_count < 0)
+		return (int)consumed_count;
+	if (consumed_count != avail_count)
+		logging(state, "A bug of access plugin for this PCM node.\n");
+
+	*frame_count = consumed_count;
+
+	return 0;
+}
+
+static int irq_mmap_process_frames(struct libasound_state *state,
+				   unsigned int *frame_count,
+				   struct mapper_context *mapper,
+				   struct container_context *cntrs)
+{
+	snd_pcm_uframes_t avail;
+	unsigned int count;
+	int err;
+
 	if (state->use_waiter) {
 		unsigned int msec_per_buffer;
 		unsigned short revents;
@@ -130,53 +189,27 @@ static int irq_mmap_process_frames(struct libasound_state *state,
 	avail = snd_pcm_avail_update(state->handle);
 	if ((snd_pcm_sframes_t)avail < 0)
 		return (int)avail;
+	xfer_libasound_mark_avail(state);
 	if (*frame_count < avail)
 		avail = *frame_count;
 
-	err = snd_pcm_mmap_begin(state->handle, &areas, &frame_offset, &avail);
+	count = (unsigned int)avail;
+	err = process_mapped_frames(state, &count, mapper, cntrs);
 	if (err < 0)
 		return err;
 
-	// Trim according up to expected frame count.
-	if (*frame_count < avail)
-		avail_count = *frame_count;
-	else
-		avail_count = (unsigned int)avail;
-
-	// TODO: Perhaps, the complex layout can be supported as a variation of
-	// vector type. However, there's no driver with this layout.
-	if (layout->vector == NULL) {
-		char *buf;
-		buf = areas[0].addr;
-		buf += snd_pcm_frames_to_bytes(state->handle, frame_offset);
-		frame_buf = buf;
-	} else {
-		int i;
-		for (i = 0; i < layout->samples_per_frame; ++i) {
-			layout->vector[i] = areas[i].addr;
-			layout->vector[i] += snd_pcm_samples_to_bytes(
-						state->handle, frame_offset);
-		}
-		frame_buf = layout->vector;
-	}
+	// In batch mode, the rest of available frames after the boundary of
+	// buffer is processed in the same iteration.
+	if (state->frames_per_batch > 0 && count > 0 && count < avail) {
+		unsigned int rest = (unsigned int)avail - count;
 
-	err = mapper_context_process_frames(mapper, frame_buf, &avail_count,
-					    cntrs);
-	if (err < 0)
-		return err;
-	if (avail_count == 0) {
-		*frame_count = 0;
-		return 0;
+		err = process_mapped_frames(state, &rest, mapper, cntrs);
+		if (err < 0)
+			return err;
+		count += rest;
 	}
 
-	consumed_count = snd_pcm_mmap_commit(state->handle, frame_offset,
-					     avail_count);
-	if (consumed_count < 0)
-		return (int)consumed_count;
-	if (consumed_count != avail_count)
-		logging(state, "A bug of access plugin for this PCM node.\n");
-
-	*frame_count = consumed_count;
+	*frame_count = count;
 
 	return 0;
 }
@@ -206,10 +239,14 @@ static int irq_mmap_r_process_frames(struct libasound_state *state,
 	// SNDRV_PCM_IOCTL_STATUS_EXT, the above care is needless because
 	// mapped page frame is unused regardless of architectures in a point of
 	// cache coherency.
-	err = snd_pcm_status(state->handle, layout->status);
-	if (err < 0)
-		goto error;
-	s = snd_pcm_status_get_state(layout->status);
+	if (state->batch_status) {
+		s = state->status.state;
+	} else {
+		err = snd_pcm_status(state->handle, layout->status);
+		if (err < 0)
+			goto error;
+		s = snd_pcm_status_get_state(layout->status);
+	}
 
 	// TODO: if reporting something, do here with the status data.
 
@@ -245,10 +282,14 @@ static int irq_mmap_w_process_frames(struct libasound_state *state,
 	int err;
 
 	// Read my comment in 'irq_mmap_r_process_frames().
-	err = snd_pcm_status(state->handle, layout->status);
-	if (err < 0)
-		goto error;
-	s = snd_pcm_status_get_state(layout->status);
+	if (state->batch_status) {
+		s = state->status.state;
+	} else {
+		err = snd_pcm_status(state->handle, layout->status);
+		if (err < 0)
+			goto error;
+		s = snd_pcm_status_get_state(layout->status);
+	}
 
 	// TODO: if reporting something, do here with the status data.
 
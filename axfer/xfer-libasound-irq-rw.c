@@ -61,45 +61,71 @@ static int read_frames(struct libasound_state *state, unsigned int *frame_count,
 	struct rw_closure *closure = state->private_data;
 	snd_pcm_sframes_t handled_frame_count;
 	unsigned int consumed_count;
+	unsigned int count;
+	void *buf;
+	int i;
 	int err;
 
 	// Trim according up to expected frame count.
 	if (*frame_count < avail_count)
 		avail_count = *frame_count;
 
-	// Cache required amount of frames.
-	if (avail_count > frame_cache_get_count(&closure->cache)) {
-		avail_count -= frame_cache_get_count(&closure->cache);
+	// Cache required amount of frames. The space in cache is two segments
+	// at most.
+	for (i = 0; i < 2; ++i) {
+		unsigned int cached_count;
+
+		cached_count = frame_cache_get_count(&closure->cache);
+		if (avail_count <= cached_count)
+			break;
+
+		buf = frame_cache_get_tail(&closure->cache, &count);
+		if (count == 0)
+			break;
+		if (count > avail_count - cached_count)
+			count = avail_count - cached_count;
 
 		// Execute write operation according to the shape of buffer.
 		// These operations automatically start the substream.
 		if (closure->access == SND_PCM_ACCESS_RW_INTERLEAVED) {
-			handled_frame_count = snd_pcm_readi(state->handle,
-							closure->cache.buf_ptr,
-							avail_count);
+			handled_frame_count = snd_pcm_readi(state->handle, buf,
+							    count);
 		} else {
-			handled_frame_count = snd_pcm_readn(state->handle,
-							closure->cache.buf_ptr,
-							avail_count);
+			handled_frame_count = snd_pcm_readn(state->handle, buf,
+							    count);
 		}
 		if (handled_frame_count < 0) {
 			err = handled_frame_count;
 			return err;
 		}
 		frame_cache_increase_count(&closure->cache, handled_frame_count);
-		avail_count = frame_cache_get_count(&closure->cache);
+		if (handled_frame_count < count)
+			break;
 	}
+	if (avail_count > frame_cache_get_count(&closure->cache))
+		avail_count = frame_cache_get_count(&closure->cache);
 
 	// Write out to file descriptors.
-	consumed_count = avail_count;
-	err = mapper_context_process_frames(mapper, closure->cache.buf,
-					    &consumed_count, cntrs);
-	if (err < 0)
-		return err;
+	*frame_count = 0;
+	for (i = 0; i < 2; ++i) {
+		if (*frame_count >= avail_count)
+			break;
 
-	frame_cache_reduce(&closure->cache, consumed_count);
+		buf = frame_cache_get_head(&closure->cache, &count);
+		if (count > avail_count - *frame_count)
+			count = avail_count - *frame_count;
 
-	*frame_count = consumed_count;
+		consumed_count = count;
+		err = mapper_context_process_frames(mapper, buf,
+						    &consumed_count, cntrs);
+		if (err < 0)
+			return err;
+
+		frame_cache_reduce(&closure->cache, consumed_count);
+		*frame_count += consumed_count;
+		if (consumed_count < count)
+			break;
+	}
 
 	return 0;
 }
@@ -116,11 +142,12 @@ static int r_process_frames_blocking(struct libasound_state *state,
 
 	if (status == SND_PCM_STATE_RUNNING) {
 		// Check available space on the buffer.
-		avail = snd_pcm_avail(state->handle);
+		avail = xfer_libasound_get_avail(state);
 		if (avail < 0) {
 			err = avail;
 			goto error;
 		}
+		xfer_libasound_mark_avail(state);
 		avail_count = (snd_pcm_uframes_t)avail;
 
 		if (avail_count == 0) {
@@ -174,12 +201,17 @@ static int r_process_frames_nonblocking(struct libasound_state *state,
 			goto error;
 	}
 
-	// Check available space on the buffer.
-	avail = snd_pcm_avail(state->handle);
+	// Check available space on the buffer. After waking up by IRQ, the
+	// position of hardware is already synchronized by the handler.
+	if (state->use_waiter && state->batch_status)
+		avail = snd_pcm_avail_update(state->handle);
+	else
+		avail = xfer_libasound_get_avail(state);
 	if (avail < 0) {
 		err = avail;
 		goto error;
 	}
+	xfer_libasound_mark_avail(state);
 	avail_count = (snd_pcm_uframes_t)avail;
 
 	if (avail_count == 0) {
@@ -204,46 +236,76 @@ static int write_frames(struct libasound_state *state,
 			struct container_context *cntrs)
 {
 	struct rw_closure *closure = state->private_data;
-	snd_pcm_uframes_t consumed_count;
 	snd_pcm_sframes_t handled_frame_count;
+	unsigned int count;
+	void *buf;
+	int i;
 	int err;
 
 	// Trim according up to expected frame count.
 	if (*frame_count < avail_count)
 		avail_count = *frame_count;
 
-	// Cache required amount of frames.
-	if (avail_count > frame_cache_get_count(&closure->cache)) {
-		avail_count -= frame_cache_get_count(&closure->cache);
+	// Cache required amount of frames. The space in cache is two segments
+	// at most.
+	for (i = 0; i < 2; ++i) {
+		unsigned int cached_count;
+		unsigned int handled_count;
+
+		cached_count = frame_cache_get_count(&closure->cache);
+		if (avail_count <= cached_count)
+			break;
+
+		buf = frame_cache_get_tail(&closure->cache, &count);
+		if (count == 0)
+			break;
+		if (count > avail_count - cached_count)
+			count = avail_count - cached_count;
 
 		// Read frames to transfer.
-		err = mapper_context_process_frames(mapper,
-				closure->cache.buf_ptr, &avail_count, cntrs);
+		handled_count = count;
+		err = mapper_context_process_frames(mapper, buf, &handled_count,
+						    cntrs);
 		if (err < 0)
 			return err;
-		frame_cache_increase_count(&closure->cache, avail_count);
-		avail_count = frame_cache_get_count(&closure->cache);
+		frame_cache_increase_count(&closure->cache, handled_count);
+		if (handled_count < count)
+			break;
 	}
+	if (avail_count > frame_cache_get_count(&closure->cache))
+		avail_count = frame_cache_get_count(&closure->cache);
 
 	// Execute write operation according to the shape of buffer. These
 	// operations automatically start the stream.
-	consumed_count = avail_count;
-	if (closure->access == SND_PCM_ACCESS_RW_INTERLEAVED) {
-		handled_frame_count = snd_pcm_writei(state->handle,
-					closure->cache.buf, consumed_count);
-	} else {
-		handled_frame_count = snd_pcm_writen(state->handle,
-					closure->cache.buf, consumed_count);
-	}
-	if (handled_frame_count < 0) {
-		err = handled_frame_count;
-		return err;
-	}
+	*frame_count = 0;
+	for (i = 0; i < 2; ++i) {
+		if (*frame_count >= avail_count)
+			break;
 
-	consumed_count = handled_frame_count;
-	frame_cache_reduce(&closure->cache, consumed_count);
+		buf = frame_cache_get_head(&closure->cache, &count);
+		if (count > avail_count - *frame_count)
+			count = avail_count - *frame_count;
+
+		if (closure->access == SND_PCM_ACCESS_RW_INTERLEAVED) {
+			handled_frame_count = snd_pcm_writei(state->handle, buf,
+							     count);
+		} else {
+			handled_frame_count = snd_pcm_writen(state->handle, buf,
+							     count);
+		}
+		if (handled_frame_count < 0) {
+			// Report frames which were already transferred.
+			if (*frame_count > 0)
+				break;
+			err = handled_frame_count;
+			return err;
+		}
 
-	*frame_count = consumed_count;
+		frame_cache_reduce(&closure->cache, handled_frame_count);
+		*frame_count += handled_frame_count;
+		if (handled_frame_count < count)
+			break;
+	}
 
 	return 0;
 }
@@ -260,11 +322,12 @@ static int w_process_frames_blocking(struct libasound_state *state,
 
 	if (status == SND_PCM_STATE_RUNNING) {
 		// Check available space on the buffer.
-		avail = snd_pcm_avail(state->handle);
+		avail = xfer_libasound_get_avail(state);
 		if (avail < 0) {
 			err = avail;
 			goto error;
 		}
+		xfer_libasound_mark_avail(state);
 		avail_count = (unsigned int)avail;
 
 		if (avail_count == 0) {
@@ -328,12 +391,17 @@ static int w_process_frames_nonblocking(struct libasound_state *state,
 			goto error;
 	}
 
-	// Check available space on the buffer.
-	avail = snd_pcm_avail(state->handle);
+	// Check available space on the buffer. After waking up by IRQ, the
+	// position of hardware is already synchronized by the handler.
+	if (state->use_waiter && state->batch_status)
+		avail = snd_pcm_avail_update(state->handle);
+	else
+		avail = xfer_libasound_get_avail(state);
 	if (avail < 0) {
 		err = avail;
 		goto error;
 	}
+	xfer_libasound_mark_avail(state);
 	avail_count = (unsigned int)avail;
 
 	if (avail_count == 0) {
@@ -391,6 +459,11 @@ static int irq_rw_pre_process(struct libasound_state *state)
 	if (err < 0)
 		return err;
 
+	if (state->verbose) {
+		logging(state, "  pages for cache: %s\n",
+			page_buffer_mode_name(closure->cache.mode));
+	}
+
 	if (snd_pcm_stream(state->handle) == SND_PCM_STREAM_CAPTURE) {
 		if (state->nonblock)
 			closure->process_frames = r_process_frames_nonblocking;
@@ -415,7 +488,7 @@ static int irq_rw_process_frames(struct libasound_state *state,
 	snd_pcm_state_t status;
 
 	// Need to recover the stream.
-	status = snd_pcm_state(state->handle);
+	status = xfer_libasound_get_state(state);
 	if (status != SND_PCM_STATE_RUNNING && status != SND_PCM_STATE_PREPARED)
 		return -EPIPE;
 
@@ -0,0 +1,231 @@
+// SPDX-License-Identifier: GPL-2.0
+//
+// xfer-libasound-stats.c - serve statistics of transmission by unix domain
+//			    socket.
+//
+// Copyright (c) 2026 agent <agent@local>
+//
+// Licensed under the terms of the GNU General Public License, version 2.
+
+#include "xfer-libasound.h"
+#include "misc.h"
+
+#include <stdarg.h>
+#include <inttypes.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+
+// The report is written to a buffer allocated in advance, so that no memory
+// is allocated in the thread to transfer frames.
+#define REPORT_SIZE		65536
+// Clients are served up to this number at one wakeup.
+#define MAX_CLIENTS_PER_WAKEUP	4
+
+struct report {
+	char *buf;
+	size_t len;
+	bool overflow;
+};
+
+static void __attribute__((format(printf, 2, 3)))
+report_append(struct report *report, const char *fmt, ...)
+{
+	va_list ap;
+	int len;
+
+	if (report->overflow)
+		return;
+
+	va_start(ap, fmt);
+	len = vsnprintf(report->buf + report->len, REPORT_SIZE - report->len,
+			fmt, ap);
+	va_end(ap);
+
+	if (len < 0 || len >= REPORT_SIZE - report->len)
+		report->overflow = true;
+	else
+		report->len += len;
+}
+
+static void report_pcm(struct libasound_state *state, struct report *report)
+{
+	snd_pcm_sframes_t avail;
+	snd_pcm_sframes_t delay;
+	snd_pcm_state_t pcm_state;
+	int err;
+
+	// The cached status is used to avoid additional system calls.
+	if (state->batch_status) {
+		pcm_state = state->status.state;
+		avail = state->status.avail;
+		delay = snd_pcm_status_get_delay(state->status.status);
+		err = 0;
+	} else {
+		pcm_state = snd_pcm_state(state->handle);
+		err = snd_pcm_avail_delay(state->handle, &avail, &delay);
+	}
+
+	report_append(report, "\"state\":\"%s\",",
+		      snd_pcm_state_name(pcm_state));
+	report_append(report, "\"frames\":%" PRIu64 ",",
+		      state->stats.frame_count);
+	report_append(report, "\"xruns\":%u,", state->stats.xrun_count);
+	if (err < 0) {
+		report_append(report, "\"avail\":null,\"delay\":null,");
+	} else {
+		report_append(report, "\"avail\":%ld,\"delay\":%ld,",
+			      (long)avail, (long)delay);
+	}
+}
+
+static void report_latency(struct libasound_state *state,
+			   struct report *report)
+{
+	int i, j;
+
+	report_append(report, "\"latency\":{");
+	for (i = 0; i < LATENCY_STAGE_COUNT; ++i) {
+		const struct latency_histogram *hist = &state->latency.hists[i];
+		bool first = true;
+
+		report_append(report,
+			      "%s\"%s\":{\"count\":%" PRIu64 ","
+			      "\"p50\":%" PRIu64 ",\"p99\":%" PRIu64 ","
+			      "\"p99.9\":%" PRIu64 ",\"max\":%" PRIu64 ",",
+			      i > 0 ? "," : "", latency_stage_labels[i],
+			      hist->count,
+			      latency_histogram_get_percentile(hist, 50.0),
+			      latency_histogram_get_percentile(hist, 99.0),
+			      latency_histogram_get_percentile(hist, 99.9),
+			      hist->max);
+
+		// Pairs of log2 of lower bound in nsec and count.
+		report_append(report, "\"buckets\":[");
+		for (j = 0; j < LATENCY_BUCKET_COUNT; ++j) {
+			if (hist->buckets[j] == 0)
+				continue;
+			report_append(report, "%s[%d,%" PRIu64 "]",
+				      first ? "" : ",", j, hist->buckets[j]);
+			first = false;
+		}
+		report_append(report, "]}");
+	}
+	report_append(report, "},");
+}
+
+static void report_containers(struct libasound_state *state,
+			      struct report *report)
+{
+	int i;
+
+	report_append(report, "\"containers\":[");
+	for (i = 0; i < state->stats.cntr_count; ++i) {
+		struct container_context *cntr = state->stats.cntrs + i;
+		unsigned int level;
+		unsigned int capacity;
+
+		report_append(report, "%s{\"bytes\":%" PRIu64,
+			      i > 0 ? "," : "", cntr->handled_byte_count);
+		if (container_context_get_io_fill(cntr, &level,
+						  &capacity) >= 0) {
+			report_append(report,
+				      ",\"ring\":{\"level\":%u,\"capacity\":%u}",
+				      level, capacity);
+		}
+		report_append(report, "}");
+	}
+	report_append(report, "]");
+}
+
+static void serve_client(struct libasound_state *state, int fd)
+{
+	struct report report = {
+		.buf = state->stats.buf,
+	};
+	ssize_t result;
+
+	report_append(&report, "{");
+	report_pcm(state, &report);
+	report_latency(state, &report);
+	report_containers(state, &report);
+	report_append(&report, "}\n");
+	if (report.overflow)
+		return;
+
+	// The buffer of socket is usually enough for the report. The client
+	// is just discarded when it's not, instead of waiting for it.
+	result = send(fd, report.buf, report.len, MSG_DONTWAIT | MSG_NOSIGNAL);
+	if (result >= 0 && result < report.len && state->verbose)
+		logging(state, "A report of statistics is truncated.\n");
+}
+
+void xfer_libasound_stats_serve(struct libasound_state *state)
+{
+	int i;
+
+	for (i = 0; i < MAX_CLIENTS_PER_WAKEUP; ++i) {
+		int fd;
+
+		fd = accept4(state->stats.fd, NULL, NULL,
+			     SOCK_NONBLOCK | SOCK_CLOEXEC);
+		if (fd < 0)
+			break;
+
+		serve_client(state, fd);
+		close(fd);
+	}
+}
+
+int xfer_libasound_stats_prepare(struct libasound_state *state)
+{
+	struct sockaddr_un addr = {
+		.sun_family = AF_UNIX,
+	};
+	struct stat st;
+	int err;
+
+	if (strlen(state->stats.path) >= sizeof(addr.sun_path))
+		return -ENAMETOOLONG;
+	strcpy(addr.sun_path, state->stats.path);
+
+	// Remove the socket left by the previous run.
+	if (stat(state->stats.path, &st) == 0) {
+		if (!S_ISSOCK(st.st_mode)) {
+			logging(state, "Not a socket: %s\n", state->stats.path);
+			return -EEXIST;
+		}
+		unlink(state->stats.path);
+	}
+
+	state->stats.buf = malloc(REPORT_SIZE);
+	if (state->stats.buf == NULL)
+		return -ENOMEM;
+
+	state->stats.fd = socket(AF_UNIX,
+				 SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+	if (state->stats.fd < 0)
+		return -errno;
+
+	if (bind(state->stats.fd, (struct sockaddr *)&addr, sizeof(addr)) < 0 ||
+	    listen(state->stats.fd, MAX_CLIENTS_PER_WAKEUP) < 0) {
+		err = -errno;
+		close(state->stats.fd);
+		state->stats.fd = -1;
+		return err;
+	}
+
+	return 0;
+}
+
+void xfer_libasound_stats_release(struct libasound_state *state)
+{
+	if (state->stats.fd >= 0) {
+		close(state->stats.fd);
+		unlink(state->stats.path);
+	}
+	state->stats.fd = -1;
+
+	free(state->stats.buf);
+	state->stats.buf = NULL;
+}
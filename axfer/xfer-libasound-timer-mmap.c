@@ -9,6 +9,8 @@
 #include "xfer-libasound.h"
 #include "misc.h"
 
+#include <time.h>
+
 struct map_layout {
 	snd_pcm_status_t *status;
 	bool need_forward_or_rewind;
@@ -17,8 +19,66 @@ struct map_layout {
 	unsigned int frames_per_second;
 	unsigned int samples_per_frame;
 	unsigned int frames_per_buffer;
+
+	// For adaptive wakeup by timerfd waiter.
+	snd_pcm_uframes_t frames_for_avail_min;
+	uint64_t committed_count;
+	uint64_t last_pos;
+	struct timespec last_ts;
+	bool pos_valid;
+	unsigned int measured_rate;
 };
 
+// The position of hw_ptr is estimated by the sum of committed frames and
+// available frames, regardless of direction, except for constant offset. Its
+// rate against monotonic clock is smoothed so that the timer for next wakeup
+// follows the actual clock of hardware.
+static void measure_hw_rate(struct map_layout *layout,
+			    snd_pcm_uframes_t avail)
+{
+	struct timespec ts;
+	uint64_t pos;
+	uint64_t elapsed_nsec;
+	uint64_t rate;
+
+	if (clock_gettime(CLOCK_MONOTONIC, &ts) < 0)
+		return;
+	pos = layout->committed_count + avail;
+
+	if (layout->pos_valid && pos > layout->last_pos) {
+		elapsed_nsec = (ts.tv_sec - layout->last_ts.tv_sec) *
+			       1000000000ull +
+			       ts.tv_nsec - layout->last_ts.tv_nsec;
+		// Too short to measure, keep the last point.
+		if (elapsed_nsec < 1000000)
+			return;
+
+		rate = (pos - layout->last_pos) * 1000000000ull / elapsed_nsec;
+		if (layout->measured_rate == 0)
+			layout->measured_rate = rate;
+		else
+			layout->measured_rate =
+				(layout->measured_rate * 7 + rate) / 8;
+	}
+
+	layout->last_pos = pos;
+	layout->last_ts = ts;
+	layout->pos_valid = true;
+}
+
+static uint64_t estimate_wakeup_nsec(struct map_layout *layout,
+				     snd_pcm_uframes_t frame_count)
+{
+	unsigned int rate = layout->measured_rate;
+
+	// Guard from the rate far from nominal one; e.g. just after starting.
+	if (rate < layout->frames_per_second / 2 ||
+	    rate > layout->frames_per_second * 2)
+		rate = layout->frames_per_second;
+
+	return (uint64_t)frame_count * 1000000000ull / rate;
+}
+
 static int timer_mmap_pre_process(struct libasound_state *state)
 {
 	struct map_layout *layout = state->private_data;
@@ -116,6 +176,39 @@ static void *get_buffer(struct libasound_state *state,
 	return frame_buf;
 }
 
+static int process_segment(struct libasound_state *state,
+			   const snd_pcm_channel_area_t *areas,
+			   snd_pcm_uframes_t frame_offset,
+			   unsigned int *frame_count,
+			   struct mapper_context *mapper,
+			   struct container_context *cntrs)
+{
+	struct map_layout *layout = state->private_data;
+	snd_pcm_sframes_t consumed_count;
+	void *frame_buf;
+	int err;
+
+	frame_buf = get_buffer(state, areas, frame_offset);
+	err = mapper_context_process_frames(mapper, frame_buf, frame_count,
+					    cntrs);
+	if (err < 0)
+		return err;
+
+	consumed_count = snd_pcm_mmap_commit(state->handle, frame_offset,
+					     *frame_count);
+	if (consumed_count < 0)
+		return (int)consumed_count;
+	if (consumed_count != *frame_count) {
+		logging(state,
+			"A bug of 'hw' PCM plugin or driver for this PCM "
+			"node.\n");
+	}
+	*frame_count = consumed_count;
+	layout->committed_count += consumed_count;
+
+	return 0;
+}
+
 static int timer_mmap_process_frames(struct libasound_state *state,
 				     unsigned int *frame_count,
 				     struct mapper_context *mapper,
@@ -127,16 +220,19 @@ static int timer_mmap_process_frames(struct libasound_state *state,
 	snd_pcm_uframes_t avail_count;
 	const snd_pcm_channel_area_t *areas;
 	snd_pcm_uframes_t frame_offset;
-	void *frame_buf;
-	snd_pcm_sframes_t consumed_count;
+	unsigned int count;
 	int err;
 
 	// Retrieve avail space on PCM buffer between kernel/user spaces.
 	// On cache incoherent architectures, still care of data
 	// synchronization.
-	avail = snd_pcm_avail_update(state->handle);
+	if (state->batch_status)
+		avail = (snd_pcm_sframes_t)state->status.avail;
+	else
+		avail = snd_pcm_avail_update(state->handle);
 	if (avail < 0)
 		return (int)avail;
+	xfer_libasound_mark_avail(state);
 
 	// Retrieve pointers of the buffer and left space up to the boundary.
 	avail_count = (snd_pcm_uframes_t)avail;
@@ -145,49 +241,93 @@ static int timer_mmap_process_frames(struct libasound_state *state,
 	if (err < 0)
 		return err;
 
-	// MEMO: Use the amount of data frames as you like.
-	planned_count = layout->frames_per_buffer * random() / RAND_MAX;
-	if (frame_offset + planned_count > layout->frames_per_buffer)
+	if (state->waiter_type == WAITER_TYPE_TIMERFD)
+		measure_hw_rate(layout, avail);
+
+	if (state->frames_per_batch > 0) {
+		// Several periods in one iteration, across the boundary of
+		// buffer.
+		planned_count = state->frames_per_batch;
+	} else if (state->waiter_type == WAITER_TYPE_TIMERFD) {
+		// Wake up just at the time to have frames for avail_min.
+		if (layout->frames_for_avail_min == 0) {
+			err = snd_pcm_sw_params_get_avail_min(state->sw_params,
+						&layout->frames_for_avail_min);
+			if (err < 0)
+				return err;
+		}
+		planned_count = layout->frames_for_avail_min;
+	} else {
+		// MEMO: Use the amount of data frames as you like.
+		planned_count = layout->frames_per_buffer * random() / RAND_MAX;
+	}
+	if (state->frames_per_batch == 0 &&
+	    frame_offset + planned_count > layout->frames_per_buffer)
 		planned_count = layout->frames_per_buffer - frame_offset;
 
 	// Trim up to expected frame count.
 	if (*frame_count < planned_count)
 		planned_count = *frame_count;
 
+	// In batch mode, the frames after the boundary are available as well.
+	if (state->frames_per_batch > 0)
+		avail_count = (snd_pcm_uframes_t)avail;
+
 	// Yield this CPU till planned amount of frames become available.
 	if (avail_count < planned_count) {
 		unsigned short revents;
 		int timeout_msec;
 
-		// TODO; precise granularity of timeout; e.g. ppoll(2).
-		// Furthermore, wrap up according to granularity of reported
-		// value for hw_ptr.
-		timeout_msec = ((planned_count - avail_count) * 1000 +
-				layout->frames_per_second - 1) /
-			       layout->frames_per_second;
+		if (state->waiter_type == WAITER_TYPE_TIMERFD) {
+			uint64_t nsec;
+
+			nsec = estimate_wakeup_nsec(layout,
+						planned_count - avail_count);
+			err = waiter_context_set_wakeup(state->waiter, nsec);
+			if (err < 0)
+				return err;
+
+			// The timer expires before the timeout as fallback.
+			timeout_msec = nsec / 1000000 * 2 + 1;
+		} else {
+			// TODO; precise granularity of timeout; e.g. ppoll(2).
+			// Furthermore, wrap up according to granularity of
+			// reported value for hw_ptr.
+			timeout_msec = ((planned_count - avail_count) * 1000 +
+					layout->frames_per_second - 1) /
+				       layout->frames_per_second;
+		}
 
 		// TODO: However, experimentally, the above is not enough to
 		// keep planned amount of frames when waking up. I don't know
 		// exactly the mechanism yet.
+		revents = 0;
 		err = xfer_libasound_wait_event(state, timeout_msec,
 						&revents);
 		// MEMO: timeout is expected since the above call is just to measure time elapse.
 		if (err < 0 && err != -ETIMEDOUT)
 			return err;
-		if (revents & POLLERR) {
-			// TODO: error reporting.
-			return -EIO;
+		if (err == 0) {
+			if (revents & POLLERR) {
+				// TODO: error reporting.
+				return -EIO;
+			}
+			if (!(revents & (POLLIN | POLLOUT)))
+				return -EAGAIN;
 		}
-		if (!(revents & (POLLIN | POLLOUT)))
-			return -EAGAIN;
 
 		// MEMO: Need to perform hwsync explicitly because hwptr is not
 		// synchronized to actual position of data frame transmission
 		// on hardware because IRQ handlers are not used in this
-		// scheduling strategy.
-		avail = snd_pcm_avail(state->handle);
+		// scheduling strategy. When batching the query of status, the
+		// position is extrapolated from the last status instead.
+		avail = xfer_libasound_estimate_avail(state);
 		if (avail < 0)
 			return (int)avail;
+		xfer_libasound_mark_avail(state);
+		if (state->waiter_type == WAITER_TYPE_TIMERFD &&
+		    !state->batch_status)
+			measure_hw_rate(layout, avail);
 		if (avail < planned_count) {
 			logging(state,
 				"Wake up but not enough space: %lu %lu %u\n",
@@ -197,21 +337,44 @@ static int timer_mmap_process_frames(struct libasound_state *state,
 	}
 
 	// Let's process data frames.
-	*frame_count = planned_count;
-	frame_buf = get_buffer(state, areas, frame_offset);
-	err = mapper_context_process_frames(mapper, frame_buf, frame_count,
-					    cntrs);
+	count = planned_count;
+	if (frame_offset + count > layout->frames_per_buffer)
+		count = layout->frames_per_buffer - frame_offset;
+	err = process_segment(state, areas, frame_offset, &count, mapper,
+			      cntrs);
 	if (err < 0)
 		return err;
+	*frame_count = count;
 
-	consumed_count = snd_pcm_mmap_commit(state->handle, frame_offset,
-					     *frame_count);
-	if (consumed_count != *frame_count) {
-		logging(state,
-			"A bug of 'hw' PCM plugin or driver for this PCM "
-			"node.\n");
+	// The rest of batch is after the boundary of buffer.
+	if (count > 0 && count < planned_count &&
+	    frame_offset + count == layout->frames_per_buffer) {
+		avail_count = planned_count - count;
+		err = snd_pcm_mmap_begin(state->handle, &areas, &frame_offset,
+					 &avail_count);
+		if (err < 0)
+			return err;
+
+		count = (unsigned int)avail_count;
+		err = process_segment(state, areas, frame_offset, &count,
+				      mapper, cntrs);
+		if (err < 0)
+			return err;
+		*frame_count += count;
 	}
-	*frame_count = consumed_count;
+
+	return 0;
+}
+
+// The application position is moved after the batched query of status.
+static int refresh_avail(struct libasound_state *state)
+{
+	snd_pcm_sframes_t avail;
+
+	avail = snd_pcm_avail_update(state->handle);
+	if (avail < 0)
+		return (int)avail;
+	state->status.avail = (snd_pcm_uframes_t)avail;
 
 	return 0;
 }
@@ -256,10 +419,14 @@ static int timer_mmap_r_process_frames(struct libasound_state *state,
 	// IRQ-based operations.
 	// Here, this is just to query current status to hardware, for later
 	// processing.
-	err = snd_pcm_status(state->handle, layout->status);
-	if (err < 0)
-		goto error;
-	s = snd_pcm_status_get_state(layout->status);
+	if (state->batch_status) {
+		s = state->status.state;
+	} else {
+		err = snd_pcm_status(state->handle, layout->status);
+		if (err < 0)
+			goto error;
+		s = snd_pcm_status_get_state(layout->status);
+	}
 
 	// TODO: if reporting something, do here with the status data.
 
@@ -271,6 +438,13 @@ static int timer_mmap_r_process_frames(struct libasound_state *state,
 			if (err < 0)
 				goto error;
 			layout->need_forward_or_rewind = false;
+			// The estimated position is discontinued.
+			layout->pos_valid = false;
+			if (state->batch_status) {
+				err = refresh_avail(state);
+				if (err < 0)
+					goto error;
+			}
 		}
 
 		err = timer_mmap_process_frames(state, frame_count, mapper,
@@ -381,10 +555,14 @@ static int timer_mmap_w_process_frames(struct libasound_state *state,
 	int err;
 
 	// Read my comment in 'timer_mmap_w_process_frames()'.
-	err = snd_pcm_status(state->handle, layout->status);
-	if (err < 0)
-		goto error;
-	s = snd_pcm_status_get_state(layout->status);
+	if (state->batch_status) {
+		s = state->status.state;
+	} else {
+		err = snd_pcm_status(state->handle, layout->status);
+		if (err < 0)
+			goto error;
+		s = snd_pcm_status_get_state(layout->status);
+	}
 
 	// TODO: if reporting something, do here with the status data.
 
@@ -396,6 +574,13 @@ static int timer_mmap_w_process_frames(struct libasound_state *state,
 			if (err < 0)
 				goto error;
 			layout->need_forward_or_rewind = false;
+			// The estimated position is discontinued.
+			layout->pos_valid = false;
+			if (state->batch_status) {
+				err = refresh_avail(state);
+				if (err < 0)
+					goto error;
+			}
 		}
 
 		err = timer_mmap_process_frames(state, frame_count, mapper,
@@ -0,0 +1,264 @@
+// SPDX-License-Identifier: GPL-2.0
+//
+// xfer-libasound-tstamp.c - record timestamps of captured frames to a
+//			     sidecar file.
+//
+// Copyright (c) 2026 agent <agent@local>
+//
+// Licensed under the terms of the GNU General Public License, version 2.
+
+#include "xfer-libasound.h"
+#include "misc.h"
+
+#include <fcntl.h>
+#include <unistd.h>
+
+// The sidecar consists of a header and records in host byte order. Each
+// record tells the position of hardware in frames since the start of
+// capture, with the system and audio timestamps of the position, as
+// snd_pcm_status() reports after each iteration. The records are written to
+// a buffer allocated in advance, and to the file when it is full.
+#define TSTAMP_MAGIC		"AXTS"
+#define TSTAMP_VERSION		1
+#define RECORDS_PER_WRITE	256
+
+struct tstamp_header {
+	char magic[4];
+	uint32_t version;
+	uint32_t frames_per_second;
+	uint32_t tstamp_type;
+	uint32_t audio_tstamp_type;
+	uint32_t reserved;
+};
+
+struct tstamp_record {
+	uint64_t frame;
+	int64_t tstamp_nsec;
+	int64_t audio_tstamp_nsec;
+};
+
+static const char *const tstamp_type_labels[] = {
+	[SND_PCM_TSTAMP_TYPE_GETTIMEOFDAY] = "gettimeofday",
+	[SND_PCM_TSTAMP_TYPE_MONOTONIC] = "monotonic",
+	[SND_PCM_TSTAMP_TYPE_MONOTONIC_RAW] = "monotonic-raw",
+};
+
+static const char *const audio_tstamp_type_labels[] = {
+	[SND_PCM_AUDIO_TSTAMP_TYPE_COMPAT] = "compat",
+	[SND_PCM_AUDIO_TSTAMP_TYPE_DEFAULT] = "default",
+	[SND_PCM_AUDIO_TSTAMP_TYPE_LINK] = "link",
+	[SND_PCM_AUDIO_TSTAMP_TYPE_LINK_ABSOLUTE] = "link-absolute",
+	[SND_PCM_AUDIO_TSTAMP_TYPE_LINK_ESTIMATED] = "link-estimated",
+	[SND_PCM_AUDIO_TSTAMP_TYPE_LINK_SYNCHRONIZED] = "link-synchronized",
+};
+
+static int type_from_label(const char *const *labels, unsigned int count,
+			   const char *literal)
+{
+	int i;
+
+	for (i = 0; i < count; ++i) {
+		if (labels[i] != NULL && !strcmp(labels[i], literal))
+			return i;
+	}
+
+	return -EINVAL;
+}
+
+int xfer_libasound_tstamp_validate(struct libasound_state *state,
+				   snd_pcm_stream_t direction)
+{
+	struct libasound_tstamp *ts = &state->tstamp;
+	int type;
+
+	if (ts->path == NULL) {
+		if (ts->type_literal != NULL ||
+		    ts->audio_type_literal != NULL) {
+			fprintf(stderr,
+				"Options for type of timestamp should be used "
+				"with an option for timestamp file.\n");
+			return -EINVAL;
+		}
+		return 0;
+	}
+
+	if (direction != SND_PCM_STREAM_CAPTURE) {
+		fprintf(stderr,
+			"An option for timestamp file is available for capture "
+			"only.\n");
+		return -EINVAL;
+	}
+
+	// The batched query of status compares timestamps to monotonic clock.
+	ts->type = state->batch_status ? SND_PCM_TSTAMP_TYPE_MONOTONIC :
+					 SND_PCM_TSTAMP_TYPE_MONOTONIC_RAW;
+	if (ts->type_literal != NULL) {
+		type = type_from_label(tstamp_type_labels,
+				       ARRAY_SIZE(tstamp_type_labels),
+				       ts->type_literal);
+		if (type < 0) {
+			fprintf(stderr, "Unsupported type of timestamp: %s\n",
+				ts->type_literal);
+			return type;
+		}
+		if (state->batch_status &&
+		    type != SND_PCM_TSTAMP_TYPE_MONOTONIC) {
+			fprintf(stderr,
+				"Batched query of status is available with "
+				"monotonic type of timestamp only.\n");
+			return -EINVAL;
+		}
+		ts->type = type;
+	}
+
+	ts->audio_type = SND_PCM_AUDIO_TSTAMP_TYPE_DEFAULT;
+	if (ts->audio_type_literal != NULL) {
+		type = type_from_label(audio_tstamp_type_labels,
+				       ARRAY_SIZE(audio_tstamp_type_labels),
+				       ts->audio_type_literal);
+		if (type < 0) {
+			fprintf(stderr,
+				"Unsupported type of audio timestamp: %s\n",
+				ts->audio_type_literal);
+			return type;
+		}
+		ts->audio_type = type;
+	}
+
+	return 0;
+}
+
+int xfer_libasound_tstamp_prepare(struct libasound_state *state,
+				  unsigned int frames_per_second)
+{
+	struct libasound_tstamp *ts = &state->tstamp;
+	struct tstamp_header header = {0};
+	int err;
+
+	// The hardware falls back to the default type.
+	if (!snd_pcm_hw_params_supports_audio_ts_type(state->hw_params,
+						      ts->audio_type)) {
+		logging(state,
+			"The %s type of audio timestamp is not supported. Use "
+			"the default type.\n",
+			audio_tstamp_type_labels[ts->audio_type]);
+		ts->audio_type = SND_PCM_AUDIO_TSTAMP_TYPE_DEFAULT;
+	}
+
+	err = snd_pcm_sw_params_set_tstamp_mode(state->handle, state->sw_params,
+						SND_PCM_TSTAMP_ENABLE);
+	if (err < 0)
+		return err;
+	err = snd_pcm_sw_params_set_tstamp_type(state->handle, state->sw_params,
+						ts->type);
+	if (err < 0)
+		return err;
+
+	err = snd_pcm_status_malloc(&ts->status);
+	if (err < 0)
+		return err;
+
+	ts->records = calloc(RECORDS_PER_WRITE, sizeof(struct tstamp_record));
+	if (ts->records == NULL)
+		return -ENOMEM;
+
+	ts->fd = open(ts->path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+	if (ts->fd < 0)
+		return -errno;
+
+	memcpy(header.magic, TSTAMP_MAGIC, sizeof(header.magic));
+	header.version = TSTAMP_VERSION;
+	header.frames_per_second = frames_per_second;
+	header.tstamp_type = ts->type;
+	header.audio_tstamp_type = ts->audio_type;
+	if (write(ts->fd, &header, sizeof(header)) != sizeof(header))
+		return errno > 0 ? -errno : -EIO;
+
+	if (state->verbose) {
+		logging(state, "Timestamp file:\n");
+		logging(state, "  %s, %s, audio %s\n", ts->path,
+			tstamp_type_labels[ts->type],
+			audio_tstamp_type_labels[ts->audio_type]);
+	}
+
+	return 0;
+}
+
+static int flush_records(struct libasound_tstamp *ts)
+{
+	size_t size = ts->record_count * sizeof(struct tstamp_record);
+	ssize_t len;
+
+	len = write(ts->fd, ts->records, size);
+	ts->record_count = 0;
+	if (len < 0)
+		return -errno;
+	if (len != size)
+		return -EIO;
+
+	return 0;
+}
+
+static inline int64_t timespec_nsec(const snd_htimestamp_t *ts)
+{
+	return (int64_t)ts->tv_sec * 1000000000 + ts->tv_nsec;
+}
+
+// After frame_count frames are read in the iteration.
+void xfer_libasound_tstamp_record(struct libasound_state *state,
+				  unsigned int frame_count)
+{
+	struct libasound_tstamp *ts = &state->tstamp;
+	snd_pcm_audio_tstamp_config_t config = {0};
+	struct tstamp_record *record;
+	snd_htimestamp_t tstamp;
+	snd_htimestamp_t audio_tstamp;
+	int err;
+
+	ts->frame_count += frame_count;
+
+	config.type_requested = ts->audio_type;
+	snd_pcm_status_set_audio_htstamp_config(ts->status, &config);
+	if (snd_pcm_status(state->handle, ts->status) < 0)
+		return;
+	if (snd_pcm_status_get_state(ts->status) != SND_PCM_STATE_RUNNING)
+		return;
+	snd_pcm_status_get_htstamp(ts->status, &tstamp);
+	snd_pcm_status_get_audio_htstamp(ts->status, &audio_tstamp);
+
+	// The frames captured but not read yet are before the position.
+	record = (struct tstamp_record *)ts->records + ts->record_count;
+	record->frame = ts->frame_count +
+			snd_pcm_status_get_avail(ts->status);
+	record->tstamp_nsec = timespec_nsec(&tstamp);
+	record->audio_tstamp_nsec = timespec_nsec(&audio_tstamp);
+
+	if (++ts->record_count >= RECORDS_PER_WRITE) {
+		err = flush_records(ts);
+		if (err < 0 && !ts->failed) {
+			logging(state, "Fail to write timestamp file: %s\n",
+				strerror(-err));
+			ts->failed = true;
+		}
+	}
+}
+
+void xfer_libasound_tstamp_release(struct libasound_state *state)
+{
+	struct libasound_tstamp *ts = &state->tstamp;
+
+	if (ts->fd >= 0) {
+		if (ts->record_count > 0)
+			flush_records(ts);
+		close(ts->fd);
+	}
+	ts->fd = -1;
+
+	free(ts->records);
+	ts->records = NULL;
+	ts->record_count = 0;
+
+	if (ts->status)
+		snd_pcm_status_free(ts->status);
+	ts->status = NULL;
+}
@@ -9,11 +9,51 @@
 #include "xfer-libasound.h"
 #include "misc.h"
 
+#include <signal.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+
 static const char *const sched_model_labels [] = {
 	[SCHED_MODEL_IRQ] = "irq",
 	[SCHED_MODEL_TIMER] = "timer",
 };
 
+const char *const latency_stage_labels[LATENCY_STAGE_COUNT] = {
+	[LATENCY_STAGE_WAKEUP_TO_AVAIL] = "wakeup-to-avail",
+	[LATENCY_STAGE_AVAIL_TO_TRANSFER] = "avail-to-transfer",
+	[LATENCY_STAGE_WAKEUP_TO_TRANSFER] = "wakeup-to-transfer",
+	[LATENCY_STAGE_WAKEUP_INTERVAL] = "wakeup-interval",
+};
+
+// Set by SIGUSR1 to dump histograms of latency.
+static volatile sig_atomic_t latency_dump_requested;
+
+// The name of PCM node to aggregate several nodes.
+#define LINKED_NODE_NAME	"axfer_linked"
+
+// Enough for the stack used in an iteration.
+#define PREFAULT_STACK_SIZE	(64 * 1024)
+
+#ifndef SCHED_DEADLINE
+#define SCHED_DEADLINE		6
+#endif
+#ifndef SCHED_FLAG_RESET_ON_FORK
+#define SCHED_FLAG_RESET_ON_FORK	0x01
+#endif
+
+// The layout of 'struct sched_attr' in UAPI of Linux kernel. Some versions of
+// glibc have neither the structure nor the wrapper of system call.
+struct deadline_attr {
+	uint32_t size;
+	uint32_t sched_policy;
+	uint64_t sched_flags;
+	int32_t sched_nice;
+	uint32_t sched_priority;
+	uint64_t sched_runtime;
+	uint64_t sched_deadline;
+	uint64_t sched_period;
+};
+
 enum no_short_opts {
         // 200 or later belong to non us-ascii character set.
 	OPT_PERIOD_SIZE = 200,
@@ -26,6 +66,17 @@ enum no_short_opts {
 	OPT_DISABLE_SOFTVOL,
 	OPT_FATAL_ERRORS,
 	OPT_TEST_NOWAIT,
+	OPT_DUMP_LATENCY,
+	OPT_CPU_AFFINITY,
+	OPT_SCHED_PRIORITY,
+	OPT_SCHED_DEADLINE,
+	OPT_MLOCK,
+	OPT_BATCH_STATUS,
+	OPT_STATS_SOCKET,
+	OPT_BATCH_PERIODS,
+	OPT_TSTAMP_FILE,
+	OPT_TSTAMP_TYPE,
+	OPT_AUDIO_TSTAMP_TYPE,
 	// Obsoleted.
 	OPT_TEST_POSITION,
 	OPT_TEST_COEF,
@@ -45,6 +96,12 @@ static const struct option l_opts[] = {
 	{"stop-delay",		1, 0, 'T'},
 	{"waiter-type",		1, 0, OPT_WAITER_TYPE},
 	{"sched-model",		1, 0, OPT_SCHED_MODEL},
+	{"batch-periods",	1, 0, OPT_BATCH_PERIODS},
+	// For realtime attributes.
+	{"cpu-affinity",	1, 0, OPT_CPU_AFFINITY},
+	{"sched-priority",	1, 0, OPT_SCHED_PRIORITY}, // to SCHED_FIFO
+	{"sched-deadline",	1, 0, OPT_SCHED_DEADLINE},
+	{"mlock",		0, 0, OPT_MLOCK},
 	// For plugins in alsa-lib.
 	{"disable-resample",	0, 0, OPT_DISABLE_RESAMPLE},
 	{"disable-channels",	0, 0, OPT_DISABLE_CHANNELS},
@@ -53,6 +110,12 @@ static const struct option l_opts[] = {
 	// For debugging.
 	{"fatal-errors",	0, 0, OPT_FATAL_ERRORS},
 	{"test-nowait",		0, 0, OPT_TEST_NOWAIT},
+	{"dump-latency",	0, 0, OPT_DUMP_LATENCY},
+	{"batch-status",	0, 0, OPT_BATCH_STATUS},
+	{"stats-socket",	1, 0, OPT_STATS_SOCKET},
+	{"tstamp-file",		1, 0, OPT_TSTAMP_FILE},
+	{"tstamp-type",		1, 0, OPT_TSTAMP_TYPE},
+	{"audio-tstamp-type",	1, 0, OPT_AUDIO_TSTAMP_TYPE},
 	// Obsoleted.
 	{"chmap",		1, 0, 'm'},
 	{"test-position",	0, 0, OPT_TEST_POSITION},
@@ -65,6 +128,9 @@ static int xfer_libasound_init(struct xfer_context *xfer,
 	struct libasound_state *state = xfer->private_data;
 	int err;
 
+	state->stats.fd = -1;
+	state->tstamp.fd = -1;
+
 	err = snd_output_stdio_attach(&state->log, stderr, 0);
 	if (err < 0)
 		return err;
@@ -76,6 +142,27 @@ static int xfer_libasound_init(struct xfer_context *xfer,
 	return snd_pcm_sw_params_malloc(&state->sw_params);
 }
 
+static int add_node_literal(struct xfer_context *xfer, const char *literal)
+{
+	struct libasound_state *state = xfer->private_data;
+	char **literals;
+
+	literals = realloc(state->node_literals,
+			   (state->node_count + 1) * sizeof(*literals));
+	if (literals == NULL)
+		return -ENOMEM;
+	state->node_literals = literals;
+
+	literals[state->node_count] = strdup(literal);
+	if (literals[state->node_count] == NULL)
+		return -ENOMEM;
+	++state->node_count;
+
+	xfer->device_count = state->node_count;
+
+	return 0;
+}
+
 static int xfer_libasound_parse_opt(struct xfer_context *xfer, int key,
 				    const char *optarg)
 {
@@ -83,7 +170,7 @@ static int xfer_libasound_parse_opt(struct xfer_context *xfer, int key,
 	int err = 0;
 
 	if (key == 'D')
-		state->node_literal = arg_duplicate_string(optarg, &err);
+		err = add_node_literal(xfer, optarg);
 	else if (key == 'N')
 		state->nonblock = true;
 	else if (key == 'M')
@@ -122,12 +209,98 @@ static int xfer_libasound_parse_opt(struct xfer_context *xfer, int key,
 		state->finish_at_xrun = true;
 	else if (key == OPT_TEST_NOWAIT)
 		state->test_nowait = true;
+	else if (key == OPT_DUMP_LATENCY)
+		state->dump_latency = true;
+	else if (key == OPT_CPU_AFFINITY)
+		state->cpu_affinity_literal = arg_duplicate_string(optarg, &err);
+	else if (key == OPT_SCHED_PRIORITY)
+		state->sched_priority = arg_parse_decimal_num(optarg, &err);
+	else if (key == OPT_SCHED_DEADLINE)
+		state->sched_runtime_usec = arg_parse_decimal_num(optarg, &err);
+	else if (key == OPT_MLOCK)
+		state->mlock = true;
+	else if (key == OPT_BATCH_STATUS)
+		state->batch_status = true;
+	else if (key == OPT_STATS_SOCKET)
+		state->stats.path = arg_duplicate_string(optarg, &err);
+	else if (key == OPT_TSTAMP_FILE)
+		state->tstamp.path = arg_duplicate_string(optarg, &err);
+	else if (key == OPT_TSTAMP_TYPE)
+		state->tstamp.type_literal = arg_duplicate_string(optarg, &err);
+	else if (key == OPT_AUDIO_TSTAMP_TYPE)
+		state->tstamp.audio_type_literal =
+					arg_duplicate_string(optarg, &err);
+	else if (key == OPT_BATCH_PERIODS)
+		state->batch_periods = arg_parse_decimal_num(optarg, &err);
 	else
 		err = -ENXIO;
 
 	return err;
 }
 
+// The list of CPUs such as '0,2-3'.
+static int parse_cpu_list(const char *literal, cpu_set_t *set)
+{
+	const char *pos = literal;
+	unsigned long first, last;
+	char *term;
+
+	CPU_ZERO(set);
+
+	while (*pos != '\0') {
+		errno = 0;
+		first = strtoul(pos, &term, 10);
+		if (errno != 0 || term == pos)
+			return -EINVAL;
+		last = first;
+		pos = term;
+
+		if (*pos == '-') {
+			++pos;
+			last = strtoul(pos, &term, 10);
+			if (errno != 0 || term == pos || last < first)
+				return -EINVAL;
+			pos = term;
+		}
+
+		if (last >= CPU_SETSIZE)
+			return -EINVAL;
+		while (first <= last) {
+			CPU_SET(first, set);
+			++first;
+		}
+
+		if (*pos == ',')
+			++pos;
+		else if (*pos != '\0')
+			return -EINVAL;
+	}
+
+	if (CPU_COUNT(set) == 0)
+		return -EINVAL;
+
+	return 0;
+}
+
+static int validate_sched_priority(struct libasound_state *state)
+{
+	int val;
+
+	val = sched_get_priority_max(SCHED_FIFO);
+	if (val < 0)
+		return -errno;
+	if (state->sched_priority > val)
+		return -EINVAL;
+
+	val = sched_get_priority_min(SCHED_FIFO);
+	if (val < 0)
+		return -errno;
+	if (state->sched_priority < val)
+		return -EINVAL;
+
+	return 0;
+}
+
 int xfer_libasound_validate_opts(struct xfer_context *xfer)
 {
 	struct libasound_state *state = xfer->private_data;
@@ -135,10 +308,20 @@ int xfer_libasound_validate_opts(struct xfer_context *xfer)
 
 	state->verbose = xfer->verbose > 1;
 
-	if (state->node_literal == NULL) {
-		state->node_literal = strdup("default");
-		if (state->node_literal == NULL)
-			return -ENOMEM;
+	if (state->node_count == 0) {
+		err = add_node_literal(xfer, "default");
+		if (err < 0)
+			return err;
+	}
+
+	if (state->node_count > 1) {
+		if (state->sched_model_literal != NULL &&
+		    !strcmp(state->sched_model_literal, "timer")) {
+			fprintf(stderr,
+				"Timer-based scheduling model is not available "
+				"with several devices.\n");
+			return -EINVAL;
+		}
 	}
 
 	if (state->mmap && state->nonblock) {
@@ -200,6 +383,71 @@ int xfer_libasound_validate_opts(struct xfer_context *xfer)
 		state->waiter_type = WAITER_TYPE_DEFAULT;
 	}
 
+	if (state->batch_periods > 0 && !state->mmap) {
+		fprintf(stderr,
+			"An option for batch periods should be used with mmap "
+			"or timer-based scheduling options.\n");
+		return -EINVAL;
+	}
+
+	if (state->stats.path != NULL) {
+		if (state->test_nowait ||
+		    (!state->nonblock && !state->mmap)) {
+			fprintf(stderr,
+				"An option for stats socket should be used "
+				"with nonblock or mmap or timer-based "
+				"scheduling options, without nowait test "
+				"option.\n");
+			return -EINVAL;
+		}
+		// The socket is polled with PCM substream.
+		if (state->waiter_type == WAITER_TYPE_DEFAULT)
+			state->waiter_type = WAITER_TYPE_POLL;
+	}
+
+	err = xfer_libasound_tstamp_validate(state, xfer->direction);
+	if (err < 0)
+		return err;
+
+	// Both use SIGUSR1.
+	if (state->dump_latency && xfer->recorder) {
+		fprintf(stderr,
+			"An option to dump latency is not available with "
+			"options for recorder.\n");
+		return -EINVAL;
+	}
+
+	state->measure_latency = state->dump_latency ||
+				 state->stats.path != NULL;
+
+	if (state->cpu_affinity_literal != NULL) {
+		err = parse_cpu_list(state->cpu_affinity_literal,
+				     &state->cpu_set);
+		if (err < 0) {
+			fprintf(stderr,
+				"A list of CPUs is invalid: %s\n",
+				state->cpu_affinity_literal);
+			return err;
+		}
+	}
+
+	if (state->sched_priority > 0 && state->sched_runtime_usec > 0) {
+		fprintf(stderr,
+			"Neither an option for priority nor deadline is "
+			"available at the same time.\n");
+		return -EINVAL;
+	}
+
+	if (state->sched_priority > 0) {
+		err = validate_sched_priority(state);
+		if (err < 0) {
+			fprintf(stderr,
+				"The priority for SCHED_FIFO is out of "
+				"range.\n");
+			return err;
+		}
+	}
+
 	return err;
 }
 
@@ -214,10 +462,15 @@ static int set_access_hw_param(struct libasound_state *state)
 	snd_pcm_access_mask_none(mask);
 	if (state->mmap) {
 		snd_pcm_access_mask_set(mask, SND_PCM_ACCESS_MMAP_INTERLEAVED);
-		snd_pcm_access_mask_set(mask, SND_PCM_ACCESS_MMAP_NONINTERLEAVED);
+		// The mapper demuxes interleaved frames into each device.
+		if (state->node_count == 1)
+			snd_pcm_access_mask_set(mask,
+					SND_PCM_ACCESS_MMAP_NONINTERLEAVED);
 	} else {
 		snd_pcm_access_mask_set(mask, SND_PCM_ACCESS_RW_INTERLEAVED);
-		snd_pcm_access_mask_set(mask, SND_PCM_ACCESS_RW_NONINTERLEAVED);
+		if (state->node_count == 1)
+			snd_pcm_access_mask_set(mask,
+					SND_PCM_ACCESS_RW_NONINTERLEAVED);
 	}
 	err = snd_pcm_hw_params_set_access_mask(state->handle, state->hw_params,
 						mask);
@@ -257,6 +510,69 @@ static int disable_period_wakeup(struct libasound_state *state)
 	return err;
 }
 
+// The 'multi' PCM plugin in alsa-lib aggregates the nodes. It links slave
+// PCMs by snd_pcm_link() if possible so that they start at the same time,
+// and uses poll descriptors of the master for all of them.
+static int open_linked_handle(struct xfer_context *xfer, int mode)
+{
+	struct libasound_state *state = xfer->private_data;
+	snd_output_t *output;
+	snd_input_t *input;
+	snd_config_t *top = NULL;
+	char *literal;
+	size_t len;
+	int i, j;
+	int err;
+
+	err = snd_output_buffer_open(&output);
+	if (err < 0)
+		return err;
+
+	snd_output_printf(output, "pcm.%s {\n", LINKED_NODE_NAME);
+	snd_output_printf(output, "  type multi\n");
+	for (i = 0; i < state->node_count; ++i) {
+		snd_output_printf(output,
+				  "  slaves.%d { pcm \"%s\" channels %u }\n",
+				  i, state->node_literals[i],
+				  xfer->samples_per_frame);
+	}
+	for (i = 0; i < state->node_count; ++i) {
+		for (j = 0; j < xfer->samples_per_frame; ++j) {
+			snd_output_printf(output,
+				"  bindings.%d { slave %d channel %d }\n",
+				i * xfer->samples_per_frame + j, i, j);
+		}
+	}
+	snd_output_printf(output, "  master 0\n");
+	snd_output_printf(output, "}\n");
+	len = snd_output_buffer_string(output, &literal);
+
+	// The slaves are resolved in a copy of global configuration space.
+	err = snd_config_update();
+	if (err < 0)
+		goto end;
+	err = snd_config_copy(&top, snd_config);
+	if (err < 0)
+		goto end;
+
+	err = snd_input_buffer_open(&input, literal, len);
+	if (err < 0)
+		goto end;
+	err = snd_config_load(top, input);
+	snd_input_close(input);
+	if (err < 0)
+		goto end;
+
+	err = snd_pcm_open_lconf(&state->handle, LINKED_NODE_NAME,
+				 xfer->direction, mode, top);
+end:
+	if (top)
+		snd_config_delete(top);
+	snd_output_close(output);
+
+	return err;
+}
+
 static int open_handle(struct xfer_context *xfer)
 {
 	struct libasound_state *state = xfer->private_data;
@@ -274,12 +590,20 @@ static int open_handle(struct xfer_context *xfer)
 	if (state->no_softvol)
 		mode |= SND_PCM_NO_SOFTVOL;
 
-	err = snd_pcm_open(&state->handle, state->node_literal, xfer->direction,
-			   mode);
+	if (state->node_count > 1) {
+		err = open_linked_handle(xfer, mode);
+	} else {
+		err = snd_pcm_open(&state->handle, state->node_literals[0],
+				   xfer->direction, mode);
+	}
 	if (err < 0) {
-		logging(state, "Fail to open libasound PCM node for %s: %s\n",
-			snd_pcm_stream_name(xfer->direction),
-			state->node_literal);
+		int i;
+
+		logging(state, "Fail to open libasound PCM node for %s:",
+			snd_pcm_stream_name(xfer->direction));
+		for (i = 0; i < state->node_count; ++i)
+			logging(state, " %s", state->node_literals[i]);
+		logging(state, "\n");
 		return err;
 	}
 
@@ -328,7 +652,9 @@ static int prepare_waiter(struct libasound_state *state)
 	if (state->waiter == NULL)
 		return -ENOMEM;
 
-	err = waiter_context_init(state->waiter, state->waiter_type, pfd_count);
+	// One more for the socket of statistics.
+	err = waiter_context_init(state->waiter, state->waiter_type,
+				  pfd_count + (state->stats.fd >= 0));
 	if (err < 0)
 		return err;
 
@@ -337,9 +663,91 @@ static int prepare_waiter(struct libasound_state *state)
 	if (err < 0)
 		return err;
 
+	if (state->stats.fd >= 0) {
+		state->stats.pfd_index = pfd_count;
+		state->waiter->pfds[pfd_count].fd = state->stats.fd;
+		state->waiter->pfds[pfd_count].events = POLLIN;
+	}
+
 	return waiter_context_prepare(state->waiter);
 }
 
+static void mark_wakeup(struct libasound_state *state)
+{
+	if (state->measure_latency) {
+		clock_gettime(CLOCK_MONOTONIC_RAW, &state->latency.wakeup);
+		state->latency.avail_marked = false;
+	}
+}
+
+static void record_latency(struct libasound_state *state)
+{
+	struct libasound_latency *latency = &state->latency;
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC_RAW, &now);
+
+	if (latency->avail_marked) {
+		latency_histogram_add(
+			&latency->hists[LATENCY_STAGE_WAKEUP_TO_AVAIL],
+			latency_elapsed_nsec(&latency->wakeup,
+					     &latency->avail));
+		latency_histogram_add(
+			&latency->hists[LATENCY_STAGE_AVAIL_TO_TRANSFER],
+			latency_elapsed_nsec(&latency->avail, &now));
+	}
+	latency_histogram_add(&latency->hists[LATENCY_STAGE_WAKEUP_TO_TRANSFER],
+			      latency_elapsed_nsec(&latency->wakeup, &now));
+
+	if (latency->prev_marked) {
+		latency_histogram_add(
+			&latency->hists[LATENCY_STAGE_WAKEUP_INTERVAL],
+			latency_elapsed_nsec(&latency->prev_wakeup,
+					     &latency->wakeup));
+	}
+	latency->prev_wakeup = latency->wakeup;
+	latency->prev_marked = true;
+}
+
+static void dump_latency(struct libasound_state *state)
+{
+	int i;
+
+	logging(state, "Latency (usec):\n");
+	logging(state, "  %-20s %10s %10s %10s %10s %10s\n",
+		"stage", "count", "p50", "p99", "p99.9", "max");
+	for (i = 0; i < LATENCY_STAGE_COUNT; ++i) {
+		const struct latency_histogram *hist = &state->latency.hists[i];
+
+		logging(state,
+			"  %-20s %10llu %10.1f %10.1f %10.1f %10.1f\n",
+			latency_stage_labels[i],
+			(unsigned long long)hist->count,
+			latency_histogram_get_percentile(hist, 50.0) / 1000.0,
+			latency_histogram_get_percentile(hist, 99.0) / 1000.0,
+			latency_histogram_get_percentile(hist, 99.9) / 1000.0,
+			hist->max / 1000.0);
+	}
+}
+
+static void handle_unix_signal_for_latency(int sig)
+{
+	latency_dump_requested = 1;
+}
+
+static int prepare_latency_dump(void)
+{
+	struct sigaction sa = {0};
+
+	sigemptyset(&sa.sa_mask);
+	sa.sa_flags = SA_RESTART;
+	sa.sa_handler = handle_unix_signal_for_latency;
+	if (sigaction(SIGUSR1, &sa, NULL) < 0)
+		return -errno;
+
+	return 0;
+}
+
 int xfer_libasound_wait_event(struct libasound_state *state, int timeout_msec,
 			      unsigned short *revents)
 {
@@ -352,17 +760,31 @@ int xfer_libasound_wait_event(struct libasound_state *state, int timeout_msec,
 		count = waiter_context_wait_event(waiter, timeout_msec);
 		if (count < 0)
 			return count;
+		mark_wakeup(state);
 		if (count == 0 && timeout_msec > 0)
 			return -ETIMEDOUT;
 
-		err = snd_pcm_poll_descriptors_revents(state->handle,
-				waiter->pfds, waiter->pfd_count, revents);
+		// Serve clients in advance. The event is not for PCM
+		// substream, thus callers may handle it as spurious wakeup.
+		if (state->stats.fd >= 0) {
+			if (waiter->pfds[state->stats.pfd_index].revents &
+			    POLLIN)
+				xfer_libasound_stats_serve(state);
+			err = snd_pcm_poll_descriptors_revents(state->handle,
+					waiter->pfds, state->stats.pfd_index,
+					revents);
+		} else {
+			err = snd_pcm_poll_descriptors_revents(state->handle,
+					waiter->pfds, waiter->pfd_count,
+					revents);
+		}
 		if (err < 0)
 			return err;
 	} else {
 		count = snd_pcm_wait(state->handle, timeout_msec);
 		if (count < 0)
 			return count;
+		mark_wakeup(state);
 		if (count == 0 && timeout_msec > 0)
 			return -ETIMEDOUT;
 
@@ -594,6 +1016,43 @@ static int configure_sw_params(struct libasound_state *state,
 		}
 	}
 
+	// Wake up once for several periods. The budget leaves a period in the
+	// buffer at least, for the time to process the batch.
+	if (state->batch_periods > 0) {
+		snd_pcm_uframes_t frames_per_period;
+
+		err = snd_pcm_hw_params_get_period_size(state->hw_params,
+							&frames_per_period,
+							NULL);
+		if (err < 0)
+			return err;
+
+		frame_count = frames_per_period * state->batch_periods;
+		if (frame_count + frames_per_period > frames_per_buffer) {
+			if (frames_per_buffer > frames_per_period * 2)
+				frame_count = frames_per_buffer -
+					      frames_per_period;
+			else
+				frame_count = frames_per_period;
+			logging(state,
+				"The batch is trimmed to %lu frames for the "
+				"buffer of %u frames.\n",
+				frame_count, frames_per_buffer);
+		}
+		state->frames_per_batch = frame_count;
+
+		if (msec_for_avail_min == 0) {
+			err = snd_pcm_sw_params_set_avail_min(state->handle,
+						state->sw_params, frame_count);
+			if (err < 0) {
+				logging(state,
+					"Fail to configure 'avail-min' for "
+					"batch.\n");
+				return -EINVAL;
+			}
+		}
+	}
+
 	if (msec_for_start_threshold > 0) {
 		frame_count = msec_for_start_threshold * frames_per_second /
 			      1000000;
@@ -639,6 +1098,135 @@ static int configure_sw_params(struct libasound_state *state,
 	return snd_pcm_sw_params(state->handle, state->sw_params);
 }
 
+static uint64_t elapsed_nsec(const struct timespec *begin,
+			     const struct timespec *end)
+{
+	int64_t nsec;
+
+	nsec = (int64_t)(end->tv_sec - begin->tv_sec) * 1000000000ll +
+	       end->tv_nsec - begin->tv_nsec;
+	if (nsec < 0)
+		return 0;
+	return (uint64_t)nsec;
+}
+
+// The call of ioctl(2) with SNDRV_PCM_IOCTL_STATUS synchronizes the position
+// of hardware as well as SNDRV_PCM_IOCTL_HWSYNC, thus the state and available
+// frames are retrieved at once.
+static int query_status(struct libasound_state *state)
+{
+	struct libasound_status *st = &state->status;
+	struct timespec audio_tstamp;
+	uint64_t sys_nsec, audio_nsec;
+	unsigned int rate;
+	int err;
+
+	err = snd_pcm_status(state->handle, st->status);
+	if (err < 0)
+		return err;
+
+	st->state = snd_pcm_status_get_state(st->status);
+	st->avail = snd_pcm_status_get_avail(st->status);
+	snd_pcm_status_get_htstamp(st->status, &st->tstamp);
+	snd_pcm_status_get_audio_htstamp(st->status, &audio_tstamp);
+
+	if (st->state != SND_PCM_STATE_RUNNING ||
+	    (audio_tstamp.tv_sec == 0 && audio_tstamp.tv_nsec == 0)) {
+		st->prev_valid = false;
+		return 0;
+	}
+
+	if (st->prev_valid) {
+		sys_nsec = elapsed_nsec(&st->prev_tstamp, &st->tstamp);
+		audio_nsec = elapsed_nsec(&st->prev_audio_tstamp,
+					  &audio_tstamp);
+		// Too short to measure, keep the last point.
+		if (sys_nsec < 1000000)
+			return 0;
+
+		rate = (uint64_t)st->frames_per_second * audio_nsec / sys_nsec;
+		if (st->measured_rate == 0)
+			st->measured_rate = rate;
+		else
+			st->measured_rate = (st->measured_rate * 7 + rate) / 8;
+	}
+
+	st->prev_tstamp = st->tstamp;
+	st->prev_audio_tstamp = audio_tstamp;
+	st->prev_valid = true;
+
+	return 0;
+}
+
+// Extrapolate available frames from the last status, instead of query to
+// hardware. The estimation is rounded down with margin of 1 msec not to
+// handle frames which the hardware doesn't process yet.
+snd_pcm_sframes_t xfer_libasound_estimate_avail(struct libasound_state *state)
+{
+	struct libasound_status *st = &state->status;
+	struct timespec now;
+	unsigned int rate;
+	uint64_t frames;
+	uint64_t margin;
+
+	if (!state->batch_status)
+		return snd_pcm_avail(state->handle);
+
+	if (clock_gettime(CLOCK_MONOTONIC, &now) < 0)
+		return -errno;
+
+	rate = st->measured_rate;
+	// Guard from the rate far from nominal one.
+	if (rate < st->frames_per_second * 15 / 16 ||
+	    rate > st->frames_per_second * 17 / 16)
+		rate = st->frames_per_second;
+
+	frames = st->avail + elapsed_nsec(&st->tstamp, &now) * rate /
+		 1000000000ull;
+	margin = st->frames_per_second / 1000;
+	if (frames < st->avail + margin)
+		return (snd_pcm_sframes_t)st->avail;
+	frames -= margin;
+	if (frames > st->frames_per_buffer)
+		frames = st->frames_per_buffer;
+
+	return (snd_pcm_sframes_t)frames;
+}
+
+static int prepare_status(struct libasound_state *state,
+			  unsigned int frames_per_second,
+			  snd_pcm_uframes_t frames_per_buffer)
+{
+	int err;
+
+	// Plugins in alsa-lib compute the position in .avail_update()
+	// callback, thus the status from the kernel is not enough.
+	if (snd_pcm_type(state->handle) != SND_PCM_TYPE_HW) {
+		logging(state,
+			"Batched query of status is available for 'hw' PCM "
+			"plugin only. Ignored.\n");
+		state->batch_status = false;
+		return 0;
+	}
+
+	err = snd_pcm_status_malloc(&state->status.status);
+	if (err < 0)
+		return err;
+
+	state->status.frames_per_second = frames_per_second;
+	state->status.frames_per_buffer = frames_per_buffer;
+
+	// The timestamp is compared to monotonic clock.
+	err = snd_pcm_sw_params_set_tstamp_mode(state->handle, state->sw_params,
+						SND_PCM_TSTAMP_ENABLE);
+	if (err < 0)
+		return err;
+
+	return snd_pcm_sw_params_set_tstamp_type(state->handle,
+						 state->sw_params,
+						 SND_PCM_TSTAMP_TYPE_MONOTONIC);
+}
+
 static int xfer_libasound_pre_process(struct xfer_context *xfer,
 				      snd_pcm_format_t *format,
 				      unsigned int *samples_per_frame,
@@ -654,6 +1242,33 @@ static int xfer_libasound_pre_process(struct xfer_context *xfer,
 	if (err < 0)
 		return -ENXIO;
 
+	// The given channels are for each of the devices.
+	if (state->node_count > 1)
+		*samples_per_frame = xfer->samples_per_frame * state->node_count;
+
+	// Select the other sample format to convert in mapper.
+	if (xfer->convert_format && *format != SND_PCM_FORMAT_UNKNOWN &&
+	    snd_pcm_hw_params_test_format(state->handle, state->hw_params,
+					  *format) < 0) {
+		snd_pcm_format_mask_t *mask;
+		snd_pcm_format_t pcm_format;
+
+		err = snd_pcm_format_mask_malloc(&mask);
+		if (err < 0)
+			return err;
+		snd_pcm_hw_params_get_format_mask(state->hw_params, mask);
+		pcm_format = mapper_conversion_select_format(*format, mask);
+		snd_pcm_format_mask_free(mask);
+
+		if (pcm_format != SND_PCM_FORMAT_UNKNOWN) {
+			logging(state,
+				"Sample format '%s' is converted to/from '%s'.\n",
+				snd_pcm_format_name(*format),
+				snd_pcm_format_name(pcm_format));
+			*format = pcm_format;
+		}
+	}
+
 	err = configure_hw_params(state, *format, *samples_per_frame,
 				  *frames_per_second,
 				  state->msec_per_period,
@@ -720,6 +1335,22 @@ static int xfer_libasound_pre_process(struct xfer_context *xfer,
 	if (err < 0)
 		return err;
 
+	if (state->batch_status) {
+		err = prepare_status(state, *frames_per_second,
+				     *frames_per_buffer);
+		if (err < 0)
+			return err;
+	}
+
+	if (state->tstamp.path != NULL) {
+		err = xfer_libasound_tstamp_prepare(state, *frames_per_second);
+		if (err < 0) {
+			logging(state, "Fail to prepare timestamp file: %s\n",
+				snd_strerror(err));
+			return err;
+		}
+	}
+
 	err = configure_sw_params(state, *frames_per_second,
 				  *frames_per_buffer,
 				  state->msec_for_avail_min,
@@ -735,6 +1366,29 @@ static int xfer_libasound_pre_process(struct xfer_context *xfer,
 		snd_pcm_dump(state->handle, state->log);
 		logging(state, "Scheduling model:\n");
 		logging(state, "  %s\n", sched_model_labels[state->sched_model]);
+		if (state->frames_per_batch > 0) {
+			logging(state, "  batch: %lu frames\n",
+				state->frames_per_batch);
+		}
+	}
+
+	if (state->dump_latency) {
+		err = prepare_latency_dump();
+		if (err < 0)
+			return err;
+	}
+
+	if (state->stats.path != NULL) {
+		err = xfer_libasound_stats_prepare(state);
+		if (err < 0) {
+			logging(state, "Fail to prepare stats socket: %s\n",
+				snd_strerror(err));
+			return err;
+		}
+		if (xfer->verbose > 0) {
+			logging(state, "Stats socket:\n");
+			logging(state, "  %s\n", state->stats.path);
+		}
 	}
 
 	if (state->use_waiter) {
@@ -755,6 +1409,133 @@ static int xfer_libasound_pre_process(struct xfer_context *xfer,
 	return 0;
 }
 
+// The slaves share the timestamp at trigger since they are linked.
+static void report_start_timestamp(struct libasound_state *state)
+{
+	snd_pcm_status_t *status;
+	snd_htimestamp_t tstamp;
+
+	snd_pcm_status_alloca(&status);
+	if (snd_pcm_status(state->handle, status) < 0)
+		return;
+	snd_pcm_status_get_trigger_htstamp(status, &tstamp);
+
+	logging(state, "Start timestamp of %u devices: %ld.%09ld\n",
+		state->node_count, (long)tstamp.tv_sec, (long)tstamp.tv_nsec);
+	state->start_reported = true;
+}
+
+// The budget is given for each period of PCM substream.
+static int set_sched_deadline(struct libasound_state *state)
+{
+#ifdef SYS_sched_setattr
+	struct deadline_attr attr = {0};
+	unsigned int usec_per_period;
+	int err;
+
+	err = snd_pcm_hw_params_get_period_time(state->hw_params,
+						&usec_per_period, NULL);
+	if (err < 0)
+		return err;
+	if (state->sched_runtime_usec > usec_per_period) {
+		fprintf(stderr,
+			"The runtime for SCHED_DEADLINE is larger than the "
+			"period: %u usec\n", usec_per_period);
+		return -EINVAL;
+	}
+
+	attr.size = sizeof(attr);
+	attr.sched_policy = SCHED_DEADLINE;
+	attr.sched_flags = SCHED_FLAG_RESET_ON_FORK;
+	attr.sched_runtime = (uint64_t)state->sched_runtime_usec * 1000;
+	attr.sched_deadline = (uint64_t)usec_per_period * 1000;
+	attr.sched_period = attr.sched_deadline;
+
+	if (syscall(SYS_sched_setattr, 0, &attr, 0) < 0)
+		return -errno;
+
+	return 0;
+#else
+	return -ENOSYS;
+#endif
+}
+
+static void prefault_stack(void)
+{
+	volatile char buf[PREFAULT_STACK_SIZE];
+	int i;
+
+	for (i = 0; i < sizeof(buf); i += 4096)
+		buf[i] = 0;
+}
+
+// Applied to the thread just before the first iteration so that threads
+// spawned by mapper and containers in pre-process keep default attributes.
+static int apply_realtime_attributes(struct libasound_state *state)
+{
+	int err;
+
+	if (state->cpu_affinity_literal != NULL) {
+		if (sched_setaffinity(0, sizeof(state->cpu_set),
+				      &state->cpu_set) < 0) {
+			err = -errno;
+			fprintf(stderr, "Fail to set CPU affinity: %s\n",
+				strerror(-err));
+			return err;
+		}
+	}
+
+	// All of the buffers for data frames are already allocated, then
+	// populated by mlockall(2).
+	if (state->mlock) {
+		if (mlockall(MCL_CURRENT | MCL_FUTURE) < 0) {
+			err = -errno;
+			fprintf(stderr, "Fail to lock memory: %s\n",
+				strerror(-err));
+			return err;
+		}
+		prefault_stack();
+	}
+
+	if (state->sched_priority > 0) {
+		struct sched_param param = {
+			.sched_priority = state->sched_priority,
+		};
+
+		if (sched_setscheduler(0, SCHED_FIFO, &param) < 0) {
+			err = -errno;
+			fprintf(stderr, "Fail to set SCHED_FIFO: %s\n",
+				strerror(-err));
+			return err;
+		}
+	} else if (state->sched_runtime_usec > 0) {
+		err = set_sched_deadline(state);
+		if (err < 0) {
+			fprintf(stderr, "Fail to set SCHED_DEADLINE: %s\n",
+				strerror(-err));
+			return err;
+		}
+	}
+
+	if (state->verbose) {
+		if (state->cpu_affinity_literal != NULL) {
+			logging(state, "  CPU affinity: %s\n",
+				state->cpu_affinity_literal);
+		}
+		if (state->mlock)
+			logging(state, "  memory lock: enabled\n");
+		if (state->sched_priority > 0) {
+			logging(state, "  SCHED_FIFO: %u\n",
+				state->sched_priority);
+		} else if (state->sched_runtime_usec > 0) {
+			logging(state, "  SCHED_DEADLINE: %u usec\n",
+				state->sched_runtime_usec);
+		}
+	}
+
+	return 0;
+}
+
 static int xfer_libasound_process_frames(struct xfer_context *xfer,
 					 unsigned int *frame_count,
 					 struct mapper_context *mapper,
@@ -766,15 +1547,60 @@ static int xfer_libasound_process_frames(struct xfer_context *xfer,
 	if (state->handle == NULL)
 		return -ENXIO;
 
+	if (!state->rt_applied) {
+		state->rt_applied = true;
+		err = apply_realtime_attributes(state);
+		if (err < 0)
+			return err;
+	}
+
+	// Overwritten when any waiter returns.
+	mark_wakeup(state);
+
+	if (state->batch_status) {
+		err = query_status(state);
+		if (err < 0) {
+			*frame_count = 0;
+			return err;
+		}
+	}
+
 	err = state->ops->process_frames(state, frame_count, mapper, cntrs);
+	if (state->node_count > 1 && !xfer->quiet && !state->start_reported) {
+		if (err >= 0 && *frame_count > 0)
+			report_start_timestamp(state);
+	}
+	if (state->measure_latency) {
+		if (err >= 0 && *frame_count > 0)
+			record_latency(state);
+	}
+	if (state->dump_latency && latency_dump_requested) {
+		latency_dump_requested = 0;
+		dump_latency(state);
+	}
+	if (state->stats.fd >= 0) {
+		if (err >= 0)
+			state->stats.frame_count += *frame_count;
+		state->stats.cntrs = cntrs;
+		state->stats.cntr_count = mapper->cntr_count;
+	}
+	if (state->tstamp.fd >= 0) {
+		if (err >= 0 && *frame_count > 0)
+			xfer_libasound_tstamp_record(state, *frame_count);
+	}
 	if (err < 0) {
 		if (err == -EAGAIN)
 			return err;
+		if (err == -EPIPE) {
+			++xfer->xrun_count;
+			state->stats.xrun_count = xfer->xrun_count;
+		}
 		if (err == -EPIPE && !state->finish_at_xrun) {
 			// Recover the stream and continue processing
 			// immediately. In this program -EPIPE comes from
 			// libasound implementation instead of file I/O.
 			err = snd_pcm_prepare(state->handle);
+			state->start_reported = false;
 		}
 
 		if (err < 0) {
@@ -825,6 +1651,9 @@ static void xfer_libasound_post_process(struct xfer_context *xfer)
 	if (state->handle == NULL)
 		return;
 
+	if (state->dump_latency)
+		dump_latency(state);
+
 	pcm_state = snd_pcm_state(state->handle);
 	if (pcm_state != SND_PCM_STATE_OPEN &&
 	    pcm_state != SND_PCM_STATE_DISCONNECTED) {
@@ -859,6 +1688,13 @@ static void xfer_libasound_post_process(struct xfer_context *xfer)
 	free(state->private_data);
 	state->private_data = NULL;
 
+	if (state->status.status)
+		snd_pcm_status_free(state->status.status);
+	state->status.status = NULL;
+
+	xfer_libasound_stats_release(state);
+	xfer_libasound_tstamp_release(state);
+
 	// Free cache of content for configuration files so that memory leaks
 	// are not detected.
 	snd_config_update_free_global();
@@ -867,13 +1703,27 @@ static void xfer_libasound_post_process(struct xfer_context *xfer)
 static void xfer_libasound_destroy(struct xfer_context *xfer)
 {
 	struct libasound_state *state = xfer->private_data;
+	int i;
 
-	free(state->node_literal);
+	for (i = 0; i < state->node_count; ++i)
+		free(state->node_literals[i]);
+	free(state->node_literals);
+	state->node_literals = NULL;
+	state->node_count = 0;
 	free(state->waiter_type_literal);
 	free(state->sched_model_literal);
-	state->node_literal = NULL;
+	free(state->cpu_affinity_literal);
+	free(state->stats.path);
+	free(state->tstamp.path);
+	free(state->tstamp.type_literal);
+	free(state->tstamp.audio_type_literal);
 	state->waiter_type_literal = NULL;
 	state->sched_model_literal = NULL;
+	state->cpu_affinity_literal = NULL;
+	state->stats.path = NULL;
+	state->tstamp.path = NULL;
+	state->tstamp.type_literal = NULL;
+	state->tstamp.audio_type_literal = NULL;
 
 	if (state->hw_params)
 		snd_pcm_hw_params_free(state->hw_params);
@@ -892,6 +1742,7 @@ static void xfer_libasound_help(struct xfer_context *xfer)
 	printf(
 "      [BASICS]\n"
 "        -D, --device          select node by name in coniguration space\n"
+"                              (several times to capture from the nodes)\n"
 "        -N, --nonblock        nonblocking mode\n"
 "        -M, --mmap            use mmap(2) for zero copying technique\n"
 "        -F, --period-time     interval between interrupts (msec unit)\n"
@@ -900,6 +1751,12 @@ static void xfer_libasound_help(struct xfer_context *xfer)
 "        --buffer-size         size of buffer for frame(frame unit)\n"
 "        --waiter-type         type of waiter to handle available frames\n"
 "        --sched-model         model of process scheduling\n"
+"        --batch-periods       the number of periods per iteration with mmap\n"
+"      [REALTIME ATTRIBUTES]\n"
+"        --cpu-affinity        list of CPUs to run transfer (e.g. 0,2-3)\n"
+"        --sched-priority      set SCHED_FIFO with given priority\n"
+"        --sched-deadline      set SCHED_DEADLINE with given runtime per period (usec unit)\n"
+"        --mlock               lock and prefault memory for buffers\n"
 "      [SOFTWARE FEATURES]\n"
 "        -A, --avail-min       threshold of frames to wake up process\n"
 "        -R, --start-delay     threshold of frames to start PCM substream\n"
@@ -912,6 +1769,12 @@ static void xfer_libasound_help(struct xfer_context *xfer)
 "      [DEBUG ASSISTANT]\n"
 "        --fatal-errors        finish at XRUN\n"
 "        --test-nowait         busy poll without any waiter\n"
+"        --dump-latency        dump histograms of latency in each iteration\n"
+"        --batch-status        query status once per iteration\n"
+"        --stats-socket        serve statistics in JSON by unix domain socket\n"
+"        --tstamp-file         record timestamps of captured frames to file\n"
+"        --tstamp-type         type of system timestamp for the file\n"
+"        --audio-tstamp-type   type of audio timestamp for the file\n"
 	);
 }
 
@@ -11,6 +11,9 @@
 
 #include "xfer.h"
 #include "waiter.h"
+#include "latency.h"
+
+#include <sched.h>
 
 #define logging(state, ...) \
 	snd_output_printf(state->log, __VA_ARGS__)
@@ -21,6 +24,76 @@ enum sched_model {
 	SCHED_MODEL_COUNT,
 };
 
+enum latency_stage {
+	LATENCY_STAGE_WAKEUP_TO_AVAIL = 0,
+	LATENCY_STAGE_AVAIL_TO_TRANSFER,
+	LATENCY_STAGE_WAKEUP_TO_TRANSFER,
+	LATENCY_STAGE_WAKEUP_INTERVAL,
+	LATENCY_STAGE_COUNT,
+};
+
+// Timestamps in an iteration. When no waiter is used, the beginning of
+// iteration is regarded as wakeup.
+struct libasound_latency {
+	struct timespec wakeup;
+	struct timespec avail;
+	struct timespec prev_wakeup;
+	bool avail_marked:1;
+	bool prev_marked:1;
+
+	struct latency_histogram hists[LATENCY_STAGE_COUNT];
+};
+
+// The status of PCM substream queried once per iteration. The position of
+// hardware is extrapolated from the timestamp of the status when needed.
+struct libasound_status {
+	snd_pcm_status_t *status;
+	snd_pcm_state_t state;
+	snd_pcm_uframes_t avail;
+	struct timespec tstamp;
+
+	// The ratio of audio clock to system clock is measured by audio
+	// timestamp.
+	struct timespec prev_tstamp;
+	struct timespec prev_audio_tstamp;
+	bool prev_valid;
+	unsigned int frames_per_second;
+	unsigned int measured_rate;
+	snd_pcm_uframes_t frames_per_buffer;
+};
+
+// The statistics served to clients of a unix domain socket. The socket is
+// polled by the waiter with file descriptors of PCM substream, and each
+// client gets one report without blocking.
+struct libasound_stats {
+	char *path;
+	int fd;
+	unsigned int pfd_index;
+	char *buf;
+
+	uint64_t frame_count;
+	unsigned int xrun_count;
+	struct container_context *cntrs;
+	unsigned int cntr_count;
+};
+
+// The timestamps of captured frames recorded to a sidecar file after each
+// iteration, so that the frames can be aligned to system clock later.
+struct libasound_tstamp {
+	char *path;
+	char *type_literal;
+	char *audio_type_literal;
+	int fd;
+	snd_pcm_status_t *status;
+	snd_pcm_tstamp_type_t type;
+	snd_pcm_audio_tstamp_type_t audio_type;
+
+	uint64_t frame_count;
+	void *records;
+	unsigned int record_count;
+	bool failed;
+};
+
 struct xfer_libasound_ops;
 
 struct libasound_state {
@@ -35,7 +108,9 @@ struct libasound_state {
 
 	bool verbose;
 
-	char *node_literal;
+	// Several nodes are aggregated by 'multi' PCM plugin.
+	char **node_literals;
+	unsigned int node_count;
 	char *waiter_type_literal;
 	char *sched_model_literal;
 
@@ -44,6 +119,10 @@ struct libasound_state {
 	unsigned int frames_per_period;
 	unsigned int frames_per_buffer;
 
+	// For batched transfer of several periods in one iteration.
+	unsigned int batch_periods;
+	snd_pcm_uframes_t frames_per_batch;
+
 	unsigned int msec_for_avail_min;
 	unsigned int msec_for_start_threshold;
 	unsigned int msec_for_stop_threshold;
@@ -56,14 +135,38 @@ struct libasound_state {
 	bool no_auto_channels:1;
 	bool no_auto_format:1;
 	bool no_softvol:1;
+	bool dump_latency:1;
+	bool mlock:1;
+	bool batch_status:1;
 
 	bool use_waiter:1;
+	bool measure_latency:1;
+	bool start_reported:1;
+	bool rt_applied:1;
 
 	enum waiter_type waiter_type;
 	struct waiter_context *waiter;
 
 	// For scheduling type.
 	enum sched_model sched_model;
+
+	// For realtime attributes of the thread to transfer frames.
+	char *cpu_affinity_literal;
+	cpu_set_t cpu_set;
+	unsigned int sched_priority;
+	unsigned int sched_runtime_usec;
+
+	// For instrumentation.
+	struct libasound_latency latency;
+
+	// For batched query of status.
+	struct libasound_status status;
+
+	// For live statistics.
+	struct libasound_stats stats;
+
+	// For timestamps of captured frames.
+	struct libasound_tstamp tstamp;
 };
 
 // For internal use in 'libasound' module.
@@ -81,6 +184,46 @@ struct xfer_libasound_ops {
 int xfer_libasound_wait_event(struct libasound_state *state, int timeout_msec,
 			      unsigned short *revents);
 
+snd_pcm_sframes_t xfer_libasound_estimate_avail(struct libasound_state *state);
+
+extern const char *const latency_stage_labels[LATENCY_STAGE_COUNT];
+
+int xfer_libasound_stats_prepare(struct libasound_state *state);
+void xfer_libasound_stats_serve(struct libasound_state *state);
+void xfer_libasound_stats_release(struct libasound_state *state);
+
+int xfer_libasound_tstamp_validate(struct libasound_state *state,
+				   snd_pcm_stream_t direction);
+int xfer_libasound_tstamp_prepare(struct libasound_state *state,
+				  unsigned int frames_per_second);
+void xfer_libasound_tstamp_record(struct libasound_state *state,
+				  unsigned int frame_count);
+void xfer_libasound_tstamp_release(struct libasound_state *state);
+
+static inline snd_pcm_state_t xfer_libasound_get_state(
+					struct libasound_state *state)
+{
+	if (state->batch_status)
+		return state->status.state;
+	return snd_pcm_state(state->handle);
+}
+
+static inline snd_pcm_sframes_t xfer_libasound_get_avail(
+					struct libasound_state *state)
+{
+	if (state->batch_status)
+		return (snd_pcm_sframes_t)state->status.avail;
+	return snd_pcm_avail(state->handle);
+}
+
+static inline void xfer_libasound_mark_avail(struct libasound_state *state)
+{
+	if (state->measure_latency) {
+		clock_gettime(CLOCK_MONOTONIC_RAW, &state->latency.avail);
+		state->latency.avail_marked = true;
+	}
+}
+
 extern const struct xfer_libasound_ops xfer_libasound_irq_rw_ops;
 
 extern const struct xfer_libasound_ops xfer_libasound_irq_mmap_r_ops;
@@ -13,9 +13,43 @@
 
 #include <stdio.h>
 #include <sched.h>
+#include <signal.h>
+#include <pthread.h>
+#include <semaphore.h>
+#include <stdatomic.h>
 
 #include <libffado/ffado.h>
 
+// The wait loop of libffado runs in a dedicated thread. It registers a period
+// of the ring as buffers of streams, thus libffado fills or consumes it
+// directly. Conversion between the samples in 24 bit integer for each stream
+// and the interleaved data frames in the format of file is done in the thread
+// for transmission, as well as I/O of containers. The ring has one producer
+// and one consumer; the streaming thread produces periods for capture, and
+// consumes them for playback. The thread never waits for the other side; an
+// empty or full ring is an xrun.
+#define RING_PERIODS_RATIO	2
+
+struct period_ring {
+	int32_t *buf;
+	enum page_buffer_mode mode;
+	unsigned int period_count;
+	unsigned int samples_per_period;
+
+	// Incremented by producer.
+	atomic_uint head;
+	// Incremented by consumer.
+	atomic_uint tail;
+	// Posted by the streaming thread.
+	sem_t sem;
+
+	pthread_t thread;
+	bool thread_running;
+	atomic_bool draining;
+	atomic_bool closing;
+	atomic_int err;
+};
+
 struct libffado_state {
 	ffado_device_t *handle;
 	enum ffado_direction direction;
@@ -37,7 +71,15 @@ struct libffado_state {
 			      struct mapper_context *mapper,
 			      struct container_context *cntrs);
 
+	// Between the ring and the cache of data frames.
+	void (*pack)(char *dst, const int32_t *src, unsigned int src_stride,
+		     unsigned int samples_per_frame, unsigned int frame_count);
+	void (*unpack)(int32_t *dst, unsigned int dst_stride, const char *src,
+		       unsigned int samples_per_frame,
+		       unsigned int frame_count);
+
 	struct frame_cache cache;
+	struct period_ring ring;
 };
 
 enum no_short_opts {
@@ -171,15 +213,314 @@ static int xfer_libffado_validate_opts(struct xfer_context *xfer)
 	return 0;
 }
 
+// Samples of stream are in the lower 24 bits with sign extension.
+static void pack_s24(char *dst, const int32_t *src, unsigned int src_stride,
+		     unsigned int samples_per_frame, unsigned int frame_count)
+{
+	int32_t *d = (int32_t *)dst;
+	unsigned int ch;
+	unsigned int i;
+
+	for (ch = 0; ch < samples_per_frame; ++ch) {
+		const int32_t *s = src + ch * src_stride;
+
+		for (i = 0; i < frame_count; ++i)
+			d[i * samples_per_frame + ch] = s[i];
+	}
+}
+
+static void pack_s32(char *dst, const int32_t *src, unsigned int src_stride,
+		     unsigned int samples_per_frame, unsigned int frame_count)
+{
+	uint32_t *d = (uint32_t *)dst;
+	unsigned int ch;
+	unsigned int i;
+
+	for (ch = 0; ch < samples_per_frame; ++ch) {
+		const int32_t *s = src + ch * src_stride;
+
+		for (i = 0; i < frame_count; ++i)
+			d[i * samples_per_frame + ch] = (uint32_t)s[i] << 8;
+	}
+}
+
+static void pack_float(char *dst, const int32_t *src, unsigned int src_stride,
+		       unsigned int samples_per_frame, unsigned int frame_count)
+{
+	float *d = (float *)dst;
+	unsigned int ch;
+	unsigned int i;
+
+	for (ch = 0; ch < samples_per_frame; ++ch) {
+		const int32_t *s = src + ch * src_stride;
+
+		for (i = 0; i < frame_count; ++i) {
+			d[i * samples_per_frame + ch] =
+					(float)s[i] * (1.0f / 8388608.0f);
+		}
+	}
+}
+
+static void unpack_s24(int32_t *dst, unsigned int dst_stride, const char *src,
+		       unsigned int samples_per_frame,
+		       unsigned int frame_count)
+{
+	const int32_t *s = (const int32_t *)src;
+	unsigned int ch;
+	unsigned int i;
+
+	for (ch = 0; ch < samples_per_frame; ++ch) {
+		int32_t *d = dst + ch * dst_stride;
+
+		for (i = 0; i < frame_count; ++i)
+			d[i] = s[i * samples_per_frame + ch];
+	}
+}
+
+static void unpack_s32(int32_t *dst, unsigned int dst_stride, const char *src,
+		       unsigned int samples_per_frame,
+		       unsigned int frame_count)
+{
+	const int32_t *s = (const int32_t *)src;
+	unsigned int ch;
+	unsigned int i;
+
+	for (ch = 0; ch < samples_per_frame; ++ch) {
+		int32_t *d = dst + ch * dst_stride;
+
+		for (i = 0; i < frame_count; ++i)
+			d[i] = s[i * samples_per_frame + ch] >> 8;
+	}
+}
+
+static void unpack_float(int32_t *dst, unsigned int dst_stride,
+			 const char *src, unsigned int samples_per_frame,
+			 unsigned int frame_count)
+{
+	const float *s = (const float *)src;
+	unsigned int ch;
+	unsigned int i;
+
+	for (ch = 0; ch < samples_per_frame; ++ch) {
+		int32_t *d = dst + ch * dst_stride;
+
+		for (i = 0; i < frame_count; ++i) {
+			float val = s[i * samples_per_frame + ch];
+
+			if (val > 1.0f)
+				val = 1.0f;
+			else if (val < -1.0f)
+				val = -1.0f;
+			d[i] = (int32_t)(val * 8388607.0f);
+		}
+	}
+}
+
+static const struct {
+	snd_pcm_format_t format;
+	void (*pack)(char *dst, const int32_t *src, unsigned int src_stride,
+		     unsigned int samples_per_frame, unsigned int frame_count);
+	void (*unpack)(int32_t *dst, unsigned int dst_stride, const char *src,
+		       unsigned int samples_per_frame,
+		       unsigned int frame_count);
+} sample_formats[] = {
+	{ SND_PCM_FORMAT_S24,	pack_s24,	unpack_s24, },
+	{ SND_PCM_FORMAT_S32,	pack_s32,	unpack_s32, },
+	{ SND_PCM_FORMAT_FLOAT,	pack_float,	unpack_float, },
+};
+
+static inline int32_t *get_period(struct period_ring *ring, unsigned int index)
+{
+	return ring->buf + (index % ring->period_count) *
+			   ring->samples_per_period;
+}
+
+static int register_stream_buffers(struct libffado_state *state,
+				   int32_t *period)
+{
+	int pos;
+	int ch;
+	int err;
+
+	pos = 0;
+	for (ch = 0; ch < state->data_ch_count; ++ch) {
+		char *buf;
+
+		if (state->data_ch_map[ch] != ffado_stream_type_audio)
+			continue;
+
+		buf = (char *)(period + pos * state->frames_per_period);
+		if (state->direction == FFADO_CAPTURE) {
+			err = ffado_streaming_set_capture_stream_buffer(
+						state->handle, ch, buf);
+		} else {
+			err = ffado_streaming_set_playback_stream_buffer(
+						state->handle, ch, buf);
+		}
+		if (err)
+			return -EIO;
+		++pos;
+	}
+
+	return 0;
+}
+
+// In the streaming thread.
+static int capture_period(struct libffado_state *state)
+{
+	struct period_ring *ring = &state->ring;
+	unsigned int head;
+	int err;
+
+	head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+	if (head - atomic_load_explicit(&ring->tail, memory_order_acquire) >=
+							ring->period_count)
+		return -EPIPE;
+
+	err = register_stream_buffers(state, get_period(ring, head));
+	if (err < 0)
+		return err;
+
+	// Move data to the period from intermediate buffer.
+	if (!ffado_streaming_transfer_buffers(state->handle))
+		return -EIO;
+
+	atomic_store_explicit(&ring->head, head + 1, memory_order_release);
+	sem_post(&ring->sem);
+
+	return 0;
+}
+
+static int playback_period(struct libffado_state *state)
+{
+	struct period_ring *ring = &state->ring;
+	unsigned int tail;
+	int err;
+
+	tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+	if (tail == atomic_load_explicit(&ring->head, memory_order_acquire)) {
+		// All of queued periods are transmitted.
+		if (atomic_load(&ring->draining))
+			return 1;
+		return -EPIPE;
+	}
+
+	err = register_stream_buffers(state, get_period(ring, tail));
+	if (err < 0)
+		return err;
+
+	// Move data on the period for transmission.
+	if (!ffado_streaming_transfer_buffers(state->handle))
+		return -EIO;
+
+	atomic_store_explicit(&ring->tail, tail + 1, memory_order_release);
+	sem_post(&ring->sem);
+
+	return 0;
+}
+
+static void *streaming_thread(void *arg)
+{
+	struct libffado_state *state = arg;
+	struct period_ring *ring = &state->ring;
+	int err = 0;
+
+	while (!atomic_load(&ring->closing)) {
+		ffado_wait_response res;
+
+		res = ffado_streaming_wait(state->handle);
+		if (res == ffado_wait_shutdown || res == ffado_wait_error) {
+			err = -EIO;
+		} else if (res == ffado_wait_xrun) {
+			// No way to recover in this backend.
+			err = -EPIPE;
+		} else if (res == ffado_wait_ok) {
+			if (state->direction == FFADO_CAPTURE)
+				err = capture_period(state);
+			else
+				err = playback_period(state);
+		} else {
+			err = -ENXIO;
+		}
+		if (err != 0)
+			break;
+	}
+
+	if (err < 0)
+		atomic_store(&ring->err, err);
+	// Wake up the thread for transmission.
+	sem_post(&ring->sem);
+
+	return NULL;
+}
+
+static int start_streaming(struct libffado_state *state)
+{
+	struct period_ring *ring = &state->ring;
+	sigset_t mask, old_mask;
+	int err;
+
+	if (ffado_streaming_start(state->handle))
+		return -EIO;
+
+	// UNIX signals should be delivered to the thread for transmission.
+	sigfillset(&mask);
+	pthread_sigmask(SIG_SETMASK, &mask, &old_mask);
+	err = -pthread_create(&ring->thread, NULL, streaming_thread, state);
+	pthread_sigmask(SIG_SETMASK, &old_mask, NULL);
+	if (err < 0) {
+		ffado_streaming_stop(state->handle);
+		return err;
+	}
+	ring->thread_running = true;
+
+	return 0;
+}
+
+static void stop_streaming(struct libffado_state *state, bool drain)
+{
+	struct period_ring *ring = &state->ring;
+
+	if (!ring->thread_running)
+		return;
+
+	if (drain)
+		atomic_store(&ring->draining, true);
+	else
+		atomic_store(&ring->closing, true);
+	pthread_join(ring->thread, NULL);
+	ring->thread_running = false;
+
+	ffado_streaming_stop(state->handle);
+}
+
+static int wait_for_period(struct period_ring *ring)
+{
+	int err;
+
+	if (sem_wait(&ring->sem) < 0)
+		return -errno;
+
+	err = atomic_load(&ring->err);
+	if (err < 0) {
+		// Keep it posted to report the error again.
+		sem_post(&ring->sem);
+		return err;
+	}
+
+	return 0;
+}
+
 static int r_process_frames(struct xfer_context *xfer,
 			    unsigned int *frame_count,
 			    struct mapper_context *mapper,
 			    struct container_context *cntrs)
 {
 	struct libffado_state *state = xfer->private_data;
+	struct period_ring *ring = &state->ring;
 	unsigned int avail_count;
-	unsigned int bytes_per_frame;
 	unsigned int consumed_count;
+	void *head_ptr;
 	int err;
 
 	// Trim up to expected frame count.
@@ -189,40 +530,46 @@ static int r_process_frames(struct xfer_context *xfer,
 
 	// Cache required amount of frames.
 	if (avail_count > frame_cache_get_count(&state->cache)) {
-		int ch;
-		int pos;
+		unsigned int tail;
+		int32_t *period;
+		unsigned int pos;
 
-		// Register buffers.
-		pos = 0;
-		bytes_per_frame = state->cache.bytes_per_sample *
-				  state->cache.samples_per_frame;
-		for (ch = 0; ch < state->data_ch_count; ++ch) {
-			char *buf;
-
-			if (state->data_ch_map[ch] != ffado_stream_type_audio)
-				continue;
-
-			buf = state->cache.buf_ptr;
-			buf += ch * bytes_per_frame;
-			if (ffado_streaming_set_capture_stream_buffer(state->handle,
-								      ch, buf))
-				return -EIO;
-			++pos;
-		}
+		err = wait_for_period(ring);
+		if (err < 0)
+			return err;
 
-		assert(pos == xfer->samples_per_frame);
+		tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+		period = get_period(ring, tail);
 
-		// Move data to the buffer from intermediate buffer.
-		if (!ffado_streaming_transfer_buffers(state->handle))
-			return -EIO;
+		// The space in the cache can be split into two segments.
+		pos = 0;
+		while (pos < state->frames_per_period) {
+			unsigned int count;
+			char *tail_ptr;
+
+			tail_ptr = frame_cache_get_tail(&state->cache, &count);
+			if (count == 0)
+				return -ENOSPC;
+			if (count > state->frames_per_period - pos)
+				count = state->frames_per_period - pos;
+
+			state->pack(tail_ptr, period + pos,
+				    state->frames_per_period,
+				    xfer->samples_per_frame, count);
+			frame_cache_increase_count(&state->cache, count);
+			pos += count;
+		}
 
-		frame_cache_increase_count(&state->cache,
-					   state->frames_per_period);
+		// Release the period to the streaming thread.
+		atomic_store_explicit(&ring->tail, tail + 1,
+				      memory_order_release);
 	}
 
 	// Write out to file descriptors.
-	consumed_count = frame_cache_get_count(&state->cache);
-	err = mapper_context_process_frames(mapper, state->cache.buf,
+	head_ptr = frame_cache_get_head(&state->cache, &consumed_count);
+	if (consumed_count > avail_count)
+		consumed_count = avail_count;
+	err = mapper_context_process_frames(mapper, head_ptr,
 					    &consumed_count, cntrs);
 	if (err < 0)
 		return err;
@@ -234,6 +581,63 @@ static int r_process_frames(struct xfer_context *xfer,
 	return 0;
 }
 
+// Queue a period of data frames in the cache to the ring. The rest of period
+// is filled with silence at the end of transmission.
+static int queue_period(struct xfer_context *xfer)
+{
+	struct libffado_state *state = xfer->private_data;
+	struct period_ring *ring = &state->ring;
+	unsigned int head;
+	int32_t *period;
+	unsigned int pos;
+	int err;
+
+	// Wait for the period released by the streaming thread. Before
+	// starting, all of periods in the ring are available.
+	if (ring->thread_running) {
+		err = wait_for_period(ring);
+		if (err < 0)
+			return err;
+	}
+
+	head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+	period = get_period(ring, head);
+
+	pos = 0;
+	while (pos < state->frames_per_period &&
+	       frame_cache_get_count(&state->cache) > 0) {
+		unsigned int count;
+		char *head_ptr;
+
+		head_ptr = frame_cache_get_head(&state->cache, &count);
+		if (count > state->frames_per_period - pos)
+			count = state->frames_per_period - pos;
+
+		state->unpack(period + pos, state->frames_per_period,
+			      head_ptr, xfer->samples_per_frame, count);
+		frame_cache_reduce(&state->cache, count);
+		pos += count;
+	}
+
+	if (pos < state->frames_per_period) {
+		unsigned int ch;
+
+		for (ch = 0; ch < xfer->samples_per_frame; ++ch) {
+			memset(period + ch * state->frames_per_period + pos, 0,
+			       (state->frames_per_period - pos) *
+			       sizeof(*period));
+		}
+	}
+
+	atomic_store_explicit(&ring->head, head + 1, memory_order_release);
+
+	// Start transmission when the ring is filled.
+	if (!ring->thread_running && head + 1 >= ring->period_count)
+		return start_streaming(state);
+
+	return 0;
+}
+
 static int w_process_frames(struct xfer_context *xfer,
 			    unsigned int *frame_count,
 			    struct mapper_context *mapper,
@@ -241,57 +645,35 @@ static int w_process_frames(struct xfer_context *xfer,
 {
 	struct libffado_state *state = xfer->private_data;
 	unsigned int avail_count;
-	int pos;
-	int ch;
-	unsigned int bytes_per_frame;
-	unsigned int consumed_count;
+	unsigned int count;
+	void *tail_ptr;
 	int err;
 
-	// Trim up to expected frame_count.
+	err = atomic_load(&state->ring.err);
+	if (err < 0)
+		return err;
+
+	// Trim up to expected frame_count and the space in the cache.
 	avail_count = state->frames_per_period;
 	if (*frame_count < avail_count)
 		avail_count = *frame_count;
+	tail_ptr = frame_cache_get_tail(&state->cache, &count);
+	if (avail_count > count)
+		avail_count = count;
 
-	// Cache required amount of frames.
-	if (avail_count > frame_cache_get_count(&state->cache)) {
-		avail_count -= frame_cache_get_count(&state->cache);
+	err = mapper_context_process_frames(mapper, tail_ptr, &avail_count,
+					    cntrs);
+	if (err < 0)
+		return err;
+	frame_cache_increase_count(&state->cache, avail_count);
 
-		err = mapper_context_process_frames(mapper, state->cache.buf_ptr,
-						    &avail_count, cntrs);
+	if (frame_cache_get_count(&state->cache) >= state->frames_per_period) {
+		err = queue_period(xfer);
 		if (err < 0)
 			return err;
-		frame_cache_increase_count(&state->cache, avail_count);
-		avail_count = state->cache.remained_count;
 	}
 
-	// Register buffers.
-	pos = 0;
-	bytes_per_frame = state->cache.bytes_per_sample *
-			  state->cache.samples_per_frame;
-	for (ch = 0; ch < state->data_ch_count; ++ch) {
-		char *buf;
-
-		if (state->data_ch_map[ch] != ffado_stream_type_audio)
-			continue;
-
-		buf = state->cache.buf;
-		buf += bytes_per_frame;
-		if (ffado_streaming_set_playback_stream_buffer(state->handle,
-								ch, buf))
-			return -EIO;
-		++pos;
-	}
-
-	assert(pos == xfer->samples_per_frame);
-
-	// Move data on the buffer for transmission.
-	if (!ffado_streaming_transfer_buffers(state->handle))
-		return -EIO;
-	consumed_count = state->frames_per_period;
-
-	frame_cache_reduce(&state->cache, consumed_count);
-
-	*frame_count = consumed_count;
+	*frame_count = avail_count;
 
 	return 0;
 }
@@ -392,20 +774,39 @@ static int xfer_libffado_pre_process(struct xfer_context *xfer,
 				     snd_pcm_uframes_t *frames_per_buffer)
 {
 	struct libffado_state *state = xfer->private_data;
+	struct period_ring *ring = &state->ring;
 	unsigned int channels;
+	int i;
 	int err;
 
 	// Supported format of sample is 24 bit multi bit linear audio in
-	// AM824 format or the others.
+	// AM824 format or the others. The samples are converted to the
+	// format of file in the thread for transmission.
 	if (state->direction == FFADO_CAPTURE) {
 		if (*format == SND_PCM_FORMAT_UNKNOWN)
 			*format = SND_PCM_FORMAT_S24;
 	}
-	if (*format != SND_PCM_FORMAT_S24) {
+	for (i = 0; i < ARRAY_SIZE(sample_formats); ++i) {
+		if (sample_formats[i].format == *format)
+			break;
+	}
+	if (i == ARRAY_SIZE(sample_formats) && xfer->convert_format) {
+		for (i = 0; i < ARRAY_SIZE(sample_formats); ++i) {
+			if (mapper_conversion_is_available(
+					sample_formats[i].format, *format)) {
+				*format = sample_formats[i].format;
+				break;
+			}
+		}
+	}
+	if (i == ARRAY_SIZE(sample_formats)) {
 		fprintf(stderr,
-			"A libffado backend supports S24 only.\n");
+			"A libffado backend supports S24, S32 and FLOAT "
+			"only.\n");
 		return -EINVAL;
 	}
+	state->pack = sample_formats[i].pack;
+	state->unpack = sample_formats[i].unpack;
 
 	// The backend requires the number of frames per second for its
 	// initialization.
@@ -457,6 +858,32 @@ static int xfer_libffado_pre_process(struct xfer_context *xfer,
 	if (err < 0)
 		return err;
 
+	// The ring of periods in samples of stream for the streaming thread.
+	ring->period_count = state->periods_per_buffer * RING_PERIODS_RATIO;
+	ring->samples_per_period = state->frames_per_period * channels;
+	ring->buf = page_buffer_alloc((size_t)ring->period_count *
+				      ring->samples_per_period *
+				      sizeof(*ring->buf), &ring->mode);
+	if (ring->buf == NULL)
+		return -ENOMEM;
+	if (sem_init(&ring->sem, 0, 0) < 0) {
+		err = -errno;
+		page_buffer_free(ring->buf);
+		ring->buf = NULL;
+		return err;
+	}
+	atomic_init(&ring->head, 0);
+	atomic_init(&ring->tail, 0);
+	atomic_init(&ring->draining, false);
+	atomic_init(&ring->closing, false);
+	atomic_init(&ring->err, 0);
+
+	if (xfer->verbose > 0) {
+		fprintf(stderr, "  ring: %u periods of %u frames in %s pages\n",
+			ring->period_count, state->frames_per_period,
+			page_buffer_mode_name(ring->mode));
+	}
+
 	if (state->direction == FFADO_CAPTURE)
 		state->process_frames = r_process_frames;
 	else
@@ -465,8 +892,9 @@ static int xfer_libffado_pre_process(struct xfer_context *xfer,
 	if (ffado_streaming_prepare(state->handle))
 		return -EIO;
 
-	if (ffado_streaming_start(state->handle))
-		return -EIO;
+	// For playback, the streaming starts when the ring is filled.
+	if (state->direction == FFADO_CAPTURE)
+		return start_streaming(state);
 
 	return 0;
 }
@@ -477,21 +905,9 @@ static int xfer_libffado_process_frames(struct xfer_context *xfer,
 					struct container_context *cntrs)
 {
 	struct libffado_state *state = xfer->private_data;
-	ffado_wait_response res;
 	int err;
 
-	res = ffado_streaming_wait(state->handle);
-	if (res == ffado_wait_shutdown || res == ffado_wait_error) {
-		err = -EIO;
-	} else if (res == ffado_wait_xrun) {
-		// No way to recover in this backend.
-		err = -EPIPE;
-	} else if (res == ffado_wait_ok) {
-		err = state->process_frames(xfer, frame_count, mapper, cntrs);
-	} else {
-		err = -ENXIO;
-	}
-
+	err = state->process_frames(xfer, frame_count, mapper, cntrs);
 	if (err < 0)
 		*frame_count = 0;
 
@@ -514,10 +930,31 @@ static void xfer_libffado_pause(struct xfer_context *xfer, bool enable)
 static void xfer_libffado_post_process(struct xfer_context *xfer)
 {
 	struct libffado_state *state = xfer->private_data;
-
+	struct period_ring *ring = &state->ring;
+	bool drain = false;
+
+	// Transmit the rest of data frames in the cache.
+	if (state->direction == FFADO_PLAYBACK && ring->buf != NULL &&
+	    atomic_load(&ring->err) == 0) {
+		if (frame_cache_get_count(&state->cache) > 0 &&
+		    queue_period(xfer) < 0)
+			goto end;
+		if (!ring->thread_running &&
+		    atomic_load(&ring->head) > 0 && start_streaming(state) < 0)
+			goto end;
+		drain = true;
+	}
+end:
 	if (state->handle != NULL) {
-		ffado_streaming_stop(state->handle);
+		stop_streaming(state, drain);
 		ffado_streaming_finish(state->handle);
+		state->handle = NULL;
+	}
+
+	if (ring->buf != NULL) {
+		sem_destroy(&ring->sem);
+		page_buffer_free(ring->buf);
+		ring->buf = NULL;
 	}
 
 	frame_cache_destroy(&state->cache);
@@ -19,6 +19,21 @@ enum no_short_opts {
 	OPT_DUMP_HW_PARAMS,
 	OPT_PERIOD_SIZE,
 	OPT_BUFFER_SIZE,
+	OPT_IO_TYPE,
+	OPT_IO_DEPTH,
+	OPT_PREALLOCATE,
+	OPT_FILE_WORKERS,
+	OPT_CHECKPOINT,
+	OPT_RESUME,
+	OPT_BLOCK_INDEX,
+	OPT_START_FRAME,
+	OPT_START_TIME,
+	OPT_CONVERT_FORMAT,
+	OPT_SILENCE_THRESHOLD,
+	OPT_SILENCE_DURATION,
+	OPT_SILENCE_MODE,
+	OPT_RECORDER,
+	OPT_RECORDER_POST_ROLL,
 	// Obsoleted.
 	OPT_MAX_FILE_TIME,
 	OPT_USE_STRFTIME,
@@ -39,13 +54,28 @@ static void print_help()
 "      -q, --quiet             quiet mode\n"
 "      -d, --duration=#        interrupt after # seconds\n"
 "      -s, --samples=#         interrupt after # frames\n"
+"      --start-frame=#         start playback at # frame\n"
+"      --start-time=#          start playback at # seconds\n"
 "      -f, --format=FORMAT     sample format (case-insensitive)\n"
 "      -c, --channels=#        channels\n"
 "      -r, --rate=#            numeric sample rate in unit of Hz or kHz\n"
-"      -t, --file-type=TYPE    file type (wav, au, sparc, voc or raw, case-insentive)\n"
+"      --convert-format        convert sample format unsupported by the device\n"
+"      -t, --file-type=TYPE    file type (wav, rf64, w64, au, sparc, voc, raw or flac, case-insentive)\n"
 "      -I, --separate-channels one file for each channel\n"
+"      --file-workers=#        the number of threads to process several files\n"
+"      --io-type=TYPE          I/O type for files (default, io-uring, mmap, thread, direct, splice)\n"
+"      --io-depth=#            the number of buffers for io-uring/thread\n"
+"      --preallocate           preallocate files for the duration of capture\n"
+"      --checkpoint=#          update headers of files per # seconds in capture\n"
+"      --resume                append to existing files in capture\n"
+"      --block-index           save/load index of blocks in voc files in playback\n"
+"      --silence-threshold=#   level of silence in dBFS to detect in capture\n"
+"      --silence-duration=#    the minimum duration of silence in milliseconds\n"
+"      --silence-mode=MODE     handling of silence (skip, split)\n"
+"      --recorder=#            keep the last # seconds in memory, dump by SIGUSR1\n"
+"      --recorder-post-roll=#  seconds to dump after SIGUSR1\n"
 "      --dump-hw-params        dump hw_params of the device\n"
-"      --xfer-type=BACKEND     backend type (libasound, libffado)\n"
+"      --xfer-type=BACKEND     backend type (libasound, libffado, rtp)\n"
 	);
 }
 
@@ -89,8 +119,13 @@ static int verify_cntr_format(struct xfer_context *xfer)
 		{"raw",		CONTAINER_FORMAT_RAW},
 		{"voc",		CONTAINER_FORMAT_VOC},
 		{"wav",		CONTAINER_FORMAT_RIFF_WAVE},
+		{"rf64",	CONTAINER_FORMAT_RF64},
+		{"w64",		CONTAINER_FORMAT_W64},
 		{"au",		CONTAINER_FORMAT_AU},
 		{"sparc",	CONTAINER_FORMAT_AU},
+#if WITH_FLAC
+		{"flac",	CONTAINER_FORMAT_FLAC},
+#endif
 	};
 	int i;
 
@@ -109,6 +144,38 @@ static int verify_cntr_format(struct xfer_context *xfer)
 	return -EINVAL;
 }
 
+static int verify_cntr_io_type(struct xfer_context *xfer)
+{
+	static const struct {
+		const char *const literal;
+		enum container_io_type io_type;
+	} *entry, entries[] = {
+		{"default",	CONTAINER_IO_TYPE_DEFAULT},
+#if WITH_LIBURING
+		{"io-uring",	CONTAINER_IO_TYPE_IO_URING},
+#endif
+		{"mmap",	CONTAINER_IO_TYPE_MMAP},
+		{"thread",	CONTAINER_IO_TYPE_THREAD},
+		{"direct",	CONTAINER_IO_TYPE_DIRECT},
+		{"splice",	CONTAINER_IO_TYPE_SPLICE},
+	};
+	int i;
+
+	for (i = 0; i < ARRAY_SIZE(entries); ++i) {
+		entry = &entries[i];
+		if (strcasecmp(xfer->cntr_io_type_literal, entry->literal))
+			continue;
+
+		xfer->cntr_io_type = entry->io_type;
+		return 0;
+	}
+
+	fprintf(stderr, "unsupported I/O type '%s'\n",
+		xfer->cntr_io_type_literal);
+
+	return -EINVAL;
+}
+
 // This should be called after 'verify_cntr_format()'.
 static int verify_sample_format(struct xfer_context *xfer)
 {
@@ -168,6 +235,206 @@ static int verify_sample_format(struct xfer_context *xfer)
 	return -EINVAL;
 }
 
+static int parse_start_frame(struct xfer_context *xfer, const char *str)
+{
+	unsigned long long val;
+	char *endptr;
+
+	errno = 0;
+	val = strtoull(str, &endptr, 0);
+	if (errno > 0)
+		return -errno;
+	if (*endptr != '\0' || *str == '-')
+		return -EINVAL;
+
+	xfer->start_frame = val;
+
+	return 0;
+}
+
+// Fraction of second is available.
+static int parse_start_time(struct xfer_context *xfer, const char *str)
+{
+	double val;
+	char *endptr;
+
+	errno = 0;
+	val = strtod(str, &endptr);
+	if (errno > 0)
+		return -errno;
+	if (*endptr != '\0' || !isfinite(val) || val < 0.0 ||
+	    val > (double)(UINT64_MAX / 1000000 / 384000))
+		return -EINVAL;
+
+	xfer->start_usec = (uint64_t)llround(val * 1000000.0);
+
+	return 0;
+}
+
+// The level is given in dBFS.
+static int parse_silence_threshold(struct xfer_context *xfer, const char *str)
+{
+	double val;
+	char *endptr;
+
+	errno = 0;
+	val = strtod(str, &endptr);
+	if (errno > 0)
+		return -errno;
+	if (*endptr != '\0' || !isfinite(val) || val >= 0.0 || val < -200.0)
+		return -EINVAL;
+
+	xfer->silence_threshold_db = val;
+	xfer->silence = true;
+
+	return 0;
+}
+
+static int verify_silence_mode(struct xfer_context *xfer)
+{
+	static const struct {
+		const char *const literal;
+		enum container_silence_mode mode;
+	} *entry, entries[] = {
+		{"skip",	CONTAINER_SILENCE_MODE_SKIP},
+		{"split",	CONTAINER_SILENCE_MODE_SPLIT},
+	};
+	int i;
+
+	for (i = 0; i < ARRAY_SIZE(entries); ++i) {
+		entry = &entries[i];
+		if (strcasecmp(xfer->silence_mode_literal, entry->literal))
+			continue;
+
+		xfer->silence_mode = entry->mode;
+		return 0;
+	}
+
+	fprintf(stderr, "unsupported mode of silence '%s'\n",
+		xfer->silence_mode_literal);
+
+	return -EINVAL;
+}
+
+static int validate_silence_options(struct xfer_context *xfer)
+{
+	int err;
+
+	if (xfer->direction != SND_PCM_STREAM_CAPTURE) {
+		fprintf(stderr,
+			"Options for silence are available for capture "
+			"only.\n");
+		return -EINVAL;
+	}
+
+	if (xfer->checkpoint_seconds > 0 || xfer->resume) {
+		fprintf(stderr,
+			"Options for silence are not available with "
+			"checkpoint and resume.\n");
+		return -EINVAL;
+	}
+
+	xfer->silence_mode = CONTAINER_SILENCE_MODE_SKIP;
+	if (xfer->silence_mode_literal) {
+		err = verify_silence_mode(xfer);
+		if (err < 0)
+			return err;
+	}
+
+	if (xfer->silence_threshold_db == 0.0)
+		xfer->silence_threshold_db = -60.0;
+	if (xfer->silence_duration_msec == 0)
+		xfer->silence_duration_msec = 2000;
+
+	if (xfer->silence_mode == CONTAINER_SILENCE_MODE_SKIP) {
+		// The list of gaps is written in the file.
+		if (xfer->cntr_format != CONTAINER_FORMAT_RIFF_WAVE &&
+		    xfer->cntr_format != CONTAINER_FORMAT_RF64) {
+			fprintf(stderr,
+				"The skip mode of silence is available for "
+				"wav and rf64 file only.\n");
+			return -EINVAL;
+		}
+		if (!strcmp(xfer->paths[0], "-")) {
+			fprintf(stderr,
+				"The skip mode of silence is not available "
+				"with stdout.\n");
+			return -EINVAL;
+		}
+	} else {
+		if (xfer->path_count > 1 || xfer->multiple_cntrs ||
+		    xfer->device_count > 1 || !strcmp(xfer->paths[0], "-")) {
+			fprintf(stderr,
+				"The split mode of silence is available with "
+				"a single file only.\n");
+			return -EINVAL;
+		}
+		// The header of container is rewritten at the same length.
+		if (xfer->cntr_format != CONTAINER_FORMAT_RIFF_WAVE &&
+		    xfer->cntr_format != CONTAINER_FORMAT_AU &&
+		    xfer->cntr_format != CONTAINER_FORMAT_RF64 &&
+		    xfer->cntr_format != CONTAINER_FORMAT_W64 &&
+		    xfer->cntr_format != CONTAINER_FORMAT_RAW) {
+			fprintf(stderr,
+				"The split mode of silence is not available "
+				"for this file type.\n");
+			return -EINVAL;
+		}
+		// Data frames should not be queued when switching files.
+		if (xfer->cntr_io_type != CONTAINER_IO_TYPE_DEFAULT) {
+			fprintf(stderr,
+				"The split mode of silence is available with "
+				"default type of I/O only.\n");
+			return -EINVAL;
+		}
+	}
+
+	return 0;
+}
+
+static int validate_recorder_options(struct xfer_context *xfer)
+{
+	if (xfer->direction != SND_PCM_STREAM_CAPTURE) {
+		fprintf(stderr,
+			"Options for recorder are available for capture "
+			"only.\n");
+		return -EINVAL;
+	}
+
+	if (xfer->recorder_seconds == 0) {
+		fprintf(stderr,
+			"An option for post-roll requires an option for "
+			"recorder.\n");
+		return -EINVAL;
+	}
+
+	// Nothing is written to the files given in command line.
+	if (xfer->silence || xfer->checkpoint_seconds > 0 || xfer->resume ||
+	    xfer->preallocate) {
+		fprintf(stderr,
+			"Options for recorder are not available with silence, "
+			"checkpoint, resume and preallocation.\n");
+		return -EINVAL;
+	}
+
+	if (!strcmp(xfer->paths[0], "-")) {
+		fprintf(stderr,
+			"Options for recorder are not available with "
+			"stdout.\n");
+		return -EINVAL;
+	}
+
+	// Data frames are kept in the ring instead of queues.
+	if (xfer->cntr_io_type != CONTAINER_IO_TYPE_DEFAULT) {
+		fprintf(stderr,
+			"Options for recorder are available with default type "
+			"of I/O only.\n");
+		return -EINVAL;
+	}
+
+	return 0;
+}
+
 static int validate_options(struct xfer_context *xfer)
 {
 	unsigned int val;
@@ -192,7 +459,45 @@ static int validate_options(struct xfer_context *xfer)
 	if (err < 0)
 		return err;
 
-	if (xfer->multiple_cntrs) {
+	if (xfer->device_count > 1) {
+		if (xfer->direction != SND_PCM_STREAM_CAPTURE) {
+			fprintf(stderr,
+				"Several devices are available for capture "
+				"only.\n");
+			return -EINVAL;
+		}
+
+		if (xfer->multiple_cntrs) {
+			fprintf(stderr,
+				"An option for separated channels is not "
+				"available with several devices.\n");
+			return -EINVAL;
+		}
+
+		if (!strcmp(xfer->paths[0], "-")) {
+			fprintf(stderr,
+				"Several devices are not available with "
+				"stdout.\n");
+			return -EINVAL;
+		}
+
+		// Like separated channels, one path can be used to generate
+		// a path for each device.
+		if (xfer->path_count > 1 &&
+		    xfer->path_count != xfer->device_count) {
+			fprintf(stderr,
+				"The number of files should be the same as "
+				"the number of devices.\n");
+			return -EINVAL;
+		}
+
+		if (xfer->samples_per_frame == 0) {
+			fprintf(stderr,
+				"The number of channels per device should be "
+				"given for several devices.\n");
+			return -EINVAL;
+		}
+	} else if (xfer->multiple_cntrs) {
 		if (!strcmp(xfer->paths[0], "-")) {
 			fprintf(stderr,
 				"An option for separated channels is not "
@@ -224,6 +529,153 @@ static int validate_options(struct xfer_context *xfer)
 		}
 	}
 
+	xfer->cntr_io_type = CONTAINER_IO_TYPE_DEFAULT;
+	if (xfer->cntr_io_type_literal) {
+		err = verify_cntr_io_type(xfer);
+		if (err < 0)
+			return err;
+	}
+
+#if WITH_FLAC
+	// Encoding is expensive, thus runs in the dedicated thread of I/O.
+	if (xfer->cntr_format == CONTAINER_FORMAT_FLAC) {
+		if (xfer->direction != SND_PCM_STREAM_CAPTURE) {
+			fprintf(stderr,
+				"FLAC file is available for capture only.\n");
+			return -EINVAL;
+		}
+		if (xfer->cntr_io_type == CONTAINER_IO_TYPE_DEFAULT) {
+			xfer->cntr_io_type = CONTAINER_IO_TYPE_THREAD;
+		} else if (xfer->cntr_io_type != CONTAINER_IO_TYPE_THREAD) {
+			fprintf(stderr,
+				"FLAC file is available with thread type of "
+				"I/O only.\n");
+			return -EINVAL;
+		}
+	}
+#endif
+
+	if (xfer->cntr_io_type == CONTAINER_IO_TYPE_MMAP &&
+	    xfer->direction != SND_PCM_STREAM_PLAYBACK) {
+		fprintf(stderr,
+			"The mmap type of I/O is available for playback "
+			"only.\n");
+		return -EINVAL;
+	}
+
+	if ((xfer->cntr_io_type == CONTAINER_IO_TYPE_DIRECT ||
+	     xfer->cntr_io_type == CONTAINER_IO_TYPE_SPLICE) &&
+	    xfer->direction != SND_PCM_STREAM_CAPTURE) {
+		fprintf(stderr,
+			"The %s type of I/O is available for capture only.\n",
+			xfer->cntr_io_type_literal);
+		return -EINVAL;
+	}
+
+	if (xfer->file_worker_count > 0 && !xfer->multiple_cntrs &&
+	    xfer->device_count < 2) {
+		fprintf(stderr,
+			"An option for workers is available with several "
+			"files only.\n");
+		return -EINVAL;
+	}
+
+	if (xfer->preallocate) {
+		if (xfer->direction != SND_PCM_STREAM_CAPTURE) {
+			fprintf(stderr,
+				"An option for preallocation is available for "
+				"capture only.\n");
+			return -EINVAL;
+		}
+		// The expected size is calculated by the duration.
+		if (xfer->duration_seconds == 0 && xfer->duration_frames == 0) {
+			fprintf(stderr,
+				"An option for preallocation requires any "
+				"option for duration.\n");
+			return -EINVAL;
+		}
+	}
+
+	if (xfer->checkpoint_seconds > 0 || xfer->resume) {
+		if (xfer->direction != SND_PCM_STREAM_CAPTURE) {
+			fprintf(stderr,
+				"Options for checkpoint and resume are "
+				"available for capture only.\n");
+			return -EINVAL;
+		}
+		if (!strcmp(xfer->paths[0], "-")) {
+			fprintf(stderr,
+				"Options for checkpoint and resume are not "
+				"available with stdout.\n");
+			return -EINVAL;
+		}
+		// The header of container is rewritten at the same length,
+		// and data frames follow it.
+		if (xfer->cntr_format != CONTAINER_FORMAT_RIFF_WAVE &&
+		    xfer->cntr_format != CONTAINER_FORMAT_AU &&
+		    xfer->cntr_format != CONTAINER_FORMAT_RF64 &&
+		    xfer->cntr_format != CONTAINER_FORMAT_W64 &&
+		    xfer->cntr_format != CONTAINER_FORMAT_RAW) {
+			fprintf(stderr,
+				"Options for checkpoint and resume are not "
+				"available for this file type.\n");
+			return -EINVAL;
+		}
+	}
+
+	if (xfer->start_frame > 0 || xfer->start_usec > 0) {
+		if (xfer->direction != SND_PCM_STREAM_PLAYBACK) {
+			fprintf(stderr,
+				"Options for start position are available for "
+				"playback only.\n");
+			return -EINVAL;
+		}
+		if (xfer->start_frame > 0 && xfer->start_usec > 0) {
+			fprintf(stderr,
+				"Options for start position are exclusive.\n");
+			return -EINVAL;
+		}
+	}
+
+	if (xfer->block_index && xfer->direction != SND_PCM_STREAM_PLAYBACK) {
+		fprintf(stderr,
+			"An option for index of blocks is available for "
+			"playback only.\n");
+		return -EINVAL;
+	}
+
+	// Data frames are queued in the other types of I/O.
+	if (xfer->checkpoint_seconds > 0 &&
+	    xfer->cntr_io_type != CONTAINER_IO_TYPE_DEFAULT) {
+		fprintf(stderr,
+			"An option for checkpoint is available with default "
+			"type of I/O only.\n");
+		return -EINVAL;
+	}
+
+	if (xfer->silence) {
+		err = validate_silence_options(xfer);
+		if (err < 0)
+			return err;
+	}
+
+	if (xfer->recorder) {
+		err = validate_recorder_options(xfer);
+		if (err < 0)
+			return err;
+	}
+
+	if (xfer->cntr_io_type == CONTAINER_IO_TYPE_IO_URING ||
+	    xfer->cntr_io_type == CONTAINER_IO_TYPE_THREAD) {
+		if (xfer->cntr_io_depth == 0)
+			xfer->cntr_io_depth = 4;
+	} else if (xfer->cntr_io_depth > 0) {
+		fprintf(stderr,
+			"An option for I/O depth is available with io-uring "
+			"and thread type of I/O only.\n");
+		return -EINVAL;
+	}
+
 	xfer->sample_format = SND_PCM_FORMAT_UNKNOWN;
 	if (xfer->sample_format_literal) {
 		err = verify_sample_format(xfer);
@@ -269,14 +721,29 @@ int xfer_options_parse_args(struct xfer_context *xfer,
 		{"quiet",		0, 0, 'q'},
 		{"duration",		1, 0, 'd'},
 		{"samples",		1, 0, 's'},
+		{"start-frame",		1, 0, OPT_START_FRAME},
+		{"start-time",		1, 0, OPT_START_TIME},
 		// For transfer backend.
 		{"format",		1, 0, 'f'},
 		{"channels",		1, 0, 'c'},
 		{"rate",		1, 0, 'r'},
+		{"convert-format",	0, 0, OPT_CONVERT_FORMAT},
 		// For containers.
 		{"file-type",		1, 0, 't'},
+		{"io-type",		1, 0, OPT_IO_TYPE},
+		{"io-depth",		1, 0, OPT_IO_DEPTH},
+		{"preallocate",		0, 0, OPT_PREALLOCATE},
+		{"checkpoint",		1, 0, OPT_CHECKPOINT},
+		{"resume",		0, 0, OPT_RESUME},
+		{"block-index",		0, 0, OPT_BLOCK_INDEX},
+		{"silence-threshold",	1, 0, OPT_SILENCE_THRESHOLD},
+		{"silence-duration",	1, 0, OPT_SILENCE_DURATION},
+		{"silence-mode",	1, 0, OPT_SILENCE_MODE},
+		{"recorder",		1, 0, OPT_RECORDER},
+		{"recorder-post-roll",	1, 0, OPT_RECORDER_POST_ROLL},
 		// For mapper.
 		{"separate-channels",	0, 0, 'I'},
+		{"file-workers",	1, 0, OPT_FILE_WORKERS},
 		// For debugging.
 		{"dump-hw-params",	0, 0, OPT_DUMP_HW_PARAMS},
 		// Obsoleted.
@@ -343,10 +810,45 @@ int xfer_options_parse_args(struct xfer_context *xfer,
 			xfer->samples_per_frame = arg_parse_decimal_num(optarg, &err);
 		else if (key == 'r')
 			xfer->frames_per_second = arg_parse_decimal_num(optarg, &err);
+		else if (key == OPT_CONVERT_FORMAT)
+			xfer->convert_format = true;
 		else if (key == 't')
 			xfer->cntr_format_literal = arg_duplicate_string(optarg, &err);
+		else if (key == OPT_IO_TYPE)
+			xfer->cntr_io_type_literal = arg_duplicate_string(optarg, &err);
+		else if (key == OPT_IO_DEPTH)
+			xfer->cntr_io_depth = arg_parse_decimal_num(optarg, &err);
+		else if (key == OPT_PREALLOCATE)
+			xfer->preallocate = true;
+		else if (key == OPT_CHECKPOINT)
+			xfer->checkpoint_seconds = arg_parse_decimal_num(optarg, &err);
+		else if (key == OPT_RESUME)
+			xfer->resume = true;
+		else if (key == OPT_BLOCK_INDEX)
+			xfer->block_index = true;
+		else if (key == OPT_START_FRAME)
+			err = parse_start_frame(xfer, optarg);
+		else if (key == OPT_START_TIME)
+			err = parse_start_time(xfer, optarg);
+		else if (key == OPT_SILENCE_THRESHOLD)
+			err = parse_silence_threshold(xfer, optarg);
+		else if (key == OPT_SILENCE_DURATION) {
+			xfer->silence_duration_msec = arg_parse_decimal_num(optarg, &err);
+			xfer->silence = true;
+		} else if (key == OPT_SILENCE_MODE) {
+			xfer->silence_mode_literal = arg_duplicate_string(optarg, &err);
+			xfer->silence = true;
+		} else if (key == OPT_RECORDER) {
+			xfer->recorder_seconds = arg_parse_decimal_num(optarg, &err);
+			xfer->recorder = true;
+		} else if (key == OPT_RECORDER_POST_ROLL) {
+			xfer->recorder_post_roll_seconds = arg_parse_decimal_num(optarg, &err);
+			xfer->recorder = true;
+		}
 		else if (key == 'I')
 			xfer->multiple_cntrs = true;
+		else if (key == OPT_FILE_WORKERS)
+			xfer->file_worker_count = arg_parse_decimal_num(optarg, &err);
 		else if (key == OPT_DUMP_HW_PARAMS)
 			xfer->dump_hw_params = true;
 		else if (key == '?') {
@@ -579,10 +1081,17 @@ int xfer_options_fixup_paths(struct xfer_context *xfer)
 		// Nothing to do for sign of stdin/stdout.
 		if (!strcmp(xfer->paths[0], "-"))
 			return 0;
-		if (!xfer->multiple_cntrs)
+		if (xfer->device_count > 1)
+			err = create_paths(xfer, xfer->device_count);
+		else if (!xfer->multiple_cntrs)
 			err = fixup_paths(xfer);
 		else
 			err = create_paths(xfer, xfer->samples_per_frame);
+	} else if (xfer->device_count > 1) {
+		if (xfer->path_count != xfer->device_count)
+			return -EINVAL;
+		else
+			err = fixup_paths(xfer);
 	} else {
 		if (!xfer->multiple_cntrs)
 			return -EINVAL;
@@ -0,0 +1,843 @@
+// SPDX-License-Identifier: GPL-2.0
+//
+// xfer-rtp.c - receive/transmit frames by RTP over UDP for AES67 network.
+//
+// Copyright (c) 2026 agent <agent@local>
+//
+// Licensed under the terms of the GNU General Public License, version 2.
+
+#include "xfer.h"
+#include "misc.h"
+
+#include <stdio.h>
+#include <inttypes.h>
+#include <fcntl.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+// A batch of packets is sent by a call of sendmmsg(2) or received by a call
+// of recvmmsg(2). The payload of each packet is a view of the buffer given to
+// the mapper, thus data frames are not copied between the buffer and the
+// socket. The header of each packet is in its own small buffer.
+//
+// In playback, a batch is sent when the mapper fills it, at the time of the
+// reference clock for its first frame. In capture, the receiver follows RTP
+// timestamp of the first packet; lost packets are filled with silence and
+// late packets are dropped.
+#define RTP_HEADER_SIZE		12
+#define RTP_VERSION		2
+#define DEFAULT_PORT		5004
+#define DEFAULT_PAYLOAD_TYPE	96
+#define DEFAULT_PACKET_USEC	1000
+#define DEFAULT_PACKETS_PER_BATCH	4
+#define MAX_PACKETS_PER_BATCH	64
+// AF41 for media in AES67.
+#define DEFAULT_DSCP		34
+#define MAX_PAYLOAD_SIZE	1440
+
+// The file descriptor of PTP hardware clock can be used for clockid_t.
+#define FD_TO_CLOCKID(fd)	((~(clockid_t)(fd) << 3) | 3)
+
+struct rtp_packet {
+	uint8_t header[RTP_HEADER_SIZE];
+	struct iovec iov[2];
+	// The frames in the payload, and the frames lost before it.
+	unsigned int frame_count;
+	unsigned int gap_count;
+};
+
+struct rtp_state {
+	int fd;
+	char *addr_literal;
+	char *iface_literal;
+	char *clock_literal;
+	unsigned int port;
+	unsigned int payload_type;
+	unsigned int packet_usec;
+	unsigned int packets_per_batch;
+	unsigned int ttl;
+	unsigned int ssrc;
+
+	struct sockaddr_in addr;
+	clockid_t clock_id;
+	int clock_fd;
+
+	unsigned int bytes_per_frame;
+	unsigned int frames_per_packet;
+	unsigned int frames_per_second;
+
+	// Frames of a batch, in the sample format of the payload.
+	char *buf;
+	char *silence;
+	struct rtp_packet *packets;
+	struct mmsghdr *msgs;
+
+	int (*process_frames)(struct xfer_context *xfer,
+			      unsigned int *frame_count,
+			      struct mapper_context *mapper,
+			      struct container_context *cntrs);
+
+	// For transmission.
+	unsigned int pos;
+	uint16_t seq;
+	uint32_t timestamp;
+	uint64_t batch_count;
+	struct timespec start;
+	bool started;
+
+	// For reception.
+	unsigned int packet_count;
+	unsigned int packet_index;
+	unsigned int packet_pos;
+	bool synced;
+	uint32_t src_ssrc;
+	uint32_t expected_timestamp;
+	uint64_t lost_count;
+	uint64_t late_count;
+};
+
+enum no_short_opts {
+	OPT_ADDRESS = 200,
+	OPT_PORT,
+	OPT_INTERFACE,
+	OPT_PAYLOAD_TYPE,
+	OPT_PACKET_TIME,
+	OPT_PACKETS_PER_BATCH,
+	OPT_TTL,
+	OPT_SSRC,
+	OPT_PTP_CLOCK,
+};
+
+#define S_OPTS	""
+static const struct option l_opts[] = {
+	{"address",		1, 0, OPT_ADDRESS},
+	{"port",		1, 0, OPT_PORT},
+	{"interface",		1, 0, OPT_INTERFACE},
+	{"payload-type",	1, 0, OPT_PAYLOAD_TYPE},
+	{"packet-time",		1, 0, OPT_PACKET_TIME},
+	{"packets-per-batch",	1, 0, OPT_PACKETS_PER_BATCH},
+	{"ttl",			1, 0, OPT_TTL},
+	{"ssrc",		1, 0, OPT_SSRC},
+	{"ptp-clock",		1, 0, OPT_PTP_CLOCK},
+};
+
+static int xfer_rtp_init(struct xfer_context *xfer,
+			 snd_pcm_stream_t direction)
+{
+	struct rtp_state *state = xfer->private_data;
+
+	state->fd = -1;
+	state->clock_fd = -1;
+
+	return 0;
+}
+
+static int xfer_rtp_parse_opt(struct xfer_context *xfer, int key,
+			      const char *optarg)
+{
+	struct rtp_state *state = xfer->private_data;
+	int err;
+
+	if (key == OPT_ADDRESS)
+		state->addr_literal = arg_duplicate_string(optarg, &err);
+	else if (key == OPT_PORT)
+		state->port = arg_parse_decimal_num(optarg, &err);
+	else if (key == OPT_INTERFACE)
+		state->iface_literal = arg_duplicate_string(optarg, &err);
+	else if (key == OPT_PAYLOAD_TYPE)
+		state->payload_type = arg_parse_decimal_num(optarg, &err);
+	else if (key == OPT_PACKET_TIME)
+		state->packet_usec = arg_parse_decimal_num(optarg, &err);
+	else if (key == OPT_PACKETS_PER_BATCH)
+		state->packets_per_batch = arg_parse_decimal_num(optarg, &err);
+	else if (key == OPT_TTL)
+		state->ttl = arg_parse_decimal_num(optarg, &err);
+	else if (key == OPT_SSRC)
+		state->ssrc = arg_parse_decimal_num(optarg, &err);
+	else if (key == OPT_PTP_CLOCK)
+		state->clock_literal = arg_duplicate_string(optarg, &err);
+	else
+		err = -ENXIO;
+
+	return err;
+}
+
+static int xfer_rtp_validate_opts(struct xfer_context *xfer)
+{
+	struct rtp_state *state = xfer->private_data;
+
+	if (state->addr_literal == NULL) {
+		fprintf(stderr, "An option for address is required.\n");
+		return -EINVAL;
+	}
+	if (inet_pton(AF_INET, state->addr_literal,
+		      &state->addr.sin_addr) != 1) {
+		fprintf(stderr, "Invalid IPv4 address: %s\n",
+			state->addr_literal);
+		return -EINVAL;
+	}
+
+	if (state->port == 0)
+		state->port = DEFAULT_PORT;
+	if (state->port > 65535) {
+		fprintf(stderr, "Invalid port: %u\n", state->port);
+		return -EINVAL;
+	}
+	state->addr.sin_family = AF_INET;
+	state->addr.sin_port = htons(state->port);
+
+	if (state->iface_literal != NULL) {
+		struct in_addr iface;
+
+		if (inet_pton(AF_INET, state->iface_literal, &iface) != 1) {
+			fprintf(stderr,
+				"The interface should be given by its IPv4 "
+				"address: %s\n", state->iface_literal);
+			return -EINVAL;
+		}
+	}
+
+	if (state->payload_type == 0)
+		state->payload_type = DEFAULT_PAYLOAD_TYPE;
+	if (state->payload_type > 127) {
+		fprintf(stderr, "Invalid payload type: %u\n",
+			state->payload_type);
+		return -EINVAL;
+	}
+
+	if (state->packet_usec == 0)
+		state->packet_usec = DEFAULT_PACKET_USEC;
+
+	if (state->packets_per_batch == 0)
+		state->packets_per_batch = DEFAULT_PACKETS_PER_BATCH;
+	if (state->packets_per_batch > MAX_PACKETS_PER_BATCH) {
+		fprintf(stderr,
+			"The number of packets per batch should be up to %u.\n",
+			MAX_PACKETS_PER_BATCH);
+		return -EINVAL;
+	}
+
+	if (state->ttl == 0)
+		state->ttl = 16;
+	if (state->ttl > 255) {
+		fprintf(stderr, "Invalid TTL: %u\n", state->ttl);
+		return -EINVAL;
+	}
+
+	if (state->clock_literal != NULL &&
+	    xfer->direction != SND_PCM_STREAM_PLAYBACK) {
+		fprintf(stderr,
+			"An option for PTP clock is available for playback "
+			"only.\n");
+		return -EINVAL;
+	}
+
+	return 0;
+}
+
+static inline uint64_t timespec_to_nsec(const struct timespec *ts)
+{
+	return (uint64_t)ts->tv_sec * 1000000000ull + ts->tv_nsec;
+}
+
+// The media clock of AES67 counts frames since the epoch of PTP.
+static uint32_t media_clock(const struct timespec *ts,
+			    unsigned int frames_per_second)
+{
+	return (uint32_t)((uint64_t)ts->tv_sec * frames_per_second +
+			  (uint64_t)ts->tv_nsec * frames_per_second /
+			  1000000000ull);
+}
+
+static void build_header(struct rtp_state *state, uint8_t *header,
+			 uint16_t seq, uint32_t timestamp)
+{
+	header[0] = RTP_VERSION << 6;
+	header[1] = state->payload_type & 0x7f;
+	header[2] = seq >> 8;
+	header[3] = seq;
+	header[4] = timestamp >> 24;
+	header[5] = timestamp >> 16;
+	header[6] = timestamp >> 8;
+	header[7] = timestamp;
+	header[8] = state->ssrc >> 24;
+	header[9] = state->ssrc >> 16;
+	header[10] = state->ssrc >> 8;
+	header[11] = state->ssrc;
+}
+
+// Sleep till the time of reference clock. The clock of PTP hardware is not
+// available for clock_nanosleep(2), thus the rest is slept in monotonic clock.
+static int wait_for_time(struct rtp_state *state, const struct timespec *when)
+{
+	struct timespec now;
+	struct timespec rel;
+	int64_t nsec;
+	int err;
+
+	if (clock_gettime(state->clock_id, &now) < 0)
+		return -errno;
+	nsec = (int64_t)(timespec_to_nsec(when) - timespec_to_nsec(&now));
+	if (nsec <= 0)
+		return 0;
+
+	rel.tv_sec = nsec / 1000000000;
+	rel.tv_nsec = nsec % 1000000000;
+	// The error is returned, not set to errno.
+	while ((err = clock_nanosleep(CLOCK_MONOTONIC, 0, &rel, &rel)) != 0) {
+		if (err != EINTR)
+			return -err;
+	}
+
+	return 0;
+}
+
+static int send_batch(struct xfer_context *xfer, unsigned int frame_count)
+{
+	struct rtp_state *state = xfer->private_data;
+	struct timespec when;
+	unsigned int count;
+	unsigned int sent;
+	uint64_t nsec;
+	int i;
+	int err;
+
+	if (!state->started) {
+		if (clock_gettime(state->clock_id, &state->start) < 0)
+			return -errno;
+		state->timestamp = media_clock(&state->start,
+					       state->frames_per_second);
+		state->started = true;
+	}
+
+	// The time of the first frame in the batch.
+	nsec = timespec_to_nsec(&state->start) +
+	       state->batch_count * state->packets_per_batch *
+	       state->frames_per_packet * 1000000000ull /
+	       state->frames_per_second;
+	when.tv_sec = nsec / 1000000000;
+	when.tv_nsec = nsec % 1000000000;
+	err = wait_for_time(state, &when);
+	if (err < 0)
+		return err;
+
+	count = 0;
+	for (i = 0; i < state->packets_per_batch && frame_count > 0; ++i) {
+		struct rtp_packet *packet = &state->packets[i];
+		unsigned int frames = state->frames_per_packet;
+
+		if (frames > frame_count)
+			frames = frame_count;
+
+		build_header(state, packet->header, state->seq++,
+			     state->timestamp);
+		state->timestamp += frames;
+		packet->iov[1].iov_len = frames * state->bytes_per_frame;
+		frame_count -= frames;
+		++count;
+	}
+
+	sent = 0;
+	while (sent < count) {
+		int ret = sendmmsg(state->fd, state->msgs + sent, count - sent,
+				   0);
+		if (ret < 0) {
+			if (errno == EINTR)
+				continue;
+			return -errno;
+		}
+		sent += ret;
+	}
+
+	++state->batch_count;
+
+	return 0;
+}
+
+static int w_process_frames(struct xfer_context *xfer,
+			    unsigned int *frame_count,
+			    struct mapper_context *mapper,
+			    struct container_context *cntrs)
+{
+	struct rtp_state *state = xfer->private_data;
+	unsigned int frames_per_batch = state->frames_per_packet *
+					state->packets_per_batch;
+	unsigned int avail_count;
+	int err;
+
+	// Trim up to expected frame count and the space in the batch.
+	avail_count = frames_per_batch - state->pos;
+	if (*frame_count < avail_count)
+		avail_count = *frame_count;
+
+	err = mapper_context_process_frames(mapper,
+			state->buf + state->pos * state->bytes_per_frame,
+			&avail_count, cntrs);
+	if (err < 0)
+		return err;
+	state->pos += avail_count;
+
+	if (state->pos >= frames_per_batch) {
+		err = send_batch(xfer, state->pos);
+		if (err < 0)
+			return err;
+		state->pos = 0;
+	}
+
+	*frame_count = avail_count;
+
+	return 0;
+}
+
+static inline uint32_t load_be32(const uint8_t *p)
+{
+	return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) |
+	       ((uint32_t)p[2] << 8) | p[3];
+}
+
+// Check the packet and count the frames in it and the frames lost before it.
+static bool accept_packet(struct rtp_state *state, struct rtp_packet *packet,
+			  unsigned int len)
+{
+	const uint8_t *header = packet->header;
+	unsigned int header_size;
+	uint32_t ssrc;
+	uint32_t timestamp;
+	int32_t delta;
+
+	if (len < RTP_HEADER_SIZE || (header[0] >> 6) != RTP_VERSION)
+		return false;
+	// Neither padding, extension nor contributing source is expected
+	// in AES67.
+	header_size = RTP_HEADER_SIZE + (header[0] & 0x0f) * 4;
+	if (header_size != RTP_HEADER_SIZE || (header[0] & 0x30))
+		return false;
+	if ((header[1] & 0x7f) != state->payload_type)
+		return false;
+
+	ssrc = load_be32(header + 8);
+	timestamp = load_be32(header + 4);
+	if (!state->synced) {
+		state->src_ssrc = ssrc;
+		state->expected_timestamp = timestamp;
+		state->synced = true;
+	} else if (ssrc != state->src_ssrc) {
+		return false;
+	}
+
+	packet->frame_count = (len - RTP_HEADER_SIZE) / state->bytes_per_frame;
+	packet->gap_count = 0;
+
+	delta = (int32_t)(timestamp - state->expected_timestamp);
+	if (delta > (int32_t)state->frames_per_second ||
+	    delta < -(int32_t)state->frames_per_second) {
+		// The source restarted.
+		delta = 0;
+	} else if (delta < 0) {
+		++state->late_count;
+		return false;
+	}
+	if (delta > 0) {
+		packet->gap_count = delta;
+		state->lost_count += delta;
+	}
+
+	state->expected_timestamp = timestamp + packet->frame_count;
+
+	return true;
+}
+
+static int receive_batch(struct xfer_context *xfer)
+{
+	struct rtp_state *state = xfer->private_data;
+	unsigned int count;
+	int ret;
+	int i;
+
+	for (i = 0; i < state->packets_per_batch; ++i) {
+		state->packets[i].iov[1].iov_len = state->frames_per_packet *
+						   state->bytes_per_frame;
+	}
+
+	// Wait for the first packet, then take the rest as much as queued.
+	ret = recvmmsg(state->fd, state->msgs, state->packets_per_batch,
+		       MSG_WAITFORONE, NULL);
+	if (ret < 0)
+		return -errno;
+
+	count = 0;
+	for (i = 0; i < ret; ++i) {
+		struct rtp_packet *packet = &state->packets[i];
+
+		if (state->msgs[i].msg_hdr.msg_flags & MSG_TRUNC)
+			continue;
+		if (!accept_packet(state, packet, state->msgs[i].msg_len))
+			continue;
+
+		// Keep the order of accepted packets.
+		if (count != i) {
+			struct rtp_packet *dst = &state->packets[count];
+
+			memmove(dst->iov[1].iov_base, packet->iov[1].iov_base,
+				packet->frame_count * state->bytes_per_frame);
+			dst->frame_count = packet->frame_count;
+			dst->gap_count = packet->gap_count;
+		}
+		++count;
+	}
+
+	state->packet_count = count;
+	state->packet_index = 0;
+	state->packet_pos = 0;
+
+	return 0;
+}
+
+static int r_process_frames(struct xfer_context *xfer,
+			    unsigned int *frame_count,
+			    struct mapper_context *mapper,
+			    struct container_context *cntrs)
+{
+	struct rtp_state *state = xfer->private_data;
+	struct rtp_packet *packet;
+	unsigned int avail_count;
+	char *ptr;
+	int err;
+
+	while (state->packet_index >= state->packet_count) {
+		err = receive_batch(xfer);
+		if (err < 0)
+			return err;
+	}
+	packet = &state->packets[state->packet_index];
+
+	// The frames lost before the packet are filled with silence.
+	if (packet->gap_count > 0) {
+		avail_count = packet->gap_count;
+		if (avail_count > state->frames_per_packet)
+			avail_count = state->frames_per_packet;
+		ptr = state->silence;
+	} else {
+		avail_count = packet->frame_count - state->packet_pos;
+		ptr = (char *)packet->iov[1].iov_base +
+		      state->packet_pos * state->bytes_per_frame;
+	}
+	if (*frame_count < avail_count)
+		avail_count = *frame_count;
+
+	err = mapper_context_process_frames(mapper, ptr, &avail_count, cntrs);
+	if (err < 0)
+		return err;
+
+	if (packet->gap_count > 0) {
+		packet->gap_count -= avail_count;
+	} else {
+		state->packet_pos += avail_count;
+		if (state->packet_pos >= packet->frame_count) {
+			++state->packet_index;
+			state->packet_pos = 0;
+		}
+	}
+
+	*frame_count = avail_count;
+
+	return 0;
+}
+
+static int open_socket(struct xfer_context *xfer)
+{
+	struct rtp_state *state = xfer->private_data;
+	bool multicast = IN_MULTICAST(ntohl(state->addr.sin_addr.s_addr));
+	struct in_addr iface = { .s_addr = htonl(INADDR_ANY) };
+	int tos = DEFAULT_DSCP << 2;
+	int on = 1;
+
+	if (state->iface_literal != NULL)
+		inet_pton(AF_INET, state->iface_literal, &iface);
+
+	state->fd = socket(AF_INET, SOCK_DGRAM | SOCK_CLOEXEC, IPPROTO_UDP);
+	if (state->fd < 0)
+		return -errno;
+
+	if (xfer->direction == SND_PCM_STREAM_PLAYBACK) {
+		if (setsockopt(state->fd, IPPROTO_IP, IP_TOS, &tos,
+			       sizeof(tos)) < 0)
+			return -errno;
+		if (multicast) {
+			unsigned char ttl = state->ttl;
+
+			if (setsockopt(state->fd, IPPROTO_IP, IP_MULTICAST_TTL,
+				       &ttl, sizeof(ttl)) < 0)
+				return -errno;
+			if (setsockopt(state->fd, IPPROTO_IP, IP_MULTICAST_IF,
+				       &iface, sizeof(iface)) < 0)
+				return -errno;
+		}
+		if (connect(state->fd, (struct sockaddr *)&state->addr,
+			    sizeof(state->addr)) < 0)
+			return -errno;
+	} else {
+		struct sockaddr_in addr = state->addr;
+
+		if (setsockopt(state->fd, SOL_SOCKET, SO_REUSEADDR, &on,
+			       sizeof(on)) < 0)
+			return -errno;
+		if (multicast) {
+			struct ip_mreq mreq = {
+				.imr_multiaddr = state->addr.sin_addr,
+				.imr_interface = iface,
+			};
+
+			if (setsockopt(state->fd, IPPROTO_IP,
+				       IP_ADD_MEMBERSHIP, &mreq,
+				       sizeof(mreq)) < 0)
+				return -errno;
+		} else {
+			addr.sin_addr.s_addr = htonl(INADDR_ANY);
+		}
+		if (bind(state->fd, (struct sockaddr *)&addr,
+			 sizeof(addr)) < 0)
+			return -errno;
+	}
+
+	return 0;
+}
+
+static int open_clock(struct rtp_state *state)
+{
+	if (state->clock_literal == NULL) {
+		// Usually disciplined to PTP by phc2sys(8).
+		state->clock_id = CLOCK_TAI;
+		return 0;
+	}
+
+	state->clock_fd = open(state->clock_literal, O_RDONLY | O_CLOEXEC);
+	if (state->clock_fd < 0) {
+		fprintf(stderr, "Fail to open '%s': %s\n",
+			state->clock_literal, strerror(errno));
+		return -errno;
+	}
+	state->clock_id = FD_TO_CLOCKID(state->clock_fd);
+
+	return 0;
+}
+
+static int xfer_rtp_pre_process(struct xfer_context *xfer,
+				snd_pcm_format_t *format,
+				unsigned int *samples_per_frame,
+				unsigned int *frames_per_second,
+				snd_pcm_access_t *access,
+				snd_pcm_uframes_t *frames_per_buffer)
+{
+	struct rtp_state *state = xfer->private_data;
+	unsigned int bytes_per_packet;
+	int i;
+	int err;
+
+	// L16 and L24 of RFC 3551 and RFC 3190.
+	if (*format == SND_PCM_FORMAT_UNKNOWN)
+		*format = SND_PCM_FORMAT_S24_3BE;
+	if (*format != SND_PCM_FORMAT_S16_BE &&
+	    *format != SND_PCM_FORMAT_S24_3BE && xfer->convert_format) {
+		if (snd_pcm_format_width(*format) <= 16 &&
+		    mapper_conversion_is_available(SND_PCM_FORMAT_S16_BE,
+						   *format))
+			*format = SND_PCM_FORMAT_S16_BE;
+		else if (mapper_conversion_is_available(SND_PCM_FORMAT_S24_3BE,
+							*format))
+			*format = SND_PCM_FORMAT_S24_3BE;
+	}
+	if (*format != SND_PCM_FORMAT_S16_BE &&
+	    *format != SND_PCM_FORMAT_S24_3BE) {
+		fprintf(stderr,
+			"An RTP backend supports S16_BE (L16) and S24_3BE (L24) "
+			"only.\n");
+		return -EINVAL;
+	}
+
+	if (*samples_per_frame == 0)
+		*samples_per_frame = 2;
+	if (*frames_per_second == 0)
+		*frames_per_second = 48000;
+
+	state->frames_per_second = *frames_per_second;
+	state->bytes_per_frame = snd_pcm_format_physical_width(*format) / 8 *
+				 *samples_per_frame;
+	state->frames_per_packet = (uint64_t)*frames_per_second *
+				   state->packet_usec / 1000000;
+	if (state->frames_per_packet == 0) {
+		fprintf(stderr, "The packet time is too short.\n");
+		return -EINVAL;
+	}
+	bytes_per_packet = state->frames_per_packet * state->bytes_per_frame;
+	if (bytes_per_packet > MAX_PAYLOAD_SIZE) {
+		fprintf(stderr,
+			"The payload of %u bytes exceeds %u bytes. Use shorter "
+			"packet time or less channels.\n",
+			bytes_per_packet, MAX_PAYLOAD_SIZE);
+		return -EINVAL;
+	}
+
+	err = open_socket(xfer);
+	if (err < 0) {
+		fprintf(stderr, "Fail to open socket for %s:%u: %s\n",
+			state->addr_literal, state->port, strerror(-err));
+		return err;
+	}
+
+	if (xfer->direction == SND_PCM_STREAM_PLAYBACK) {
+		err = open_clock(state);
+		if (err < 0)
+			return err;
+		if (state->ssrc == 0)
+			state->ssrc = (getpid() << 16) ^ time(NULL);
+	}
+
+	state->buf = calloc(state->packets_per_batch, bytes_per_packet);
+	state->silence = calloc(1, bytes_per_packet);
+	state->packets = calloc(state->packets_per_batch,
+				sizeof(*state->packets));
+	state->msgs = calloc(state->packets_per_batch, sizeof(*state->msgs));
+	if (state->buf == NULL || state->silence == NULL ||
+	    state->packets == NULL || state->msgs == NULL)
+		return -ENOMEM;
+
+	for (i = 0; i < state->packets_per_batch; ++i) {
+		struct rtp_packet *packet = &state->packets[i];
+		struct msghdr *hdr = &state->msgs[i].msg_hdr;
+
+		packet->iov[0].iov_base = packet->header;
+		packet->iov[0].iov_len = RTP_HEADER_SIZE;
+		packet->iov[1].iov_base = state->buf + i * bytes_per_packet;
+		packet->iov[1].iov_len = bytes_per_packet;
+		hdr->msg_iov = packet->iov;
+		hdr->msg_iovlen = 2;
+	}
+
+	if (xfer->direction == SND_PCM_STREAM_CAPTURE)
+		state->process_frames = r_process_frames;
+	else
+		state->process_frames = w_process_frames;
+
+	// A buffer has the frames of a batch.
+	*access = SND_PCM_ACCESS_RW_INTERLEAVED;
+	*frames_per_buffer = state->frames_per_packet *
+			     state->packets_per_batch;
+
+	if (xfer->verbose > 0) {
+		fprintf(stderr, "  RTP: %s:%u, %u frames/packet, "
+			"%u packets/batch\n", state->addr_literal, state->port,
+			state->frames_per_packet, state->packets_per_batch);
+	}
+
+	return 0;
+}
+
+static int xfer_rtp_process_frames(struct xfer_context *xfer,
+				   unsigned int *frame_count,
+				   struct mapper_context *mapper,
+				   struct container_context *cntrs)
+{
+	struct rtp_state *state = xfer->private_data;
+	int err;
+
+	err = state->process_frames(xfer, frame_count, mapper, cntrs);
+	if (err < 0)
+		*frame_count = 0;
+
+	return err;
+}
+
+static void xfer_rtp_pause(struct xfer_context *xfer, bool enable)
+{
+	struct rtp_state *state = xfer->private_data;
+
+	// The media clock continues while pausing, thus the timestamp of the
+	// next batch follows the reference clock again.
+	state->started = false;
+	state->batch_count = 0;
+	state->synced = false;
+}
+
+static void xfer_rtp_post_process(struct xfer_context *xfer)
+{
+	struct rtp_state *state = xfer->private_data;
+
+	// Transmit the rest of frames in the batch.
+	if (xfer->direction == SND_PCM_STREAM_PLAYBACK && state->fd >= 0 &&
+	    state->pos > 0) {
+		send_batch(xfer, state->pos);
+		state->pos = 0;
+	}
+
+	if (xfer->direction == SND_PCM_STREAM_CAPTURE && xfer->verbose > 0) {
+		fprintf(stderr, "  RTP: %" PRIu64 " frames lost, %" PRIu64
+			" packets late\n", state->lost_count,
+			state->late_count);
+	}
+
+	if (state->fd >= 0)
+		close(state->fd);
+	state->fd = -1;
+	if (state->clock_fd >= 0)
+		close(state->clock_fd);
+	state->clock_fd = -1;
+
+	free(state->buf);
+	free(state->silence);
+	free(state->packets);
+	free(state->msgs);
+	state->buf = NULL;
+	state->silence = NULL;
+	state->packets = NULL;
+	state->msgs = NULL;
+}
+
+static void xfer_rtp_destroy(struct xfer_context *xfer)
+{
+	struct rtp_state *state = xfer->private_data;
+
+	free(state->addr_literal);
+	free(state->iface_literal);
+	free(state->clock_literal);
+	state->addr_literal = NULL;
+	state->iface_literal = NULL;
+	state->clock_literal = NULL;
+}
+
+static void xfer_rtp_help(struct xfer_context *xfer)
+{
+	printf(
+"      --address=ADDR       IPv4 address of the stream, unicast or multicast\n"
+"      --port=#             UDP port of the stream (default 5004)\n"
+"      --interface=ADDR     IPv4 address of the local interface for multicast\n"
+"      --payload-type=#     RTP payload type (default 96)\n"
+"      --packet-time=#      microseconds of frames in a packet (default 1000)\n"
+"      --packets-per-batch=# packets in a call of sendmmsg/recvmmsg (default 4)\n"
+"      --ttl=#              TTL of multicast packets (default 16)\n"
+"      --ssrc=#             RTP synchronization source in playback\n"
+"      --ptp-clock=PATH     PTP hardware clock for timestamps in playback (default CLOCK_TAI)\n"
+	);
+}
+
+const struct xfer_data xfer_rtp = {
+	.s_opts = S_OPTS,
+	.l_opts = l_opts,
+	.l_opts_count = ARRAY_SIZE(l_opts),
+	.ops = {
+		.init		= xfer_rtp_init,
+		.parse_opt	= xfer_rtp_parse_opt,
+		.validate_opts	= xfer_rtp_validate_opts,
+		.pre_process	= xfer_rtp_pre_process,
+		.process_frames	= xfer_rtp_process_frames,
+		.pause		= xfer_rtp_pause,
+		.post_process	= xfer_rtp_post_process,
+		.destroy	= xfer_rtp_destroy,
+		.help		= xfer_rtp_help,
+	},
+	.private_size = sizeof(struct rtp_state),
+};
@@ -16,6 +16,7 @@ static const char *const xfer_type_labels[] = {
 #if WITH_FFADO
 	[XFER_TYPE_LIBFFADO] = "libffado",
 #endif
+	[XFER_TYPE_RTP] = "rtp",
 };
 
 enum xfer_type xfer_type_from_label(const char *label)
@@ -46,6 +47,7 @@ int xfer_context_init(struct xfer_context *xfer, enum xfer_type type,
 #if WITH_FFADO
 		{XFER_TYPE_LIBFFADO, &xfer_libffado},
 #endif
+		{XFER_TYPE_RTP, &xfer_rtp},
 	};
 	int i;
 	int err;
@@ -109,6 +111,12 @@ void xfer_context_destroy(struct xfer_context *xfer)
 
 	free(xfer->cntr_format_literal);
 	xfer->cntr_format_literal = NULL;
+
+	free(xfer->cntr_io_type_literal);
+	xfer->cntr_io_type_literal = NULL;
+
+	free(xfer->silence_mode_literal);
+	xfer->silence_mode_literal = NULL;
 }
 
 int xfer_context_pre_process(struct xfer_context *xfer,
@@ -118,6 +126,7 @@ int xfer_context_pre_process(struct xfer_context *xfer,
 			     snd_pcm_access_t *access,
 			     snd_pcm_uframes_t *frames_per_buffer)
 {
+	snd_pcm_format_t requested_format;
 	int err;
 
 	assert(xfer);
@@ -178,12 +187,30 @@ int xfer_context_pre_process(struct xfer_context *xfer,
 		}
 	}
 
+	requested_format = *format;
 	err = xfer->ops->pre_process(xfer, format, samples_per_frame,
 				     frames_per_second, access,
 				     frames_per_buffer);
 	if (err < 0)
 		return err;
 
+	// The backend can select the other format when conversion in mapper
+	// is allowed.
+	if (requested_format == SND_PCM_FORMAT_UNKNOWN)
+		requested_format = *format;
+	if (*format != requested_format) {
+		if (!xfer->convert_format ||
+		    !mapper_conversion_is_available(*format, requested_format)) {
+			fprintf(stderr,
+				"Sample format mismatch: %s is requested but "
+				"%s by the backend\n",
+				snd_pcm_format_name(requested_format),
+				snd_pcm_format_name(*format));
+			return -EINVAL;
+		}
+	}
+	xfer->cntr_sample_format = requested_format;
+
 	assert(*format >= SND_PCM_FORMAT_S8);
 	assert(*format <= SND_PCM_FORMAT_LAST);
 	assert(*samples_per_frame > 0);
@@ -209,6 +236,10 @@ int xfer_context_pre_process(struct xfer_context *xfer,
 			snd_pcm_access_name(*access));
 		fprintf(stderr, "  sample format: %s\n",
 			snd_pcm_format_name(*format));
+		if (xfer->cntr_sample_format != *format) {
+			fprintf(stderr, "  sample format for files: %s\n",
+				snd_pcm_format_name(xfer->cntr_sample_format));
+		}
 		fprintf(stderr, "  bytes/sample: %u\n",
 		       snd_pcm_format_physical_width(*format) / 8);
 		fprintf(stderr, "  samples/frame: %u\n",
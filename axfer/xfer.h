@@ -21,6 +21,7 @@ enum xfer_type {
 #if WITH_FFADO
 	XFER_TYPE_LIBFFADO,
 #endif
+	XFER_TYPE_RTP,
 	XFER_TYPE_COUNT,
 };
 
@@ -34,6 +35,7 @@ struct xfer_context {
 
 	char *sample_format_literal;
 	char *cntr_format_literal;
+	char *cntr_io_type_literal;
 	unsigned int verbose;
 	unsigned int duration_seconds;
 	unsigned int duration_frames;
@@ -43,13 +45,43 @@ struct xfer_context {
 	bool quiet:1;
 	bool dump_hw_params:1;
 	bool multiple_cntrs:1;	// For mapper.
+	bool preallocate:1;
+	bool resume:1;
+	bool block_index:1;
+	bool convert_format:1;
+	bool silence:1;
+	bool recorder:1;
 
 	snd_pcm_format_t sample_format;
 
+	// For several devices to capture at the same time. Each of them has
+	// the same number of samples per frame, and its own container.
+	unsigned int device_count;
+
 	// For containers.
 	char **paths;
 	unsigned int path_count;
 	enum container_format cntr_format;
+	snd_pcm_format_t cntr_sample_format;
+	enum container_io_type cntr_io_type;
+	unsigned int cntr_io_depth;
+	unsigned int file_worker_count;
+	unsigned int checkpoint_seconds;
+	uint64_t start_frame;
+	uint64_t start_usec;
+
+	// For runs of silence in capture.
+	char *silence_mode_literal;
+	enum container_silence_mode silence_mode;
+	double silence_threshold_db;
+	unsigned int silence_duration_msec;
+
+	// For the recorder to keep the last data frames of capture in memory.
+	unsigned int recorder_seconds;
+	unsigned int recorder_post_roll_seconds;
+
+	// For statistics.
+	unsigned int xrun_count;
 };
 
 enum xfer_type xfer_type_from_label(const char *label);
@@ -114,4 +146,6 @@ extern const struct xfer_data xfer_libasound;
 	extern const struct xfer_data xfer_libffado;
 #endif
 
+extern const struct xfer_data xfer_rtp;
+
 #endif
@@ -28,6 +28,7 @@
 #include "common.h"
 #include "alsa.h"
 #include "latencytest.h"
+#include "online.h"
 
 struct pcm_container {
 	snd_pcm_t *handle;
@@ -39,8 +40,28 @@ struct pcm_container {
 	size_t sample_bits;
 	size_t frame_bits;
 	char *buffer;
+	bool kept;			/* stays open for the next batch case */
 };
 
+/*
+ * In batch mode the PCM of each stream is opened once and kept until
+ * close_kept_pcm(). The hw params are only set again when the request
+ * of the case differs from the previous one.
+ */
+struct pcm_kept {
+	struct pcm_container sndpcm;
+	char *device;
+	unsigned int rate;		/* requested and granted rates */
+	unsigned int rate_set;
+	int channels;
+	enum _bat_pcm_format format;
+	int buffer_size;
+	int period_size;
+	bool mmap;
+};
+
+static struct pcm_kept kept_pcm[SND_PCM_STREAM_LAST + 1];
+
 struct format_map_table {
 	enum _bat_pcm_format format_bat;
 	snd_pcm_format_t format_alsa;
@@ -100,6 +121,7 @@ static int set_snd_pcm_params(struct bat *bat, struct pcm_container *sndpcm)
 
 	/* Set access mode */
 	err = snd_pcm_hw_params_set_access(sndpcm->handle, params,
+			bat->mmap ? SND_PCM_ACCESS_MMAP_INTERLEAVED :
 			SND_PCM_ACCESS_RW_INTERLEAVED);
 	if (err < 0) {
 		fprintf(bat->err, _("Set parameter to device error: "));
@@ -301,6 +323,125 @@ static int set_snd_pcm_params(struct bat *bat, struct pcm_container *sndpcm)
 	return 0;
 }
 
+static void open_error(struct bat *bat, snd_pcm_stream_t stream, int err)
+{
+	if (stream == SND_PCM_STREAM_PLAYBACK)
+		fprintf(bat->err, _("Cannot open PCM playback device: "));
+	else
+		fprintf(bat->err, _("Cannot open PCM capture device: "));
+	fprintf(bat->err, _("%s(%d)\n"), snd_strerror(err), err);
+}
+
+static void close_pcm_kept(struct pcm_kept *k)
+{
+	free(k->sndpcm.buffer);
+	snd_pcm_close(k->sndpcm.handle);
+	free(k->device);
+	memset(k, 0, sizeof(*k));
+}
+
+static int open_kept_pcm(struct bat *bat, struct pcm_container *sndpcm,
+		snd_pcm_stream_t stream, char *device)
+{
+	struct pcm_kept *k = &kept_pcm[stream];
+	unsigned int rate = bat->rate;
+	int err;
+
+	if (k->sndpcm.handle != NULL && strcmp(k->device, device) != 0)
+		close_pcm_kept(k);
+
+	if (k->sndpcm.handle == NULL) {
+		err = snd_pcm_open(&k->sndpcm.handle, device, stream, 0);
+		if (err != 0) {
+			open_error(bat, stream, err);
+			return err;
+		}
+		k->device = strdup(device);
+		if (k->device == NULL) {
+			snd_pcm_close(k->sndpcm.handle);
+			k->sndpcm.handle = NULL;
+			return -ENOMEM;
+		}
+		k->sndpcm.kept = true;
+	} else if (k->rate == rate && k->channels == bat->channels
+			&& k->format == bat->format
+			&& k->buffer_size == bat->buffer_size
+			&& k->period_size == bat->period_size
+			&& k->mmap == bat->mmap) {
+		fprintf(bat->log, _("Reusing hw params of %s\n"), device);
+		bat->rate = k->rate_set;
+		*sndpcm = k->sndpcm;
+		return snd_pcm_prepare(sndpcm->handle);
+	} else {
+		free(k->sndpcm.buffer);
+		k->sndpcm.buffer = NULL;
+		snd_pcm_hw_free(k->sndpcm.handle);
+	}
+
+	/* invalid until the new params are set */
+	k->rate = 0;
+	k->channels = bat->channels;
+	k->format = bat->format;
+	k->buffer_size = bat->buffer_size;
+	k->period_size = bat->period_size;
+	k->mmap = bat->mmap;
+
+	err = set_snd_pcm_params(bat, &k->sndpcm);
+	if (err != 0)
+		return err;
+
+	k->rate = rate;
+	k->rate_set = bat->rate;
+	*sndpcm = k->sndpcm;
+
+	return 0;
+}
+
+static int open_pcm(struct bat *bat, struct pcm_container *sndpcm,
+		snd_pcm_stream_t stream)
+{
+	char *device = stream == SND_PCM_STREAM_PLAYBACK ?
+			bat->playback.device : bat->capture.device;
+	int err;
+
+	if (bat->keep_pcm)
+		return open_kept_pcm(bat, sndpcm, stream, device);
+
+	err = snd_pcm_open(&sndpcm->handle, device, stream, 0);
+	if (err != 0) {
+		open_error(bat, stream, err);
+		return err;
+	}
+
+	err = set_snd_pcm_params(bat, sndpcm);
+	if (err != 0) {
+		free(sndpcm->buffer);
+		snd_pcm_close(sndpcm->handle);
+	}
+
+	return err;
+}
+
+/* a kept PCM is only stopped, its buffer stays with it */
+static void close_pcm(struct pcm_container *sndpcm)
+{
+	if (sndpcm->kept) {
+		snd_pcm_drop(sndpcm->handle);
+		return;
+	}
+	free(sndpcm->buffer);
+	snd_pcm_close(sndpcm->handle);
+}
+
+void close_kept_pcm(void)
+{
+	int i;
+
+	for (i = 0; i <= SND_PCM_STREAM_LAST; i++)
+		if (kept_pcm[i].sndpcm.handle != NULL)
+			close_pcm_kept(&kept_pcm[i]);
+}
+
 static int write_to_pcm(const struct pcm_container *sndpcm,
 		int frames, struct bat *bat)
 {
@@ -309,8 +450,12 @@ static int write_to_pcm(const struct pcm_container *sndpcm,
 	int remain = frames;
 
 	while (remain > 0) {
-		err = snd_pcm_writei(sndpcm->handle, sndpcm->buffer + offset,
-				remain);
+		if (bat->mmap)
+			err = snd_pcm_mmap_writei(sndpcm->handle,
+					sndpcm->buffer + offset, remain);
+		else
+			err = snd_pcm_writei(sndpcm->handle,
+					sndpcm->buffer + offset, remain);
 		if (err == -EAGAIN || (err >= 0 && err < frames)) {
 			snd_pcm_wait(sndpcm->handle, 500);
 		} else if (err == -EPIPE) {
@@ -339,41 +484,11 @@ static int write_to_pcm(const struct pcm_container *sndpcm,
 	return 0;
 }
 
-/**
- * Process output data for latency test
- */
-static int latencytest_process_output(struct pcm_container *sndpcm,
+/* transfers of the latency test, the buffer is the one of sndpcm */
+static int latency_write(void *pcm, void *buffer, int frames,
 		struct bat *bat)
 {
-	int err = 0;
-	int bytes = sndpcm->period_bytes; /* playback buffer size */
-	int frames = sndpcm->period_size; /* frame count */
-
-	bat->latency.is_playing = true;
-
-	while (1) {
-		/* generate output data */
-		err = handleoutput(bat, sndpcm->buffer, bytes, frames);
-		if (err != 0)
-			break;
-
-		err = write_to_pcm(sndpcm, frames, bat);
-		if (err != 0)
-			break;
-
-		/* Xrun error, terminate the playback thread*/
-		if (bat->latency.xrun_error == true)
-			break;
-
-		if (bat->latency.state == LATENCY_STATE_COMPLETE_SUCCESS)
-			break;
-
-		bat->periods_played++;
-	}
-
-	bat->latency.is_playing = false;
-
-	return err;
+	return write_to_pcm(pcm, frames, bat);
 }
 
 static int write_to_pcm_loop(struct pcm_container *sndpcm, struct bat *bat)
@@ -418,6 +533,10 @@ static int write_to_pcm_loop(struct pcm_container *sndpcm, struct bat *bat)
 				&& bat->periods_played >= bat->periods_total)
 			break;
 
+		/* the result is known, no need to play the rest */
+		if (bat->analyzer && online_done(bat))
+			break;
+
 		err = write_to_pcm(sndpcm, frames, bat);
 		if (err != 0)
 			break;
@@ -443,24 +562,15 @@ void *playback_alsa(struct bat *bat)
 
 	fprintf(bat->log, _("Entering playback thread (ALSA).\n"));
 
-	retval_play = 0;
+	bat->playback.retval = 0;
 	memset(&sndpcm, 0, sizeof(sndpcm));
 
-	err = snd_pcm_open(&sndpcm.handle, bat->playback.device,
-			SND_PCM_STREAM_PLAYBACK, 0);
+	err = open_pcm(bat, &sndpcm, SND_PCM_STREAM_PLAYBACK);
 	if (err != 0) {
-		fprintf(bat->err, _("Cannot open PCM playback device: "));
-		fprintf(bat->err, _("%s(%d)\n"), snd_strerror(err), err);
-		retval_play = err;
+		bat->playback.retval = err;
 		goto exit1;
 	}
 
-	err = set_snd_pcm_params(bat, &sndpcm);
-	if (err != 0) {
-		retval_play = err;
-		goto exit2;
-	}
-
 	if (bat->playback.file == NULL) {
 		fprintf(bat->log, _("Playing generated audio sine wave"));
 		bat->sinus_duration == 0 ?
@@ -474,23 +584,24 @@ void *playback_alsa(struct bat *bat)
 		if (bat->fp == NULL) {
 			fprintf(bat->err, _("Cannot open file: %s %d\n"),
 					bat->playback.file, err);
-			retval_play = err;
+			bat->playback.retval = err;
 			goto exit3;
 		}
 		/* Skip header */
 		err = read_wav_header(bat, bat->playback.file, bat->fp, true);
 		if (err != 0) {
-			retval_play = err;
+			bat->playback.retval = err;
 			goto exit4;
 		}
 	}
 
 	if (bat->roundtriplatency)
-		err = latencytest_process_output(&sndpcm, bat);
+		err = latencytest_output(bat, sndpcm.buffer,
+				sndpcm.period_size, latency_write, &sndpcm);
 	else
 		err = write_to_pcm_loop(&sndpcm, bat);
 	if (err < 0) {
-		retval_play = err;
+		bat->playback.retval = err;
 		goto exit4;
 	}
 
@@ -498,11 +609,9 @@ exit4:
 	if (bat->playback.file)
 		fclose(bat->fp);
 exit3:
-	free(sndpcm.buffer);
-exit2:
-	snd_pcm_close(sndpcm.handle);
+	close_pcm(&sndpcm);
 exit1:
-	pthread_exit(&retval_play);
+	pthread_exit(&bat->playback.retval);
 }
 
 static int read_from_pcm(struct pcm_container *sndpcm,
@@ -513,8 +622,12 @@ static int read_from_pcm(struct pcm_container *sndpcm,
 	int remain = frames;
 
 	while (remain > 0) {
-		err = snd_pcm_readi(sndpcm->handle,
-				sndpcm->buffer + offset, remain);
+		if (bat->mmap)
+			err = snd_pcm_mmap_readi(sndpcm->handle,
+					sndpcm->buffer + offset, remain);
+		else
+			err = snd_pcm_readi(sndpcm->handle,
+					sndpcm->buffer + offset, remain);
 		if (err == -EAGAIN || (err >= 0 && err < remain)) {
 			snd_pcm_wait(sndpcm->handle, 500);
 		} else if (err == -EPIPE) {
@@ -552,6 +665,10 @@ static int read_from_pcm_loop(struct pcm_container *sndpcm, struct bat *bat)
 	int bytes_count = bat->frames * bat->frame_size;
 	int remain = bytes_count;
 
+	/* neither the online analyzer nor a capture in memory need a file */
+	if (bat->analyzer || bat->capture_buf)
+		goto loop;
+
 	remove(bat->capture.file);
 	fp = fopen(bat->capture.file, "wb");
 	err = -errno;
@@ -567,6 +684,8 @@ static int read_from_pcm_loop(struct pcm_container *sndpcm, struct bat *bat)
 		return err;
 	}
 
+loop:
+
 	while (remain > 0) {
 		size = (remain <= sndpcm->period_bytes) ?
 			remain : sndpcm->period_bytes;
@@ -577,94 +696,51 @@ static int read_from_pcm_loop(struct pcm_container *sndpcm, struct bat *bat)
 		if (err != 0)
 			break;
 
-		/* write the chunk to file */
-		if (fwrite(sndpcm->buffer, 1, size, fp) != size) {
+		/* store the chunk or pass it to the analyzer */
+		if (bat->analyzer) {
+			online_feed(bat, sndpcm->buffer, frames);
+		} else if (bat->capture_buf) {
+			memcpy(bat->capture_buf + bytes_read, sndpcm->buffer,
+					size);
+			bat->capture_frames += frames;
+		} else if (fwrite(sndpcm->buffer, 1, size, fp) != size) {
 			err = -EIO;
 			break;
 		}
 
-		bytes_read += size;
-		remain -= size;
+		/* the soak test runs until the analyzer stops */
+		if (!bat->soak) {
+			bytes_read += size;
+			remain -= size;
+		}
 		bat->periods_played++;
 
 		if (bat->period_is_limited
 				&& bat->periods_played >= bat->periods_total)
 			break;
-	}
-
-	update_wav_header(bat, fp, bytes_read);
 
-	fclose(fp);
-	return err;
-}
-
-/**
- * Process input data for latency test
- */
-static int latencytest_process_input(struct pcm_container *sndpcm,
-		struct bat *bat)
-{
-	int err = 0;
-	FILE *fp = NULL;
-	int bytes_read = 0;
-	int frames = sndpcm->period_size;
-	int size = sndpcm->period_bytes;
-	int bytes_count = bat->frames * bat->frame_size;
-
-	remove(bat->capture.file);
-	fp = fopen(bat->capture.file, "wb");
-	err = -errno;
-	if (fp == NULL) {
-		fprintf(bat->err, _("Cannot open file: %s %d\n"),
-				bat->capture.file, err);
-		return err;
-	}
-	/* leave space for file header */
-	if (fseek(fp, sizeof(struct wav_container), SEEK_SET) != 0) {
-		fclose(fp);
-		return err;
-	}
-
-	bat->latency.is_capturing = true;
-
-	while (bytes_read < bytes_count) {
-		/* read a chunk from pcm device */
-		err = read_from_pcm(sndpcm, frames, bat);
-		if (err != 0)
-			break;
-
-		/* Xrun error, terminate the capture thread*/
-		if (bat->latency.xrun_error == true)
-			break;
-
-		err = handleinput(bat, sndpcm->buffer, frames);
-		if (err != 0)
-			break;
-
-		if (bat->latency.is_playing == false)
-			break;
-
-		/* write the chunk to file */
-		if (fwrite(sndpcm->buffer, 1, size, fp) != size) {
-			err = -EIO;
+		if (bat->analyzer && online_done(bat)) {
+			fprintf(bat->log, _("Analysis done, stop capture.\n"));
 			break;
 		}
-
-		bytes_read += size;
 	}
 
-	bat->latency.is_capturing = false;
-
-	update_wav_header(bat, fp, bytes_read);
-
-	fclose(fp);
+	if (fp) {
+		update_wav_header(bat, fp, bytes_read);
+		fclose(fp);
+	}
 	return err;
 }
 
+static int latency_read(void *pcm, void *buffer, int frames,
+		struct bat *bat)
+{
+	return read_from_pcm(pcm, frames, bat);
+}
 
 static void pcm_cleanup(void *p)
 {
-	snd_pcm_close(p);
+	close_pcm(p);
 }
 
 /**
@@ -679,40 +755,30 @@ void *record_alsa(struct bat *bat)
 
 	fprintf(bat->log, _("Entering capture thread (ALSA).\n"));
 
-	retval_record = 0;
+	bat->capture.retval = 0;
 	memset(&sndpcm, 0, sizeof(sndpcm));
 
-	err = snd_pcm_open(&sndpcm.handle, bat->capture.device,
-			SND_PCM_STREAM_CAPTURE, 0);
+	err = open_pcm(bat, &sndpcm, SND_PCM_STREAM_CAPTURE);
 	if (err != 0) {
-		fprintf(bat->err, _("Cannot open PCM capture device: "));
-		fprintf(bat->err, _("%s(%d)\n"), snd_strerror(err), err);
-		retval_record = err;
+		bat->capture.retval = err;
 		goto exit1;
 	}
 
-	err = set_snd_pcm_params(bat, &sndpcm);
-	if (err != 0) {
-		retval_record = err;
-		goto exit2;
-	}
-
 	pthread_setcancelstate(PTHREAD_CANCEL_ENABLE, NULL);
 	pthread_setcanceltype(PTHREAD_CANCEL_DEFERRED, NULL);
-	pthread_cleanup_push(pcm_cleanup, sndpcm.handle);
-	pthread_cleanup_push(free, sndpcm.buffer);
+	pthread_cleanup_push(pcm_cleanup, &sndpcm);
 
 	fprintf(bat->log, _("Recording ...\n"));
 	if (bat->roundtriplatency)
-		err = latencytest_process_input(&sndpcm, bat);
+		err = latencytest_input(bat, sndpcm.buffer,
+				sndpcm.period_size, latency_read, &sndpcm);
 	else
 		err = read_from_pcm_loop(&sndpcm, bat);
 
 	pthread_cleanup_pop(0);
-	pthread_cleanup_pop(0);
 
 	if (err != 0) {
-		retval_record = err;
+		bat->capture.retval = err;
 		goto exit3;
 	}
 
@@ -720,12 +786,9 @@ void *record_alsa(struct bat *bat)
 	 * previous call) (before exit3) as this thread will be cancelled
 	 * by end of play thread. Except in single line mode. */
 	snd_pcm_drain(sndpcm.handle);
-	pthread_exit(&retval_record);
 
 exit3:
-	free(sndpcm.buffer);
-exit2:
-	snd_pcm_close(sndpcm.handle);
+	close_pcm(&sndpcm);
 exit1:
-	pthread_exit(&retval_record);
+	pthread_exit(&bat->capture.retval);
 }
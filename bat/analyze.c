@@ -15,9 +15,12 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <errno.h>
 #include <stdbool.h>
 #include <stdint.h>
+#include <unistd.h>
+#include <pthread.h>
 
 #include <math.h>
 #include <fftw3.h>
@@ -27,6 +30,7 @@
 
 #include "common.h"
 #include "bat-signal.h"
+#include "analyze.h"
 
 static void check_amplitude(struct bat *bat, float *buf)
 {
@@ -174,30 +178,261 @@ static void calc_magnitude(struct bat *bat, struct analyze *a, int N)
 	a->mag[0] = 0.0;
 }
 
-static int find_and_check_harmonics(struct bat *bat, struct analyze *a,
-		int channel)
+/**
+ * Search for the peaks in a magnitude spectrum of a FFT of given length
+ */
+int check_spectrum(struct bat *bat, float *mag, int frames, int channel)
 {
-	fftwf_plan p;
-	int err = -ENOMEM, N = bat->frames;
+	struct bat b = *bat;
+	struct analyze a;
+
+	b.frames = frames;
+	memset(&a, 0, sizeof(a));
+	a.mag = mag;
+
+	return check(&b, &a, channel);
+}
+
+/*
+ * The FFT length only depends on the number of frames, which is the same
+ * for all channels, so each analysis thread creates its plan and aligned
+ * buffers once and reuses them. A plan found in the wisdom file costs no
+ * measurement. Only the execution of a plan is thread safe, all other FFTW
+ * calls are serialized by the planner lock.
+ *
+ * The plans themselves are shared by all users of the same length in the
+ * process, e.g. the device pairs tested in parallel, and executed on the
+ * buffers of each user by fft_execute(). A plan is destroyed with its
+ * last user.
+ */
+static pthread_mutex_t planner_lock = PTHREAD_MUTEX_INITIALIZER;
+
+struct shared_plan {
+	struct shared_plan *next;
+	int N;
+	fftwf_plan plan;
+	int users;
+};
+
+static struct shared_plan *shared_plans;
+
+/* called with the planner lock */
+static void put_plan(fftwf_plan plan)
+{
+	struct shared_plan *s, **p;
+
+	for (p = &shared_plans; (s = *p) != NULL; p = &s->next) {
+		if (s->plan != plan)
+			continue;
+		if (--s->users == 0) {
+			fftwf_destroy_plan(s->plan);
+			*p = s->next;
+			free(s);
+		}
+		return;
+	}
+}
+
+/* called with the planner lock */
+static fftwf_plan get_plan(struct bat *bat, struct fft_plan *fft, int N)
+{
+	unsigned int flags = FFTW_MEASURE | FFTW_PRESERVE_INPUT;
+	struct shared_plan *s;
+	fftwf_plan plan = NULL;
+
+	for (s = shared_plans; s != NULL; s = s->next) {
+		if (s->N == N) {
+			s->users++;
+			return s->plan;
+		}
+	}
+
+	s = malloc(sizeof(*s));
+	if (s == NULL)
+		return NULL;
+
+	/* create FFT plan, measure it only if it is not known yet */
+	if (bat->wisdom != NULL)
+		plan = fftwf_plan_r2r_1d(N, fft->in, fft->out, FFTW_R2HC,
+				flags | FFTW_WISDOM_ONLY);
+	if (plan == NULL) {
+		plan = fftwf_plan_r2r_1d(N, fft->in, fft->out, FFTW_R2HC,
+				flags);
+		if (plan == NULL) {
+			free(s);
+			return NULL;
+		}
+		if (bat->wisdom != NULL &&
+				!fftwf_export_wisdom_to_filename(bat->wisdom))
+			fprintf(bat->err, _("Cannot save FFTW wisdom: %s\n"),
+					bat->wisdom);
+	}
+
+	s->N = N;
+	s->plan = plan;
+	s->users = 1;
+	s->next = shared_plans;
+	shared_plans = s;
+
+	return plan;
+}
+
+/* a missing wisdom file is created with the first plan */
+void fft_import_wisdom(struct bat *bat)
+{
+	if (bat->wisdom == NULL)
+		return;
+
+	pthread_mutex_lock(&planner_lock);
+	fftwf_import_wisdom_from_filename(bat->wisdom);
+	pthread_mutex_unlock(&planner_lock);
+}
+
+void fft_free(struct fft_plan *fft)
+{
+	pthread_mutex_lock(&planner_lock);
+	if (fft->plan != NULL)
+		put_plan(fft->plan);
+	fftwf_free(fft->mag);
+	fftwf_free(fft->out);
+	fftwf_free(fft->in);
+	pthread_mutex_unlock(&planner_lock);
+	memset(fft, 0, sizeof(*fft));
+}
+
+int fft_prepare(struct bat *bat, struct fft_plan *fft, int N)
+{
+	int err = 0;
+
+	if (fft->plan != NULL && fft->N == N)
+		return 0;
+	fft_free(fft);
+
+	pthread_mutex_lock(&planner_lock);
 
 	/* Allocate FFT buffers */
-	a->in = (float *) fftwf_malloc(sizeof(float) * bat->frames);
-	if (a->in == NULL)
-		goto out1;
+	fft->in = (float *) fftwf_malloc(sizeof(float) * N);
+	fft->out = (float *) fftwf_malloc(sizeof(float) * N);
+	fft->mag = (float *) fftwf_malloc(sizeof(float) * N);
+	if (fft->in == NULL || fft->out == NULL || fft->mag == NULL) {
+		err = -ENOMEM;
+		goto out;
+	}
 
-	a->out = (float *) fftwf_malloc(sizeof(float) * bat->frames);
-	if (a->out == NULL)
-		goto out2;
+	fft->plan = get_plan(bat, fft, N);
+	if (fft->plan == NULL) {
+		err = -ENOMEM;
+		goto out;
+	}
+	fft->N = N;
 
-	a->mag = (float *) fftwf_malloc(sizeof(float) * bat->frames);
-	if (a->mag == NULL)
-		goto out3;
+out:
+	pthread_mutex_unlock(&planner_lock);
+	if (err < 0)
+		fft_free(fft);
+	return err;
+}
 
-	/* create FFT plan */
-	p = fftwf_plan_r2r_1d(N, a->in, a->out, FFTW_R2HC,
-			FFTW_MEASURE | FFTW_PRESERVE_INPUT);
-	if (p == NULL)
-		goto out4;
+/**
+ * Find the delay of ref (m samples) in sig (n samples) from the peak of
+ * their cross-correlation, computed by FFT, with a parabolic interpolation
+ * of the peak for a fraction of sample. The ratio of the peak to the rms
+ * of the correlation tells how clearly ref was found.
+ */
+int xcorr_delay(float *sig, int n, float *ref, int m, double *delay,
+		float *ratio)
+{
+	float *a, *b, *A, *B;
+	fftwf_plan pa = NULL, pb = NULL, inv = NULL;
+	float re, im, y0, ym, yp, d, rms;
+	int N, k, lag, peak, err = -ENOMEM;
+
+	if (m > n)
+		return -EINVAL;
+	for (N = 1 << SHIFT_MIN; N < n + m; N <<= 1)
+		;
+
+	a = (float *) fftwf_malloc(sizeof(float) * N);
+	b = (float *) fftwf_malloc(sizeof(float) * N);
+	A = (float *) fftwf_malloc(sizeof(float) * N);
+	B = (float *) fftwf_malloc(sizeof(float) * N);
+	if (!a || !b || !A || !B)
+		goto out;
+
+	/* used once per measurement, not worth a measured plan */
+	pthread_mutex_lock(&planner_lock);
+	pa = fftwf_plan_r2r_1d(N, a, A, FFTW_R2HC, FFTW_ESTIMATE);
+	pb = fftwf_plan_r2r_1d(N, b, B, FFTW_R2HC, FFTW_ESTIMATE);
+	inv = fftwf_plan_r2r_1d(N, A, a, FFTW_HC2R, FFTW_ESTIMATE);
+	pthread_mutex_unlock(&planner_lock);
+	if (!pa || !pb || !inv)
+		goto out;
+
+	memset(a, 0, sizeof(float) * N);
+	memset(b, 0, sizeof(float) * N);
+	memcpy(a, sig, sizeof(float) * n);
+	memcpy(b, ref, sizeof(float) * m);
+	fftwf_execute(pa);
+	fftwf_execute(pb);
+
+	/* A * conj(B), in halfcomplex order */
+	A[0] *= B[0];
+	A[N / 2] *= B[N / 2];
+	for (k = 1; k < N / 2; k++) {
+		re = A[k] * B[k] + A[N - k] * B[N - k];
+		im = A[N - k] * B[k] - A[k] * B[N - k];
+		A[k] = re;
+		A[N - k] = im;
+	}
+	fftwf_execute(inv);
+
+	/* only the lags where ref lies wholly in sig */
+	for (lag = 0, peak = 0, rms = 0.0; lag <= n - m; lag++) {
+		rms += a[lag] * a[lag];
+		if (a[lag] > a[peak])
+			peak = lag;
+	}
+	rms = sqrtf(rms / (n - m + 1));
+	*ratio = rms > 0.0 ? a[peak] / rms : 0.0;
+
+	*delay = peak;
+	if (peak > 0 && peak < n - m) {
+		ym = a[peak - 1];
+		y0 = a[peak];
+		yp = a[peak + 1];
+		d = ym - 2 * y0 + yp;
+		if (d < 0.0)
+			*delay += 0.5 * (ym - yp) / d;
+	}
+	err = 0;
+
+out:
+	pthread_mutex_lock(&planner_lock);
+	if (inv)
+		fftwf_destroy_plan(inv);
+	if (pb)
+		fftwf_destroy_plan(pb);
+	if (pa)
+		fftwf_destroy_plan(pa);
+	pthread_mutex_unlock(&planner_lock);
+	fftwf_free(B);
+	fftwf_free(A);
+	fftwf_free(b);
+	fftwf_free(a);
+	return err;
+}
+
+static int find_and_check_harmonics(struct bat *bat, struct analyze *a,
+		struct fft_plan *fft, int channel)
+{
+	int err, N = bat->frames;
+
+	err = fft_prepare(bat, fft, N);
+	if (err < 0)
+		return err;
+	a->in = fft->in;
+	a->out = fft->out;
+	a->mag = fft->mag;
 
 	/* convert source PCM to floats */
 	bat->convert_sample_to_float(a->buf, a->in, bat->frames);
@@ -206,24 +441,41 @@ static int find_and_check_harmonics(struct bat *bat, struct analyze *a,
 	check_amplitude(bat, a->in);
 
 	/* run FFT */
-	fftwf_execute(p);
+	fft_execute(fft);
 
 	/* FFT out is real and imaginary numbers - calc magnitude for each */
 	calc_magnitude(bat, a, N);
 
 	/* check data */
-	err = check(bat, a, channel);
+	return check(bat, a, channel);
+}
 
-	fftwf_destroy_plan(p);
+static void noise_sums(const float *target, const float *src, float a,
+		float b, int n, double *stt, double *sts, double *sss)
+{
+	double tt[4] = { 0.0 }, ts[4] = { 0.0 }, ss[4] = { 0.0 };
+	float s;
+	int i, k;
+
+	for (i = 0; i + 4 <= n; i += 4) {
+		for (k = 0; k < 4; k++) {
+			/* shift sine waveform to source[0] = 0.0 */
+			s = a * src[i + k + 1] + b * src[i + k];
+			tt[k] += (double) target[i + k] * target[i + k];
+			ts[k] += (double) target[i + k] * s;
+			ss[k] += (double) s * s;
+		}
+	}
+	for (; i < n; i++) {
+		s = a * src[i + 1] + b * src[i];
+		tt[0] += (double) target[i] * target[i];
+		ts[0] += (double) target[i] * s;
+		ss[0] += (double) s * s;
+	}
 
-out4:
-	fftwf_free(a->mag);
-out3:
-	fftwf_free(a->out);
-out2:
-	fftwf_free(a->in);
-out1:
-	return err;
+	*stt = tt[0] + tt[1] + tt[2] + tt[3];
+	*sts = ts[0] + ts[1] + ts[2] + ts[3];
+	*sss = ss[0] + ss[1] + ss[2] + ss[3];
 }
 
 static int calculate_noise_one_period(struct bat *bat,
@@ -231,7 +483,8 @@ static int calculate_noise_one_period(struct bat *bat,
 		int length, int channel)
 {
 	int i, shift = 0;
-	float tmp, rms, gain, residual;
+	float tmp;
+	double rms, gain, residual, stt, sts, sss;
 	float a = 0.0, b = 1.0;
 
 	/* step 1. phase compensation */
@@ -257,116 +510,153 @@ static int calculate_noise_one_period(struct bat *bat,
 	if (shift == -1)
 		return -EINVAL;
 
-	/* shift sine waveform to source[0] = 0.0 */
-	for (i = 0; i < na->nsamples; i++)
-		na->source[i] = a * src[i + shift + 1] + b * src[i + shift];
-
-	/* step 2. gain compensation */
-
-	/* calculate rms of signal amplitude */
-	for (i = 0, tmp = 0.0; i < na->nsamples; i++)
-		tmp += na->source[i] * na->source[i];
-	rms = sqrtf(tmp / na->nsamples);
-
-	gain = na->rms_tgt / rms;
-
-	for (i = 0; i < na->nsamples; i++)
-		na->source[i] *= gain;
-
-	/* step 3. calculate snr in dB */
-
-	for (i = 0, tmp = 0.0, residual = 0.0; i < na->nsamples; i++) {
-		tmp = fabsf(na->target[i] - na->source[i]);
-		residual += tmp * tmp;
+	/*
+	 * step 2. gain compensation and step 3. snr, fused in one pass:
+	 * with s the phase shifted source, t the target and g the gain
+	 * rms(t) / rms(s), the residual is sum((t - g * s)^2)
+	 * = sum(t * t) - 2 * g * sum(t * s) + g * g * sum(s * s).
+	 * The sums are split in four partial ones so that the compiler can
+	 * vectorize the loop, and kept in double precision because of the
+	 * cancellation at high snr.
+	 */
+	noise_sums(na->target, src + shift, a, b, na->nsamples, &stt, &sts,
+			&sss);
+	/* silence, counted as noise */
+	if (sss <= 0.0) {
+		na->snr_db = SNR_DB_INVALID;
+		return 0;
 	}
+	rms = sqrt(sss / na->nsamples);
+	gain = na->rms_tgt / rms;
+	residual = stt - 2.0 * gain * sts + gain * gain * sss;
+	if (residual < 0.0)
+		residual = 0.0;
 
-	tmp = na->rms_tgt / sqrtf(residual / na->nsamples);
+	tmp = na->rms_tgt / sqrt(residual / na->nsamples);
 	na->snr_db = 20.0 * log10f(tmp);
 
 	return 0;
 }
 
-static int calculate_noise(struct bat *bat, float *src, int channel)
+int noise_analyzer_init(struct bat *bat, struct noise_analyzer *na,
+		int channel)
 {
-	int err = 0;
-	struct noise_analyzer na;
-	float freq = bat->target_freq[channel];
-	float tmp, sum_snr_pc, avg_snr_pc, avg_snr_db;
-	int offset, i, cnt_noise, cnt_clean;
+	int err, i;
+	float tmp;
 	/* num of samples in each sine period */
-	int nsamples = (int) ceilf(bat->rate / freq);
-	/* each section has 2 sine periods, the first one for locating
-	 * and the second one for noise calculating */
-	int nsamples_per_section = nsamples * 2;
-	/* all sine periods will be calculated except the first one */
-	int nsection = bat->frames / nsamples - 1;
-
-	fprintf(bat->log, _("samples per period: %d\n"), nsamples);
-	fprintf(bat->log, _("total sections to detect: %d\n"), nsection);
-	na.source = (float *)malloc(sizeof(float) * nsamples);
-	if (!na.source) {
-		err = -ENOMEM;
-		goto out1;
-	}
+	int nsamples = (int) ceilf(bat->rate / bat->target_freq[channel]);
 
-	na.target = (float *)malloc(sizeof(float) * nsamples);
-	if (!na.target) {
+	memset(na, 0, sizeof(*na));
+	na->target = (float *)malloc(sizeof(float) * nsamples);
+	if (!na->target) {
 		err = -ENOMEM;
-		goto out2;
+		goto fail;
 	}
 
 	/* generate standard single-tone signal */
-	err = generate_sine_wave_raw_mono(bat, na.target, freq, nsamples);
+	err = generate_sine_wave_raw_mono(bat, na->target,
+			bat->target_freq[channel], nsamples);
 	if (err < 0)
-		goto out3;
+		goto fail;
 
-	na.nsamples = nsamples;
+	na->nsamples = nsamples;
 
 	/* calculate rms of standard signal */
 	for (i = 0, tmp = 0.0; i < nsamples; i++)
-		tmp += na.target[i] * na.target[i];
-	na.rms_tgt = sqrtf(tmp / nsamples);
+		tmp += na->target[i] * na->target[i];
+	na->rms_tgt = sqrtf(tmp / nsamples);
 
-	/* calculate average noise level */
-	sum_snr_pc = 0.0;
-	cnt_clean = cnt_noise = 0;
-	for (i = 0, offset = 0; i < nsection; i++) {
-		na.snr_db = SNR_DB_INVALID;
+	return 0;
 
-		err = calculate_noise_one_period(bat, &na, src + offset,
-				nsamples_per_section, channel);
-		if (err < 0)
-			goto out3;
+fail:
+	noise_analyzer_free(na);
+	return err;
+}
 
-		if (na.snr_db > bat->snr_thd_db) {
-			cnt_clean++;
-			sum_snr_pc += 100.0 / powf(10.0, na.snr_db / 20.0);
-		} else {
-			cnt_noise++;
-		}
-		offset += nsamples;
+void noise_analyzer_free(struct noise_analyzer *na)
+{
+	free(na->target);
+	na->target = NULL;
+}
+
+/**
+ * Check one section of two sine periods, the first one for locating
+ * and the second one for noise calculating
+ */
+int noise_analyzer_section(struct bat *bat, struct noise_analyzer *na,
+		float *src, int channel, struct noise_stats *st)
+{
+	int err;
+
+	na->snr_db = SNR_DB_INVALID;
+
+	err = calculate_noise_one_period(bat, na, src, na->nsamples * 2,
+			channel);
+	if (err < 0)
+		return err;
+
+	if (na->snr_db > bat->snr_thd_db) {
+		st->clean++;
+		st->sum_snr_pc += 100.0 / powf(10.0, na->snr_db / 20.0);
+	} else {
+		st->noise++;
 	}
 
-	if (cnt_noise > 0) {
+	return 0;
+}
+
+int noise_report(struct bat *bat, struct noise_stats *st)
+{
+	float avg_snr_pc, avg_snr_db;
+	int err = 0;
+
+	if (st->noise > 0) {
 		fprintf(bat->err, _("Noise detected at %d points.\n"),
-				cnt_noise);
-		err = -cnt_noise;
-		if (cnt_clean == 0)
-			goto out3;
+				st->noise);
+		err = -st->noise;
+		if (st->clean == 0)
+			return err;
 	} else {
 		fprintf(bat->log, _("No noise detected.\n"));
 	}
 
-	avg_snr_pc = sum_snr_pc / cnt_clean;
+	avg_snr_pc = st->sum_snr_pc / st->clean;
 	avg_snr_db = 20.0 * log10f(100.0 / avg_snr_pc);
 	fprintf(bat->log, _("Average SNR is %.2f dB (%.2f %%) at %d points.\n"),
-			avg_snr_db, avg_snr_pc, cnt_clean);
+			avg_snr_db, avg_snr_pc, st->clean);
 
-out3:
-	free(na.target);
-out2:
-	free(na.source);
-out1:
+	return err;
+}
+
+static int calculate_noise(struct bat *bat, float *src, int channel)
+{
+	int err = 0;
+	struct noise_analyzer na;
+	struct noise_stats st;
+	int offset, i;
+
+	/* calculate average noise level */
+	err = noise_analyzer_init(bat, &na, channel);
+	if (err < 0)
+		return err;
+
+	fprintf(bat->log, _("samples per period: %d\n"), na.nsamples);
+	/* all sine periods will be calculated except the first one */
+	fprintf(bat->log, _("total sections to detect: %d\n"),
+			bat->frames / na.nsamples - 1);
+	memset(&st, 0, sizeof(st));
+	for (i = 0, offset = 0; i < bat->frames / na.nsamples - 1; i++) {
+		err = noise_analyzer_section(bat, &na, src + offset, channel,
+				&st);
+		if (err < 0)
+			goto out;
+		offset += na.nsamples;
+	}
+
+	err = noise_report(bat, &st);
+
+out:
+	noise_analyzer_free(&na);
 	return err;
 }
 
@@ -390,9 +680,10 @@ static int find_and_check_noise(struct bat *bat, void *buf, int channel)
 }
 
 /**
- * Convert interleaved samples from channels in samples from a single channel
+ * Convert interleaved samples from channels in samples from a single channel,
+ * the interleaved buffer is freed if owned
  */
-static int reorder_data(struct bat *bat)
+static int reorder_data(struct bat *bat, bool owned)
 {
 	char *p, *new_bat_buf;
 	int ch, i, j;
@@ -414,7 +705,8 @@ static int reorder_data(struct bat *bat)
 		}
 	}
 
-	free(bat->buf);
+	if (owned)
+		free(bat->buf);
 	bat->buf = new_bat_buf;
 
 	return 0;
@@ -434,12 +726,163 @@ static int truncate_frames(struct bat *bat)
 	return -EINVAL;
 }
 
-int analyze_capture(struct bat *bat)
+static int analyze_channel(struct bat *bat, struct fft_plan *fft, int c)
 {
+	struct analyze a;
 	int err = 0;
-	size_t items;
+
+	fprintf(bat->log, _("\nChannel %i - "), c + 1);
+	fprintf(bat->log, _("Checking for target frequency %2.2f Hz\n"),
+			bat->target_freq[c]);
+	a.buf = bat->buf +
+			c * bat->frames * bat->frame_size
+			/ bat->channels;
+	if (!bat->standalone) {
+		err = find_and_check_harmonics(bat, &a, fft, c);
+		if (err != 0)
+			return err;
+	}
+
+	if (snr_is_valid(bat->snr_thd_db)) {
+		fprintf(bat->log, _("\nChecking for SNR: "));
+		fprintf(bat->log, _("Threshold is %.2f dB (%.2f%%)\n"),
+				bat->snr_thd_db, 100.0
+				/ powf(10.0, bat->snr_thd_db / 20.0));
+		err = find_and_check_noise(bat, a.buf, c);
+	}
+
+	return err;
+}
+
+/*
+ * Channels are analyzed in parallel. Each job works on a copy of the
+ * bat context whose log and error streams are redirected to memory, the
+ * output is then printed in channel order up to the first failing
+ * channel, the same as a sequential analysis would print it.
+ */
+struct channel_job {
+	struct bat bat;
+	char *log_buf;
+	size_t log_size;
+	char *err_buf;
+	size_t err_size;
+	int err;
+};
+
+struct analyze_pool {
+	struct channel_job *jobs;
+	int channels;
+	int next;
+	struct fft_plan *plans;		/* one per worker */
+	int workers;
+	pthread_mutex_t lock;
+};
+
+static void *analyze_worker(void *arg)
+{
+	struct analyze_pool *pool = arg;
+	struct fft_plan *fft;
 	int c;
-	struct analyze a;
+
+	pthread_mutex_lock(&pool->lock);
+	fft = &pool->plans[pool->workers++];
+	pthread_mutex_unlock(&pool->lock);
+
+	for (;;) {
+		pthread_mutex_lock(&pool->lock);
+		c = pool->next++;
+		pthread_mutex_unlock(&pool->lock);
+		if (c >= pool->channels)
+			break;
+		pool->jobs[c].err = analyze_channel(&pool->jobs[c].bat, fft, c);
+	}
+
+	return NULL;
+}
+
+static int analyze_channels(struct bat *bat, struct fft_plan *plans,
+		int workers)
+{
+	struct analyze_pool pool;
+	struct channel_job *job;
+	pthread_t *threads;
+	int c, i, started, err = 0;
+
+	pool.jobs = calloc(bat->channels, sizeof(*pool.jobs));
+	threads = calloc(workers, sizeof(*threads));
+	if (pool.jobs == NULL || threads == NULL) {
+		err = -ENOMEM;
+		goto out;
+	}
+	pool.channels = bat->channels;
+	pool.next = 0;
+	pool.plans = plans;
+	pool.workers = 0;
+	pthread_mutex_init(&pool.lock, NULL);
+
+	for (c = 0; c < bat->channels; c++) {
+		job = &pool.jobs[c];
+		job->bat = *bat;
+		job->bat.log = open_memstream(&job->log_buf, &job->log_size);
+		if (job->bat.log == NULL) {
+			err = -ENOMEM;
+			goto out_streams;
+		}
+		/* keep one stream when both go to the same file */
+		if (bat->err == bat->log) {
+			job->bat.err = job->bat.log;
+			continue;
+		}
+		job->bat.err = open_memstream(&job->err_buf, &job->err_size);
+		if (job->bat.err == NULL) {
+			err = -ENOMEM;
+			goto out_streams;
+		}
+	}
+
+	for (started = 0; started < workers; started++) {
+		if (pthread_create(&threads[started], NULL, analyze_worker,
+					&pool) != 0)
+			break;
+	}
+	/* without any thread, analyze in this one */
+	if (started == 0)
+		analyze_worker(&pool);
+	for (i = 0; i < started; i++)
+		pthread_join(threads[i], NULL);
+
+out_streams:
+	for (c = 0; c < bat->channels; c++) {
+		job = &pool.jobs[c];
+		if (job->bat.err != NULL && job->bat.err != job->bat.log)
+			fclose(job->bat.err);
+		if (job->bat.log != NULL)
+			fclose(job->bat.log);
+		if (err == 0) {
+			fwrite(job->log_buf, 1, job->log_size, bat->log);
+			if (job->err_buf != NULL)
+				fwrite(job->err_buf, 1, job->err_size,
+						bat->err);
+			err = job->err;
+		}
+		free(job->log_buf);
+		free(job->err_buf);
+	}
+	pthread_mutex_destroy(&pool.lock);
+
+out:
+	free(threads);
+	free(pool.jobs);
+	return err;
+}
+
+int analyze_capture(struct bat *bat)
+{
+	int err = 0;
+	int c, workers;
+	struct fft_plan local[MAX_CHANNELS];
+	struct fft_plan *plans = bat->plans;
+	struct wav_map map = { NULL, 0, 0, 0 };
 
 	err = truncate_frames(bat);
 	if (err < 0) {
@@ -453,61 +896,69 @@ int analyze_capture(struct bat *bat)
 	fprintf(bat->log, _(" %d channels, %d bytes per sample.\n"),
 			bat->channels, bat->sample_size);
 
-	bat->buf = malloc(bat->frames * bat->frame_size);
-	if (bat->buf == NULL)
-		return -ENOMEM;
-
-	bat->fp = fopen(bat->capture.file, "rb");
-	err = -errno;
-	if (bat->fp == NULL) {
-		fprintf(bat->err, _("Cannot open file: %s %d\n"),
-				bat->capture.file, err);
-		goto exit1;
+	if (bat->capture_buf != NULL) {
+		/* captured in memory, the analysis takes the buffer over */
+		if (bat->capture_frames < bat->frames) {
+			fprintf(bat->err, _("Captured only %d frames\n"),
+					bat->capture_frames);
+			return -EIO;
+		}
+		bat->buf = bat->capture_buf;
+		bat->capture_buf = NULL;
+	} else {
+		err = map_wav_data(bat, bat->capture.file, &map);
+		if (err != 0)
+			goto exit;
+		if (map.frames < bat->frames) {
+			err = -EIO;
+			goto exit;
+		}
+		bat->buf = map.data;
 	}
 
-	/* Skip header */
-	err = read_wav_header(bat, bat->capture.file, bat->fp, true);
+	err = reorder_data(bat, map.addr == NULL);
 	if (err != 0)
-		goto exit2;
-
-	items = fread(bat->buf, bat->frame_size, bat->frames, bat->fp);
-	if (items != bat->frames) {
-		err = -EIO;
-		goto exit2;
+		goto exit;
+	/* the planar copy no longer needs the mapping */
+	if (map.addr != NULL && bat->channels > 1)
+		unmap_wav_data(&map);
+
+	if (!bat->standalone)
+		fft_import_wisdom(bat);
+
+	/* the device pairs tested in parallel share the processors */
+	workers = sysconf(_SC_NPROCESSORS_ONLN);
+	if (bat->pair_count > 1)
+		workers /= bat->pair_count;
+	if (workers > bat->channels)
+		workers = bat->channels;
+
+	/* the plans of a batch are kept for the next case */
+	if (plans == NULL) {
+		memset(local, 0, sizeof(local));
+		plans = local;
 	}
 
-	err = reorder_data(bat);
-	if (err != 0)
-		goto exit2;
-
-	for (c = 0; c < bat->channels; c++) {
-		fprintf(bat->log, _("\nChannel %i - "), c + 1);
-		fprintf(bat->log, _("Checking for target frequency %2.2f Hz\n"),
-				bat->target_freq[c]);
-		a.buf = bat->buf +
-				c * bat->frames * bat->frame_size
-				/ bat->channels;
-		if (!bat->standalone) {
-			err = find_and_check_harmonics(bat, &a, c);
-			if (err != 0)
-				goto exit2;
-		}
-
-		if (snr_is_valid(bat->snr_thd_db)) {
-			fprintf(bat->log, _("\nChecking for SNR: "));
-			fprintf(bat->log, _("Threshold is %.2f dB (%.2f%%)\n"),
-					bat->snr_thd_db, 100.0
-					/ powf(10.0, bat->snr_thd_db / 20.0));
-			err = find_and_check_noise(bat, a.buf, c);
+	if (workers <= 1) {
+		for (c = 0; c < bat->channels; c++) {
+			err = analyze_channel(bat, &plans[0], c);
 			if (err != 0)
-				goto exit2;
+				break;
 		}
+	} else {
+		err = analyze_channels(bat, plans, workers);
 	}
 
-exit2:
-	fclose(bat->fp);
-exit1:
-	free(bat->buf);
+	if (plans == local)
+		for (c = 0; c < MAX_CHANNELS; c++)
+			fft_free(&local[c]);
+
+exit:
+	if (map.addr != NULL)
+		unmap_wav_data(&map);
+	else
+		free(bat->buf);
+	bat->buf = NULL;
 
 	return err;
 }
@@ -14,3 +14,37 @@
  */
 
 int analyze_capture(struct bat *);
+
+#include <fftw3.h>
+
+struct fft_plan {
+	int N;
+	float *in;
+	float *out;
+	float *mag;
+	fftwf_plan plan;
+};
+
+struct noise_stats {
+	int clean;			/* sections with SNR above threshold */
+	int noise;			/* sections with noise */
+	float sum_snr_pc;		/* sum of noise percentage of clean */
+};
+
+int fft_prepare(struct bat *, struct fft_plan *, int);
+void fft_free(struct fft_plan *);
+void fft_import_wisdom(struct bat *);
+
+/* the plan may be shared, it is executed on the buffers of this user */
+static inline void fft_execute(struct fft_plan *fft)
+{
+	fftwf_execute_r2r(fft->plan, fft->in, fft->out);
+}
+int check_spectrum(struct bat *, float *, int, int);
+int xcorr_delay(float *, int, float *, int, double *, float *);
+
+int noise_analyzer_init(struct bat *, struct noise_analyzer *, int);
+void noise_analyzer_free(struct noise_analyzer *);
+int noise_analyzer_section(struct bat *, struct noise_analyzer *, float *,
+		int, struct noise_stats *);
+int noise_report(struct bat *, struct noise_stats *);
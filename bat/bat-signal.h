@@ -27,5 +27,11 @@
 int sin_generator_init(struct sin_generator *, float, float, float);
 float sin_generator_next_sample(struct sin_generator *);
 void sin_generator_vfill(struct sin_generator *, float *, int);
+void sin_generator_vfill_stride(struct sin_generator *, float *, int, int);
 int generate_sine_wave(struct bat *, int, void *);
 int generate_sine_wave_raw_mono(struct bat *, float *, float, int);
+int sweep_length(struct bat *);
+void sweep_fill(struct bat *, float *, int, int);
+int chirp_length(struct bat *);
+void chirp_fill(struct bat *, float *, int, int);
+int generate_chirp(struct bat *, int, int, void *);
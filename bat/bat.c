@@ -38,8 +38,11 @@
 #include "alsa.h"
 #endif
 #include "convert.h"
+#include "bat-signal.h"
 #ifdef HAVE_LIBFFTW3F
 #include "analyze.h"
+#include "online.h"
+#include "sweep.h"
 #endif
 #include "latencytest.h"
 
@@ -127,6 +130,37 @@ static void get_sine_frequencies(struct bat *bat, char *freq)
 	}
 }
 
+static void get_sweep_range(struct bat *bat, char *range)
+{
+	char *ptr;
+
+	bat->sweep_low = strtof(range, &ptr);
+	if (*ptr == ':')
+		bat->sweep_high = strtof(ptr + 1, &ptr);
+	if (*ptr != '\0' || bat->sweep_high <= bat->sweep_low) {
+		fprintf(bat->err, _("Invalid sweep range '%s'\n"), range);
+		exit(EXIT_FAILURE);
+	}
+}
+
+static void add_pair(struct bat *bat, char *pair)
+{
+	char **pairs;
+
+	if (bat->pair_count == MAX_PAIRS) {
+		fprintf(bat->err, _("Too many device pairs, max %d\n"),
+				MAX_PAIRS);
+		exit(EXIT_FAILURE);
+	}
+	pairs = realloc(bat->pairs, (bat->pair_count + 1) * sizeof(*pairs));
+	if (pairs == NULL) {
+		fprintf(bat->err, _("Not enough memory\n"));
+		exit(EXIT_FAILURE);
+	}
+	pairs[bat->pair_count++] = pair;
+	bat->pairs = pairs;
+}
+
 static void get_format(struct bat *bat, char *optarg)
 {
 	if (strcasecmp(optarg, "cd") == 0) {
@@ -171,7 +205,7 @@ static inline int thread_wait_completion(struct bat *bat,
 }
 
 /* loopback test where we play sine wave and capture the same sine wave */
-static void test_loopback(struct bat *bat)
+static int test_loopback(struct bat *bat)
 {
 	pthread_t capture_id, playback_id;
 	int err;
@@ -183,7 +217,7 @@ static void test_loopback(struct bat *bat)
 	if (err != 0) {
 		fprintf(bat->err, _("Cannot create playback thread: %d\n"),
 				err);
-		exit(EXIT_FAILURE);
+		return -err;
 	}
 
 	/* TODO: use a pipe to signal stream start etc - i.e. to sync threads */
@@ -195,16 +229,17 @@ static void test_loopback(struct bat *bat)
 	if (err != 0) {
 		fprintf(bat->err, _("Cannot create capture thread: %d\n"), err);
 		pthread_cancel(playback_id);
-		exit(EXIT_FAILURE);
+		pthread_join(playback_id, NULL);
+		return -err;
 	}
 
 	/* wait for playback to complete */
 	err = thread_wait_completion(bat, playback_id, &thread_result_playback);
 	if (err != 0) {
 		fprintf(bat->err, _("Cannot join playback thread: %d\n"), err);
-		free(thread_result_playback);
 		pthread_cancel(capture_id);
-		exit(EXIT_FAILURE);
+		pthread_join(capture_id, NULL);
+		return -err;
 	}
 
 	/* check playback status */
@@ -212,7 +247,8 @@ static void test_loopback(struct bat *bat)
 		fprintf(bat->err, _("Exit playback thread fail: %d\n"),
 				*thread_result_playback);
 		pthread_cancel(capture_id);
-		exit(EXIT_FAILURE);
+		pthread_join(capture_id, NULL);
+		return *thread_result_playback;
 	} else {
 		fprintf(bat->log, _("Playback completed.\n"));
 	}
@@ -222,24 +258,24 @@ static void test_loopback(struct bat *bat)
 	err = thread_wait_completion(bat, capture_id, &thread_result_capture);
 	if (err != 0) {
 		fprintf(bat->err, _("Cannot join capture thread: %d\n"), err);
-		free(thread_result_capture);
-		exit(EXIT_FAILURE);
+		return -err;
 	}
 
 	/* check if capture thread is canceled or not */
 	if (thread_result_capture == PTHREAD_CANCELED) {
 		fprintf(bat->log, _("Capture canceled.\n"));
-		return;
+		return 0;
 	}
 
 	/* check capture status */
 	if (*thread_result_capture != 0) {
 		fprintf(bat->err, _("Exit capture thread fail: %d\n"),
 				*thread_result_capture);
-		exit(EXIT_FAILURE);
-	} else {
-		fprintf(bat->log, _("Capture completed.\n"));
+		return *thread_result_capture;
 	}
+	fprintf(bat->log, _("Capture completed.\n"));
+
+	return 0;
 }
 
 /* single ended playback only test */
@@ -334,8 +370,16 @@ _("Usage: alsabat [-options]...\n"
 "      --local            internal loop, set to bypass pcm hardware devices\n"
 "      --standalone       standalone mode, to bypass analysis\n"
 "      --roundtriplatency round trip latency mode\n"
+"      --latency-xcorr=#  round trip latency by cross-correlation, number of runs\n"
 "      --snr-db=#         noise detect threshold, in SNR(dB)\n"
 "      --snr-pc=#         noise detect threshold, in noise percentage(%%)\n"
+"      --wisdom=#         file that FFTW wisdom is loaded from and saved to\n"
+"      --online           analyze while capturing, stop when the result is known\n"
+"      --sweep=#          frequency response with a sweep, range low:high in Hz\n"
+"      --batch=#          file of test cases, one line of options per case\n"
+"      --mmap             transfer the samples with mmap\n"
+"      --soak[=#]         loop with rolling statistics, for # seconds or until stopped\n"
+"      --pair=#           playback,capture pcm devices tested in parallel, repeatable\n"
 ));
 	fprintf(bat->log, _("Recognized sample formats are: "));
 	fprintf(bat->log, _("U8 S16_LE S24_3LE S32_LE\n"));
@@ -395,8 +439,16 @@ static void parse_arguments(struct bat *bat, int argc, char *argv[])
 		{"local",    0, 0, OPT_LOCAL},
 		{"standalone", 0, 0, OPT_STANDALONE},
 		{"roundtriplatency", 0, 0, OPT_ROUNDTRIPLATENCY},
+		{"latency-xcorr", 1, 0, OPT_LATENCYXCORR},
 		{"snr-db",   1, 0, OPT_SNRTHD_DB},
 		{"snr-pc",   1, 0, OPT_SNRTHD_PC},
+		{"wisdom",   1, 0, OPT_WISDOM},
+		{"online",   0, 0, OPT_ONLINE},
+		{"sweep",    1, 0, OPT_SWEEP},
+		{"batch",    1, 0, OPT_BATCH},
+		{"mmap",     0, 0, OPT_MMAP},
+		{"soak",     2, 0, OPT_SOAK},
+		{"pair",     1, 0, OPT_PAIR},
 		{0, 0, 0, 0}
 	};
 
@@ -406,6 +458,20 @@ static void parse_arguments(struct bat *bat, int argc, char *argv[])
 		case OPT_LOG:
 			bat->logarg = optarg;
 			break;
+		case OPT_BATCH:
+			bat->batch = optarg;
+			break;
+		case OPT_MMAP:
+			bat->mmap = true;
+			break;
+		case OPT_PAIR:
+			add_pair(bat, optarg);
+			break;
+		case OPT_SOAK:
+			bat->soak = true;
+			bat->online = true;
+			bat->soak_duration = optarg ? atoi(optarg) : 0;
+			break;
 		case OPT_READFILE:
 			bat->playback.file = optarg;
 			break;
@@ -421,12 +487,27 @@ static void parse_arguments(struct bat *bat, int argc, char *argv[])
 		case OPT_ROUNDTRIPLATENCY:
 			bat->roundtriplatency = true;
 			break;
+		case OPT_LATENCYXCORR:
+			bat->roundtriplatency = true;
+			bat->latency.xcorr_runs = atoi(optarg);
+			if (bat->latency.xcorr_runs <= 0)
+				bat->latency.xcorr_runs = -1;
+			break;
 		case OPT_SNRTHD_DB:
 			get_snr_thd_db(bat, optarg);
 			break;
 		case OPT_SNRTHD_PC:
 			get_snr_thd_pc(bat, optarg);
 			break;
+		case OPT_WISDOM:
+			bat->wisdom = optarg;
+			break;
+		case OPT_ONLINE:
+			bat->online = true;
+			break;
+		case OPT_SWEEP:
+			get_sweep_range(bat, optarg);
+			break;
 		case 'D':
 			if (bat->playback.device == NULL)
 				bat->playback.device = optarg;
@@ -512,9 +593,44 @@ static int validate_options(struct bat *bat)
 		return -EINVAL;
 	}
 
+	if (bat->latency.xcorr_runs < 0
+			|| bat->latency.xcorr_runs > LATENCY_XCORR_MAX) {
+		fprintf(bat->err, _("runs of latency test out of range:"));
+		fprintf(bat->err, _(" (1, %d)\n"), LATENCY_XCORR_MAX);
+		return -EINVAL;
+	}
+#ifndef HAVE_LIBFFTW3F
+	if (bat->latency.xcorr_runs) {
+		fprintf(bat->err, _("No libfftw3 library for cross-correlation\n"));
+		return -EINVAL;
+	}
+#endif
+
+	if (bat->soak && (bat->local || bat->standalone
+			|| bat->roundtriplatency || bat->sweep_high > 0.0
+			|| bat->playback.mode != MODE_LOOPBACK
+			|| bat->capture.mode != MODE_LOOPBACK)) {
+		fprintf(bat->err, _("soak test is a loopback test with analysis\n"));
+		return -EINVAL;
+	}
+#ifndef HAVE_LIBFFTW3F
+	if (bat->soak) {
+		fprintf(bat->err, _("No libfftw3 library for the soak test\n"));
+		return -EINVAL;
+	}
+#endif
+
 	/* check sine wave frequency range */
 	freq_low = DC_THRESHOLD;
 	freq_high = bat->rate * RATE_FACTOR;
+	if (bat->sweep_high > 0.0 && (bat->sweep_low < freq_low
+			|| bat->sweep_high > freq_high
+			|| bat->sweep_high < bat->sweep_low * 2)) {
+		fprintf(bat->err, _("sweep out of range: (%.1f, %.1f),"),
+				freq_low, freq_high);
+		fprintf(bat->err, _(" at least one octave\n"));
+		return -EINVAL;
+	}
 	for (c = 0; c < bat->channels; c++) {
 		if (bat->target_freq[c] < freq_low
 				|| bat->target_freq[c] > freq_high) {
@@ -528,13 +644,11 @@ static int validate_options(struct bat *bat)
 	return 0;
 }
 
-static int bat_init(struct bat *bat)
+/* Determine logging to a file or stdout and stderr */
+static int open_log(struct bat *bat)
 {
-	int err = 0;
-	int fd = 0;
-	char name[] = TEMP_RECORD_FILE_NAME;
+	int err;
 
-	/* Determine logging to a file or stdout and stderr */
 	if (bat->logarg) {
 		bat->log = NULL;
 		bat->log = fopen(bat->logarg, "wb");
@@ -547,6 +661,25 @@ static int bat_init(struct bat *bat)
 		bat->err = bat->log;
 	}
 
+	return 0;
+}
+
+static bool capture_in_memory(struct bat *bat)
+{
+	return !bat->roundtriplatency && bat->frames > 0
+			&& bat->playback.mode != MODE_SINGLE;
+}
+
+static int bat_init(struct bat *bat)
+{
+	int err = 0;
+	int fd = 0;
+	char name[] = TEMP_RECORD_FILE_NAME;
+
+	err = open_log(bat);
+	if (err < 0)
+		return err;
+
 	/* Determine duration of playback and/or capture */
 	if (bat->narg) {
 		err = get_duration(bat);
@@ -554,13 +687,21 @@ static int bat_init(struct bat *bat)
 			return err;
 	}
 
+	/* the sweep analysis needs two periods, one to settle */
+	if (bat->sweep_high > 0.0 && !bat->local
+			&& bat->frames > 0 && bat->frames < 2 * sweep_length(bat))
+		bat->frames = 2 * sweep_length(bat);
+
 	/* Set default playback and capture devices */
 	if (bat->playback.device == NULL && bat->capture.device == NULL)
 		bat->playback.device = bat->capture.device = DEFAULT_DEV_NAME;
 
-	/* Determine capture file */
+	/* Determine capture file, the analysis takes the capture from
+	 * memory unless the round trip latency is measured */
 	if (bat->local) {
 		bat->capture.file = bat->playback.file;
+	} else if (capture_in_memory(bat)) {
+		bat->capture.file = NULL;
 	} else {
 		/* create temp file for sound record and analysis */
 		fd = mkstemp(name);
@@ -600,6 +741,9 @@ static int bat_init(struct bat *bat)
 			bat->sinus_duration = 0;
 			bat->playback.mode = MODE_SINGLE;
 		}
+		/* the soak test plays until the analyzer stops it */
+		if (bat->soak)
+			bat->sinus_duration = 0;
 	} else {
 		bat->fp = fopen(bat->playback.file, "rb");
 		err = -errno;
@@ -640,6 +784,421 @@ static int bat_init(struct bat *bat)
 		return -EINVAL;
 	}
 
+	/* the soak test keeps nothing, the analyzer takes the periods */
+	if (!bat->local && capture_in_memory(bat) && !bat->soak) {
+		bat->capture_buf = malloc(bat->frames * bat->frame_size);
+		if (bat->capture_buf == NULL) {
+			fprintf(bat->err, _("Not enough memory: size=%d\n"),
+					bat->frames * bat->frame_size);
+			return -ENOMEM;
+		}
+		bat->capture_frames = 0;
+	}
+
+	return err;
+}
+
+/* start the online analyzer, fed by the capture thread, if wanted */
+static int start_analysis(struct bat *bat)
+{
+#ifdef HAVE_LIBFFTW3F
+	if (bat->online && !bat->local && bat->sweep_high == 0.0
+			&& (!bat->standalone || snr_is_valid(bat->snr_thd_db)))
+		return online_start(bat);
+#endif
+	return 0;
+}
+
+static int finish_analysis(struct bat *bat)
+{
+#ifdef HAVE_LIBFFTW3F
+	if (bat->analyzer)
+		return online_finish(bat);
+	if (bat->sweep_high > 0.0 && !bat->standalone)
+		return analyze_sweep(bat);
+	if (!bat->standalone || snr_is_valid(bat->snr_thd_db))
+		return analyze_capture(bat);
+#else
+	fprintf(bat->log, _("No libfftw3 library. Exit without analysis.\n"));
+#endif
+	return 0;
+}
+
+/*
+ * Batch mode: each line of the file holds the options of one loopback
+ * case, applied over the ones of the command line. All lines are parsed
+ * before the first case runs. The PCM handles stay open between the
+ * cases and the FFT plans are kept while the sizes do not change.
+ */
+#define BATCH_MAX_ARGS			64
+
+struct batch_case {
+	struct bat bat;
+	char *line;			/* as read, for the report */
+	char *args;			/* tokens pointed to by bat */
+	int err;
+};
+
+static int batch_parse(struct bat *bat, struct batch_case *bc)
+{
+	char *argv[BATCH_MAX_ARGS + 1];
+	char *tok, *save;
+	int argc = 1;
+
+	argv[0] = "alsabat";
+	for (tok = strtok_r(bc->args, " \t", &save); tok != NULL;
+			tok = strtok_r(NULL, " \t", &save)) {
+		if (argc == BATCH_MAX_ARGS) {
+			fprintf(bat->err, _("Too many options in batch case: %s\n"),
+					bc->line);
+			return -E2BIG;
+		}
+		argv[argc++] = tok;
+	}
+	argv[argc] = NULL;
+
+	bc->bat = *bat;
+	bc->bat.batch = NULL;
+	bc->bat.logarg = NULL;
+	/* restart getopt from scratch */
+	optind = 0;
+	parse_arguments(&bc->bat, argc, argv);
+
+	if (bc->bat.batch || bc->bat.logarg || bc->bat.local
+			|| bc->bat.pair_count
+			|| bc->bat.roundtriplatency
+			|| bc->bat.playback.mode != MODE_LOOPBACK
+			|| bc->bat.capture.mode != MODE_LOOPBACK) {
+		fprintf(bat->err, _("Only loopback tests can be batched: %s\n"),
+				bc->line);
+		return -EINVAL;
+	}
+	bc->bat.keep_pcm = true;
+
+	return 0;
+}
+
+static int batch_read(struct bat *bat, struct batch_case **cases)
+{
+	struct batch_case *bc, *list = NULL;
+	FILE *fp;
+	char *line = NULL;
+	size_t size = 0;
+	int n = 0, err = 0;
+	ssize_t len;
+
+	fp = fopen(bat->batch, "r");
+	err = -errno;
+	if (fp == NULL) {
+		fprintf(bat->err, _("Cannot open file: %s %d\n"),
+				bat->batch, err);
+		return err;
+	}
+	err = 0;
+
+	while ((len = getline(&line, &size, fp)) >= 0) {
+		if (len > 0 && line[len - 1] == '\n')
+			line[--len] = '\0';
+		/* skip empty lines and comments */
+		if (line[strspn(line, " \t")] == '\0'
+				|| line[strspn(line, " \t")] == '#')
+			continue;
+
+		bc = realloc(list, (n + 1) * sizeof(*list));
+		if (bc == NULL) {
+			err = -ENOMEM;
+			break;
+		}
+		list = bc;
+		bc = &list[n];
+		memset(bc, 0, sizeof(*bc));
+		bc->line = strdup(line);
+		bc->args = strdup(line);
+		n++;
+		if (bc->line == NULL || bc->args == NULL) {
+			err = -ENOMEM;
+			break;
+		}
+		err = batch_parse(bat, bc);
+		if (err < 0)
+			break;
+	}
+	free(line);
+	fclose(fp);
+
+	if (err == 0 && n == 0) {
+		fprintf(bat->err, _("No test case in batch file: %s\n"),
+				bat->batch);
+		err = -EINVAL;
+	}
+	if (err < 0) {
+		while (n-- > 0) {
+			free(list[n].line);
+			free(list[n].args);
+		}
+		free(list);
+		return err;
+	}
+
+	*cases = list;
+	return n;
+}
+
+static int batch_run_case(struct bat *bat)
+{
+	int err;
+
+	err = bat_init(bat);
+	if (err < 0)
+		return err;
+
+	err = validate_options(bat);
+	if (err < 0)
+		goto out;
+
+	err = start_analysis(bat);
+	if (err < 0)
+		goto out;
+
+	err = test_loopback(bat);
+	if (err < 0) {
+		/* stop the analyzer, the capture has failed anyway */
+		if (bat->analyzer)
+			finish_analysis(bat);
+		goto out;
+	}
+
+	err = finish_analysis(bat);
+
+out:
+	free(bat->capture_buf);
+	bat->capture_buf = NULL;
+
+	return err;
+}
+
+static int run_batch(struct bat *bat)
+{
+	struct batch_case *cases;
+	int i, n, failed = 0, err;
+
+	err = open_log(bat);
+	if (err < 0)
+		return err;
+
+	n = batch_read(bat, &cases);
+	if (n < 0)
+		return n;
+
+#ifdef HAVE_LIBFFTW3F
+	bat->plans = calloc(MAX_CHANNELS, sizeof(struct fft_plan));
+	if (bat->plans == NULL) {
+		err = -ENOMEM;
+		goto out;
+	}
+#endif
+
+	for (i = 0; i < n; i++) {
+		cases[i].bat.log = bat->log;
+		cases[i].bat.err = bat->err;
+		cases[i].bat.plans = bat->plans;
+		fprintf(bat->log, _("\nBatch case %d of %d: %s\n"), i + 1, n,
+				cases[i].line);
+		cases[i].err = batch_run_case(&cases[i].bat);
+		if (cases[i].err != 0 && failed++ == 0)
+			err = cases[i].err;
+	}
+
+	fprintf(bat->log, _("\nBatch report: %d cases, %d passed, %d failed\n"),
+			n, n - failed, failed);
+	for (i = 0; i < n; i++) {
+		if (cases[i].err == 0)
+			fprintf(bat->log, _("%4d  PASS        %s\n"), i + 1,
+					cases[i].line);
+		else
+			fprintf(bat->log, _("%4d  FAIL %5d  %s\n"), i + 1,
+					cases[i].err, cases[i].line);
+	}
+
+#ifdef HAVE_LIBFFTW3F
+	for (i = 0; i < MAX_CHANNELS; i++)
+		fft_free(&bat->plans[i]);
+	free(bat->plans);
+	bat->plans = NULL;
+out:
+#endif
+#ifndef HAVE_LIBTINYALSA
+	close_kept_pcm();
+#endif
+	for (i = 0; i < n; i++) {
+		free(cases[i].line);
+		free(cases[i].args);
+	}
+	free(cases);
+
+	return err;
+}
+
+/*
+ * Parallel mode: each device pair runs the loopback test in its own thread,
+ * which starts the playback and capture threads of the pair and analyzes
+ * the capture. The pairs work on copies of the bat context whose log and
+ * error streams are redirected to memory, the output is printed in pair
+ * order when all are done. The FFT plans of the same length are shared by
+ * the pairs, and the analysis threads of a pair get their part of the
+ * processors.
+ */
+struct pair_job {
+	struct bat bat;
+	char *devices;			/* split into the device names */
+	char *log_buf;
+	size_t log_size;
+	char *err_buf;
+	size_t err_size;
+	pthread_t thread;
+	bool started;
+	int err;
+};
+
+static void *pair_thread(void *arg)
+{
+	struct pair_job *job = arg;
+
+	job->err = batch_run_case(&job->bat);
+
+	return NULL;
+}
+
+static int pair_setup(struct bat *bat, struct pair_job *job, char *pair)
+{
+	char *sep;
+
+	job->bat = *bat;
+	job->bat.logarg = NULL;
+	/* the streams of the parent are not ours to close */
+	job->bat.log = NULL;
+	job->bat.err = NULL;
+	/* each pair generates its own signal */
+	memset(job->bat.sg, 0, sizeof(job->bat.sg));
+	job->bat.sweep_pos = 0;
+	job->bat.sinus_load = 0;
+
+	job->devices = strdup(pair);
+	if (job->devices == NULL)
+		return -ENOMEM;
+	sep = strchr(job->devices, ',');
+	if (sep != NULL)
+		*sep++ = '\0';
+	job->bat.playback.device = job->devices;
+	job->bat.capture.device = (sep != NULL && *sep != '\0') ?
+			sep : job->devices;
+
+	job->bat.log = open_memstream(&job->log_buf, &job->log_size);
+	if (job->bat.log == NULL)
+		return -ENOMEM;
+	/* keep one stream when both go to the same file */
+	if (bat->err == bat->log) {
+		job->bat.err = job->bat.log;
+		return 0;
+	}
+	job->bat.err = open_memstream(&job->err_buf, &job->err_size);
+	if (job->bat.err == NULL)
+		return -ENOMEM;
+
+	return 0;
+}
+
+static int run_pairs(struct bat *bat)
+{
+	struct pair_job *jobs, *job;
+	int i, n = bat->pair_count, failed = 0, err;
+
+	if (bat->playback.device || bat->capture.device || bat->local
+			|| bat->soak || bat->roundtriplatency
+			|| bat->sweep_high > 0.0
+			|| bat->playback.mode != MODE_LOOPBACK
+			|| bat->capture.mode != MODE_LOOPBACK) {
+		fprintf(bat->err, _("Device pairs only run loopback tests,"));
+		fprintf(bat->err, _(" without -D, -P and -C\n"));
+		return -EINVAL;
+	}
+	if (bat->debugplay) {
+		fprintf(bat->err, _("Device pairs cannot be used with"));
+		fprintf(bat->err, _(" --saveplay\n"));
+		return -EINVAL;
+	}
+
+	err = open_log(bat);
+	if (err < 0)
+		return err;
+
+	jobs = calloc(n, sizeof(*jobs));
+	if (jobs == NULL)
+		return -ENOMEM;
+
+	for (i = 0; i < n; i++) {
+		err = pair_setup(bat, &jobs[i], bat->pairs[i]);
+		if (err < 0)
+			goto out;
+	}
+
+	for (i = 0; i < n; i++) {
+		job = &jobs[i];
+		err = pthread_create(&job->thread, NULL, pair_thread, job);
+		if (err != 0) {
+			fprintf(bat->err, _("Cannot create pair thread: %d\n"),
+					err);
+			job->err = -err;
+			continue;
+		}
+		job->started = true;
+	}
+	for (i = 0; i < n; i++) {
+		if (jobs[i].started)
+			pthread_join(jobs[i].thread, NULL);
+	}
+
+	err = 0;
+	for (i = 0; i < n; i++) {
+		job = &jobs[i];
+		if (job->bat.err != job->bat.log)
+			fclose(job->bat.err);
+		fclose(job->bat.log);
+		job->bat.log = job->bat.err = NULL;
+		fprintf(bat->log, _("\nPair %d of %d: %s -> %s\n"), i + 1, n,
+				job->bat.playback.device,
+				job->bat.capture.device);
+		fwrite(job->log_buf, 1, job->log_size, bat->log);
+		if (job->err_buf != NULL)
+			fwrite(job->err_buf, 1, job->err_size, bat->err);
+		if (job->err != 0 && failed++ == 0)
+			err = job->err;
+	}
+
+	fprintf(bat->log, _("\nPair report: %d pairs, %d passed, %d failed\n"),
+			n, n - failed, failed);
+	for (i = 0; i < n; i++) {
+		if (jobs[i].err == 0)
+			fprintf(bat->log, _("%4d  PASS        %s\n"), i + 1,
+					bat->pairs[i]);
+		else
+			fprintf(bat->log, _("%4d  FAIL %5d  %s\n"), i + 1,
+					jobs[i].err, bat->pairs[i]);
+	}
+
+out:
+	for (i = 0; i < n; i++) {
+		job = &jobs[i];
+		if (job->bat.err != NULL && job->bat.err != job->bat.log)
+			fclose(job->bat.err);
+		if (job->bat.log != NULL)
+			fclose(job->bat.log);
+		free(job->log_buf);
+		free(job->err_buf);
+		free(job->devices);
+	}
+	free(jobs);
+
 	return err;
 }
 
@@ -659,6 +1218,22 @@ int main(int argc, char *argv[])
 
 	parse_arguments(&bat, argc, argv);
 
+	if (bat.batch && bat.pair_count > 0) {
+		fprintf(bat.err, _("Device pairs cannot be batched\n"));
+		err = -EINVAL;
+		goto out;
+	}
+
+	if (bat.batch) {
+		err = run_batch(&bat);
+		goto out;
+	}
+
+	if (bat.pair_count > 0) {
+		err = run_pairs(&bat);
+		goto out;
+	}
+
 	err = bat_init(&bat);
 	if (err < 0)
 		goto out;
@@ -673,7 +1248,9 @@ int main(int argc, char *argv[])
 			fprintf(bat.log,
 				_("\nStart round trip latency\n"));
 			roundtrip_latency_init(&bat);
-			test_loopback(&bat);
+			err = test_loopback(&bat);
+			if (err < 0)
+				goto out;
 
 			if (bat.latency.xrun_error == false)
 				break;
@@ -702,6 +1279,10 @@ int main(int argc, char *argv[])
 		goto out;
 	}
 
+	err = start_analysis(&bat);
+	if (err < 0)
+		goto out;
+
 	/* single line capture thread: capture only, no playback */
 	if (bat.capture.mode == MODE_SINGLE) {
 		test_capture(&bat);
@@ -709,16 +1290,14 @@ int main(int argc, char *argv[])
 	}
 
 	/* loopback thread: playback and capture in a loop */
-	if (bat.local == false)
-		test_loopback(&bat);
+	if (bat.local == false) {
+		err = test_loopback(&bat);
+		if (err < 0)
+			goto out;
+	}
 
 analyze:
-#ifdef HAVE_LIBFFTW3F
-	if (!bat.standalone || snr_is_valid(bat.snr_thd_db))
-		err = analyze_capture(&bat);
-#else
-	fprintf(bat.log, _("No libfftw3 library. Exit without analysis.\n"));
-#endif
+	err = finish_analysis(&bat);
 out:
 	fprintf(bat.log, _("\nReturn value is %d\n"), err);
 
@@ -726,6 +1305,9 @@ out:
 		fclose(bat.log);
 	if (!bat.local)
 		free(bat.capture.file);
+	free(bat.capture_buf);
+	free(bat.latency.capture);
+	free(bat.pairs);
 
 	return err;
 }
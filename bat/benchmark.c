@@ -0,0 +1,339 @@
+/*
+ * Copyright (C) 2026 agent <agent@local>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ */
+
+/*
+ * Benchmark of the analysis of a captured signal: the FFT, the noise
+ * analyzer and the whole analyze_capture() as run after a capture in
+ * memory, over a generated sine. No device is used.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "aconfig.h"
+
+#include "common.h"
+#include "bat-signal.h"
+#include "analyze.h"
+#include "convert.h"
+#include "bench.h"
+
+/* the amount of samples analyzed in each trial by default */
+#define DEFAULT_MEGABYTES	8
+
+#define ARRAY_SIZE(a)		(sizeof(a) / sizeof((a)[0]))
+
+static bool json;
+
+struct bench_format {
+	const char *name;
+	enum _bat_pcm_format format;
+	int sample_size;
+	void (*convert_sample_to_float)(void *, float *, int);
+	void (*convert_float_to_sample)(float *, void *, int, int);
+};
+
+static const struct bench_format formats[] = {
+	{ "S16_LE", BAT_PCM_FORMAT_S16_LE, 2,
+	  convert_int16_to_float, convert_float_to_int16 },
+	{ "S24_3LE", BAT_PCM_FORMAT_S24_3LE, 3,
+	  convert_int24_to_float, convert_float_to_int24 },
+	{ "S32_LE", BAT_PCM_FORMAT_S32_LE, 4,
+	  convert_int32_to_float, convert_float_to_int32 },
+};
+
+static void print_trial(const char *name, const char *format, int channels,
+		int frames)
+{
+	if (json) {
+		printf("{ \"suite\": \"bat\", \"name\": \"%s\", "
+				"\"format\": \"%s\", \"channels\": %d, "
+				"\"frames\": %d",
+				name, format, channels, frames);
+		return;
+	}
+
+	printf("%-10s %-10s %3d %7d", name, format, channels, frames);
+}
+
+static unsigned int repeat_count(uint64_t byte_count, int frames,
+		int bytes_per_frame)
+{
+	uint64_t bytes = (uint64_t) frames * bytes_per_frame;
+
+	return (byte_count + bytes - 1) / bytes;
+}
+
+/* the same defaults as alsabat, with the thresholds of both checks set */
+static int prepare_bat(struct bat *bat, FILE *log,
+		const struct bench_format *f, int channels, int frames)
+{
+	memset(bat, 0, sizeof(*bat));
+	bat->rate = 48000;
+	bat->channels = channels;
+	bat->frames = frames;
+	bat->sample_size = f->sample_size;
+	bat->frame_size = f->sample_size * channels;
+	bat->format = f->format;
+	bat->convert_sample_to_float = f->convert_sample_to_float;
+	bat->convert_float_to_sample = f->convert_float_to_sample;
+	bat->target_freq[0] = 997.0;
+	bat->target_freq[1] = 1499.0;
+	bat->sigma_k = 3.0;
+	bat->snr_thd_db = 40.0;
+	bat->log = log;
+	bat->err = log;
+
+	/* the plans are kept between the runs, as in a batch */
+	bat->plans = calloc(MAX_CHANNELS, sizeof(struct fft_plan));
+	if (bat->plans == NULL)
+		return -ENOMEM;
+
+	return 0;
+}
+
+static void release_bat(struct bat *bat)
+{
+	int c;
+
+	for (c = 0; c < MAX_CHANNELS; c++)
+		fft_free(&bat->plans[c]);
+	free(bat->plans);
+}
+
+/* the whole analysis of a capture kept in memory */
+static int bench_analyze(FILE *log, const struct bench_format *f,
+		int channels, int frames, uint64_t byte_count)
+{
+	struct bench_cost cost = {0};
+	struct bat bat;
+	unsigned int i, count;
+	void *wave;
+	int err;
+
+	err = prepare_bat(&bat, log, f, channels, frames);
+	if (err < 0)
+		return err;
+
+	wave = malloc(frames * bat.frame_size);
+	if (wave == NULL) {
+		err = -ENOMEM;
+		goto out;
+	}
+	err = generate_sine_wave(&bat, frames, wave);
+	if (err < 0)
+		goto out;
+
+	/* the first run creates the plans */
+	count = repeat_count(byte_count, frames, bat.frame_size) + 1;
+	for (i = 0; i < count; i++) {
+		bat.capture_buf = malloc(frames * bat.frame_size);
+		if (bat.capture_buf == NULL) {
+			err = -ENOMEM;
+			goto out;
+		}
+		memcpy(bat.capture_buf, wave, frames * bat.frame_size);
+		bat.capture_frames = frames;
+		bat.frames = frames;
+
+		if (i > 0)
+			bench_cost_begin(&cost);
+		err = analyze_capture(&bat);
+		if (i > 0)
+			bench_cost_end(&cost, frames, bat.frame_size);
+		if (err != 0) {
+			err = -EIO;
+			goto out;
+		}
+	}
+
+	print_trial("analyze", f->name, channels, frames);
+	bench_print_cost("analyze", &cost, json);
+	printf(json ? " }\n" : "\n");
+
+out:
+	/* left only if the analysis failed before taking it over */
+	free(bat.capture_buf);
+	free(wave);
+	release_bat(&bat);
+	return err;
+}
+
+/* the FFT of one channel and its plan, on floats */
+static int bench_fft(FILE *log, int frames, uint64_t byte_count)
+{
+	struct bench_cost cost = {0};
+	struct fft_plan *fft;
+	struct bat bat;
+	unsigned int i, count;
+	int err;
+
+	err = prepare_bat(&bat, log, &formats[0], 1, frames);
+	if (err < 0)
+		return err;
+	fft = &bat.plans[0];
+
+	err = fft_prepare(&bat, fft, frames);
+	if (err < 0)
+		goto out;
+	err = generate_sine_wave_raw_mono(&bat, fft->in, bat.target_freq[0],
+			frames);
+	if (err < 0)
+		goto out;
+
+	count = repeat_count(byte_count, frames, sizeof(float));
+	for (i = 0; i < count; i++) {
+		bench_cost_begin(&cost);
+		fft_execute(fft);
+		bench_cost_end(&cost, frames, sizeof(float));
+	}
+
+	print_trial("fft", "FLOAT", 1, frames);
+	bench_print_cost("fft", &cost, json);
+	printf(json ? " }\n" : "\n");
+
+out:
+	release_bat(&bat);
+	return err;
+}
+
+/* all sections of one channel through the noise analyzer, on floats */
+static int bench_noise(FILE *log, int frames, uint64_t byte_count)
+{
+	struct bench_cost cost = {0};
+	struct noise_analyzer na;
+	struct noise_stats st;
+	struct bat bat;
+	unsigned int i, count;
+	int offset, s, sections;
+	float *source;
+	int err;
+
+	err = prepare_bat(&bat, log, &formats[0], 1, frames);
+	if (err < 0)
+		return err;
+
+	source = malloc(sizeof(float) * frames);
+	if (source == NULL) {
+		err = -ENOMEM;
+		goto out;
+	}
+	err = generate_sine_wave_raw_mono(&bat, source, bat.target_freq[0],
+			frames);
+	if (err < 0)
+		goto out;
+	err = noise_analyzer_init(&bat, &na, 0);
+	if (err < 0)
+		goto out;
+
+	sections = frames / na.nsamples - 1;
+	count = repeat_count(byte_count, frames, sizeof(float));
+	for (i = 0; i < count && err == 0; i++) {
+		memset(&st, 0, sizeof(st));
+		bench_cost_begin(&cost);
+		for (s = 0, offset = 0; s < sections; s++) {
+			err = noise_analyzer_section(&bat, &na,
+					source + offset, 0, &st);
+			if (err < 0)
+				break;
+			offset += na.nsamples;
+		}
+		bench_cost_end(&cost, frames, sizeof(float));
+		if (err == 0 && st.noise > 0)
+			err = -EIO;
+	}
+	noise_analyzer_free(&na);
+	if (err < 0)
+		goto out;
+
+	print_trial("noise", "FLOAT", 1, frames);
+	bench_print_cost("noise", &cost, json);
+	printf(json ? " }\n" : "\n");
+
+out:
+	free(source);
+	release_bat(&bat);
+	return err;
+}
+
+int main(int argc, char *argv[])
+{
+	static const int frames_entries[] = {16384, 131072};
+	uint64_t byte_count;
+	FILE *log;
+	int f, c, i;
+	int err = 0;
+
+	if (argc > 1 && strcmp(argv[1], "--json") == 0) {
+		json = true;
+		--argc;
+		++argv;
+	}
+
+	byte_count = DEFAULT_MEGABYTES;
+	if (argc > 1) {
+		char *term;
+
+		errno = 0;
+		byte_count = strtoul(argv[1], &term, 10);
+		if (errno || *term != '\0' || byte_count == 0) {
+			printf("Usage: %s [--json] [megabytes per trial]\n",
+					argv[0]);
+			return EXIT_FAILURE;
+		}
+	}
+	byte_count *= 1024 * 1024;
+
+	/* the reports of the analysis are not a part of the results */
+	log = fopen("/dev/null", "w");
+	if (log == NULL) {
+		fprintf(stderr, "/dev/null: %s\n", strerror(errno));
+		return EXIT_FAILURE;
+	}
+
+	if (!json)
+		printf("%-10s %-10s %3s %7s %10s %10s\n", "analysis",
+				"format", "ch", "frames", "MB/s", "cyc/frame");
+	for (i = 0; i < ARRAY_SIZE(frames_entries); i++) {
+		err = bench_fft(log, frames_entries[i], byte_count);
+		if (err < 0)
+			goto end;
+		err = bench_noise(log, frames_entries[i], byte_count);
+		if (err < 0)
+			goto end;
+	}
+	for (f = 0; f < ARRAY_SIZE(formats); f++) {
+		for (c = 1; c <= MAX_CHANNELS; c++) {
+			for (i = 0; i < ARRAY_SIZE(frames_entries); i++) {
+				err = bench_analyze(log, &formats[f], c,
+						frames_entries[i], byte_count);
+				if (err < 0)
+					goto end;
+			}
+		}
+	}
+
+end:
+	fclose(log);
+	if (err < 0) {
+		fprintf(stderr, "%s\n", strerror(-err));
+		return EXIT_FAILURE;
+	}
+	return EXIT_SUCCESS;
+}
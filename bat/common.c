@@ -17,7 +17,10 @@
 #include <stddef.h>
 #include <stdlib.h>
 #include <stdbool.h>
+#include <string.h>
 #include <errno.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 
 #include "aconfig.h"
 #include "gettext.h"
@@ -26,9 +29,6 @@
 #include "alsa.h"
 #include "bat-signal.h"
 
-int retval_play;
-int retval_record;
-
 /* update chunk_fmt data to bat */
 static int update_fmt_to_bat(struct bat *bat, struct chunk_fmt *fmt)
 {
@@ -175,6 +175,68 @@ void prepare_wav_info(struct wav_container *wav, struct bat *bat)
 			+ sizeof(wav->format) + sizeof(wav->header) - 8;
 }
 
+/*
+ * Map the data chunk of a wav file read for analysis, so that the samples
+ * are converted from the page cache without being copied first.
+ */
+int map_wav_data(struct bat *bat, char *file, struct wav_map *map)
+{
+	struct stat st;
+	off_t offset;
+	FILE *fp;
+	int err;
+
+	memset(map, 0, sizeof(*map));
+
+	fp = fopen(file, "rb");
+	err = -errno;
+	if (fp == NULL) {
+		fprintf(bat->err, _("Cannot open file: %s %d\n"), file, err);
+		return err;
+	}
+
+	/* Skip header */
+	err = read_wav_header(bat, file, fp, true);
+	if (err != 0)
+		goto out;
+
+	offset = ftello(fp);
+	if (offset < 0 || fstat(fileno(fp), &st) < 0) {
+		err = -errno;
+		goto out;
+	}
+	if (st.st_size <= offset) {
+		err = -EIO;
+		goto out;
+	}
+
+	map->size = st.st_size;
+	map->addr = mmap(NULL, map->size, PROT_READ, MAP_PRIVATE, fileno(fp), 0);
+	if (map->addr == MAP_FAILED) {
+		err = -errno;
+		map->addr = NULL;
+		fprintf(bat->err, _("Cannot map file: %s %d\n"), file, err);
+		goto out;
+	}
+	madvise(map->addr, map->size, MADV_SEQUENTIAL);
+
+	map->data = (char *) map->addr + offset;
+	map->frames = (st.st_size - offset) / bat->frame_size;
+	if (map->frames > bat->frames)
+		map->frames = bat->frames;
+
+out:
+	fclose(fp);
+	return err;
+}
+
+void unmap_wav_data(struct wav_map *map)
+{
+	if (map->addr != NULL)
+		munmap(map->addr, map->size);
+	memset(map, 0, sizeof(*map));
+}
+
 int write_wav_header(FILE *fp, struct wav_container *wav, struct bat *bat)
 {
 	int err = 0;
@@ -224,7 +286,7 @@ int update_wav_header(struct bat *bat, FILE *fp, int bytes)
 int generate_input_data(struct bat *bat, void *buffer, int bytes, int frames)
 {
 	int err;
-	static int load;
+	int load;
 
 	if (bat->playback.file != NULL) {
 		/* From input file */
@@ -251,14 +313,15 @@ int generate_input_data(struct bat *bat, void *buffer, int bytes, int frames)
 		}
 	} else {
 		/* Generate sine wave */
-		if ((bat->sinus_duration) && (load > bat->sinus_duration))
+		if ((bat->sinus_duration) &&
+				(bat->sinus_load > bat->sinus_duration))
 			return 1;
 
 		err = generate_sine_wave(bat, frames, buffer);
 		if (err != 0)
 			return err;
 
-		load += frames;
+		bat->sinus_load += frames;
 	}
 
 	return 0;
@@ -25,6 +25,14 @@
 #define OPT_ROUNDTRIPLATENCY		(OPT_BASE + 6)
 #define OPT_SNRTHD_DB			(OPT_BASE + 7)
 #define OPT_SNRTHD_PC			(OPT_BASE + 8)
+#define OPT_WISDOM			(OPT_BASE + 9)
+#define OPT_ONLINE			(OPT_BASE + 10)
+#define OPT_SWEEP			(OPT_BASE + 11)
+#define OPT_LATENCYXCORR		(OPT_BASE + 12)
+#define OPT_BATCH			(OPT_BASE + 13)
+#define OPT_MMAP			(OPT_BASE + 14)
+#define OPT_SOAK			(OPT_BASE + 15)
+#define OPT_PAIR			(OPT_BASE + 16)
 
 #define COMPOSE(a, b, c, d)		((a) | ((b)<<8) | ((c)<<16) | ((d)<<24))
 #define WAV_RIFF			COMPOSE('R', 'I', 'F', 'F')
@@ -56,7 +64,15 @@
 /* default period size for tinyalsa */
 #define TINYALSA_PERIODSIZE			1024
 
+/* device pairs tested in parallel by one process */
+#define MAX_PAIRS			32
+
 #define LATENCY_TEST_NUMBER			5
+/* runs of the cross-correlation latency test */
+#define LATENCY_XCORR_MAX			100
+/* chirp played by the cross-correlation latency test, in ms and Hz */
+#define LATENCY_CHIRP_TIME			50
+#define LATENCY_CHIRP_LOW			200
 #define LATENCY_TEST_TIME_LIMIT			25
 #define DIV_BUFFERSIZE			2
 
@@ -64,6 +80,7 @@
 #define ENOPEAK				(EBATBASE + 1)
 #define EONLYDC				(EBATBASE + 2)
 #define EBADPEAK			(EBATBASE + 3)
+#define EGLITCH				(EBATBASE + 4)
 
 #define DC_THRESHOLD			7.01
 
@@ -169,6 +186,7 @@ struct pcm {
 	char *file;
 	enum _bat_op_mode mode;
 	void *(*fct)(struct bat *);
+	int retval;			/* exit value of the thread */
 };
 
 struct sin_generator;
@@ -186,7 +204,7 @@ struct sin_generator {
 struct roundtrip_latency {
 	int number;
 	enum latency_state state;
-	float result[LATENCY_TEST_NUMBER];
+	float result[LATENCY_XCORR_MAX];
 	int final_result;
 	int samples;
 	float sum;
@@ -195,16 +213,22 @@ struct roundtrip_latency {
 	bool is_capturing;
 	bool is_playing;
 	bool xrun_error;
+
+	int xcorr_runs;			/* cross-correlation runs, 0 if not used */
+	float *capture;			/* capture since the chirp was started */
+	int chirp_pos;			/* chirp frames played */
 };
 
 struct noise_analyzer {
 	int nsamples;			/* number of sample */
-	float *source;			/* single-tone to be analyzed */
 	float *target;			/* target single-tone as standard */
 	float rms_tgt;			/* rms of target single-tone */
 	float snr_db;			/* snr in dB */
 };
 
+struct online;
+struct fft_plan;
+
 struct bat {
 	unsigned int rate;		/* sampling rate */
 	int channels;			/* nb of channels */
@@ -218,13 +242,26 @@ struct bat {
 	float sigma_k;			/* threshold for peak detection */
 	float snr_thd_db;		/* threshold for noise detection (dB) */
 	float target_freq[MAX_CHANNELS];
+	float sweep_low;		/* sweep range, disabled if high is 0 */
+	float sweep_high;
 
 	int sinus_duration;		/* number of frames for playback */
 	char *narg;			/* argument string of duration */
 	char *logarg;			/* path name of log file */
 	char *debugplay;		/* path name to store playback signal */
+	char *wisdom;			/* path name of FFTW wisdom file */
 	bool standalone;		/* enable to bypass analysis */
 	bool roundtriplatency;		/* enable round trip latency */
+	bool online;			/* analyze while capturing */
+	bool mmap;			/* mmap transfers */
+	bool soak;			/* loop until stopped, see online.c */
+	int soak_duration;		/* seconds, 0 for no limit */
+	struct online *analyzer;	/* online analyzer if running */
+	char *batch;			/* path name of batch test file */
+	bool keep_pcm;			/* keep the PCM open between cases */
+	struct fft_plan *plans;		/* kept between cases, per channel */
+	char **pairs;			/* "playback,capture" tested in parallel */
+	int pair_count;
 
 	struct pcm playback;
 	struct pcm capture;
@@ -243,6 +280,12 @@ struct bat {
 	void (*convert_float_to_sample)(float *, void *, int, int);
 
 	void *buf;			/* PCM Buffer */
+	/* state of the generated playback signal, one per job */
+	struct sin_generator sg[MAX_CHANNELS];
+	int sweep_pos;			/* frames into the sweep */
+	int sinus_load;			/* frames generated */
+	char *capture_buf;		/* capture in memory, without a file */
+	int capture_frames;		/* frames stored in capture_buf */
 
 	bool local;			/* true for internal test */
 };
@@ -256,6 +299,17 @@ struct analyze {
 
 void prepare_wav_info(struct wav_container *, struct bat *);
 int read_wav_header(struct bat *, char *, FILE *, bool);
+
+/* data chunk of a wav file mapped in memory, up to bat->frames */
+struct wav_map {
+	void *addr;
+	size_t size;
+	void *data;
+	int frames;
+};
+
+int map_wav_data(struct bat *, char *, struct wav_map *);
+void unmap_wav_data(struct wav_map *);
 int write_wav_header(FILE *, struct wav_container *, struct bat *);
 int update_wav_header(struct bat *, FILE *, int);
 int generate_input_data(struct bat *, void *, int, int);
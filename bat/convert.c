@@ -17,7 +17,15 @@
 #include <stddef.h>
 #include <stdlib.h>
 #include <stdint.h>
+#include <string.h>
 
+#include "sample-kernels.h"
+
+/*
+ * The wav files of bat are in little endian. The kernels load the samples
+ * by memcpy, since the data chunk of a mapped wav file can start at an
+ * offset not aligned to the size of sample.
+ */
 void convert_uint8_to_float(void *buf, float *val, int samples)
 {
 	int i;
@@ -28,86 +36,42 @@ void convert_uint8_to_float(void *buf, float *val, int samples)
 
 void convert_int16_to_float(void *buf, float *val, int samples)
 {
-	int i;
-
-	for (i = 0; i < samples; i++)
-		val[i] = ((int16_t *) buf)[i];
+	sample_s16le_to_float(buf, val, samples);
 }
 
 void convert_int24_to_float(void *buf, float *val, int samples)
 {
-	int i;
-	int32_t tmp;
-
-	for (i = 0; i < samples; i++) {
-		tmp = ((uint8_t *) buf)[i * 3 + 2] << 24;
-		tmp |= ((uint8_t *) buf)[i * 3 + 1] << 16;
-		tmp |= ((uint8_t *) buf)[i * 3] << 8;
-		tmp >>= 8;
-		val[i] = tmp;
-	}
+	sample_s24_3le_to_float(buf, val, samples);
 }
 
 void convert_int32_to_float(void *buf, float *val, int samples)
 {
-	int i;
-
-	for (i = 0; i < samples; i++)
-		val[i] = ((int32_t *) buf)[i];
+	sample_s32le_to_float(buf, val, samples);
 }
 
+/*
+ * The interleaved samples of all channels are converted alike, so each
+ * converter below is one flat loop which compilers vectorize.
+ */
 void convert_float_to_uint8(float *val, void *buf, int samples, int channels)
 {
-	int i, c, idx;
+	int i;
 
-	for (i = 0; i < samples; i++) {
-		for (c = 0; c < channels; c++) {
-			idx = i * channels + c;
-			((uint8_t *) buf)[idx] = (uint8_t) val[idx];
-		}
-	}
+	for (i = 0; i < samples * channels; i++)
+		((uint8_t *) buf)[i] = (uint8_t) val[i];
 }
 
 void convert_float_to_int16(float *val, void *buf, int samples, int channels)
 {
-	int i, c, idx;
-
-	for (i = 0; i < samples; i++) {
-		for (c = 0; c < channels; c++) {
-			idx = i * channels + c;
-			((int16_t *) buf)[idx] = (int16_t) val[idx];
-		}
-	}
+	sample_float_to_s16le(val, buf, samples * channels);
 }
 
 void convert_float_to_int24(float *val, void *buf, int samples, int channels)
 {
-	int i, c, idx_f, idx_i;
-	int32_t val_f_i;
-
-	for (i = 0; i < samples; i++) {
-		for (c = 0; c < channels; c++) {
-			idx_f = i * channels + c;
-			idx_i = 3 * idx_f;
-			val_f_i = (int32_t) val[idx_f];
-			((int8_t *) buf)[idx_i + 0] =
-				(int8_t) (val_f_i & 0xff);
-			((int8_t *) buf)[idx_i + 1] =
-				(int8_t) ((val_f_i >> 8) & 0xff);
-			((int8_t *) buf)[idx_i + 2] =
-				(int8_t) ((val_f_i >> 16) & 0xff);
-		}
-	}
+	sample_float_to_s24_3le(val, buf, samples * channels);
 }
 
 void convert_float_to_int32(float *val, void *buf, int samples, int channels)
 {
-	int i, c, idx;
-
-	for (i = 0; i < samples; i++) {
-		for (c = 0; c < channels; c++) {
-			idx = i * channels + c;
-			((int32_t *) buf)[idx] = (int32_t) val[idx];
-		}
-	}
+	sample_float_to_s32le(val, buf, samples * channels);
 }
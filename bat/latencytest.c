@@ -18,10 +18,16 @@
 #include <stdlib.h>
 #include <string.h>
 #include <stdbool.h>
+#include <errno.h>
 
+#include "aconfig.h"
 #include "common.h"
 #include "bat-signal.h"
+#include "latencytest.h"
 #include "gettext.h"
+#ifdef HAVE_LIBFFTW3F
+#include "analyze.h"
+#endif
 
 /* How one measurement step works:
    - Listen and measure the average loudness of the environment for 1 second.
@@ -153,6 +159,103 @@ static void play_and_listen(struct bat *bat, void *buffer, int frames)
 	return;
 }
 
+#ifdef HAVE_LIBFFTW3F
+/* the correlation peak must stand out of its rms */
+#define LATENCY_XCORR_RATIO	10.0
+
+static void xcorr_result(struct bat *bat)
+{
+	int n, num = bat->latency.xcorr_runs;
+	float *res = bat->latency.result;
+	double sum = 0.0, var = 0.0, mean;
+	float min = res[0], max = res[0];
+
+	for (n = 0; n < num; n++) {
+		sum += res[n];
+		if (res[n] < min)
+			min = res[n];
+		if (res[n] > max)
+			max = res[n];
+	}
+	mean = sum / num;
+	for (n = 0; n < num; n++)
+		var += (res[n] - mean) * (res[n] - mean);
+	if (num > 1)
+		var /= num - 1;
+
+	bat->latency.final_result = (int) (mean + 0.5);
+	fprintf(bat->log, _("Final round trip latency: %.3fms"), mean);
+	fprintf(bat->log, _(" (stddev %.3fms, min %.3fms, max %.3fms)\n"),
+			sqrt(var), min, max);
+}
+
+/* Capture one second from the start of the chirp, then find the chirp in
+   it by cross-correlation */
+static void xcorr_listen(struct bat *bat, void *buffer, int frames)
+{
+	int i, n, len, err, num = bat->latency.number;
+	float *ref, ratio = 0.0;
+	double delay;
+
+	if (bat->latency.capture == NULL) {
+		fprintf(bat->err, _("Not enough memory.\n"));
+		bat->latency.state = LATENCY_STATE_COMPLETE_FAILURE;
+		bat->latency.is_capturing = false;
+		return;
+	}
+
+	n = bat->rate - bat->latency.samples;
+	if (n > frames)
+		n = frames;
+	for (i = 0; i < n; i++)
+		bat->convert_sample_to_float((char *) buffer
+				+ i * bat->frame_size,
+				bat->latency.capture + bat->latency.samples + i, 1);
+	bat->latency.samples += n;
+	if (bat->latency.samples < bat->rate)
+		return;
+
+	len = chirp_length(bat);
+	ref = malloc(len * sizeof(float));
+	if (ref == NULL) {
+		err = -ENOMEM;
+	} else {
+		chirp_fill(bat, ref, 0, len);
+		err = xcorr_delay(bat->latency.capture, bat->rate, ref, len,
+				&delay, &ratio);
+		free(ref);
+	}
+
+	/* wait a full second before the next run */
+	bat->latency.samples = 0;
+	bat->latency.state = LATENCY_STATE_WAITING;
+
+	if (err < 0 || ratio < LATENCY_XCORR_RATIO) {
+		bat->latency.error++;
+		if (bat->latency.error > LATENCY_TEST_NUMBER) {
+			fprintf(bat->err, _("Could not detect signal."));
+			fprintf(bat->err, _("Too much background noise?\n"));
+			bat->latency.state = LATENCY_STATE_COMPLETE_FAILURE;
+			bat->latency.is_capturing = false;
+		}
+		return;
+	}
+
+	bat->latency.result[num - 1] = delay * 1000 / bat->rate;
+	fprintf(bat->log, _("Test%d, round trip latency %.3fms (%.2f frames)\n"),
+			num, bat->latency.result[num - 1], delay);
+
+	if (num == bat->latency.xcorr_runs) {
+		xcorr_result(bat);
+		bat->latency.state = LATENCY_STATE_COMPLETE_SUCCESS;
+		bat->latency.is_capturing = false;
+		return;
+	}
+
+	bat->latency.number++;
+}
+#endif
+
 static void calculate_threshold(struct bat *bat)
 {
 	float average;
@@ -180,6 +283,14 @@ void roundtrip_latency_init(struct bat *bat)
 	bat->latency.xrun_error = false;
 	bat->frames = LATENCY_TEST_TIME_LIMIT * bat->rate;
 	bat->periods_played = 0;
+
+	/* about three seconds per cross-correlation run */
+	if (bat->latency.xcorr_runs) {
+		bat->frames += 3 * bat->latency.xcorr_runs * bat->rate;
+		bat->latency.chirp_pos = 0;
+		if (bat->latency.capture == NULL)
+			bat->latency.capture = malloc(bat->rate * sizeof(float));
+	}
 }
 
 int handleinput(struct bat *bat, void *buffer, int frames)
@@ -201,6 +312,12 @@ int handleinput(struct bat *bat, void *buffer, int frames)
 
 	/* Playing sine wave and listening if it comes back */
 	case LATENCY_STATE_PLAY_AND_LISTEN:
+#ifdef HAVE_LIBFFTW3F
+		if (bat->latency.xcorr_runs) {
+			xcorr_listen(bat, buffer, frames);
+			break;
+		}
+#endif
 		play_and_listen(bat, buffer, frames);
 		break;
 
@@ -231,11 +348,118 @@ int handleoutput(struct bat *bat, void *buffer, int bytes, int frames)
 			&& bat->latency.is_capturing == false)
 		return bat->latency.state;
 
-	if (bat->latency.state == LATENCY_STATE_PLAY_AND_LISTEN)
+	if (bat->latency.state == LATENCY_STATE_PLAY_AND_LISTEN
+			&& bat->latency.xcorr_runs) {
+		err = generate_chirp(bat, bat->latency.chirp_pos, frames,
+				buffer);
+		bat->latency.chirp_pos += frames;
+	} else if (bat->latency.state == LATENCY_STATE_PLAY_AND_LISTEN) {
 		err = generate_sine_wave(bat, frames, buffer);
-	else
+	} else {
 		/* Output silence */
 		memset(buffer, 0, bytes);
+		bat->latency.chirp_pos = 0;
+	}
+
+	return err;
+}
+
+/*
+ * The playback and capture loops of the latency test, shared by the
+ * backends. The backend transfer returns 0 or a negative error and flags
+ * its xruns in bat->latency.xrun_error.
+ */
+int latencytest_output(struct bat *bat, void *buffer, int frames,
+		latency_transfer_t transfer, void *pcm)
+{
+	int err = 0;
+	int bytes = frames * bat->frame_size;
+
+	fprintf(bat->log, _("Play sample with %d frames buffer\n"), frames);
+
+	bat->latency.is_playing = true;
+
+	while (1) {
+		/* generate output data */
+		err = handleoutput(bat, buffer, bytes, frames);
+		if (err != 0)
+			break;
+
+		err = transfer(pcm, buffer, frames, bat);
+		if (err != 0)
+			break;
+
+		/* Xrun error, terminate the playback thread*/
+		if (bat->latency.xrun_error == true)
+			break;
+
+		if (bat->latency.state == LATENCY_STATE_COMPLETE_SUCCESS)
+			break;
+
+		bat->periods_played++;
+	}
+
+	bat->latency.is_playing = false;
+
+	return err;
+}
+
+int latencytest_input(struct bat *bat, void *buffer, int frames,
+		latency_transfer_t transfer, void *pcm)
+{
+	int err = 0;
+	FILE *fp = NULL;
+	int bytes_read = 0;
+	int size = frames * bat->frame_size;
+	int bytes_count = bat->frames * bat->frame_size;
+
+	remove(bat->capture.file);
+	fp = fopen(bat->capture.file, "wb");
+	err = -errno;
+	if (fp == NULL) {
+		fprintf(bat->err, _("Cannot open file: %s %d\n"),
+				bat->capture.file, err);
+		return err;
+	}
+	/* leave space for file header */
+	if (fseek(fp, sizeof(struct wav_container), SEEK_SET) != 0) {
+		err = -errno;
+		fclose(fp);
+		return err;
+	}
+
+	bat->latency.is_capturing = true;
+
+	while (bytes_read < bytes_count) {
+		/* read a chunk from pcm device */
+		err = transfer(pcm, buffer, frames, bat);
+		if (err != 0)
+			break;
+
+		/* Xrun error, terminate the capture thread*/
+		if (bat->latency.xrun_error == true)
+			break;
+
+		err = handleinput(bat, buffer, frames);
+		if (err != 0)
+			break;
+
+		if (bat->latency.is_playing == false)
+			break;
+
+		/* write the chunk to file */
+		if (fwrite(buffer, 1, size, fp) != size) {
+			err = -EIO;
+			break;
+		}
+
+		bytes_read += size;
+	}
+
+	bat->latency.is_capturing = false;
+
+	update_wav_header(bat, fp, bytes_read);
 
+	fclose(fp);
 	return err;
 }
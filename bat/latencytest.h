@@ -15,3 +15,9 @@
 void roundtrip_latency_init(struct bat *);
 int handleinput(struct bat *, void *, int);
 int handleoutput(struct bat *, void *, int, int);
+
+typedef int (*latency_transfer_t)(void *pcm, void *buffer, int frames,
+		struct bat *bat);
+
+int latencytest_output(struct bat *, void *, int, latency_transfer_t, void *);
+int latencytest_input(struct bat *, void *, int, latency_transfer_t, void *);
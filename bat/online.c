@@ -0,0 +1,811 @@
+/*
+ * Copyright (C) 2026 agent <agent@local>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <pthread.h>
+#include <signal.h>
+#include <time.h>
+
+#include <math.h>
+
+#include "aconfig.h"
+#include "gettext.h"
+
+#include "common.h"
+#include "analyze.h"
+#include "online.h"
+
+/*
+ * Online analysis: the capture thread copies each period to a ring and
+ * an analyzer thread consumes it, so nothing is written to disk. The
+ * spectrum is estimated with Welch's method: Hann windowed FFTs over
+ * half-overlapping windows, with the power averaged over the windows.
+ * The noise sections are checked as soon as their two sine periods have
+ * arrived. Once enough windows are seen, the verdict is printed and the
+ * capture and playback loops stop early.
+ */
+
+/* averaged windows needed for the verdict */
+#define ONLINE_WINDOWS			4
+/* frames handled at a time by the analyzer */
+#define ONLINE_CHUNK			1024
+/* ring size, given in seconds */
+#define ONLINE_RING			2
+
+/*
+ * Soak test: the analysis never ends by itself. Every window gives an SNR
+ * and a THD from its own spectrum, rolled into statistics for each report
+ * interval and for the whole run. Each sample is also checked against the
+ * two before it: a sine satisfies x[n] = 2 cos(w) x[n-1] - x[n-2], so the
+ * residual jumps at a discontinuity. The level of short blocks is compared
+ * to a slowly tracked reference to catch the drops. The memory used does
+ * not grow with the duration.
+ */
+
+/* seconds between two reports */
+#define SOAK_REPORT			60
+/* bins on each side of a peak, the Blackman-Harris main lobe is 4 */
+#define SOAK_PEAK_BINS			6
+#define SOAK_HARMONICS			5
+/* a jump of the residual above its rms by this ratio is a glitch */
+#define SOAK_JUMP_RATIO			10.0
+/* and above the amplitude by this ratio */
+#define SOAK_JUMP_MIN			0.01
+/* level blocks per second, a drop below 6 dB of the reference */
+#define SOAK_BLOCKS			100
+#define SOAK_DROP			0.25
+/* glitches logged per report interval, the others are only counted */
+#define SOAK_LOG_MAX			20
+
+struct soak_stats {
+	long long windows;
+	double snr_sum;
+	float snr_min;
+	float snr_max;
+	float thd_max;
+	int jumps;
+	int drops;
+};
+
+struct soak_channel {
+	struct soak_stats interval;
+	struct soak_stats total;
+	double coef;			/* 2 cos(w) */
+	float x1, x2;			/* last two samples */
+	double res_ms;			/* reference mean square of residual */
+	double level_ms;		/* reference mean square of signal */
+	double block_res;
+	double block_level;
+	int block_filled;
+	bool block_jump;		/* a jump happened in the block */
+	bool in_drop;
+	long long holdoff;		/* no new jump before this frame */
+};
+
+struct online_channel {
+	float *hist;			/* last samples, one window */
+	int hist_filled;
+	double *power;			/* accumulated power spectrum */
+	float *mag;
+	int windows;			/* windows in power */
+
+	struct noise_analyzer na;
+	struct noise_stats st;
+	float *nbuf;			/* samples of pending noise sections */
+	int nbuf_filled;
+	int noise_err;
+
+	struct soak_channel soak;
+};
+
+struct online {
+	struct bat *bat;
+	pthread_t thread;
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+
+	char *ring;
+	int ring_frames;
+	int ring_head;			/* first filled frame */
+	int ring_count;			/* filled frames */
+	int dropped;			/* frames lost on a full ring */
+	bool eof;			/* no more data will come */
+	bool done;			/* verdict is given */
+	int err;			/* verdict */
+
+	bool spectrum;			/* check the peaks */
+	bool noise;			/* check the noise */
+	long long frames;		/* frames analyzed */
+	int window;			/* FFT length */
+	float *taper;			/* Hann, Blackman-Harris when soaking */
+	struct fft_plan fft;
+
+	bool soak;			/* until stopped, see above */
+	long long soak_end;		/* frames, 0 for no limit */
+	long long next_report;
+	int logged;			/* glitches logged in the interval */
+
+	char *frames_buf;		/* interleaved chunk taken from the ring */
+	char *sample_buf;		/* one channel of the chunk */
+	float *float_buf;
+	struct online_channel ch[MAX_CHANNELS];
+};
+
+static volatile sig_atomic_t soak_stop;
+
+static void soak_signal(int sig)
+{
+	soak_stop = 1;
+}
+
+static void soak_stats_add(struct soak_stats *st, float snr, float thd)
+{
+	if (st->windows == 0 || snr < st->snr_min)
+		st->snr_min = snr;
+	if (st->windows == 0 || snr > st->snr_max)
+		st->snr_max = snr;
+	if (thd > st->thd_max)
+		st->thd_max = thd;
+	st->snr_sum += snr;
+	st->windows++;
+}
+
+/* power of the bins around f, away from the DC */
+static double soak_band(struct online *o, float f)
+{
+	int k, lo, hi, W = o->window;
+	float *out = o->fft.out;
+	double sum = 0.0;
+
+	k = lrintf(f * W / o->bat->rate);
+	lo = k - SOAK_PEAK_BINS;
+	hi = k + SOAK_PEAK_BINS;
+	if (lo <= SOAK_PEAK_BINS)
+		lo = SOAK_PEAK_BINS + 1;
+	if (hi >= W / 2)
+		hi = W / 2 - 1;
+	for (k = lo; k <= hi; k++)
+		sum += out[k] * out[k] + out[W - k] * out[W - k];
+
+	return sum;
+}
+
+/* SNR and THD of the window just transformed */
+static void soak_spectrum(struct online *o, int c)
+{
+	struct bat *bat = o->bat;
+	struct soak_channel *sc = &o->ch[c].soak;
+	float f = bat->target_freq[c];
+	double total, sig, harm = 0.0, noise;
+	float snr, thd;
+	int h;
+
+	total = 0.0;
+	for (h = SOAK_PEAK_BINS + 1; h < o->window / 2; h++)
+		total += o->fft.out[h] * o->fft.out[h]
+				+ o->fft.out[o->window - h]
+				* o->fft.out[o->window - h];
+
+	sig = soak_band(o, f);
+	if (sig <= 0.0)
+		return;
+	for (h = 2; h <= SOAK_HARMONICS; h++)
+		if (h * f < bat->rate / 2.0
+				- (SOAK_PEAK_BINS + 1.0) * bat->rate / o->window)
+			harm += soak_band(o, h * f);
+	noise = total - sig - harm;
+	/* a digital loopback can be cleaner than the float precision */
+	if (noise < sig * 1e-15)
+		noise = sig * 1e-15;
+
+	snr = 10.0 * log10(sig / noise);
+	thd = 100.0 * sqrt(harm / sig);
+	soak_stats_add(&sc->interval, snr, thd);
+	soak_stats_add(&sc->total, snr, thd);
+}
+
+static void soak_glitch(struct online *o, int c, long long frame,
+		const char *kind)
+{
+	struct bat *bat = o->bat;
+	char date[32];
+	time_t t;
+	struct tm tm;
+
+	if (o->logged++ >= SOAK_LOG_MAX)
+		return;
+
+	t = time(NULL);
+	localtime_r(&t, &tm);
+	strftime(date, sizeof(date), "%Y-%m-%d %H:%M:%S", &tm);
+	fprintf(bat->log, _("%s  channel %d: %s at frame %lld (%.3f s)\n"),
+			date, c + 1, kind, frame, (double) frame / bat->rate);
+	if (o->logged == SOAK_LOG_MAX)
+		fprintf(bat->log, _("Further glitches of this interval are only counted\n"));
+}
+
+static void soak_block(struct online *o, int c, long long frame)
+{
+	struct soak_channel *sc = &o->ch[c].soak;
+	double level = sc->block_level / sc->block_filled;
+	double res = sc->block_res / sc->block_filled;
+
+	/* the first second only learns the references */
+	if (frame < o->bat->rate) {
+		sc->level_ms = sc->level_ms == 0.0 ? level
+				: 0.8 * sc->level_ms + 0.2 * level;
+		sc->res_ms = sc->res_ms == 0.0 ? res
+				: 0.8 * sc->res_ms + 0.2 * res;
+	} else if (level < SOAK_DROP * sc->level_ms) {
+		if (!sc->in_drop) {
+			soak_glitch(o, c, frame, _("level drop"));
+			sc->interval.drops++;
+			sc->total.drops++;
+		}
+		sc->in_drop = true;
+	} else {
+		sc->in_drop = false;
+		sc->level_ms = 0.99 * sc->level_ms + 0.01 * level;
+		if (!sc->block_jump)
+			sc->res_ms = 0.99 * sc->res_ms + 0.01 * res;
+	}
+
+	sc->block_level = 0.0;
+	sc->block_res = 0.0;
+	sc->block_filled = 0;
+	sc->block_jump = false;
+}
+
+static void soak_samples(struct online *o, int c, float *src, int n)
+{
+	struct bat *bat = o->bat;
+	struct soak_channel *sc = &o->ch[c].soak;
+	int i, block = bat->rate / SOAK_BLOCKS;
+	long long frame;
+	double e, thr;
+
+	for (i = 0; i < n; i++) {
+		frame = o->frames + i;
+		e = src[i] - sc->coef * sc->x1 + sc->x2;
+		sc->x2 = sc->x1;
+		sc->x1 = src[i];
+
+		if (frame >= bat->rate && frame >= sc->holdoff) {
+			thr = SOAK_JUMP_RATIO * SOAK_JUMP_RATIO * sc->res_ms;
+			if (thr < SOAK_JUMP_MIN * SOAK_JUMP_MIN * 2.0
+					* sc->level_ms)
+				thr = SOAK_JUMP_MIN * SOAK_JUMP_MIN * 2.0
+						* sc->level_ms;
+			if (e * e > thr) {
+				soak_glitch(o, c, frame, _("discontinuity"));
+				sc->interval.jumps++;
+				sc->total.jumps++;
+				sc->holdoff = frame + block;
+				sc->block_jump = true;
+			}
+		}
+
+		if (frame >= 2)
+			sc->block_res += e * e;
+		sc->block_level += src[i] * src[i];
+		if (++sc->block_filled == block)
+			soak_block(o, c, frame);
+	}
+}
+
+static void soak_report(struct online *o, const char *title, bool total)
+{
+	struct bat *bat = o->bat;
+	struct soak_stats *st;
+	int c, dropped;
+
+	pthread_mutex_lock(&o->lock);
+	dropped = o->dropped;
+	pthread_mutex_unlock(&o->lock);
+
+	fprintf(bat->log, _("\n%s: %lld frames (%.0f s), %d frames dropped\n"),
+			title, o->frames, (double) o->frames / bat->rate,
+			dropped);
+	for (c = 0; c < bat->channels; c++) {
+		st = total ? &o->ch[c].soak.total : &o->ch[c].soak.interval;
+		fprintf(bat->log, _("  channel %d: "), c + 1);
+		if (st->windows > 0)
+			fprintf(bat->log, _("SNR %.1f/%.1f/%.1f dB (min/avg/max), THD max %.3f%%, "),
+					st->snr_min, st->snr_sum / st->windows,
+					st->snr_max, st->thd_max);
+		fprintf(bat->log, _("%d discontinuities, %d level drops\n"),
+				st->jumps, st->drops);
+	}
+	fflush(bat->log);
+}
+
+/* true when the soak test is to stop */
+static bool soak_check(struct online *o)
+{
+	int c;
+
+	if (o->frames >= o->next_report) {
+		soak_report(o, _("Soak interval"), false);
+		for (c = 0; c < o->bat->channels; c++)
+			memset(&o->ch[c].soak.interval, 0,
+					sizeof(struct soak_stats));
+		o->logged = 0;
+		o->next_report += (long long) o->bat->rate * SOAK_REPORT;
+	}
+
+	return soak_stop || (o->soak_end > 0 && o->frames >= o->soak_end);
+}
+
+static void soak_verdict(struct online *o)
+{
+	struct bat *bat = o->bat;
+	struct soak_stats *st;
+	int c, err = 0;
+
+	soak_report(o, _("Soak test total"), true);
+
+	for (c = 0; c < bat->channels; c++) {
+		st = &o->ch[c].soak.total;
+		if (st->windows == 0) {
+			fprintf(bat->err, _("Not enough data for analysis\n"));
+			err = -ENOPEAK;
+		} else if (st->jumps > 0 || st->drops > 0) {
+			fprintf(bat->err, _(" FAIL: glitches on channel %d\n"),
+					c + 1);
+			err = -EGLITCH;
+		} else if (snr_is_valid(bat->snr_thd_db)
+				&& st->snr_min < bat->snr_thd_db) {
+			fprintf(bat->err, _(" FAIL: SNR of channel %d down to %.1f dB\n"),
+					c + 1, st->snr_min);
+			err = -EGLITCH;
+		}
+		if (err != 0)
+			break;
+	}
+	if (err == 0)
+		fprintf(bat->log, _(" PASS: no glitch\n"));
+
+	pthread_mutex_lock(&o->lock);
+	o->err = err;
+	o->done = true;
+	pthread_mutex_unlock(&o->lock);
+}
+
+static void welch_window(struct online *o, struct online_channel *ch)
+{
+	int i, W = o->window;
+	float mean = 0.0;
+	float *out = o->fft.out;
+
+	for (i = 0; i < W; i++)
+		mean += ch->hist[i];
+	mean /= W;
+	for (i = 0; i < W; i++)
+		o->fft.in[i] = (ch->hist[i] - mean) * o->taper[i];
+
+	fft_execute(&o->fft);
+
+	if (o->soak) {
+		soak_spectrum(o, ch - o->ch);
+	} else {
+		for (i = 1; i < W / 2; i++)
+			ch->power[i] += out[i] * out[i]
+					+ out[W - i] * out[W - i];
+	}
+	ch->windows++;
+
+	/* keep the second half for the next window */
+	memmove(ch->hist, ch->hist + W / 2, sizeof(float) * W / 2);
+	ch->hist_filled = W / 2;
+}
+
+static void welch_add(struct online *o, struct online_channel *ch,
+		float *src, int n)
+{
+	int k;
+
+	while (n > 0) {
+		k = o->window - ch->hist_filled;
+		if (k > n)
+			k = n;
+		memcpy(ch->hist + ch->hist_filled, src, sizeof(float) * k);
+		ch->hist_filled += k;
+		src += k;
+		n -= k;
+		if (ch->hist_filled == o->window)
+			welch_window(o, ch);
+	}
+}
+
+static void noise_add(struct online *o, struct online_channel *ch,
+		float *src, int n, int channel)
+{
+	int err, pos = 0, nsamples = ch->na.nsamples;
+
+	if (ch->noise_err != 0)
+		return;
+	memcpy(ch->nbuf + ch->nbuf_filled, src, sizeof(float) * n);
+	ch->nbuf_filled += n;
+
+	/* each section has 2 sine periods, the next starts a period later */
+	while (ch->nbuf_filled - pos >= nsamples * 2) {
+		err = noise_analyzer_section(o->bat, &ch->na, ch->nbuf + pos,
+				channel, &ch->st);
+		if (err < 0) {
+			ch->noise_err = err;
+			return;
+		}
+		pos += nsamples;
+	}
+
+	memmove(ch->nbuf, ch->nbuf + pos,
+			sizeof(float) * (ch->nbuf_filled - pos));
+	ch->nbuf_filled -= pos;
+}
+
+static void online_process(struct online *o, int n)
+{
+	struct bat *bat = o->bat;
+	int c, i;
+
+	for (c = 0; c < bat->channels; c++) {
+		for (i = 0; i < n; i++)
+			memcpy(o->sample_buf + i * bat->sample_size,
+					o->frames_buf + i * bat->frame_size
+					+ c * bat->sample_size,
+					bat->sample_size);
+		bat->convert_sample_to_float(o->sample_buf, o->float_buf, n);
+
+		if (o->spectrum)
+			welch_add(o, &o->ch[c], o->float_buf, n);
+		if (o->noise)
+			noise_add(o, &o->ch[c], o->float_buf, n, c);
+		if (o->soak)
+			soak_samples(o, c, o->float_buf, n);
+	}
+	o->frames += n;
+}
+
+static int online_check_channel(struct online *o, int c)
+{
+	struct bat *bat = o->bat;
+	struct online_channel *ch = &o->ch[c];
+	int err, i;
+
+	fprintf(bat->log, _("\nChannel %i - "), c + 1);
+	fprintf(bat->log, _("Checking for target frequency %2.2f Hz\n"),
+			bat->target_freq[c]);
+
+	if (o->spectrum) {
+		if (ch->windows == 0) {
+			fprintf(bat->err, _("Not enough data for analysis\n"));
+			return -ENOPEAK;
+		}
+		for (i = 1; i < o->window / 2; i++)
+			ch->mag[i] = sqrtf(ch->power[i] / ch->windows);
+		ch->mag[0] = 0.0;
+
+		err = check_spectrum(bat, ch->mag, o->window, c);
+		if (err != 0)
+			return err;
+	}
+
+	if (o->noise) {
+		fprintf(bat->log, _("\nChecking for SNR: "));
+		fprintf(bat->log, _("Threshold is %.2f dB (%.2f%%)\n"),
+				bat->snr_thd_db, 100.0
+				/ powf(10.0, bat->snr_thd_db / 20.0));
+		fprintf(bat->log, _("samples per period: %d\n"),
+				ch->na.nsamples);
+		fprintf(bat->log, _("total sections detected: %d\n"),
+				ch->st.clean + ch->st.noise);
+		if (ch->noise_err != 0)
+			return ch->noise_err;
+		return noise_report(bat, &ch->st);
+	}
+
+	return 0;
+}
+
+static void online_verdict(struct online *o)
+{
+	struct bat *bat = o->bat;
+	int c, err = 0;
+
+	fprintf(bat->log, _("\nBAT online analysis: %lld frames at %d Hz,"),
+			o->frames, bat->rate);
+	if (o->spectrum)
+		fprintf(bat->log, _(" %d windows of %d frames.\n"),
+				o->ch[0].windows, o->window);
+	else
+		fprintf(bat->log, _(" noise only.\n"));
+
+	for (c = 0; c < bat->channels; c++) {
+		err = online_check_channel(o, c);
+		if (err != 0)
+			break;
+	}
+
+	pthread_mutex_lock(&o->lock);
+	o->err = err;
+	o->done = true;
+	pthread_mutex_unlock(&o->lock);
+}
+
+static void *online_thread(void *arg)
+{
+	struct online *o = arg;
+	struct bat *bat = o->bat;
+	/* half-overlapped windows, the first one needs full data */
+	long long needed = (long long)(ONLINE_WINDOWS + 1) * o->window / 2;
+	int n;
+
+	for (;;) {
+		pthread_mutex_lock(&o->lock);
+		while (o->ring_count == 0 && !o->eof)
+			pthread_cond_wait(&o->cond, &o->lock);
+		if (o->ring_count == 0) {
+			pthread_mutex_unlock(&o->lock);
+			break;
+		}
+		n = o->ring_count;
+		if (n > ONLINE_CHUNK)
+			n = ONLINE_CHUNK;
+		if (n > o->ring_frames - o->ring_head)
+			n = o->ring_frames - o->ring_head;
+		memcpy(o->frames_buf, o->ring + o->ring_head * bat->frame_size,
+				n * bat->frame_size);
+		o->ring_head = (o->ring_head + n) % o->ring_frames;
+		o->ring_count -= n;
+		pthread_mutex_unlock(&o->lock);
+
+		online_process(o, n);
+		if (o->soak ? soak_check(o) : o->frames >= needed)
+			break;
+	}
+
+	/* also gives the verdict when the capture ended early */
+	if (o->soak)
+		soak_verdict(o);
+	else
+		online_verdict(o);
+
+	return NULL;
+}
+
+static void online_free(struct online *o)
+{
+	int c;
+
+	for (c = 0; c < MAX_CHANNELS; c++) {
+		free(o->ch[c].hist);
+		free(o->ch[c].power);
+		free(o->ch[c].mag);
+		free(o->ch[c].nbuf);
+		noise_analyzer_free(&o->ch[c].na);
+	}
+	fft_free(&o->fft);
+	free(o->taper);
+	free(o->float_buf);
+	free(o->sample_buf);
+	free(o->frames_buf);
+	free(o->ring);
+	free(o);
+}
+
+int online_start(struct bat *bat)
+{
+	struct online *o;
+	struct online_channel *ch;
+	int c, i, W, err;
+
+	o = calloc(1, sizeof(*o));
+	if (o == NULL)
+		return -ENOMEM;
+	o->bat = bat;
+	o->spectrum = !bat->standalone;
+	o->noise = snr_is_valid(bat->snr_thd_db);
+	o->soak = bat->soak;
+	if (o->soak) {
+		/* the SNR threshold applies to the rolling spectra */
+		o->noise = false;
+		o->soak_end = (long long) bat->soak_duration * bat->rate;
+		o->next_report = (long long) bat->rate * SOAK_REPORT;
+	}
+
+	/* the largest power of two not above the rate keeps the bin
+	 * resolution below 2 Hz, the peak is found within 1 Hz */
+	for (W = 1 << SHIFT_MIN; W * 2 <= bat->rate; W *= 2)
+		;
+	o->window = W;
+
+	o->ring_frames = bat->rate * ONLINE_RING;
+	o->ring = malloc(o->ring_frames * bat->frame_size);
+	o->frames_buf = malloc(ONLINE_CHUNK * bat->frame_size);
+	o->sample_buf = malloc(ONLINE_CHUNK * bat->sample_size);
+	o->float_buf = malloc(sizeof(float) * ONLINE_CHUNK);
+	if (!o->ring || !o->frames_buf || !o->sample_buf || !o->float_buf) {
+		err = -ENOMEM;
+		goto fail;
+	}
+
+	if (o->spectrum) {
+		fft_import_wisdom(bat);
+		err = fft_prepare(bat, &o->fft, W);
+		if (err < 0)
+			goto fail;
+		o->taper = malloc(sizeof(float) * W);
+		if (o->taper == NULL) {
+			err = -ENOMEM;
+			goto fail;
+		}
+		/* the SNR of a single window needs the low sidelobes of
+		 * the 4 term Blackman-Harris window */
+		for (i = 0; i < W; i++) {
+			if (o->soak)
+				o->taper[i] = 0.35875
+					- 0.48829 * cosf(2.0 * M_PI * i / W)
+					+ 0.14128 * cosf(4.0 * M_PI * i / W)
+					- 0.01168 * cosf(6.0 * M_PI * i / W);
+			else
+				o->taper[i] = 0.5 - 0.5
+					* cosf(2.0 * M_PI * i / W);
+		}
+	}
+
+	for (c = 0; c < bat->channels; c++) {
+		ch = &o->ch[c];
+		if (o->spectrum) {
+			ch->hist = malloc(sizeof(float) * W);
+			ch->power = calloc(W / 2, sizeof(double));
+			ch->mag = calloc(W / 2, sizeof(float));
+			if (!ch->hist || !ch->power || !ch->mag) {
+				err = -ENOMEM;
+				goto fail;
+			}
+		}
+		ch->soak.coef = 2.0 * cos(2.0 * M_PI * bat->target_freq[c]
+				/ bat->rate);
+		if (o->noise) {
+			err = noise_analyzer_init(bat, &ch->na, c);
+			if (err < 0)
+				goto fail;
+			ch->nbuf = malloc(sizeof(float) *
+					(ch->na.nsamples * 2 + ONLINE_CHUNK));
+			if (!ch->nbuf) {
+				err = -ENOMEM;
+				goto fail;
+			}
+		}
+	}
+
+	pthread_mutex_init(&o->lock, NULL);
+	pthread_cond_init(&o->cond, NULL);
+	err = pthread_create(&o->thread, NULL, online_thread, o);
+	if (err != 0) {
+		fprintf(bat->err, _("Cannot create analysis thread: %d\n"),
+				err);
+		pthread_cond_destroy(&o->cond);
+		pthread_mutex_destroy(&o->lock);
+		err = -err;
+		goto fail;
+	}
+
+	if (o->soak) {
+		struct sigaction sa;
+
+		memset(&sa, 0, sizeof(sa));
+		sa.sa_handler = soak_signal;
+		sa.sa_flags = SA_RESTART;
+		sigaction(SIGINT, &sa, NULL);
+		sigaction(SIGTERM, &sa, NULL);
+		fprintf(bat->log, _("Soak test, report every %d s, "),
+				SOAK_REPORT);
+		if (bat->soak_duration > 0)
+			fprintf(bat->log, _("stop after %d s\n"),
+					bat->soak_duration);
+		else
+			fprintf(bat->log, _("stop with SIGINT or SIGTERM\n"));
+	}
+
+	bat->analyzer = o;
+	return 0;
+
+fail:
+	online_free(o);
+	return err;
+}
+
+/**
+ * Called by the capture thread for each period. It never blocks on the
+ * analyzer, a full ring drops the data and fails the test.
+ */
+void online_feed(struct bat *bat, void *buf, int frames)
+{
+	struct online *o = bat->analyzer;
+	int n, pos;
+
+	pthread_mutex_lock(&o->lock);
+	if (o->done || o->eof)
+		goto out;
+	if (frames > o->ring_frames - o->ring_count) {
+		o->dropped += frames - (o->ring_frames - o->ring_count);
+		frames = o->ring_frames - o->ring_count;
+	}
+	pos = (o->ring_head + o->ring_count) % o->ring_frames;
+	while (frames > 0) {
+		n = o->ring_frames - pos;
+		if (n > frames)
+			n = frames;
+		memcpy(o->ring + pos * bat->frame_size, buf,
+				n * bat->frame_size);
+		buf = (char *)buf + n * bat->frame_size;
+		o->ring_count += n;
+		frames -= n;
+		pos = 0;
+	}
+	pthread_cond_signal(&o->cond);
+out:
+	pthread_mutex_unlock(&o->lock);
+}
+
+bool online_done(struct bat *bat)
+{
+	struct online *o = bat->analyzer;
+	bool done;
+
+	pthread_mutex_lock(&o->lock);
+	done = o->done;
+	pthread_mutex_unlock(&o->lock);
+
+	return done;
+}
+
+/**
+ * Wait for the verdict, with the data captured so far if it is not given
+ * yet, and release the analyzer
+ */
+int online_finish(struct bat *bat)
+{
+	struct online *o = bat->analyzer;
+	int err;
+
+	pthread_mutex_lock(&o->lock);
+	o->eof = true;
+	pthread_cond_signal(&o->cond);
+	pthread_mutex_unlock(&o->lock);
+
+	pthread_join(o->thread, NULL);
+	pthread_cond_destroy(&o->cond);
+	pthread_mutex_destroy(&o->lock);
+
+	err = o->err;
+	if (o->dropped > 0) {
+		fprintf(bat->err, _("Analysis too slow, %d frames dropped\n"),
+				o->dropped);
+		if (err == 0)
+			err = -EPIPE;
+	}
+
+	bat->analyzer = NULL;
+	online_free(o);
+
+	return err;
+}
@@ -0,0 +1,25 @@
+/*
+ * Copyright (C) 2026 agent <agent@local>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ */
+
+#ifdef HAVE_LIBFFTW3F
+int online_start(struct bat *);
+void online_feed(struct bat *, void *, int);
+bool online_done(struct bat *);
+int online_finish(struct bat *);
+#else
+/* without libfftw3 there is no analyzer, bat->analyzer stays NULL */
+static inline void online_feed(struct bat *bat, void *buf, int frames) {}
+static inline bool online_done(struct bat *bat) { return false; }
+#endif
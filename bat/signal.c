@@ -78,35 +78,92 @@ float sin_generator_next_sample(struct sin_generator *sg)
 	return (float)sr;
 }
 
+/* fills every stride-th element, one channel of an interleaved buffer */
+void sin_generator_vfill_stride(struct sin_generator *sg, float *buf, int n,
+		int stride)
+{
+	int i;
+	for (i = 0; i < n; i++, buf += stride)
+		*buf = sin_generator_next_sample(sg);
+}
+
 /* fills a vector with a sine wave */
 void sin_generator_vfill(struct sin_generator *sg, float *buf, int n)
 {
-	int i;
-	for (i = 0; i < n; i++)
-		*buf++ = sin_generator_next_sample(sg);
+	sin_generator_vfill_stride(sg, buf, n, 1);
 }
 
-static int reorder(struct bat *bat, float *val, int frames)
+/*
+ * The sweep is exponential from sweep_low to sweep_high and repeats every
+ * sweep_length() frames, a power of two of at least one second. Being
+ * periodic, any period of the capture is a circular shift of the played
+ * one, so the analysis needs no synchronization with the playback.
+ */
+int sweep_length(struct bat *bat)
 {
-	float *new_buf = NULL;
-	int i, c, bytes;
+	int n;
 
-	bytes = frames * bat->channels * sizeof(float);
+	for (n = 1 << SHIFT_MIN; n < bat->rate; n <<= 1)
+		;
+	return n;
+}
 
-	new_buf = (float *) malloc(bytes);
-	if (new_buf == NULL) {
-		fprintf(bat->err, _("Not enough memory.\n"));
-		return -ENOMEM;
+/* fills a vector with the sweep, from frame pos of the period */
+void sweep_fill(struct bat *bat, float *buf, int pos, int n)
+{
+	int i, N = sweep_length(bat);
+	/* time for the frequency to rise by e */
+	double L = (double) N / bat->rate
+			/ log(bat->sweep_high / bat->sweep_low);
+	double w = 2.0 * M_PI * bat->sweep_low * L;
+	double t;
+
+	for (i = 0; i < n; i++, pos++) {
+		t = (double) (pos % N) / bat->rate;
+		buf[i] = sin(w * (exp(t / L) - 1.0));
 	}
+}
 
-	memcpy(new_buf, val, bytes);
-	for (i = 0; i < frames; i++)
-		for (c = 0; c < bat->channels; c++)
-			val[i * bat->channels + c] =
-				new_buf[c * frames + i];
-	free(new_buf);
+/*
+ * Probe of the cross-correlation latency test: a linear chirp over most of
+ * the band with a Hann envelope, its autocorrelation is a narrow peak.
+ */
+int chirp_length(struct bat *bat)
+{
+	return bat->rate * LATENCY_CHIRP_TIME / 1000;
+}
 
-	return 0;
+/* fills a vector with the chirp from frame pos, silence after its end */
+void chirp_fill(struct bat *bat, float *buf, int pos, int n)
+{
+	int i, len = chirp_length(bat);
+	double f0 = LATENCY_CHIRP_LOW, f1 = bat->rate * RATE_FACTOR;
+	double t, T = (double) len / bat->rate;
+
+	for (i = 0; i < n; i++, pos++) {
+		if (pos >= len) {
+			buf[i] = 0.0;
+			continue;
+		}
+		t = (double) pos / bat->rate;
+		buf[i] = sin(2.0 * M_PI * (f0 * t + (f1 - f0) * t * t / T / 2))
+				* (0.5 - 0.5 * cos(2.0 * M_PI * pos / len));
+	}
+}
+
+/*
+ * Spread a mono signal in the first frames of val to all channels,
+ * interleaved. Going backwards, no sample is overwritten before use.
+ */
+static void spread_channels(struct bat *bat, float *val, int frames)
+{
+	int i, c;
+
+	if (bat->channels == 1)
+		return;
+	for (i = frames - 1; i >= 0; i--)
+		for (c = bat->channels - 1; c >= 0; c--)
+			val[i * bat->channels + c] = val[i];
 }
 
 static int adjust_waveform(struct bat *bat, float *val, int frames,
@@ -148,7 +205,7 @@ int generate_sine_wave(struct bat *bat, int frames, void *buf)
 	int err = 0;
 	int c, nsamples;
 	float *sinus_f = NULL;
-	static struct sin_generator sg[MAX_CHANNELS];
+	struct sin_generator *sg = bat->sg;
 
 	nsamples = bat->channels * frames;
 	sinus_f = (float *) malloc(nsamples * sizeof(float));
@@ -157,21 +214,53 @@ int generate_sine_wave(struct bat *bat, int frames, void *buf)
 		return -ENOMEM;
 	}
 
+	if (bat->sweep_high > 0.0) {
+		/* all channels play the same sweep */
+		sweep_fill(bat, sinus_f, bat->sweep_pos, frames);
+		spread_channels(bat, sinus_f, frames);
+		bat->sweep_pos = (bat->sweep_pos + frames) % sweep_length(bat);
+		goto adjust;
+	}
+
 	for (c = 0; c < bat->channels; c++) {
-		/* initialize static struct at the first time */
+		/* initialize the generator at the first time */
 		if (sg[c].frequency != bat->target_freq[c])
 			sin_generator_init(&sg[c], 1.0, bat->target_freq[c],
 					bat->rate);
-		/* fill buffer for each channel */
-		sin_generator_vfill(&sg[c], sinus_f + c * frames, frames);
+		/* fill each channel in place, already interleaved */
+		sin_generator_vfill_stride(&sg[c], sinus_f + c, frames,
+				bat->channels);
 	}
 
-	/* reorder samples to interleaved mode */
-	err = reorder(bat, sinus_f, frames);
+adjust:
+	/* adjust amplitude and offset of waveform */
+	err = adjust_waveform(bat, sinus_f, frames, bat->channels);
 	if (err != 0)
 		goto exit;
 
-	/* adjust amplitude and offset of waveform */
+	bat->convert_float_to_sample(sinus_f, buf, frames, bat->channels);
+
+exit:
+	free(sinus_f);
+
+	return err;
+}
+
+int generate_chirp(struct bat *bat, int pos, int frames, void *buf)
+{
+	int err = 0;
+	float *sinus_f = NULL;
+
+	sinus_f = (float *) malloc(bat->channels * frames * sizeof(float));
+	if (sinus_f == NULL) {
+		fprintf(bat->err, _("Not enough memory.\n"));
+		return -ENOMEM;
+	}
+
+	/* all channels play the same chirp */
+	chirp_fill(bat, sinus_f, pos, frames);
+	spread_channels(bat, sinus_f, frames);
+
 	err = adjust_waveform(bat, sinus_f, frames, bat->channels);
 	if (err != 0)
 		goto exit;
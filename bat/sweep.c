@@ -0,0 +1,333 @@
+/*
+ * Copyright (C) 2026 agent <agent@local>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+#include <math.h>
+
+#include "aconfig.h"
+#include "gettext.h"
+
+#include "common.h"
+#include "bat-signal.h"
+#include "analyze.h"
+#include "sweep.h"
+
+/*
+ * Frequency response from one period of the exponential sweep (Farina).
+ * The capture is deconvolved by a spectral division by the played sweep,
+ * which gives the impulse response of the linear part at the main peak
+ * and the responses of the harmonics k at L * ln(k) seconds before it.
+ * The spectrum of the k-th harmonic response at k * f is the amplitude
+ * of this harmonic relative to the fundamental at f, because the sweep
+ * spectrum and the harmonic density both fall as 1 / f.
+ */
+
+/* highest harmonic taken for THD */
+#define SWEEP_HARMONICS			5
+/* fade in and out of each impulse response window, in frames */
+#define SWEEP_FADE			64
+/* the impulse response peak must stand out of its rms */
+#define SWEEP_PEAK_RATIO		10.0
+
+struct sweep {
+	struct bat *bat;
+	int N;				/* period and FFT length */
+	double L;			/* time for the frequency to rise by e */
+	struct fft_plan fft;		/* forward */
+	fftwf_plan inverse;		/* from fft.out back to fft.in */
+	float *X;			/* spectrum of the played sweep */
+	float *Y;			/* spectrum of the capture */
+	float *h;			/* impulse responses */
+	float *power[SWEEP_HARMONICS + 1];	/* of each harmonic response */
+	char *sample_buf;
+};
+
+static float band_weight(struct sweep *s, float f)
+{
+	float low = s->bat->sweep_low, high = s->bat->sweep_high;
+	float edge = powf(2.0, 1.0 / 6);
+
+	/* raised cosine over 1/6 octave at each end of the sweep */
+	if (f <= low || f >= high)
+		return 0.0;
+	if (f < low * edge)
+		return 0.5 - 0.5 * cosf(M_PI * log2f(f / low) * 6);
+	if (f > high / edge)
+		return 0.5 - 0.5 * cosf(M_PI * log2f(high / f) * 6);
+	return 1.0;
+}
+
+/* h = ifft(Y / X) in the sweep band, in halfcomplex order */
+static void deconvolve(struct sweep *s)
+{
+	int k, N = s->N;
+	float xr, xi, yr, yi, d, w;
+	float *H = s->fft.out;
+
+	H[0] = H[N / 2] = 0.0;
+	for (k = 1; k < N / 2; k++) {
+		w = band_weight(s, (float) k * s->bat->rate / N);
+		xr = s->X[k];
+		xi = s->X[N - k];
+		yr = s->Y[k];
+		yi = s->Y[N - k];
+		d = xr * xr + xi * xi;
+		if (w == 0.0 || d == 0.0) {
+			H[k] = H[N - k] = 0.0;
+			continue;
+		}
+		w /= d * N;
+		H[k] = (yr * xr + yi * xi) * w;
+		H[N - k] = (yi * xr - yr * xi) * w;
+	}
+	fftwf_execute(s->inverse);
+	memcpy(s->h, s->fft.in, sizeof(float) * N);
+}
+
+/* power spectrum of h in [start, end) circularly, with faded edges */
+static void window_power(struct sweep *s, int start, int end, float *power)
+{
+	int i, idx, len = end - start, N = s->N;
+	float g, *in = s->fft.in, *out = s->fft.out;
+
+	memset(in, 0, sizeof(float) * N);
+	for (i = 0; i < len; i++) {
+		idx = ((start + i) % N + N) % N;
+		g = 1.0;
+		if (i < SWEEP_FADE)
+			g = 0.5 - 0.5 * cosf(M_PI * i / SWEEP_FADE);
+		else if (len - i <= SWEEP_FADE)
+			g = 0.5 - 0.5 * cosf(M_PI * (len - i) / SWEEP_FADE);
+		in[i] = s->h[idx] * g;
+	}
+	fft_execute(&s->fft);
+	power[0] = 0.0;
+	for (i = 1; i < N / 2; i++)
+		power[i] = out[i] * out[i] + out[N - i] * out[N - i];
+}
+
+/* mean power in the 1/3 octave band around f */
+static float band_power(struct sweep *s, float *power, float f)
+{
+	float hz = (float) s->bat->rate / s->N, sum = 0.0;
+	int k, lo, hi;
+
+	lo = f * powf(2.0, -1.0 / 6) / hz;
+	hi = f * powf(2.0, 1.0 / 6) / hz;
+	if (lo < 1)
+		lo = 1;
+	if (hi >= s->N / 2)
+		hi = s->N / 2 - 1;
+	if (hi < lo)
+		hi = lo;
+	for (k = lo; k <= hi; k++)
+		sum += power[k];
+
+	return sum / (hi - lo + 1);
+}
+
+static int sweep_channel(struct sweep *s, void *buf, int total, int channel)
+{
+	struct bat *bat = s->bat;
+	int N = s->N, i, k, peak, start, end;
+	double d[SWEEP_HARMONICS + 2];
+	float rms, ref, f, p1, pk, low, high;
+	float *power1 = s->power[1];
+	float thd;
+
+	fprintf(bat->log, _("\nChannel %i - "), channel + 1);
+	fprintf(bat->log, _("Checking for sweep from %.1f to %.1f Hz\n"),
+			bat->sweep_low, bat->sweep_high);
+
+	/* the last period of the capture */
+	for (i = 0; i < N; i++)
+		memcpy(s->sample_buf + i * bat->sample_size,
+				(char *) buf + (total - N + i) * bat->frame_size
+				+ channel * bat->sample_size,
+				bat->sample_size);
+	bat->convert_sample_to_float(s->sample_buf, s->fft.in, N);
+	fft_execute(&s->fft);
+	memcpy(s->Y, s->fft.out, sizeof(float) * N);
+
+	deconvolve(s);
+
+	for (i = 0, peak = 0, rms = 0.0; i < N; i++) {
+		rms += s->h[i] * s->h[i];
+		if (fabsf(s->h[i]) > fabsf(s->h[peak]))
+			peak = i;
+	}
+	rms = sqrtf(rms / N);
+	fprintf(bat->log, _("Impulse response peak at frame %d\n"), peak);
+	if (fabsf(s->h[peak]) < SWEEP_PEAK_RATIO * rms) {
+		fprintf(bat->err, _(" FAIL: No response to the sweep\n"));
+		return -ENOPEAK;
+	}
+
+	/* the harmonic responses come before the peak, the windows are
+	 * split half way between them */
+	for (k = 1; k <= SWEEP_HARMONICS + 1; k++)
+		d[k] = s->L * log(k) * bat->rate;
+	for (k = 1; k <= SWEEP_HARMONICS; k++) {
+		start = peak - (d[k] + d[k + 1]) / 2;
+		/* the linear one runs up to the last harmonic window */
+		if (k == 1)
+			end = peak + N - (d[SWEEP_HARMONICS]
+					+ d[SWEEP_HARMONICS + 1]) / 2;
+		else
+			end = peak - (d[k - 1] + d[k]) / 2;
+		window_power(s, start, end, s->power[k]);
+	}
+
+	/* the levels are relative to 1 kHz, or to the middle of the sweep */
+	low = bat->sweep_low;
+	high = bat->sweep_high;
+	f = (low < 1000.0 && high > 1000.0) ? 1000.0 : sqrtf(low * high);
+	ref = band_power(s, power1, f);
+	if (ref <= 0.0)
+		return -ENOPEAK;
+
+	fprintf(bat->log, _("%10s %10s %10s\n"), _("Freq (Hz)"),
+			_("Level (dB)"), _("THD (%)"));
+	/* third octave points, away from the tapered ends of the band */
+	for (i = ceilf(3 * log2f(low / 1000.0)) + 1;
+			1000.0 * powf(2.0, (i + 1) / 3.0) <= high; i++) {
+		f = 1000.0 * powf(2.0, i / 3.0);
+		p1 = band_power(s, power1, f);
+		fprintf(bat->log, "%10.1f %10.2f", f, 10.0 * log10f(p1 / ref));
+		/* harmonics above the sweep are not measured */
+		for (k = 2, pk = 0.0; k <= SWEEP_HARMONICS; k++)
+			if (k * f * powf(2.0, 1.0 / 6) <= high)
+				pk += band_power(s, s->power[k], k * f);
+		if (pk > 0.0 && 2 * f * powf(2.0, 1.0 / 6) <= high) {
+			thd = 100.0 * sqrtf(pk / p1);
+			fprintf(bat->log, " %10.3f\n", thd);
+		} else {
+			fprintf(bat->log, " %10s\n", "-");
+		}
+	}
+
+	return 0;
+}
+
+static void sweep_free(struct sweep *s)
+{
+	int k;
+
+	if (s->inverse != NULL)
+		fftwf_destroy_plan(s->inverse);
+	fft_free(&s->fft);
+	for (k = 1; k <= SWEEP_HARMONICS; k++)
+		free(s->power[k]);
+	free(s->h);
+	free(s->Y);
+	free(s->X);
+	free(s->sample_buf);
+}
+
+static int sweep_prepare(struct bat *bat, struct sweep *s)
+{
+	int k, err;
+
+	memset(s, 0, sizeof(*s));
+	s->bat = bat;
+	s->N = sweep_length(bat);
+	s->L = (double) s->N / bat->rate
+			/ log(bat->sweep_high / bat->sweep_low);
+
+	fft_import_wisdom(bat);
+	err = fft_prepare(bat, &s->fft, s->N);
+	if (err < 0)
+		return err;
+	/* used once per channel, not worth a measurement */
+	s->inverse = fftwf_plan_r2r_1d(s->N, s->fft.out, s->fft.in,
+			FFTW_HC2R, FFTW_ESTIMATE);
+	s->X = malloc(sizeof(float) * s->N);
+	s->Y = malloc(sizeof(float) * s->N);
+	s->h = malloc(sizeof(float) * s->N);
+	s->sample_buf = malloc(bat->sample_size * s->N);
+	if (!s->inverse || !s->X || !s->Y || !s->h || !s->sample_buf)
+		goto fail;
+	for (k = 1; k <= SWEEP_HARMONICS; k++) {
+		s->power[k] = malloc(sizeof(float) * s->N / 2);
+		if (!s->power[k])
+			goto fail;
+	}
+
+	/* spectrum of the played period */
+	sweep_fill(bat, s->fft.in, 0, s->N);
+	fft_execute(&s->fft);
+	memcpy(s->X, s->fft.out, sizeof(float) * s->N);
+
+	return 0;
+
+fail:
+	sweep_free(s);
+	return -ENOMEM;
+}
+
+int analyze_sweep(struct bat *bat)
+{
+	struct sweep s;
+	struct wav_map map = { NULL, 0, 0, 0 };
+	int err, c, total;
+	void *buf;
+
+	if (bat->frames < sweep_length(bat) + sweep_length(bat) / 4) {
+		fprintf(bat->err, _("Capture too short for the sweep: %d\n"),
+				bat->frames);
+		return -EINVAL;
+	}
+
+	if (bat->capture_buf != NULL) {
+		buf = bat->capture_buf;
+		total = bat->capture_frames;
+	} else {
+		err = map_wav_data(bat, bat->capture.file, &map);
+		if (err != 0)
+			return err;
+		buf = map.data;
+		total = map.frames;
+	}
+	if (total < sweep_length(bat)) {
+		err = -EIO;
+		goto exit;
+	}
+
+	fprintf(bat->log, _("\nBAT sweep analysis: %d frames at %d Hz,"),
+			total, bat->rate);
+	fprintf(bat->log, _(" period of %d frames.\n"), sweep_length(bat));
+
+	err = sweep_prepare(bat, &s);
+	if (err < 0)
+		goto exit;
+
+	for (c = 0; c < bat->channels; c++) {
+		err = sweep_channel(&s, buf, total, c);
+		if (err != 0)
+			break;
+	}
+
+	sweep_free(&s);
+exit:
+	unmap_wav_data(&map);
+
+	return err;
+}
@@ -28,6 +28,7 @@
 #include "common.h"
 #include "tinyalsa.h"
 #include "latencytest.h"
+#include "online.h"
 
 struct format_map_table {
 	enum _bat_pcm_format format_bat;
@@ -81,6 +82,47 @@ static void close_handle(void *handle)
 		pcm_close(pcm);
 }
 
+/**
+ * Transfer with mmap or read/write, 0 or a negative error
+ */
+static int tiny_write(struct bat *bat, struct pcm *pcm,
+		void *buffer, unsigned int bytes)
+{
+	int err;
+
+	if (bat->mmap)
+		err = pcm_mmap_write(pcm, buffer, bytes);
+	else
+		err = pcm_write(pcm, buffer, bytes);
+
+	return err < 0 ? err : 0;
+}
+
+static int tiny_read(struct bat *bat, struct pcm *pcm,
+		void *buffer, unsigned int bytes)
+{
+	int err;
+
+	if (bat->mmap)
+		err = pcm_mmap_read(pcm, buffer, bytes);
+	else
+		err = pcm_read(pcm, buffer, bytes);
+
+	return err < 0 ? err : 0;
+}
+
+static int latency_write(void *pcm, void *buffer, int frames,
+		struct bat *bat)
+{
+	return tiny_write(bat, pcm, buffer, frames * bat->frame_size);
+}
+
+static int latency_read(void *pcm, void *buffer, int frames,
+		struct bat *bat)
+{
+	return tiny_read(bat, pcm, buffer, frames * bat->frame_size);
+}
+
 /**
  * Check that a parameter is inside bounds
  */
@@ -156,40 +198,6 @@ exit:
 	return err;
 }
 
-/**
- * Process output data for latency test
- */
-static int latencytest_process_output(struct bat *bat, struct pcm *pcm,
-		void *buffer, int bytes)
-{
-	int err = 0;
-	int frames = bytes / bat->frame_size;
-
-	fprintf(bat->log, _("Play sample with %d frames buffer\n"), frames);
-
-	bat->latency.is_playing = true;
-
-	while (1) {
-		/* generate output data */
-		err = handleoutput(bat, buffer, bytes, frames);
-		if (err != 0)
-			break;
-
-		err = pcm_write(pcm, buffer, bytes);
-		if (err != 0)
-			break;
-
-		if (bat->latency.state == LATENCY_STATE_COMPLETE_SUCCESS)
-			break;
-
-		bat->periods_played++;
-	}
-
-	bat->latency.is_playing = false;
-
-	return err;
-}
-
 /**
  * Play sample
  */
@@ -235,7 +243,11 @@ static int play_sample(struct bat *bat, struct pcm *pcm,
 				&& bat->periods_played >= bat->periods_total)
 			break;
 
-		err = pcm_write(pcm, buffer, bytes);
+		/* the result is known, no need to play the rest */
+		if (bat->analyzer && online_done(bat))
+			break;
+
+		err = tiny_write(bat, pcm, buffer, bytes);
 		if (err != 0)
 			break;
 	}
@@ -289,46 +301,46 @@ void *playback_tinyalsa(struct bat *bat)
 
 	fprintf(bat->log, _("Entering playback thread (tinyalsa).\n"));
 
-	retval_play = 0;
+	bat->playback.retval = 0;
 
 	/* init device */
 	err = get_tiny_device(bat, bat->playback.device,
 			&bat->playback.card_tiny,
 			&bat->playback.device_tiny);
 	if (err < 0) {
-		retval_play = err;
+		bat->playback.retval = err;
 		goto exit1;
 	}
 
 	/* init config */
 	err = init_config(bat, &config);
 	if (err < 0) {
-		retval_play = err;
+		bat->playback.retval = err;
 		goto exit1;
 	}
 
 	/* check param before open device */
 	err = check_playback_params(bat, &config);
 	if (err < 0) {
-		retval_play = err;
+		bat->playback.retval = err;
 		goto exit1;
 	}
 
 	/* open device */
 	pcm = pcm_open(bat->playback.card_tiny, bat->playback.device_tiny,
-			PCM_OUT, &config);
+			PCM_OUT | (bat->mmap ? PCM_MMAP : 0), &config);
 	if (!pcm || !pcm_is_ready(pcm)) {
 		fprintf(bat->err, _("Unable to open PCM device %u (%s)!\n"),
 				bat->playback.device_tiny, pcm_get_error(pcm));
-		retval_play = -EINVAL;
+		bat->playback.retval = -EINVAL;
 		goto exit1;
 	}
 
-	/* init buffer */
-	bufbytes = pcm_frames_to_bytes(pcm, pcm_get_buffer_size(pcm));
+	/* transfer one period at a time, as the alsa-lib backend does */
+	bufbytes = pcm_frames_to_bytes(pcm, config.period_size);
 	buffer = malloc(bufbytes);
 	if (!buffer) {
-		retval_play = -ENOMEM;
+		bat->playback.retval = -ENOMEM;
 		goto exit2;
 	}
 
@@ -346,23 +358,24 @@ void *playback_tinyalsa(struct bat *bat)
 		if (bat->fp == NULL) {
 			fprintf(bat->err, _("Cannot open file: %s %d\n"),
 					bat->playback.file, err);
-			retval_play = err;
+			bat->playback.retval = err;
 			goto exit3;
 		}
 		/* Skip header */
 		err = read_wav_header(bat, bat->playback.file, bat->fp, true);
 		if (err != 0) {
-			retval_play = err;
+			bat->playback.retval = err;
 			goto exit4;
 		}
 	}
 
 	if (bat->roundtriplatency)
-		err = latencytest_process_output(bat, pcm, buffer, bufbytes);
+		err = latencytest_output(bat, buffer, config.period_size,
+				latency_write, pcm);
 	else
 		err = play_sample(bat, pcm, buffer, bufbytes);
 	if (err < 0) {
-		retval_play = err;
+		bat->playback.retval = err;
 		goto exit4;
 	}
 
@@ -374,7 +387,7 @@ exit3:
 exit2:
 	pcm_close(pcm);
 exit1:
-	pthread_exit(&retval_play);
+	pthread_exit(&bat->playback.retval);
 }
 
 /**
@@ -387,6 +400,11 @@ static int capture_sample(struct bat *bat, struct pcm *pcm,
 	FILE *fp = NULL;
 	unsigned int bytes_read = 0;
 	unsigned int bytes_count = bat->frames * bat->frame_size;
+	unsigned int size;
+
+	/* neither the online analyzer nor a capture in memory need a file */
+	if (bat->analyzer || bat->capture_buf)
+		goto loop;
 
 	remove(bat->capture.file);
 	fp = fopen(bat->capture.file, "wb");
@@ -403,68 +421,38 @@ static int capture_sample(struct bat *bat, struct pcm *pcm,
 		return err;
 	}
 
-	while (bytes_read < bytes_count && !pcm_read(pcm, buffer, bytes)) {
-		if (fwrite(buffer, 1, bytes, fp) != bytes)
+loop:
+	while ((bat->soak || bytes_read < bytes_count)
+			&& !tiny_read(bat, pcm, buffer, bytes)) {
+		if (bat->analyzer) {
+			online_feed(bat, buffer, bytes / bat->frame_size);
+		} else if (bat->capture_buf) {
+			size = bytes_count - bytes_read < bytes ?
+					bytes_count - bytes_read : bytes;
+			memcpy(bat->capture_buf + bytes_read, buffer, size);
+			bat->capture_frames += size / bat->frame_size;
+		} else if (fwrite(buffer, 1, bytes, fp) != bytes) {
 			break;
+		}
 
-		bytes_read += bytes;
+		/* the soak test runs until the analyzer stops */
+		if (!bat->soak)
+			bytes_read += bytes;
 
 		bat->periods_played++;
 
 		if (bat->period_is_limited
 				&& bat->periods_played >= bat->periods_total)
 			break;
-	}
-
-	err = update_wav_header(bat, fp, bytes_read);
-
-	fclose(fp);
-	return err;
-}
-
-/**
- * Process input data for latency test
- */
-static int latencytest_process_input(struct bat *bat, struct pcm *pcm,
-		void *buffer, unsigned int bytes)
-{
-	int err = 0;
-	FILE *fp = NULL;
-	unsigned int bytes_read = 0;
-	unsigned int bytes_count = bat->frames * bat->frame_size;
-
-	remove(bat->capture.file);
-	fp = fopen(bat->capture.file, "wb");
-	err = -errno;
-	if (fp == NULL) {
-		fprintf(bat->err, _("Cannot open file: %s %d\n"),
-				bat->capture.file, err);
-		return err;
-	}
-	/* leave space for file header */
-	if (fseek(fp, sizeof(struct wav_container), SEEK_SET) != 0) {
-		err = -errno;
-		fclose(fp);
-		return err;
-	}
-
-	bat->latency.is_capturing = true;
-
-	while (bytes_read < bytes_count && !pcm_read(pcm, buffer, bytes)) {
-		if (fwrite(buffer, 1, bytes, fp) != bytes)
-			break;
 
-		err = handleinput(bat, buffer, bytes / bat->frame_size);
-		if (err != 0)
-			break;
-
-		if (bat->latency.is_playing == false)
+		if (bat->analyzer && online_done(bat)) {
+			fprintf(bat->log, _("Analysis done, stop capture.\n"));
 			break;
-
-		bytes_read += bytes;
+		}
 	}
 
-	bat->latency.is_capturing = false;
+	if (fp == NULL)
+		return 0;
 
 	err = update_wav_header(bat, fp, bytes_read);
 
@@ -487,39 +475,39 @@ void *record_tinyalsa(struct bat *bat)
 
 	fprintf(bat->log, _("Entering capture thread (tinyalsa).\n"));
 
-	retval_record = 0;
+	bat->capture.retval = 0;
 
 	/* init device */
 	err = get_tiny_device(bat, bat->capture.device,
 			&bat->capture.card_tiny,
 			&bat->capture.device_tiny);
 	if (err < 0) {
-		retval_record = err;
+		bat->capture.retval = err;
 		goto exit1;
 	}
 
 	/* init config */
 	err = init_config(bat, &config);
 	if (err < 0) {
-		retval_record = err;
+		bat->capture.retval = err;
 		goto exit1;
 	}
 
 	/* open device */
 	pcm = pcm_open(bat->capture.card_tiny, bat->capture.device_tiny,
-			PCM_IN, &config);
+			PCM_IN | (bat->mmap ? PCM_MMAP : 0), &config);
 	if (!pcm || !pcm_is_ready(pcm)) {
 		fprintf(bat->err, _("Unable to open PCM device (%s)!\n"),
 				pcm_get_error(pcm));
-		retval_record = -EINVAL;
+		bat->capture.retval = -EINVAL;
 		goto exit1;
 	}
 
-	/* init buffer */
-	bufbytes = pcm_frames_to_bytes(pcm, pcm_get_buffer_size(pcm));
+	/* transfer one period at a time, as the alsa-lib backend does */
+	bufbytes = pcm_frames_to_bytes(pcm, config.period_size);
 	buffer = malloc(bufbytes);
 	if (!buffer) {
-		retval_record = -ENOMEM;
+		bat->capture.retval = -ENOMEM;
 		goto exit2;
 	}
 
@@ -530,11 +518,12 @@ void *record_tinyalsa(struct bat *bat)
 
 	fprintf(bat->log, _("Recording ...\n"));
 	if (bat->roundtriplatency)
-		err = latencytest_process_input(bat, pcm, buffer, bufbytes);
+		err = latencytest_input(bat, buffer, config.period_size,
+				latency_read, pcm);
 	else
 		err = capture_sample(bat, pcm, buffer, bufbytes);
 	if (err != 0) {
-		retval_record = err;
+		bat->capture.retval = err;
 		goto exit3;
 	}
 
@@ -543,12 +532,12 @@ void *record_tinyalsa(struct bat *bat)
 	 *  by end of play thread. Except in single line mode. */
 	pthread_cleanup_pop(0);
 	pthread_cleanup_pop(0);
-	pthread_exit(&retval_record);
+	pthread_exit(&bat->capture.retval);
 
 exit3:
 	free(buffer);
 exit2:
 	pcm_close(pcm);
 exit1:
-	pthread_exit(&retval_record);
+	pthread_exit(&bat->capture.retval);
 }
@@ -13,8 +13,5 @@
  *
  */
 
-extern int retval_play;
-extern int retval_record;
-
 void *playback_tinyalsa(struct bat *);
 void *record_tinyalsa(struct bat *);
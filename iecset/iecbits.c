@@ -257,3 +257,31 @@ void dump_iec958(snd_aes_iec958_t *iec)
 	}
 }
 
+
+/* the sample rate in Hz, 0 if not indicated, -1 if unknown */
+int iec958_rate(snd_aes_iec958_t *iec)
+{
+	if (iec->status[0] & IEC958_AES0_PROFESSIONAL) {
+		switch (iec->status[0] & IEC958_AES0_PRO_FS) {
+		case IEC958_AES0_PRO_FS_44100: return 44100;
+		case IEC958_AES0_PRO_FS_48000: return 48000;
+		case IEC958_AES0_PRO_FS_32000: return 32000;
+		case IEC958_AES0_PRO_FS_NOTID: return 0;
+		}
+		return -1;
+	}
+	switch (iec->status[3] & IEC958_AES3_CON_FS) {
+	case IEC958_AES3_CON_FS_22050: return 22050;
+	case IEC958_AES3_CON_FS_24000: return 24000;
+	case IEC958_AES3_CON_FS_32000: return 32000;
+	case IEC958_AES3_CON_FS_44100: return 44100;
+	case IEC958_AES3_CON_FS_48000: return 48000;
+	case IEC958_AES3_CON_FS_88200: return 88200;
+	case IEC958_AES3_CON_FS_96000: return 96000;
+	case IEC958_AES3_CON_FS_176400: return 176400;
+	case IEC958_AES3_CON_FS_192000: return 192000;
+	case IEC958_AES3_CON_FS_768000: return 768000;
+	case IEC958_AES3_CON_FS_NOTID: return 0;
+	}
+	return -1;
+}
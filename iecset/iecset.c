@@ -19,9 +19,11 @@
 
 #include <stdio.h>
 #include <ctype.h>
+#include <errno.h>
 #include <alsa/asoundlib.h>
 
 void dump_iec958(snd_aes_iec958_t *iec);
+int iec958_rate(snd_aes_iec958_t *iec);
 
 static int get_bool(const char *str)
 {
@@ -91,8 +93,12 @@ static void usage(void)
 	printf("    -D device   specifies the control device to use\n");
 	printf("    -c card     specifies the card number to use (equiv. with -Dhw:#)\n");
 	printf("    -n number   specifies the control index number (default = 0)\n");
+	printf("                a list like 0,2-5 or \"all\" selects several controls\n");
 	printf("    -x          dump the dump the AESx hex code for IEC958 PCM parameters\n");
+	printf("    -j          dump the status of the controls in compact JSON\n");
 	printf("    -i          read commands from stdin\n");
+	printf("    -f file     read commands from file, \"index N\" lines start\n");
+	printf("                commands for the given controls only\n");
 	printf("Commands:\n");
 	for (i = 0; i < (int)(sizeof(cmds)/sizeof(cmds[0])); i++) {
 		printf("    %s\n", cmds[i].desc);
@@ -158,6 +164,158 @@ static void parse_file(int *parms, FILE *fp)
 	}
 }
 
+/*
+ * the selected control indices; with none, the first IEC958 control found
+ * is used
+ */
+static int *indices;
+static int num_indices;
+static int all_indices;
+
+static int add_index(int index)
+{
+	int *p, i;
+
+	for (i = 0; i < num_indices; i++)
+		if (indices[i] == index)
+			return 0;
+	p = realloc(indices, (num_indices + 1) * sizeof(*indices));
+	if (p == NULL)
+		return -ENOMEM;
+	indices = p;
+	indices[num_indices++] = index;
+	return 0;
+}
+
+/* parse "3", "0,2-5" or "all" */
+static int parse_index_list(const char *str, int (*add)(int index, void *arg),
+			    void *arg)
+{
+	char *end;
+	long first, last;
+	int err;
+
+	if (strcmp(str, "all") == 0) {
+		all_indices = 1;
+		return 0;
+	}
+	while (*str) {
+		first = strtol(str, &end, 0);
+		if (end == str || first < 0)
+			return -EINVAL;
+		last = first;
+		if (*end == '-') {
+			str = end + 1;
+			last = strtol(str, &end, 0);
+			if (end == str || last < first)
+				return -EINVAL;
+		}
+		for (; first <= last; first++) {
+			err = add(first, arg);
+			if (err < 0)
+				return err;
+		}
+		if (*end == ',')
+			end++;
+		else if (*end && !isspace(*end))
+			return -EINVAL;
+		str = skipspace(end);
+	}
+	return 0;
+}
+
+static int add_selected(int index, void *arg)
+{
+	return add_index(index);
+}
+
+/*
+ * the commands of the "index" sections of a config file, applied on top
+ * of the common commands for the listed controls
+ */
+struct section {
+	int index;
+	int parms[IDX_LAST];
+};
+
+static struct section *sections;
+static int num_sections;
+
+struct section_list {
+	int *list;
+	int count;
+};
+
+static int add_section(int index, void *arg)
+{
+	struct section_list *cur = arg;
+	struct section *p;
+	int *l, i;
+
+	for (i = 0; i < num_sections; i++)
+		if (sections[i].index == index)
+			break;
+	if (i == num_sections) {
+		p = realloc(sections, (num_sections + 1) * sizeof(*sections));
+		if (p == NULL)
+			return -ENOMEM;
+		sections = p;
+		sections[i].index = index;
+		memset(sections[i].parms, 0xff, sizeof(sections[i].parms)); /* -1 = not set */
+		num_sections++;
+	}
+	l = realloc(cur->list, (cur->count + 1) * sizeof(*l));
+	if (l == NULL)
+		return -ENOMEM;
+	cur->list = l;
+	cur->list[cur->count++] = i;
+	return add_index(index);
+}
+
+static int parse_config_file(int *parms, const char *name)
+{
+	char line[1024], *cmd, *arg;
+	struct section_list cur = { NULL, 0 };
+	int i, err = 0, lineno = 0;
+	FILE *fp;
+
+	fp = fopen(name, "r");
+	if (fp == NULL) {
+		fprintf(stderr, "cannot open %s: %s\n", name, strerror(errno));
+		return -errno;
+	}
+	while (fgets(line, sizeof(line), fp) != NULL) {
+		lineno++;
+		cmd = skipspace(line);
+		if (*cmd == '#' || ! *cmd)
+			continue;
+		for (arg = cmd; *arg && !isspace(*arg); arg++)
+			;
+		if (! *arg)
+			continue;
+		*arg++ = 0;
+		arg = skipspace(arg);
+		if (! *arg)
+			continue;
+		if (strcmp(cmd, "index") == 0) {
+			cur.count = 0;
+			err = parse_index_list(arg, add_section, &cur);
+			if (err < 0) {
+				fprintf(stderr, "%s:%d: invalid index list\n", name, lineno);
+				break;
+			}
+			continue;
+		}
+		if (cur.count == 0)
+			parse_command(parms, cmd, arg);
+		for (i = 0; i < cur.count; i++)
+			parse_command(sections[cur.list[i]].parms, cmd, arg);
+	}
+	free(cur.list);
+	fclose(fp);
+	return err;
+}
+
 /* update iec958 status values
  * return non-zero if the values are modified
  */
@@ -307,27 +465,86 @@ static int update_iec958_status(snd_aes_iec958_t *iec958, int *parms)
 }
 		
 
+static void print_json(int index, snd_aes_iec958_t *iec, int first)
+{
+	int rate = iec958_rate(iec);
+
+	printf("%s{\"index\":%d,\"aes\":[%u,%u,%u,%u],\"professional\":%s,"
+	       "\"audio\":%s,\"rate\":",
+	       first ? "" : ",", index,
+	       iec->status[0], iec->status[1], iec->status[2], iec->status[3],
+	       (iec->status[0] & IEC958_AES0_PROFESSIONAL) ? "true" : "false",
+	       (iec->status[0] & IEC958_AES0_NONAUDIO) ? "false" : "true");
+	if (rate > 0)
+		printf("%d}", rate);
+	else
+		printf("null}");
+}
+
+/* apply the commands to one control and read the result back */
+static int apply_control(snd_ctl_t *ctl, snd_ctl_elem_id_t *cid,
+			 int *parms, snd_aes_iec958_t *iec958)
+{
+	snd_ctl_elem_value_t *cval;
+	int err;
+
+	snd_ctl_elem_value_alloca(&cval);
+	snd_ctl_elem_value_set_id(cval, cid);
+	if ((err = snd_ctl_elem_read(ctl, cval)) < 0) {
+		error("snd_ctl_elem_read", err);
+		return err;
+	}
+
+	snd_ctl_elem_value_get_iec958(cval, iec958);
+
+	if (update_iec958_status(iec958, parms)) {
+		/* store the values */
+		snd_ctl_elem_value_set_iec958(cval, iec958);
+		if ((err = snd_ctl_elem_write(ctl, cval)) < 0) {
+			error("snd_ctl_elem_write", err);
+			return err;
+		}
+		if ((err = snd_ctl_elem_read(ctl, cval)) < 0) {
+			error("snd_ctl_elem_write", err);
+			return err;
+		}
+		snd_ctl_elem_value_get_iec958(cval, iec958);
+	}
+	return 0;
+}
+
+static int index_selected(int index)
+{
+	int i;
+
+	if (all_indices)
+		return 1;
+	for (i = 0; i < num_indices; i++)
+		if (indices[i] == index)
+			return 1;
+	return 0;
+}
+
 int main(int argc, char **argv)
 {
 	const char *dev = "default";
 	const char *spdif_str = SND_CTL_NAME_IEC958("", PLAYBACK, DEFAULT);
-	int spdif_index = -1;
+	const char *config_file = NULL;
 	snd_ctl_t *ctl;
 	snd_ctl_elem_list_t *clist;
 	snd_ctl_elem_id_t *cid;
-	snd_ctl_elem_value_t *cval;
 	snd_aes_iec958_t iec958;
 	int from_stdin = 0;
-	int dumphex = 0;
-	int i, c, err;
+	int dumphex = 0, json = 0;
+	int i, c, err, index, found = 0, ret = 0;
 	unsigned int controls, cidx;
 	char tmpname[32];
-	int parms[IDX_LAST];
+	int parms[IDX_LAST], cparms[IDX_LAST];
 
 	for (i = 0; i < IDX_LAST; i++)
 		parms[i] = -1; /* not set */
 
-	while ((c = getopt(argc, argv, "D:c:n:xhi")) != -1) {
+	while ((c = getopt(argc, argv, "D:c:n:xjhif:")) != -1) {
 		switch (c) {
 		case 'D':
 			dev = optarg;
@@ -342,20 +559,39 @@ int main(int argc, char **argv)
 			dev = tmpname;
 			break;
 		case 'n':
-			spdif_index = atoi(optarg);
+			if (parse_index_list(optarg, add_selected, NULL) < 0) {
+				fprintf(stderr, "invalid control index %s\n", optarg);
+				return 1;
+			}
 			break;
 		case 'x':
 			dumphex = 1;
 			break;
+		case 'j':
+			json = 1;
+			break;
 		case 'i':
 			from_stdin = 1;
 			break;
+		case 'f':
+			config_file = optarg;
+			break;
 		default:
 			usage();
 			return 1;
 		}
 	}
 
+	/* parse from the file and stdin */
+	if (config_file && parse_config_file(parms, config_file) < 0)
+		return 1;
+	if (from_stdin)
+		parse_file(parms, stdin);
+
+	/* parse commands */
+	for (c = optind; c < argc - 1; c += 2)
+		parse_command(parms, argv[c], argv[c + 1]);
+
 	if ((err = snd_ctl_open(&ctl, dev, 0)) < 0) {
 		error("snd_ctl_open", err);
 		return 1;
@@ -375,58 +611,69 @@ int main(int argc, char **argv)
 		return 1;
 	}
 
+	/* one pass over the element list for all selected controls */
+	snd_ctl_elem_id_alloca(&cid);
+	if (json)
+		printf("[");
 	controls = snd_ctl_elem_list_get_used(clist);
 	for (cidx = 0; cidx < controls; cidx++) {
-		if (!strcmp(snd_ctl_elem_list_get_name(clist, cidx), spdif_str))
-			if (spdif_index < 0 ||
-			    snd_ctl_elem_list_get_index(clist, cidx) == spdif_index)
-				break;
-	}
-	if (cidx >= controls) {
-		fprintf(stderr, "control \"%s\" (index %d) not found\n",
-			spdif_str, spdif_index);
-		return 1;
-	}
-
-	snd_ctl_elem_id_alloca(&cid);
-	snd_ctl_elem_list_get_id(clist, cidx, cid);
-	snd_ctl_elem_value_alloca(&cval);
-	snd_ctl_elem_value_set_id(cval, cid);
-	if ((err = snd_ctl_elem_read(ctl, cval)) < 0) {
-		error("snd_ctl_elem_read", err);
-		return 1;
-	}
-
-	snd_ctl_elem_value_get_iec958(cval, &iec958);
+		if (strcmp(snd_ctl_elem_list_get_name(clist, cidx), spdif_str))
+			continue;
+		index = snd_ctl_elem_list_get_index(clist, cidx);
+		if ((num_indices || all_indices) && !index_selected(index))
+			continue;
 
-	/* parse from stdin */
-	if (from_stdin)
-		parse_file(parms, stdin);
+		memcpy(cparms, parms, sizeof(cparms));
+		for (i = 0; i < num_sections; i++) {
+			if (sections[i].index != index)
+				continue;
+			for (c = 0; c < IDX_LAST; c++)
+				if (sections[i].parms[c] >= 0)
+					cparms[c] = sections[i].parms[c];
+		}
 
-	/* parse commands */
-	for (c = optind; c < argc - 1; c += 2)
-		parse_command(parms, argv[c], argv[c + 1]);
+		snd_ctl_elem_list_get_id(clist, cidx, cid);
+		if (apply_control(ctl, cid, cparms, &iec958) < 0) {
+			ret = 1;
+			continue;
+		}
 
-	if (update_iec958_status(&iec958, parms)) {
-		/* store the values */
-		snd_ctl_elem_value_set_iec958(cval, &iec958);
-		if ((err = snd_ctl_elem_write(ctl, cval)) < 0) {
-			error("snd_ctl_elem_write", err);
-			return 1;
+		if (json)
+			print_json(index, &iec958, !found);
+		else if (dumphex)
+			printf("AES0=0x%02x,AES1=0x%02x,AES2=0x%02x,AES3=0x%02x\n",
+			       iec958.status[0], iec958.status[1], iec958.status[2], iec958.status[3]);
+		else {
+			if (num_indices > 1 || all_indices)
+				printf("%sIndex: %d\n", found ? "\n" : "", index);
+			dump_iec958(&iec958);
 		}
-		if ((err = snd_ctl_elem_read(ctl, cval)) < 0) {
-			error("snd_ctl_elem_write", err);
-			return 1;
+		found++;
+		/* without a selection, only the first control */
+		if (!num_indices && !all_indices)
+			break;
+	}
+	if (json)
+		printf("]\n");
+	if (!found) {
+		fprintf(stderr, "control \"%s\" not found\n", spdif_str);
+		ret = 1;
+	}
+	for (i = 0; i < num_indices; i++) {
+		for (cidx = 0; cidx < controls; cidx++)
+			if (!strcmp(snd_ctl_elem_list_get_name(clist, cidx), spdif_str) &&
+			    (int)snd_ctl_elem_list_get_index(clist, cidx) == indices[i])
+				break;
+		if (cidx >= controls) {
+			fprintf(stderr, "control \"%s\" (index %d) not found\n",
+				spdif_str, indices[i]);
+			ret = 1;
 		}
-		snd_ctl_elem_value_get_iec958(cval, &iec958);
 	}
 
-	if (dumphex)
-		printf("AES0=0x%02x,AES1=0x%02x,AES2=0x%02x,AES3=0x%02x\n",
-		       iec958.status[0], iec958.status[1], iec958.status[2], iec958.status[3]);
-	else
-		dump_iec958(&iec958);
-
+	snd_ctl_elem_list_free_space(clist);
 	snd_ctl_close(ctl);
-	return 0;
+	free(indices);
+	free(sections);
+	return ret;
 }
@@ -0,0 +1,126 @@
+/*
+ *  bench.h - timing of the microbenchmarks run by 'make bench'
+ *  Copyright (c) 2026 by agent <agent@local>
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ */
+
+#ifndef __BENCH_H
+#define __BENCH_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <time.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define HAVE_CYCLE_COUNTER
+#endif
+
+/*
+ * The benchmarks print one line per trial: a table for reading, or with
+ * --json one JSON object whose keys keep the same order in each run, so
+ * that the results can be kept and compared over time. The identifying
+ * keys ("suite", "name", ...) come first, then the costs printed here.
+ */
+
+/* The accumulated cost of handling data frames. */
+struct bench_cost {
+	uint64_t nsec;
+	uint64_t cycles;
+	uint64_t frames;
+	uint64_t bytes;
+
+	struct timespec begin_ts;
+	uint64_t begin_cycles;
+};
+
+static inline uint64_t bench_read_cycles(void)
+{
+#ifdef HAVE_CYCLE_COUNTER
+	return __rdtsc();
+#else
+	return 0;
+#endif
+}
+
+static inline void bench_cost_begin(struct bench_cost *cost)
+{
+	clock_gettime(CLOCK_MONOTONIC_RAW, &cost->begin_ts);
+	cost->begin_cycles = bench_read_cycles();
+}
+
+static inline void bench_cost_end(struct bench_cost *cost,
+				  uint64_t frame_count,
+				  unsigned int bytes_per_frame)
+{
+	struct timespec end_ts;
+	uint64_t end_cycles;
+
+	end_cycles = bench_read_cycles();
+	clock_gettime(CLOCK_MONOTONIC_RAW, &end_ts);
+
+	cost->nsec += (end_ts.tv_sec - cost->begin_ts.tv_sec) * 1000000000ull +
+		      end_ts.tv_nsec - cost->begin_ts.tv_nsec;
+	cost->cycles += end_cycles - cost->begin_cycles;
+	cost->frames += frame_count;
+	cost->bytes += frame_count * bytes_per_frame;
+}
+
+/* MB/s and cycles per frame, as "<label>_mbps" and "<label>_cycles_per_frame" */
+static inline void bench_print_cost(const char *label,
+				    const struct bench_cost *cost, bool json)
+{
+	double mbps = 0.0;
+
+	if (cost->nsec > 0)
+		mbps = (double)cost->bytes * 1000.0 / cost->nsec;
+
+	if (json) {
+		printf(", \"%s_mbps\": %.1f", label, mbps);
+#ifdef HAVE_CYCLE_COUNTER
+		if (cost->frames > 0)
+			printf(", \"%s_cycles_per_frame\": %.1f", label,
+			       (double)cost->cycles / cost->frames);
+#endif
+		return;
+	}
+
+	printf(" %10.1f", mbps);
+
+#ifdef HAVE_CYCLE_COUNTER
+	if (cost->frames > 0)
+		printf(" %10.1f", (double)cost->cycles / cost->frames);
+	else
+		printf(" %10s", "-");
+#else
+	printf(" %10s", "-");
+#endif
+}
+
+/* microseconds per call, as "<label>_usec", for work not measured in frames */
+static inline void bench_print_time(const char *label,
+				    const struct bench_cost *cost,
+				    unsigned int calls, bool json)
+{
+	double usec = 0.0;
+
+	if (calls > 0)
+		usec = (double)cost->nsec / calls / 1000.0;
+
+	if (json)
+		printf(", \"%s_usec\": %.1f", label, usec);
+	else
+		printf(" %10.1f", usec);
+}
+
+#endif /* __BENCH_H */
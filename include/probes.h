@@ -0,0 +1,38 @@
+/*
+ *  probes.h - static probes for tracing tools
+ *  Copyright (c) 2026 by agent <agent@local>
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ */
+
+#ifndef __PROBES_H
+#define __PROBES_H
+
+/*
+ * USDT probes, which perf and bpftrace can attach to by name, for example
+ * 'usdt:/usr/bin/aplay:aplay:xrun'. A probe is a single nop until a tracer
+ * enables it. Without sys/sdt.h the probes expand to nothing and the
+ * arguments are not evaluated.
+ */
+#ifdef HAVE_SYS_SDT_H
+#include <sys/sdt.h>
+#define PROBE0(provider, name)			DTRACE_PROBE(provider, name)
+#define PROBE1(provider, name, a1)		DTRACE_PROBE1(provider, name, a1)
+#define PROBE2(provider, name, a1, a2)		DTRACE_PROBE2(provider, name, a1, a2)
+#define PROBE3(provider, name, a1, a2, a3)	DTRACE_PROBE3(provider, name, a1, a2, a3)
+#else
+#define PROBE0(provider, name)			do { } while (0)
+#define PROBE1(provider, name, a1)		do { } while (0)
+#define PROBE2(provider, name, a1, a2)		do { } while (0)
+#define PROBE3(provider, name, a1, a2, a3)	do { } while (0)
+#endif
+
+#endif /* __PROBES_H */
@@ -0,0 +1,601 @@
+/*
+ *  sample-kernels.h - loops over interleaved samples shared by the tools
+ *  Copyright (c) 2026 by agent <agent@local>
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ */
+
+#ifndef __SAMPLE_KERNELS_H
+#define __SAMPLE_KERNELS_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <endian.h>
+
+/*
+ * The kernels are specialized for width and byte order of samples and have
+ * no branch in the inner loop, so that the compiler can vectorize them for
+ * the target. The format is dispatched once per buffer by the caller.
+ *
+ * The users are:
+ *  - peaks: the level metering of aplay and alsamixer
+ *  - sample access and conversion: axfer (mapper-convert.c), bat
+ *    (convert.c) and speaker-test (store_channel())
+ *  - interleave and remap: axfer (mapper-single.c, mapper-multiple.c) and
+ *    aplay (remap_data())
+ *  - gain and silence: speaker-test
+ *
+ * Samples are loaded and stored by memcpy(3) of a constant size, since the
+ * buffers of the tools are not always aligned to the size of sample (e.g.
+ * the data chunk of a mapped file). Compilers turn it into a plain load.
+ */
+
+/*
+ * Peak of each channel as the absolute value. The mask is xored to each
+ * sample to turn unsigned formats into signed ones. With one channel, all
+ * samples are handled as one channel.
+ */
+#define DEFINE_PEAK_KERNEL(name, type, load)				\
+static inline void name(const void *data, size_t frames, int channels,	\
+			unsigned int mask, unsigned int *peaks)		\
+{									\
+	const type *valp = data;					\
+	size_t i;							\
+	int c;								\
+									\
+	if (channels == 1) {						\
+		unsigned int peak = peaks[0];				\
+		for (i = 0; i < frames; i++) {				\
+			signed int val = (type)(load(valp[i]) ^ mask);	\
+			unsigned int uval = val < 0 ? -(unsigned int)val : \
+						      (unsigned int)val; \
+			peak = peak < uval ? uval : peak;		\
+		}							\
+		peaks[0] = peak;					\
+		return;							\
+	}								\
+									\
+	for (i = 0; i < frames; i++) {					\
+		for (c = 0; c < channels; c++) {			\
+			signed int val = (type)(load(valp[c]) ^ mask);	\
+			unsigned int uval = val < 0 ? -(unsigned int)val : \
+						      (unsigned int)val; \
+			if (peaks[c] < uval)				\
+				peaks[c] = uval;			\
+		}							\
+		valp += channels;					\
+	}								\
+}
+
+#define SAMPLE_LOAD_NATIVE(x)	(x)
+
+DEFINE_PEAK_KERNEL(sample_peaks_8, signed char, SAMPLE_LOAD_NATIVE)
+DEFINE_PEAK_KERNEL(sample_peaks_16le, signed short, le16toh)
+DEFINE_PEAK_KERNEL(sample_peaks_16be, signed short, be16toh)
+DEFINE_PEAK_KERNEL(sample_peaks_32le, signed int, le32toh)
+DEFINE_PEAK_KERNEL(sample_peaks_32be, signed int, be32toh)
+
+/* samples in 3 bytes */
+static inline void sample_peaks_24(const void *data, size_t frames,
+				   int channels, unsigned int mask,
+				   unsigned int *peaks, int little)
+{
+	const unsigned char *valp = data;
+	int b0 = little ? 0 : 2;
+	int b2 = little ? 2 : 0;
+	size_t i;
+	int c;
+
+	for (i = 0; i < frames; i++) {
+		for (c = 0; c < channels; c++) {
+			const unsigned char *p = valp + c * 3;
+			unsigned int uval;
+			signed int val;
+
+			val = p[b0] | (p[1] << 8) | (p[b2] << 16);
+			/* Correct signed bit in 32-bit value */
+			val = (signed int)((unsigned int)(val ^ mask) << 8) >> 8;
+			uval = val < 0 ? -(unsigned int)val : (unsigned int)val;
+			if (peaks[c] < uval)
+				peaks[c] = uval;
+		}
+		valp += channels * 3;
+	}
+}
+
+/*
+ * Peak and sum of squares of each channel of native S16 samples, merged
+ * into the given results. Stereo has its own loop with the accumulators
+ * in registers, which is the common case of the level meters.
+ */
+static inline void sample_peak_sumsq_s16(const short *buf, size_t frames,
+					 int channels, unsigned int *peaks,
+					 unsigned long long *sums)
+{
+	size_t i;
+	int c;
+
+	if (channels == 2) {
+		unsigned int p0 = 0, p1 = 0, a0, a1;
+		unsigned long long s0 = 0, s1 = 0;
+		int v0, v1;
+
+		for (i = 0; i < frames; i++) {
+			v0 = buf[2 * i];
+			v1 = buf[2 * i + 1];
+			a0 = v0 < 0 ? -v0 : v0;
+			a1 = v1 < 0 ? -v1 : v1;
+			p0 = a0 > p0 ? a0 : p0;
+			p1 = a1 > p1 ? a1 : p1;
+			s0 += v0 * v0;
+			s1 += v1 * v1;
+		}
+		if (p0 > peaks[0])
+			peaks[0] = p0;
+		if (p1 > peaks[1])
+			peaks[1] = p1;
+		sums[0] += s0;
+		sums[1] += s1;
+		return;
+	}
+
+	for (i = 0; i < frames; i++) {
+		for (c = 0; c < channels; c++) {
+			int v = buf[c];
+			unsigned int a = v < 0 ? -v : v;
+
+			if (a > peaks[c])
+				peaks[c] = a;
+			sums[c] += v * v;
+		}
+		buf += channels;
+	}
+}
+
+/*
+ * Access to one sample, as a 32 bit signed integer aligned to MSB. The
+ * least significant bits are truncated when the format is narrower.
+ */
+static inline uint16_t sample_load16(const uint8_t *p)
+{
+	uint16_t val;
+
+	memcpy(&val, p, sizeof(val));
+	return val;
+}
+
+static inline uint32_t sample_load32(const uint8_t *p)
+{
+	uint32_t val;
+
+	memcpy(&val, p, sizeof(val));
+	return val;
+}
+
+static inline void sample_store16(uint8_t *p, uint16_t val)
+{
+	memcpy(p, &val, sizeof(val));
+}
+
+static inline void sample_store32(uint8_t *p, uint32_t val)
+{
+	memcpy(p, &val, sizeof(val));
+}
+
+#define SAMPLE_SIZE_S8		1
+#define SAMPLE_SIZE_U8		1
+#define SAMPLE_SIZE_S16_LE	2
+#define SAMPLE_SIZE_S16_BE	2
+#define SAMPLE_SIZE_S24_LE	4
+#define SAMPLE_SIZE_S24_BE	4
+#define SAMPLE_SIZE_S24_3LE	3
+#define SAMPLE_SIZE_S24_3BE	3
+#define SAMPLE_SIZE_S32_LE	4
+#define SAMPLE_SIZE_S32_BE	4
+
+static inline int32_t sample_read_S8(const uint8_t *p)
+{
+	return (int32_t)((uint32_t)p[0] << 24);
+}
+
+static inline int32_t sample_read_U8(const uint8_t *p)
+{
+	return (int32_t)((uint32_t)(p[0] ^ 0x80) << 24);
+}
+
+static inline int32_t sample_read_S16_LE(const uint8_t *p)
+{
+	return (int32_t)((uint32_t)le16toh(sample_load16(p)) << 16);
+}
+
+static inline int32_t sample_read_S16_BE(const uint8_t *p)
+{
+	return (int32_t)((uint32_t)be16toh(sample_load16(p)) << 16);
+}
+
+static inline int32_t sample_read_S24_LE(const uint8_t *p)
+{
+	return (int32_t)(le32toh(sample_load32(p)) << 8);
+}
+
+static inline int32_t sample_read_S24_BE(const uint8_t *p)
+{
+	return (int32_t)(be32toh(sample_load32(p)) << 8);
+}
+
+static inline int32_t sample_read_S24_3LE(const uint8_t *p)
+{
+	return (int32_t)(((uint32_t)p[0] << 8) | ((uint32_t)p[1] << 16) |
+			 ((uint32_t)p[2] << 24));
+}
+
+static inline int32_t sample_read_S24_3BE(const uint8_t *p)
+{
+	return (int32_t)(((uint32_t)p[2] << 8) | ((uint32_t)p[1] << 16) |
+			 ((uint32_t)p[0] << 24));
+}
+
+static inline int32_t sample_read_S32_LE(const uint8_t *p)
+{
+	return (int32_t)le32toh(sample_load32(p));
+}
+
+static inline int32_t sample_read_S32_BE(const uint8_t *p)
+{
+	return (int32_t)be32toh(sample_load32(p));
+}
+
+static inline void sample_write_S8(uint8_t *p, int32_t val)
+{
+	p[0] = (uint32_t)val >> 24;
+}
+
+static inline void sample_write_U8(uint8_t *p, int32_t val)
+{
+	p[0] = ((uint32_t)val >> 24) ^ 0x80;
+}
+
+static inline void sample_write_S16_LE(uint8_t *p, int32_t val)
+{
+	sample_store16(p, htole16((uint32_t)val >> 16));
+}
+
+static inline void sample_write_S16_BE(uint8_t *p, int32_t val)
+{
+	sample_store16(p, htobe16((uint32_t)val >> 16));
+}
+
+/* The most significant byte is for sign extension. */
+static inline void sample_write_S24_LE(uint8_t *p, int32_t val)
+{
+	sample_store32(p, htole32((uint32_t)(val >> 8)));
+}
+
+static inline void sample_write_S24_BE(uint8_t *p, int32_t val)
+{
+	sample_store32(p, htobe32((uint32_t)(val >> 8)));
+}
+
+static inline void sample_write_S24_3LE(uint8_t *p, int32_t val)
+{
+	p[0] = (uint32_t)val >> 8;
+	p[1] = (uint32_t)val >> 16;
+	p[2] = (uint32_t)val >> 24;
+}
+
+static inline void sample_write_S24_3BE(uint8_t *p, int32_t val)
+{
+	p[2] = (uint32_t)val >> 8;
+	p[1] = (uint32_t)val >> 16;
+	p[0] = (uint32_t)val >> 24;
+}
+
+static inline void sample_write_S32_LE(uint8_t *p, int32_t val)
+{
+	sample_store32(p, htole32((uint32_t)val));
+}
+
+static inline void sample_write_S32_BE(uint8_t *p, int32_t val)
+{
+	sample_store32(p, htobe32((uint32_t)val));
+}
+
+/*
+ * Conversion of interleaved or planar samples from one format to another.
+ * The kernels are instantiated by the users for the pairs they need.
+ */
+#define DEFINE_SAMPLE_CONVERT_KERNEL(src, dst)				\
+static void sample_convert_##src##_to_##dst(void *dst_buf,		\
+					     const void *src_buf,	\
+					     unsigned int sample_count)	\
+{									\
+	const uint8_t *s = src_buf;					\
+	uint8_t *d = dst_buf;						\
+	unsigned int i;							\
+									\
+	for (i = 0; i < sample_count; ++i) {				\
+		sample_write_##dst(d + i * SAMPLE_SIZE_##dst,		\
+			sample_read_##src(s + i * SAMPLE_SIZE_##src));	\
+	}								\
+}
+
+/*
+ * Store the samples of one channel into an interleaved buffer, with step
+ * bytes between frames. The samples are given aligned to MSB.
+ */
+#define DEFINE_SAMPLE_STORE_KERNEL(fmt)					\
+static inline void sample_store_##fmt(void *dst, size_t step,		\
+				      const int32_t *src, size_t count)	\
+{									\
+	uint8_t *d = dst;						\
+	size_t i;							\
+									\
+	for (i = 0; i < count; i++)					\
+		sample_write_##fmt(d + i * step, src[i]);		\
+}
+
+DEFINE_SAMPLE_STORE_KERNEL(S8)
+DEFINE_SAMPLE_STORE_KERNEL(S16_LE)
+DEFINE_SAMPLE_STORE_KERNEL(S16_BE)
+DEFINE_SAMPLE_STORE_KERNEL(S24_LE)
+DEFINE_SAMPLE_STORE_KERNEL(S24_BE)
+DEFINE_SAMPLE_STORE_KERNEL(S24_3LE)
+DEFINE_SAMPLE_STORE_KERNEL(S24_3BE)
+DEFINE_SAMPLE_STORE_KERNEL(S32_LE)
+DEFINE_SAMPLE_STORE_KERNEL(S32_BE)
+
+/*
+ * Conversion between little endian samples and floats in the range of the
+ * integer type, as used by the analysis of bat.
+ */
+static inline void sample_s16le_to_float(const void *buf, float *val,
+					 size_t count)
+{
+	const uint8_t *p = buf;
+	size_t i;
+
+	for (i = 0; i < count; i++)
+		val[i] = (float)(int16_t)le16toh(sample_load16(p + i * 2));
+}
+
+static inline void sample_s24_3le_to_float(const void *buf, float *val,
+					   size_t count)
+{
+	const uint8_t *p = buf;
+	size_t i = 0;
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+	/* one unaligned 32 bit load per sample, the top byte belongs to the
+	 * next sample, so the last one is left to the byte loop */
+	for (; i + 1 < count; i++)
+		val[i] = (float)((int32_t)(sample_load32(p + i * 3) << 8) >> 8);
+#endif
+	for (; i < count; i++)
+		val[i] = (float)(sample_read_S24_3LE(p + i * 3) >> 8);
+}
+
+static inline void sample_s32le_to_float(const void *buf, float *val,
+					 size_t count)
+{
+	const uint8_t *p = buf;
+	size_t i;
+
+	for (i = 0; i < count; i++)
+		val[i] = (float)(int32_t)le32toh(sample_load32(p + i * 4));
+}
+
+static inline void sample_float_to_s16le(const float *val, void *buf,
+					 size_t count)
+{
+	uint8_t *p = buf;
+	size_t i;
+
+	for (i = 0; i < count; i++)
+		sample_store16(p + i * 2, htole16((uint16_t)(int16_t)val[i]));
+}
+
+static inline void sample_float_to_s24_3le(const float *val, void *buf,
+					   size_t count)
+{
+	uint8_t *p = buf;
+	size_t i;
+
+	for (i = 0; i < count; i++)
+		sample_write_S24_3LE(p + i * 3,
+				     (int32_t)((uint32_t)(int32_t)val[i] << 8));
+}
+
+static inline void sample_float_to_s32le(const float *val, void *buf,
+					 size_t count)
+{
+	uint8_t *p = buf;
+	size_t i;
+
+	for (i = 0; i < count; i++)
+		sample_store32(p + i * 4, htole32((uint32_t)(int32_t)val[i]));
+}
+
+/* samples multiplied by the gain */
+static inline void sample_gain(float *dst, const float *src, size_t count,
+			       float gain)
+{
+	size_t i;
+
+	for (i = 0; i < count; i++)
+		dst[i] = src[i] * gain;
+}
+
+/*
+ * Samples in -1.0..1.0 multiplied by the gain and stored aligned to MSB,
+ * with saturation instead of the undefined conversion out of the range.
+ */
+static inline void sample_gain_to_s32(int32_t *dst, const float *src,
+				      size_t count, float gain)
+{
+	size_t i;
+
+	for (i = 0; i < count; i++) {
+		float v = src[i] * gain * 2147483648.0f;
+
+		v = v < 2147483520.0f ? v : 2147483520.0f;
+		v = v > -2147483648.0f ? v : -2147483648.0f;
+		dst[i] = (int32_t)v;
+	}
+}
+
+/*
+ * Fill the samples with the pattern of silence given in the order of
+ * bytes in memory, as snd_pcm_format_silence_64() returns it for samples
+ * in 1, 2, 4 or 8 bytes.
+ */
+static inline void sample_fill_silence(void *buf, size_t count,
+				       unsigned int width, uint64_t silence)
+{
+	uint8_t *p = buf;
+	size_t i;
+
+	if (silence == 0 || width == 1) {
+		memset(buf, (uint8_t)silence, count * width);
+		return;
+	}
+	for (i = 0; i < count; i++)
+		memcpy(p + i * width, &silence, width);
+}
+
+/*
+ * Interleave the channels of several buffers into one. The dst channel i
+ * is the first channel of srcs[i], which has src_channels[i] channels, or
+ * one when src_channels is NULL.
+ */
+static inline void sample_interleave_n(uint8_t *dst, char *const *srcs,
+				       const unsigned int *src_channels,
+				       unsigned int count, size_t frames,
+				       const unsigned int width)
+{
+	size_t j;
+	unsigned int i;
+
+	/* Write the interleaved buffer sequentially. */
+	for (j = 0; j < frames; j++) {
+		for (i = 0; i < count; i++) {
+			size_t pos = width * j *
+				     (src_channels ? src_channels[i] : 1);
+
+			memcpy(dst, srcs[i] + pos, width);
+			dst += width;
+		}
+	}
+}
+
+/*
+ * Deinterleave one buffer into several ones. dsts[i] receives
+ * dst_channels[i] channels of each frame, or one when dst_channels is NULL.
+ */
+static inline void sample_deinterleave_n(char *const *dsts,
+					 const unsigned int *dst_channels,
+					 unsigned int count,
+					 const uint8_t *src, size_t frames,
+					 const unsigned int width)
+{
+	size_t j;
+	unsigned int i, k;
+
+	/* Read the interleaved buffer sequentially. */
+	for (j = 0; j < frames; j++) {
+		for (i = 0; i < count; i++) {
+			unsigned int n = dst_channels ? dst_channels[i] : 1;
+			uint8_t *d = (uint8_t *)dsts[i] + width * n * j;
+
+			for (k = 0; k < n; k++) {
+				memcpy(d, src, width);
+				d += width;
+				src += width;
+			}
+		}
+	}
+}
+
+/* The width is given as constant to each case so that memcpy is inlined. */
+#define SAMPLE_WIDTH_DISPATCH(call, width)				\
+	switch (width) {						\
+	case 1: call(1); break;						\
+	case 2: call(2); break;						\
+	case 3: call(3); break;						\
+	case 4: call(4); break;						\
+	case 8: call(8); break;						\
+	default: call(width); break;					\
+	}
+
+static inline void sample_interleave(void *dst, char *const *srcs,
+				     const unsigned int *src_channels,
+				     unsigned int count, size_t frames,
+				     unsigned int width)
+{
+#define SAMPLE_INTERLEAVE(w) \
+	sample_interleave_n(dst, srcs, src_channels, count, frames, w)
+	SAMPLE_WIDTH_DISPATCH(SAMPLE_INTERLEAVE, width)
+#undef SAMPLE_INTERLEAVE
+}
+
+static inline void sample_deinterleave(char *const *dsts,
+				       const unsigned int *dst_channels,
+				       unsigned int count, const void *src,
+				       size_t frames, unsigned int width)
+{
+#define SAMPLE_DEINTERLEAVE(w) \
+	sample_deinterleave_n(dsts, dst_channels, count, src, frames, w)
+	SAMPLE_WIDTH_DISPATCH(SAMPLE_DEINTERLEAVE, width)
+#undef SAMPLE_DEINTERLEAVE
+}
+
+/*
+ * Reorder the channels of interleaved frames; the dst channel c is the src
+ * channel map[c]. The loop over channels is unrolled for stereo, which is
+ * the most usual case to be swapped.
+ */
+static inline void sample_remap_n(uint8_t *dst, const uint8_t *src,
+				  size_t frames, unsigned int channels,
+				  const unsigned int *map,
+				  const unsigned int width)
+{
+	size_t i;
+	unsigned int ch;
+
+	if (channels == 2) {
+		unsigned int l = map[0] * width, r = map[1] * width;
+
+		for (i = 0; i < frames; i++) {
+			memcpy(dst, src + l, width);
+			memcpy(dst + width, src + r, width);
+			dst += 2 * width;
+			src += 2 * width;
+		}
+		return;
+	}
+
+	for (i = 0; i < frames; i++) {
+		for (ch = 0; ch < channels; ch++)
+			memcpy(dst + ch * width, src + map[ch] * width, width);
+		dst += channels * width;
+		src += channels * width;
+	}
+}
+
+static inline void sample_remap(void *dst, const void *src, size_t frames,
+				unsigned int channels, const unsigned int *map,
+				unsigned int width)
+{
+#define SAMPLE_REMAP(w) sample_remap_n(dst, src, frames, channels, map, w)
+	SAMPLE_WIDTH_DISPATCH(SAMPLE_REMAP, width)
+#undef SAMPLE_REMAP
+}
+
+#endif /* __SAMPLE_KERNELS_H */
@@ -63,6 +63,8 @@ static void usage(void)
 	printf(_("     -l,--list           list current connections of each port\n"));
 	printf(_(" * Remove all exported connections\n"));
 	printf(_("     -x, --removeall\n"));
+	printf(_(" * Apply the connections listed in a file, removing the others\n"));
+	printf(_("   aconnect -f file [-options]\n"));
 }
 
 /*
@@ -243,12 +245,291 @@ static void remove_all_connections(snd_seq_t *seq)
 }
 
 
+/*
+ * apply a routing file
+ *
+ * Each line of the file has a sender and a receiver address, which may
+ * be quoted when a client name contains spaces; '#' starts a comment.
+ * The clients and ports are enumerated only once, the addresses are
+ * resolved from that list, and only the difference to the current
+ * connections is subscribed or unsubscribed.
+ */
+
+struct route_port {
+	snd_seq_addr_t addr;
+	char name[64];			/* of the client */
+	unsigned int caps;
+};
+
+struct route {
+	snd_seq_addr_t sender, dest;
+	int queue;
+	int keep;
+};
+
+struct route_state {
+	struct route_port *ports;
+	int nports;
+	struct route *routes;		/* current connections */
+	int nroutes;
+};
+
+static void *route_grow(void *array, int count, size_t size)
+{
+	/* grow in steps of 64 entries */
+	if (count % 64 == 0) {
+		array = realloc(array, (count + 64) * size);
+		if (!array) {
+			fprintf(stderr, _("out of memory\n"));
+			exit(1);
+		}
+	}
+	return array;
+}
+
+static void collect_port(struct route_state *st, snd_seq_t *seq,
+			 snd_seq_client_info_t *cinfo, snd_seq_port_info_t *pinfo)
+{
+	snd_seq_query_subscribe_t *query;
+	struct route_port *p;
+	struct route *r;
+
+	st->ports = route_grow(st->ports, st->nports, sizeof(*st->ports));
+	p = &st->ports[st->nports++];
+	p->addr = *snd_seq_port_info_get_addr(pinfo);
+	snprintf(p->name, sizeof(p->name), "%s", snd_seq_client_info_get_name(cinfo));
+	p->caps = snd_seq_port_info_get_capability(pinfo);
+
+	snd_seq_query_subscribe_alloca(&query);
+	snd_seq_query_subscribe_set_root(query, &p->addr);
+	snd_seq_query_subscribe_set_type(query, SND_SEQ_QUERY_SUBS_READ);
+	snd_seq_query_subscribe_set_index(query, 0);
+	while (snd_seq_query_port_subscribers(seq, query) >= 0) {
+		st->routes = route_grow(st->routes, st->nroutes, sizeof(*st->routes));
+		r = &st->routes[st->nroutes++];
+		r->sender = p->addr;
+		r->dest = *snd_seq_query_subscribe_get_addr(query);
+		r->queue = snd_seq_query_subscribe_get_queue(query);
+		r->keep = 0;
+		snd_seq_query_subscribe_set_index(query, snd_seq_query_subscribe_get_index(query) + 1);
+	}
+}
+
+static void collect_ports(struct route_state *st, snd_seq_t *seq)
+{
+	snd_seq_client_info_t *cinfo;
+	snd_seq_port_info_t *pinfo;
+
+	snd_seq_client_info_alloca(&cinfo);
+	snd_seq_port_info_alloca(&pinfo);
+	snd_seq_client_info_set_client(cinfo, -1);
+	while (snd_seq_query_next_client(seq, cinfo) >= 0) {
+		snd_seq_port_info_set_client(pinfo, snd_seq_client_info_get_client(cinfo));
+		snd_seq_port_info_set_port(pinfo, -1);
+		while (snd_seq_query_next_port(seq, pinfo) >= 0)
+			collect_port(st, seq, cinfo, pinfo);
+	}
+}
+
+static struct route_port *find_port(struct route_state *st, const snd_seq_addr_t *addr)
+{
+	int i;
+
+	for (i = 0; i < st->nports; i++)
+		if (st->ports[i].addr.client == addr->client &&
+		    st->ports[i].addr.port == addr->port)
+			return &st->ports[i];
+	return NULL;
+}
+
+/*
+ * resolve "client:port" like snd_seq_parse_address(), the client being a
+ * number, a name or a prefix of a name, but from the collected list
+ */
+static int resolve_address(struct route_state *st, const char *arg, snd_seq_addr_t *addr)
+{
+	char client[64], *end;
+	const char *sep;
+	size_t len;
+	long val;
+	int i, port = 0, prefix = -1;
+
+	sep = strrchr(arg, ':');
+	if (!sep)
+		sep = strrchr(arg, '.');
+	if (sep && sep[1] && strspn(sep + 1, "0123456789") == strlen(sep + 1)) {
+		port = atoi(sep + 1);
+		len = sep - arg;
+	} else {
+		len = strlen(arg);
+	}
+	if (len == 0 || len >= sizeof(client))
+		return -EINVAL;
+	memcpy(client, arg, len);
+	client[len] = '\0';
+
+	val = strtol(client, &end, 10);
+	if (*end == '\0') {
+		addr->client = val;
+		addr->port = port;
+		return 0;
+	}
+	for (i = 0; i < st->nports; i++) {
+		if (!strcmp(st->ports[i].name, client)) {
+			addr->client = st->ports[i].addr.client;
+			addr->port = port;
+			return 0;
+		}
+		if (prefix < 0 && !strncmp(st->ports[i].name, client, len))
+			prefix = i;
+	}
+	if (prefix < 0)
+		return -ENOENT;
+	addr->client = st->ports[prefix].addr.client;
+	addr->port = port;
+	return 0;
+}
+
+/* split the next word off the line, a word may be in double quotes */
+static char *next_word(char **line)
+{
+	char *p = *line, *word;
+
+	while (isspace((unsigned char)*p))
+		p++;
+	if (*p == '\0' || *p == '#')
+		return NULL;
+	if (*p == '"') {
+		word = ++p;
+		while (*p && *p != '"')
+			p++;
+	} else {
+		word = p;
+		while (*p && !isspace((unsigned char)*p))
+			p++;
+	}
+	if (*p)
+		*p++ = '\0';
+	*line = p;
+	return word;
+}
+
+/* connections that -f manages, the same ones that -x removes */
+static int route_exported(struct route_state *st, const struct route *r)
+{
+	struct route_port *dest = find_port(st, &r->dest);
+
+	return dest && (dest->caps & SND_SEQ_PORT_CAP_SUBS_WRITE) &&
+	       !(dest->caps & SND_SEQ_PORT_CAP_NO_EXPORT);
+}
+
+static int apply_routes(snd_seq_t *seq, const char *file, int queue, int exclusive,
+			int convert_time, int convert_real)
+{
+	struct route_state st;
+	snd_seq_port_subscribe_t *subs;
+	snd_seq_addr_t sender, dest;
+	char line[512], *p, *w1, *w2;
+	int i, lineno = 0, errors = 0, found;
+	FILE *fp;
+
+	if (strcmp(file, "-") == 0)
+		fp = stdin;
+	else
+		fp = fopen(file, "r");
+	if (!fp) {
+		fprintf(stderr, _("can't open %s: %s\n"), file, strerror(errno));
+		return 1;
+	}
+
+	memset(&st, 0, sizeof(st));
+	collect_ports(&st, seq);
+	snd_seq_port_subscribe_alloca(&subs);
+
+	while (fgets(line, sizeof(line), fp)) {
+		lineno++;
+		p = line;
+		w1 = next_word(&p);
+		if (!w1)
+			continue;
+		w2 = next_word(&p);
+		if (!w2) {
+			fprintf(stderr, _("%s:%d: missing receiver\n"), file, lineno);
+			errors++;
+			continue;
+		}
+		if (resolve_address(&st, w1, &sender) < 0) {
+			fprintf(stderr, _("%s:%d: invalid sender address %s\n"), file, lineno, w1);
+			errors++;
+			continue;
+		}
+		if (resolve_address(&st, w2, &dest) < 0) {
+			fprintf(stderr, _("%s:%d: invalid destination address %s\n"), file, lineno, w2);
+			errors++;
+			continue;
+		}
+
+		found = 0;
+		for (i = 0; i < st.nroutes; i++) {
+			struct route *r = &st.routes[i];
+			if (r->sender.client == sender.client && r->sender.port == sender.port &&
+			    r->dest.client == dest.client && r->dest.port == dest.port) {
+				r->keep = 1;
+				found = 1;
+			}
+		}
+		if (found)
+			continue;
+
+		snd_seq_port_subscribe_set_sender(subs, &sender);
+		snd_seq_port_subscribe_set_dest(subs, &dest);
+		snd_seq_port_subscribe_set_queue(subs, queue);
+		snd_seq_port_subscribe_set_exclusive(subs, exclusive);
+		snd_seq_port_subscribe_set_time_update(subs, convert_time);
+		snd_seq_port_subscribe_set_time_real(subs, convert_real);
+		if (snd_seq_subscribe_port(seq, subs) < 0) {
+			fprintf(stderr, _("%s:%d: connection failed (%s)\n"),
+				file, lineno, snd_strerror(errno));
+			errors++;
+			continue;
+		}
+		/* a duplicate line must not subscribe twice */
+		st.routes = route_grow(st.routes, st.nroutes, sizeof(*st.routes));
+		st.routes[st.nroutes].sender = sender;
+		st.routes[st.nroutes].dest = dest;
+		st.routes[st.nroutes].queue = queue;
+		st.routes[st.nroutes].keep = 1;
+		st.nroutes++;
+	}
+	if (fp != stdin)
+		fclose(fp);
+
+	/* remove the connections that are not in the file */
+	for (i = 0; i < st.nroutes; i++) {
+		struct route *r = &st.routes[i];
+		if (r->keep || !route_exported(&st, r))
+			continue;
+		snd_seq_port_subscribe_set_sender(subs, &r->sender);
+		snd_seq_port_subscribe_set_dest(subs, &r->dest);
+		snd_seq_port_subscribe_set_queue(subs, r->queue);
+		if (snd_seq_unsubscribe_port(seq, subs) < 0) {
+			fprintf(stderr, _("Disconnection failed (%s)\n"), snd_strerror(errno));
+			errors++;
+		}
+	}
+
+	free(st.ports);
+	free(st.routes);
+	return errors ? 1 : 0;
+}
+
+
 /*
  * main..
  */
 
 enum {
-	SUBSCRIBE, UNSUBSCRIBE, LIST, REMOVE_ALL
+	SUBSCRIBE, UNSUBSCRIBE, LIST, REMOVE_ALL, APPLY_FILE
 };
 
 static const struct option long_option[] = {
@@ -260,6 +541,7 @@ static const struct option long_option[] = {
 	{"exclusive", 0, NULL, 'e'},
 	{"list", 0, NULL, 'l'},
 	{"removeall", 0, NULL, 'x'},
+	{"file", 1, NULL, 'f'},
 	{NULL, 0, NULL, 0},
 };
 
@@ -274,13 +556,15 @@ int main(int argc, char **argv)
 	int list_subs = 0;
 	snd_seq_port_subscribe_t *subs;
 	snd_seq_addr_t sender, dest;
+	const char *route_file = NULL;
+	int err;
 
 #ifdef ENABLE_NLS
 	setlocale(LC_ALL, "");
 	textdomain(PACKAGE);
 #endif
 
-	while ((c = getopt_long(argc, argv, "dior:t:elx", long_option, NULL)) != -1) {
+	while ((c = getopt_long(argc, argv, "dior:t:elxf:", long_option, NULL)) != -1) {
 		switch (c) {
 		case 'd':
 			command = UNSUBSCRIBE;
@@ -313,6 +597,10 @@ int main(int argc, char **argv)
 		case 'x':
 			command = REMOVE_ALL;
 			break;
+		case 'f':
+			command = APPLY_FILE;
+			route_file = optarg;
+			break;
 		default:
 			usage();
 			exit(1);
@@ -336,6 +624,11 @@ int main(int argc, char **argv)
 		remove_all_connections(seq);
 		snd_seq_close(seq);
 		return 0;
+	case APPLY_FILE:
+		err = apply_routes(seq, route_file, queue, exclusive,
+				   convert_time, convert_real);
+		snd_seq_close(seq);
+		return err;
 	}
 
 	/* connection or disconnection */
@@ -24,9 +24,15 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdarg.h>
+#include <stdint.h>
 #include <string.h>
 #include <getopt.h>
 #include <unistd.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include <alsa/asoundlib.h>
 #include "aconfig.h"
 #include "version.h"
@@ -69,12 +75,51 @@ static int port_count;
 static snd_seq_addr_t *ports;
 static int queue;
 static int end_delay = 2;
-static const char *file_name;
-static FILE *file;
-static int file_offset;		/* current offset in input file */
-static int num_tracks;
-static struct track *tracks;
-static int smpte_timing;
+static int lookahead_ms = 500;
+static double start_seconds;
+static int tempo_percent = 100;
+static int queue_ppq;			/* of the queue while playing */
+static int gapless;
+static const char *cache_dir;
+
+/*
+ * The events of all tracks are allocated from large blocks, so loading a
+ * file does not need an allocation per event, the events of a track are
+ * close together in memory, and the whole song is freed block by block.
+ */
+#define EVENT_BLOCK_SIZE (64 * 1024)
+
+/* keep the events aligned */
+#define EVENT_ALIGN(size) (((size) + sizeof(void *) - 1) & ~(sizeof(void *) - 1))
+
+struct event_block {
+	struct event_block *next;
+	size_t size;
+	size_t used;
+	unsigned char data[0];
+};
+
+/*
+ * A file being loaded or played. With --gapless, the next file is loaded
+ * by a thread while the current one plays, so everything the parser
+ * touches lives here.
+ * The whole file is mapped (or read, if it cannot be mapped) before it is
+ * parsed, so reading a byte does not go through stdio.
+ */
+struct song {
+	const char *file_name;
+	const unsigned char *file_data;
+	int file_size;
+	int file_offset;		/* current offset in input file */
+	int file_mapped;
+	int num_tracks;
+	struct track *tracks;
+	int smpte_timing;
+	int ppq;			/* queue timing for the file */
+	int tempo;
+	struct event_block *event_blocks;
+	int ok;				/* loaded successfully */
+};
 
 /* prints an error message to stderr */
 static void errormsg(const char *msg, ...)
@@ -207,37 +252,47 @@ static void connect_ports(void)
 	}
 }
 
-static int read_byte(void)
+static int read_byte(struct song *song)
+{
+	if (song->file_offset >= song->file_size) {
+		/* remember that we tried to read beyond the end */
+		song->file_offset = song->file_size + 1;
+		return EOF;
+	}
+	return song->file_data[song->file_offset++];
+}
+
+/* whether a read beyond the end of the file has happened */
+static int end_of_file(struct song *song)
 {
-	++file_offset;
-	return getc(file);
+	return song->file_offset > song->file_size;
 }
 
 /* reads a little-endian 32-bit integer */
-static int read_32_le(void)
+static int read_32_le(struct song *song)
 {
 	int value;
-	value = read_byte();
-	value |= read_byte() << 8;
-	value |= read_byte() << 16;
-	value |= read_byte() << 24;
-	return !feof(file) ? value : -1;
+	value = read_byte(song);
+	value |= read_byte(song) << 8;
+	value |= read_byte(song) << 16;
+	value |= read_byte(song) << 24;
+	return !end_of_file(song) ? value : -1;
 }
 
 /* reads a 4-character identifier */
-static int read_id(void)
+static int read_id(struct song *song)
 {
-	return read_32_le();
+	return read_32_le(song);
 }
 #define MAKE_ID(c1, c2, c3, c4) ((c1) | ((c2) << 8) | ((c3) << 16) | ((c4) << 24))
 
 /* reads a fixed-size big-endian number */
-static int read_int(int bytes)
+static int read_int(struct song *song, int bytes)
 {
 	int c, value = 0;
 
 	do {
-		c = read_byte();
+		c = read_byte(song);
 		if (c == EOF)
 			return -1;
 		value = (value << 8) | c;
@@ -246,36 +301,56 @@ static int read_int(int bytes)
 }
 
 /* reads a variable-length number */
-static int read_var(void)
+static int read_var(struct song *song)
 {
 	int value, c;
 
-	c = read_byte();
+	c = read_byte(song);
 	value = c & 0x7f;
 	if (c & 0x80) {
-		c = read_byte();
+		c = read_byte(song);
 		value = (value << 7) | (c & 0x7f);
 		if (c & 0x80) {
-			c = read_byte();
+			c = read_byte(song);
 			value = (value << 7) | (c & 0x7f);
 			if (c & 0x80) {
-				c = read_byte();
+				c = read_byte(song);
 				value = (value << 7) | c;
 				if (c & 0x80)
 					return -1;
 			}
 		}
 	}
-	return !feof(file) ? value : -1;
+	return !end_of_file(song) ? value : -1;
+}
+
+static void *alloc_event_memory(struct song *song, size_t size)
+{
+	struct event_block *block = song->event_blocks;
+	void *p;
+
+	size = EVENT_ALIGN(size);
+	if (!block || block->size - block->used < size) {
+		size_t block_size = size > EVENT_BLOCK_SIZE ? size : EVENT_BLOCK_SIZE;
+
+		block = malloc(sizeof(*block) + block_size);
+		check_mem(block);
+		block->next = song->event_blocks;
+		block->size = block_size;
+		block->used = 0;
+		song->event_blocks = block;
+	}
+	p = block->data + block->used;
+	block->used += size;
+	return p;
 }
 
 /* allocates a new event */
-static struct event *new_event(struct track *track, int sysex_length)
+static struct event *new_event(struct song *song, struct track *track, int sysex_length)
 {
 	struct event *event;
 
-	event = malloc(sizeof(struct event) + sysex_length);
-	check_mem(event);
+	event = alloc_event_memory(song, sizeof(struct event) + sysex_length);
 
 	event->next = NULL;
 
@@ -289,31 +364,35 @@ static struct event *new_event(struct track *track, int sysex_length)
 	return event;
 }
 
-static void skip(int bytes)
+static void skip(struct song *song, int bytes)
 {
-	while (bytes > 0)
-		read_byte(), --bytes;
+	if (bytes <= 0)
+		return;
+	if (bytes > song->file_size - song->file_offset)
+		song->file_offset = song->file_size + 1;
+	else
+		song->file_offset += bytes;
 }
 
 /* reads one complete track from the file */
-static int read_track(struct track *track, int track_end)
+static int read_track(struct song *song, struct track *track, int track_end)
 {
 	int tick = 0;
 	unsigned char last_cmd = 0;
 	unsigned char port = 0;
 
 	/* the current file position is after the track ID and length */
-	while (file_offset < track_end) {
+	while (song->file_offset < track_end) {
 		unsigned char cmd;
 		struct event *event;
 		int delta_ticks, len, c;
 
-		delta_ticks = read_var();
+		delta_ticks = read_var(song);
 		if (delta_ticks < 0)
 			break;
 		tick += delta_ticks;
 
-		c = read_byte();
+		c = read_byte(song);
 		if (c < 0)
 			break;
 
@@ -324,8 +403,7 @@ static int read_track(struct track *track, int track_end)
 				last_cmd = cmd;
 		} else {
 			/* running status */
-			ungetc(c, file);
-			file_offset--;
+			song->file_offset--;
 			cmd = last_cmd;
 			if (!cmd)
 				goto _error;
@@ -348,35 +426,35 @@ static int read_track(struct track *track, int track_end)
 		case 0xa:
 		case 0xb:
 		case 0xe:
-			event = new_event(track, 0);
+			event = new_event(song, track, 0);
 			event->type = cmd_type[cmd >> 4];
 			event->port = port;
 			event->tick = tick;
 			event->data.d[0] = cmd & 0x0f;
-			event->data.d[1] = read_byte() & 0x7f;
-			event->data.d[2] = read_byte() & 0x7f;
+			event->data.d[1] = read_byte(song) & 0x7f;
+			event->data.d[2] = read_byte(song) & 0x7f;
 			break;
 
 		case 0xc: /* channel msg with 1 parameter byte */
 		case 0xd:
-			event = new_event(track, 0);
+			event = new_event(song, track, 0);
 			event->type = cmd_type[cmd >> 4];
 			event->port = port;
 			event->tick = tick;
 			event->data.d[0] = cmd & 0x0f;
-			event->data.d[1] = read_byte() & 0x7f;
+			event->data.d[1] = read_byte(song) & 0x7f;
 			break;
 
 		case 0xf:
 			switch (cmd) {
 			case 0xf0: /* sysex */
 			case 0xf7: /* continued sysex, or escaped commands */
-				len = read_var();
+				len = read_var(song);
 				if (len < 0)
 					goto _error;
 				if (cmd == 0xf0)
 					++len;
-				event = new_event(track, len);
+				event = new_event(song, track, len);
 				event->type = SND_SEQ_EVENT_SYSEX;
 				event->port = port;
 				event->tick = tick;
@@ -388,12 +466,12 @@ static int read_track(struct track *track, int track_end)
 					c = 0;
 				}
 				for (; c < len; ++c)
-					event->sysex[c] = read_byte();
+					event->sysex[c] = read_byte(song);
 				break;
 
 			case 0xff: /* meta event */
-				c = read_byte();
-				len = read_var();
+				c = read_byte(song);
+				len = read_var(song);
 				if (len < 0)
 					goto _error;
 
@@ -401,35 +479,35 @@ static int read_track(struct track *track, int track_end)
 				case 0x21: /* port number */
 					if (len < 1)
 						goto _error;
-					port = read_byte() % port_count;
-					skip(len - 1);
+					port = read_byte(song) % port_count;
+					skip(song, len - 1);
 					break;
 
 				case 0x2f: /* end of track */
 					track->end_tick = tick;
-					skip(track_end - file_offset);
+					skip(song, track_end - song->file_offset);
 					return 1;
 
 				case 0x51: /* tempo */
 					if (len < 3)
 						goto _error;
-					if (smpte_timing) {
+					if (song->smpte_timing) {
 						/* SMPTE timing doesn't change */
-						skip(len);
+						skip(song, len);
 					} else {
-						event = new_event(track, 0);
+						event = new_event(song, track, 0);
 						event->type = SND_SEQ_EVENT_TEMPO;
 						event->port = port;
 						event->tick = tick;
-						event->data.tempo = read_byte() << 16;
-						event->data.tempo |= read_byte() << 8;
-						event->data.tempo |= read_byte();
-						skip(len - 3);
+						event->data.tempo = read_byte(song) << 16;
+						event->data.tempo |= read_byte(song) << 8;
+						event->data.tempo |= read_byte(song);
+						skip(song, len - 3);
 					}
 					break;
 
 				default: /* ignore all other meta events */
-					skip(len);
+					skip(song, len);
 					break;
 				}
 				break;
@@ -444,54 +522,52 @@ static int read_track(struct track *track, int track_end)
 		}
 	}
 _error:
-	errormsg("%s: invalid MIDI data (offset %#x)", file_name, file_offset);
+	errormsg("%s: invalid MIDI data (offset %#x)", song->file_name, song->file_offset);
 	return 0;
 }
 
 /* reads an entire MIDI file */
-static int read_smf(void)
+static int read_smf(struct song *song)
 {
-	int header_len, type, time_division, i, err;
-	snd_seq_queue_tempo_t *queue_tempo;
+	int header_len, type, time_division, i;
 
 	/* the curren position is immediately after the "MThd" id */
-	header_len = read_int(4);
+	header_len = read_int(song, 4);
 	if (header_len < 6) {
 invalid_format:
-		errormsg("%s: invalid file format", file_name);
+		errormsg("%s: invalid file format", song->file_name);
 		return 0;
 	}
 
-	type = read_int(2);
+	type = read_int(song, 2);
 	if (type != 0 && type != 1) {
-		errormsg("%s: type %d format is not supported", file_name, type);
+		errormsg("%s: type %d format is not supported", song->file_name, type);
 		return 0;
 	}
 
-	num_tracks = read_int(2);
-	if (num_tracks < 1 || num_tracks > 1000) {
-		errormsg("%s: invalid number of tracks (%d)", file_name, num_tracks);
-		num_tracks = 0;
+	song->num_tracks = read_int(song, 2);
+	if (song->num_tracks < 1 || song->num_tracks > 1000) {
+		errormsg("%s: invalid number of tracks (%d)", song->file_name, song->num_tracks);
+		song->num_tracks = 0;
 		return 0;
 	}
-	tracks = calloc(num_tracks, sizeof(struct track));
-	if (!tracks) {
+	song->tracks = calloc(song->num_tracks, sizeof(struct track));
+	if (!song->tracks) {
 		errormsg("out of memory");
-		num_tracks = 0;
+		song->num_tracks = 0;
 		return 0;
 	}
 
-	time_division = read_int(2);
+	time_division = read_int(song, 2);
 	if (time_division < 0)
 		goto invalid_format;
 
 	/* interpret and set tempo */
-	snd_seq_queue_tempo_alloca(&queue_tempo);
-	smpte_timing = !!(time_division & 0x8000);
-	if (!smpte_timing) {
+	song->smpte_timing = !!(time_division & 0x8000);
+	if (!song->smpte_timing) {
 		/* time_division is ticks per quarter */
-		snd_seq_queue_tempo_set_tempo(queue_tempo, 500000); /* default: 120 bpm */
-		snd_seq_queue_tempo_set_ppq(queue_tempo, time_division);
+		song->tempo = 500000; /* default: 120 bpm */
+		song->ppq = time_division;
 	} else {
 		/* upper byte is negative frames per second */
 		i = 0x80 - ((time_division >> 8) & 0x7f);
@@ -500,112 +576,100 @@ invalid_format:
 		/* now pretend that we have quarter-note based timing */
 		switch (i) {
 		case 24:
-			snd_seq_queue_tempo_set_tempo(queue_tempo, 500000);
-			snd_seq_queue_tempo_set_ppq(queue_tempo, 12 * time_division);
+			song->tempo = 500000;
+			song->ppq = 12 * time_division;
 			break;
 		case 25:
-			snd_seq_queue_tempo_set_tempo(queue_tempo, 400000);
-			snd_seq_queue_tempo_set_ppq(queue_tempo, 10 * time_division);
+			song->tempo = 400000;
+			song->ppq = 10 * time_division;
 			break;
 		case 29: /* 30 drop-frame */
-			snd_seq_queue_tempo_set_tempo(queue_tempo, 100000000);
-			snd_seq_queue_tempo_set_ppq(queue_tempo, 2997 * time_division);
+			song->tempo = 100000000;
+			song->ppq = 2997 * time_division;
 			break;
 		case 30:
-			snd_seq_queue_tempo_set_tempo(queue_tempo, 500000);
-			snd_seq_queue_tempo_set_ppq(queue_tempo, 15 * time_division);
+			song->tempo = 500000;
+			song->ppq = 15 * time_division;
 			break;
 		default:
 			errormsg("%s: invalid number of SMPTE frames per second (%d)",
-				 file_name, i);
+				 song->file_name, i);
 			return 0;
 		}
 	}
-	err = snd_seq_set_queue_tempo(seq, queue, queue_tempo);
-	if (err < 0) {
-		errormsg("Cannot set queue tempo (%u/%i)",
-			 snd_seq_queue_tempo_get_tempo(queue_tempo),
-			 snd_seq_queue_tempo_get_ppq(queue_tempo));
-		return 0;
-	}
-
 	/* read tracks */
-	for (i = 0; i < num_tracks; ++i) {
+	for (i = 0; i < song->num_tracks; ++i) {
 		int len;
 
 		/* search for MTrk chunk */
 		for (;;) {
-			int id = read_id();
-			len = read_int(4);
-			if (feof(file)) {
-				errormsg("%s: unexpected end of file", file_name);
+			int id = read_id(song);
+			len = read_int(song, 4);
+			if (end_of_file(song)) {
+				errormsg("%s: unexpected end of file", song->file_name);
 				return 0;
 			}
 			if (len < 0 || len >= 0x10000000) {
-				errormsg("%s: invalid chunk length %d", file_name, len);
+				errormsg("%s: invalid chunk length %d", song->file_name, len);
 				return 0;
 			}
 			if (id == MAKE_ID('M', 'T', 'r', 'k'))
 				break;
-			skip(len);
+			skip(song, len);
 		}
-		if (!read_track(&tracks[i], file_offset + len))
+		if (!read_track(song, &song->tracks[i], song->file_offset + len))
 			return 0;
 	}
 	return 1;
 }
 
-static int read_riff(void)
+static int read_riff(struct song *song)
 {
 	/* skip file length */
-	read_byte();
-	read_byte();
-	read_byte();
-	read_byte();
+	read_byte(song);
+	read_byte(song);
+	read_byte(song);
+	read_byte(song);
 
 	/* check file type ("RMID" = RIFF MIDI) */
-	if (read_id() != MAKE_ID('R', 'M', 'I', 'D')) {
+	if (read_id(song) != MAKE_ID('R', 'M', 'I', 'D')) {
 invalid_format:
-		errormsg("%s: invalid file format", file_name);
+		errormsg("%s: invalid file format", song->file_name);
 		return 0;
 	}
 	/* search for "data" chunk */
 	for (;;) {
-		int id = read_id();
-		int len = read_32_le();
-		if (feof(file)) {
+		int id = read_id(song);
+		int len = read_32_le(song);
+		if (end_of_file(song)) {
 data_not_found:
-			errormsg("%s: data chunk not found", file_name);
+			errormsg("%s: data chunk not found", song->file_name);
 			return 0;
 		}
 		if (id == MAKE_ID('d', 'a', 't', 'a'))
 			break;
 		if (len < 0)
 			goto data_not_found;
-		skip((len + 1) & ~1);
+		skip(song, (len + 1) & ~1);
 	}
 	/* the "data" chunk must contain data in SMF format */
-	if (read_id() != MAKE_ID('M', 'T', 'h', 'd'))
+	if (read_id(song) != MAKE_ID('M', 'T', 'h', 'd'))
 		goto invalid_format;
-	return read_smf();
+	return read_smf(song);
 }
 
-static void cleanup_file_data(void)
+static void cleanup_file_data(struct song *song)
 {
-	int i;
-	struct event *event;
+	struct event_block *block;
 
-	for (i = 0; i < num_tracks; ++i) {
-		event = tracks[i].first_event;
-		while (event) {
-			struct event *next = event->next;
-			free(event);
-			event = next;
-		}
+	while (song->event_blocks) {
+		block = song->event_blocks;
+		song->event_blocks = block->next;
+		free(block);
 	}
-	num_tracks = 0;
-	free(tracks);
-	tracks = NULL;
+	song->num_tracks = 0;
+	free(song->tracks);
+	song->tracks = NULL;
 }
 
 static void handle_big_sysex(snd_seq_event_t *ev)
@@ -639,21 +703,131 @@ static void handle_big_sysex(snd_seq_event_t *ev)
 	ev->data.ext.len = length;
 }
 
-static void play_midi(void)
+/*
+ * The tracks with events left are kept in a min-heap ordered by the tick of
+ * their current event, so that the next event is found in O(log tracks).
+ * Ties go to the lower track number, like a scan of all tracks would do.
+ */
+static int track_before(const struct track *a, const struct track *b)
+{
+	if (a->current_event->tick != b->current_event->tick)
+		return a->current_event->tick < b->current_event->tick;
+	return a < b;
+}
+
+static void heap_sift_down(struct track **heap, int size, int i)
+{
+	struct track *t = heap[i];
+	int child;
+
+	while ((child = 2 * i + 1) < size) {
+		if (child + 1 < size && track_before(heap[child + 1], heap[child]))
+			++child;
+		if (!track_before(heap[child], t))
+			break;
+		heap[i] = heap[child];
+		i = child;
+	}
+	heap[i] = t;
+}
+
+/* the number of ticks played in lookahead_ms at the tempo */
+static int lookahead_ticks(int tempo)
+{
+	if (lookahead_ms <= 0 || tempo <= 0)
+		return 0;
+	return (long long)lookahead_ms * 1000 * queue_ppq / tempo *
+		tempo_percent / 100 + 1;
+}
+
+/*
+ * Blocks until the queue has reached the tick. The queue position is
+ * polled, so the wait does not depend on an event delivered back to us,
+ * and it ends when the queue is no longer running.
+ */
+#define WAIT_POLL_US	10000
+
+static void wait_for_tick(int tick)
+{
+	snd_seq_queue_status_t *status;
+	int err;
+
+	snd_seq_queue_status_alloca(&status);
+
+	err = snd_seq_drain_output(seq);
+	check_snd("drain output", err);
+
+	for (;;) {
+		err = snd_seq_get_queue_status(seq, queue, status);
+		check_snd("get queue status", err);
+		if ((int)snd_seq_queue_status_get_tick_time(status) >= tick)
+			break;
+		if (!snd_seq_queue_status_get_status(status))
+			break;
+		usleep(WAIT_POLL_US);
+	}
+}
+
+/* the tick at the --start position, found by walking the tempo changes */
+static int seek_tick(struct song *song, struct event *event, double *time_us, int *last_tick, int *tempo)
+{
+	double start_us = start_seconds * 1000000.0;
+	double t = *time_us + (double)(event->tick - *last_tick) * *tempo / song->ppq;
+
+	if (t < start_us) {
+		*time_us = t;
+		*last_tick = event->tick;
+		if (event->type == SND_SEQ_EVENT_TEMPO)
+			*tempo = event->data.tempo;
+		return -1;
+	}
+	return *last_tick + (int)((start_us - *time_us) * song->ppq / *tempo);
+}
+
+/* convert a tick of the song to a tick of the queue */
+static int song_to_queue_tick(struct song *song, int tick, int start, int start_tick)
+{
+	if (song->ppq == queue_ppq)
+		return start + tick - start_tick;
+	return start + (long long)(tick - start_tick) * queue_ppq / song->ppq;
+}
+
+/*
+ * Queue the events of the song, beginning at the queue tick start. For the
+ * first song, start is 0 and the queue is set up and started; later songs
+ * (with --gapless) are appended to the running queue.
+ * Returns the queue tick where the song ends.
+ */
+static int play_midi(struct song *song, int start)
 {
 	snd_seq_event_t ev;
-	int i, max_tick, err;
+	snd_seq_queue_tempo_t *queue_tempo;
+	struct track **heap;
+	struct track *tracks = song->tracks;
+	int i, max_tick, heap_size, err;
+	int tempo = song->tempo, window, wait_tick = start;
+	int start_tick = 0, seek_last_tick = 0;
+	int seeking = start == 0 && start_seconds > 0;
+	double seek_time_us = 0;
 
 	/* calculate length of the entire file */
 	max_tick = -1;
-	for (i = 0; i < num_tracks; ++i) {
+	for (i = 0; i < song->num_tracks; ++i) {
 		if (tracks[i].end_tick > max_tick)
 			max_tick = tracks[i].end_tick;
 	}
 
 	/* initialize current position in each track */
-	for (i = 0; i < num_tracks; ++i)
+	heap = malloc(song->num_tracks * sizeof(*heap) + 1);
+	check_mem(heap);
+	heap_size = 0;
+	for (i = 0; i < song->num_tracks; ++i) {
 		tracks[i].current_event = tracks[i].first_event;
+		if (tracks[i].current_event)
+			heap[heap_size++] = &tracks[i];
+	}
+	for (i = heap_size / 2 - 1; i >= 0; --i)
+		heap_sift_down(heap, heap_size, i);
 
 	/* common settings for all our events */
 	snd_seq_ev_clear(&ev);
@@ -661,35 +835,79 @@ static void play_midi(void)
 	ev.source.port = 0;
 	ev.flags = SND_SEQ_TIME_STAMP_TICK;
 
-	err = snd_seq_start_queue(seq, queue, NULL);
-	check_snd("start queue", err);
-	/* The queue won't be started until the START_QUEUE event is
-	 * actually drained to the kernel, which is exactly what we want. */
+	if (start == 0) {
+		/* the queue runs with the timing of the first song */
+		queue_ppq = song->ppq;
+		snd_seq_queue_tempo_alloca(&queue_tempo);
+		snd_seq_queue_tempo_set_tempo(queue_tempo, song->tempo);
+		snd_seq_queue_tempo_set_ppq(queue_tempo, queue_ppq);
+		snd_seq_queue_tempo_set_skew(queue_tempo, 0x10000LL * tempo_percent / 100);
+		snd_seq_queue_tempo_set_skew_base(queue_tempo, 0x10000);
+		err = snd_seq_set_queue_tempo(seq, queue, queue_tempo);
+		check_snd("set queue tempo", err);
+
+		err = snd_seq_start_queue(seq, queue, NULL);
+		check_snd("start queue", err);
+		/* The queue won't be started until the START_QUEUE event is
+		 * actually drained to the kernel, which is exactly what we want. */
+	} else {
+		/* restore the initial tempo of this song */
+		snd_seq_ev_set_fixed(&ev);
+		ev.type = SND_SEQ_EVENT_TEMPO;
+		ev.time.tick = start;
+		ev.dest.client = SND_SEQ_CLIENT_SYSTEM;
+		ev.dest.port = SND_SEQ_PORT_SYSTEM_TIMER;
+		ev.data.queue.queue = queue;
+		ev.data.queue.param.value = song->tempo;
+		err = snd_seq_event_output(seq, &ev);
+		check_snd("output event", err);
+	}
+
+	window = lookahead_ticks(tempo);
 
-	for (;;) {
-		struct event* event = NULL;
-		struct track* event_track = NULL;
-		int i, min_tick = max_tick + 1;
-
-		/* search next event */
-		for (i = 0; i < num_tracks; ++i) {
-			struct track *track = &tracks[i];
-			struct event *e2 = track->current_event;
-			if (e2 && e2->tick < min_tick) {
-				min_tick = e2->tick;
-				event = e2;
-				event_track = track;
-			}
-		}
-		if (!event)
-			break; /* end of song reached */
+	while (heap_size > 0) {
+		struct track *event_track = heap[0];
+		struct event *event = event_track->current_event;
+		int tick;
 
 		/* advance pointer to next event */
 		event_track->current_event = event->next;
+		if (!event_track->current_event)
+			heap[0] = heap[--heap_size];
+		if (heap_size > 0)
+			heap_sift_down(heap, heap_size, 0);
+
+		/*
+		 * Before the start position, the notes are dropped and all
+		 * other events are sent at once, so that the controllers,
+		 * programs and the tempo are set up when playing starts.
+		 */
+		if (seeking) {
+			start_tick = seek_tick(song, event, &seek_time_us, &seek_last_tick, &tempo);
+			if (start_tick < 0) {
+				start_tick = 0;
+				if (event->type == SND_SEQ_EVENT_NOTEON ||
+				    event->type == SND_SEQ_EVENT_NOTEOFF ||
+				    event->type == SND_SEQ_EVENT_KEYPRESS)
+					continue;
+				tick = 0;
+				goto output;
+			}
+			seeking = 0;
+			window = lookahead_ticks(tempo);
+		}
+		tick = song_to_queue_tick(song, event->tick, start, start_tick);
 
+		/* keep no more than the lookahead window in the queue */
+		if (window > 0 && tick - window > wait_tick) {
+			wait_tick = tick - window;
+			wait_for_tick(wait_tick);
+		}
+
+output:
 		/* output the event */
 		ev.type = event->type;
-		ev.time.tick = event->tick;
+		ev.time.tick = tick;
 		ev.dest = ports[event->port];
 		switch (ev.type) {
 		case SND_SEQ_EVENT_NOTEON:
@@ -730,6 +948,10 @@ static void play_midi(void)
 			ev.dest.port = SND_SEQ_PORT_SYSTEM_TIMER;
 			ev.data.queue.queue = queue;
 			ev.data.queue.param.value = event->data.tempo;
+			if (!seeking) {
+				tempo = event->data.tempo;
+				window = lookahead_ticks(tempo);
+			}
 			break;
 		default:
 			fatal("Invalid event type %d!", ev.type);
@@ -739,11 +961,29 @@ static void play_midi(void)
 		err = snd_seq_event_output(seq, &ev);
 		check_snd("output event", err);
 	}
+	free(heap);
+	/* the start position is after the last event */
+	if (seeking)
+		start_tick = max_tick;
+	if (max_tick < start_tick)
+		return start;
+	return song_to_queue_tick(song, max_tick, start, start_tick);
+}
+
+/* stop the queue at end_tick and wait until everything has been played */
+static void finish(int end_tick)
+{
+	snd_seq_event_t ev;
+	int err;
 
 	/* schedule queue stop at end of song */
+	snd_seq_ev_clear(&ev);
 	snd_seq_ev_set_fixed(&ev);
 	ev.type = SND_SEQ_EVENT_STOP;
-	ev.time.tick = max_tick;
+	ev.flags = SND_SEQ_TIME_STAMP_TICK;
+	ev.queue = queue;
+	ev.source.port = 0;
+	ev.time.tick = end_tick;
 	ev.dest.client = SND_SEQ_CLIENT_SYSTEM;
 	ev.dest.port = SND_SEQ_PORT_SYSTEM_TIMER;
 	ev.data.queue.queue = queue;
@@ -771,41 +1011,428 @@ static void play_midi(void)
 		sleep(end_delay);
 }
 
-static void play_file(void)
+/* maps the file, or reads it if it is not a regular file */
+static int open_file_data(struct song *song, int fd, const struct stat *st)
+{
+	unsigned char *buf = NULL, *p;
+	size_t size = 0, alloc = 0;
+	ssize_t len;
+
+	if (S_ISREG(st->st_mode)) {
+		if (st->st_size > INT_MAX) {
+			errormsg("%s: file too large", song->file_name);
+			return 0;
+		}
+		song->file_size = st->st_size;
+		if (song->file_size == 0)
+			return 1;
+		p = mmap(NULL, song->file_size, PROT_READ, MAP_PRIVATE, fd, 0);
+		if (p != MAP_FAILED) {
+			madvise(p, song->file_size, MADV_SEQUENTIAL);
+			song->file_data = p;
+			song->file_mapped = 1;
+			return 1;
+		}
+	}
+
+	for (;;) {
+		if (size == alloc) {
+			if (alloc >= INT_MAX) {
+				errormsg("%s: file too large", song->file_name);
+				free(buf);
+				return 0;
+			}
+			alloc = alloc ? alloc * 2 : 64 * 1024;
+			p = realloc(buf, alloc);
+			check_mem(p);
+			buf = p;
+		}
+		len = read(fd, buf + size, alloc - size);
+		if (len < 0) {
+			if (errno == EINTR)
+				continue;
+			errormsg("Cannot read %s - %s", song->file_name, strerror(errno));
+			free(buf);
+			return 0;
+		}
+		if (len == 0)
+			break;
+		size += len;
+	}
+	song->file_data = buf;
+	song->file_size = size > INT_MAX ? INT_MAX : size;
+	return 1;
+}
+
+static void close_file_data(struct song *song)
+{
+	if (song->file_mapped)
+		munmap((void *)song->file_data, song->file_size);
+	else
+		free((void *)song->file_data);
+	song->file_data = NULL;
+	song->file_size = 0;
+	song->file_mapped = 0;
+}
+
+/*
+ * With --cache, the events of a parsed file are stored in the cache
+ * directory as one track, already merged in the order in which they are
+ * played. The next time the file is played, the events are read back in
+ * one go and only the links of the list have to be restored.
+ * The events are stored in the layout of this build, and the cache entry
+ * is used only while the size, the time of modification and the inode of
+ * the file, and the number of ports (which limits the port numbers in the
+ * events) are the same.
+ */
+#define CACHE_MAGIC	"APMC"
+#define CACHE_VERSION	1
+
+struct cache_header {
+	char magic[4];
+	uint32_t version;
+	uint32_t event_size;
+	uint32_t port_count;
+	uint64_t file_dev;
+	uint64_t file_ino;
+	uint64_t file_size;
+	int64_t file_mtime_ns;
+	int32_t smpte_timing;
+	int32_t ppq;
+	int32_t tempo;
+	int32_t end_tick;
+	uint64_t events_size;
+};
+
+static size_t event_memory_size(const struct event *event)
+{
+	size_t size = sizeof(struct event);
+
+	if (event->type == SND_SEQ_EVENT_SYSEX)
+		size += event->data.length;
+	return EVENT_ALIGN(size);
+}
+
+static void cache_header_init(struct cache_header *header, const struct stat *st)
+{
+	memset(header, 0, sizeof(*header));
+	memcpy(header->magic, CACHE_MAGIC, sizeof(header->magic));
+	header->version = CACHE_VERSION;
+	header->event_size = sizeof(struct event);
+	header->port_count = port_count;
+	header->file_dev = st->st_dev;
+	header->file_ino = st->st_ino;
+	header->file_size = st->st_size;
+	header->file_mtime_ns = (int64_t)st->st_mtim.tv_sec * 1000000000 + st->st_mtim.tv_nsec;
+}
+
+/* the name of the cache entry is a hash of the absolute path of the file */
+static char *cache_path(const char *name)
+{
+	char *real, *path, *c;
+	uint64_t hash = 0xcbf29ce484222325ULL;	/* FNV-1a */
+
+	real = realpath(name, NULL);
+	if (!real)
+		return NULL;
+	for (c = real; *c; ++c) {
+		hash ^= (unsigned char)*c;
+		hash *= 0x100000001b3ULL;
+	}
+	free(real);
+	if (asprintf(&path, "%s/%016llx.apmc", cache_dir, (unsigned long long)hash) < 0)
+		return NULL;
+	return path;
+}
+
+static int read_all(int fd, void *buf, size_t size)
+{
+	ssize_t len;
+
+	while (size > 0) {
+		len = read(fd, buf, size);
+		if (len < 0 && errno == EINTR)
+			continue;
+		if (len <= 0)
+			return 0;
+		buf = (char *)buf + len;
+		size -= len;
+	}
+	return 1;
+}
+
+static int write_all(int fd, const void *buf, size_t size)
+{
+	ssize_t len;
+
+	while (size > 0) {
+		len = write(fd, buf, size);
+		if (len < 0 && errno == EINTR)
+			continue;
+		if (len <= 0)
+			return 0;
+		buf = (const char *)buf + len;
+		size -= len;
+	}
+	return 1;
+}
+
+static int load_cached_song(struct song *song, const char *path, const struct stat *st)
 {
-	int ok;
+	struct cache_header header, expected;
+	struct event_block *block;
+	struct event *event, *prev = NULL;
+	size_t offset;
+	int fd, ok = 0;
+
+	fd = open(path, O_RDONLY | O_CLOEXEC);
+	if (fd < 0)
+		return 0;
+	if (!read_all(fd, &header, sizeof(header)))
+		goto out;
+	cache_header_init(&expected, st);
+	if (memcmp(header.magic, expected.magic, sizeof(header.magic)) ||
+	    header.version != expected.version ||
+	    header.event_size != expected.event_size ||
+	    header.port_count != expected.port_count ||
+	    header.file_dev != expected.file_dev ||
+	    header.file_ino != expected.file_ino ||
+	    header.file_size != expected.file_size ||
+	    header.file_mtime_ns != expected.file_mtime_ns ||
+	    header.events_size > (uint64_t)INT_MAX ||
+	    header.events_size % sizeof(void *))
+		goto out;
+
+	song->tracks = calloc(1, sizeof(struct track));
+	check_mem(song->tracks);
+	song->num_tracks = 1;
+	song->smpte_timing = header.smpte_timing;
+	song->ppq = header.ppq;
+	song->tempo = header.tempo;
+	song->tracks[0].end_tick = header.end_tick;
+	if (header.events_size == 0) {
+		ok = 1;
+		goto out;
+	}
+
+	block = malloc(sizeof(*block) + header.events_size);
+	check_mem(block);
+	block->next = NULL;
+	block->size = header.events_size;
+	block->used = header.events_size;
+	song->event_blocks = block;
+	if (!read_all(fd, block->data, block->size))
+		goto out;
+
+	/* restore the links, and check that the events fill the block */
+	for (offset = 0; offset < block->size; offset += event_memory_size(event)) {
+		if (block->size - offset < sizeof(struct event))
+			goto out;
+		event = (struct event *)(block->data + offset);
+		if (event->type == SND_SEQ_EVENT_SYSEX &&
+		    event->data.length > block->size - offset - sizeof(struct event))
+			goto out;
+		event->next = NULL;
+		if (prev)
+			prev->next = event;
+		else
+			song->tracks[0].first_event = event;
+		prev = event;
+	}
+	ok = 1;
+out:
+	close(fd);
+	if (!ok)
+		cleanup_file_data(song);
+	return ok;
+}
+
+/* stores the events of all tracks in the order of play_midi() */
+static void save_cached_song(struct song *song, const char *path, const struct stat *st)
+{
+	struct cache_header header;
+	struct track **heap;
+	struct event *event;
+	unsigned char *buf;
+	char *tmp_path;
+	size_t size = 0, offset = 0;
+	int i, heap_size = 0, end_tick = 0, fd, ok;
+
+	for (i = 0; i < song->num_tracks; ++i) {
+		if (song->tracks[i].end_tick > end_tick)
+			end_tick = song->tracks[i].end_tick;
+		for (event = song->tracks[i].first_event; event; event = event->next)
+			size += event_memory_size(event);
+	}
+
+	/* the padding is written too, so the entry is always the same */
+	buf = calloc(1, size + 1);
+	check_mem(buf);
+	heap = malloc(song->num_tracks * sizeof(*heap) + 1);
+	check_mem(heap);
+	for (i = 0; i < song->num_tracks; ++i) {
+		song->tracks[i].current_event = song->tracks[i].first_event;
+		if (song->tracks[i].current_event)
+			heap[heap_size++] = &song->tracks[i];
+	}
+	for (i = heap_size / 2 - 1; i >= 0; --i)
+		heap_sift_down(heap, heap_size, i);
+	while (heap_size > 0) {
+		struct track *event_track = heap[0];
+		struct event *copy;
 
-	if (!strcmp(file_name, "-"))
-		file = stdin;
+		event = event_track->current_event;
+		event_track->current_event = event->next;
+		if (!event_track->current_event)
+			heap[0] = heap[--heap_size];
+		if (heap_size > 0)
+			heap_sift_down(heap, heap_size, 0);
+
+		copy = (struct event *)(buf + offset);
+		copy->type = event->type;
+		copy->port = event->port;
+		copy->tick = event->tick;
+		copy->data = event->data;
+		if (event->type == SND_SEQ_EVENT_SYSEX)
+			memcpy(copy->sysex, event->sysex, event->data.length);
+		offset += event_memory_size(event);
+	}
+	free(heap);
+
+	cache_header_init(&header, st);
+	header.smpte_timing = song->smpte_timing;
+	header.ppq = song->ppq;
+	header.tempo = song->tempo;
+	header.end_tick = end_tick;
+	header.events_size = size;
+
+	/* write to a new file, so that other players never see a partial entry */
+	if (asprintf(&tmp_path, "%s.XXXXXX", path) < 0) {
+		free(buf);
+		return;
+	}
+	fd = mkstemp(tmp_path);
+	if (fd < 0) {
+		errormsg("Cannot create %s - %s", tmp_path, strerror(errno));
+		free(tmp_path);
+		free(buf);
+		return;
+	}
+	ok = write_all(fd, &header, sizeof(header)) && write_all(fd, buf, size);
+	ok = !close(fd) && ok;
+	if (!ok || rename(tmp_path, path) < 0) {
+		errormsg("Cannot write %s - %s", path, strerror(errno));
+		unlink(tmp_path);
+	}
+	free(tmp_path);
+	free(buf);
+}
+
+static void load_song(struct song *song, const char *name)
+{
+	struct stat st;
+	char *cache = NULL;
+	int fd;
+
+	memset(song, 0, sizeof(*song));
+	song->file_name = name;
+	if (!strcmp(name, "-"))
+		fd = STDIN_FILENO;
 	else
-		file = fopen(file_name, "rb");
-	if (!file) {
-		errormsg("Cannot open %s - %s", file_name, strerror(errno));
+		fd = open(name, O_RDONLY | O_CLOEXEC);
+	if (fd < 0) {
+		errormsg("Cannot open %s - %s", name, strerror(errno));
 		return;
 	}
+	if (fstat(fd, &st) < 0) {
+		errormsg("Cannot stat %s - %s", name, strerror(errno));
+		goto out;
+	}
 
-	file_offset = 0;
-	ok = 0;
+	if (cache_dir && fd != STDIN_FILENO && S_ISREG(st.st_mode)) {
+		cache = cache_path(name);
+		if (cache && load_cached_song(song, cache, &st)) {
+			song->ok = 1;
+			goto out;
+		}
+	}
+
+	if (!open_file_data(song, fd, &st))
+		goto out;
 
-	switch (read_id()) {
+	switch (read_id(song)) {
 	case MAKE_ID('M', 'T', 'h', 'd'):
-		ok = read_smf();
+		song->ok = read_smf(song);
 		break;
 	case MAKE_ID('R', 'I', 'F', 'F'):
-		ok = read_riff();
+		song->ok = read_riff(song);
 		break;
 	default:
-		errormsg("%s is not a Standard MIDI File", file_name);
+		errormsg("%s is not a Standard MIDI File", name);
 		break;
 	}
+	close_file_data(song);
+
+	if (song->ok && cache)
+		save_cached_song(song, cache, &st);
+out:
+	free(cache);
+	if (fd != STDIN_FILENO)
+		close(fd);
+	if (!song->ok)
+		cleanup_file_data(song);
+}
+
+static void play_file(const char *name)
+{
+	struct song song;
 
-	if (file != stdin)
-		fclose(file);
+	load_song(&song, name);
+	if (song.ok)
+		finish(play_midi(&song, 0));
+	cleanup_file_data(&song);
+}
+
+static void *load_song_thread(void *arg)
+{
+	struct song *song = arg;
 
-	if (ok)
-		play_midi();
+	load_song(song, song->file_name);
+	return NULL;
+}
 
-	cleanup_file_data();
+/*
+ * Play the files back to back on one queue: while a song is being queued,
+ * the next one is read by a thread, and its events are appended at the
+ * tick where the current song ends.
+ */
+static void play_gapless(char **names, int count)
+{
+	struct song songs[2], *cur = &songs[0], *next = &songs[1], *tmp;
+	pthread_t thread;
+	int i, end_tick = 0, started = 0, err;
+
+	load_song(cur, names[0]);
+	for (i = 0; i < count; ++i) {
+		if (i + 1 < count) {
+			next->file_name = names[i + 1];
+			err = pthread_create(&thread, NULL, load_song_thread, next);
+			if (err)
+				fatal("Cannot create thread - %s", strerror(err));
+		}
+		if (cur->ok) {
+			end_tick = play_midi(cur, started ? end_tick : 0);
+			started = 1;
+		}
+		cleanup_file_data(cur);
+		if (i + 1 < count)
+			pthread_join(thread, NULL);
+		tmp = cur;
+		cur = next;
+		next = tmp;
+	}
+	if (started)
+		finish(end_tick);
 }
 
 static void list_ports(void)
@@ -851,7 +1478,12 @@ static void usage(const char *argv0)
 		"-V, --version               print current version\n"
 		"-l, --list                  list all possible output ports\n"
 		"-p, --port=client:port,...  set port(s) to play to\n"
-		"-d, --delay=seconds         delay after song ends\n",
+		"-d, --delay=seconds         delay after song ends\n"
+		"-a, --lookahead=ms          queue at most this much ahead (0 = all)\n"
+		"-s, --start=seconds         start playing at this position\n"
+		"-t, --tempo=percent         play faster or slower\n"
+		"-g, --gapless               play the files without pauses in between\n"
+		"-c, --cache=directory       keep the parsed files in the directory\n",
 		argv0);
 }
 
@@ -862,13 +1494,18 @@ static void version(void)
 
 int main(int argc, char *argv[])
 {
-	static const char short_options[] = "hVlp:d:";
+	static const char short_options[] = "hVlp:d:a:s:t:gc:";
 	static const struct option long_options[] = {
 		{"help", 0, NULL, 'h'},
 		{"version", 0, NULL, 'V'},
 		{"list", 0, NULL, 'l'},
 		{"port", 1, NULL, 'p'},
 		{"delay", 1, NULL, 'd'},
+		{"lookahead", 1, NULL, 'a'},
+		{"start", 1, NULL, 's'},
+		{"tempo", 1, NULL, 't'},
+		{"gapless", 0, NULL, 'g'},
+		{"cache", 1, NULL, 'c'},
 		{0}
 	};
 	int c;
@@ -894,6 +1531,25 @@ int main(int argc, char *argv[])
 		case 'd':
 			end_delay = atoi(optarg);
 			break;
+		case 'a':
+			lookahead_ms = atoi(optarg);
+			break;
+		case 's':
+			start_seconds = atof(optarg);
+			break;
+		case 't':
+			tempo_percent = atoi(optarg);
+			if (tempo_percent < 1 || tempo_percent > 1000) {
+				errormsg("Invalid tempo %s", optarg);
+				return 1;
+			}
+			break;
+		case 'g':
+			gapless = 1;
+			break;
+		case 'c':
+			cache_dir = optarg;
+			break;
 		default:
 			usage(argv[0]);
 			return 1;
@@ -922,10 +1578,11 @@ int main(int argc, char *argv[])
 		create_queue();
 		connect_ports();
 
-		for (; optind < argc; ++optind) {
-			file_name = argv[optind];
-			play_file();
-		}
+		if (gapless)
+			play_gapless(argv + optind, argc - optind);
+		else
+			for (; optind < argc; ++optind)
+				play_file(argv[optind]);
 	}
 	snd_seq_close(seq);
 	return 0;
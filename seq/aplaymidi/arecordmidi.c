@@ -28,6 +28,7 @@
 #include <signal.h>
 #include <getopt.h>
 #include <poll.h>
+#include <time.h>
 #include <alsa/asoundlib.h>
 #include "aconfig.h"
 #include "version.h"
@@ -47,6 +48,7 @@ struct smf_track {
 	snd_seq_tick_time_t last_tick;	/* end of track */
 	unsigned char last_command;	/* used for running status */
 	int used;			/* anything record on this track */
+	int port;			/* last port prefix, with --flush */
 	struct buffer first_buf;	/* list head */
 };
 
@@ -85,6 +87,11 @@ static int metronome_channel = METRONOME_CHANNEL;
 static int ts_num = 4; /* time signature: numerator */
 static int ts_div = 4; /* time signature: denominator */
 static int ts_dd = 2; /* time signature: denominator as a power of two */
+static int flush_interval;	/* seconds, 0 = write the file at exit */
+static long track_length_offset;	/* of the MTrk length, with --flush */
+static int realtime;		/* timestamp the events in real time */
+static double ticks_per_second;
+static FILE *timestamp_file;
 
 /* Parse a decimal number from a command line argument. */
 static long arg_parse_decimal_num(const char *str, int *err)
@@ -263,6 +270,10 @@ static void init_tracks(void)
 
 	/* MIDI RP-019 says we need at least one track per port */
 	num_tracks = port_count;
+	/* When streaming, there is only the track being written, and the
+	 * ports are told apart by port prefix events. */
+	if (flush_interval)
+		num_tracks = 1;
 	/* Allocate one track for each possible channel.
 	 * Empty tracks won't be written to the file. */
 	if (channel_split)
@@ -270,8 +281,10 @@ static void init_tracks(void)
 
 	tracks = calloc(num_tracks, sizeof(struct smf_track));
 	check_mem(tracks);
-	for (i = 0; i < num_tracks; ++i)
+	for (i = 0; i < num_tracks; ++i) {
 		tracks[i].cur_buf = &tracks[i].first_buf;
+		tracks[i].port = -1;
+	}
 }
 
 static void create_queue(void)
@@ -318,6 +331,15 @@ static void create_queue(void)
 		fatal("Cannot set queue tempo (%u/%i)",
 		      snd_seq_queue_tempo_get_tempo(tempo),
 		      snd_seq_queue_tempo_get_ppq(tempo));
+	ticks_per_second = (double)snd_seq_queue_tempo_get_ppq(tempo) * 1000000 /
+			   snd_seq_queue_tempo_get_tempo(tempo);
+}
+
+/* converts a real time queue timestamp to ticks of the file */
+static snd_seq_tick_time_t real_to_tick(const snd_seq_real_time_t *t)
+{
+	return (snd_seq_tick_time_t)((t->tv_sec + t->tv_nsec / 1e9) *
+				     ticks_per_second + 0.5);
 }
 
 static void create_ports(void)
@@ -339,6 +361,7 @@ static void create_ports(void)
 
 	/* we want to know when the events got delivered to us */
 	snd_seq_port_info_set_timestamping(pinfo, 1);
+	snd_seq_port_info_set_timestamp_real(pinfo, realtime);
 	snd_seq_port_info_set_timestamp_queue(pinfo, queue);
 
 	/* our port number is the same as our port index */
@@ -404,6 +427,28 @@ static void add_byte(struct smf_track *track, unsigned char byte)
 	track->size++;
 }
 
+/* records a block of bytes, like add_byte() but a buffer at a time */
+static void add_bytes(struct smf_track *track, const unsigned char *data, int len)
+{
+	int n;
+
+	while (len > 0) {
+		if (track->cur_buf_size >= BUFFER_SIZE) {
+			add_byte(track, *data++);
+			len--;
+			continue;
+		}
+		n = BUFFER_SIZE - track->cur_buf_size;
+		if (n > len)
+			n = len;
+		memcpy(track->cur_buf->buf + track->cur_buf_size, data, n);
+		track->cur_buf_size += n;
+		track->size += n;
+		data += n;
+		len -= n;
+	}
+}
+
 /* record a variable-length quantity */
 static void var_value(struct smf_track *track, int v)
 {
@@ -424,6 +469,18 @@ static void delta_time(struct smf_track *track, const snd_seq_event_t *ev)
 	int diff = ev->time.tick - track->last_tick;
 	if (diff < 0)
 		diff = 0;
+	/* the single streamed track gets a port prefix on each port change */
+	if (flush_interval && port_count > 1 && ev->dest.port != track->port) {
+		track->port = ev->dest.port;
+		var_value(track, diff);
+		add_byte(track, 0xff);
+		add_byte(track, 0x21);
+		var_value(track, 1);
+		add_byte(track, track->port);
+		/* meta events cancel the running status */
+		track->last_command = 0;
+		diff = 0;
+	}
 	var_value(track, diff);
 	track->last_tick = ev->time.tick;
 }
@@ -453,23 +510,47 @@ static void record_port_numbers(void)
 	}
 }
 
+/* writes the raw timestamp of an event to the side log */
+static void log_timestamp(const snd_seq_event_t *ev)
+{
+	if (snd_seq_ev_is_real(ev))
+		fprintf(timestamp_file, "%u.%09u", ev->time.time.tv_sec,
+			ev->time.time.tv_nsec);
+	else
+		fprintf(timestamp_file, "%u", ev->time.tick);
+	fprintf(timestamp_file, " %d:%d %d %d\n", ev->source.client,
+		ev->source.port, ev->dest.port, ev->type);
+}
+
 static void record_event(const snd_seq_event_t *ev)
 {
 	unsigned int i;
 	struct smf_track *track;
+	snd_seq_event_t tick_ev;
 
 	/* ignore events without proper timestamps */
-	if (ev->queue != queue || !snd_seq_ev_is_tick(ev))
+	if (ev->queue != queue)
 		return;
 
 	/* determine which track to record to */
 	i = ev->dest.port;
 	if (i == port_count) {
-		if (ev->type == SND_SEQ_EVENT_USR0)
+		if (ev->type == SND_SEQ_EVENT_USR0 && snd_seq_ev_is_tick(ev))
 			metronome_pattern(ev->time.tick);
 		return;
 	}
-	if (channel_split) {
+	if (realtime ? !snd_seq_ev_is_real(ev) : !snd_seq_ev_is_tick(ev))
+		return;
+	if (timestamp_file)
+		log_timestamp(ev);
+	if (realtime) {
+		tick_ev = *ev;
+		tick_ev.time.tick = real_to_tick(&ev->time.time);
+		ev = &tick_ev;
+	}
+	if (flush_interval) {
+		i = 0;
+	} else if (channel_split) {
 		i *= TRACKS_PER_PORT;
 		if (snd_seq_ev_is_channel_type(ev))
 			i += 1 + (ev->data.note.channel & 0xf);
@@ -583,8 +664,8 @@ static void record_event(const snd_seq_event_t *ev)
 		else
 			command(track, 0xf7), i = 0;
 		var_value(track, ev->data.ext.len - i);
-		for (; i < ev->data.ext.len; ++i)
-			add_byte(track, ((unsigned char*)ev->data.ext.ptr)[i]);
+		add_bytes(track, (unsigned char*)ev->data.ext.ptr + i,
+			  ev->data.ext.len - i);
 		break;
 	default:
 		return;
@@ -601,7 +682,10 @@ static void finish_tracks(void)
 
 	err = snd_seq_get_queue_status(seq, queue, queue_status);
 	check_snd("get queue status", err);
-	tick = snd_seq_queue_status_get_tick_time(queue_status);
+	if (realtime)
+		tick = real_to_tick(snd_seq_queue_status_get_real_time(queue_status));
+	else
+		tick = snd_seq_queue_status_get_tick_time(queue_status);
 
 	/* make length of first track the recording length */
 	var_value(&tracks[0], tick - tracks[0].last_tick);
@@ -618,14 +702,17 @@ static void finish_tracks(void)
 	}
 }
 
-static void write_file(void)
+static void write_be32(int value)
 {
-	int used_tracks, time_division, i;
-	struct buffer *buf;
+	fputc((value >> 24) & 0xff, file);
+	fputc((value >> 16) & 0xff, file);
+	fputc((value >> 8) & 0xff, file);
+	fputc(value & 0xff, file);
+}
 
-	used_tracks = 0;
-	for (i = 0; i < num_tracks; ++i)
-		used_tracks += !!tracks[i].used;
+static void write_header(int used_tracks)
+{
+	int time_division;
 
 	/* header id and length */
 	fwrite("MThd\0\0\0\6", 1, 8, file);
@@ -641,6 +728,34 @@ static void write_file(void)
 		time_division |= (0x100 - frames) << 8;
 	fputc(time_division >> 8, file);
 	fputc(time_division & 0xff, file);
+}
+
+/* writes the buffered contents of the track and frees the buffers */
+static void write_track_data(struct smf_track *track)
+{
+	struct buffer *buf, *next;
+
+	for (buf = &track->first_buf; buf; buf = next) {
+		next = buf->next;
+		fwrite(buf->buf, 1, buf == track->cur_buf
+		       ? track->cur_buf_size : BUFFER_SIZE, file);
+		if (buf != &track->first_buf)
+			free(buf);
+	}
+	track->first_buf.next = NULL;
+	track->cur_buf = &track->first_buf;
+	track->cur_buf_size = 0;
+}
+
+static void write_file(void)
+{
+	int used_tracks, i;
+
+	used_tracks = 0;
+	for (i = 0; i < num_tracks; ++i)
+		used_tracks += !!tracks[i].used;
+
+	write_header(used_tracks);
 
 	for (i = 0; i < num_tracks; ++i) {
 		if (!tracks[i].used)
@@ -648,17 +763,39 @@ static void write_file(void)
 		/* track id */
 		fwrite("MTrk", 1, 4, file);
 		/* data length */
-		fputc((tracks[i].size >> 24) & 0xff, file);
-		fputc((tracks[i].size >> 16) & 0xff, file);
-		fputc((tracks[i].size >> 8) & 0xff, file);
-		fputc(tracks[i].size & 0xff, file);
+		write_be32(tracks[i].size);
 		/* track contents */
-		for (buf = &tracks[i].first_buf; buf; buf = buf->next)
-			fwrite(buf->buf, 1, buf == tracks[i].cur_buf
-			       ? tracks[i].cur_buf_size : BUFFER_SIZE, file);
+		write_track_data(&tracks[i]);
 	}
 }
 
+/*
+ * With --flush, the file has a single track that is written while
+ * recording. The track length in the file is updated on each flush, so
+ * that the file is usable (only missing the end of track event) even if
+ * arecordmidi is killed, and the memory use does not grow with the
+ * recording length.
+ */
+static void stream_start(void)
+{
+	write_header(1);
+	fwrite("MTrk", 1, 4, file);
+	track_length_offset = ftell(file);
+	write_be32(0);
+}
+
+static void stream_flush(void)
+{
+	write_track_data(&tracks[0]);
+	if (fseek(file, track_length_offset, SEEK_SET) < 0)
+		fatal("Cannot seek in the output file - %s", strerror(errno));
+	write_be32(tracks[0].size);
+	if (fseek(file, 0, SEEK_END) < 0)
+		fatal("Cannot seek in the output file - %s", strerror(errno));
+	if (fflush(file) || ferror(file))
+		fatal("Cannot write the output file - %s", strerror(errno));
+}
+
 static void list_ports(void)
 {
 	snd_seq_client_info_t *cinfo;
@@ -710,7 +847,10 @@ static void help(const char *argv0)
 		"  -s,--split-channels        create a track for each channel\n"
 		"  -m,--metronome=client:port play a metronome signal\n"
 		"  -i,--timesig=nn:dd         time signature\n"
-		"  -n,--num-events=events     fixed number of events to record, then exit\n",
+		"  -n,--num-events=events     fixed number of events to record, then exit\n"
+		"  -F,--flush=seconds         write the file while recording, every seconds\n"
+		"  -r,--realtime              timestamp the events in real time\n"
+		"  -T,--timestamps=file       log the raw event timestamps to file\n",
 		argv0);
 }
 
@@ -726,7 +866,7 @@ static void sighandler(int sig)
 
 int main(int argc, char *argv[])
 {
-	static const char short_options[] = "hVlp:b:f:t:sdm:i:n:";
+	static const char short_options[] = "hVlp:b:f:t:sdm:i:n:F:rT:";
 	static const struct option long_options[] = {
 		{"help", 0, NULL, 'h'},
 		{"version", 0, NULL, 'V'},
@@ -740,10 +880,14 @@ int main(int argc, char *argv[])
 		{"metronome", 1, NULL, 'm'},
 		{"timesig", 1, NULL, 'i'},
 		{"num-events", 1, NULL, 'n'},
+		{"flush", 1, NULL, 'F'},
+		{"realtime", 0, NULL, 'r'},
+		{"timestamps", 1, NULL, 'T'},
 		{0}
 	};
 
 	char *filename = NULL;
+	const char *timestamp_filename = NULL;
 	int do_list = 0;
 	struct pollfd *pfds;
 	int npfds;
@@ -751,6 +895,7 @@ int main(int argc, char *argv[])
 	/* If |num_events| isn't specified, leave it at 0. */
 	long num_events = 0;
 	long events_received = 0;
+	time_t last_flush = 0;
 
 	init_seq();
 
@@ -809,6 +954,17 @@ int main(int argc, char *argv[])
 			if (num_events <= 0)
 				fatal("num_events must be greater than 0");
 			break;
+		case 'F':
+			flush_interval = atoi(optarg);
+			if (flush_interval < 1)
+				fatal("Invalid flush interval");
+			break;
+		case 'r':
+			realtime = 1;
+			break;
+		case 'T':
+			timestamp_filename = optarg;
+			break;
 		default:
 			help(argv[0]);
 			return 1;
@@ -825,8 +981,9 @@ int main(int argc, char *argv[])
 		return 1;
 	}
 
+	/* a high resolution, so that the real time is not quantised much */
 	if (!ticks)
-		ticks = smpte_timing ? 40 : 384;
+		ticks = smpte_timing ? (realtime ? 255 : 40) : (realtime ? 3840 : 384);
 	if (smpte_timing && ticks > 0xff)
 		ticks = 0xff;
 
@@ -836,11 +993,14 @@ int main(int argc, char *argv[])
 	}
 	filename = argv[optind];
 
+	if (flush_interval && channel_split)
+		fatal("--split-channels cannot be used with --flush");
+
 	init_tracks();
 	create_queue();
 	create_ports();
 	connect_ports();
-	if (port_count > 1)
+	if (port_count > 1 && !flush_interval)
 		record_port_numbers();
 
 	/* record tempo */
@@ -871,6 +1031,15 @@ int main(int argc, char *argv[])
 	file = fopen(filename, "wb");
 	if (!file)
 		fatal("Cannot open %s - %s", filename, strerror(errno));
+	if (timestamp_filename) {
+		timestamp_file = fopen(timestamp_filename, "w");
+		if (!timestamp_file)
+			fatal("Cannot open %s - %s", timestamp_filename, strerror(errno));
+	}
+	if (flush_interval) {
+		stream_start();
+		last_flush = time(NULL);
+	}
 
 	err = snd_seq_start_queue(seq, queue, NULL);
 	check_snd("start queue", err);
@@ -891,7 +1060,7 @@ int main(int argc, char *argv[])
 	pfds = alloca(sizeof(*pfds) * npfds);
 	for (;;) {
 		snd_seq_poll_descriptors(seq, pfds, npfds, POLLIN);
-		if (poll(pfds, npfds, -1) < 0)
+		if (poll(pfds, npfds, flush_interval ? flush_interval * 1000 : -1) < 0)
 			break;
 		do {
 			snd_seq_event_t *event;
@@ -907,15 +1076,24 @@ int main(int argc, char *argv[])
 			break;
 		if (num_events && (events_received == num_events))
 			break;
+		if (flush_interval && time(NULL) - last_flush >= flush_interval) {
+			stream_flush();
+			last_flush = time(NULL);
+		}
 	}
 
 	if (num_events && events_received < num_events)
 		fputs("Warning: Received signal before num_events\n", stdout);
 
 	finish_tracks();
-	write_file();
+	if (flush_interval)
+		stream_flush();
+	else
+		write_file();
 
 	fclose(file);
+	if (timestamp_file)
+		fclose(timestamp_file);
 	snd_seq_close(seq);
 	return 0;
 }
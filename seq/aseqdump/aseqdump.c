@@ -26,6 +26,7 @@
 #include <signal.h>
 #include <getopt.h>
 #include <poll.h>
+#include <stdint.h>
 #include <alsa/asoundlib.h>
 #include "aconfig.h"
 #include "version.h"
@@ -34,6 +35,69 @@ static snd_seq_t *seq;
 static int port_count;
 static snd_seq_addr_t *ports;
 static volatile sig_atomic_t stop = 0;
+static int queue = -1;
+
+/* output formats */
+enum {
+	FORMAT_TEXT,
+	FORMAT_JSON,
+	FORMAT_BINARY,
+};
+static int format = FORMAT_TEXT;
+
+/* with --ump, our client receives UMP packets instead of legacy events */
+static int ump_version;
+
+/* stdout is fully buffered and flushed once per poll cycle */
+#define OUTPUT_BUFFER_SIZE (64 * 1024)
+#define INPUT_BUFFER_SIZE (64 * 1024)
+
+/* number of events received from each source port */
+struct port_counter {
+	snd_seq_addr_t addr;
+	unsigned long count;
+};
+static struct port_counter *counters;
+static int counter_count;
+
+/* event type names for --events, a name can stand for several types */
+static const struct {
+	const char *name;
+	int type;
+} event_types[] = {
+	{ "note", SND_SEQ_EVENT_NOTEON },
+	{ "note", SND_SEQ_EVENT_NOTEOFF },
+	{ "note", SND_SEQ_EVENT_KEYPRESS },
+	{ "control", SND_SEQ_EVENT_CONTROLLER },
+	{ "control", SND_SEQ_EVENT_CONTROL14 },
+	{ "control", SND_SEQ_EVENT_NONREGPARAM },
+	{ "control", SND_SEQ_EVENT_REGPARAM },
+	{ "program", SND_SEQ_EVENT_PGMCHANGE },
+	{ "aftertouch", SND_SEQ_EVENT_KEYPRESS },
+	{ "aftertouch", SND_SEQ_EVENT_CHANPRESS },
+	{ "pitchbend", SND_SEQ_EVENT_PITCHBEND },
+	{ "sysex", SND_SEQ_EVENT_SYSEX },
+	{ "common", SND_SEQ_EVENT_SONGPOS },
+	{ "common", SND_SEQ_EVENT_SONGSEL },
+	{ "common", SND_SEQ_EVENT_QFRAME },
+	{ "common", SND_SEQ_EVENT_TUNE_REQUEST },
+	{ "realtime", SND_SEQ_EVENT_START },
+	{ "realtime", SND_SEQ_EVENT_CONTINUE },
+	{ "realtime", SND_SEQ_EVENT_STOP },
+	{ "realtime", SND_SEQ_EVENT_CLOCK },
+	{ "realtime", SND_SEQ_EVENT_RESET },
+	{ "realtime", SND_SEQ_EVENT_SENSING },
+	{ "clock", SND_SEQ_EVENT_CLOCK },
+	{ "clock", SND_SEQ_EVENT_TICK },
+	{ "announce", SND_SEQ_EVENT_CLIENT_START },
+	{ "announce", SND_SEQ_EVENT_CLIENT_EXIT },
+	{ "announce", SND_SEQ_EVENT_CLIENT_CHANGE },
+	{ "announce", SND_SEQ_EVENT_PORT_START },
+	{ "announce", SND_SEQ_EVENT_PORT_EXIT },
+	{ "announce", SND_SEQ_EVENT_PORT_CHANGE },
+	{ "announce", SND_SEQ_EVENT_PORT_SUBSCRIBED },
+	{ "announce", SND_SEQ_EVENT_PORT_UNSUBSCRIBED },
+};
 
 
 /* prints an error message to stderr, and dies */
@@ -75,6 +139,28 @@ static void init_seq(void)
 	check_snd("set client name", err);
 }
 
+static void set_ump_version(const char *arg)
+{
+	char *end;
+	long version;
+
+	version = strtol(arg, &end, 0);
+	if (*arg == '\0' || *end != '\0' || version < 0 || version > 2)
+		fatal("Invalid UMP version %s", arg);
+#ifdef HAVE_SEQ_UMP_EVENT_INPUT
+	if (version > 0) {
+		int err = snd_seq_set_client_midi_version(seq, version == 1 ?
+							  SND_SEQ_CLIENT_UMP_MIDI_1_0 :
+							  SND_SEQ_CLIENT_UMP_MIDI_2_0);
+		check_snd("set client MIDI version", err);
+	}
+#else
+	if (version > 0)
+		fatal("UMP is not supported by this alsa-lib");
+#endif
+	ump_version = version;
+}
+
 /* parses one or more port addresses from the string */
 static void parse_ports(const char *arg)
 {
@@ -104,16 +190,78 @@ static void parse_ports(const char *arg)
 	free(buf);
 }
 
+/*
+ * Sets the event filter of our client from a list of type names or
+ * numbers, so that other events are dropped by the kernel and never
+ * reach us.
+ */
+static void parse_event_filter(const char *arg)
+{
+	char *buf, *s, *name, *end;
+	unsigned int i;
+	int found;
+	long type;
+
+	buf = strdup(arg);
+	check_mem(buf);
+
+	for (name = s = buf; s; name = s + 1) {
+		s = strchr(name, ',');
+		if (s)
+			*s = '\0';
+
+		found = 0;
+		for (i = 0; i < sizeof(event_types) / sizeof(event_types[0]); ++i) {
+			if (!strcmp(name, event_types[i].name)) {
+				snd_seq_set_client_event_filter(seq, event_types[i].type);
+				found = 1;
+			}
+		}
+		if (!found) {
+			type = strtol(name, &end, 0);
+			if (*name == '\0' || *end != '\0' || type < 0 || type > 255)
+				fatal("Invalid event type %s", name);
+			snd_seq_set_client_event_filter(seq, type);
+		}
+	}
+
+	free(buf);
+}
+
 static void create_port(void)
 {
+	snd_seq_port_info_t *pinfo;
 	int err;
 
-	err = snd_seq_create_simple_port(seq, "aseqdump",
+	snd_seq_port_info_alloca(&pinfo);
+	snd_seq_port_info_set_name(pinfo, "aseqdump");
+	snd_seq_port_info_set_capability(pinfo,
 					 SND_SEQ_PORT_CAP_WRITE |
-					 SND_SEQ_PORT_CAP_SUBS_WRITE,
-					 SND_SEQ_PORT_TYPE_MIDI_GENERIC |
-					 SND_SEQ_PORT_TYPE_APPLICATION);
+					 SND_SEQ_PORT_CAP_SUBS_WRITE);
+	snd_seq_port_info_set_type(pinfo,
+				   SND_SEQ_PORT_TYPE_MIDI_GENERIC |
+				   SND_SEQ_PORT_TYPE_APPLICATION);
+	snd_seq_port_info_set_midi_channels(pinfo, 16);
+	snd_seq_port_info_set_port_specified(pinfo, 1);
+	snd_seq_port_info_set_port(pinfo, 0);
+
+	/* the JSON and binary formats include the time of arrival */
+	if (format != FORMAT_TEXT) {
+		queue = snd_seq_alloc_named_queue(seq, "aseqdump");
+		check_snd("create queue", queue);
+		snd_seq_port_info_set_timestamping(pinfo, 1);
+		snd_seq_port_info_set_timestamp_real(pinfo, 1);
+		snd_seq_port_info_set_timestamp_queue(pinfo, queue);
+	}
+
+	err = snd_seq_create_port(seq, pinfo);
 	check_snd("create port", err);
+
+	if (queue >= 0) {
+		err = snd_seq_start_queue(seq, queue, NULL);
+		check_snd("start queue", err);
+		snd_seq_drain_output(seq);
+	}
 }
 
 static void connect_ports(void)
@@ -297,6 +445,386 @@ static void dump_event(const snd_seq_event_t *ev)
 	}
 }
 
+static void count_event(const snd_seq_event_t *ev)
+{
+	static int last;
+	int i;
+
+	/* most events come from the same port as the previous one */
+	if (last < counter_count &&
+	    counters[last].addr.client == ev->source.client &&
+	    counters[last].addr.port == ev->source.port) {
+		counters[last].count++;
+		return;
+	}
+	for (i = 0; i < counter_count; ++i)
+		if (counters[i].addr.client == ev->source.client &&
+		    counters[i].addr.port == ev->source.port)
+			break;
+	if (i == counter_count) {
+		counters = realloc(counters, (counter_count + 1) * sizeof(*counters));
+		check_mem(counters);
+		counters[i].addr = ev->source;
+		counters[i].count = 0;
+		counter_count++;
+	}
+	counters[i].count++;
+	last = i;
+}
+
+static void print_counters(void)
+{
+	int i;
+
+	for (i = 0; i < counter_count; ++i)
+		fprintf(stderr, "%3d:%-3d %lu events\n", counters[i].addr.client,
+			counters[i].addr.port, counters[i].count);
+}
+
+/* one line per event, with the fields that the text format shows */
+static void dump_event_json(const snd_seq_event_t *ev)
+{
+	unsigned int i;
+
+	printf("{\"time\":%u.%09u,\"source\":\"%d:%d\",\"type\":%d",
+	       ev->time.time.tv_sec, ev->time.time.tv_nsec,
+	       ev->source.client, ev->source.port, ev->type);
+	switch (ev->type) {
+	case SND_SEQ_EVENT_NOTEON:
+	case SND_SEQ_EVENT_NOTEOFF:
+	case SND_SEQ_EVENT_KEYPRESS:
+		printf(",\"channel\":%d,\"note\":%d,\"velocity\":%d",
+		       ev->data.note.channel, ev->data.note.note,
+		       ev->data.note.velocity);
+		break;
+	case SND_SEQ_EVENT_CONTROLLER:
+	case SND_SEQ_EVENT_CONTROL14:
+	case SND_SEQ_EVENT_NONREGPARAM:
+	case SND_SEQ_EVENT_REGPARAM:
+		printf(",\"channel\":%d,\"param\":%u,\"value\":%d",
+		       ev->data.control.channel, ev->data.control.param,
+		       ev->data.control.value);
+		break;
+	case SND_SEQ_EVENT_PGMCHANGE:
+	case SND_SEQ_EVENT_CHANPRESS:
+	case SND_SEQ_EVENT_PITCHBEND:
+		printf(",\"channel\":%d,\"value\":%d",
+		       ev->data.control.channel, ev->data.control.value);
+		break;
+	case SND_SEQ_EVENT_SONGPOS:
+	case SND_SEQ_EVENT_SONGSEL:
+	case SND_SEQ_EVENT_QFRAME:
+		printf(",\"value\":%d", ev->data.control.value);
+		break;
+	case SND_SEQ_EVENT_SYSEX:
+		printf(",\"data\":\"");
+		for (i = 0; i < ev->data.ext.len; ++i)
+			printf("%02X", ((unsigned char*)ev->data.ext.ptr)[i]);
+		putchar('"');
+		break;
+	}
+	puts("}");
+}
+
+/*
+ * A record per event, in host byte order: the seconds and nanoseconds of
+ * the timestamp (32 bits each), the source client, port, the event type
+ * and a zero byte, the data length (32 bits), and the data: the payload
+ * of variable length events, or the 12 bytes of ev->data otherwise.
+ */
+static void dump_event_binary(const snd_seq_event_t *ev)
+{
+	unsigned char hdr[4];
+	uint32_t v[2], len;
+	const void *data;
+
+	v[0] = ev->time.time.tv_sec;
+	v[1] = ev->time.time.tv_nsec;
+	hdr[0] = ev->source.client;
+	hdr[1] = ev->source.port;
+	hdr[2] = ev->type;
+	hdr[3] = 0;
+	if (snd_seq_ev_is_variable(ev)) {
+		len = ev->data.ext.len;
+		data = ev->data.ext.ptr;
+	} else {
+		len = sizeof(ev->data.raw8.d);
+		data = ev->data.raw8.d;
+	}
+	fwrite(v, sizeof(v), 1, stdout);
+	fwrite(hdr, sizeof(hdr), 1, stdout);
+	fwrite(&len, sizeof(len), 1, stdout);
+	fwrite(data, 1, len, stdout);
+}
+
+#ifdef HAVE_SEQ_UMP_EVENT_INPUT
+/*
+ * UMP packets are decoded with tables instead of a switch per message:
+ * the message type (the upper nibble of the first word) gives the packet
+ * length and the decoder, and the status of channel voice messages gives
+ * the name and the layout of the fields.
+ */
+static const unsigned char ump_packet_words[16] = {
+	1, 1, 1, 2, 2, 4, 1, 1, 2, 2, 2, 3, 3, 4, 4, 4
+};
+
+enum {
+	UMP_FIELDS_NONE,
+	UMP_FIELDS_NOTE_VELOCITY,	/* note, velocity, attribute */
+	UMP_FIELDS_NOTE_VALUE,		/* note, value */
+	UMP_FIELDS_NOTE_INDEX_VALUE,	/* note, controller, value */
+	UMP_FIELDS_NOTE_FLAGS,		/* note, management flags */
+	UMP_FIELDS_INDEX_VALUE,		/* controller, value */
+	UMP_FIELDS_BANK_INDEX_VALUE,	/* bank, index, value */
+	UMP_FIELDS_PROGRAM,		/* program, bank */
+	UMP_FIELDS_VALUE,		/* value */
+};
+
+static const struct {
+	const char *name;
+	unsigned char fields;
+} ump_midi2_messages[16] = {
+	[0x0] = { "Per-note RCC", UMP_FIELDS_NOTE_INDEX_VALUE },
+	[0x1] = { "Per-note ACC", UMP_FIELDS_NOTE_INDEX_VALUE },
+	[0x2] = { "RPN", UMP_FIELDS_BANK_INDEX_VALUE },
+	[0x3] = { "NRPN", UMP_FIELDS_BANK_INDEX_VALUE },
+	[0x4] = { "Relative RPN", UMP_FIELDS_BANK_INDEX_VALUE },
+	[0x5] = { "Relative NRPN", UMP_FIELDS_BANK_INDEX_VALUE },
+	[0x6] = { "Per-note pitchbend", UMP_FIELDS_NOTE_VALUE },
+	[0x8] = { "Note off", UMP_FIELDS_NOTE_VELOCITY },
+	[0x9] = { "Note on", UMP_FIELDS_NOTE_VELOCITY },
+	[0xa] = { "Polyphonic aftertouch", UMP_FIELDS_NOTE_VALUE },
+	[0xb] = { "Control change", UMP_FIELDS_INDEX_VALUE },
+	[0xc] = { "Program change", UMP_FIELDS_PROGRAM },
+	[0xd] = { "Channel aftertouch", UMP_FIELDS_VALUE },
+	[0xe] = { "Pitch bend", UMP_FIELDS_VALUE },
+	[0xf] = { "Per-note management", UMP_FIELDS_NOTE_FLAGS },
+};
+
+static const char *const ump_midi1_names[16] = {
+	[0x8] = "Note off",
+	[0x9] = "Note on",
+	[0xa] = "Polyphonic aftertouch",
+	[0xb] = "Control change",
+	[0xc] = "Program change",
+	[0xd] = "Channel aftertouch",
+	[0xe] = "Pitch bend",
+};
+
+static const char *const ump_system_names[16] = {
+	[0x1] = "MTC quarter frame",
+	[0x2] = "Song position",
+	[0x3] = "Song select",
+	[0x6] = "Tune request",
+	[0x8] = "Clock",
+	[0xa] = "Start",
+	[0xb] = "Continue",
+	[0xc] = "Stop",
+	[0xe] = "Active sensing",
+	[0xf] = "Reset",
+};
+
+static const char *const ump_data_names[16] = {
+	[0x0] = "complete",
+	[0x1] = "start",
+	[0x2] = "continue",
+	[0x3] = "end",
+};
+
+/* the n-th byte of the packet, counted from the top of the first word */
+static unsigned int ump_byte(const unsigned int *ump, unsigned int n)
+{
+	return (ump[n / 4] >> (24 - 8 * (n % 4))) & 0xff;
+}
+
+static void dump_ump_words(const unsigned int *ump, unsigned int words)
+{
+	unsigned int i;
+
+	for (i = 0; i < words; ++i)
+		printf(" %08X", ump[i]);
+	putchar('\n');
+}
+
+static void dump_ump_midi2(const unsigned int *ump, unsigned int words)
+{
+	unsigned int status = (ump[0] >> 20) & 0xf;
+	unsigned int note = (ump[0] >> 8) & 0x7f;
+
+	if (!ump_midi2_messages[status].name) {
+		printf("MIDI 2.0 status %X      ", status);
+		dump_ump_words(ump, words);
+		return;
+	}
+	printf("%-23s%2d, ", ump_midi2_messages[status].name, (ump[0] >> 16) & 0xf);
+	switch (ump_midi2_messages[status].fields) {
+	case UMP_FIELDS_NOTE_VELOCITY:
+		printf("note %u, velocity 0x%04x, attr type %u, attr 0x%04x\n",
+		       note, ump[1] >> 16, ump[0] & 0xff, ump[1] & 0xffff);
+		break;
+	case UMP_FIELDS_NOTE_VALUE:
+		printf("note %u, value 0x%08x\n", note, ump[1]);
+		break;
+	case UMP_FIELDS_NOTE_INDEX_VALUE:
+		printf("note %u, controller %u, value 0x%08x\n",
+		       note, ump[0] & 0xff, ump[1]);
+		break;
+	case UMP_FIELDS_NOTE_FLAGS:
+		printf("note %u, flags 0x%02x\n", note, ump[0] & 0xff);
+		break;
+	case UMP_FIELDS_INDEX_VALUE:
+		printf("controller %u, value 0x%08x\n", note, ump[1]);
+		break;
+	case UMP_FIELDS_BANK_INDEX_VALUE:
+		printf("bank %u, index %u, value 0x%08x\n",
+		       note, ump[0] & 0x7f, ump[1]);
+		break;
+	case UMP_FIELDS_PROGRAM:
+		if (ump[0] & 1)
+			printf("program %u, bank %u:%u\n", ump[1] >> 24,
+			       (ump[1] >> 8) & 0x7f, ump[1] & 0x7f);
+		else
+			printf("program %u\n", ump[1] >> 24);
+		break;
+	default:
+		printf("value 0x%08x\n", ump[1]);
+		break;
+	}
+}
+
+static void dump_ump_midi1(const unsigned int *ump, unsigned int words)
+{
+	unsigned int status = (ump[0] >> 20) & 0xf;
+	unsigned int d1 = (ump[0] >> 8) & 0x7f, d2 = ump[0] & 0x7f;
+
+	if (!ump_midi1_names[status]) {
+		printf("MIDI 1.0 status %X      ", status);
+		dump_ump_words(ump, words);
+		return;
+	}
+	printf("%-23s%2d, ", ump_midi1_names[status], (ump[0] >> 16) & 0xf);
+	switch (status) {
+	case 0xc:
+	case 0xd:
+		printf("value %u\n", d1);
+		break;
+	case 0xe:
+		printf("value %d\n", (int)(d1 | (d2 << 7)) - 0x2000);
+		break;
+	default:
+		printf("%u, %u\n", d1, d2);
+		break;
+	}
+}
+
+static void dump_ump_system(const unsigned int *ump, unsigned int words)
+{
+	unsigned int status = (ump[0] >> 16) & 0xff;
+
+	if ((status & 0xf0) != 0xf0 || !ump_system_names[status & 0xf]) {
+		printf("System status %02X       ", status);
+		dump_ump_words(ump, words);
+		return;
+	}
+	printf("%-23s    ", ump_system_names[status & 0xf]);
+	switch (status) {
+	case 0xf1:
+	case 0xf3:
+		printf("%u\n", (ump[0] >> 8) & 0x7f);
+		break;
+	case 0xf2:
+		printf("%u\n", ((ump[0] >> 8) & 0x7f) | ((ump[0] & 0x7f) << 7));
+		break;
+	default:
+		putchar('\n');
+		break;
+	}
+}
+
+/* SysEx7 (64 bits) and data (128 bits) messages carry up to 6 or 14 bytes */
+static void dump_ump_data(const unsigned int *ump, unsigned int words)
+{
+	unsigned int status = (ump[0] >> 20) & 0xf;
+	unsigned int count = (ump[0] >> 16) & 0xf;
+	unsigned int first = 2, i;
+	const char *name = ump_data_names[status];
+
+	if (words == 4) {
+		/* the first data byte is the stream ID */
+		if (count > 14)
+			count = 14;
+		printf("Data %-8s stream %3u ", name ? name : "?", ump_byte(ump, 2));
+		first = 3;
+		if (count > 0)
+			--count;
+	} else {
+		if (count > 6)
+			count = 6;
+		printf("SysEx %-17s", name ? name : "?");
+	}
+	for (i = 0; i < count; ++i)
+		printf(" %02X", ump_byte(ump, first + i));
+	putchar('\n');
+}
+
+static void dump_ump_other(const unsigned int *ump, unsigned int words)
+{
+	printf("UMP type %X             ", ump[0] >> 28);
+	dump_ump_words(ump, words);
+}
+
+static void (*const ump_decoders[16])(const unsigned int *ump, unsigned int words) = {
+	[0x1] = dump_ump_system,
+	[0x2] = dump_ump_midi1,
+	[0x3] = dump_ump_data,
+	[0x4] = dump_ump_midi2,
+	[0x5] = dump_ump_data,
+};
+
+static void dump_ump_event(const snd_seq_ump_event_t *ev)
+{
+	const unsigned int *ump = ev->ump;
+	unsigned int type = ump[0] >> 28;
+	void (*decode)(const unsigned int *ump, unsigned int words);
+
+	printf("%3d:%-3d Group %2d, ", ev->source.client, ev->source.port,
+	       (ump[0] >> 24) & 0xf);
+	decode = ump_decoders[type] ? ump_decoders[type] : dump_ump_other;
+	decode(ump, ump_packet_words[type]);
+}
+
+static void dump_ump_event_json(const snd_seq_ump_event_t *ev)
+{
+	unsigned int i, words = ump_packet_words[ev->ump[0] >> 28];
+
+	printf("{\"time\":%u.%09u,\"source\":\"%d:%d\",\"group\":%u,\"ump\":[",
+	       ev->time.time.tv_sec, ev->time.time.tv_nsec,
+	       ev->source.client, ev->source.port, (ev->ump[0] >> 24) & 0xf);
+	for (i = 0; i < words; ++i)
+		printf(i ? ",\"%08X\"" : "\"%08X\"", ev->ump[i]);
+	puts("]}");
+}
+
+/* the record of dump_event_binary(), with 1 in the zero byte and the words */
+static void dump_ump_event_binary(const snd_seq_ump_event_t *ev)
+{
+	unsigned char hdr[4];
+	uint32_t v[2], len;
+
+	v[0] = ev->time.time.tv_sec;
+	v[1] = ev->time.time.tv_nsec;
+	hdr[0] = ev->source.client;
+	hdr[1] = ev->source.port;
+	hdr[2] = ev->type;
+	hdr[3] = 1;
+	len = ump_packet_words[ev->ump[0] >> 28] * 4;
+	fwrite(v, sizeof(v), 1, stdout);
+	fwrite(hdr, sizeof(hdr), 1, stdout);
+	fwrite(&len, sizeof(len), 1, stdout);
+	fwrite(ev->ump, 1, len, stdout);
+}
+#endif
+
 static void list_ports(void)
 {
 	snd_seq_client_info_t *cinfo;
@@ -335,7 +863,12 @@ static void help(const char *argv0)
 		"  -h,--help                  this help\n"
 		"  -V,--version               show version\n"
 		"  -l,--list                  list input ports\n"
-		"  -p,--port=client:port,...  source port(s)\n",
+		"  -p,--port=client:port,...  source port(s)\n"
+		"  -f,--format=format         output format: text, json or binary\n"
+		"  -c,--count                 print the events per port at exit\n"
+		"  -e,--events=type,...       receive only these event types\n"
+		"  -u,--ump=version           receive UMP packets: 0 (legacy events),\n"
+		"                             1 (MIDI 1.0) or 2 (MIDI 2.0)\n",
 		argv0);
 }
 
@@ -351,16 +884,21 @@ static void sighandler(int sig)
 
 int main(int argc, char *argv[])
 {
-	static const char short_options[] = "hVlp:";
+	static const char short_options[] = "hVlp:f:ce:u:";
 	static const struct option long_options[] = {
 		{"help", 0, NULL, 'h'},
 		{"version", 0, NULL, 'V'},
 		{"list", 0, NULL, 'l'},
 		{"port", 1, NULL, 'p'},
+		{"format", 1, NULL, 'f'},
+		{"count", 0, NULL, 'c'},
+		{"events", 1, NULL, 'e'},
+		{"ump", 1, NULL, 'u'},
 		{0}
 	};
 
 	int do_list = 0;
+	int do_count = 0;
 	struct pollfd *pfds;
 	int npfds;
 	int c, err;
@@ -382,6 +920,25 @@ int main(int argc, char *argv[])
 		case 'p':
 			parse_ports(optarg);
 			break;
+		case 'f':
+			if (!strcmp(optarg, "text"))
+				format = FORMAT_TEXT;
+			else if (!strcmp(optarg, "json"))
+				format = FORMAT_JSON;
+			else if (!strcmp(optarg, "binary"))
+				format = FORMAT_BINARY;
+			else
+				fatal("Invalid format %s", optarg);
+			break;
+		case 'c':
+			do_count = 1;
+			break;
+		case 'e':
+			parse_event_filter(optarg);
+			break;
+		case 'u':
+			set_ump_version(optarg);
+			break;
 		default:
 			help(argv[0]);
 			return 1;
@@ -402,14 +959,26 @@ int main(int argc, char *argv[])
 
 	err = snd_seq_nonblock(seq, 1);
 	check_snd("set nonblock mode", err);
+	/* read many events with each read() */
+	err = snd_seq_set_input_buffer_size(seq, INPUT_BUFFER_SIZE);
+	check_snd("set input buffer size", err);
 	
+	/* the messages go to stderr when stdout carries the data */
 	if (port_count > 0)
-		printf("Waiting for data.");
+		fprintf(format == FORMAT_TEXT ? stdout : stderr,
+			"Waiting for data.");
 	else
-		printf("Waiting for data at port %d:0.",
-		       snd_seq_client_id(seq));
-	printf(" Press Ctrl+C to end.\n");
-	printf("Source  Event                  Ch  Data\n");
+		fprintf(format == FORMAT_TEXT ? stdout : stderr,
+			"Waiting for data at port %d:0.",
+			snd_seq_client_id(seq));
+	fprintf(format == FORMAT_TEXT ? stdout : stderr,
+		" Press Ctrl+C to end.\n");
+	if (format == FORMAT_TEXT && ump_version > 0)
+		printf("Source  Group     Event                  Ch  Data\n");
+	else if (format == FORMAT_TEXT)
+		printf("Source  Event                  Ch  Data\n");
+	fflush(stdout);
+	setvbuf(stdout, NULL, _IOFBF, OUTPUT_BUFFER_SIZE);
 	
 	signal(SIGINT, sighandler);
 	signal(SIGTERM, sighandler);
@@ -420,19 +989,59 @@ int main(int argc, char *argv[])
 		snd_seq_poll_descriptors(seq, pfds, npfds, POLLIN);
 		if (poll(pfds, npfds, -1) < 0)
 			break;
-		do {
+		/*
+		 * Read until the kernel has nothing more (-EAGAIN), not only
+		 * until our buffer is empty, so that a busy source does not
+		 * cost a poll() per event.
+		 */
+		for (;;) {
 			snd_seq_event_t *event;
+#ifdef HAVE_SEQ_UMP_EVENT_INPUT
+			if (ump_version > 0) {
+				snd_seq_ump_event_t *ump_event;
+
+				err = snd_seq_ump_event_input(seq, &ump_event);
+				if (err >= 0 && ump_event && snd_seq_ev_is_ump(ump_event)) {
+					if (do_count)
+						count_event((snd_seq_event_t *)ump_event);
+					if (format == FORMAT_JSON)
+						dump_ump_event_json(ump_event);
+					else if (format == FORMAT_BINARY)
+						dump_ump_event_binary(ump_event);
+					else
+						dump_ump_event(ump_event);
+					continue;
+				}
+				/* other events share the header of legacy events */
+				event = (snd_seq_event_t *)ump_event;
+			} else
+#endif
 			err = snd_seq_event_input(seq, &event);
+			if (err == -ENOSPC) {
+				fputs("Input overrun, events were lost\n", stderr);
+				continue;
+			}
 			if (err < 0)
 				break;
-			if (event)
+			if (!event)
+				continue;
+			if (do_count)
+				count_event(event);
+			if (format == FORMAT_JSON)
+				dump_event_json(event);
+			else if (format == FORMAT_BINARY)
+				dump_event_binary(event);
+			else
 				dump_event(event);
-		} while (err > 0);
+		}
 		fflush(stdout);
 		if (stop)
 			break;
 	}
 
+	fflush(stdout);
+	if (do_count)
+		print_counters();
 	snd_seq_close(seq);
 	return 0;
 }
@@ -20,6 +20,7 @@
 #include <ctype.h>
 #include <string.h>
 #include <netinet/in.h>
+#include <netinet/tcp.h>
 #include <sys/socket.h>
 #include <arpa/inet.h>
 #include <netdb.h>
@@ -28,6 +29,8 @@
 #include <getopt.h>
 #include <signal.h>
 #include <assert.h>
+#include <fcntl.h>
+#include <sys/epoll.h>
 #include "aconfig.h"
 #include "gettext.h"
 
@@ -36,40 +39,110 @@
  */
 static void usage(void);
 static void init_buf(void);
-static void init_pollfds(void);
+static void init_epoll(void);
 static void close_files(void);
 static void init_seq(char *source, char *dest, char *name);
 static void sigterm_exit(int sig);
 static void init_server(const char *port);
 static void init_client(const char *server, const char *port);
+static void init_udp(const char *host, const char *port);
 static void do_loop(void);
 static int copy_local_to_remote(void);
-static int copy_remote_to_local(int fd);
+static int copy_remote_to_local(int i);
+static void flush_connection(int i);
+static void copy_udp_to_local(void);
 
 /*
  * default TCP port number
  */
 #define DEFAULT_PORT	"40002"
 
+#define MAX_BUF_EVENTS	200
+#define MAX_CONNECTION	10
+
 /*
- * local input buffer
+ * input buffer of each connection; TCP can split the stream anywhere, so
+ * an incomplete packet is kept until the rest of it has arrived
  */
-static char *readbuf;
-static int max_rdlen;
-static char *writebuf;
-static int cur_wrlen, max_wrlen;
+struct inbuf {
+	char *data;
+	size_t len;		/* bytes received */
+	size_t size;		/* allocated */
+};
 
-#define MAX_BUF_EVENTS	200
-#define MAX_CONNECTION	10
+/* larger sysex packets are taken as a broken stream */
+#define MAX_PACKET_SIZE	(1024 * 1024)
+
+/*
+ * output ring of each connection; the sockets are nonblocking, and what
+ * the peer doesn't take at once is kept here until it is writable again
+ */
+struct outbuf {
+	char *data;
+	size_t head;		/* offset of the first byte to send */
+	size_t len;		/* bytes queued */
+	int want_out;		/* waiting for EPOLLOUT */
+	unsigned long dropped;	/* events dropped by OVERFLOW_DROP */
+};
+
+#define DEFAULT_OUTBUF_SIZE	(64 * 1024)
+
+/* what to do when the output ring of a connection is full */
+enum {
+	OVERFLOW_DROP,		/* drop the event for this connection */
+	OVERFLOW_DISCONNECT,	/* close the connection */
+	OVERFLOW_BLOCK,		/* wait until the peer takes the data */
+};
+
+/* epoll tags */
+#define TAG_SEQ		0x10000
+#define TAG_SOCKET	0x20000
+#define TAG_NET		0x30000
+#define TAG_UDP		0x40000
+#define TAG_TYPE(tag)	((tag) & 0xffff0000)
+#define TAG_INDEX(tag)	((tag) & 0xffff)
 
 static snd_seq_t *handle;
 static struct pollfd *seqifds = NULL;
 static struct pollfd *seqofds = NULL;
-static struct pollfd *pollfds = NULL;
 static int seqifds_count = 0;
 static int seqofds_count = 0;
-static int pollfds_count = 0;
+static int epfd = -1;
 static int sockfd, netfd[MAX_CONNECTION] = {[0 ... MAX_CONNECTION-1] = -1};
+static struct outbuf outbufs[MAX_CONNECTION];
+static struct inbuf inbufs[MAX_CONNECTION];
+static int output_pending;
+
+/*
+ * UDP mode: each datagram starts with a 32-bit sequence number in network
+ * byte order, followed by event packets as on TCP. Late and duplicated
+ * datagrams are dropped, lost ones are counted.
+ */
+#define UDP_HEADER_SIZE		4
+#define UDP_PAYLOAD_SIZE	1400	/* fits in an Ethernet frame */
+#define UDP_MAX_SIZE		65507
+
+struct udp_peer {
+	struct sockaddr_storage addr;
+	socklen_t addrlen;
+	int started;		/* next_seq is known */
+	uint32_t next_seq;
+	unsigned long lost;
+};
+
+static int udp_mode;
+static int udpfd = -1;
+static struct sockaddr_storage udp_dest;
+static socklen_t udp_destlen;
+static uint32_t udp_seq;
+static char *udp_buf;		/* datagram being filled */
+static size_t udp_len;
+static struct udp_peer udp_peers[MAX_CONNECTION];
+static int udp_peer_count;
+static int nodelay;
+static size_t outbuf_size = DEFAULT_OUTBUF_SIZE;
+static int overflow_policy = OVERFLOW_DROP;
+static int connection_closed;
 static int max_connection;
 static int cur_connected;
 static int seq_port;
@@ -93,6 +166,10 @@ static const struct option long_option[] = {
 	{"help", 0, NULL, 'h'},
 	{"verbose", 0, NULL, 'v'},
 	{"info", 0, NULL, 'i'},
+	{"buffer-size", 1, NULL, 'b'},
+	{"overflow", 1, NULL, 'o'},
+	{"nodelay", 0, NULL, 'N'},
+	{"udp", 0, NULL, 'u'},
 	{NULL, 0, NULL, 0},
 };
 
@@ -108,7 +185,7 @@ int main(int argc, char **argv)
 	textdomain(PACKAGE);
 #endif
 
-	while ((c = getopt_long(argc, argv, "p:s:d:n:6hvi", long_option, NULL)) != -1) {
+	while ((c = getopt_long(argc, argv, "p:s:d:n:6hvib:o:Nu", long_option, NULL)) != -1) {
 		switch (c) {
 		case '6':
 			ipv6 = 1;
@@ -131,6 +208,31 @@ int main(int argc, char **argv)
 		case 'i':
 			info++;
 			break;
+		case 'b':
+			outbuf_size = (size_t)atoi(optarg) * 1024;
+			if (outbuf_size < 1024) {
+				fprintf(stderr, _("invalid buffer size %s\n"), optarg);
+				exit(1);
+			}
+			break;
+		case 'o':
+			if (!strcmp(optarg, "drop"))
+				overflow_policy = OVERFLOW_DROP;
+			else if (!strcmp(optarg, "disconnect"))
+				overflow_policy = OVERFLOW_DISCONNECT;
+			else if (!strcmp(optarg, "block"))
+				overflow_policy = OVERFLOW_BLOCK;
+			else {
+				fprintf(stderr, _("invalid overflow policy %s\n"), optarg);
+				exit(1);
+			}
+			break;
+		case 'N':
+			nodelay = 1;
+			break;
+		case 'u':
+			udp_mode = 1;
+			break;
 		default:
 			usage();
 			exit(1);
@@ -143,15 +245,24 @@ int main(int argc, char **argv)
 	init_buf();
 	init_seq(source, dest, name);
 
-	if (optind >= argc) {
+	if (udp_mode) {
+		if (optind >= argc) {
+			fprintf(stderr, _("UDP mode needs a peer or multicast group\n"));
+			exit(1);
+		}
+		server_mode = 0;
+		max_connection = 0;
+		init_epoll();
+		init_udp(argv[optind], port);
+	} else if (optind >= argc) {
 		server_mode = 1;
 		max_connection = MAX_CONNECTION;
-		init_pollfds();
+		init_epoll();
 		init_server(port);
 	} else {
 		server_mode = 0;
 		max_connection = 1;
-		init_pollfds();
+		init_epoll();
 		init_client(argv[optind], port);
 	}
 
@@ -181,6 +292,10 @@ static void usage(void)
 	printf(_("  -n,--name value : use a specific midi process name\n"));
 	printf(_("  -v, --verbose : print verbose messages\n"));
 	printf(_("  -i, --info : print certain received events\n"));
+	printf(_("  -b, --buffer-size KB : output buffer size per connection\n"));
+	printf(_("  -o, --overflow policy : drop, disconnect or block when a buffer is full\n"));
+	printf(_("  -N, --nodelay : send small TCP packets at once (TCP_NODELAY)\n"));
+	printf(_("  -u, --udp : use UDP; the host may be a multicast group\n"));
 }
 
 
@@ -189,27 +304,100 @@ static void usage(void)
  */
 static void init_buf(void)
 {
-	max_wrlen = MAX_BUF_EVENTS * sizeof(snd_seq_event_t);
-	max_rdlen = MAX_BUF_EVENTS * sizeof(snd_seq_event_t);
-	writebuf = malloc(max_wrlen);
-	readbuf = malloc(max_rdlen);
-	if (writebuf == NULL || readbuf == NULL) {
-		fprintf(stderr, _("can't malloc\n"));
+	int i;
+
+	for (i = 0; i < MAX_CONNECTION; i++) {
+		outbufs[i].data = NULL;
+		outbufs[i].head = outbufs[i].len = 0;
+		inbufs[i].size = MAX_BUF_EVENTS * sizeof(snd_seq_event_t);
+		inbufs[i].data = malloc(inbufs[i].size);
+		inbufs[i].len = 0;
+		if (inbufs[i].data == NULL) {
+			fprintf(stderr, _("can't malloc\n"));
+			exit(1);
+		}
+	}
+}
+
+static void epoll_add(int fd, unsigned int events, unsigned int tag)
+{
+	struct epoll_event ev;
+
+	memset(&ev, 0, sizeof(ev));
+	ev.events = events;
+	ev.data.u32 = tag;
+	if (epoll_ctl(epfd, EPOLL_CTL_ADD, fd, &ev) < 0) {
+		perror("epoll_ctl");
 		exit(1);
 	}
-	memset(writebuf, 0, max_wrlen);
-	memset(readbuf, 0, max_rdlen);
-	cur_wrlen = 0;
 }
 
 /*
- * allocate and initialize poll array
+ * create the epoll set with the sequencer descriptors; the sockets are
+ * added when they are opened
  */
-static void init_pollfds(void)
+static void init_epoll(void)
+{
+	int i;
+
+	epfd = epoll_create1(EPOLL_CLOEXEC);
+	if (epfd < 0) {
+		perror("epoll_create");
+		exit(1);
+	}
+	for (i = 0; i < seqifds_count; i++)
+		epoll_add(seqifds[i].fd, EPOLLIN, TAG_SEQ | i);
+}
+
+static void set_nonblock(int fd)
+{
+	int flags = fcntl(fd, F_GETFL);
+
+	if (flags < 0 || fcntl(fd, F_SETFL, flags | O_NONBLOCK) < 0) {
+		perror("fcntl");
+		exit(1);
+	}
+}
+
+/*
+ * set up the output ring and the polling of a new connection
+ */
+static void open_connection(int i)
+{
+	struct outbuf *out = &outbufs[i];
+
+	if (out->data == NULL) {
+		out->data = malloc(outbuf_size);
+		if (out->data == NULL) {
+			fprintf(stderr, _("can't malloc\n"));
+			exit(1);
+		}
+	}
+	out->head = out->len = 0;
+	out->want_out = 0;
+	out->dropped = 0;
+	inbufs[i].len = 0;
+	if (nodelay && setsockopt(netfd[i], IPPROTO_TCP, TCP_NODELAY,
+				  &nodelay, sizeof(nodelay)) < 0) {
+		perror("setsockopt");
+		exit(1);
+	}
+	set_nonblock(netfd[i]);
+	epoll_add(netfd[i], EPOLLIN, TAG_NET | i);
+}
+
+static void close_connection(int i)
 {
-	pollfds_count = seqifds_count + seqofds_count + 1 + max_connection;
-	pollfds = (struct pollfd *)calloc(pollfds_count, sizeof(struct pollfd));
-	assert(pollfds);
+	if (netfd[i] < 0)
+		return;
+	if (verbose && outbufs[i].dropped)
+		fprintf(stderr, _("dropped %lu events for connection %d\n"),
+			outbufs[i].dropped, netfd[i]);
+	/* closing removes it from the epoll set */
+	close(netfd[i]);
+	netfd[i] = -1;
+	cur_connected--;
+	connection_closed = 1;
 }
 
 /*
@@ -226,6 +414,8 @@ static void close_files(void)
 	}
 	if (sockfd >= 0)
 		close(sockfd);
+	if (udpfd >= 0)
+		close(udpfd);
 }
 
 
@@ -391,6 +581,7 @@ static void init_server(const char *port)
 		perror("can't listen");
 		exit(1);
 	}
+	epoll_add(sockfd, EPOLLIN, TAG_SOCKET);
 
 	cur_connected = 0;
 	for (i = 0; i < max_connection; i++)
@@ -423,6 +614,7 @@ static void start_connection(void)
 	}
 	if (verbose)
 		fprintf(stderr, _("accepted[%d]\n"), netfd[i]);
+	open_connection(i);
 	cur_connected++;
 }
 
@@ -474,97 +666,340 @@ static void init_client(const char *server, const char *port)
 	if (verbose)
 		fprintf(stderr, _("ok.. connected\n"));
 	netfd[0] = fd;
+	open_connection(0);
 	cur_connected = 1;
 }
 
+static int is_multicast(const struct sockaddr *addr)
+{
+	switch (addr->sa_family) {
+	case AF_INET:
+		return IN_MULTICAST(ntohl(((const struct sockaddr_in *)addr)->sin_addr.s_addr));
+	case AF_INET6:
+		return IN6_IS_ADDR_MULTICAST(&((const struct sockaddr_in6 *)addr)->sin6_addr);
+	}
+	return 0;
+}
+
+/*
+ * initialize UDP mode: the events are sent to host, which is either a
+ * peer running aseqnet in UDP mode too, or a multicast group that all
+ * receivers join
+ */
+static void init_udp(const char *host, const char *port)
+{
+	struct addrinfo hints;
+	struct addrinfo *result;
+	struct sockaddr_storage local;
+	char buf[100];
+	int curstate = 1, loop = 0;
+
+	memset(&hints, 0, sizeof(hints));
+	hints.ai_family = ipv6 ? AF_INET6 : AF_UNSPEC;
+	hints.ai_socktype = SOCK_DGRAM;
+
+	if (getaddrinfo(host, port, &hints, &result) != 0 || result == NULL) {
+		fprintf(stderr, _("can't get address %s\n"), host);
+		exit(1);
+	}
+	memcpy(&udp_dest, result->ai_addr, result->ai_addrlen);
+	udp_destlen = result->ai_addrlen;
+	if (verbose) {
+		get_net_addr(result, buf, sizeof(buf));
+		fprintf(stderr, _("sending to: %s\n"), buf);
+	}
+
+	if ((udpfd = socket(result->ai_family, SOCK_DGRAM, 0)) < 0) {
+		perror("create socket");
+		exit(1);
+	}
+	if (setsockopt(udpfd, SOL_SOCKET, SO_REUSEADDR, &curstate, sizeof(curstate)) < 0) {
+		perror("setsockopt");
+		exit(1);
+	}
+
+	/* receive on the same port from any address */
+	memcpy(&local, &udp_dest, udp_destlen);
+	if (local.ss_family == AF_INET)
+		((struct sockaddr_in *)&local)->sin_addr.s_addr = htonl(INADDR_ANY);
+	else
+		((struct sockaddr_in6 *)&local)->sin6_addr = in6addr_any;
+	if (bind(udpfd, (struct sockaddr *)&local, udp_destlen) < 0) {
+		perror("bind");
+		exit(1);
+	}
+
+	if (is_multicast(result->ai_addr)) {
+		if (result->ai_family == AF_INET) {
+			struct ip_mreq mreq;
+
+			mreq.imr_multiaddr = ((struct sockaddr_in *)result->ai_addr)->sin_addr;
+			mreq.imr_interface.s_addr = htonl(INADDR_ANY);
+			if (setsockopt(udpfd, IPPROTO_IP, IP_ADD_MEMBERSHIP, &mreq, sizeof(mreq)) < 0 ||
+			    setsockopt(udpfd, IPPROTO_IP, IP_MULTICAST_LOOP, &loop, sizeof(loop)) < 0) {
+				perror("join multicast group");
+				exit(1);
+			}
+		} else {
+			struct ipv6_mreq mreq;
+
+			mreq.ipv6mr_multiaddr = ((struct sockaddr_in6 *)result->ai_addr)->sin6_addr;
+			mreq.ipv6mr_interface = 0;
+			if (setsockopt(udpfd, IPPROTO_IPV6, IPV6_JOIN_GROUP, &mreq, sizeof(mreq)) < 0 ||
+			    setsockopt(udpfd, IPPROTO_IPV6, IPV6_MULTICAST_LOOP, &loop, sizeof(loop)) < 0) {
+				perror("join multicast group");
+				exit(1);
+			}
+		}
+		if (verbose)
+			fprintf(stderr, _("joined multicast group\n"));
+	}
+	freeaddrinfo(result);
+
+	udp_buf = malloc(UDP_MAX_SIZE);
+	if (udp_buf == NULL) {
+		fprintf(stderr, _("can't malloc\n"));
+		exit(1);
+	}
+	udp_len = 0;
+	set_nonblock(udpfd);
+	epoll_add(udpfd, EPOLLIN, TAG_UDP);
+}
+
 /*
  * event loop
  */
 static void do_loop(void)
 {
-	int i, rc, width;
-	int seqifd_ptr, sockfd_ptr = -1, netfd_ptr;
+	struct epoll_event events[MAX_CONNECTION + 8];
+	int i, n, idx;
+	unsigned int tag;
 
 	for (;;) {
-		memset(pollfds, 0, pollfds_count * sizeof(struct pollfd));
-		seqifd_ptr = 0;
-		memcpy(pollfds, seqifds, sizeof(*seqifds)*(width = seqifds_count));
-		if (server_mode) {
-			sockfd_ptr = width;
-			pollfds[width].fd = sockfd;
-			pollfds[width].events = POLLIN;
-			width++;
-		}
-		netfd_ptr = width;
-		for (i = 0; i < max_connection; i++) {
-			if (netfd[i] >= 0) {
-				pollfds[width].fd = netfd[i];
-				pollfds[width].events = POLLIN;
-				width++;
-			}
-		}
 		do {
-			rc = poll(pollfds, width, -1);
-		} while (rc <= 0 && errno == EINTR);
-		if (rc <= 0) {
-			perror("poll");
+			n = epoll_wait(epfd, events, sizeof(events) / sizeof(events[0]), -1);
+		} while (n < 0 && errno == EINTR);
+		if (n < 0) {
+			perror("epoll_wait");
 			exit(1);
 		}
-		if (server_mode) {
-			if (pollfds[sockfd_ptr].revents & (POLLIN|POLLOUT))
+		connection_closed = 0;
+		for (i = 0; i < n; i++) {
+			tag = events[i].data.u32;
+			switch (TAG_TYPE(tag)) {
+			case TAG_SOCKET:
 				start_connection();
-		}
-		for (i = 0; i < seqifds_count; i++)
-			if (pollfds[seqifd_ptr + i].revents & (POLLIN|POLLOUT)) {
+				break;
+			case TAG_SEQ:
 				if (copy_local_to_remote())
 					return;
 				break;
-			}
-		for (i = 0; i < max_connection; i++) {
-			if (netfd[i] < 0)
-				continue;
-			if (pollfds[netfd_ptr + i].revents & (POLLIN|POLLOUT)) {
-				if (copy_remote_to_local(netfd[i])) {
-					netfd[i] = -1;
-					cur_connected--;
-					if (cur_connected <= 0)
-						return;
-				}
+			case TAG_UDP:
+				copy_udp_to_local();
+				break;
+			case TAG_NET:
+				idx = TAG_INDEX(tag);
+				/* may have been closed by an earlier event */
+				if (netfd[idx] < 0)
+					break;
+				if (events[i].events & EPOLLOUT)
+					flush_connection(idx);
+				if (netfd[idx] >= 0 &&
+				    (events[i].events & (EPOLLIN | EPOLLHUP | EPOLLERR)) &&
+				    copy_remote_to_local(idx))
+					close_connection(idx);
+				break;
 			}
 		}
+		/* one drain for the events of all connections */
+		if (output_pending) {
+			snd_seq_drain_output(handle);
+			output_pending = 0;
+		}
+		if (connection_closed && cur_connected <= 0)
+			return;
 	}
 }
 
 
+static void set_want_out(int i, int want)
+{
+	struct epoll_event ev;
+
+	if (outbufs[i].want_out == want)
+		return;
+	memset(&ev, 0, sizeof(ev));
+	ev.events = EPOLLIN | (want ? EPOLLOUT : 0);
+	ev.data.u32 = TAG_NET | i;
+	if (epoll_ctl(epfd, EPOLL_CTL_MOD, netfd[i], &ev) < 0) {
+		perror("epoll_ctl");
+		exit(1);
+	}
+	outbufs[i].want_out = want;
+}
+
 /*
- * flush write buffer - send data to the socket
+ * send as much of the output ring as the socket takes without blocking
  */
-static void flush_writebuf(void)
-{
-	if (cur_wrlen) {
-		int i;
-		for (i = 0; i < max_connection; i++) {
-			if (netfd[i] >= 0) {
-				ssize_t wrlen = write(netfd[i], writebuf, cur_wrlen);
-				if (wrlen != (ssize_t)cur_wrlen)
-					fprintf(stderr, "write error: %s", wrlen < 0 ? strerror(errno) : "short");
-			}
+static void flush_connection(int i)
+{
+	struct outbuf *out = &outbufs[i];
+	size_t chunk;
+	ssize_t wrlen;
+
+	while (out->len > 0) {
+		chunk = outbuf_size - out->head;
+		if (chunk > out->len)
+			chunk = out->len;
+		wrlen = write(netfd[i], out->data + out->head, chunk);
+		if (wrlen < 0) {
+			if (errno == EINTR)
+				continue;
+			if (errno == EAGAIN || errno == EWOULDBLOCK)
+				break;
+			fprintf(stderr, "write error: %s\n", strerror(errno));
+			close_connection(i);
+			return;
 		}
-		cur_wrlen = 0;
+		out->head = (out->head + wrlen) % outbuf_size;
+		out->len -= wrlen;
+	}
+	if (out->len == 0)
+		out->head = 0;
+	set_want_out(i, out->len > 0);
+}
+
+/*
+ * copy up to len bytes into the output ring, returns the bytes copied
+ */
+static size_t outbuf_put(struct outbuf *out, const char *data, size_t len)
+{
+	size_t tail, chunk, copied = 0;
+
+	if (len > outbuf_size - out->len)
+		len = outbuf_size - out->len;
+	while (copied < len) {
+		tail = (out->head + out->len) % outbuf_size;
+		chunk = outbuf_size - tail;
+		if (chunk > len - copied)
+			chunk = len - copied;
+		memcpy(out->data + tail, data + copied, chunk);
+		out->len += chunk;
+		copied += chunk;
 	}
+	return copied;
 }
 
 /*
- * get space from write buffer
+ * wait until the socket is writable and send what it takes
  */
-static char *get_writebuf(int len)
+static void wait_connection(int i)
 {
-	char *buf;
-	if (cur_wrlen + len >= max_wrlen)
-		flush_writebuf();
-	buf = writebuf + cur_wrlen;
-	cur_wrlen += len;
-	return buf;
+	struct pollfd pfd;
+
+	pfd.fd = netfd[i];
+	pfd.events = POLLOUT;
+	while (poll(&pfd, 1, -1) < 0 && errno == EINTR)
+		;
+	flush_connection(i);
+}
+
+static void queue_data(int i, const char *data, size_t len)
+{
+	size_t n;
+
+	while (len > 0 && netfd[i] >= 0) {
+		n = outbuf_put(&outbufs[i], data, len);
+		data += n;
+		len -= n;
+		if (len > 0)
+			wait_connection(i);
+	}
+}
+
+/*
+ * send the datagram being filled, a lost datagram is just lost
+ */
+static void udp_flush(void)
+{
+	uint32_t seq;
+
+	if (udp_len == 0)
+		return;
+	seq = htonl(udp_seq++);
+	memcpy(udp_buf, &seq, sizeof(seq));
+	if (sendto(udpfd, udp_buf, UDP_HEADER_SIZE + udp_len, 0,
+		   (struct sockaddr *)&udp_dest, udp_destlen) < 0 && verbose)
+		fprintf(stderr, "sendto: %s\n", strerror(errno));
+	udp_len = 0;
+}
+
+static void udp_send_packet(const char *hdr, size_t hdrlen, const char *data, size_t len)
+{
+	if (UDP_HEADER_SIZE + hdrlen + len > UDP_MAX_SIZE) {
+		if (verbose)
+			fprintf(stderr, _("event too large for UDP, dropped\n"));
+		return;
+	}
+	/* small events are collected, a large one gets its own datagram */
+	if (udp_len > 0 && UDP_HEADER_SIZE + udp_len + hdrlen + len > UDP_PAYLOAD_SIZE)
+		udp_flush();
+	memcpy(udp_buf + UDP_HEADER_SIZE + udp_len, hdr, hdrlen);
+	udp_len += hdrlen;
+	if (len) {
+		memcpy(udp_buf + UDP_HEADER_SIZE + udp_len, data, len);
+		udp_len += len;
+	}
+}
+
+/*
+ * queue an event packet for all connections; a packet is queued either
+ * completely or not at all, so that the stream framing stays intact
+ */
+static void send_packet(const char *hdr, size_t hdrlen, const char *data, size_t len)
+{
+	int i;
+
+	if (udp_mode) {
+		udp_send_packet(hdr, hdrlen, data, len);
+		return;
+	}
+	for (i = 0; i < max_connection; i++) {
+		if (netfd[i] < 0)
+			continue;
+		if (overflow_policy != OVERFLOW_BLOCK &&
+		    hdrlen + len > outbuf_size - outbufs[i].len) {
+			/* try sending what is queued before giving up */
+			flush_connection(i);
+			if (netfd[i] < 0)
+				continue;
+			if (hdrlen + len > outbuf_size - outbufs[i].len) {
+				if (overflow_policy == OVERFLOW_DISCONNECT) {
+					if (verbose)
+						fprintf(stderr, _("connection %d too slow, closing\n"),
+							netfd[i]);
+					close_connection(i);
+				} else {
+					outbufs[i].dropped++;
+				}
+				continue;
+			}
+		}
+		queue_data(i, hdr, hdrlen);
+		queue_data(i, data, len);
+	}
+}
+
+static void flush_connections(void)
+{
+	int i;
+
+	if (udp_mode)
+		udp_flush();
+
+	for (i = 0; i < max_connection; i++)
+		if (netfd[i] >= 0 && outbufs[i].len > 0)
+			flush_connection(i);
 }
 
 static void print_event(snd_seq_event_t *ev)
@@ -598,7 +1033,7 @@ static int copy_local_to_remote(void)
 {
 	int rc;
 	snd_seq_event_t *ev;
-	char *buf;
+	char buf[EVENT_PACKET_SIZE];
 
 	while ((rc = snd_seq_event_input(handle, &ev)) >= 0 && ev) {
 		if (ev->type >= SND_SEQ_EVENT_CLIENT_START &&
@@ -606,60 +1041,169 @@ static int copy_local_to_remote(void)
 			snd_seq_free_event(ev);
 			continue;
 		}
-		if (snd_seq_ev_is_variable(ev)) {
-			int len;
-			len = EVENT_PACKET_SIZE + ev->data.ext.len;
-			buf = get_writebuf(len);
-			memcpy(buf, ev, sizeof(snd_seq_event_t));
-			memcpy(buf + EVENT_PACKET_SIZE, ev->data.ext.ptr, ev->data.ext.len);
-		} else {
-			buf = get_writebuf(EVENT_PACKET_SIZE);
-			memcpy(buf, ev, EVENT_PACKET_SIZE);
-		}
+		memset(buf, 0, sizeof(buf));
+		memcpy(buf, ev, sizeof(snd_seq_event_t));
+		if (snd_seq_ev_is_variable(ev))
+			send_packet(buf, sizeof(buf), ev->data.ext.ptr, ev->data.ext.len);
+		else
+			send_packet(buf, sizeof(buf), NULL, 0);
 		if (info)
 			print_event(ev);
 		snd_seq_free_event(ev);
 	}
-	flush_writebuf();
+	flush_connections();
 	return 0;
 }
 
 /*
- * copy events from a port to sequencer
+ * output the complete packets in data, returns the bytes used or -1 for
+ * an invalid packet; *need is set to the size of the incomplete packet
+ * that follows, or 0
  */
-static int copy_remote_to_local(int fd)
+static size_t output_packets(char *data, size_t len, size_t *need)
 {
-	int count;
-	char *buf;
-	snd_seq_event_t *ev;
+	snd_seq_event_t ev;
+	size_t pos = 0, size;
 
-	count = read(fd, readbuf, MAX_BUF_EVENTS * sizeof(snd_seq_event_t));
-	buf = readbuf;
+	*need = 0;
+	while (len - pos >= EVENT_PACKET_SIZE) {
+		memcpy(&ev, data + pos, sizeof(ev));
+		size = EVENT_PACKET_SIZE;
+		if (snd_seq_ev_is_variable(&ev))
+			size += ev.data.ext.len;
+		if (size > MAX_PACKET_SIZE)
+			return (size_t)-1;
+		if (len - pos < size) {
+			*need = size;
+			break;
+		}
+		if (snd_seq_ev_is_variable(&ev))
+			ev.data.ext.ptr = data + pos + EVENT_PACKET_SIZE;
+		snd_seq_ev_set_direct(&ev);
+		snd_seq_ev_set_source(&ev, seq_port);
+		snd_seq_ev_set_subs(&ev);
+		if (info)
+			print_event(&ev);
+		snd_seq_event_output(handle, &ev);
+		output_pending = 1;
+		pos += size;
+	}
+	return pos;
+}
+
+/*
+ * copy events from a port to sequencer
+ *
+ * Each packet is an event of EVENT_PACKET_SIZE bytes, followed by
+ * data.ext.len bytes of data for variable length events, so the header
+ * tells the length of the packet.
+ */
+static int copy_remote_to_local(int i)
+{
+	struct inbuf *in = &inbufs[i];
+	ssize_t count;
+	size_t pos, need;
+	char *p;
 
-	if (count == 0) {
+	count = read(netfd[i], in->data + in->len, in->size - in->len);
+	if (count < 0 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR))
+		return 0;
+	if (count <= 0) {
 		if (verbose)
 			fprintf(stderr, _("disconnected\n"));
 		return 1;
 	}
+	in->len += count;
 
-	while (count > 0) {
-		ev = (snd_seq_event_t*)buf;
-		buf += EVENT_PACKET_SIZE;
-		count -= EVENT_PACKET_SIZE;
-		if (snd_seq_ev_is_variable(ev) && ev->data.ext.len > 0) {
-			ev->data.ext.ptr = buf;
-			buf += ev->data.ext.len;
-			count -= ev->data.ext.len;
+	pos = output_packets(in->data, in->len, &need);
+	if (pos == (size_t)-1) {
+		fprintf(stderr, _("invalid packet from connection %d\n"), netfd[i]);
+		return 1;
+	}
+	/* make room for the rest of a large packet */
+	if (need > in->size) {
+		p = realloc(in->data, need);
+		if (p == NULL) {
+			fprintf(stderr, _("can't malloc\n"));
+			exit(1);
 		}
-		snd_seq_ev_set_direct(ev);
-		snd_seq_ev_set_source(ev, seq_port);
-		snd_seq_ev_set_subs(ev);
-		if (info)
-			print_event(ev);
-		snd_seq_event_output(handle, ev);
+		in->data = p;
+		in->size = need;
 	}
 
-	snd_seq_drain_output(handle);
+	/* keep the incomplete packet at the start of the buffer */
+	if (pos > 0) {
+		memmove(in->data, in->data + pos, in->len - pos);
+		in->len -= pos;
+	}
 	return 0;
 }
 
+static struct udp_peer *find_udp_peer(const struct sockaddr_storage *addr, socklen_t addrlen)
+{
+	int i;
+
+	for (i = 0; i < udp_peer_count; i++)
+		if (udp_peers[i].addrlen == addrlen &&
+		    !memcmp(&udp_peers[i].addr, addr, addrlen))
+			return &udp_peers[i];
+	if (udp_peer_count >= MAX_CONNECTION)
+		return NULL;
+	i = udp_peer_count++;
+	memcpy(&udp_peers[i].addr, addr, addrlen);
+	udp_peers[i].addrlen = addrlen;
+	udp_peers[i].started = 0;
+	udp_peers[i].lost = 0;
+	return &udp_peers[i];
+}
+
+/*
+ * copy the events of the received datagrams to the sequencer
+ */
+static void copy_udp_to_local(void)
+{
+	static char buf[UDP_MAX_SIZE];
+	struct sockaddr_storage addr;
+	socklen_t addrlen;
+	struct udp_peer *peer;
+	uint32_t seq;
+	int32_t diff;
+	ssize_t count;
+	size_t need;
+
+	for (;;) {
+		addrlen = sizeof(addr);
+		count = recvfrom(udpfd, buf, sizeof(buf), 0,
+				 (struct sockaddr *)&addr, &addrlen);
+		if (count < 0) {
+			if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)
+				perror("recvfrom");
+			return;
+		}
+		if (count < UDP_HEADER_SIZE)
+			continue;
+		memcpy(&seq, buf, sizeof(seq));
+		seq = ntohl(seq);
+		peer = find_udp_peer(&addr, addrlen);
+		if (peer == NULL)
+			continue;
+		if (peer->started) {
+			diff = (int32_t)(seq - peer->next_seq);
+			/* late or duplicated */
+			if (diff < 0)
+				continue;
+			if (diff > 0) {
+				peer->lost += diff;
+				if (verbose)
+					fprintf(stderr, _("lost %d datagrams (%lu total)\n"),
+						diff, peer->lost);
+			}
+		}
+		peer->next_seq = seq + 1;
+		peer->started = 1;
+		/* a datagram holds complete packets only */
+		if (output_packets(buf + UDP_HEADER_SIZE, count - UDP_HEADER_SIZE, &need) !=
+		    (size_t)(count - UDP_HEADER_SIZE) && verbose)
+			fprintf(stderr, _("invalid datagram\n"));
+	}
+}
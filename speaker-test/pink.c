@@ -50,6 +50,9 @@ void initialize_pink_noise( pink_noise_t *pink, int num_rows )
 /* Initialize rows. */
     for( i=0; i<num_rows; i++ ) pink->pink_rows[i] = 0;
     pink->pink_running_sum = 0;
+/* Seeds of the block generator, any non-zero values will do. */
+    pink->row_seed = 22222;
+    for( i=0; i<PINK_WHITE_LANES; i++ ) pink->white_seed[i] = 0x9e3779b9u * (i + 1);
 }
 
 /* generate Pink noise values between -1.0 and +1.0 */
@@ -94,3 +97,73 @@ float generate_pink_noise_sample( pink_noise_t *pink )
 
     return output;
 }
+
+/************************************************************/
+/* Marsaglia xorshift, much cheaper than the LCG above. */
+static inline uint32_t xorshift32( uint32_t *state )
+{
+    uint32_t x = *state;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    *state = x;
+    return x;
+}
+
+#define PINK_BLOCK_SIZE        (256)
+
+/* generate count Pink noise values between -1.0 and +1.0 at once.
+ * The row updates depend on each other and are done in a first pass;
+ * the white noise comes from PINK_WHITE_LANES independent generators,
+ * so the second pass has no dependency between neighbouring samples and
+ * can be vectorised by the compiler.
+ */
+void generate_pink_noise_block( pink_noise_t *pink, float *out, int count )
+{
+    int32_t sums[PINK_BLOCK_SIZE];
+    uint32_t seed[PINK_WHITE_LANES];
+    int32_t new_random;
+    int i, j, n, row;
+
+    for( j=0; j<PINK_WHITE_LANES; j++ ) seed[j] = pink->white_seed[j];
+
+    while( count > 0 )
+    {
+	n = count < PINK_BLOCK_SIZE ? count : PINK_BLOCK_SIZE;
+
+	for( i=0; i<n; i++ )
+	{
+	    pink->pink_index = (pink->pink_index + 1) & pink->pink_index_mask;
+	    if( pink->pink_index != 0 )
+	    {
+		row = __builtin_ctz( pink->pink_index );
+		new_random = (int32_t)xorshift32( &pink->row_seed ) >> (32 - PINK_RANDOM_BITS);
+		pink->pink_running_sum += new_random - pink->pink_rows[row];
+		pink->pink_rows[row] = new_random;
+	    }
+	    sums[i] = pink->pink_running_sum;
+	}
+
+	for( i=0; i + PINK_WHITE_LANES <= n; i += PINK_WHITE_LANES )
+	{
+	    for( j=0; j<PINK_WHITE_LANES; j++ )
+	    {
+		seed[j] ^= seed[j] << 13;
+		seed[j] ^= seed[j] >> 17;
+		seed[j] ^= seed[j] << 5;
+		new_random = (int32_t)seed[j] >> (32 - PINK_RANDOM_BITS);
+		out[i + j] = pink->pink_scalar * (sums[i + j] + new_random);
+	    }
+	}
+	for( ; i<n; i++ )
+	{
+	    new_random = (int32_t)xorshift32( &seed[0] ) >> (32 - PINK_RANDOM_BITS);
+	    out[i] = pink->pink_scalar * (sums[i] + new_random);
+	}
+
+	out += n;
+	count -= n;
+    }
+
+    for( j=0; j<PINK_WHITE_LANES; j++ ) pink->white_seed[j] = seed[j];
+}
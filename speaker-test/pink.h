@@ -1,6 +1,9 @@
+#include <stdint.h>
+
 #define PINK_MAX_RANDOM_ROWS   (30)
 #define PINK_RANDOM_BITS       (24)
 #define PINK_RANDOM_SHIFT      ((sizeof(long)*8)-PINK_RANDOM_BITS)
+#define PINK_WHITE_LANES       (4)
 
 typedef struct
 {
@@ -9,7 +12,10 @@ typedef struct
   int       pink_index;        /* Incremented each sample. */
   int       pink_index_mask;    /* Index wrapped by ANDing with this mask. */
   float     pink_scalar;       /* Used to scale within range of -1.0 to +1.0 */
+  uint32_t  row_seed;          /* xorshift state for the rows (block generator) */
+  uint32_t  white_seed[PINK_WHITE_LANES]; /* xorshift states for the white noise */
 } pink_noise_t;
 
 void initialize_pink_noise( pink_noise_t *pink, int num_rows );
 float generate_pink_noise_sample( pink_noise_t *pink );
+void generate_pink_noise_block( pink_noise_t *pink, float *out, int count );
@@ -51,8 +51,11 @@
 #define ALSA_PCM_NEW_SW_PARAMS_API
 #include <alsa/asoundlib.h>
 #include <sys/time.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include <math.h>
 #include "pink.h"
+#include "sample-kernels.h"
 #include "aconfig.h"
 #include "gettext.h"
 #include "version.h"
@@ -70,6 +73,7 @@ enum {
   TEST_SINE,
   TEST_WAV,
   TEST_PATTERN,
+  TEST_ALIGN,
 };
 
 #define MAX_CHANNELS	16
@@ -107,8 +111,11 @@ static const char *given_test_wav_file = NULL;
 static char *wav_file_dir = SOUNDSDIR;
 static int debug = 0;
 static int force_frequency = 0;
+static int all_channels = 0;
 static int in_aborting = 0;
 static snd_pcm_t *pcm_handle = NULL;
+static const char *capture_device = "default"; /* measurement mic for -t align */
+static snd_pcm_t *capture_handle = NULL;
 
 #ifdef CONFIG_SUPPORT_CHMAP
 static snd_pcm_chmap_t *channel_map;
@@ -297,76 +304,66 @@ typedef union {
   int32_t i;
 } value_t;
 
-static void do_generate(uint8_t *frames, int channel, int count,
-			value_t (*generate)(void *), void *arg)
+/*
+ * Convert count samples of one channel to the sample format and store them
+ * interleaved into the period buffer; the caller clears the buffer for the
+ * silent channels.  The format switch is done once per period, not per
+ * sample.  sizeof(value_t) is the one of int32_t, so the values are given
+ * to the kernels as an array of the integers.
+ */
+static void store_channel(uint8_t *frames, int channel, int count,
+			  const value_t *val)
 {
-  value_t res;
-  int    chn;
-  int8_t *samp8 = (int8_t*) frames;
-  int16_t *samp16 = (int16_t*) frames;
-  int32_t *samp32 = (int32_t*) frames;
-  float   *samp_f = (float*) frames;
-
-  while (count-- > 0) {
-    for(chn=0;chn<channels;chn++) {
-      if (chn==channel) {
-	res = generate(arg);
-      } else {
-	res.i = 0;
-      }
-
-      switch (format) {
-      case SND_PCM_FORMAT_S8:
-	*samp8++ = res.i >> 24;
-        break;
-      case SND_PCM_FORMAT_S16_LE:
-	*samp16++ = LE_SHORT(res.i >> 16);
-        break;
-      case SND_PCM_FORMAT_S16_BE:
-	*samp16++ = BE_SHORT(res.i >> 16);
-        break;
-      case SND_PCM_FORMAT_FLOAT_LE:
-	*samp_f++ = res.f;
-        break;
-      case SND_PCM_FORMAT_S24_3LE:
-        res.i >>= 8;
-        *samp8++ = LE_INT(res.i);
-        *samp8++ = LE_INT(res.i) >> 8;
-        *samp8++ = LE_INT(res.i) >> 16;
-        break;
-      case SND_PCM_FORMAT_S24_3BE:
-        res.i >>= 8;
-        *samp8++ = BE_INT(res.i);
-        *samp8++ = BE_INT(res.i) >> 8;
-        *samp8++ = BE_INT(res.i) >> 16;
-        break;
-      case SND_PCM_FORMAT_S24_LE:
-        res.i >>= 8;
-        *samp8++ = LE_INT(res.i);
-        *samp8++ = LE_INT(res.i) >> 8;
-        *samp8++ = LE_INT(res.i) >> 16;
-        *samp8++ = 0;
-        break;
-      case SND_PCM_FORMAT_S24_BE:
-        res.i >>= 8;
-        *samp8++ = 0;
-        *samp8++ = BE_INT(res.i);
-        *samp8++ = BE_INT(res.i) >> 8;
-        *samp8++ = BE_INT(res.i) >> 16;
-        break;
-      case SND_PCM_FORMAT_S32_LE:
-	*samp32++ = LE_INT(res.i);
-        break;
-      case SND_PCM_FORMAT_S32_BE:
-	*samp32++ = BE_INT(res.i);
-        break;
-      default:
-        ;
-      }
-    }
+  int     width = snd_pcm_format_physical_width(format) / 8;
+  int     step = width * channels;
+  uint8_t *dst = frames + channel * width;
+  float   *samp_f = (float*) frames + channel;
+
+  switch (format) {
+  case SND_PCM_FORMAT_S8:
+    sample_store_S8(dst, step, &val->i, count);
+    break;
+  case SND_PCM_FORMAT_S16_LE:
+    sample_store_S16_LE(dst, step, &val->i, count);
+    break;
+  case SND_PCM_FORMAT_S16_BE:
+    sample_store_S16_BE(dst, step, &val->i, count);
+    break;
+  case SND_PCM_FORMAT_FLOAT_LE:
+    for (; count-- > 0; val++, samp_f += channels)
+      *samp_f = val->f;
+    break;
+  case SND_PCM_FORMAT_S24_3LE:
+    sample_store_S24_3LE(dst, step, &val->i, count);
+    break;
+  case SND_PCM_FORMAT_S24_3BE:
+    sample_store_S24_3BE(dst, step, &val->i, count);
+    break;
+  case SND_PCM_FORMAT_S24_LE:
+    sample_store_S24_LE(dst, step, &val->i, count);
+    break;
+  case SND_PCM_FORMAT_S24_BE:
+    sample_store_S24_BE(dst, step, &val->i, count);
+    break;
+  case SND_PCM_FORMAT_S32_LE:
+    sample_store_S32_LE(dst, step, &val->i, count);
+    break;
+  case SND_PCM_FORMAT_S32_BE:
+    sample_store_S32_BE(dst, step, &val->i, count);
+    break;
+  default:
+    ;
   }
 }
 
+/* fill count frames with silence, for the channels not stored */
+static void clear_frames(uint8_t *frames, int count)
+{
+  sample_fill_silence(frames, (size_t)count * channels,
+                      snd_pcm_format_physical_width(format) / 8,
+                      snd_pcm_format_silence_64(format));
+}
+
 /*
  * Sine generator
  */
@@ -374,18 +371,59 @@ typedef struct {
   double phase;
   double max_phase;
   double step;
+  value_t *table;		/* one full cycle, when it fits in rate samples */
+  unsigned int table_size;
+  unsigned int table_pos;
 } sine_t;
 
-static void init_sine(sine_t *sine)
+static unsigned int gcd(unsigned int a, unsigned int b)
 {
+  unsigned int t;
+
+  while (b) {
+    t = a % b;
+    a = b;
+    b = t;
+  }
+  return a;
+}
+
+static void init_sine(sine_t *sine, double frequency)
+{
+  unsigned int n, f, size;
+  value_t *table;
+
   sine->phase = 0;
-  sine->max_phase = 1.0 / freq;
+  sine->max_phase = 1.0 / frequency;
   sine->step = 1.0 / (double)rate;
+
+  /*
+   * With an integer frequency the signal repeats exactly after
+   * rate / gcd(rate, freq) samples, so one cycle is computed here and
+   * the periods are copied from it.
+   */
+  free(sine->table);
+  sine->table = NULL;
+  if (frequency < 1 || frequency != (unsigned int)frequency)
+    return;
+  f = frequency;
+  size = rate / gcd(rate, f);
+  table = malloc(size * sizeof(*table));
+  if (table == NULL)
+    return;
+  for (n = 0; n < size; n++) {
+    table[n].f = sin(2 * M_PI * (double)((unsigned long long)n * f % rate) / rate - M_PI);
+    table[n].f *= generator_scale;
+    if (format != SND_PCM_FORMAT_FLOAT_LE)
+      table[n].i = table[n].f * INT32_MAX;
+  }
+  sine->table = table;
+  sine->table_size = size;
+  sine->table_pos = 0;
 }
 
-static value_t generate_sine(void *arg)
+static value_t generate_sine(sine_t *sine)
 {
-  sine_t *sine = arg;
   value_t res;
 
   res.f = sin((sine->phase * 2 * M_PI) / sine->max_phase - M_PI);
@@ -398,29 +436,15 @@ static value_t generate_sine(void *arg)
   return res;
 }
 
-/* Pink noise is a better test than sine wave because we can tell
- * where pink noise is coming from more easily that a sine wave.
- */
-static value_t generate_pink_noise(void *arg)
-{
-  pink_noise_t *pink = arg;
-  value_t res;
-
-  res.f = generate_pink_noise_sample(pink) * generator_scale;
-  if (format != SND_PCM_FORMAT_FLOAT_LE)
-    res.i = res.f * INT32_MAX;
-  return res;
-}
-
 /*
  * useful for tests
  */
-static value_t generate_pattern(void *arg)
+static value_t generate_pattern(int *pattern)
 {
   value_t res;
 
-  res.i = *(int *)arg;
-  *(int *)arg = res.i + 1;
+  res.i = *pattern;
+  *pattern = res.i + 1;
   if (format != SND_PCM_FORMAT_FLOAT_LE)
     res.f = (float)res.i / (float)INT32_MAX;
   return res;
@@ -639,7 +663,8 @@ static int xrun_recovery(snd_pcm_t *handle, int err) {
  */
 
 static const char *wav_file[MAX_CHANNELS];
-static int wav_file_size[MAX_CHANNELS];
+static value_t *wav_data[MAX_CHANNELS];	/* samples converted at load */
+static int wav_samples[MAX_CHANNELS];
 
 struct wave_header {
   struct {
@@ -682,11 +707,23 @@ static const char *search_for_file(const char *name)
   return file;
 }
 
+/*
+ * Map the file and convert its samples once, so that the playback loop
+ * only has to store them into the periods.
+ */
 static int check_wav_file(int channel, const char *name)
 {
   struct wave_header header;
-  int fd;
-
+  struct stat st;
+  const uint8_t *map;
+  const int16_t *src;
+  value_t *val;
+  size_t length;
+  int fd, i, err = -EINVAL;
+
+  free((void *)wav_file[channel]);
+  free(wav_data[channel]);
+  wav_data[channel] = NULL;
   wav_file[channel] = search_for_file(name);
   if (! wav_file[channel]) {
     fprintf(stderr, _("No enough memory\n"));
@@ -697,10 +734,18 @@ static int check_wav_file(int channel, const char *name)
     fprintf(stderr, _("Cannot open WAV file %s\n"), wav_file[channel]);
     return -EINVAL;
   }
-  if (read(fd, &header, sizeof(header)) < (int)sizeof(header)) {
+  if (fstat(fd, &st) < 0 || st.st_size < (off_t)sizeof(header)) {
     fprintf(stderr, _("Invalid WAV file %s\n"), wav_file[channel]);
-    goto error;
+    close(fd);
+    return -EINVAL;
   }
+  map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (map == MAP_FAILED) {
+    fprintf(stderr, _("Cannot open WAV file %s\n"), wav_file[channel]);
+    return -EINVAL;
+  }
+  memcpy(&header, map, sizeof(header));
   
   if (header.hdr.magic != WAV_RIFF || header.hdr.type != WAV_WAVE) {
     fprintf(stderr, _("Not a WAV file: %s\n"), wav_file[channel]);
@@ -730,13 +775,32 @@ static int check_wav_file(int channel, const char *name)
     fprintf(stderr, _("Invalid WAV file %s\n"), wav_file[channel]);
     goto error;
   }
-  wav_file_size[channel] = LE_INT(header.chunk.length);
-  close(fd);
-  return 0;
+
+  length = LE_INT(header.chunk.length);
+  if (length > st.st_size - sizeof(header))
+    length = st.st_size - sizeof(header);
+  wav_samples[channel] = length / 2;
+  wav_data[channel] = malloc(wav_samples[channel] * sizeof(value_t) + 1);
+  if (! wav_data[channel]) {
+    fprintf(stderr, _("No enough memory\n"));
+    err = -ENOMEM;
+    goto error;
+  }
+  src = (const int16_t *)(map + sizeof(header));
+  val = wav_data[channel];
+  for (i = 0; i < wav_samples[channel]; i++, val++) {
+    int16_t sample = LE_SHORT(src[i]);
+
+    if (format == SND_PCM_FORMAT_FLOAT_LE)
+      val->f = sample / 32768.0f;
+    else
+      val->i = (int32_t)sample * 65536;
+  }
+  err = 0;
 
  error:
-  close(fd);
-  return -EINVAL;
+  munmap((void *)map, st.st_size);
+  return err;
 }
 
 static int setup_wav_file(int chn)
@@ -774,53 +838,69 @@ static int setup_wav_file(int chn)
   return check_wav_file(chn, wavs[chn]);
 }
 
-static int read_wav(uint16_t *buf, int channel, int offset, int bufsize)
-{
-  static FILE *wavfp = NULL;
-  int size;
+/*
+ *   Transfer method - write only
+ */
 
-  if (in_aborting)
-    return -EFAULT;
+/*
+ * The alignment test (-t align) plays a short chirp on each channel in
+ * turn, one slot of at least a second apart, while the measurement mic is
+ * recorded in the same run.  The arrival of each chirp is found by cross
+ * correlation, so the differences between the channels do not depend on
+ * when the streams were started.
+ */
+#define ALIGN_CHIRP_MS	20
+#define ALIGN_MIN_CONFIDENCE	8.0
 
-  if (! wav_file[channel]) {
-    fprintf(stderr, _("Undefined channel %d\n"), channel);
-    return -EINVAL;
-  }
+static float *align_ref;	/* the chirp */
+static int align_ref_len;
+static int align_pos;		/* position of the generator in the slot */
+static float *capture_data;	/* mono, since the start of the capture */
+static snd_pcm_uframes_t capture_frames, capture_size;
+static int capture_failed;
 
-  if (offset >= wav_file_size[channel])
-   return 0; /* finished */
+static void init_align(void)
+{
+  double f0 = 500.0, f1 = rate * 0.4 < 8000.0 ? rate * 0.4 : 8000.0;
+  double t, len;
+  int n;
 
-  if (! offset) {
-    if (wavfp)
-      fclose(wavfp);
-    wavfp = fopen(wav_file[channel], "r");
-    if (! wavfp)
-      return -errno;
-    if (fseek(wavfp, sizeof(struct wave_header), SEEK_SET) < 0)
-      return -errno;
+  align_ref_len = rate * ALIGN_CHIRP_MS / 1000;
+  align_ref = malloc(align_ref_len * sizeof(*align_ref));
+  if (align_ref == NULL) {
+    fprintf(stderr, _("No enough memory\n"));
+    exit(EXIT_FAILURE);
   }
-  if (offset + bufsize > wav_file_size[channel])
-    bufsize = wav_file_size[channel] - offset;
-  bufsize /= channels;
-  for (size = 0; size < bufsize; size += 2) {
-    int chn;
-    for (chn = 0; chn < channels; chn++) {
-      if (chn == channel) {
-	if (fread(buf, 2, 1, wavfp) != 1)
-	  return size;
-      }
-      else
-	*buf = 0;
-      buf++;
-    }
+  /* linear chirp with a Hann window, its correlation has a sharp peak */
+  len = (double)align_ref_len / rate;
+  for (n = 0; n < align_ref_len; n++) {
+    t = (double)n / rate;
+    align_ref[n] = sin(2 * M_PI * (f0 * t + (f1 - f0) * t * t / (2 * len))) *
+                   (0.5 - 0.5 * cos(2 * M_PI * n / (align_ref_len - 1))) *
+                   generator_scale;
   }
-  return size;
+  align_pos = align_ref_len;
 }
 
+/* read what the mic has recorded so far, without blocking */
+static void capture_poll(void)
+{
+  snd_pcm_sframes_t n;
 
-/*
- *   Transfer method - write only
- */
+  while (capture_frames < capture_size && !capture_failed) {
+    n = snd_pcm_readi(capture_handle, capture_data + capture_frames,
+                      capture_size - capture_frames);
+    if (n == -EAGAIN || n == 0)
+      break;
+    if (n < 0) {
+      /* the lost frames would move all later arrivals */
+      fprintf(stderr, _("Capture error: %s\n"), snd_strerror(n));
+      capture_failed = 1;
+      break;
+    }
+    capture_frames += n;
+  }
+}
 
 static int write_buffer(snd_pcm_t *handle, uint8_t *ptr, int cptr)
 {
@@ -844,44 +924,138 @@ static int write_buffer(snd_pcm_t *handle, uint8_t *ptr, int cptr)
 
     ptr += snd_pcm_frames_to_bytes(handle, err);
     cptr -= err;
+    if (capture_handle)
+      capture_poll();
   }
   return 0;
 }
 
+/*
+ * In the --all test every channel has its own generator, the sine of the
+ * channel n is at freq * (1 + ALL_FREQ_STEP * n); otherwise only the
+ * first one is used.
+ */
+#define ALL_FREQ_STEP	0.3
+
 static int pattern;
-static sine_t sine;
-static pink_noise_t pink;
+static sine_t sine[MAX_CHANNELS];
+static pink_noise_t pink[MAX_CHANNELS];
+static value_t *values;		/* one period of the tested channel */
+
+static int prg_exit(int code);
+
+static double channel_freq(int chn)
+{
+  return all_channels ? freq * (1 + ALL_FREQ_STEP * chn) : freq;
+}
 
 static void init_loop(void)
 {
+  int chn, count = all_channels ? channels : 1;
+
+  values = malloc(period_size * sizeof(*values));
+  if (values == NULL) {
+    fprintf(stderr, _("No enough memory\n"));
+    prg_exit(EXIT_FAILURE);
+  }
+
   switch (test_type) {
   case TEST_PINK_NOISE:
-    initialize_pink_noise(&pink, 16);
+    for (chn = 0; chn < count; chn++) {
+      initialize_pink_noise(&pink[chn], 16);
+      /* uncorrelated noise on each channel */
+      pink[chn].row_seed += chn;
+      pink[chn].white_seed[0] += chn;
+    }
     break;
   case TEST_SINE:
-    init_sine(&sine);
+    for (chn = 0; chn < count; chn++)
+      init_sine(&sine[chn], channel_freq(chn));
     break;
   case TEST_PATTERN:
     pattern = 0;
     break;
+  case TEST_ALIGN:
+    init_align();
+    break;
+  }
+}
+
+/* fill one period from the generator gen, calling it directly */
+static void generate_period(value_t *val, int count, int gen)
+{
+  float noise[256];
+  unsigned int n;
+
+  switch (test_type) {
+  case TEST_PINK_NOISE:
+    /* Pink noise is a better test than sine wave because we can tell
+     * where pink noise is coming from more easily that a sine wave.
+     */
+    while (count > 0) {
+      n = count < ARRAY_SIZE(noise) ? count : ARRAY_SIZE(noise);
+      generate_pink_noise_block(&pink[gen], noise, n);
+      if (format == SND_PCM_FORMAT_FLOAT_LE)
+        sample_gain(&val->f, noise, n, generator_scale);
+      else
+        sample_gain_to_s32(&val->i, noise, n, generator_scale);
+      val += n;
+      count -= n;
+    }
+    break;
+  case TEST_PATTERN:
+    while (count-- > 0)
+      *val++ = generate_pattern(&pattern);
+    break;
+  case TEST_ALIGN:
+    for (; count-- > 0; val++, align_pos++) {
+      val->f = align_pos < align_ref_len ? align_ref[align_pos] : 0;
+      if (format != SND_PCM_FORMAT_FLOAT_LE)
+        val->i = val->f * INT32_MAX;
+    }
+    break;
+  default:
+    if (sine[gen].table == NULL) {
+      while (count-- > 0)
+        *val++ = generate_sine(&sine[gen]);
+      break;
+    }
+    while (count > 0) {
+      n = sine[gen].table_size - sine[gen].table_pos;
+      if (n > (unsigned int)count)
+        n = count;
+      memcpy(val, sine[gen].table + sine[gen].table_pos, n * sizeof(*val));
+      val += n;
+      count -= n;
+      sine[gen].table_pos += n;
+      if (sine[gen].table_pos >= sine[gen].table_size)
+        sine[gen].table_pos = 0;
+    }
+    break;
   }
 }
 
 static int write_loop(snd_pcm_t *handle, int channel, int periods, uint8_t *frames)
 {
-  int    err, n;
+  int    err, n, count;
 
   fflush(stdout);
   if (test_type == TEST_WAV) {
-    int bufsize = snd_pcm_frames_to_bytes(handle, period_size);
-    n = 0;
-    while ((err = read_wav((uint16_t *)frames, channel, n, bufsize)) > 0 && !in_aborting) {
-      n += err;
-      if ((err = write_buffer(handle, frames,
-			      snd_pcm_bytes_to_frames(handle, err * channels))) < 0)
+    if (! wav_data[channel]) {
+      fprintf(stderr, _("Undefined channel %d\n"), channel);
+      return -EINVAL;
+    }
+    err = 0;
+    for (n = 0; n < wav_samples[channel] && !in_aborting; n += count) {
+      count = wav_samples[channel] - n;
+      if (count > (int)period_size)
+	count = period_size;
+      clear_frames(frames, count);
+      store_channel(frames, channel, count, wav_data[channel] + n);
+      if ((err = write_buffer(handle, frames, count)) < 0)
 	break;
     }
-    if (buffer_size > n && !in_aborting) {
+    if (buffer_size > (snd_pcm_uframes_t)n && !in_aborting) {
       snd_pcm_drain(handle);
       snd_pcm_prepare(handle);
     }
@@ -893,12 +1067,9 @@ static int write_loop(snd_pcm_t *handle, int channel, int periods, uint8_t *fram
     periods = 1;
 
   for(n = 0; n < periods && !in_aborting; n++) {
-    if (test_type == TEST_PINK_NOISE)
-      do_generate(frames, channel, period_size, generate_pink_noise, &pink);
-    else if (test_type == TEST_PATTERN)
-      do_generate(frames, channel, period_size, generate_pattern, &pattern);
-    else
-      do_generate(frames, channel, period_size, generate_sine, &sine);
+    generate_period(values, period_size, 0);
+    clear_frames(frames, period_size);
+    store_channel(frames, channel, period_size, values);
 
     if ((err = write_buffer(handle, frames, period_size)) < 0)
       return err;
@@ -910,8 +1081,196 @@ static int write_loop(snd_pcm_t *handle, int channel, int periods, uint8_t *fram
   return 0;
 }
 
+/* play all channels at once, each from its own generator or WAV file */
+static int write_all_loop(snd_pcm_t *handle, int periods, uint8_t *frames)
+{
+  int    err = 0, n, chn, count, length = 0;
+
+  fflush(stdout);
+  if (test_type == TEST_WAV) {
+    for (chn = 0; chn < channels; chn++) {
+      if (wav_samples[chn] > length)
+        length = wav_samples[chn];
+    }
+  } else {
+    if (periods <= 0)
+      periods = 1;
+    length = periods * period_size;
+  }
+
+  for (n = 0; n < length && !in_aborting; n += count) {
+    count = length - n;
+    if (count > (int)period_size)
+      count = period_size;
+    clear_frames(frames, count);
+    for (chn = 0; chn < channels; chn++) {
+      if (test_type != TEST_WAV) {
+        generate_period(values, count, chn);
+        store_channel(frames, chn, count, values);
+      } else if (n < wav_samples[chn]) {
+        store_channel(frames, chn,
+                      wav_samples[chn] - n < count ? wav_samples[chn] - n : count,
+                      wav_data[chn] + n);
+      }
+    }
+    if ((err = write_buffer(handle, frames, count)) < 0)
+      return err;
+  }
+  if (buffer_size > (snd_pcm_uframes_t)n && !in_aborting) {
+    snd_pcm_drain(handle);
+    snd_pcm_prepare(handle);
+  }
+  return 0;
+}
+
+static double timestamp_sec(const snd_htimestamp_t *ts)
+{
+  return ts->tv_sec + ts->tv_nsec / 1000000000.0;
+}
+
+/*
+ * The position of the chirp in the capture between from and from + len,
+ * with the sub-sample peak of the correlation; the confidence is the
+ * ratio of the peak to the RMS of the correlation.
+ */
+static double find_arrival(long from, long len, double *confidence)
+{
+  double sum, r, best = 0, prev = 0, next = 0, energy = 0, pos;
+  long lag, end, best_lag = -1;
+  int k;
+
+  if (from < 0)
+    from = 0;
+  end = from + len;
+  if (end > (long)capture_frames - align_ref_len)
+    end = (long)capture_frames - align_ref_len;
+  for (lag = from; lag < end; lag++) {
+    sum = 0;
+    for (k = 0; k < align_ref_len; k++)
+      sum += capture_data[lag + k] * align_ref[k];
+    r = fabs(sum);
+    energy += r * r;
+    if (r > best) {
+      best = r;
+      best_lag = lag;
+    }
+  }
+  if (best_lag < 0 || energy == 0) {
+    *confidence = 0;
+    return -1;
+  }
+  *confidence = best / sqrt(energy / (end - from));
+
+  /* parabolic interpolation around the peak */
+  pos = best_lag;
+  if (best_lag > from && best_lag + 1 < end) {
+    for (k = 0; k < align_ref_len; k++) {
+      prev += capture_data[best_lag - 1 + k] * align_ref[k];
+      next += capture_data[best_lag + 1 + k] * align_ref[k];
+    }
+    prev = fabs(prev);
+    next = fabs(next);
+    if (prev - 2 * best + next != 0)
+      pos += 0.5 * (prev - next) / (prev - 2 * best + next);
+  }
+  return pos;
+}
+
+static int align_test(snd_pcm_t *handle, uint8_t *frames)
+{
+  snd_pcm_status_t *status;
+  snd_htimestamp_t play_trigger, capture_trigger;
+  double latency[MAX_CHANNELS], confidence[MAX_CHANNELS], arrival, max_latency = 0;
+  long offset, slot;
+  int err, chn, periods, found = 0;
+
+  snd_pcm_status_alloca(&status);
+
+  if ((err = snd_pcm_open(&capture_handle, capture_device, SND_PCM_STREAM_CAPTURE,
+                          SND_PCM_NONBLOCK)) < 0) {
+    fprintf(stderr, _("Capture open error: %d,%s\n"), err, snd_strerror(err));
+    return err;
+  }
+  if ((err = snd_pcm_set_params(capture_handle, SND_PCM_FORMAT_FLOAT,
+                                SND_PCM_ACCESS_RW_INTERLEAVED, 1, rate, 1,
+                                500000)) < 0) {
+    fprintf(stderr, _("Setting of capture params failed: %s\n"), snd_strerror(err));
+    return err;
+  }
+
+  /* a slot holds the buffer, so write_loop() never drains in between */
+  periods = ((buffer_size > rate ? buffer_size : rate) + period_size - 1) / period_size;
+  slot = periods * period_size;
+  capture_size = (channels + 1) * slot + rate / 2;
+  capture_data = malloc(capture_size * sizeof(*capture_data));
+  if (capture_data == NULL) {
+    fprintf(stderr, _("No enough memory\n"));
+    return -ENOMEM;
+  }
+
+  printf(_("Capture device is %s\n"), capture_device);
+  if ((err = snd_pcm_start(capture_handle)) < 0) {
+    fprintf(stderr, _("Capture start error: %s\n"), snd_strerror(err));
+    return err;
+  }
+  for (chn = 0; chn < channels && !in_aborting; chn++) {
+    printf(" %d - %s\n", chn, get_channel_name(chn));
+    align_pos = 0;
+    if ((err = write_loop(handle, chn, periods, frames)) < 0)
+      return err;
+  }
+  /* a silent slot, while the last chirp arrives */
+  align_pos = align_ref_len;
+  if ((err = write_loop(handle, 0, periods, frames)) < 0)
+    return err;
+  while (capture_frames < capture_size && !capture_failed && !in_aborting) {
+    snd_pcm_wait(capture_handle, 1000);
+    capture_poll();
+  }
+  if (capture_failed || in_aborting)
+    return -EIO;
+
+  /* the capture is started before the playback */
+  offset = 0;
+  if (snd_pcm_status(handle, status) >= 0) {
+    snd_pcm_status_get_trigger_htstamp(status, &play_trigger);
+    if (snd_pcm_status(capture_handle, status) >= 0) {
+      snd_pcm_status_get_trigger_htstamp(status, &capture_trigger);
+      offset = lround((timestamp_sec(&play_trigger) -
+                       timestamp_sec(&capture_trigger)) * rate);
+      if (offset < 0 || offset > (long)rate)
+        offset = 0;
+    }
+  }
+
+  for (chn = 0; chn < channels; chn++) {
+    arrival = find_arrival(offset + chn * slot, slot - align_ref_len, &confidence[chn]);
+    latency[chn] = (arrival - offset - chn * slot) * 1000.0 / rate;
+    if (arrival < 0 || confidence[chn] < ALIGN_MIN_CONFIDENCE)
+      continue;
+    if (!found || latency[chn] > max_latency)
+      max_latency = latency[chn];
+    found = 1;
+  }
+
+  printf(_("Channel delays, add the delay to align the channel with the latest one:\n"));
+  for (chn = 0; chn < channels; chn++) {
+    if (confidence[chn] < ALIGN_MIN_CONFIDENCE) {
+      printf(_(" %2d - %-16s no clear arrival (confidence %.1f)\n"),
+             chn, get_channel_name(chn), confidence[chn]);
+      continue;
+    }
+    printf(_(" %2d - %-16s latency %8.3f ms, delay %8.3f ms (%ld samples), confidence %.1f\n"),
+           chn, get_channel_name(chn), latency[chn], max_latency - latency[chn],
+           lround((max_latency - latency[chn]) * rate / 1000.0), confidence[chn]);
+  }
+  return found ? 0 : -EIO;
+}
+
 static int prg_exit(int code)
 {
+  if (capture_handle)
+    snd_pcm_close(capture_handle);
   if (pcm_handle)
     snd_pcm_close(pcm_handle);
   exit(code);
@@ -949,9 +1308,12 @@ static void help(void)
 	   "-b,--buffer	ring buffer size in us\n"
 	   "-p,--period	period size in us\n"
 	   "-P,--nperiods	number of periods\n"
-	   "-t,--test	pink=use pink noise, sine=use sine wave, wav=WAV file\n"
+	   "-t,--test	pink=use pink noise, sine=use sine wave, wav=WAV file,\n"
+	   "		align=measure the delay of each channel with a mic\n"
+	   "-C,--capture	capture device of the mic for -t align\n"
 	   "-l,--nloops	specify number of loops to test, 0 = infinite\n"
 	   "-s,--speaker	single speaker test. Values 1=Left, 2=right, etc\n"
+	   "-a,--all	test all speakers at once, each with its own tone\n"
 	   "-w,--wavfile	Use the given WAV file as a test sound\n"
 	   "-W,--wavdir	Specify the directory containing WAV files\n"
 	   "-m,--chmap	Specify the channel map to override\n"
@@ -997,11 +1359,13 @@ int main(int argc, char *argv[]) {
     {"test",      1, NULL, 't'},
     {"nloops",    1, NULL, 'l'},
     {"speaker",   1, NULL, 's'},
+    {"all",       0, NULL, 'a'},
     {"wavfile",   1, NULL, 'w'},
     {"wavdir",    1, NULL, 'W'},
     {"debug",	  0, NULL, 'd'},
     {"force-frequency",	  0, NULL, 'X'},
     {"scale",	  1, NULL, 'S'},
+    {"capture",	  1, NULL, 'C'},
 #ifdef CONFIG_SUPPORT_CHMAP
     {"chmap",	  1, NULL, 'm'},
 #endif
@@ -1023,7 +1387,7 @@ int main(int argc, char *argv[]) {
   while (1) {
     int c;
     
-    if ((c = getopt_long(argc, argv, "hD:r:c:f:F:b:p:P:t:l:s:w:W:d:XS:"
+    if ((c = getopt_long(argc, argv, "hD:r:c:f:F:b:p:P:t:l:s:aw:W:d:XS:C:"
 #ifdef CONFIG_SUPPORT_CHMAP
 			 "m:"
 #endif
@@ -1084,9 +1448,11 @@ int main(int argc, char *argv[]) {
 	test_type = TEST_WAV;
       else if (*optarg == 't')
 	test_type = TEST_PATTERN;
+      else if (*optarg == 'a')
+	test_type = TEST_ALIGN;
       else if (isdigit(*optarg)) {
 	test_type = atoi(optarg);
-	if (test_type < TEST_PINK_NOISE || test_type > TEST_PATTERN) {
+	if (test_type < TEST_PINK_NOISE || test_type > TEST_ALIGN) {
 	  fprintf(stderr, _("Invalid test type %s\n"), optarg);
 	  exit(1);
 	}
@@ -1103,6 +1469,9 @@ int main(int argc, char *argv[]) {
       speaker = speaker < 1 ? 0 : speaker;
       speakeroptset = 1;
       break;
+    case 'a':
+      all_channels = 1;
+      break;
     case 'w':
       given_test_wav_file = optarg;
       break;
@@ -1123,6 +1492,9 @@ int main(int argc, char *argv[]) {
     case 'S':
       generator_scale = atoi(optarg) / 100.0;
       break;
+    case 'C':
+      capture_device = optarg;
+      break;
     default:
       fprintf(stderr, _("Unknown option '%c'\n"), c);
       exit(EXIT_FAILURE);
@@ -1143,6 +1515,28 @@ int main(int argc, char *argv[]) {
     }
   }
 
+  if (all_channels) {
+    if (speakeroptset) {
+      fprintf(stderr, _("The -a and -s options cannot be combined.\n"));
+      exit(EXIT_FAILURE);
+    }
+    if (channels > MAX_CHANNELS) {
+      fprintf(stderr, _("At most %d channels can be tested at once.\n"), MAX_CHANNELS);
+      exit(EXIT_FAILURE);
+    }
+  }
+
+  if (test_type == TEST_ALIGN) {
+    if (all_channels || speakeroptset) {
+      fprintf(stderr, _("The alignment test cannot be combined with -a or -s.\n"));
+      exit(EXIT_FAILURE);
+    }
+    if (channels > MAX_CHANNELS) {
+      fprintf(stderr, _("At most %d channels can be tested at once.\n"), MAX_CHANNELS);
+      exit(EXIT_FAILURE);
+    }
+  }
+
   if (!force_frequency) {
     freq = freq < 30.0 ? 30.0 : freq;
     freq = freq > 8000.0 ? 8000.0 : freq;
@@ -1150,8 +1544,12 @@ int main(int argc, char *argv[]) {
     freq = freq < 1.0 ? 1.0 : freq;
   }
 
-  if (test_type == TEST_WAV)
-    format = SND_PCM_FORMAT_S16_LE; /* fixed format */
+  if (all_channels && test_type == TEST_SINE &&
+      channel_freq(channels - 1) >= rate / 2.0) {
+    fprintf(stderr, _("The tone of channel %d (%.4fHz) is above the Nyquist frequency.\n"),
+	    channels - 1, channel_freq(channels - 1));
+    exit(EXIT_FAILURE);
+  }
 
   printf(_("Playback device is %s\n"), device);
   printf(_("Stream parameters are %iHz, %s, %i channels\n"), rate, snd_pcm_format_name(format), channels);
@@ -1165,6 +1563,9 @@ int main(int argc, char *argv[]) {
   case TEST_WAV:
     printf(_("WAV file(s)\n"));
     break;
+  case TEST_ALIGN:
+    printf(_("Using a %d ms chirp per channel for the alignment\n"), ALIGN_CHIRP_MS);
+    break;
 
   }
 
@@ -1210,7 +1611,36 @@ int main(int argc, char *argv[]) {
 
   init_loop();
 
-  if (speaker==0) {
+  if (test_type == TEST_ALIGN) {
+    err = align_test(handle, frames);
+    if (err < 0) {
+      fprintf(stderr, _("Alignment test failed: %s\n"), snd_strerror(err));
+      prg_exit(EXIT_FAILURE);
+    }
+  } else if (all_channels) {
+
+    if (test_type == TEST_WAV) {
+      for (chn = 0; chn < channels; chn++) {
+	if (setup_wav_file(chn) < 0)
+	  prg_exit(EXIT_FAILURE);
+      }
+    }
+
+    for (chn = 0; chn < channels; chn++) {
+      if (test_type == TEST_SINE)
+        printf(" %d - %s: %.4fHz\n", chn, get_channel_name(chn), channel_freq(chn));
+      else
+        printf(" %d - %s\n", chn, get_channel_name(chn));
+    }
+
+    for (n = 0; (! nloops || n < nloops) && !in_aborting; n++) {
+      err = write_all_loop(handle, ((rate*5)/period_size), frames);
+      if (err < 0) {
+        fprintf(stderr, _("Transfer failed: %s\n"), snd_strerror(err));
+        prg_exit(EXIT_SUCCESS);
+      }
+    }
+  } else if (speaker==0) {
 
     if (test_type == TEST_WAV) {
       for (chn = 0; chn < channels; chn++) {
@@ -1258,6 +1688,13 @@ int main(int argc, char *argv[]) {
   snd_pcm_drain(handle);
 
   free(frames);
+  free(values);
+  free(align_ref);
+  free(capture_data);
+  for (chn = 0; chn < MAX_CHANNELS; chn++) {
+    free(sine[chn].table);
+    free(wav_data[chn]);
+  }
 #ifdef CONFIG_SUPPORT_CHMAP
   free(ordered_channels);
 #endif
@@ -0,0 +1,580 @@
+/*
+  Copyright(c) 2026 agent <agent@local>
+  All rights reserved.
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of version 2 of the GNU General Public License as
+  published by the Free Software Foundation.
+
+  This program is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 51 Franklin St - Fifth Floor, Boston, MA 02110-1301 USA.
+  The full GNU General Public License is included in this distribution
+  in the file called LICENSE.GPL.
+*/
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <errno.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <alsa/input.h>
+#include <alsa/output.h>
+#include <alsa/conf.h>
+#include <alsa/error.h>
+#include "topology.h"
+
+/*
+ * Cache of the parsed include files of a Topology2.0 source. The include
+ * directives at the top level of the source, which bring in the class
+ * definitions, are parsed apart from the rest of the source and the
+ * resulting tree is saved in a binary cache file. The cache is keyed by a
+ * hash of the directives and of the content of every file they include, so
+ * it stays valid while only the source itself changes. A valid cache is
+ * mapped and the tree is rebuilt from it without running the parser
+ * on the include files, then the rest of the source is loaded over it.
+ *
+ * The file has a header, the nodes in pre-order, each compound followed by
+ * its children, and the strings of the ids and values.
+ */
+#define CACHE_MAGIC		"TPLC"
+#define CACHE_VERSION		1
+#define CACHE_NO_STRING		UINT32_MAX
+
+struct cache_header {
+	char magic[4];
+	uint32_t version;
+	uint64_t key;
+	uint32_t node_count;
+	uint32_t strings_size;
+	uint64_t reserved;
+};
+
+struct cache_node {
+	uint32_t id;		/* offset in the strings */
+	uint32_t type;		/* snd_config_type_t */
+	uint32_t count;		/* children of a compound */
+	uint32_t string;	/* offset of a string value */
+	int64_t value;		/* integer, or the bits of a real */
+};
+
+struct cache_builder {
+	struct cache_node *nodes;
+	uint32_t node_count;
+	uint32_t node_alloc;
+	char *strings;
+	uint32_t strings_size;
+	uint32_t strings_alloc;
+};
+
+struct cache_reader {
+	const struct cache_node *nodes;
+	uint32_t node_count;
+	uint32_t next;
+	const char *strings;
+	uint32_t strings_size;
+};
+
+/* append a string to the buffer, the length is limited by the caller */
+static int buf_append(char **buf, size_t *size, size_t *alloc, const char *s, size_t len)
+{
+	char *p;
+
+	if (*size + len + 1 > *alloc) {
+		*alloc = (*size + len + 1) * 2;
+		p = realloc(*buf, *alloc);
+		if (!p)
+			return -ENOMEM;
+		*buf = p;
+	}
+	memcpy(*buf + *size, s, len);
+	*size += len;
+	(*buf)[*size] = '\0';
+	return 0;
+}
+
+/*
+ * Split the source into its top-level include directives and the rest. The
+ * search directories are kept in the rest, too, for the nested includes.
+ * The directives are blanked in the rest so that the line numbers of the
+ * parser messages do not change.
+ */
+static int split_source(const char *config, size_t size, char **includes,
+			size_t *includes_size, char **body)
+{
+	size_t i, j, alloc = 0;
+	int depth = 0;
+	char quote;
+	int err;
+
+	*includes = NULL;
+	*includes_size = 0;
+	*body = malloc(size + 1);
+	if (!*body)
+		return -ENOMEM;
+	memcpy(*body, config, size);
+	(*body)[size] = '\0';
+
+	for (i = 0; i < size; i++) {
+		switch (config[i]) {
+		case '#':
+			while (i + 1 < size && config[i + 1] != '\n')
+				i++;
+			break;
+		case '\'':
+		case '"':
+			quote = config[i];
+			while (i + 1 < size && config[i + 1] != quote) {
+				if (config[i + 1] == '\\' && i + 2 < size)
+					i++;
+				i++;
+			}
+			i++;
+			break;
+		case '{':
+		case '[':
+			depth++;
+			break;
+		case '}':
+		case ']':
+			depth--;
+			break;
+		case '<':
+			if (depth > 0)
+				break;
+			for (j = i + 1; j < size && config[j] != '>'; j++)
+				;
+			if (j == size)
+				break;
+			err = buf_append(includes, includes_size, &alloc, config + i, j + 1 - i);
+			if (err >= 0)
+				err = buf_append(includes, includes_size, &alloc, "\n", 1);
+			if (err < 0)
+				return err;
+			if (strncmp(config + i + 1, "searchdir:", 10))
+				memset(*body + i, ' ', j + 1 - i);
+			i = j;
+			break;
+		default:
+			break;
+		}
+	}
+
+	return 0;
+}
+
+#define FNV_OFFSET		0xcbf29ce484222325ULL
+#define FNV_PRIME		0x100000001b3ULL
+
+static uint64_t hash_bytes(uint64_t hash, const void *data, size_t size)
+{
+	const unsigned char *p = data;
+	size_t i;
+
+	for (i = 0; i < size; i++) {
+		hash ^= p[i];
+		hash *= FNV_PRIME;
+	}
+	return hash;
+}
+
+static uint64_t hash_file(uint64_t hash, const char *file)
+{
+	struct stat st;
+	void *p;
+	int fd;
+
+	hash = hash_bytes(hash, file, strlen(file) + 1);
+
+	/* a missing file is reported by the parser */
+	fd = open(file, O_RDONLY);
+	if (fd < 0)
+		return hash;
+	if (fstat(fd, &st) == 0 && st.st_size > 0) {
+		p = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+		if (p != MAP_FAILED) {
+			hash = hash_bytes(hash, p, st.st_size);
+			munmap(p, st.st_size);
+		}
+	}
+	close(fd);
+	return hash;
+}
+
+static int cache_key(const char *includes, size_t includes_size, uint64_t *key)
+{
+	struct tplg_deps deps;
+	uint64_t hash;
+	char *buf;
+	int i, err;
+
+	/* the scan cuts the directives */
+	buf = strdup(includes);
+	if (!buf)
+		return -ENOMEM;
+	err = tplg_deps_scan_buffer(&deps, buf);
+	free(buf);
+	if (err < 0)
+		return err;
+
+	hash = hash_bytes(FNV_OFFSET, includes, includes_size);
+	for (i = 0; i < deps.count; i++)
+		hash = hash_file(hash, deps.files[i]);
+	tplg_deps_free(&deps);
+
+	*key = hash;
+	return 0;
+}
+
+static int builder_add_string(struct cache_builder *b, const char *s, uint32_t *offset)
+{
+	size_t size = b->strings_size, alloc = b->strings_alloc;
+	size_t len;
+	int err;
+
+	if (!s) {
+		*offset = CACHE_NO_STRING;
+		return 0;
+	}
+	len = strlen(s);
+	if (b->strings_size + len + 1 >= CACHE_NO_STRING)
+		return -E2BIG;
+	err = buf_append(&b->strings, &size, &alloc, s, len);
+	if (err < 0)
+		return err;
+	*offset = b->strings_size;
+	/* keep the terminator of each string */
+	b->strings_size = size + 1;
+	b->strings_alloc = alloc;
+	return 0;
+}
+
+static int builder_add_node(struct cache_builder *b, snd_config_t *cfg)
+{
+	snd_config_iterator_t i, next;
+	struct cache_node *node;
+	const char *id, *s;
+	long lval;
+	long long llval;
+	double dval;
+	uint32_t index, count = 0;
+	int err;
+
+	if (b->node_count == b->node_alloc) {
+		b->node_alloc = b->node_alloc ? b->node_alloc * 2 : 1024;
+		node = realloc(b->nodes, b->node_alloc * sizeof(*node));
+		if (!node)
+			return -ENOMEM;
+		b->nodes = node;
+	}
+	index = b->node_count++;
+	node = &b->nodes[index];
+	memset(node, 0, sizeof(*node));
+	node->string = CACHE_NO_STRING;
+	node->type = snd_config_get_type(cfg);
+
+	if (snd_config_get_id(cfg, &id) < 0)
+		id = NULL;
+	err = builder_add_string(b, id, &b->nodes[index].id);
+	if (err < 0)
+		return err;
+
+	switch (snd_config_get_type(cfg)) {
+	case SND_CONFIG_TYPE_INTEGER:
+		snd_config_get_integer(cfg, &lval);
+		b->nodes[index].value = lval;
+		break;
+	case SND_CONFIG_TYPE_INTEGER64:
+		snd_config_get_integer64(cfg, &llval);
+		b->nodes[index].value = llval;
+		break;
+	case SND_CONFIG_TYPE_REAL:
+		snd_config_get_real(cfg, &dval);
+		memcpy(&b->nodes[index].value, &dval, sizeof(dval));
+		break;
+	case SND_CONFIG_TYPE_STRING:
+		if (snd_config_get_string(cfg, &s) < 0 || !s)
+			s = "";
+		err = builder_add_string(b, s, &b->nodes[index].string);
+		if (err < 0)
+			return err;
+		break;
+	case SND_CONFIG_TYPE_COMPOUND:
+		/* the node array may move while the children are added */
+		snd_config_for_each(i, next, cfg) {
+			err = builder_add_node(b, snd_config_iterator_entry(i));
+			if (err < 0)
+				return err;
+			count++;
+		}
+		b->nodes[index].count = count;
+		break;
+	default:
+		/* pointers are not meant to be in a configuration file */
+		return -EINVAL;
+	}
+
+	return 0;
+}
+
+static int cache_write(const char *cache_file, uint64_t key, snd_config_t *top)
+{
+	struct cache_builder b;
+	struct cache_header header;
+	snd_config_iterator_t i, next;
+	char *tmp;
+	FILE *fp;
+	int err = 0;
+
+	memset(&b, 0, sizeof(b));
+	snd_config_for_each(i, next, top) {
+		err = builder_add_node(&b, snd_config_iterator_entry(i));
+		if (err < 0)
+			goto out;
+	}
+
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, CACHE_MAGIC, sizeof(header.magic));
+	header.version = CACHE_VERSION;
+	header.key = key;
+	header.node_count = b.node_count;
+	header.strings_size = b.strings_size;
+
+	/* replaced at once, a concurrent run maps the old or the new one */
+	tmp = malloc(strlen(cache_file) + 5);
+	if (!tmp) {
+		err = -ENOMEM;
+		goto out;
+	}
+	sprintf(tmp, "%s.tmp", cache_file);
+	fp = fopen(tmp, "wb");
+	if (!fp) {
+		err = -errno;
+		free(tmp);
+		goto out;
+	}
+	if (fwrite(&header, sizeof(header), 1, fp) != 1 ||
+	    fwrite(b.nodes, sizeof(*b.nodes), b.node_count, fp) != b.node_count ||
+	    fwrite(b.strings, 1, b.strings_size, fp) != b.strings_size)
+		err = -EIO;
+	if (fclose(fp) && !err)
+		err = -errno;
+	if (!err && rename(tmp, cache_file) < 0)
+		err = -errno;
+	if (err)
+		unlink(tmp);
+	free(tmp);
+
+out:
+	free(b.nodes);
+	free(b.strings);
+	return err;
+}
+
+static int reader_string(struct cache_reader *r, uint32_t offset, const char **s)
+{
+	if (offset == CACHE_NO_STRING) {
+		*s = NULL;
+		return 0;
+	}
+	if (offset >= r->strings_size)
+		return -EINVAL;
+	*s = r->strings + offset;
+	return 0;
+}
+
+static int reader_add_node(struct cache_reader *r, snd_config_t *parent)
+{
+	const struct cache_node *node;
+	snd_config_t *n;
+	const char *id, *s;
+	double dval;
+	uint32_t k;
+	int err;
+
+	if (r->next >= r->node_count)
+		return -EINVAL;
+	node = &r->nodes[r->next++];
+	err = reader_string(r, node->id, &id);
+	if (err < 0)
+		return err;
+
+	switch (node->type) {
+	case SND_CONFIG_TYPE_INTEGER:
+		err = snd_config_imake_integer(&n, id, node->value);
+		break;
+	case SND_CONFIG_TYPE_INTEGER64:
+		err = snd_config_imake_integer64(&n, id, node->value);
+		break;
+	case SND_CONFIG_TYPE_REAL:
+		memcpy(&dval, &node->value, sizeof(dval));
+		err = snd_config_imake_real(&n, id, dval);
+		break;
+	case SND_CONFIG_TYPE_STRING:
+		err = reader_string(r, node->string, &s);
+		if (err < 0)
+			return err;
+		err = snd_config_imake_string(&n, id, s);
+		break;
+	case SND_CONFIG_TYPE_COMPOUND:
+		err = snd_config_make_compound(&n, id, 0);
+		break;
+	default:
+		return -EINVAL;
+	}
+	if (err < 0)
+		return err;
+
+	err = snd_config_add(parent, n);
+	if (err < 0) {
+		snd_config_delete(n);
+		return err;
+	}
+
+	if (node->type != SND_CONFIG_TYPE_COMPOUND)
+		return 0;
+	for (k = 0; k < node->count; k++) {
+		err = reader_add_node(r, n);
+		if (err < 0)
+			return err;
+	}
+
+	return 0;
+}
+
+/* returns 1 when there is no valid cache for the key */
+static int cache_read(const char *cache_file, uint64_t key, snd_config_t **top)
+{
+	const struct cache_header *header;
+	struct cache_reader r;
+	struct stat st;
+	void *p;
+	size_t size;
+	int fd, err = 1;
+
+	fd = open(cache_file, O_RDONLY);
+	if (fd < 0)
+		return 1;
+	if (fstat(fd, &st) < 0 || (size_t)st.st_size < sizeof(*header)) {
+		close(fd);
+		return 1;
+	}
+	size = st.st_size;
+	p = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (p == MAP_FAILED)
+		return 1;
+
+	header = p;
+	if (memcmp(header->magic, CACHE_MAGIC, sizeof(header->magic)) ||
+	    header->version != CACHE_VERSION || header->key != key)
+		goto out;
+	if (size != sizeof(*header) +
+		    (size_t)header->node_count * sizeof(struct cache_node) +
+		    header->strings_size)
+		goto out;
+	if (header->strings_size == 0 && header->node_count > 0)
+		goto out;
+
+	r.nodes = (const struct cache_node *)(header + 1);
+	r.node_count = header->node_count;
+	r.next = 0;
+	r.strings = (const char *)(r.nodes + r.node_count);
+	r.strings_size = header->strings_size;
+	if (r.strings_size > 0 && r.strings[r.strings_size - 1] != '\0')
+		goto out;
+
+	err = snd_config_top(top);
+	if (err < 0)
+		goto out;
+	while (r.next < r.node_count) {
+		err = reader_add_node(&r, *top);
+		if (err < 0)
+			break;
+	}
+	if (err < 0) {
+		fprintf(stderr, "Invalid class cache '%s', ignored\n", cache_file);
+		snd_config_delete(*top);
+		*top = NULL;
+		err = 1;
+	}
+
+out:
+	munmap(p, size);
+	return err;
+}
+
+static int load_buffer(snd_config_t *top, const char *buf, size_t size)
+{
+	snd_input_t *in;
+	int err;
+
+	err = snd_input_buffer_open(&in, buf, size);
+	if (err < 0) {
+		fprintf(stderr, "Unable to open input buffer\n");
+		return err;
+	}
+	err = snd_config_load(top, in);
+	snd_input_close(in);
+	if (err < 0)
+		fprintf(stderr, "Unable not load configuration\n");
+	return err;
+}
+
+/*
+ * Parse the source into a new top-level node, with the include files taken
+ * from the cache when it is valid. The cache is written otherwise.
+ */
+int tplg_class_cache_load(const char *cache_file, char *config, size_t config_size,
+			  snd_config_t **top)
+{
+	char *includes, *body;
+	size_t includes_size;
+	uint64_t key;
+	int err;
+
+	*top = NULL;
+	err = split_source(config, config_size, &includes, &includes_size, &body);
+	if (err < 0)
+		goto out;
+
+	err = includes_size ? cache_key(includes, includes_size, &key) : 1;
+	if (err < 0)
+		goto out;
+	if (err == 0)
+		err = cache_read(cache_file, key, top);
+
+	if (err > 0) {
+		err = snd_config_top(top);
+		if (err < 0)
+			goto out;
+		if (includes_size) {
+			err = load_buffer(*top, includes, includes_size);
+			if (err < 0)
+				goto out;
+			if (cache_write(cache_file, key, *top) < 0)
+				fprintf(stderr, "Unable to write class cache '%s'\n",
+					cache_file);
+		}
+	}
+
+	err = load_buffer(*top, body, config_size);
+
+out:
+	if (err < 0 && *top) {
+		snd_config_delete(*top);
+		*top = NULL;
+	}
+	free(includes);
+	free(body);
+	return err;
+}
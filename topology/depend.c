@@ -0,0 +1,346 @@
+/*
+  Copyright(c) 2026 agent <agent@local>
+  All rights reserved.
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of version 2 of the GNU General Public License as
+  published by the Free Software Foundation.
+
+  This program is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 51 Franklin St - Fifth Floor, Boston, MA 02110-1301 USA.
+  The full GNU General Public License is included in this distribution
+  in the file called LICENSE.GPL.
+*/
+#include <stdbool.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <errno.h>
+#include <string.h>
+#include <ctype.h>
+#include <sys/stat.h>
+#include <alsa/input.h>
+#include <alsa/output.h>
+#include <alsa/conf.h>
+#include <alsa/error.h>
+#include "topology.h"
+
+/*
+ * Dependency tracking for the incremental compilation. The included files
+ * are found by scanning the sources for the <file>, <searchdir:dir> and
+ * <confdir:file> directives the same way the alsa-lib parser resolves
+ * them: first in the search directories seen so far, then relative to the
+ * current directory.
+ */
+
+static int deps_add(struct tplg_deps *deps, const char *file)
+{
+	char **files;
+	int i;
+
+	for (i = 0; i < deps->count; i++)
+		if (!strcmp(deps->files[i], file))
+			return 0;
+
+	files = realloc(deps->files, (deps->count + 1) * sizeof(*files));
+	if (!files)
+		return -ENOMEM;
+	deps->files = files;
+	files[deps->count] = strdup(file);
+	if (!files[deps->count])
+		return -ENOMEM;
+	deps->count++;
+	return 1;
+}
+
+static int deps_add_searchdir(struct tplg_deps *deps, const char *dir)
+{
+	char **dirs;
+
+	dirs = realloc(deps->searchdirs, (deps->searchdirs_count + 1) * sizeof(*dirs));
+	if (!dirs)
+		return -ENOMEM;
+	deps->searchdirs = dirs;
+	dirs[deps->searchdirs_count] = strdup(dir);
+	if (!dirs[deps->searchdirs_count])
+		return -ENOMEM;
+	deps->searchdirs_count++;
+	return 0;
+}
+
+static bool file_exists(const char *file)
+{
+	struct stat st;
+
+	return stat(file, &st) == 0 && S_ISREG(st.st_mode);
+}
+
+static char *path_join(const char *dir, const char *name)
+{
+	size_t len = strlen(dir) + strlen(name) + 2;
+	char *path = malloc(len);
+
+	if (path)
+		snprintf(path, len, "%s/%s", dir, name);
+	return path;
+}
+
+/* resolve an include like the parser does, returns an allocated path */
+static char *deps_resolve(struct tplg_deps *deps, const char *name)
+{
+	char *path;
+	int i;
+
+	if (!strncmp(name, "confdir:", 8)) {
+		return path_join(snd_config_topdir(), name + 8);
+	}
+
+	if (name[0] != '/') {
+		for (i = 0; i < deps->searchdirs_count; i++) {
+			path = path_join(deps->searchdirs[i], name);
+			if (!path)
+				return NULL;
+			if (file_exists(path))
+				return path;
+			free(path);
+		}
+	}
+
+	return strdup(name);
+}
+
+static int deps_scan_file(struct tplg_deps *deps, const char *file);
+
+static int deps_scan_include(struct tplg_deps *deps, const char *name)
+{
+	char *path;
+	int err;
+
+	if (!strncmp(name, "searchdir:", 10))
+		return deps_add_searchdir(deps, name + 10);
+
+	path = deps_resolve(deps, name);
+	if (!path)
+		return -ENOMEM;
+
+	/* a missing file is reported by the parser later */
+	err = 0;
+	if (file_exists(path))
+		err = deps_scan_file(deps, path);
+	free(path);
+	return err;
+}
+
+/* the directives are cut out of buf in place */
+static int deps_scan_buf(struct tplg_deps *deps, char *buf)
+{
+	char *p, *end, quote;
+	int err = 0;
+
+	for (p = buf; *p && err >= 0; p++) {
+		switch (*p) {
+		case '#':
+			/* comment to the end of line */
+			while (p[1] && p[1] != '\n')
+				p++;
+			break;
+		case '\'':
+		case '"':
+			quote = *p;
+			while (p[1] && p[1] != quote) {
+				if (p[1] == '\\' && p[2])
+					p++;
+				p++;
+			}
+			if (p[1])
+				p++;
+			break;
+		case '<':
+			end = strchr(p + 1, '>');
+			if (!end)
+				break;
+			*end = '\0';
+			err = deps_scan_include(deps, p + 1);
+			p = end;
+			break;
+		default:
+			break;
+		}
+	}
+
+	return err;
+}
+
+static int deps_scan_file(struct tplg_deps *deps, const char *file)
+{
+	char *buf = NULL;
+	size_t size = 0;
+	FILE *fp;
+	int err;
+
+	err = deps_add(deps, file);
+	if (err <= 0)
+		return err;
+
+	fp = fopen(file, "r");
+	if (!fp)
+		return -errno;
+	err = getdelim(&buf, &size, '\0', fp) < 0 && ferror(fp) ? -EIO : 0;
+	fclose(fp);
+	if (err < 0 || !buf) {
+		free(buf);
+		return err;
+	}
+
+	err = deps_scan_buf(deps, buf);
+	free(buf);
+	return err;
+}
+
+int tplg_deps_scan(struct tplg_deps *deps, const char *source_file)
+{
+	int err;
+
+	memset(deps, 0, sizeof(*deps));
+	err = deps_scan_file(deps, source_file);
+	if (err < 0)
+		tplg_deps_free(deps);
+	return err;
+}
+
+/* the files included by a configuration in memory, buf is modified */
+int tplg_deps_scan_buffer(struct tplg_deps *deps, char *buf)
+{
+	int err;
+
+	memset(deps, 0, sizeof(*deps));
+	err = deps_scan_buf(deps, buf);
+	if (err < 0)
+		tplg_deps_free(deps);
+	return err;
+}
+
+void tplg_deps_free(struct tplg_deps *deps)
+{
+	int i;
+
+	for (i = 0; i < deps->count; i++)
+		free(deps->files[i]);
+	free(deps->files);
+	for (i = 0; i < deps->searchdirs_count; i++)
+		free(deps->searchdirs[i]);
+	free(deps->searchdirs);
+	memset(deps, 0, sizeof(*deps));
+}
+
+static void write_escaped(FILE *fp, const char *s)
+{
+	for (; *s; s++) {
+		if (*s == ' ' || *s == '\\' || *s == '#')
+			fputc('\\', fp);
+		else if (*s == '$')
+			fputc('$', fp);
+		fputc(*s, fp);
+	}
+}
+
+/* write a make rule "target: deps..." */
+int tplg_deps_write(struct tplg_deps *deps, const char *depfile, const char *target)
+{
+	FILE *fp;
+	int i;
+
+	fp = fopen(depfile, "w");
+	if (!fp) {
+		fprintf(stderr, "Unable to open depfile '%s': %s\n",
+			depfile, strerror(errno));
+		return -errno;
+	}
+	write_escaped(fp, target);
+	fputc(':', fp);
+	for (i = 0; i < deps->count; i++) {
+		fputs(" \\\n ", fp);
+		write_escaped(fp, deps->files[i]);
+	}
+	fputc('\n', fp);
+	if (fclose(fp)) {
+		fprintf(stderr, "Unable to write depfile '%s': %s\n",
+			depfile, strerror(errno));
+		return -errno;
+	}
+	return 0;
+}
+
+static bool newer(const struct timespec *a, const struct timespec *b)
+{
+	return a->tv_sec > b->tv_sec ||
+	       (a->tv_sec == b->tv_sec && a->tv_nsec > b->tv_nsec);
+}
+
+/*
+ * Check the file against the dependencies recorded in the depfile. Returns
+ * true only when both exist and no dependency is newer than the file.
+ */
+bool tplg_deps_up_to_date(const char *depfile, const char *file)
+{
+	struct stat st;
+	struct timespec mtime;
+	char *buf = NULL, *p, *q, *word;
+	size_t size = 0;
+	bool ok = true, target = true;
+	FILE *fp;
+
+	if (stat(file, &st) < 0)
+		return false;
+	mtime = st.st_mtim;
+
+	fp = fopen(depfile, "r");
+	if (!fp)
+		return false;
+	if (getdelim(&buf, &size, '\0', fp) < 0 || !buf) {
+		fclose(fp);
+		free(buf);
+		return false;
+	}
+	fclose(fp);
+
+	/* the words after "target:", with the escapes removed in place */
+	for (p = buf; *p && ok; ) {
+		while (isspace(*p) || (*p == '\\' && p[1] == '\n'))
+			p++;
+		if (*p == '\0')
+			break;
+		for (word = q = p; *p && !isspace(*p); p++) {
+			if (*p == '\\' && p[1] == '\n')
+				break;
+			if (*p == '\\' && p[1])
+				p++;
+			else if (*p == '$' && p[1] == '$')
+				p++;
+			else if (target && *p == ':' && (isspace(p[1]) || !p[1]))
+				break;
+			*q++ = *p;
+		}
+		if (target) {
+			/* skip the target itself */
+			if (*p == ':') {
+				target = false;
+				p++;
+			}
+			continue;
+		}
+		if (*p && *p != '\\')
+			p++;
+		*q = '\0';
+		if (stat(word, &st) < 0 || newer(&st.st_mtim, &mtime))
+			ok = false;
+	}
+
+	free(buf);
+	return ok && !target;
+}
@@ -21,6 +21,7 @@
 #include <errno.h>
 #include <limits.h>
 #include <stdio.h>
+#include <stdint.h>
 #include <alsa/input.h>
 #include <alsa/output.h>
 #include <alsa/conf.h>
@@ -28,6 +29,255 @@
 #include "topology.h"
 #include "pre-processor.h"
 
+#define TPLG_INDEX_MIN_SIZE	256
+
+static unsigned int tplg_index_hash(snd_config_t *scope, const char **parts, int count)
+{
+	uintptr_t p = (uintptr_t)scope;
+	unsigned int hash = 2166136261U;
+	const char *s;
+	unsigned int i;
+	int j;
+
+	for (i = 0; i < sizeof(p); i++) {
+		hash ^= (p >> (i * 8)) & 0xff;
+		hash *= 16777619U;
+	}
+	for (j = 0; j < count; j++) {
+		if (j > 0) {
+			hash ^= '.';
+			hash *= 16777619U;
+		}
+		for (s = parts[j]; *s; s++) {
+			hash ^= (unsigned char)*s;
+			hash *= 16777619U;
+		}
+	}
+	return hash;
+}
+
+/* compare the key with the parts joined by '.' */
+static bool tplg_index_key_match(const char *key, const char **parts, int count)
+{
+	size_t len;
+	int j;
+
+	for (j = 0; j < count; j++) {
+		if (j > 0 && *key++ != '.')
+			return false;
+		len = strlen(parts[j]);
+		if (strncmp(key, parts[j], len))
+			return false;
+		key += len;
+	}
+	return *key == '\0';
+}
+
+static int tplg_index_resize(struct tplg_pre_processor *tplg_pp, unsigned int size)
+{
+	struct tplg_index_entry **index, *e, *next;
+	unsigned int i;
+
+	index = calloc(size, sizeof(*index));
+	if (!index)
+		return -ENOMEM;
+
+	for (i = 0; i < tplg_pp->index_size; i++) {
+		for (e = tplg_pp->index[i]; e; e = next) {
+			next = e->next;
+			e->next = index[e->hash & (size - 1)];
+			index[e->hash & (size - 1)] = e;
+		}
+	}
+	free(tplg_pp->index);
+	tplg_pp->index = index;
+	tplg_pp->index_size = size;
+	return 0;
+}
+
+static int tplg_index_add(struct tplg_pre_processor *tplg_pp, snd_config_t *scope,
+			  const char **parts, int count, snd_config_t *cfg)
+{
+	struct tplg_index_entry *e;
+	unsigned int hash;
+	size_t len = 0;
+	int j, ret;
+
+	if (tplg_pp->index_count >= tplg_pp->index_size) {
+		ret = tplg_index_resize(tplg_pp, tplg_pp->index_size ?
+					tplg_pp->index_size * 2 : TPLG_INDEX_MIN_SIZE);
+		if (ret < 0)
+			return ret;
+	}
+
+	for (j = 0; j < count; j++)
+		len += strlen(parts[j]) + 1;
+
+	e = calloc(1, sizeof(*e) + len);
+	if (!e)
+		return -ENOMEM;
+
+	e->key = (char *)(e + 1);
+	for (j = 0; j < count; j++) {
+		if (j > 0)
+			strcat(e->key, ".");
+		strcat(e->key, parts[j]);
+	}
+	hash = tplg_index_hash(scope, parts, count);
+	e->hash = hash;
+	e->scope = scope;
+	e->cfg = cfg;
+	e->next = tplg_pp->index[hash & (tplg_pp->index_size - 1)];
+	tplg_pp->index[hash & (tplg_pp->index_size - 1)] = e;
+	tplg_pp->index_count++;
+	return 0;
+}
+
+snd_config_t *tplg_class_index_find(struct tplg_pre_processor *tplg_pp, snd_config_t *scope,
+				    const char **parts, int count)
+{
+	struct tplg_index_entry *e;
+	unsigned int hash;
+
+	hash = tplg_index_hash(scope, parts, count);
+	for (e = tplg_pp->index[hash & (tplg_pp->index_size - 1)]; e; e = e->next) {
+		if (e->hash == hash && e->scope == scope &&
+		    tplg_index_key_match(e->key, parts, count))
+			return e->cfg;
+	}
+
+	return NULL;
+}
+
+void tplg_class_free_index(struct tplg_pre_processor *tplg_pp)
+{
+	struct tplg_index_entry *e, *next;
+	unsigned int i;
+
+	for (i = 0; i < tplg_pp->index_size; i++) {
+		for (e = tplg_pp->index[i]; e; e = next) {
+			next = e->next;
+			free(e);
+		}
+	}
+	free(tplg_pp->index);
+	tplg_pp->index = NULL;
+	tplg_pp->index_size = 0;
+	tplg_pp->index_count = 0;
+}
+
+/* add the objects declared in a class, Object.type.class.id {} */
+static int tplg_class_index_objects(struct tplg_pre_processor *tplg_pp, snd_config_t *class)
+{
+	snd_config_iterator_t i, next, i2, next2, i3, next3;
+	snd_config_t *objects, *n, *n2, *n3;
+	const char *parts[3];
+	int ret;
+
+	if (snd_config_search(class, "Object", &objects) < 0 ||
+	    snd_config_get_type(objects) != SND_CONFIG_TYPE_COMPOUND)
+		return 0;
+
+	snd_config_for_each(i, next, objects) {
+		n = snd_config_iterator_entry(i);
+		if (snd_config_get_id(n, &parts[0]) < 0 ||
+		    snd_config_get_type(n) != SND_CONFIG_TYPE_COMPOUND)
+			continue;
+		snd_config_for_each(i2, next2, n) {
+			n2 = snd_config_iterator_entry(i2);
+			if (snd_config_get_id(n2, &parts[1]) < 0 ||
+			    snd_config_get_type(n2) != SND_CONFIG_TYPE_COMPOUND)
+				continue;
+			snd_config_for_each(i3, next3, n2) {
+				n3 = snd_config_iterator_entry(i3);
+				if (snd_config_get_id(n3, &parts[2]) < 0)
+					continue;
+				ret = tplg_index_add(tplg_pp, class, parts, 3, n3);
+				if (ret < 0)
+					return ret;
+			}
+		}
+	}
+
+	return 0;
+}
+
+/* index all classes in input_cfg with their attribute definitions and objects */
+int tplg_class_build_index(struct tplg_pre_processor *tplg_pp)
+{
+	snd_config_iterator_t i, next, i2, next2, i3, next3;
+	snd_config_t *classes, *n, *n2, *attrs, *n3;
+	const char *parts[2];
+	int ret;
+
+	tplg_class_free_index(tplg_pp);
+	ret = tplg_index_resize(tplg_pp, TPLG_INDEX_MIN_SIZE);
+	if (ret < 0)
+		return ret;
+
+	if (snd_config_search(tplg_pp->input_cfg, "Class", &classes) < 0 ||
+	    snd_config_get_type(classes) != SND_CONFIG_TYPE_COMPOUND)
+		return 0;
+
+	snd_config_for_each(i, next, classes) {
+		n = snd_config_iterator_entry(i);
+		if (snd_config_get_id(n, &parts[0]) < 0 ||
+		    snd_config_get_type(n) != SND_CONFIG_TYPE_COMPOUND)
+			continue;
+		snd_config_for_each(i2, next2, n) {
+			n2 = snd_config_iterator_entry(i2);
+			if (snd_config_get_id(n2, &parts[1]) < 0)
+				continue;
+			ret = tplg_index_add(tplg_pp, NULL, parts, 2, n2);
+			if (ret < 0)
+				goto err;
+
+			if (snd_config_get_type(n2) != SND_CONFIG_TYPE_COMPOUND)
+				continue;
+
+			if (snd_config_search(n2, "DefineAttribute", &attrs) >= 0 &&
+			    snd_config_get_type(attrs) == SND_CONFIG_TYPE_COMPOUND) {
+				snd_config_for_each(i3, next3, attrs) {
+					const char *attr_name;
+
+					n3 = snd_config_iterator_entry(i3);
+					if (snd_config_get_id(n3, &attr_name) < 0)
+						continue;
+					ret = tplg_index_add(tplg_pp, n2, &attr_name, 1, n3);
+					if (ret < 0)
+						goto err;
+				}
+			}
+
+			ret = tplg_class_index_objects(tplg_pp, n2);
+			if (ret < 0)
+				goto err;
+		}
+	}
+
+	tplg_pp_debug("Indexed %u class entries", tplg_pp->index_count);
+	return 0;
+err:
+	tplg_class_free_index(tplg_pp);
+	return ret;
+}
+
+/* look up a DefineAttribute entry of the class, quietly */
+static snd_config_t *tplg_class_attribute(struct tplg_pre_processor *tplg_pp,
+					  snd_config_t *class, const char *name)
+{
+	snd_config_t *attributes, *attr;
+
+	if (tplg_pp->index)
+		return tplg_class_index_find(tplg_pp, class, &name, 1);
+
+	if (snd_config_search(class, "DefineAttribute", &attributes) < 0)
+		return NULL;
+	if (snd_config_search(attributes, name, &attr) < 0)
+		return NULL;
+	return attr;
+}
+
 bool tplg_class_is_attribute_check(const char *attr, snd_config_t *class_cfg, char *category)
 {
 	snd_config_iterator_t i, next;
@@ -116,7 +366,17 @@ snd_config_t *tplg_class_lookup(struct tplg_pre_processor *tplg_pp, snd_config_t
 	if (snd_config_get_id(class, &class_name) < 0)
 		return NULL;
 
-	class_config_id = tplg_snprintf("Class.%s.%s", class_type, class_name);
+	if (tplg_pp->index) {
+		const char *parts[2] = { class_type, class_name };
+
+		class_cfg = tplg_class_index_find(tplg_pp, NULL, parts, 2);
+		if (!class_cfg)
+			SNDERR("No Class definition found for Class.%s.%s\n",
+			       class_type, class_name);
+		return class_cfg;
+	}
+
+	class_config_id = tplg_pp_snprintf(tplg_pp, "Class.%s.%s", class_type, class_name);
 	if (!class_config_id)
 		return NULL;
 
@@ -124,7 +384,6 @@ snd_config_t *tplg_class_lookup(struct tplg_pre_processor *tplg_pp, snd_config_t
 	if (ret < 0)
 		SNDERR("No Class definition found for %s\n", class_config_id);
 
-	free(class_config_id);
 	return class_cfg;
 }
 
@@ -132,24 +391,17 @@ snd_config_t *tplg_class_lookup(struct tplg_pre_processor *tplg_pp, snd_config_t
 snd_config_t *tplg_class_find_attribute_by_name(struct tplg_pre_processor *tplg_pp,
 						snd_config_t *class, const char *name)
 {
-	snd_config_t *attr = NULL;
+	snd_config_t *attr;
 	const char *class_id;
-	char *attr_str;
-	int ret;
 
 	if (snd_config_get_id(class, &class_id) < 0)
 		return NULL;
 
-	attr_str = tplg_snprintf("DefineAttribute.%s", name);
-	if (!attr_str)
-		return NULL;
-
-	ret = snd_config_search(class, attr_str, &attr);
-	if (ret < 0)
+	attr = tplg_class_attribute(tplg_pp, class, name);
+	if (!attr)
 		SNDERR("No definition for attribute '%s' in class '%s'\n",
 			name, class_id);
 
-	free(attr_str);
 	return attr;
 }
 
@@ -213,16 +465,12 @@ snd_config_type_t tplg_class_get_attribute_type(struct tplg_pre_processor *tplg_
 const char *tplg_class_get_attribute_token_ref(struct tplg_pre_processor *tplg_pp,
 					       snd_config_t *class, const char *attr_name)
 {
-	snd_config_t *attributes, *attr, *token_ref;
+	snd_config_t *attr, *token_ref;
 	const char *token;
 	int ret;
 
-	ret = snd_config_search(class, "DefineAttribute", &attributes);
-	if (ret < 0)
-		return NULL;
-
-	ret = snd_config_search(attributes, attr_name, &attr);
-	if (ret < 0)
+	attr = tplg_class_attribute(tplg_pp, class, attr_name);
+	if (!attr)
 		return NULL;
 
 	ret = snd_config_search(attr, "token_ref", &token_ref);
@@ -241,7 +489,7 @@ long tplg_class_attribute_valid_tuple_value(struct tplg_pre_processor *tplg_pp,
 					    snd_config_t *class, snd_config_t *attr)
 {
 
-	snd_config_t *attributes, *cfg, *valid, *tuples, *n;
+	snd_config_t *cfg, *valid, *tuples, *n;
 	snd_config_iterator_t i, next;
 	const char *attr_name, *attr_value;
 	int ret;
@@ -255,13 +503,8 @@ long tplg_class_attribute_valid_tuple_value(struct tplg_pre_processor *tplg_pp,
 		return -EINVAL;
 
 	/* find attribute definition in class */
-	ret = snd_config_search(class, "DefineAttribute", &attributes);
-	if (ret < 0)
-		return -EINVAL;
-
-
-	ret = snd_config_search(attributes, attr_name, &cfg);
-	if (ret < 0)
+	cfg = tplg_class_attribute(tplg_pp, class, attr_name);
+	if (!cfg)
 		return -EINVAL;
 
 	/* check if it has valid values */
@@ -140,6 +140,7 @@ int tplg_build_bytes_control(struct tplg_pre_processor *tplg_pp, snd_config_t *o
  * Optionally, the index argument for a widget can be omitted and will be substituted with
  * the index from the route: ex: pga..0, host..playback etc
  */
+/* the widget name is allocated in the pre-processor arena */
 static int tplg_pp_get_widget_name(struct tplg_pre_processor *tplg_pp,
 				      const char *string, long index, char **widget)
 {
@@ -155,51 +156,41 @@ static int tplg_pp_get_widget_name(struct tplg_pre_processor *tplg_pp,
 		return -EINVAL;
 	}
 
-	class_name = calloc(1, strlen(string) - strlen(args) + 1);
+	class_name = tplg_pp_snprintf(tplg_pp, "%.*s", (int)(args - string), string);
 	if (!class_name)
 		return -ENOMEM;
 
-	snprintf(class_name, strlen(string) - strlen(args) + 1, "%s", string);
-
 	/* create config with Widget class type */
 	ret = snd_config_make(&temp_cfg, "Widget", SND_CONFIG_TYPE_COMPOUND);
-	if (ret < 0) {
-		free(class_name);
+	if (ret < 0)
 		return ret;
-	}
 
 	/* create config with class name and add it to the Widget config */
 	ret = tplg_config_make_add(&child, class_name, SND_CONFIG_TYPE_COMPOUND, temp_cfg);
 	if (ret < 0) {
-		free(class_name);
+		snd_config_delete(temp_cfg);
 		return ret;
 	}
 
 	/* get class definition for widget */
 	class_cfg = tplg_class_lookup(tplg_pp, temp_cfg);
 	snd_config_delete(temp_cfg);
-	if (!class_cfg) {
-		free(class_name);
+	if (!class_cfg)
 		return -EINVAL;
-	}
 
 	/* get constructor for class */
 	ret = snd_config_search(class_cfg, "attributes.constructor", &temp_cfg);
 	if (ret < 0) {
 		SNDERR("No arguments in class for widget %s\n", string);
-		free(class_name);
 		return ret;
 	}
 
-	widget_name = strdup(class_name);
-	free(class_name);
-	if (!widget_name)
-		return -ENOMEM;
+	widget_name = class_name;
 
 	/* construct widget name using the constructor argument values */
 	snd_config_for_each(i, next, temp_cfg) {
 		const char *id;
-		char *arg, *remaining, *temp;
+		char *arg, *remaining;
 
 		n = snd_config_iterator_entry(i);
 		if (snd_config_get_string(n, &id) < 0)
@@ -207,61 +198,161 @@ static int tplg_pp_get_widget_name(struct tplg_pre_processor *tplg_pp,
 
 		if (!args) {
 			SNDERR("insufficient arugments for widget %s\n", string);
-			ret = -EINVAL;
-			goto err;
+			return -EINVAL;
 		}
 
 		remaining = strchr(args + 1, '.');
-		if (remaining) {
-			arg = calloc(1, strlen(args + 1) - strlen(remaining) + 1);
-			if (!arg) {
-				ret = -ENOMEM;
-				goto err;
-			}
-			snprintf(arg, strlen(args + 1) - strlen(remaining) + 1, "%s", args + 1);
-		} else {
-			arg = calloc(1, strlen(args + 1) + 1);
-			if (!arg) {
-				ret = -ENOMEM;
-				goto err;
-			}
-
-			snprintf(arg, strlen(args + 1) + 1, "%s", args + 1);
-		}
+		if (remaining)
+			arg = tplg_pp_snprintf(tplg_pp, "%.*s", (int)(remaining - args - 1),
+					       args + 1);
+		else
+			arg = tplg_pp_strdup(tplg_pp, args + 1);
+		if (!arg)
+			return -ENOMEM;
 
 		/* if no index provided, substitue with route index */
 		if (!strcmp(arg, "") && !strcmp(id, "index")) {
-			free(arg);
-			arg = tplg_snprintf("%ld", index);
-			if (!arg) {
-				ret = -ENOMEM;
-				free(arg);
-				goto err;
-			}
+			arg = tplg_pp_snprintf(tplg_pp, "%ld", index);
+			if (!arg)
+				return -ENOMEM;
 		}
 
-		temp = tplg_snprintf("%s.%s", widget_name, arg);
-		if (!temp) {
-			ret = -ENOMEM;
-			free(arg);
-			goto err;
-		}
+		widget_name = tplg_pp_snprintf(tplg_pp, "%s.%s", widget_name, arg);
+		if (!widget_name)
+			return -ENOMEM;
 
-		free(widget_name);
-		widget_name = temp;
-		free(arg);
-		if (remaining)
-			args = remaining;
-		else
-			args = NULL;
+		args = remaining;
 	}
 
 	*widget = widget_name;
 	return 0;
+}
 
-err:
-	free(widget_name);
-	return ret;
+static unsigned int tplg_widget_ref_hash(const char *string, long index)
+{
+	unsigned int hash = 2166136261U;
+	unsigned int i;
+
+	for (; *string; string++) {
+		hash ^= (unsigned char)*string;
+		hash *= 16777619U;
+	}
+	for (i = 0; i < sizeof(index); i++) {
+		hash ^= ((unsigned long)index >> (i * 8)) & 0xff;
+		hash *= 16777619U;
+	}
+	return hash;
+}
+
+/*
+ * Resolve a route endpoint through the cache, the name is built only for the
+ * first route using the endpoint. Returns -ENOENT for an unresolved endpoint.
+ */
+static int tplg_pp_lookup_widget_name(struct tplg_pre_processor *tplg_pp,
+				      const char *string, long index, const char **widget)
+{
+	struct tplg_widget_ref *ref, **bucket;
+	unsigned int hash;
+	char *name;
+	int ret;
+
+	if (!tplg_pp->widget_refs) {
+		tplg_pp->widget_refs = calloc(TPLG_WIDGET_REFS_SIZE, sizeof(*tplg_pp->widget_refs));
+		if (!tplg_pp->widget_refs)
+			return -ENOMEM;
+	}
+
+	hash = tplg_widget_ref_hash(string, index);
+	bucket = &tplg_pp->widget_refs[hash & (TPLG_WIDGET_REFS_SIZE - 1)];
+	for (ref = *bucket; ref; ref = ref->next) {
+		if (ref->hash == hash && ref->index == index && !strcmp(ref->string, string))
+			goto found;
+	}
+
+	ref = calloc(1, sizeof(*ref) + strlen(string) + 1);
+	if (!ref)
+		return -ENOMEM;
+	strcpy(ref->string, string);
+	ref->hash = hash;
+	ref->index = index;
+
+	ret = tplg_pp_get_widget_name(tplg_pp, string, index, &name);
+	if (ret == -ENOMEM) {
+		free(ref);
+		return ret;
+	}
+	if (ret >= 0) {
+		/* the cache outlives the arena */
+		ref->name = strdup(name);
+		if (!ref->name) {
+			free(ref);
+			return -ENOMEM;
+		}
+	}
+	ref->next = *bucket;
+	*bucket = ref;
+
+found:
+	if (!ref->name)
+		return -ENOENT;
+	*widget = ref->name;
+	return 0;
+}
+
+void tplg_dapm_free_widget_refs(struct tplg_pre_processor *tplg_pp)
+{
+	struct tplg_widget_ref *ref, *next;
+	unsigned int i;
+
+	if (tplg_pp->widget_refs) {
+		for (i = 0; i < TPLG_WIDGET_REFS_SIZE; i++) {
+			for (ref = tplg_pp->widget_refs[i]; ref; ref = next) {
+				next = ref->next;
+				free(ref->name);
+				free(ref);
+			}
+		}
+		free(tplg_pp->widget_refs);
+		tplg_pp->widget_refs = NULL;
+	}
+
+	for (i = 0; i < tplg_pp->unresolved_count; i++)
+		free(tplg_pp->unresolved_routes[i]);
+	free(tplg_pp->unresolved_routes);
+	tplg_pp->unresolved_routes = NULL;
+	tplg_pp->unresolved_count = 0;
+}
+
+/* remember a route with an unresolved endpoint, it is reported at the end */
+static int tplg_dapm_add_unresolved(struct tplg_pre_processor *tplg_pp, const char *route,
+				    const char *endpoint)
+{
+	char **routes;
+
+	routes = realloc(tplg_pp->unresolved_routes,
+			 (tplg_pp->unresolved_count + 1) * sizeof(*routes));
+	if (!routes)
+		return -ENOMEM;
+	tplg_pp->unresolved_routes = routes;
+	routes[tplg_pp->unresolved_count] = tplg_snprintf("%s (%s)", route, endpoint);
+	if (!routes[tplg_pp->unresolved_count])
+		return -ENOMEM;
+	tplg_pp->unresolved_count++;
+	return 0;
+}
+
+/* report all routes with unresolved endpoints once the objects are built */
+int tplg_dapm_check_routes(struct tplg_pre_processor *tplg_pp)
+{
+	unsigned int i;
+
+	if (!tplg_pp->unresolved_count)
+		return 0;
+
+	for (i = 0; i < tplg_pp->unresolved_count; i++)
+		SNDERR("unresolved widget in route %s\n", tplg_pp->unresolved_routes[i]);
+	SNDERR("%u routes with unresolved widgets\n", tplg_pp->unresolved_count);
+	return -EINVAL;
 }
 
 int tplg_build_dapm_route_object(struct tplg_pre_processor *tplg_pp, snd_config_t *obj_cfg,
@@ -270,7 +361,8 @@ int tplg_build_dapm_route_object(struct tplg_pre_processor *tplg_pp, snd_config_
 	snd_config_t *top, *obj, *cfg, *route, *child, *parent_obj;
 	const char *name, *wname;
 	const char *parent_name = "Endpoint";
-	char *src_widget_name, *sink_widget_name, *line_str, *route_name;
+	const char *src_widget_name, *sink_widget_name;
+	char *line_str, *route_name;
 	const char *control = "";
 	long index = 0;
 	int ret;
@@ -325,33 +417,30 @@ int tplg_build_dapm_route_object(struct tplg_pre_processor *tplg_pp, snd_config_
 		return ret;
 	}
 
-	ret = tplg_pp_get_widget_name(tplg_pp, wname, index, &src_widget_name);
-	if (ret < 0) {
-		SNDERR("error getting widget name for %s\n", wname);
+	ret = tplg_pp_lookup_widget_name(tplg_pp, wname, index, &src_widget_name);
+	if (ret == -ENOENT)
+		return tplg_dapm_add_unresolved(tplg_pp, name, wname);
+	if (ret < 0)
 		return ret;
-	}
 
 	/* get sink widget name */
 	ret = snd_config_search(obj, "sink", &cfg);
 	if (ret < 0) {
 		SNDERR("No sink for route %s\n", name);
-		free(src_widget_name);
 		return ret;
 	}
 
 	ret = snd_config_get_string(cfg, &wname);
 	if (ret < 0) {
 		SNDERR("Invalid name for sink in route %s\n", name);
-		free(src_widget_name);
 		return ret;
 	}
 
-	ret = tplg_pp_get_widget_name(tplg_pp, wname, index, &sink_widget_name);
-	if (ret < 0) {
-		SNDERR("error getting widget name for %s\n", wname);
-		free(src_widget_name);
+	ret = tplg_pp_lookup_widget_name(tplg_pp, wname, index, &sink_widget_name);
+	if (ret == -ENOENT)
+		return tplg_dapm_add_unresolved(tplg_pp, name, wname);
+	if (ret < 0)
 		return ret;
-	}
 
 	/* get control name */
 	ret = snd_config_search(obj, "control", &cfg);
@@ -364,14 +453,13 @@ int tplg_build_dapm_route_object(struct tplg_pre_processor *tplg_pp, snd_config_
 	}
 
 	/* add route */
-	route_name = tplg_snprintf("%s.%s", parent_name, name);
+	route_name = tplg_pp_snprintf(tplg_pp, "%s.%s", parent_name, name);
 	if (!route_name) {
 		ret = -ENOMEM;
 		goto err;
 	}
 
 	ret = snd_config_make(&route, route_name, SND_CONFIG_TYPE_COMPOUND);
-	free(route_name);
 	if (ret < 0) {
 		SNDERR("Error creating route config for %s %d\n", name, ret);
 		goto err;
@@ -410,7 +498,8 @@ int tplg_build_dapm_route_object(struct tplg_pre_processor *tplg_pp, snd_config_
 		goto err;
 	}
 
-	line_str = tplg_snprintf("%s, %s, %s", sink_widget_name, control, src_widget_name);
+	line_str = tplg_pp_snprintf(tplg_pp, "%s, %s, %s", sink_widget_name, control,
+				    src_widget_name);
 	if (!line_str) {
 		ret = -ENOMEM;
 		goto err;
@@ -418,12 +507,9 @@ int tplg_build_dapm_route_object(struct tplg_pre_processor *tplg_pp, snd_config_
 
 	/* set the line string */
 	ret = snd_config_set_string(child, line_str);
-	free(line_str);
 	if (ret < 0)
 		SNDERR("Error creating lines config for %s\n", name);
 err:
-	free(src_widget_name);
-	free(sink_widget_name);
 	return ret;
 }
 
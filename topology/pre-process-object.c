@@ -158,12 +158,11 @@ int tplg_parent_update(struct tplg_pre_processor *tplg_pp, snd_config_t *parent,
 	}
 
 	/* add new item */
-	item_id = tplg_snprintf("%d", id);
+	item_id = tplg_pp_snprintf(tplg_pp, "%d", id);
 	if (!item_id)
 		return -ENOMEM;
 
 	ret = snd_config_make(&cfg, item_id, SND_CONFIG_TYPE_STRING);
-	free(item_id);
 	if (ret < 0)
 		return ret;
 
@@ -197,55 +196,6 @@ int tplg_build_data_object(struct tplg_pre_processor *tplg_pp, snd_config_t *obj
 	return tplg_parent_update(tplg_pp, parent, "data", name);
 }
 
-static int tplg_create_config_template(struct tplg_pre_processor *tplg_pp,
-				       snd_config_t **template,
-				       const struct config_template_items *items)
-{
-	snd_config_t *top, *child;
-	int ret, i;
-
-	ret = snd_config_make(&top, "template", SND_CONFIG_TYPE_COMPOUND);
-	if (ret < 0)
-		return ret;
-
-	/* add integer configs */
-	for (i = 0; i < MAX_CONFIGS_IN_TEMPLATE; i++)
-		if (items->int_config_ids[i]) {
-			ret = tplg_config_make_add(&child, items->int_config_ids[i],
-						   SND_CONFIG_TYPE_INTEGER, top);
-			if (ret < 0)
-				goto err;
-		}
-
-	/* add string configs */
-	for (i = 0; i < MAX_CONFIGS_IN_TEMPLATE; i++)
-		if (items->string_config_ids[i]) {
-			ret = tplg_config_make_add(&child, items->string_config_ids[i],
-						   SND_CONFIG_TYPE_STRING, top);
-			if (ret < 0)
-				goto err;
-		}
-
-	/* add compound configs */
-	for (i = 0; i < MAX_CONFIGS_IN_TEMPLATE; i++) {
-		if (items->compound_config_ids[i]) {
-			ret = tplg_config_make_add(&child, items->compound_config_ids[i],
-						   SND_CONFIG_TYPE_COMPOUND, top);
-			if (ret < 0)
-				goto err;
-		}
-	}
-
-err:
-	if (ret < 0) {
-		snd_config_delete(top);
-		return ret;
-	}
-
-	*template = top;
-	return ret;
-}
-
 static void tplg_attribute_print_valid_values(snd_config_t *valid_values, const char *name)
 {
 	snd_config_iterator_t i, next;
@@ -456,21 +406,33 @@ const char *tplg_object_get_name(struct tplg_pre_processor *tplg_pp,
 	return name;
 }
 
-/* look up the instance of object in a config */
+/*
+ * look up the instance of object in a config, in_class is set when the config
+ * is a class definition from input_cfg
+ */
 static snd_config_t *tplg_object_lookup_in_config(struct tplg_pre_processor *tplg_pp,
 						  snd_config_t *class, const char *type,
-						  const char *class_name, const char *id)
+						  const char *class_name, const char *id,
+						  bool in_class)
 {
 	snd_config_t *obj_cfg = NULL;
 	char *config_id;
+	int ret;
 
-	config_id = tplg_snprintf("Object.%s.%s.%s", type, class_name, id);
+	/* the objects declared in a class definition are indexed */
+	if (tplg_pp->index && in_class) {
+		const char *parts[3] = { type, class_name, id };
+
+		return tplg_class_index_find(tplg_pp, class, parts, 3);
+	}
+
+	config_id = tplg_pp_snprintf(tplg_pp, "Object.%s.%s.%s", type, class_name, id);
 	if (!config_id)
 		return NULL;
 
-	if (snd_config_search(class, config_id, &obj_cfg) < 0)
+	ret = snd_config_search(class, config_id, &obj_cfg);
+	if (ret < 0)
 		return NULL;
-	free(config_id);
 	return obj_cfg;
 }
 
@@ -654,12 +616,11 @@ static int tplg_pp_add_object_data_section(struct tplg_pre_processor *tplg_pp,
 	snd_config_for_each(i, next, obj_data)
 		id++;
 
-	data_id = tplg_snprintf("%d", id);
+	data_id = tplg_pp_snprintf(tplg_pp, "%d", id);
 	if (!data_id)
 		return -ENOMEM;
 
 	ret = tplg_config_make_add(&child, data_id, SND_CONFIG_TYPE_STRING, obj_data);
-	free(data_id);
 	if (ret < 0) {
 		SNDERR("error adding data ref %s\n", data_name);
 		return ret;
@@ -708,14 +669,13 @@ int tplg_add_object_data(struct tplg_pre_processor *tplg_pp, snd_config_t *obj_c
 		if (!token)
 			continue;
 
-		data_cfg_name = tplg_snprintf("%s.%s", object_id, token);
+		data_cfg_name = tplg_pp_snprintf(tplg_pp, "%s.%s", object_id, token);
 		if (!data_cfg_name)
 			return -ENOMEM;
 
 		ret = tplg_pp_add_object_data_section(tplg_pp, data_cfg, data_cfg_name);
 		if (ret < 0) {
 			SNDERR("Failed to add data section %s\n", data_cfg_name);
-			free(data_cfg_name);
 			return ret;
 		}
 
@@ -723,52 +683,71 @@ int tplg_add_object_data(struct tplg_pre_processor *tplg_pp, snd_config_t *obj_c
 						       token, array_name);
 		if (ret < 0) {
 			SNDERR("Failed to add data section %s\n", data_cfg_name);
-			free(data_cfg_name);
 			return ret;
 		}
-		free(data_cfg_name);
 	}
 
 	return 0;
 }
 
 /* search for all template configs in the source config and copy them to the destination */
-static int tplg_object_add_attributes(snd_config_t *dst, snd_config_t *template,
-				      snd_config_t *src)
+static int tplg_object_add_attribute(snd_config_t *dst, snd_config_t *src, const char *id)
 {
-	snd_config_iterator_t i, next;
-	snd_config_t *n;
+	snd_config_t *attr, *new;
 	int ret;
 
-	snd_config_for_each(i, next, template) {
-		snd_config_t *attr, *new;
-		const char *id;
+	ret = snd_config_search(src, id, &attr);
+	if (ret < 0)
+		return 0;
 
-		n = snd_config_iterator_entry(i);
-		if (snd_config_get_id(n, &id) < 0)
-			continue;
+	/* skip if attribute is already set */
+	ret = snd_config_search(dst, id, &new);
+	if (ret >= 0)
+		return 0;
 
-		ret = snd_config_search(src, id, &attr);
-		if (ret < 0)
-			continue;
+	ret = snd_config_copy(&new, attr);
+	if (ret < 0) {
+		SNDERR("failed to copy attribute %s\n", id);
+		return ret;
+	}
 
-		/* skip if attribute is already set */
-		ret = snd_config_search(dst, id, &new);
-		if (ret >= 0)
-			continue;
+	ret = snd_config_add(dst, new);
+	if (ret < 0) {
+		snd_config_delete(new);
+		SNDERR("failed to add attribute %s\n", id);
+		return ret;
+	}
 
-		ret = snd_config_copy(&new, attr);
-		if (ret < 0) {
-			SNDERR("failed to copy attribute %s\n", id);
+	return 0;
+}
+
+/*
+ * Copy the attributes named in the template items from src to dst. The items
+ * are walked directly, the integer, string and compound IDs in this order,
+ * instead of building a template config for each object instance.
+ */
+static int tplg_object_add_attributes(snd_config_t *dst,
+				      const struct config_template_items *items,
+				      snd_config_t *src)
+{
+	int ret, i;
+
+	for (i = 0; i < MAX_CONFIGS_IN_TEMPLATE && items->int_config_ids[i]; i++) {
+		ret = tplg_object_add_attribute(dst, src, items->int_config_ids[i]);
+		if (ret < 0)
 			return ret;
-		}
+	}
 
-		ret = snd_config_add(dst, new);
-		if (ret < 0) {
-			snd_config_delete(new);
-			SNDERR("failed to add attribute %s\n", id);
+	for (i = 0; i < MAX_CONFIGS_IN_TEMPLATE && items->string_config_ids[i]; i++) {
+		ret = tplg_object_add_attribute(dst, src, items->string_config_ids[i]);
+		if (ret < 0)
+			return ret;
+	}
+
+	for (i = 0; i < MAX_CONFIGS_IN_TEMPLATE && items->compound_config_ids[i]; i++) {
+		ret = tplg_object_add_attribute(dst, src, items->compound_config_ids[i]);
+		if (ret < 0)
 			return ret;
-		}
 	}
 
 	return 0;
@@ -839,7 +818,7 @@ int tplg_build_object_from_template(struct tplg_pre_processor *tplg_pp, snd_conf
 				    snd_config_t **wtop, snd_config_t *top_config,
 				    bool skip_name)
 {
-	snd_config_t *top, *template, *obj;
+	snd_config_t *top, *obj;
 	const struct build_function_map *map;
 	const char *object_name;
 	int ret;
@@ -896,19 +875,11 @@ int tplg_build_object_from_template(struct tplg_pre_processor *tplg_pp, snd_conf
 	}
 
 template:
-	/* create template config */
 	if (!map->template_items)
 		return 0;
 
-	ret = tplg_create_config_template(tplg_pp, &template, map->template_items);
-	if (ret < 0) {
-		SNDERR("Error creating template config for %s\n", object_name);
-		return ret;
-	}
-
 	/* update section config based on template and the attribute values in the object */
-	ret = tplg_object_add_attributes(*wtop, template, obj);
-	snd_config_delete(template);
+	ret = tplg_object_add_attributes(*wtop, map->template_items, obj);
 	if (ret < 0)
 		SNDERR("Error adding attributes for object '%s'\n", object_name);
 
@@ -1000,10 +971,11 @@ const struct config_template_items data_config = {
 };
 
 /*
- * Items without class name should be placed lower than those with one,
- * because they are much more generic.
+ * The build functions of each class type. Items without class name match
+ * any class of the type, so they should be placed last, because they are
+ * much more generic.
  */
-const struct build_function_map object_build_map[] = {
+static const struct build_function_map base_build_map[] = {
 	{"Base", "manifest", "SectionManifest", &tplg_build_generic_object, NULL, NULL},
 	{"Base", "data", "SectionData", &tplg_build_data_object, NULL, &data_config},
 	{"Base", "tlv", "SectionTLV", &tplg_build_tlv_object, NULL, NULL},
@@ -1017,14 +989,26 @@ const struct build_function_map object_build_map[] = {
 	 &hwcfg_config},
 	{"Base", "fe_dai", "dai", &tplg_build_fe_dai_object, NULL, &fe_dai_config},
 	{"Base", "route", "SectionGraph", &tplg_build_dapm_route_object, NULL, NULL},
+};
+
+static const struct build_function_map widget_build_map[] = {
 	{"Widget", "buffer", "SectionWidget", &tplg_build_generic_object,
 	 tplg_update_buffer_auto_attr, &widget_config},
 	{"Widget", "", "SectionWidget", &tplg_build_generic_object, NULL, &widget_config},
+};
+
+static const struct build_function_map control_build_map[] = {
 	{"Control", "mixer", "SectionControlMixer", &tplg_build_mixer_control, NULL,
 	 &mixer_control_config},
 	{"Control", "bytes", "SectionControlBytes", &tplg_build_bytes_control, NULL,
 	 &bytes_control_config},
+};
+
+static const struct build_function_map dai_build_map[] = {
 	{"Dai", "", "SectionBE", &tplg_build_generic_object, NULL, &be_dai_config},
+};
+
+static const struct build_function_map pcm_build_map[] = {
 	{"PCM", "pcm", "SectionPCM", &tplg_build_generic_object, NULL, &pcm_config},
 	{"PCM", "pcm_caps", "SectionPCMCapabilities", &tplg_build_pcm_caps_object,
 	 NULL, &pcm_caps_config},
@@ -1035,8 +1019,9 @@ static const struct build_function_map *tplg_object_get_map(struct tplg_pre_proc
 {
 	snd_config_iterator_t first;
 	snd_config_t *class;
+	const struct build_function_map *map;
 	const char *class_type, *class_name;
-	unsigned int i;
+	unsigned int i, count;
 
 	first = snd_config_iterator_first(obj);
 	class = snd_config_iterator_entry(first);
@@ -1047,20 +1032,38 @@ static const struct build_function_map *tplg_object_get_map(struct tplg_pre_proc
 	if (snd_config_get_id(obj, &class_type) < 0)
 		return NULL;
 
-	for (i = 0; i < ARRAY_SIZE(object_build_map); i++) {
-		if (!strcmp(class_type, "Widget") &&
-		    !strcmp(object_build_map[i].class_type, "Widget") &&
-			!strcmp(object_build_map[i].class_name, ""))
-			return &object_build_map[i];
+	/* pick the table of the class type, the first character is unique */
+	switch (class_type[0]) {
+	case 'B':
+		map = base_build_map;
+		count = ARRAY_SIZE(base_build_map);
+		break;
+	case 'W':
+		map = widget_build_map;
+		count = ARRAY_SIZE(widget_build_map);
+		break;
+	case 'C':
+		map = control_build_map;
+		count = ARRAY_SIZE(control_build_map);
+		break;
+	case 'D':
+		map = dai_build_map;
+		count = ARRAY_SIZE(dai_build_map);
+		break;
+	case 'P':
+		map = pcm_build_map;
+		count = ARRAY_SIZE(pcm_build_map);
+		break;
+	default:
+		return NULL;
+	}
 
-		if (!strcmp(class_type, "Dai") &&
-		    !strcmp(object_build_map[i].class_type, "Dai"))
-			return &object_build_map[i];
+	if (strcmp(class_type, map->class_type))
+		return NULL;
 
-		/* for other type objects, also match the object class_name */
-		if (!strcmp(class_type, object_build_map[i].class_type) &&
-		    !strcmp(object_build_map[i].class_name, class_name))
-			return &object_build_map[i];
+	for (i = 0; i < count; i++) {
+		if (!map[i].class_name[0] || !strcmp(map[i].class_name, class_name))
+			return &map[i];
 	}
 
 	return NULL;
@@ -1213,7 +1216,7 @@ parent_object:
 			goto parent_class;
 
 		cfg = tplg_object_lookup_in_config(tplg_pp, parent_obj, class_type,
-						   class_name, obj_id);
+						   class_name, obj_id, false);
 		if (!cfg)
 			goto parent_class;
 
@@ -1232,7 +1235,7 @@ parent_class:
 			return -EINVAL;
 
 		cfg = tplg_object_lookup_in_config(tplg_pp, cfg, class_type,
-						   class_name, obj_id);
+						   class_name, obj_id, true);
 		if (!cfg)
 			goto check;
 
@@ -1288,8 +1291,7 @@ static int tplg_construct_object_name(struct tplg_pre_processor *tplg_pp, snd_co
 {
 	snd_config_iterator_t i, next;
 	snd_config_t *args, *n;
-	const char *id, *class_id, *obj_id, *s;
-	char *new_name;
+	const char *id, *class_id, *obj_id, *s, *new_name;
 	int ret;
 
 	/* find config for class constructor attributes. Nothing to do if not defined */
@@ -1302,35 +1304,30 @@ static int tplg_construct_object_name(struct tplg_pre_processor *tplg_pp, snd_co
 		return -EINVAL;
 	if (snd_config_get_id(class_cfg, &class_id) < 0)
 		return -EINVAL;
-	new_name = strdup(class_id);
-	if (!new_name)
-		return -ENOMEM;
+	new_name = class_id;
 
 	/* iterate through all class arguments and set object name */
 	snd_config_for_each(i, next, args) {
 		snd_config_t *arg;
-		char *arg_value, *temp;
+		const char *arg_value;
 
 		n = snd_config_iterator_entry(i);
 
 		if (snd_config_get_id(n, &id) < 0) {
 			SNDERR("Invalid ID for constructor argument\n");
-			ret = -EINVAL;
-			goto err;
+			return -EINVAL;
 		}
 
 		if (snd_config_get_string(n, &s) < 0) {
 			SNDERR("Invalid value for constructor argument\n");
-			ret = -EINVAL;
-			goto err;
+			return -EINVAL;
 		}
 
 		/* find and replace with value set in object */
 		ret = snd_config_search(obj, s, &arg);
 		if (ret < 0) {
 			SNDERR("Argument %s not set for object '%s.%s'\n", s, class_id, obj_id);
-			ret = -ENOENT;
-			goto err;
+			return -ENOENT;
 		}
 
 		/* concat arg value to object name. arg types must be either integer or string */
@@ -1341,11 +1338,9 @@ static int tplg_construct_object_name(struct tplg_pre_processor *tplg_pp, snd_co
 			ret = snd_config_get_integer(arg, &v);
 			assert(ret >= 0);
 
-			arg_value = tplg_snprintf("%ld", v);
-			if (!arg_value) {
-				ret = -ENOMEM;
-				goto err;
-			}
+			arg_value = tplg_pp_snprintf(tplg_pp, "%ld", v);
+			if (!arg_value)
+				return -ENOMEM;
 			break;
 		}
 		case SND_CONFIG_TYPE_STRING:
@@ -1355,35 +1350,22 @@ static int tplg_construct_object_name(struct tplg_pre_processor *tplg_pp, snd_co
 			ret = snd_config_get_string(arg, &s);
 			assert(ret >= 0);
 
-			arg_value = strdup(s);
-			if (!arg_value) {
-				ret = -ENOMEM;
-				goto err;
-			}
+			arg_value = s;
 			break;
 		}
 		default:
 			SNDERR("Argument '%s' in object '%s.%s' is not an integer or a string\n",
 			       s, class_id, obj_id);
-			ret = -EINVAL;
-			goto err;
+			return -EINVAL;
 		}
 
-		/* alloc and concat arg value to the name */
-		temp = tplg_snprintf("%s.%s", new_name, arg_value);
-		free(arg_value);
-		if (!temp) {
-			ret = -ENOMEM;
-			goto err;
-		}
-		free(new_name);
-		new_name = temp;
+		/* concat arg value to the name, the parts live in the pre-processor arena */
+		new_name = tplg_pp_snprintf(tplg_pp, "%s.%s", new_name, arg_value);
+		if (!new_name)
+			return -ENOMEM;
 	}
 
-	ret = snd_config_set_id(obj, new_name);
-err:
-	free(new_name);
-	return ret;
+	return snd_config_set_id(obj, new_name);
 }
 
 /* set the attribute value by type */
@@ -1500,6 +1482,7 @@ static int tplg_build_object(struct tplg_pre_processor *tplg_pp, snd_config_t *n
 	build_func builder;
 	update_auto_attr_func auto_attr_updater;
 	const char *id, *class_id;
+	long long start_ns;
 	int ret;
 
 	obj_local = tplg_object_get_instance_config(tplg_pp, new_obj);
@@ -1558,9 +1541,17 @@ static int tplg_build_object(struct tplg_pre_processor *tplg_pp, snd_config_t *n
 		builder = &tplg_build_parent_data;
 	}
 
+	start_ns = tplg_pp_stats_now(tplg_pp);
 	ret = builder(tplg_pp, new_obj, parent);
 	if (ret < 0)
 		return ret;
+	if (tplg_pp->stats) {
+		const char *class_type;
+
+		if (snd_config_get_id(new_obj, &class_type) >= 0)
+			tplg_pp_stats_build(tplg_pp, class_type, class_id,
+					    map ? map->section_name : "parent data", start_ns);
+	}
 
 	/* create child objects in the object instance */
 	ret = tplg_object_pre_process_children(tplg_pp, new_obj, obj_local);
@@ -1584,6 +1575,7 @@ int tplg_pre_process_objects(struct tplg_pre_processor *tplg_pp, snd_config_t *c
 	snd_config_iterator_t i, next, i2, next2;
 	snd_config_t *n, *n2, *_obj_type, *_obj_class, *_obj;
 	const char *id, *class_type, *class_name;
+	long long start_ns;
 	int ret;
 
 	if (snd_config_get_id(cfg, &class_type) < 0)
@@ -1636,8 +1628,12 @@ int tplg_pre_process_objects(struct tplg_pre_processor *tplg_pp, snd_config_t *c
 				snd_config_t *parent_instance, *parent_obj, *temp;
 				char *obj_cfg_name;
 
-				obj_cfg_name = tplg_snprintf("%s%s.%s.%s", "Object.",
-							     class_type, class_name, id);
+				obj_cfg_name = tplg_pp_snprintf(tplg_pp, "%s%s.%s.%s", "Object.",
+								class_type, class_name, id);
+				if (!obj_cfg_name) {
+					snd_config_delete(temp_n2);
+					return -ENOMEM;
+				}
 
 				/* search for object instance in the parent */
 				parent_instance = tplg_object_get_instance_config(tplg_pp, parent);
@@ -1645,7 +1641,6 @@ int tplg_pre_process_objects(struct tplg_pre_processor *tplg_pp, snd_config_t *c
 					goto temp_cfg;
 
 				ret = snd_config_search(parent_instance, obj_cfg_name, &parent_obj);
-				free(obj_cfg_name);
 				if (ret < 0)
 					goto temp_cfg;
 
@@ -1701,10 +1696,13 @@ temp_cfg:
 			}
 
 			/* Build the object now */
+			start_ns = tplg_pp_stats_now(tplg_pp);
 			ret = tplg_build_object(tplg_pp, _obj_type, parent);
 			if (ret < 0)
 				SNDERR("Error building object %s.%s.%s\n",
 				       class_type, class_name, id);
+			else
+				tplg_pp_stats_object(tplg_pp, class_type, class_name, start_ns);
 err:
 			snd_config_delete(temp_n2);
 			snd_config_delete(_obj_type);
@@ -23,6 +23,8 @@
 #include <stddef.h>
 #include <string.h>
 #include <errno.h>
+#include <time.h>
+#include <sys/resource.h>
 
 #include <alsa/input.h>
 #include <alsa/output.h>
@@ -98,6 +100,84 @@ char *tplg_snprintf(char *fmt, ...)
 	return string;
 }
 
+static void *tplg_arena_alloc(struct tplg_pre_processor *tplg_pp, size_t size)
+{
+	struct tplg_arena_block *block = tplg_pp->arena;
+	size_t block_size;
+	void *p;
+
+	/* keep the allocations aligned for anything but strings, too */
+	size = (size + 7) & ~(size_t)7;
+	if (!block || block->size - block->used < size) {
+		block_size = size > TPLG_ARENA_BLOCK_SIZE ? size : TPLG_ARENA_BLOCK_SIZE;
+		block = malloc(sizeof(*block) + block_size);
+		if (!block)
+			return NULL;
+		block->prev = tplg_pp->arena;
+		block->size = block_size;
+		block->used = 0;
+		tplg_pp->arena = block;
+	}
+
+	p = block->data + block->used;
+	block->used += size;
+	return p;
+}
+
+/* like tplg_snprintf() but the string lives in the pre-processor arena */
+char *tplg_pp_snprintf(struct tplg_pre_processor *tplg_pp, char *fmt, ...)
+{
+	char *string;
+	int len = 1;
+
+	va_list va;
+
+	va_start(va, fmt);
+	len += vsnprintf(NULL, 0, fmt, va);
+	va_end(va);
+
+	string = tplg_arena_alloc(tplg_pp, len);
+	if (!string)
+		return NULL;
+
+	va_start(va, fmt);
+	vsnprintf(string, len, fmt, va);
+	va_end(va);
+
+	return string;
+}
+
+char *tplg_pp_strdup(struct tplg_pre_processor *tplg_pp, const char *s)
+{
+	size_t len = strlen(s) + 1;
+	char *string;
+
+	string = tplg_arena_alloc(tplg_pp, len);
+	if (string)
+		memcpy(string, s, len);
+	return string;
+}
+
+void tplg_arena_get_mark(struct tplg_pre_processor *tplg_pp, struct tplg_arena_mark *mark)
+{
+	mark->block = tplg_pp->arena;
+	mark->used = tplg_pp->arena ? tplg_pp->arena->used : 0;
+}
+
+/* free everything allocated after the mark, a NULL mark frees all */
+void tplg_arena_release(struct tplg_pre_processor *tplg_pp, const struct tplg_arena_mark *mark)
+{
+	struct tplg_arena_block *block;
+
+	while (tplg_pp->arena && (!mark || tplg_pp->arena != mark->block)) {
+		block = tplg_pp->arena;
+		tplg_pp->arena = block->prev;
+		free(block);
+	}
+	if (mark && tplg_pp->arena)
+		tplg_pp->arena->used = mark->used;
+}
+
 #ifdef TPLG_DEBUG
 void tplg_pp_debug(char *fmt, ...)
 {
@@ -120,10 +200,165 @@ void tplg_pp_debug(char *fmt, ...) {}
 void tplg_pp_config_debug(struct tplg_pre_processor *tplg_pp, snd_config_t *cfg){}
 #endif
 
+/* statistics helpers */
+int tplg_pp_enable_stats(struct tplg_pre_processor *tplg_pp)
+{
+	tplg_pp->stats = calloc(1, sizeof(*tplg_pp->stats));
+	if (!tplg_pp->stats)
+		return -ENOMEM;
+	return 0;
+}
+
+long long tplg_pp_stats_now(struct tplg_pre_processor *tplg_pp)
+{
+	struct timespec ts;
+
+	if (!tplg_pp->stats)
+		return 0;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static struct tplg_pp_stats_entry *stats_entry(struct tplg_pp_stats_entry **list,
+					       const char *name1, const char *name2)
+{
+	struct tplg_pp_stats_entry *e;
+	size_t len1 = strlen(name1);
+
+	for (e = *list; e; e = e->next) {
+		if (!strncmp(e->name, name1, len1) &&
+		    (name2 ? e->name[len1] == '.' && !strcmp(e->name + len1 + 1, name2)
+			   : e->name[len1] == '\0'))
+			return e;
+	}
+
+	e = calloc(1, sizeof(*e));
+	if (!e)
+		return NULL;
+	e->name = name2 ? tplg_snprintf("%s.%s", name1, name2) : strdup(name1);
+	if (!e->name) {
+		free(e);
+		return NULL;
+	}
+	e->next = *list;
+	*list = e;
+	return e;
+}
+
+/* an object of the class is built, start_ns is the time before building it */
+void tplg_pp_stats_object(struct tplg_pre_processor *tplg_pp, const char *class_type,
+			  const char *class_name, long long start_ns)
+{
+	struct tplg_pp_stats_entry *e;
+
+	if (!tplg_pp->stats)
+		return;
+	tplg_pp->stats->objects++;
+	e = stats_entry(&tplg_pp->stats->classes, class_type, class_name);
+	if (!e)
+		return;
+	e->count++;
+	e->total_ns += tplg_pp_stats_now(tplg_pp) - start_ns;
+}
+
+/* the build function of an object returned, start_ns is the time of the call */
+void tplg_pp_stats_build(struct tplg_pre_processor *tplg_pp, const char *class_type,
+			 const char *class_name, const char *builder, long long start_ns)
+{
+	struct tplg_pp_stats_entry *e;
+	long long ns;
+
+	if (!tplg_pp->stats)
+		return;
+	ns = tplg_pp_stats_now(tplg_pp) - start_ns;
+	e = stats_entry(&tplg_pp->stats->classes, class_type, class_name);
+	if (e)
+		e->build_ns += ns;
+	e = stats_entry(&tplg_pp->stats->builders, builder, NULL);
+	if (e) {
+		e->count++;
+		e->build_ns += ns;
+		e->total_ns += ns;
+	}
+}
+
+static int stats_entry_cmp(const void *a, const void *b)
+{
+	const struct tplg_pp_stats_entry *e1 = *(const struct tplg_pp_stats_entry **)a;
+	const struct tplg_pp_stats_entry *e2 = *(const struct tplg_pp_stats_entry **)b;
+
+	if (e1->build_ns != e2->build_ns)
+		return e1->build_ns < e2->build_ns ? 1 : -1;
+	return strcmp(e1->name, e2->name);
+}
+
+/* print the entries sorted by the build time, the slowest first */
+static void stats_print_list(struct tplg_pp_stats_entry *list, const char *title)
+{
+	struct tplg_pp_stats_entry *e, **sorted;
+	unsigned int i, count = 0;
+
+	for (e = list; e; e = e->next)
+		count++;
+	if (!count)
+		return;
+	sorted = calloc(count, sizeof(*sorted));
+	if (!sorted)
+		return;
+	for (i = 0, e = list; e; e = e->next)
+		sorted[i++] = e;
+	qsort(sorted, count, sizeof(*sorted), stats_entry_cmp);
+
+	fprintf(stderr, "%-40s %8s %12s %12s\n", title, "count", "build us", "total us");
+	for (i = 0; i < count; i++)
+		fprintf(stderr, "%-40s %8u %12lld %12lld\n", sorted[i]->name, sorted[i]->count,
+			sorted[i]->build_ns / 1000, sorted[i]->total_ns / 1000);
+	free(sorted);
+}
+
+static unsigned int stats_count_nodes(snd_config_t *cfg)
+{
+	snd_config_iterator_t i, next;
+	unsigned int count = 1;
+
+	if (snd_config_get_type(cfg) != SND_CONFIG_TYPE_COMPOUND)
+		return count;
+	snd_config_for_each(i, next, cfg)
+		count += stats_count_nodes(snd_config_iterator_entry(i));
+	return count;
+}
+
+static void stats_print(struct tplg_pre_processor *tplg_pp)
+{
+	struct tplg_pp_stats *stats = tplg_pp->stats;
+	struct rusage usage;
+
+	fprintf(stderr, "pre-process: %u objects, %u output config nodes, %lld us\n",
+		stats->objects, stats_count_nodes(tplg_pp->output_cfg),
+		(tplg_pp_stats_now(tplg_pp) - stats->start_ns) / 1000);
+	if (getrusage(RUSAGE_SELF, &usage) == 0)
+		fprintf(stderr, "peak memory: %ld KiB\n", usage.ru_maxrss);
+	/* the total time of a class includes its child objects */
+	stats_print_list(stats->classes, "class");
+	stats_print_list(stats->builders, "build function");
+}
+
+static void stats_free_list(struct tplg_pp_stats_entry *list)
+{
+	struct tplg_pp_stats_entry *next;
+
+	for (; list; list = next) {
+		next = list->next;
+		free(list->name);
+		free(list);
+	}
+}
+
 static int pre_process_config(struct tplg_pre_processor *tplg_pp, snd_config_t *cfg)
 {
 	snd_config_iterator_t i, next, i2, next2;
 	snd_config_t *n, *n2;
+	struct tplg_arena_mark mark;
 	const char *id;
 	int err;
 
@@ -158,7 +393,9 @@ static int pre_process_config(struct tplg_pre_processor *tplg_pp, snd_config_t *
 			}
 
 			/* pre-process Object instance. Top-level object have no parent */
+			tplg_arena_get_mark(tplg_pp, &mark);
 			err = tplg_pre_process_objects(tplg_pp, n2, NULL);
+			tplg_arena_release(tplg_pp, &mark);
 			if (err < 0)
 				return err;
 		}
@@ -172,6 +409,12 @@ void free_pre_preprocessor(struct tplg_pre_processor *tplg_pp)
 	snd_output_close(tplg_pp->output);
 	snd_output_close(tplg_pp->dbg_output);
 	snd_config_delete(tplg_pp->output_cfg);
+	tplg_arena_release(tplg_pp, NULL);
+	if (tplg_pp->stats) {
+		stats_free_list(tplg_pp->stats->classes);
+		stats_free_list(tplg_pp->stats->builders);
+		free(tplg_pp->stats);
+	}
 	free(tplg_pp);
 }
 
@@ -224,6 +467,47 @@ err:
 	return ret;
 }
 
+/*
+ * Pre-process an already parsed configuration tree. The tree is owned by
+ * the caller, so a base tree can be copied and processed several times.
+ */
+int pre_process_tree(struct tplg_pre_processor *tplg_pp, snd_config_t *top)
+{
+	int err;
+
+	tplg_pp->input_cfg = top;
+	if (tplg_pp->stats)
+		tplg_pp->stats->start_ns = tplg_pp_stats_now(tplg_pp);
+
+	err = tplg_class_build_index(tplg_pp);
+	if (err < 0) {
+		fprintf(stderr, "Unable to index the classes\n");
+		goto err;
+	}
+
+	err = pre_process_config(tplg_pp, top);
+	if (err >= 0)
+		err = tplg_dapm_check_routes(tplg_pp);
+	if (err < 0) {
+		fprintf(stderr, "Unable to pre-process configuration\n");
+		goto err;
+	}
+
+	/* save config to output */
+	err = snd_config_save(tplg_pp->output_cfg, tplg_pp->output);
+	if (err < 0)
+		fprintf(stderr, "failed to save pre-processed output file\n");
+
+	if (tplg_pp->stats)
+		stats_print(tplg_pp);
+
+err:
+	tplg_dapm_free_widget_refs(tplg_pp);
+	tplg_class_free_index(tplg_pp);
+	tplg_pp->input_cfg = NULL;
+	return err;
+}
+
 int pre_process(struct tplg_pre_processor *tplg_pp, char *config, size_t config_size)
 {
 	snd_input_t *in;
@@ -249,18 +533,7 @@ int pre_process(struct tplg_pre_processor *tplg_pp, char *config, size_t config_
 		goto err;
 	}
 
-	tplg_pp->input_cfg = top;
-
-	err = pre_process_config(tplg_pp, top);
-	if (err < 0) {
-		fprintf(stderr, "Unable to pre-process configuration\n");
-		goto err;
-	}
-
-	/* save config to output */
-	err = snd_config_save(tplg_pp->output_cfg, tplg_pp->output);
-	if (err < 0)
-		fprintf(stderr, "failed to save pre-processed output file\n");
+	err = pre_process_tree(tplg_pp, top);
 
 err:
 	snd_config_delete(top);
@@ -47,7 +47,30 @@ struct build_function_map {
 	const struct config_template_items *template_items;
 };
 
-extern const struct build_function_map object_build_map[];
+/*
+ * Arena for the transient strings of the pre-processor, like the config IDs
+ * built to search for a node. The strings are never freed one by one, the
+ * arena is released to a mark after each top-level object and completely
+ * by free_pre_preprocessor().
+ */
+#define TPLG_ARENA_BLOCK_SIZE	8192
+
+struct tplg_arena_block {
+	struct tplg_arena_block *prev;
+	size_t size;
+	size_t used;
+	char data[];
+};
+
+struct tplg_arena_mark {
+	struct tplg_arena_block *block;
+	size_t used;
+};
+
+char *tplg_pp_snprintf(struct tplg_pre_processor *tplg_pp, char *fmt, ...);
+char *tplg_pp_strdup(struct tplg_pre_processor *tplg_pp, const char *s);
+void tplg_arena_get_mark(struct tplg_pre_processor *tplg_pp, struct tplg_arena_mark *mark);
+void tplg_arena_release(struct tplg_pre_processor *tplg_pp, const struct tplg_arena_mark *mark);
 
 /* debug helpers */
 void tplg_pp_debug(char *fmt, ...);
@@ -95,6 +118,68 @@ const char *tplg_object_get_name(struct tplg_pre_processor *tplg_pp,
 				 snd_config_t *object);
 snd_config_t *tplg_object_get_section(struct tplg_pre_processor *tplg_pp, snd_config_t *class);
 
+/*
+ * Hash index of the class definitions in input_cfg, built once per
+ * pre_process(). The classes are indexed as "type.name" with a NULL scope,
+ * the attribute definitions and the objects declared in a class with the
+ * class as the scope, as "name" and "type.class.id".
+ */
+struct tplg_index_entry {
+	struct tplg_index_entry *next;
+	unsigned int hash;
+	snd_config_t *scope;
+	char *key;
+	snd_config_t *cfg;
+};
+
+int tplg_class_build_index(struct tplg_pre_processor *tplg_pp);
+void tplg_class_free_index(struct tplg_pre_processor *tplg_pp);
+snd_config_t *tplg_class_index_find(struct tplg_pre_processor *tplg_pp, snd_config_t *scope,
+				    const char **parts, int count);
+
+/*
+ * Pre-process statistics: the objects built and the time spent per class,
+ * the time spent in each build function, reported by pre_process_tree().
+ */
+struct tplg_pp_stats_entry {
+	struct tplg_pp_stats_entry *next;
+	char *name;
+	unsigned int count;
+	long long total_ns;	/* including the child objects */
+	long long build_ns;	/* in the build function only */
+};
+
+struct tplg_pp_stats {
+	struct tplg_pp_stats_entry *classes;
+	struct tplg_pp_stats_entry *builders;
+	unsigned int objects;
+	long long start_ns;
+};
+
+long long tplg_pp_stats_now(struct tplg_pre_processor *tplg_pp);
+void tplg_pp_stats_object(struct tplg_pre_processor *tplg_pp, const char *class_type,
+			  const char *class_name, long long start_ns);
+void tplg_pp_stats_build(struct tplg_pre_processor *tplg_pp, const char *class_type,
+			 const char *class_name, const char *builder, long long start_ns);
+
+/*
+ * Route endpoint cache: the widget name built for an endpoint string and
+ * route index, NULL when the endpoint cannot be resolved. The routes with
+ * unresolved endpoints are reported together by tplg_dapm_check_routes().
+ */
+#define TPLG_WIDGET_REFS_SIZE	1024
+
+struct tplg_widget_ref {
+	struct tplg_widget_ref *next;
+	unsigned int hash;
+	long index;
+	char *name;
+	char string[];
+};
+
+int tplg_dapm_check_routes(struct tplg_pre_processor *tplg_pp);
+void tplg_dapm_free_widget_refs(struct tplg_pre_processor *tplg_pp);
+
 /* class helpers */
 snd_config_t *tplg_class_lookup(struct tplg_pre_processor *tplg_pp, snd_config_t *cfg);
 snd_config_t *tplg_class_find_attribute_by_name(struct tplg_pre_processor *tplg_pp,
@@ -29,8 +29,11 @@
 #include <errno.h>
 #include <string.h>
 #include <sys/stat.h>
+#include <sys/mman.h>
 #include <getopt.h>
 #include <assert.h>
+#include <ctype.h>
+#include <pthread.h>
 
 #include <alsa/asoundlib.h>
 #include <alsa/topology.h>
@@ -39,6 +42,10 @@
 #include "topology.h"
 
 bool pre_process_config = false;
+static const char *depfile;
+static const char *cache_file;
+static const char *class_cache_file;
+static bool pre_process_stats;
 
 static snd_output_t *log;
 
@@ -51,11 +58,18 @@ _("Usage: %s [OPTIONS]...\n"
 "-c, --compile=FILE      compile configuration file\n"
 "-p, --pre-process       pre-process Topology2.0 configuration file before compilation\n"
 "-P, --pre-process=FILE  pre-process Topology2.0 configuration file\n"
+"-S, --stats             print the pre-processor statistics to stderr\n"
 "-d, --decode=FILE       decode binary topology file\n"
 "-n, --normalize=FILE    normalize configuration file\n"
 "-u, --dump=FILE         dump (reparse) configuration file\n"
 "-v, --verbose=LEVEL     set verbosity level (0...1)\n"
 "-o, --output=FILE       set output file\n"
+"-m, --multi=FILE        compile the variants listed in FILE from the -c source\n"
+"-j, --jobs=N            number of variants compiled in parallel\n"
+"-M, --depfile=FILE      write the make dependencies of the output, skip\n"
+"                        the compilation when the output is up to date\n"
+"-C, --cache=FILE        keep the pre-processed configuration for -M\n"
+"-L, --class-cache=FILE  keep the parsed include files of the source for -p\n"
 "-s, --sort              sort the identifiers in the normalized output\n"
 "-g, --group             save configuration by group indexes\n"
 "-x, --nocheck           save configuration without additional integrity checks\n"
@@ -74,12 +88,18 @@ _("%s version %s\n"
    snd_asoundlib_version(), snd_tplg_version());
 }
 
-static int load(const char *source_file, void **dst, size_t *dst_size)
+/*
+ * Regular files are mapped, unless the caller passes no mapped flag because
+ * it needs a private heap copy. Anything else (stdin, pipes) is read into
+ * a growing buffer. Release the result with unload().
+ */
+static int load(const char *source_file, void **dst, size_t *dst_size, bool *mapped)
 {
 	int fd;
 	void *buf, *buf2;
 	size_t size, pos;
 	ssize_t r;
+	struct stat st;
 
 	if (strcmp(source_file, "-") == 0) {
 		fd = fileno(stdin);
@@ -92,6 +112,23 @@ static int load(const char *source_file, void **dst, size_t *dst_size)
 		}
 	}
 
+	if (mapped) {
+		*mapped = false;
+		if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0) {
+			/* private writable pages, the copy is made only on write */
+			buf = mmap(NULL, st.st_size, PROT_READ | PROT_WRITE,
+				   MAP_PRIVATE, fd, 0);
+			if (buf != MAP_FAILED) {
+				if (fd != fileno(stdin))
+					close(fd);
+				*dst = buf;
+				*dst_size = st.st_size;
+				*mapped = true;
+				return 0;
+			}
+		}
+	}
+
 	size = 16*1024;
 	pos = 0;
 	buf = malloc(size);
@@ -104,7 +141,10 @@ static int load(const char *source_file, void **dst, size_t *dst_size)
 		if (r <= 0)
 			break;
 		pos += r;
-		size += 8*1024;
+		if (pos < size)
+			continue;
+		/* grow geometrically so large inputs are not copied over and over */
+		size *= 2;
 		buf2 = realloc(buf, size);
 		if (buf2 == NULL)
 			goto _nomem;
@@ -131,6 +171,14 @@ _err:
 	return 1;
 }
 
+static void unload(void *buf, size_t size, bool mapped)
+{
+	if (mapped)
+		munmap(buf, size);
+	else
+		free(buf);
+}
+
 static int load_topology(snd_tplg_t **tplg, char *config,
 			 size_t config_size, int cflags)
 {
@@ -212,13 +260,14 @@ static int dump(const char *source_file, const char *output_file, int cflags, in
 	snd_tplg_t *tplg;
 	char *config, *text;
 	size_t size;
+	bool mapped;
 	int err;
 
-	err = load(source_file, (void **)&config, &size);
+	err = load(source_file, (void **)&config, &size, &mapped);
 	if (err)
 		return err;
 	err = load_topology(&tplg, config, size, cflags);
-	free(config);
+	unload(config, size, mapped);
 	if (err)
 		return err;
 	err = snd_tplg_save(tplg, &text, sflags);
@@ -233,15 +282,34 @@ static int dump(const char *source_file, const char *output_file, int cflags, in
 	return err;
 }
 
+/* pre-process the source, the include files parsed by the class cache if set */
+static int pre_process_source(struct tplg_pre_processor *tplg_pp, char *config,
+			      size_t config_size)
+{
+	snd_config_t *top;
+	int err;
+
+	if (!class_cache_file)
+		return pre_process(tplg_pp, config, config_size);
+
+	err = tplg_class_cache_load(class_cache_file, config, config_size, &top);
+	if (err < 0)
+		return err;
+	err = pre_process_tree(tplg_pp, top);
+	snd_config_delete(top);
+	return err;
+}
+
 /* Convert Topology2.0 conf to the existing conf syntax */
 static int pre_process_conf(const char *source_file, const char *output_file)
 {
 	struct tplg_pre_processor *tplg_pp;
 	size_t config_size;
 	char *config;
+	bool mapped;
 	int err;
 
-	err = load(source_file, (void **)&config, &config_size);
+	err = load(source_file, (void **)&config, &config_size, &mapped);
 	if (err)
 		return err;
 
@@ -249,72 +317,414 @@ static int pre_process_conf(const char *source_file, const char *output_file)
 	err = init_pre_precessor(&tplg_pp, SND_OUTPUT_STDIO, output_file);
 	if (err < 0) {
 		fprintf(stderr, _("failed to init pre-processor for Topology2.0\n"));
-		free(config);
+		unload(config, config_size, mapped);
 		return err;
 	}
 
+	if (pre_process_stats)
+		tplg_pp_enable_stats(tplg_pp);
+
 	/* pre-process conf file */
-	err = pre_process(tplg_pp, config, config_size);
+	err = pre_process_source(tplg_pp, config, config_size);
 
 	/* free pre-processor */
 	free_pre_preprocessor(tplg_pp);
-	free(config);
+	unload(config, config_size, mapped);
 	return err;
 }
 
+/*
+ * The pre-processed configuration is kept in the cache file and reused
+ * while it is newer than all the files listed in the depfile.
+ */
+static int load_cache(char **config, size_t *config_size, bool *mapped)
+{
+	if (!cache_file || !depfile || !pre_process_config)
+		return 1;
+	if (!tplg_deps_up_to_date(depfile, cache_file))
+		return 1;
+	return load(cache_file, (void **)config, config_size, mapped);
+}
+
+static void update_deps(const char *source_file, const char *output_file,
+			char *pconfig, size_t pconfig_size)
+{
+	struct tplg_deps deps;
+
+	if (!depfile)
+		return;
+	if (cache_file && pconfig && save(cache_file, pconfig, pconfig_size))
+		return;
+	if (tplg_deps_scan(&deps, source_file) < 0) {
+		fprintf(stderr, _("Unable to scan the dependencies of '%s'\n"), source_file);
+		return;
+	}
+	tplg_deps_write(&deps, depfile, output_file);
+	tplg_deps_free(&deps);
+}
+
 static int compile(const char *source_file, const char *output_file, int cflags)
 {
 	struct tplg_pre_processor *tplg_pp = NULL;
 	snd_tplg_t *tplg;
-	char *config;
+	char *config, *pconfig = NULL;
 	void *bin;
-	size_t config_size, size;
+	size_t config_size, pconfig_size = 0, size;
+	bool mapped;
+	bool track = depfile && strcmp(source_file, "-") && strcmp(output_file, "-");
 	int err;
 
-	err = load(source_file, (void **)&config, &config_size);
+	/* nothing changed since the last run */
+	if (track && tplg_deps_up_to_date(depfile, output_file))
+		return 0;
+
+	if (track && load_cache(&config, &config_size, &mapped) == 0) {
+		err = load_topology(&tplg, config, config_size, cflags);
+		unload(config, config_size, mapped);
+		if (err)
+			return err;
+		goto build;
+	}
+
+	err = load(source_file, (void **)&config, &config_size, &mapped);
 	if (err)
 		return err;
 
 	/* pre-process before compiling */
 	if (pre_process_config) {
-		char *pconfig;
-		size_t size;
-
 		/* init pre-processor */
 		init_pre_precessor(&tplg_pp, SND_OUTPUT_BUFFER, NULL);
+		if (pre_process_stats)
+			tplg_pp_enable_stats(tplg_pp);
 
 		/* pre-process conf file */
-		err = pre_process(tplg_pp, config, config_size);
+		err = pre_process_source(tplg_pp, config, config_size);
 		if (err) {
 			free_pre_preprocessor(tplg_pp);
-			free(config);
+			unload(config, config_size, mapped);
 			return err;
 		}
 
 		/* load topology */
-		size = snd_output_buffer_string(tplg_pp->output, &pconfig);
-		err = load_topology(&tplg, pconfig, size, cflags);
-
-		/* free pre-processor */
-		free_pre_preprocessor(tplg_pp);
+		pconfig_size = snd_output_buffer_string(tplg_pp->output, &pconfig);
+		err = load_topology(&tplg, pconfig, pconfig_size, cflags);
+		if (err) {
+			free_pre_preprocessor(tplg_pp);
+			tplg_pp = NULL;
+		}
 	} else {
 		err = load_topology(&tplg, config, config_size, cflags);
 	}
-	free(config);
+	unload(config, config_size, mapped);
 	if (err)
 		return err;
+build:
 	err = snd_tplg_build_bin(tplg, &bin, &size);
 	snd_tplg_free(tplg);
 	if (err < 0 || size == 0) {
 		fprintf(stderr, _("failed to compile context %s: %s\n"),
 			source_file, snd_strerror(-err));
+		if (tplg_pp)
+			free_pre_preprocessor(tplg_pp);
 		return 1;
 	}
 	err = save(output_file, bin, size);
 	free(bin);
+	if (!err && track)
+		update_deps(source_file, output_file, pconfig, pconfig_size);
+
+	/* free pre-processor */
+	if (tplg_pp)
+		free_pre_preprocessor(tplg_pp);
 	return err;
 }
 
+/*
+ * Multi-output mode: the source is parsed once (including the shared
+ * class files it includes) and each variant gets a copy of that tree
+ * with its own config files loaded over it. The copies are pre-processed
+ * and compiled on worker threads.
+ *
+ * Each non-empty line of the list file is "OUTPUT [CONF...]", a '#'
+ * starts a comment.
+ */
+struct tplg_variant {
+	char *output;
+	char **confs;
+	int confs_count;
+	int err;
+};
+
+struct tplg_multi {
+	snd_config_t *base;
+	struct tplg_variant *variants;
+	int count;
+	int next;
+	int cflags;
+	pthread_mutex_t mutex;
+};
+
+static int load_config(snd_config_t *top, const char *source_file)
+{
+	snd_input_t *in;
+	char *config;
+	size_t size;
+	bool mapped;
+	int err;
+
+	err = load(source_file, (void **)&config, &size, &mapped);
+	if (err)
+		return -EINVAL;
+	err = snd_input_buffer_open(&in, config, size);
+	if (err < 0) {
+		unload(config, size, mapped);
+		return err;
+	}
+	err = snd_config_load(top, in);
+	snd_input_close(in);
+	unload(config, size, mapped);
+	if (err < 0)
+		fprintf(stderr, _("Unable to load configuration '%s': %s\n"),
+			source_file, snd_strerror(-err));
+	return err;
+}
+
+static int compile_variant(struct tplg_multi *multi, struct tplg_variant *variant)
+{
+	struct tplg_pre_processor *tplg_pp = NULL;
+	snd_output_t *out = NULL;
+	snd_config_t *top;
+	snd_tplg_t *tplg;
+	char *config;
+	void *bin;
+	size_t size;
+	int i, err;
+
+	err = snd_config_copy(&top, multi->base);
+	if (err < 0)
+		return err;
+	for (i = 0; i < variant->confs_count; i++) {
+		err = load_config(top, variant->confs[i]);
+		if (err < 0)
+			goto out;
+	}
+
+	if (pre_process_config) {
+		err = init_pre_precessor(&tplg_pp, SND_OUTPUT_BUFFER, NULL);
+		if (err < 0)
+			goto out;
+		if (pre_process_stats)
+			tplg_pp_enable_stats(tplg_pp);
+		err = pre_process_tree(tplg_pp, top);
+		if (err < 0)
+			goto out;
+		size = snd_output_buffer_string(tplg_pp->output, &config);
+	} else {
+		err = snd_output_buffer_open(&out);
+		if (err < 0)
+			goto out;
+		err = snd_config_save(top, out);
+		if (err < 0)
+			goto out;
+		size = snd_output_buffer_string(out, &config);
+	}
+
+	err = load_topology(&tplg, config, size, multi->cflags);
+	if (err) {
+		err = -EINVAL;
+		goto out;
+	}
+	err = snd_tplg_build_bin(tplg, &bin, &size);
+	snd_tplg_free(tplg);
+	if (err < 0 || size == 0) {
+		fprintf(stderr, _("failed to compile variant %s: %s\n"),
+			variant->output, snd_strerror(-err));
+		err = -EINVAL;
+		goto out;
+	}
+	err = save(variant->output, bin, size) ? -EIO : 0;
+	free(bin);
+
+out:
+	if (tplg_pp)
+		free_pre_preprocessor(tplg_pp);
+	if (out)
+		snd_output_close(out);
+	snd_config_delete(top);
+	return err;
+}
+
+static void *compile_worker(void *arg)
+{
+	struct tplg_multi *multi = arg;
+	struct tplg_variant *variant;
+
+	while (1) {
+		pthread_mutex_lock(&multi->mutex);
+		if (multi->next >= multi->count) {
+			pthread_mutex_unlock(&multi->mutex);
+			break;
+		}
+		variant = &multi->variants[multi->next++];
+		pthread_mutex_unlock(&multi->mutex);
+		variant->err = compile_variant(multi, variant);
+	}
+	return NULL;
+}
+
+static void free_variants(struct tplg_variant *variants, int count)
+{
+	int i, j;
+
+	for (i = 0; i < count; i++) {
+		free(variants[i].output);
+		for (j = 0; j < variants[i].confs_count; j++)
+			free(variants[i].confs[j]);
+		free(variants[i].confs);
+	}
+	free(variants);
+}
+
+static char *next_word(char **s)
+{
+	char *p = *s, *word;
+
+	while (isspace(*p))
+		p++;
+	if (*p == '\0' || *p == '#')
+		return NULL;
+	word = p;
+	while (*p && !isspace(*p))
+		p++;
+	if (*p)
+		*p++ = '\0';
+	*s = p;
+	return word;
+}
+
+static int load_variants(const char *list_file, struct tplg_variant **variants)
+{
+	struct tplg_variant *v = NULL, *v2, *variant;
+	char **confs;
+	char *list, *line, *next, *word;
+	size_t size;
+	int count = 0;
+
+	if (load(list_file, (void **)&list, &size, NULL))
+		return -EINVAL;
+	/* make it a string */
+	next = realloc(list, size + 1);
+	if (next == NULL)
+		goto _nomem;
+	list = next;
+	list[size] = '\0';
+
+	for (line = list; line; line = next) {
+		next = strchr(line, '\n');
+		if (next)
+			*next++ = '\0';
+		word = next_word(&line);
+		if (word == NULL)
+			continue;
+		v2 = realloc(v, (count + 1) * sizeof(*v));
+		if (v2 == NULL)
+			goto _nomem;
+		v = v2;
+		variant = &v[count++];
+		memset(variant, 0, sizeof(*variant));
+		variant->output = strdup(word);
+		if (variant->output == NULL)
+			goto _nomem;
+		while ((word = next_word(&line)) != NULL) {
+			confs = realloc(variant->confs,
+					(variant->confs_count + 1) * sizeof(*confs));
+			if (confs == NULL)
+				goto _nomem;
+			variant->confs = confs;
+			confs[variant->confs_count] = strdup(word);
+			if (confs[variant->confs_count] == NULL)
+				goto _nomem;
+			variant->confs_count++;
+		}
+	}
+	free(list);
+	if (count == 0) {
+		fprintf(stderr, _("No variants in '%s'\n"), list_file);
+		return -EINVAL;
+	}
+	*variants = v;
+	return count;
+
+_nomem:
+	fprintf(stderr, _("No enough memory\n"));
+	free_variants(v, count);
+	free(list);
+	return -ENOMEM;
+}
+
+static int compile_multi(const char *source_file, const char *list_file,
+			 int cflags, int jobs)
+{
+	struct tplg_multi multi;
+	pthread_t *threads;
+	int i, started, err;
+
+	memset(&multi, 0, sizeof(multi));
+	multi.cflags = cflags;
+	pthread_mutex_init(&multi.mutex, NULL);
+
+	multi.count = load_variants(list_file, &multi.variants);
+	if (multi.count < 0)
+		return 1;
+
+	err = snd_config_top(&multi.base);
+	if (err < 0)
+		goto _free;
+	err = load_config(multi.base, source_file);
+	if (err < 0)
+		goto _free;
+
+	if (jobs <= 0)
+		jobs = sysconf(_SC_NPROCESSORS_ONLN);
+	if (jobs <= 0)
+		jobs = 1;
+	if (jobs > multi.count)
+		jobs = multi.count;
+
+	threads = calloc(jobs, sizeof(*threads));
+	if (threads == NULL) {
+		err = -ENOMEM;
+		goto _free;
+	}
+	for (started = 0; started < jobs; started++) {
+		if (pthread_create(&threads[started], NULL, compile_worker, &multi))
+			break;
+	}
+	/* the main thread takes over when no worker could be started */
+	if (started == 0)
+		compile_worker(&multi);
+	for (i = 0; i < started; i++)
+		pthread_join(threads[i], NULL);
+	free(threads);
+
+	err = 0;
+	for (i = 0; i < multi.count; i++) {
+		if (multi.variants[i].err == 0)
+			continue;
+		fprintf(stderr, _("Variant '%s' failed: %s\n"),
+			multi.variants[i].output,
+			snd_strerror(-multi.variants[i].err));
+		err = -EINVAL;
+	}
+
+_free:
+	if (multi.base)
+		snd_config_delete(multi.base);
+	free_variants(multi.variants, multi.count);
+	pthread_mutex_destroy(&multi.mutex);
+	return err ? 1 : 0;
+}
+
 static int decode(const char *source_file, const char *output_file,
 		  int cflags, int dflags, int sflags)
 {
@@ -322,17 +732,19 @@ static int decode(const char *source_file, const char *output_file,
 	void *bin;
 	char *text;
 	size_t size;
+	bool mapped;
 	int err;
 
-	if (load(source_file, &bin, &size))
+	if (load(source_file, &bin, &size, &mapped))
 		return 1;
 	tplg = snd_tplg_create(cflags);
 	if (tplg == NULL) {
 		fprintf(stderr, _("failed to create new topology context\n"));
+		unload(bin, size, mapped);
 		return 1;
 	}
 	err = snd_tplg_decode(tplg, bin, size, dflags);
-	free(bin);
+	unload(bin, size, mapped);
 	if (err < 0) {
 		snd_tplg_free(tplg);
 		fprintf(stderr, _("failed to decode context %s: %s\n"),
@@ -353,16 +765,22 @@ static int decode(const char *source_file, const char *output_file,
 
 int main(int argc, char *argv[])
 {
-	static const char short_options[] = "hc:d:n:u:v:o:pP:sgxzV";
+	static const char short_options[] = "hc:d:n:u:v:o:m:j:M:C:L:pP:SsgxzV";
 	static const struct option long_options[] = {
 		{"help", 0, NULL, 'h'},
 		{"verbose", 1, NULL, 'v'},
 		{"compile", 1, NULL, 'c'},
 		{"pre-process", 1, NULL, 'p'},
+		{"stats", 0, NULL, 'S'},
 		{"decode", 1, NULL, 'd'},
 		{"normalize", 1, NULL, 'n'},
 		{"dump", 1, NULL, 'u'},
 		{"output", 1, NULL, 'o'},
+		{"multi", 1, NULL, 'm'},
+		{"jobs", 1, NULL, 'j'},
+		{"depfile", 1, NULL, 'M'},
+		{"cache", 1, NULL, 'C'},
+		{"class-cache", 1, NULL, 'L'},
 		{"sort", 0, NULL, 's'},
 		{"group", 0, NULL, 'g'},
 		{"nocheck", 0, NULL, 'x'},
@@ -372,7 +790,9 @@ int main(int argc, char *argv[])
 	};
 	char *source_file = NULL;
 	char *output_file = NULL;
+	char *list_file = NULL;
 	int c, err, op = 'c', cflags = 0, dflags = 0, sflags = 0, option_index;
+	int jobs = 0;
 
 #ifdef ENABLE_NLS
 	setlocale(LC_ALL, "");
@@ -407,6 +827,21 @@ int main(int argc, char *argv[])
 		case 'o':
 			output_file = optarg;
 			break;
+		case 'm':
+			list_file = optarg;
+			break;
+		case 'j':
+			jobs = atoi(optarg);
+			break;
+		case 'M':
+			depfile = optarg;
+			break;
+		case 'C':
+			cache_file = optarg;
+			break;
+		case 'L':
+			class_cache_file = optarg;
+			break;
 		case 's':
 			sflags |= SND_TPLG_SAVE_SORT;
 			break;
@@ -417,6 +852,9 @@ int main(int argc, char *argv[])
 		case 'p':
 			pre_process_config = true;
 			break;
+		case 'S':
+			pre_process_stats = true;
+			break;
 		case 'g':
 			sflags |= SND_TPLG_SAVE_GROUPS;
 			break;
@@ -432,6 +870,16 @@ int main(int argc, char *argv[])
 		}
 	}
 
+	if (list_file) {
+		if (op != 'c' || source_file == NULL || output_file) {
+			fprintf(stderr, _("The multi-output mode needs a compile source and no output file\n"));
+			return 1;
+		}
+		err = compile_multi(source_file, list_file, cflags, jobs);
+		snd_output_close(log);
+		return err;
+	}
+
 	if (source_file == NULL || output_file == NULL) {
 		usage(argv[0]);
 		return 1;
@@ -18,6 +18,12 @@
 #define __TOPOLOGY_H
 
 #include <stdlib.h>
+#include <stdbool.h>
+
+struct tplg_index_entry;
+struct tplg_pp_stats;
+struct tplg_arena_block;
+struct tplg_widget_ref;
 
 /* pre_processor */
 struct tplg_pre_processor {
@@ -25,10 +31,42 @@ struct tplg_pre_processor {
 	snd_config_t *output_cfg;
 	snd_output_t *output;
 	snd_output_t *dbg_output;
+	/* class, attribute and class object index of input_cfg */
+	struct tplg_index_entry **index;
+	unsigned int index_size;
+	unsigned int index_count;
+	/* pre-process statistics, NULL unless enabled */
+	struct tplg_pp_stats *stats;
+	/* transient strings, see tplg_pp_snprintf() */
+	struct tplg_arena_block *arena;
+	/* route endpoint to widget name cache and the unresolved routes */
+	struct tplg_widget_ref **widget_refs;
+	char **unresolved_routes;
+	unsigned int unresolved_count;
 };
 
 int pre_process(struct tplg_pre_processor *tplg_pp, char *config, size_t config_size);
+int pre_process_tree(struct tplg_pre_processor *tplg_pp, snd_config_t *top);
 int init_pre_precessor(struct tplg_pre_processor **tplg_pp, snd_output_type_t type,
 		       const char *output_file);
 void free_pre_preprocessor(struct tplg_pre_processor *tplg_pp);
+int tplg_pp_enable_stats(struct tplg_pre_processor *tplg_pp);
+
+/* cache of the parsed include files */
+int tplg_class_cache_load(const char *cache_file, char *config, size_t config_size,
+			  snd_config_t **top);
+
+/* dependency tracking */
+struct tplg_deps {
+	char **files;		/* the source and all files it includes */
+	int count;
+	char **searchdirs;
+	int searchdirs_count;
+};
+
+int tplg_deps_scan(struct tplg_deps *deps, const char *source_file);
+int tplg_deps_scan_buffer(struct tplg_deps *deps, char *buf);
+void tplg_deps_free(struct tplg_deps *deps);
+int tplg_deps_write(struct tplg_deps *deps, const char *depfile, const char *target);
+bool tplg_deps_up_to_date(const char *depfile, const char *file);
 #endif